@@ -8,9 +8,13 @@
 #include <stdio.h>
 #include <string.h>
 #include <malloc.h>
+#include <stdlib.h>
 #include <app.h>
 #include <platform.h>
+#include <arch/mmu.h>
+#include <arch/user_copy.h>
 #include <kernel/thread.h>
+#include <kernel/vm.h>
 
 static uint8_t *src;
 static uint8_t *dst;
@@ -283,6 +287,172 @@ static void validate_memset(void)
     }
 }
 
+#if WITH_KERNEL_VM
+/* user copies run against a buffer in a scratch user address space */
+#define USER_SIZE (BUFFER_SIZE + 256)
+
+static vmm_aspace_t *user_aspace;
+static vmm_aspace_t *old_aspace;
+static uint8_t *user_buf;
+
+static bool usercopy_begin(void)
+{
+    if (vmm_create_aspace(&user_aspace, "usercopy", 0) < 0) {
+        printf("failed to create address space\n");
+        return false;
+    }
+    old_aspace = get_current_thread()->aspace;
+    vmm_set_active_aspace(user_aspace);
+
+    void *ptr;
+    if (vmm_alloc(user_aspace, "usercopy", USER_SIZE, &ptr, 0, VMM_FLAG_COMMIT,
+                  ARCH_MMU_FLAG_PERM_READ | ARCH_MMU_FLAG_PERM_WRITE |
+                  ARCH_MMU_FLAG_PERM_USER) < 0) {
+        printf("failed to allocate user buffer\n");
+        vmm_set_active_aspace(old_aspace);
+        vmm_free_aspace(user_aspace);
+        return false;
+    }
+    user_buf = ptr;
+    return true;
+}
+
+static void usercopy_end(void)
+{
+    vmm_set_active_aspace(old_aspace);
+    vmm_free_aspace(user_aspace);
+    user_buf = NULL;
+}
+
+static void validate_usercopy(void)
+{
+    size_t srcalign, dstalign, size;
+    const size_t maxsize = 300;
+    static const size_t large[] = { 4096, 65535, 262143, 262144, 262145, 1000001 };
+    int errors = 0;
+
+    printf("testing user copies for correctness\n");
+
+    if (!usercopy_begin())
+        return;
+
+    /*
+     * the same simple tests as for memcpy, in both directions, covering
+     * each of the size classes the copy routines treat differently.
+     * the kernel can't touch user_buf directly with SMAP on, so it is
+     * filled and checked with whole-buffer copies through kernel scratch
+     * buffers, which also checks those copies.
+     */
+    for (srcalign = 0; srcalign < 16; srcalign++) {
+        for (dstalign = 0; dstalign < 16; dstalign++) {
+            for (size = 0; size < maxsize; size++) {
+                fillbuf(src, maxsize * 2, 567);
+                fillbuf(dst, maxsize * 2, 123514);
+                fillbuf(dst2, maxsize * 2, 123514);
+                arch_copy_to_user(user_buf, dst, maxsize * 2);
+
+                c_memmove(dst + dstalign, src + srcalign, size);
+                if (arch_copy_to_user(user_buf + dstalign, src + srcalign, size) != NO_ERROR ||
+                    arch_copy_from_user(src2, user_buf, maxsize * 2) != NO_ERROR ||
+                    memcmp(src2, dst, maxsize * 2) != 0) {
+                    printf("error! to user: srcalign %zu, dstalign %zu, size %zu\n",
+                           srcalign, dstalign, size);
+                    errors++;
+                }
+
+                arch_copy_to_user(user_buf, src, maxsize * 2);
+                c_memmove(src2, dst2, maxsize * 2);
+                c_memmove(src2 + dstalign, src + srcalign, size);
+                if (arch_copy_from_user(dst2 + dstalign, user_buf + srcalign, size) != NO_ERROR ||
+                    memcmp(dst2, src2, maxsize * 2) != 0) {
+                    printf("error! from user: srcalign %zu, dstalign %zu, size %zu\n",
+                           srcalign, dstalign, size);
+                    errors++;
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < countof(large); i++) {
+        size = large[i];
+        for (dstalign = 0; dstalign < 16; dstalign += 5) {
+            fillbuf(src, size + 16, (uint32_t)size);
+            if (arch_copy_to_user(user_buf + dstalign, src, size) != NO_ERROR ||
+                arch_copy_from_user(dst2, user_buf + dstalign, size) != NO_ERROR ||
+                memcmp(dst2, src, size) != 0) {
+                printf("error! to user: dstalign %zu, size %zu\n", dstalign, size);
+                errors++;
+            }
+            memset(dst, 0, size + 16);
+            if (arch_copy_from_user(dst + dstalign, user_buf + dstalign, size) != NO_ERROR ||
+                memcmp(dst + dstalign, src, size) != 0) {
+                printf("error! from user: dstalign %zu, size %zu\n", dstalign, size);
+                errors++;
+            }
+        }
+    }
+
+    /* copies that run off the end of a mapping have to fail, not crash */
+    void *ptr;
+    if (vmm_alloc(user_aspace, "usercopy fault", PAGE_SIZE, &ptr, 0, VMM_FLAG_COMMIT,
+                  ARCH_MMU_FLAG_PERM_READ | ARCH_MMU_FLAG_PERM_WRITE |
+                  ARCH_MMU_FLAG_PERM_USER) == NO_ERROR) {
+        vmm_free_region(user_aspace, (vaddr_t)ptr);
+        static const size_t fault_sizes[] = { 1, 8, 24, 200, 4096, 300000 };
+        for (size_t i = 0; i < countof(fault_sizes); i++) {
+            size = fault_sizes[i];
+            if (arch_copy_to_user(ptr, src, size) == NO_ERROR ||
+                arch_copy_from_user(dst, ptr, size) == NO_ERROR) {
+                printf("error! copy of %zu bytes to an unmapped page succeeded\n", size);
+                errors++;
+            }
+        }
+    }
+
+    usercopy_end();
+    printf("%d errors\n", errors);
+}
+
+static void bench_usercopy(void)
+{
+    static const size_t sizes[] = {
+        4, 8, 16, 32, 64, 128, 256, 512, 1024, 4096, 16384, 65536, 262144, 1048576, BUFFER_SIZE
+    };
+
+    printf("user copy speed test\n");
+    thread_sleep(200); // let the debug string clear the serial port
+
+    if (!usercopy_begin())
+        return;
+
+    for (size_t i = 0; i < countof(sizes); i++) {
+        size_t size = sizes[i];
+        // copy 64MB each way, but make at least a few calls
+        uint32_t iterations = MAX(64 * 1024 * 1024 / size, 16u);
+        lk_bigtime_t to, from, t0;
+        uint32_t n;
+
+        t0 = current_time_hires();
+        for (n = 0; n < iterations; n++)
+            arch_copy_to_user(user_buf, src, size);
+        to = MAX(current_time_hires() - t0, 1u);
+
+        t0 = current_time_hires();
+        for (n = 0; n < iterations; n++)
+            arch_copy_from_user(dst, user_buf, size);
+        from = MAX(current_time_hires() - t0, 1u);
+
+        printf("size %7zu: ", size);
+        printf("to user %5llu ns/call, %llu bytes/sec; ",
+               to * 1000ULL / iterations, (uint64_t)size * iterations * 1000000ULL / to);
+        printf("from user %5llu ns/call, %llu bytes/sec\n",
+               from * 1000ULL / iterations, (uint64_t)size * iterations * 1000000ULL / from);
+    }
+
+    usercopy_end();
+}
+#endif // WITH_KERNEL_VM
+
 #if defined(WITH_LIB_CONSOLE)
 #include <lib/console.h>
 
@@ -306,6 +476,7 @@ static int string_tests(int argc, const cmd_args *argv)
 usage:
         printf("%s validate <routine>\n", argv[0].str);
         printf("%s bench <routine>\n", argv[0].str);
+        printf("routines: memcpy, memset, usercopy\n");
         goto out;
     }
 
@@ -314,12 +485,20 @@ usage:
             validate_memcpy();
         } else if (!strcmp(argv[2].str, "memset")) {
             validate_memset();
+#if WITH_KERNEL_VM
+        } else if (!strcmp(argv[2].str, "usercopy")) {
+            validate_usercopy();
+#endif
         }
     } else if (!strcmp(argv[1].str, "bench")) {
         if (!strcmp(argv[2].str, "memcpy")) {
             bench_memcpy();
         } else if (!strcmp(argv[2].str, "memset")) {
             bench_memset();
+#if WITH_KERNEL_VM
+        } else if (!strcmp(argv[2].str, "usercopy")) {
+            bench_usercopy();
+#endif
         }
     } else {
         goto usage;
@@ -15,6 +15,7 @@
 #include <kernel/thread.h>
 #include <platform.h>
 
+#include <lib/ktrace.h>
 #include <lib/user_copy.h>
 
 #if WITH_LIB_MAGENTA
@@ -257,6 +258,14 @@ void x86_exception_handler(x86_iframe_t *frame)
     // did we come from user or kernel space?
     bool from_user = SELECTOR_PL(frame->cs) != 0;
 
+    // exceptions are traced where they are handled, if at all
+    bool is_irq = frame->vector > X86_INT_MAX_INTEL_DEFINED;
+    if (is_irq)
+        ktrace(TAG_IRQ_ENTER, (uint32_t)frame->vector, 0, 0, 0);
+#if THREAD_STATS
+    lk_bigtime_t irq_start = is_irq ? current_time_hires() : 0;
+#endif
+
     // deliver the interrupt
     enum handler_return ret = INT_NO_RESCHEDULE;
 
@@ -300,6 +309,9 @@ void x86_exception_handler(x86_iframe_t *frame)
             break;
         }
         case X86_INT_APIC_TIMER: {
+#if ARCH_X86_64
+            ktrace_profile_irq(frame->ip, frame->rbp, from_user);
+#endif
             ret = apic_timer_interrupt_handler();
             apic_issue_eoi();
             break;
@@ -330,6 +342,13 @@ void x86_exception_handler(x86_iframe_t *frame)
             x86_unhandled_exception(frame);
     }
 
+#if THREAD_STATS
+    if (is_irq)
+        THREAD_STATS_ADD(irq_time, current_time_hires() - irq_start);
+#endif
+    if (is_irq)
+        ktrace(TAG_IRQ_EXIT, (uint32_t)frame->vector, 0, 0, 0);
+
     /* if we came from user space, check to see if we have any signals to handle */
     if (unlikely(from_user)) {
         /* in the case of receiving a kill signal, this function may not return,
@@ -111,6 +111,7 @@ void x86_feature_debug(void)
         { X86_FEATURE_AESNI, "aesni" },
         { X86_FEATURE_TSC_ADJUST, "tsc_adj" },
         { X86_FEATURE_SMEP, "smep" },
+        { X86_FEATURE_ERMS, "erms" },
         { X86_FEATURE_SMAP, "smap" },
         { X86_FEATURE_RDRAND, "rdrand" },
         { X86_FEATURE_RDSEED, "rdseed" },
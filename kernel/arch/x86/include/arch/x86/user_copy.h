@@ -5,27 +5,39 @@
 // https://opensource.org/licenses/MIT
 
 #pragma once
+
+/* flags for the x86 usercopy routines, used by assembly */
+#define X86_USER_COPY_SMAP  (1 << 0)    /* stac/clac around the copy */
+#define X86_USER_COPY_ERMS  (1 << 1)    /* rep movsb is fast for large copies */
+
+/* copies this large bypass the cache */
+#define X86_USER_COPY_NT_THRESHOLD (256 * 1024)
+
+#ifndef ASSEMBLY
+
 #include <magenta/compiler.h>
 
 __BEGIN_CDECLS
 
-/* These functions are identical to arch_copy_from_user, except they take an
- * additional argument of fault_return, used to handle page faults within the
- * function.  These should not be called anywhere except in the x86 usercopy
- * implementation. */
+/* These functions are identical to arch_copy_from_user, except they take
+ * additional arguments of X86_USER_COPY_* flags and fault_return, used to
+ * handle page faults within the function.  These should not be called
+ * anywhere except in the x86 usercopy implementation. */
 
 status_t _x86_copy_from_user(
         void *dst,
         const void *src,
         size_t len,
-        bool smap_avail,
+        uint32_t flags,
         void **fault_return);
 
 status_t _x86_copy_to_user(
         void *dst,
         const void *src,
         size_t len,
-        bool smap_avail,
+        uint32_t flags,
         void **fault_return);
 
 __END_CDECLS
+
+#endif // ASSEMBLY
@@ -173,6 +173,17 @@ int x86_apic_id_to_cpu_num(uint32_t apic_id)
     return -1;
 }
 
+uint32_t x86_cpu_num_to_apic_id(uint cpu_num)
+{
+    if (cpu_num == 0) {
+        return bp_percpu.apic_id;
+    }
+    if (cpu_num >= x86_num_cpus) {
+        return INVALID_APIC_ID;
+    }
+    return ap_percpus[cpu_num - 1].apic_id;
+}
+
 #if WITH_SMP
 status_t arch_mp_send_ipi(mp_cpu_mask_t target, mp_ipi_t ipi)
 {
@@ -12,6 +12,7 @@
 #include <debug.h>
 #include <dev/interrupt/arm_gic.h>
 #include <dev/interrupt/arm_gic_regs.h>
+#include <platform.h>
 #include <reg.h>
 #include <kernel/thread.h>
 #include <kernel/debug.h>
@@ -19,6 +20,7 @@
 #include <dev/interrupt.h>
 #include <arch/ops.h>
 #include <trace.h>
+#include <lib/ktrace.h>
 #if WITH_LIB_SM
 #include <lib/sm.h>
 #include <lib/sm/sm_err.h>
@@ -353,9 +355,18 @@ enum handler_return __platform_irq(struct iframe *frame)
 
     THREAD_STATS_INC(interrupts);
     KEVLOG_IRQ_ENTER(vector);
+    ktrace(TAG_IRQ_ENTER, vector, 0, 0, 0);
+#if THREAD_STATS
+    lk_bigtime_t irq_start = current_time_hires();
+#endif
 
     uint cpu = arch_curr_cpu_num();
 
+#if ARCH_ARM64
+    // the short iframe does not save x29, so no stack walk here
+    ktrace_profile_irq(frame->elr, 0, (frame->spsr & 0xf) == 0);
+#endif
+
     LTRACEF_LEVEL(2, "iar 0x%x cpu %u currthread %p vector %d pc 0x%lx\n", iar, cpu,
                   get_current_thread(), vector, (uintptr_t)IFRAME_PC(frame));
 
@@ -371,6 +382,10 @@ enum handler_return __platform_irq(struct iframe *frame)
 
     LTRACEF_LEVEL(2, "cpu %u exit %d\n", cpu, ret);
 
+#if THREAD_STATS
+    THREAD_STATS_ADD(irq_time, current_time_hires() - irq_start);
+#endif
+    ktrace(TAG_IRQ_EXIT, vector, 0, 0, 0);
     KEVLOG_IRQ_EXIT(vector);
 
     return ret;
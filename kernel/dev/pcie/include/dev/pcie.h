@@ -145,6 +145,13 @@ typedef struct pcie_init_info {
      * platform is incapable of masking individual MSI handlers.
      */
     platform_mask_unmask_msi_t mask_unmask_msi;
+
+    /**
+     * Routine for computing the MSI target address which steers an IRQ to a
+     * particular CPU.  May be NULL if the platform cannot choose which CPU
+     * handles an MSI.
+     */
+    platform_get_msi_target_t get_msi_target;
 } pcie_init_info_t;
 
 /* Function table registered by a device driver.  Method requirements and device
@@ -282,8 +289,17 @@ typedef struct pcie_device_state {
             pcie_msi_block_t   irq_block;
         } msi;
 
-        /* TODO(johngro) : Add MSI-X state */
-        struct { } msi_x;
+        /* MSI-X state.  The vector table lives in one of the device's memory
+         * BARs and is mapped into the kernel only while in MSI-X mode. */
+        struct {
+            pcie_cap_msix_t*                   cfg;
+            uint                               max_irqs;
+            uint                               table_bar;
+            uint32_t                           table_offset;
+            vaddr_t                            table_mapping;
+            volatile pcie_msix_vector_entry_t* table;
+            pcie_msi_block_t                   irq_block;
+        } msi_x;
     } irq;
 
 } pcie_device_state_t;
@@ -125,6 +125,18 @@ typedef struct pcie_msix_vector_entry {
     uint32_t vector_ctrl;
 } __PACKED pcie_msix_vector_entry_t;
 
+#define PCIE_CAP_MSIX_CTRL_GET_TABLE_SIZE(ctrl)      ((ctrl & 0x07FF) + 1)
+#define PCIE_CAP_MSIX_CTRL_GET_FUNC_MASK(ctrl)       ((ctrl & 0x4000) != 0)
+#define PCIE_CAP_MSIX_CTRL_GET_ENB(ctrl)             ((ctrl & 0x8000) != 0)
+
+#define PCIE_CAP_MSIX_CTRL_SET_FUNC_MASK(val, ctrl)  ((ctrl & ~0x4000) | ((!!val) << 14))
+#define PCIE_CAP_MSIX_CTRL_SET_ENB(val, ctrl)        ((ctrl & ~0x8000) | ((!!val) << 15))
+
+#define PCIE_CAP_MSIX_TABLE_BIR(reg)                 (reg & 0x7)
+#define PCIE_CAP_MSIX_TABLE_OFFSET(reg)              (reg & ~0x7)
+
+#define PCIE_MSIX_VECTOR_CTRL_MASKED                 (0x00000001)
+
 /**
  * Structure and type definitions for capability PCIE_CAP_ID_PCI_EXPRESS
  *
@@ -207,6 +207,23 @@ typedef void (*platform_mask_unmask_msi_t)(const pcie_msi_block_t* block,
                                            uint                    msi_id,
                                            bool                    mask);
 
+/**
+ * Callback definition used to compute the MSI target address which will
+ * deliver IRQs from a block of MSIs to a specific CPU.  The data written by the
+ * device is unchanged; only the address selects the destination.
+ *
+ * @param block A pointer to a block of MSIs allocated using a platform supplied
+ *        platform_alloc_msi_block_t callback.
+ * @param cpu_num The number of the CPU which should handle the IRQ.
+ * @param out_tgt_addr A pointer to storage for the target address.
+ *
+ * @return NO_ERROR on success, or ERR_INVALID_ARGS if the CPU does not exist
+ *         or cannot be targeted.
+ */
+typedef status_t (*platform_get_msi_target_t)(const pcie_msi_block_t* block,
+                                              uint                    cpu_num,
+                                              uint64_t*               out_tgt_addr);
+
 /**
  * Structure used internally to hold the state of a registered handler.
  */
@@ -355,6 +372,35 @@ status_t pcie_mask_unmask_irq(struct pcie_device_state* dev,
                               uint                      irq_id,
                               bool                      mask);
 
+/**
+ * Steer the specified IRQ to a specific CPU.
+ *
+ * In MSI-X mode, each IRQ may be steered independently.  In MSI mode, all of
+ * the IRQs in a block share a single target address, so affinity may only be
+ * set when exactly one IRQ has been allocated.
+ *
+ * @param dev A pointer to the pci device to configure.
+ * @param irq_id The ID of the IRQ to steer.
+ * @param cpu_num The CPU which should handle the IRQ.
+ *
+ * @return A status_t indicating the success or failure of the operation.
+ * Status codes may include (but are not limited to)...
+ *
+ * ++ ERR_UNAVAILABLE
+ *    The device has become unplugged and is waiting to be released.
+ * ++ ERR_BAD_STATE
+ *    The device is in DISABLED IRQ mode.
+ * ++ ERR_INVALID_ARGS
+ *    The irq_id is out of range for the currently configured mode, or the CPU
+ *    cannot be targeted.
+ * ++ ERR_NOT_SUPPORTED
+ *    The device is in legacy mode or multi-vector MSI mode, or the platform
+ *    cannot steer MSIs.
+ */
+status_t pcie_set_irq_affinity(struct pcie_device_state* dev,
+                               uint                      irq_id,
+                               uint                      cpu_num);
+
 /**
  * Mask the specified IRQ for the given device.
  *
@@ -328,6 +328,61 @@ static status_t pcie_parse_msi_caps(pcie_device_state_t* dev,
     return NO_ERROR;
 }
 
+/*
+ * @see PCI Local Bus Specification 3.0 Section 6.8.2
+ */
+static status_t pcie_parse_msix_caps(pcie_device_state_t* dev,
+                                     void*                hdr,
+                                     uint                 version,
+                                     uint                 space_left) {
+    DEBUG_ASSERT(dev);
+
+    /* Zero out the devices MSI-X IRQ state */
+    memset(&dev->irq.msi_x, 0, sizeof(dev->irq.msi_x));
+
+    pcie_cap_msix_t* msix_cap = (pcie_cap_msix_t*)hdr;
+    if (space_left < sizeof(*msix_cap)) {
+        TRACEF("Device %02x:%02x.%01x (%04hx:%04hx) has illegally positioned MSI-X "
+               "capability structure.  Structure is %zu bytes long, but only %u "
+               "bytes remain in ECAM standard config.\n",
+               dev->bus_id, dev->dev_id, dev->func_id,
+               dev->vendor_id, dev->device_id,
+               sizeof(*msix_cap), space_left);
+        return ERR_INVALID_ARGS;
+    }
+
+    uint16_t ctrl      = pcie_read16(&msix_cap->ctrl);
+    uint32_t table_reg = pcie_read32(&msix_cap->vector_table_bir_offset);
+    uint     table_bar = PCIE_CAP_MSIX_TABLE_BIR(table_reg);
+
+    /* The vector table has to live in one of our BARs.  Whether or not that
+     * BAR is a usable MMIO window is checked when MSI-X mode is entered, since
+     * BARs have not been allocated yet. */
+    if (table_bar >= PCIE_BAR_REGS_PER_DEVICE) {
+        TRACEF("Device %02x:%02x.%01x (%04hx:%04hx) has invalid BIR (%u) in its "
+               "MSI-X capability structure.\n",
+               dev->bus_id, dev->dev_id, dev->func_id,
+               dev->vendor_id, dev->device_id, table_bar);
+        return ERR_INTERNAL;
+    }
+
+    /* Success!
+     *
+     * Make sure that MSI-X is disabled with all vectors masked at the function
+     * level, then record our capabilities.  Individual vector masks live in
+     * the vector table and are set up when MSI-X mode is entered.
+     */
+    pcie_write16(&msix_cap->ctrl, PCIE_CAP_MSIX_CTRL_SET_FUNC_MASK(1,
+                                  PCIE_CAP_MSIX_CTRL_SET_ENB(0, ctrl)));
+
+    dev->irq.msi_x.cfg          = msix_cap;
+    dev->irq.msi_x.max_irqs     = PCIE_CAP_MSIX_CTRL_GET_TABLE_SIZE(ctrl);
+    dev->irq.msi_x.table_bar    = table_bar;
+    dev->irq.msi_x.table_offset = PCIE_CAP_MSIX_TABLE_OFFSET(table_reg);
+
+    return NO_ERROR;
+}
+
 /*
  * Advanced Capabilities for Conventional PCI ECN
  */
@@ -587,7 +642,7 @@ static const pcie_caps_parse_table_entry_t PCIE_STANDARD_CAPS_PARSE_TABLE[] = {
     PTE(PCIE_CAP_ID_AGP_8X,                   NULL),
     PTE(PCIE_CAP_ID_SECURE_DEVICE,            NULL),
     PTE(PCIE_CAP_ID_PCI_EXPRESS,              pcie_parse_pci_express_caps),
-    PTE(PCIE_CAP_ID_MSIX,                     NULL),
+    PTE(PCIE_CAP_ID_MSIX,                     pcie_parse_msix_caps),
     PTE(PCIE_CAP_ID_SATA_DATA_NDX_CFG,        NULL),
     PTE(PCIE_CAP_ID_ADVANCED_FEATURES,        pcie_parse_pci_advanced_features),
     PTE(PCIE_CAP_ID_ENHANCED_ALLOCATION,      NULL),
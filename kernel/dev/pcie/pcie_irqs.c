@@ -15,6 +15,8 @@
 #include <kernel/vm.h>
 #include <list.h>
 #include <pow2.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <trace.h>
 
@@ -377,9 +379,27 @@ static status_t pcie_enter_legacy_irq_mode(pcie_device_state_t*    dev,
 
 /******************************************************************************
  *
- * MSI IRQ mode routines.
+ * MSI and MSI-X IRQ mode routines.  Dispatch, masking and block management are
+ * shared between the two modes; only the way the target is programmed into the
+ * device differs.
  *
  ******************************************************************************/
+static inline pcie_msi_block_t* pcie_get_msi_block(pcie_device_state_t* dev) {
+    DEBUG_ASSERT(dev);
+    return (dev->irq.mode == PCIE_IRQ_MODE_MSI_X) ? &dev->irq.msi_x.irq_block
+                                                  : &dev->irq.msi.irq_block;
+}
+
+/* MSI-X vectors can always be masked in the vector table.  Plain MSI vectors
+ * can only be masked if the device implements PVM, or the platform can mask at
+ * the interrupt controller. */
+static inline bool pcie_msi_can_mask(const pcie_device_state_t* dev) {
+    DEBUG_ASSERT(dev);
+    return (dev->irq.mode == PCIE_IRQ_MODE_MSI_X)
+        || (dev->bus_drv->mask_unmask_msi != NULL)
+        || (dev->irq.msi.pvm_mask_reg != NULL);
+}
+
 static inline void pcie_set_msi_enb(pcie_device_state_t* dev, bool enb) {
     DEBUG_ASSERT(dev);
     DEBUG_ASSERT(dev->irq.msi.cfg);
@@ -392,20 +412,29 @@ static inline bool pcie_mask_unmask_msi_irq_locked(pcie_device_state_t* dev,
                                                    uint                 irq_id,
                                                    bool                 mask) {
     DEBUG_ASSERT(dev);
-    DEBUG_ASSERT(dev->irq.mode == PCIE_IRQ_MODE_MSI);
+    DEBUG_ASSERT((dev->irq.mode == PCIE_IRQ_MODE_MSI) ||
+                 (dev->irq.mode == PCIE_IRQ_MODE_MSI_X));
     DEBUG_ASSERT(irq_id < dev->irq.handler_count);
     DEBUG_ASSERT(dev->irq.handlers);
 
     pcie_bus_driver_state_t*  bus_drv = dev->bus_drv;
     pcie_irq_handler_state_t* hstate  = &dev->irq.handlers[irq_id];
+    const pcie_msi_block_t*   block   = pcie_get_msi_block(dev);
     DEBUG_ASSERT(spin_lock_held(&hstate->lock));
 
     /* Internal code should not be calling this function if they want to mask
      * the interrupt, but it is not possible to do so. */
-    DEBUG_ASSERT(!mask || bus_drv->mask_unmask_msi || dev->irq.msi.pvm_mask_reg);
+    DEBUG_ASSERT(!mask || pcie_msi_can_mask(dev));
 
     /* If we can mask at the PCI device level, do so. */
-    if (dev->irq.msi.pvm_mask_reg) {
+    if (dev->irq.mode == PCIE_IRQ_MODE_MSI_X) {
+        DEBUG_ASSERT(dev->irq.msi_x.table);
+        volatile uint32_t* ctrl_reg = &dev->irq.msi_x.table[irq_id].vector_ctrl;
+        uint32_t val = pcie_read32(ctrl_reg);
+        if (mask) val |=  PCIE_MSIX_VECTOR_CTRL_MASKED;
+        else      val &= ~PCIE_MSIX_VECTOR_CTRL_MASKED;
+        pcie_write32(ctrl_reg, val);
+    } else if (dev->irq.msi.pvm_mask_reg) {
         DEBUG_ASSERT(irq_id < PCIE_MAX_MSI_IRQS);
         uint32_t  val  = pcie_read32(dev->irq.msi.pvm_mask_reg);
         if (mask) val |=  ((uint32_t)1 << irq_id);
@@ -415,10 +444,10 @@ static inline bool pcie_mask_unmask_msi_irq_locked(pcie_device_state_t* dev,
 
 
     /* If we can mask at the platform interrupt controller level, do so. */
-    DEBUG_ASSERT(dev->irq.msi.irq_block.allocated);
-    DEBUG_ASSERT(irq_id < dev->irq.msi.irq_block.num_irq);
+    DEBUG_ASSERT(block->allocated);
+    DEBUG_ASSERT(irq_id < block->num_irq);
     if (bus_drv->mask_unmask_msi)
-        bus_drv->mask_unmask_msi(&dev->irq.msi.irq_block, irq_id, mask);
+        bus_drv->mask_unmask_msi(block, irq_id, mask);
 
     bool ret = hstate->masked;
     hstate->masked = mask;
@@ -428,7 +457,6 @@ static inline bool pcie_mask_unmask_msi_irq_locked(pcie_device_state_t* dev,
 static inline status_t pcie_mask_unmask_msi_irq(pcie_device_state_t* dev,
                                                 uint                 irq_id,
                                                 bool                 mask) {
-    pcie_bus_driver_state_t* bus_drv = dev->bus_drv;
     spin_lock_saved_state_t irq_state;
 
     if (irq_id >= dev->irq.handler_count)
@@ -437,7 +465,7 @@ static inline status_t pcie_mask_unmask_msi_irq(pcie_device_state_t* dev,
     /* If a mask is being requested, and we cannot mask at either the platform
      * interrupt controller or the PCI device level, tell the caller that the
      * operation is unsupported. */
-    if (mask && !bus_drv->mask_unmask_msi && !dev->irq.msi.pvm_mask_reg)
+    if (mask && !pcie_msi_can_mask(dev))
         return ERR_NOT_SUPPORTED;
 
     DEBUG_ASSERT(dev->irq.handlers);
@@ -492,7 +520,6 @@ static enum handler_return pcie_msi_irq_handler(void *arg) {
     DEBUG_ASSERT(arg);
     pcie_irq_handler_state_t* hstate  = (pcie_irq_handler_state_t*)arg;
     pcie_device_state_t*      dev     = hstate->dev;
-    pcie_bus_driver_state_t*  bus_drv = dev->bus_drv;
 
     /* No need to save IRQ state; we are in an IRQ handler at the moment. */
     DEBUG_ASSERT(hstate);
@@ -500,7 +527,7 @@ static enum handler_return pcie_msi_irq_handler(void *arg) {
 
     /* Mask our IRQ if we can. */
     bool was_masked;
-    if (bus_drv->mask_unmask_msi || dev->irq.msi.pvm_mask_reg) {
+    if (pcie_msi_can_mask(dev)) {
         was_masked = pcie_mask_unmask_msi_irq_locked(dev, hstate->pci_irq_id, true);
     } else {
         DEBUG_ASSERT(!hstate->masked);
@@ -526,12 +553,13 @@ static enum handler_return pcie_msi_irq_handler(void *arg) {
     return (irq_ret & PCIE_IRQRET_RESCHED) ? INT_RESCHEDULE : INT_NO_RESCHEDULE;
 }
 
-static void pcie_free_msi_block(pcie_device_state_t* dev) {
+static void pcie_free_msi_block(pcie_device_state_t* dev, pcie_msi_block_t* b) {
     DEBUG_ASSERT(dev);
+    DEBUG_ASSERT(b);
     pcie_bus_driver_state_t* bus_drv = dev->bus_drv;
 
     /* If no block has been allocated, there is nothing to do */
-    if (!dev->irq.msi.irq_block.allocated)
+    if (!b->allocated)
         return;
 
     DEBUG_ASSERT(bus_drv->register_msi_handler);
@@ -539,7 +567,6 @@ static void pcie_free_msi_block(pcie_device_state_t* dev) {
 
     /* Mask the IRQ at the platform interrupt controller level if we can, and
      * unregister any registered handler. */
-    const pcie_msi_block_t* b = &dev->irq.msi.irq_block;
     for (uint i = 0; i < b->num_irq; i++) {
         if (bus_drv->mask_unmask_msi)
             bus_drv->mask_unmask_msi(b, i, true);
@@ -551,8 +578,8 @@ static void pcie_free_msi_block(pcie_device_state_t* dev) {
     DEBUG_ASSERT(bus_drv->free_msi_block);
 
     /* Give the block of IRQs back to the plaform */
-    bus_drv->free_msi_block(&dev->irq.msi.irq_block);
-    DEBUG_ASSERT(!dev->irq.msi.irq_block.allocated);
+    bus_drv->free_msi_block(b);
+    DEBUG_ASSERT(!b->allocated);
 }
 
 static void pcie_set_msi_multi_message_enb(pcie_device_state_t* dev, uint requested_irqs) {
@@ -581,7 +608,7 @@ static void pcie_leave_msi_irq_mode(pcie_device_state_t* dev) {
     /* Return any allocated irq block to the platform, unregistering with
      * the interrupt controller and synchronizing with the dispatchers in
      * the process. */
-    pcie_free_msi_block(dev);
+    pcie_free_msi_block(dev, &dev->irq.msi.irq_block);
 
     /* Reset our common state, free any allocated handlers */
     pcie_reset_common_irq_bookkeeping(dev);
@@ -660,6 +687,189 @@ bailout:
     return res;
 }
 
+static inline void pcie_set_msix_enb(pcie_device_state_t* dev, bool enb) {
+    DEBUG_ASSERT(dev);
+    DEBUG_ASSERT(dev->irq.msi_x.cfg);
+
+    /* The function mask is cleared only while MSI-X is enabled.  Individual
+     * vectors stay masked in the vector table until they are unmasked. */
+    volatile uint16_t* ctrl_reg = &dev->irq.msi_x.cfg->ctrl;
+    pcie_write16(ctrl_reg, PCIE_CAP_MSIX_CTRL_SET_FUNC_MASK(!enb,
+                           PCIE_CAP_MSIX_CTRL_SET_ENB(enb, pcie_read16(ctrl_reg))));
+}
+
+static void pcie_set_msix_vector_target(pcie_device_state_t* dev,
+                                        uint irq_id,
+                                        uint64_t tgt_addr,
+                                        uint32_t tgt_data) {
+    DEBUG_ASSERT(dev);
+    DEBUG_ASSERT(dev->irq.msi_x.table);
+    DEBUG_ASSERT(irq_id < dev->irq.msi_x.max_irqs);
+
+    volatile pcie_msix_vector_entry_t* entry = &dev->irq.msi_x.table[irq_id];
+    pcie_write32(&entry->addr,       (uint32_t)(tgt_addr & 0xFFFFFFFF));
+    pcie_write32(&entry->addr_upper, (uint32_t)(tgt_addr >> 32));
+    pcie_write32(&entry->data,       tgt_data);
+}
+
+static status_t pcie_map_msix_table(pcie_device_state_t* dev) {
+    DEBUG_ASSERT(dev);
+    DEBUG_ASSERT(dev->irq.msi_x.cfg);
+    DEBUG_ASSERT(!dev->irq.msi_x.table_mapping);
+
+    /* The vector table must sit entirely inside an allocated MMIO BAR. */
+    const pcie_bar_info_t* bar = pcie_get_bar_info(dev, dev->irq.msi_x.table_bar);
+    uint64_t table_size = (uint64_t)dev->irq.msi_x.max_irqs * sizeof(pcie_msix_vector_entry_t);
+    if (!bar || !bar->is_mmio ||
+        (dev->irq.msi_x.table_offset > bar->size) ||
+        (table_size > (bar->size - dev->irq.msi_x.table_offset))) {
+        TRACEF("Device %02x:%02x.%01x (%04hx:%04hx) has an MSI-X vector table "
+               "(BAR %u offset 0x%x) which does not fit in an allocated MMIO BAR.\n",
+               dev->bus_id, dev->dev_id, dev->func_id,
+               dev->vendor_id, dev->device_id,
+               dev->irq.msi_x.table_bar, dev->irq.msi_x.table_offset);
+        return ERR_NOT_SUPPORTED;
+    }
+
+    paddr_t table_phys = bar->bus_addr + dev->irq.msi_x.table_offset;
+    paddr_t map_base   = ROUNDDOWN(table_phys, PAGE_SIZE);
+    size_t  map_size   = ROUNDUP(table_phys + table_size, PAGE_SIZE) - map_base;
+
+    char name_buf[32];
+    snprintf(name_buf, sizeof(name_buf), "pcie_msix_%02x:%02x.%01x",
+             dev->bus_id, dev->dev_id, dev->func_id);
+
+    void* vaddr;
+    status_t res = vmm_alloc_physical(dev->bus_drv->aspace,
+                                      name_buf,
+                                      map_size,
+                                      &vaddr,
+                                      PAGE_SIZE_SHIFT,
+                                      map_base,
+                                      0 /* vmm flags */,
+                                      ARCH_MMU_FLAG_UNCACHED_DEVICE | ARCH_MMU_FLAG_PERM_READ |
+                                          ARCH_MMU_FLAG_PERM_WRITE);
+    if (res != NO_ERROR)
+        return res;
+
+    dev->irq.msi_x.table_mapping = (vaddr_t)vaddr;
+    dev->irq.msi_x.table = (volatile pcie_msix_vector_entry_t*)
+                           ((uintptr_t)vaddr + (uintptr_t)(table_phys - map_base));
+    return NO_ERROR;
+}
+
+static void pcie_unmap_msix_table(pcie_device_state_t* dev) {
+    DEBUG_ASSERT(dev);
+
+    if (!dev->irq.msi_x.table_mapping)
+        return;
+
+    vmm_free_region(dev->bus_drv->aspace, dev->irq.msi_x.table_mapping);
+    dev->irq.msi_x.table_mapping = 0;
+    dev->irq.msi_x.table = NULL;
+}
+
+static void pcie_leave_msix_irq_mode(pcie_device_state_t* dev) {
+    DEBUG_ASSERT(dev);
+    DEBUG_ASSERT(dev->bus_drv);
+
+    /* Disable MSI-X at the top level (which also sets the function mask), then
+     * mask every vector in the table. */
+    pcie_set_msix_enb(dev, false);
+    if (dev->irq.msi_x.table) {
+        for (uint i = 0; i < dev->irq.msi_x.max_irqs; ++i) {
+            pcie_write32(&dev->irq.msi_x.table[i].vector_ctrl, PCIE_MSIX_VECTOR_CTRL_MASKED);
+            pcie_set_msix_vector_target(dev, i, 0x0, 0x0);
+        }
+    }
+
+    /* Return any allocated irq block to the platform, unregistering with
+     * the interrupt controller and synchronizing with the dispatchers in
+     * the process. */
+    pcie_free_msi_block(dev, &dev->irq.msi_x.irq_block);
+    pcie_unmap_msix_table(dev);
+
+    /* Reset our common state, free any allocated handlers */
+    pcie_reset_common_irq_bookkeeping(dev);
+}
+
+static status_t pcie_enter_msix_irq_mode(pcie_device_state_t*    dev,
+                                         uint                    requested_irqs) {
+    DEBUG_ASSERT(dev);
+    DEBUG_ASSERT(dev->bus_drv);
+    DEBUG_ASSERT(requested_irqs);
+
+    status_t res = NO_ERROR;
+
+    if (!dev->irq.msi_x.cfg             ||
+        !dev->bus_drv->alloc_msi_block  ||
+        (requested_irqs > dev->irq.msi_x.max_irqs))
+        return ERR_NOT_SUPPORTED;
+
+    DEBUG_ASSERT(dev->bus_drv->free_msi_block &&
+                 dev->bus_drv->register_msi_handler);
+
+    /* Map the vector table so that we can program and mask individual vectors */
+    res = pcie_map_msix_table(dev);
+    if (res != NO_ERROR)
+        goto bailout;
+
+    /* Ask the platform for a chunk of MSI compatible IRQs.  MSI-X targets are
+     * always 64 bit capable. */
+    DEBUG_ASSERT(!dev->irq.msi_x.irq_block.allocated);
+    res = dev->bus_drv->alloc_msi_block(requested_irqs,
+                                        true,  /* can_target_64bit */
+                                        true,  /* is_msix == true */
+                                        &dev->irq.msi_x.irq_block);
+    if (res != NO_ERROR) {
+        LTRACEF("Failed to allocate a block of %u MSI-X IRQs for device "
+                "%02x:%02x.%01x (res %d)\n",
+                requested_irqs, dev->bus_id, dev->dev_id, dev->func_id, res);
+        goto bailout;
+    }
+
+    /* Allocate our handler table */
+    res = pcie_alloc_irq_handlers(dev, requested_irqs);
+    if (res != NO_ERROR)
+        goto bailout;
+
+    /* Record our new IRQ mode */
+    dev->irq.mode = PCIE_IRQ_MODE_MSI_X;
+
+    /* Make sure MSI-X is disabled while we program the table.  Each vector gets
+     * its own entry, all of them initially targeting the same CPU and masked.
+     * Unused entries are left masked. */
+    pcie_set_msix_enb(dev, false);
+    const pcie_msi_block_t* block = &dev->irq.msi_x.irq_block;
+    for (uint i = 0; i < dev->irq.msi_x.max_irqs; ++i) {
+        pcie_write32(&dev->irq.msi_x.table[i].vector_ctrl, PCIE_MSIX_VECTOR_CTRL_MASKED);
+        if (i < dev->irq.handler_count)
+            pcie_set_msix_vector_target(dev, i, block->tgt_addr, block->tgt_data + i);
+    }
+
+    /* Register each IRQ with the dispatcher */
+    DEBUG_ASSERT(dev->irq.handler_count <= block->num_irq);
+    for (uint i = 0; i < dev->irq.handler_count; ++i) {
+        dev->irq.handlers[i].masked = true;
+        dev->bus_drv->register_msi_handler(block,
+                                           i,
+                                           pcie_msi_irq_handler,
+                                           dev->irq.handlers + i);
+    }
+
+    /* Memory decode must be on for the device to see its vector table. */
+    pcie_modify_cmd_internal(dev, 0, PCI_COMMAND_MEM_EN);
+
+    /* Enable MSI-X at the top level */
+    pcie_set_msix_enb(dev, true);
+
+bailout:
+    if (res != NO_ERROR)
+        pcie_leave_msix_irq_mode(dev);
+
+    return res;
+}
+
 /******************************************************************************
  *
  * Internal implementation of the Kernel facing API.
@@ -710,8 +920,13 @@ status_t pcie_query_irq_mode_capabilities_internal(const pcie_device_state_t* de
         if (!bus_drv->alloc_msi_block)
             return ERR_NOT_SUPPORTED;
 
-        /* TODO(johngro) : finish MSI-X implementation. */
-        return ERR_NOT_SUPPORTED;
+        if (!dev->irq.msi_x.cfg)
+            return ERR_NOT_SUPPORTED;
+
+        /* Every MSI-X vector has a mask bit in the vector table. */
+        out_caps->max_irqs = dev->irq.msi_x.max_irqs;
+        out_caps->per_vector_masking_supported = true;
+        break;
 
     default:
         return ERR_INVALID_ARGS;
@@ -769,10 +984,14 @@ status_t pcie_set_irq_mode_internal(pcie_device_state_t*    dev,
             DEBUG_ASSERT(!dev->irq.registered_handler_count);
             return NO_ERROR;
 
-        /* Right now, there should be no way to get into MSI-X mode */
         case PCIE_IRQ_MODE_MSI_X:
-            DEBUG_ASSERT(false);
-            return ERR_NOT_SUPPORTED;
+            DEBUG_ASSERT(dev->irq.msi_x.cfg);
+            DEBUG_ASSERT(dev->irq.msi_x.irq_block.allocated);
+
+            pcie_leave_msix_irq_mode(dev);
+
+            DEBUG_ASSERT(!dev->irq.registered_handler_count);
+            return NO_ERROR;
 
         default:
             /* mode is not one of the valid enum values, this should be impossible */
@@ -793,7 +1012,7 @@ status_t pcie_set_irq_mode_internal(pcie_device_state_t*    dev,
     switch (mode) {
     case PCIE_IRQ_MODE_LEGACY: return pcie_enter_legacy_irq_mode(dev, requested_irqs);
     case PCIE_IRQ_MODE_MSI:    return pcie_enter_msi_irq_mode   (dev, requested_irqs);
-    case PCIE_IRQ_MODE_MSI_X:  return ERR_NOT_SUPPORTED;
+    case PCIE_IRQ_MODE_MSI_X:  return pcie_enter_msix_irq_mode  (dev, requested_irqs);
     default:                   return ERR_INVALID_ARGS;
     }
 }
@@ -867,7 +1086,7 @@ status_t pcie_mask_unmask_irq_internal(pcie_device_state_t* dev,
     switch (dev->irq.mode) {
     case PCIE_IRQ_MODE_LEGACY: return pcie_mask_unmask_legacy_irq(dev, mask);
     case PCIE_IRQ_MODE_MSI:    return pcie_mask_unmask_msi_irq(dev, irq_id, mask);
-    case PCIE_IRQ_MODE_MSI_X:  return ERR_NOT_SUPPORTED;
+    case PCIE_IRQ_MODE_MSI_X:  return pcie_mask_unmask_msi_irq(dev, irq_id, mask);
     default:
         DEBUG_ASSERT(false); /* This should be un-possible! */
         return ERR_INTERNAL;
@@ -876,6 +1095,66 @@ status_t pcie_mask_unmask_irq_internal(pcie_device_state_t* dev,
     return NO_ERROR;
 }
 
+status_t pcie_set_irq_affinity_internal(pcie_device_state_t* dev,
+                                        uint                 irq_id,
+                                        uint                 cpu_num) {
+    DEBUG_ASSERT(dev && dev->plugged_in);
+    DEBUG_ASSERT(is_mutex_held(&dev->dev_lock));
+
+    pcie_bus_driver_state_t* bus_drv = dev->bus_drv;
+
+    /* Cannot steer IRQs while in the DISABLED state */
+    if (dev->irq.mode == PCIE_IRQ_MODE_DISABLED)
+        return ERR_BAD_STATE;
+
+    DEBUG_ASSERT(dev->irq.handlers);
+    DEBUG_ASSERT(dev->irq.handler_count);
+
+    if (irq_id >= dev->irq.handler_count)
+        return ERR_INVALID_ARGS;
+
+    /* Legacy IRQs are shared and routed by the platform.  Multi-vector MSI
+     * blocks share a single target address, so moving one vector would move
+     * all of them. */
+    if (!bus_drv->get_msi_target ||
+        (dev->irq.mode == PCIE_IRQ_MODE_LEGACY) ||
+        ((dev->irq.mode == PCIE_IRQ_MODE_MSI) && (dev->irq.handler_count > 1)))
+        return ERR_NOT_SUPPORTED;
+
+    const pcie_msi_block_t* block = pcie_get_msi_block(dev);
+    uint64_t tgt_addr;
+    status_t res = bus_drv->get_msi_target(block, cpu_num, &tgt_addr);
+    if (res != NO_ERROR)
+        return res;
+
+    if (dev->irq.mode == PCIE_IRQ_MODE_MSI) {
+        /* pcie_set_msi_target disables MSI and masks the vector while it
+         * reprograms the target.  Put things back the way they were. */
+        pcie_irq_handler_state_t* hstate = &dev->irq.handlers[0];
+        bool was_masked = hstate->masked;
+
+        pcie_set_msi_target(dev, tgt_addr, block->tgt_data);
+        pcie_set_msi_enb(dev, true);
+        if (!was_masked)
+            pcie_mask_unmask_msi_irq(dev, 0, false);
+        return NO_ERROR;
+    }
+
+    /* The vector's address may only be changed while it is masked. */
+    DEBUG_ASSERT(dev->irq.mode == PCIE_IRQ_MODE_MSI_X);
+    pcie_irq_handler_state_t* hstate = &dev->irq.handlers[irq_id];
+    spin_lock_saved_state_t irq_state;
+
+    spin_lock_irqsave(&hstate->lock, irq_state);
+    bool was_masked = pcie_mask_unmask_msi_irq_locked(dev, irq_id, true);
+    pcie_set_msix_vector_target(dev, irq_id, tgt_addr, block->tgt_data + irq_id);
+    if (!was_masked)
+        pcie_mask_unmask_msi_irq_locked(dev, irq_id, false);
+    spin_unlock_irqrestore(&hstate->lock, irq_state);
+
+    return NO_ERROR;
+}
+
 /******************************************************************************
  *
  * Kernel API; prototypes in dev/pcie_irqs.h
@@ -968,6 +1247,21 @@ status_t pcie_mask_unmask_irq(pcie_device_state_t* dev,
     return ret;
 }
 
+status_t pcie_set_irq_affinity(pcie_device_state_t* dev,
+                               uint                 irq_id,
+                               uint                 cpu_num) {
+    DEBUG_ASSERT(dev);
+    status_t ret;
+
+    MUTEX_ACQUIRE(dev, dev_lock);
+    ret = dev->plugged_in
+        ? pcie_set_irq_affinity_internal(dev, irq_id, cpu_num)
+        : ERR_BAD_STATE;
+    MUTEX_RELEASE(dev, dev_lock);
+
+    return ret;
+}
+
 /******************************************************************************
  *
  * Internal API; prototypes in pcie_priv.h
@@ -1028,6 +1322,7 @@ status_t pcie_init_irqs(pcie_bus_driver_state_t* bus_drv, const pcie_init_info_t
     bus_drv->free_msi_block       = init_info->free_msi_block;
     bus_drv->register_msi_handler = init_info->register_msi_handler;
     bus_drv->mask_unmask_msi      = init_info->mask_unmask_msi;
+    bus_drv->get_msi_target       = init_info->get_msi_target;
 
     return NO_ERROR;
 }
@@ -0,0 +1,62 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <magenta/compiler.h>
+#include <arch/spinlock.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Lock profiler
+//
+// Built in with ENABLE_LOCK_STATS=true (WITH_LOCK_STATS=1).  Locks are
+// grouped into classes by the place they were initialized: the
+// mutex_init() or spin_lock_init() call, or where MUTEX_INITIAL_VALUE
+// was written.  Statically initialized spin locks have no such place
+// and get a class of their own, named by address.  Each class counts
+// acquisitions and contended acquisitions, keeps histograms of wait
+// and hold time, and keeps the LOCKSTAT_CALLERS callers that had to
+// wait most often, with their wait counts.
+//
+// Read with the lockstat console command or MX_INFO_LOCK_STATS.
+
+__BEGIN_CDECLS
+
+#define LOCKSTAT_BUCKETS 16     // powers of 4 nanoseconds, as MX_LOCK_STATS_BUCKETS
+#define LOCKSTAT_CALLERS 8
+
+#define LOCKSTAT_TYPE_SPIN  1
+#define LOCKSTAT_TYPE_MUTEX 2
+
+typedef struct lockstat_class lockstat_class_t;
+
+struct mutex;
+typedef struct mx_record_lock_stats mx_record_lock_stats_t;
+
+#if WITH_LOCK_STATS
+
+// spin lock hooks, see kernel/spinlock.h
+void lockstat_spin_lock(spin_lock_t *lock);
+int lockstat_spin_trylock(spin_lock_t *lock);
+void lockstat_spin_unlock(spin_lock_t *lock);
+void lockstat_spin_init(spin_lock_t *lock, const char *file, int line);
+
+// mutex hooks, called from kernel/mutex.c with the thread lock held
+void lockstat_mutex_acquired(struct mutex *m, uint64_t wait_start, bool contended, void *caller);
+void lockstat_mutex_held(struct mutex *m);
+void lockstat_mutex_released(struct mutex *m);
+
+uint64_t lockstat_ticks(void);
+
+#endif // WITH_LOCK_STATS
+
+// for MX_INFO_LOCK_STATS, ERR_NOT_SUPPORTED unless built in
+status_t lockstat_get_record(uint32_t index, mx_record_lock_stats_t *rec);
+uint32_t lockstat_num_classes(void);
+
+__END_CDECLS
@@ -12,6 +12,7 @@
 #include <magenta/compiler.h>
 #include <debug.h>
 #include <stdint.h>
+#include <kernel/lockstat.h>
 #include <kernel/thread.h>
 
 __BEGIN_CDECLS;
@@ -23,8 +24,30 @@ typedef struct mutex {
     thread_t *holder;
     int count;
     wait_queue_t wait;
+#if WITH_LOCK_STATS
+    /* where the mutex was initialized, names its lock class */
+    const char *lockstat_file;
+    int lockstat_line;
+    lockstat_class_t *lockstat_class;
+    uint64_t lockstat_acquired;
+#endif
 } mutex_t;
 
+#if WITH_LOCK_STATS
+#define MUTEX_INITIAL_VALUE_SITE(m, file, line) \
+{ \
+    .magic = MUTEX_MAGIC, \
+    .holder = NULL, \
+    .count = 0, \
+    .wait = WAIT_QUEUE_INITIAL_VALUE((m).wait), \
+    .lockstat_file = (file), \
+    .lockstat_line = (line), \
+    .lockstat_class = NULL, \
+    .lockstat_acquired = 0, \
+}
+
+#define MUTEX_INITIAL_VALUE(m) MUTEX_INITIAL_VALUE_SITE(m, __FILE__, __LINE__)
+#else
 #define MUTEX_INITIAL_VALUE(m) \
 { \
     .magic = MUTEX_MAGIC, \
@@ -32,6 +55,7 @@ typedef struct mutex {
     .count = 0, \
     .wait = WAIT_QUEUE_INITIAL_VALUE((m).wait), \
 }
+#endif
 
 /* Rules for Mutexes:
  * - Mutexes are only safe to use from thread context.
@@ -39,6 +63,10 @@ typedef struct mutex {
 */
 
 void mutex_init(mutex_t *);
+#if WITH_LOCK_STATS
+void mutex_init_etc(mutex_t *, const char *file, int line);
+#define mutex_init(m) mutex_init_etc((m), __FILE__, __LINE__)
+#endif
 void mutex_destroy(mutex_t *);
 status_t mutex_acquire_timeout(mutex_t *, lk_time_t); /* try to acquire the mutex with a timeout value */
 void mutex_release(mutex_t *);
@@ -63,7 +91,13 @@ __END_CDECLS;
 #ifdef __cplusplus
 class Mutex {
 public:
+#if WITH_LOCK_STATS && !defined(__clang__)
+    // take the lock class from where the Mutex is constructed
+    constexpr Mutex(const char* file = __builtin_FILE(), int line = __builtin_LINE())
+        : mutex_(MUTEX_INITIAL_VALUE_SITE(mutex_, file, line)) { }
+#else
     constexpr Mutex() : mutex_(MUTEX_INITIAL_VALUE(mutex_)) { }
+#endif
 
     ~Mutex() {
         mutex_destroy(&mutex_);
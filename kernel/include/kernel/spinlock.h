@@ -9,14 +9,47 @@
 
 #include <magenta/compiler.h>
 #include <arch/spinlock.h>
+#include <kernel/lockstat.h>
 
 __BEGIN_CDECLS
 
+#if WITH_LOCK_STATS
+/* out of line, so the profiler sees the caller */
+static inline void spin_lock(spin_lock_t *lock)
+{
+    lockstat_spin_lock(lock);
+}
+
+static inline int spin_trylock(spin_lock_t *lock)
+{
+    return lockstat_spin_trylock(lock);
+}
+
+static inline void spin_unlock(spin_lock_t *lock)
+{
+    lockstat_spin_unlock(lock);
+}
+
+/* the call site names the lock class */
+#define spin_lock_init(lock) lockstat_spin_init((lock), __FILE__, __LINE__)
+#else
+#if WITH_SMP && WITH_LIB_KTRACE
+/* out of line slow path, traces how long the wait took */
+void spin_lock_contended(spin_lock_t *lock);
+
+/* interrupts should already be disabled */
+static inline void spin_lock(spin_lock_t *lock)
+{
+    if (unlikely(arch_spin_trylock(lock)))
+        spin_lock_contended(lock);
+}
+#else
 /* interrupts should already be disabled */
 static inline void spin_lock(spin_lock_t *lock)
 {
     arch_spin_lock(lock);
 }
+#endif
 
 /* Returns 0 on success, non-0 on failure */
 static inline int spin_trylock(spin_lock_t *lock)
@@ -34,6 +67,7 @@ static inline void spin_lock_init(spin_lock_t *lock)
 {
     arch_spin_lock_init(lock);
 }
+#endif // WITH_LOCK_STATS
 
 static inline bool spin_lock_held(spin_lock_t *lock)
 {
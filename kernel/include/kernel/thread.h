@@ -106,6 +106,16 @@ typedef struct thread {
      * THREAD_RUNNING state, this excludes the time it has accrued since it
      * left the scheduler. */
     lk_bigtime_t runtime_us;
+    /* Total time in THREAD_BLOCKED or THREAD_SLEEPING state, and when the
+     * current such wait began (0 if not waiting). */
+    lk_bigtime_t wait_time_us;
+    lk_bigtime_t last_blocked_us;
+    /* when the syscall in progress last got the cpu, 0 if not in one */
+    lk_bigtime_t syscall_started_us;
+    /* times switched out, and how many of those were while still runnable */
+    uint64_t context_switches;
+    uint64_t preemptions;
+    uint64_t page_faults;
 
     /* if blocked, a pointer to the wait queue */
     struct wait_queue *blocking_wait_queue;
@@ -211,6 +221,11 @@ void thread_kill(thread_t *t, bool block);
 /* process pending signals, may never return because of kill signal */
 void thread_process_pending_signals(void);
 
+/* bracket the body of a syscall so the time spent running it is charged
+ * to the cpu's syscall time, enter with interrupts disabled */
+void thread_syscall_enter(void);
+void thread_syscall_exit(void);
+
 void dump_thread(thread_t *t);
 void arch_dump_thread(thread_t *t);
 void dump_all_threads(void);
@@ -254,6 +269,10 @@ struct thread_stats {
     ulong interrupts; /* platform code increment this */
     ulong timer_ints; /* timer code increment this */
     ulong timers; /* timer code increment this */
+    ulong syscalls;
+    ulong page_faults;
+    lk_bigtime_t irq_time; /* platform code accumulate this */
+    lk_bigtime_t syscall_time;
 
 #if WITH_SMP
     ulong reschedule_ipis;
@@ -263,10 +282,12 @@ struct thread_stats {
 extern struct thread_stats thread_stats[SMP_MAX_CPUS];
 
 #define THREAD_STATS_INC(name) do { thread_stats[arch_curr_cpu_num()].name++; } while(0)
+#define THREAD_STATS_ADD(name, n) do { thread_stats[arch_curr_cpu_num()].name += (n); } while(0)
 
 #else
 
 #define THREAD_STATS_INC(name) do { } while (0)
+#define THREAD_STATS_ADD(name, n) do { } while (0)
 
 #endif
 
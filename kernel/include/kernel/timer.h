@@ -53,6 +53,13 @@ void timer_set_oneshot(timer_t *, lk_time_t delay, timer_callback, void *arg);
 void timer_set_periodic(timer_t *, lk_time_t period, timer_callback, void *arg);
 void timer_cancel(timer_t *);
 
+/* Like timer_cancel(), but also waits for a callback already running on
+ * another cpu to return, so the timer and its argument can be freed
+ * afterwards.  Must not be called from the callback, or while holding a
+ * lock the callback takes.
+ */
+void timer_cancel_sync(timer_t *);
+
 void timer_transition_off_cpu(uint old_cpu);
 void timer_thaw_percpu(void);
 
@@ -208,6 +208,7 @@ status_t vmm_reserve_space(vmm_aspace_t* aspace, const char* name, size_t size,
 /* For region creation routines */
 #define VMM_FLAG_VALLOC_SPECIFIC (1 << 0) /* allocate at specific address */
 #define VMM_FLAG_COMMIT (1 << 1)          /* commit memory up front (no demand paging) */
+#define VMM_FLAG_LARGE_PAGES (1 << 2)     /* back with large pages where possible (vmm_alloc) */
 
 /* allocate a region of virtual space that maps a physical piece of address space.
    the physical pages that back this are not allocated from the pmm. */
@@ -72,6 +72,15 @@ public:
     // free the region at a given address
     status_t FreeRegion(vaddr_t vaddr);
 
+    // unmap whatever of [offset, offset + len) of its object a region maps,
+    // if the region is still in this address space
+    void UnmapObjectRange(VmRegion& r, uint64_t offset, uint64_t len);
+
+    // decommit the pages behind [vaddr, vaddr + len), or commit them in the
+    // background, in whichever objects are mapped there
+    status_t DecommitRange(vaddr_t vaddr, size_t len);
+    status_t PrefetchRange(vaddr_t vaddr, size_t len);
+
     // destroy but not free the address space
     status_t Destroy();
 
@@ -85,6 +94,12 @@ public:
 
     void Dump() const;
 
+    // bytes of address space covered by regions, bytes of committed pages
+    // within the parts of the vm objects those regions map, and how many of
+    // those bytes are in large pages
+    void GetMemoryUsage(size_t* mapped, size_t* committed, size_t* large,
+                        uint32_t* regions) const;
+
 private:
     using RegionTree = mxtl::WAVLTree<vaddr_t, mxtl::RefPtr<VmRegion>>;
 
@@ -9,11 +9,14 @@
 #include <assert.h>
 #include <kernel/mutex.h>
 #include <kernel/vm.h>
+#include <kernel/vm/vm_region.h>
 #include <list.h>
 #include <stdint.h>
 #include <mxtl/array.h>
+#include <mxtl/intrusive_double_list.h>
 #include <mxtl/ref_counted.h>
 #include <mxtl/ref_ptr.h>
+#include <mxtl/unique_ptr.h>
 #include <lib/user_copy/user_ptr.h>
 
 // The base vm object that holds a range of bytes of data
@@ -23,11 +26,22 @@
 
 class VmObject : public mxtl::RefCounted<VmObject> {
 public:
-    static mxtl::RefPtr<VmObject> Create(uint32_t pmm_alloc_flags, uint64_t size);
+    static mxtl::RefPtr<VmObject> Create(uint32_t pmm_alloc_flags, uint64_t size,
+                                         uint32_t flags = 0);
+
+    // flags
+    // back whole, aligned LARGE_PAGE_SIZE chunks of the object with single
+    // large pages when physical memory allows, so mappings of them can use
+    // one page table entry per chunk
+    static const uint32_t FLAG_LARGE_PAGES = (1u << 0);
+
+    static const uint8_t LARGE_PAGE_SHIFT = 21;
+    static const uint64_t LARGE_PAGE_SIZE = (1ULL << LARGE_PAGE_SHIFT);
 
     status_t Resize(uint64_t size);
 
     uint64_t size() const { return size_; }
+    bool large_pages() const { return (flags_ & FLAG_LARGE_PAGES) != 0; }
 
     // add a page to the object
     status_t AddPage(vm_page_t* p, uint64_t offset);
@@ -38,9 +52,35 @@ public:
     // find a contiguous run of physical pages to back the range of the object
     int64_t CommitRangeContiguous(uint64_t offset, uint64_t len, uint8_t alignment_log2 = 0);
 
+    // free the pages backing the range, unmapping them from every region
+    // that maps them; later accesses see fresh zero pages.  the range must
+    // be page aligned, but may end at the end of the object
+    int64_t DecommitRange(uint64_t offset, uint64_t len);
+
+    // commit the range on a background thread, returning at once
+    status_t PrefetchRange(uint64_t offset, uint64_t len);
+
+    // the background half of PrefetchRange(), which commits the range a
+    // chunk at a time and gives up if the object is no longer wanted
+    void PrefetchCommit(uint64_t offset, uint64_t len);
+
+    // set one bit per page of the range, lowest bit first, for each page
+    // that is committed.  the range starts at the page holding offset
+    status_t QueryResidency(uint64_t offset, uint64_t len, user_ptr<uint8_t> bitmap,
+                            size_t bitmap_size);
+
+    // regions mapping the object register themselves, so decommit can
+    // find the page table entries to remove
+    void AddMapping(VmRegion* r);
+    void RemoveMapping(VmRegion* r);
+
     // get a pointer to a page at a given offset
     vm_page_t* GetPage(uint64_t offset);
 
+    // if offset lies in a chunk backed by a large page, return the physical
+    // address of the start of the chunk
+    bool GetLargePage(uint64_t offset, paddr_t* pa);
+
     // fault in a page at a given offset with PF_FLAGS
     vm_page_t* FaultPage(uint64_t offset, uint pf_flags);
 
@@ -55,15 +95,32 @@ public:
     // translate a range of the vmo to physical addresses and store in the buffer
     status_t Lookup(uint64_t offset, uint64_t len, user_ptr<paddr_t>, size_t);
 
+    // commit a range and hold its physical pages in place (for device
+    // dma) until the same pinner unpins exactly that range.  A pinner is
+    // the opaque owner the pin was made through plus the id of the
+    // process that made it, so nobody can drop anyone else's pins.
+    status_t Pin(const void* owner, uint64_t id, uint64_t offset, uint64_t len);
+    status_t Unpin(const void* owner, uint64_t id, uint64_t offset, uint64_t len);
+
+    // drop every pin made through owner, when it goes away
+    void UnpinAll(const void* owner);
+
+    // number of pages committed in the given range, and optionally how
+    // many of those are parts of large pages
+    size_t AllocatedPages(uint64_t offset, uint64_t len, size_t* large_pages = nullptr);
+
     void Dump();
 
+    // print large page counters for the whole system
+    static void DumpLargePageStats();
+
 private:
     // kill copy constructors
     VmObject(const VmObject& o) = delete;
     VmObject& operator=(VmObject& o) = delete;
 
     // private constructor (use Create())
-    explicit VmObject(uint32_t pmm_alloc_flags);
+    VmObject(uint32_t pmm_alloc_flags, uint32_t flags);
 
     // private destructor, only called from refptr
     ~VmObject();
@@ -76,6 +133,14 @@ private:
     // internal page list routine
     void AddPageToArray(size_t index, vm_page_t* p);
 
+    // true if any pin overlaps [offset, offset + len)
+    bool PinnedLocked(uint64_t offset, uint64_t len) const;
+
+    // large page chunk routines
+    bool CommitLargePageLocked(size_t chunk);
+    void UpdateChunksLocked(uint64_t offset, uint64_t end);
+    bool SplitsChunkLocked(uint64_t offset) const;
+
     // internal read/write routine that takes a templated copy function to help share some code
     template <typename T>
     status_t ReadWriteInternal(uint64_t offset, size_t len, size_t* bytes_copied, bool write,
@@ -92,14 +157,40 @@ private:
     static const uint32_t MAGIC = 0x564d4f5f; // VMO_
     uint32_t magic_ = MAGIC;
 
+    static const size_t LARGE_PAGE_PAGES = LARGE_PAGE_SIZE / PAGE_SIZE;
+
+    // state of each whole LARGE_PAGE_SIZE chunk of a large page object
+    enum : uint8_t {
+        CHUNK_EMPTY = 0, // nothing committed yet
+        CHUNK_LARGE,     // backed by one large page
+        CHUNK_SMALL,     // backed by separate pages, or a large page that was split
+    };
+
     // members
     uint64_t size_ = 0;
     uint32_t pmm_alloc_flags_ = PMM_ALLOC_FLAG_ANY;
+    uint32_t flags_ = 0;
     mutex_t lock_ = MUTEX_INITIAL_VALUE(lock_);
 
+    // one entry per outstanding Pin() call
+    struct PinnedRange : public mxtl::DoublyLinkedListable<mxtl::unique_ptr<PinnedRange>> {
+        const void* owner;
+        uint64_t id;
+        uint64_t offset;
+        uint64_t len;
+    };
+    mxtl::DoublyLinkedList<mxtl::unique_ptr<PinnedRange>> pin_list_;
+
     // array of page pointers, one per page offset into the object
     mxtl::Array<vm_page_t*> page_array_;
 
     // list of all allocated pages
     list_node page_list_ = LIST_INITIAL_VALUE(page_list_);
+
+    // one entry per whole chunk, for large page objects
+    mxtl::Array<uint8_t> chunk_state_;
+
+    // regions mapping the object
+    mxtl::DoublyLinkedList<VmRegion*, VmRegion::ObjectMappingListTraits> mapping_list_;
+    size_t mapping_count_ = 0;
 };
@@ -8,6 +8,7 @@
 
 #include <assert.h>
 #include <stdint.h>
+#include <mxtl/intrusive_double_list.h>
 #include <mxtl/intrusive_wavl_tree.h>
 #include <mxtl/ref_counted.h>
 #include <mxtl/ref_ptr.h>
@@ -54,11 +55,20 @@ public:
     // page fault in an address into the region
     status_t PageFault(vaddr_t va, uint pf_flags);
 
-    mxtl::RefPtr<VmObject> vmo();
+    mxtl::RefPtr<VmObject> vmo() const;
+
+    VmAspace& aspace() const { return *aspace_; }
 
     // WAVL tree key function
     vaddr_t GetKey() const { return base(); }
 
+    // for the list of regions mapping a vm object, kept by the object
+    struct ObjectMappingListTraits {
+        static mxtl::DoublyLinkedListNodeState<VmRegion*>& node_state(VmRegion& r) {
+            return r.object_mapping_node_state_;
+        }
+    };
+
 private:
     // private constructor, use Create()
     VmRegion(VmAspace& aspace, vaddr_t base, size_t size, uint arch_mmu_flags, const char* name);
@@ -67,6 +77,10 @@ private:
     VmRegion(const VmRegion&) = delete;
     VmRegion& operator=(const VmRegion&) = delete;
 
+    // find the large page of the object, if any, covering offset into the
+    // region, if the region maps all of it at a suitably aligned address
+    bool LargePageAt(size_t offset, size_t* start, paddr_t* pa) const;
+
     // magic value
     static const uint32_t MAGIC = 0x564d5247; // VMRG
     uint32_t magic_ = MAGIC;
@@ -84,6 +98,7 @@ private:
     // pointer and region of the object we are mapping
     mxtl::RefPtr<VmObject> object_;
     uint64_t object_offset_ = 0;
+    mxtl::DoublyLinkedListNodeState<VmRegion*> object_mapping_node_state_;
 
     char name_[32];
 };
@@ -16,6 +16,10 @@ void ktrace(uint32_t tag, uint32_t a, uint32_t b, uint32_t c, uint32_t d);
 void ktrace_name(uint32_t tag, uint32_t id, const char name[KTRACE_NAMESIZE]);
 int ktrace_read_user(void* ptr, uint32_t off, uint32_t len);
 status_t ktrace_control(uint32_t action, uint32_t options);
+uint64_t ktrace_timestamp(void);
+void ktrace_lock_wait(uint32_t tag, const void* lock, uint64_t start);
+status_t ktrace_profile_control(uint32_t hz);
+void ktrace_profile_irq(uintptr_t pc, uintptr_t fp, bool user);
 #else
 static inline void ktrace(uint32_t tag, uint32_t a, uint32_t b, uint32_t c, uint32_t d) {}
 static inline void ktrace_name(uint32_t tag, uint32_t id, const char name[KTRACE_NAMESIZE]) {}
@@ -29,9 +33,20 @@ static inline ssize_t ktrace_read_user(void* ptr, uint32_t off, uint32_t len) {
 static inline status_t ktrace_control(uint32_t action, uint32_t options) {
     return ERR_NOT_SUPPORTED;
 }
+static inline uint64_t ktrace_timestamp(void) {
+    return 0;
+}
+static inline void ktrace_lock_wait(uint32_t tag, const void* lock, uint64_t start) {}
+static inline void ktrace_profile_irq(uintptr_t pc, uintptr_t fp, bool user) {}
 #endif
 
 #define KTRACE_DEFAULT_BUFSIZE 32 // MB
-#define KTRACE_DEFAULT_GRPMASK 0xFFF
+// the syscall, fault, irq, timer and lock groups are busy enough
+// to fill the buffer during boot, so they are off unless asked for
+#define KTRACE_DEFAULT_GRPMASK 0x01F
+#define KTRACE_DEFAULT_MODE KTRACE_MODE_LINEAR
+#define KTRACE_DEFAULT_PROFILE_HZ 0 // off
+#define KTRACE_DEFAULT_PROFILE_DEPTH 16
+#define KTRACE_PROFILE_MAX_DEPTH 32
 
 __END_CDECLS
\ No newline at end of file
@@ -0,0 +1,549 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+/**
+ * @file
+ * @brief  Lock profiler
+ *
+ * See kernel/lockstat.h.  Everything here runs inside lock and unlock,
+ * so it only ever takes its own table lock, as a raw arch spin lock,
+ * and never prints while holding it.
+ */
+
+#include <kernel/lockstat.h>
+
+#include <debug.h>
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arch/ops.h>
+#include <kernel/mutex.h>
+#include <kernel/spinlock.h>
+#include <lib/ktrace.h>
+#include <magenta/syscalls-types.h>
+
+#if WITH_LOCK_STATS
+
+#if ARCH_X86_64
+#include <arch/x86.h>
+uint64_t get_tsc_ticks_per_ms(void);
+#define lockstat_ticks_raw() rdtsc()
+#define lockstat_ticks_per_ms() get_tsc_ticks_per_ms()
+#else
+#include <platform.h>
+#define lockstat_ticks_raw() current_time_hires()
+#define lockstat_ticks_per_ms() (1000)
+#endif
+
+#define LOCKSTAT_MAX_CLASSES 512
+#define LOCKSTAT_MAP_SIZE    4096   // spin locks we can tell apart, power of 2
+#define LOCKSTAT_MAP_PROBES  16
+#define LOCKSTAT_MAX_HELD    16     // spin locks one cpu can hold at once
+
+struct lockstat_class {
+    int type;
+
+    // init site, or NULL and the address of the one lock in the class
+    const char *file;
+    int line;
+    const void *addr;
+
+    uint64_t acquisitions;
+    uint64_t contended;
+    uint64_t wait_total;    // nanoseconds, contended acquisitions only
+    uint64_t wait_max;
+    uint64_t hold_total;
+    uint64_t hold_max;
+    uint64_t wait_hist[LOCKSTAT_BUCKETS];
+    uint64_t hold_hist[LOCKSTAT_BUCKETS];
+
+    // the callers that waited most often, see record_caller()
+    spin_lock_t callers_lock;
+    struct {
+        uintptr_t pc;
+        uint64_t count;
+    } callers[LOCKSTAT_CALLERS];
+};
+
+static lockstat_class_t classes[LOCKSTAT_MAX_CLASSES];
+static int num_classes;
+
+// where locks go once the tables are full
+static lockstat_class_t overflow_spin = { .type = LOCKSTAT_TYPE_SPIN };
+static lockstat_class_t overflow_mutex = { .type = LOCKSTAT_TYPE_MUTEX };
+
+// spin lock address to class
+static struct {
+    spin_lock_t *lock;
+    lockstat_class_t *cls;
+} spin_map[LOCKSTAT_MAP_SIZE];
+
+// the spin locks each cpu holds, with when it got them
+typedef struct {
+    spin_lock_t *lock;
+    lockstat_class_t *cls;
+    uint64_t start;
+} held_t;
+
+static struct {
+    uint depth;
+    held_t held[LOCKSTAT_MAX_HELD];
+} __CPU_ALIGN held_spin[SMP_MAX_CPUS];
+
+// protects adding classes and map entries, readers do not take it
+static spin_lock_t table_lock = SPIN_LOCK_INITIAL_VALUE;
+
+uint64_t lockstat_ticks(void)
+{
+    return lockstat_ticks_raw();
+}
+
+static uint64_t ticks_to_ns(uint64_t ticks)
+{
+    uint64_t per_ms = lockstat_ticks_per_ms();
+    if (per_ms == 0)
+        return 0;
+    return ticks * 1000000 / per_ms;
+}
+
+static uint bucket(uint64_t ns)
+{
+    uint b = ns ? (63 - __builtin_clzll(ns)) / 2 : 0;
+    return MIN(b, LOCKSTAT_BUCKETS - 1);
+}
+
+static void add(uint64_t *p, uint64_t n)
+{
+    __atomic_fetch_add(p, n, __ATOMIC_RELAXED);
+}
+
+static void update_max(uint64_t *p, uint64_t n)
+{
+    uint64_t old = __atomic_load_n(p, __ATOMIC_RELAXED);
+    while (n > old) {
+        if (__atomic_compare_exchange_n(p, &old, n, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            break;
+    }
+}
+
+// Counts a wait by caller.  Once every slot is taken, a new caller
+// replaces the one with the fewest waits and inherits its count, so a
+// caller that waits often enough always ends up with a slot even if it
+// shows up late, at the cost of its count being overstated by at most
+// what it inherited.  Call with interrupts disabled.
+static void record_caller(lockstat_class_t *cls, uintptr_t caller)
+{
+    arch_spin_lock(&cls->callers_lock);
+    uint min = 0;
+    for (uint i = 0; i < LOCKSTAT_CALLERS; i++) {
+        if (cls->callers[i].pc == caller) {
+            cls->callers[i].count++;
+            arch_spin_unlock(&cls->callers_lock);
+            return;
+        }
+        if (cls->callers[i].pc == 0) {
+            // slots fill in order, so the caller is not further on
+            min = i;
+            break;
+        }
+        if (cls->callers[i].count < cls->callers[min].count)
+            min = i;
+    }
+    cls->callers[min].pc = caller;
+    cls->callers[min].count++;
+    arch_spin_unlock(&cls->callers_lock);
+}
+
+static void record_wait(lockstat_class_t *cls, uint64_t ticks, uintptr_t caller)
+{
+    uint64_t ns = ticks_to_ns(ticks);
+    add(&cls->contended, 1);
+    add(&cls->wait_total, ns);
+    add(&cls->wait_hist[bucket(ns)], 1);
+    update_max(&cls->wait_max, ns);
+    record_caller(cls, caller);
+}
+
+static void record_hold(lockstat_class_t *cls, uint64_t ticks)
+{
+    uint64_t ns = ticks_to_ns(ticks);
+    add(&cls->hold_total, ns);
+    add(&cls->hold_hist[bucket(ns)], 1);
+    update_max(&cls->hold_max, ns);
+}
+
+// call with interrupts disabled
+static lockstat_class_t *get_class(int type, const char *file, int line, const void *addr)
+{
+    lockstat_class_t *cls = NULL;
+
+    arch_spin_lock(&table_lock);
+    for (int i = 0; i < num_classes; i++) {
+        lockstat_class_t *c = &classes[i];
+        if (c->type != type)
+            continue;
+        if (file ? (c->file && c->line == line && (c->file == file || !strcmp(c->file, file)))
+                 : (!c->file && c->addr == addr)) {
+            cls = c;
+            break;
+        }
+    }
+    if (!cls) {
+        if (num_classes < LOCKSTAT_MAX_CLASSES) {
+            cls = &classes[num_classes];
+            cls->type = type;
+            cls->file = file;
+            cls->line = line;
+            cls->addr = file ? NULL : addr;
+            __atomic_store_n(&num_classes, num_classes + 1, __ATOMIC_RELEASE);
+        } else {
+            cls = (type == LOCKSTAT_TYPE_SPIN) ? &overflow_spin : &overflow_mutex;
+        }
+    }
+    arch_spin_unlock(&table_lock);
+    return cls;
+}
+
+static uint map_hash(const void *p)
+{
+    uint64_t h = (uintptr_t)p * 0x9E3779B97F4A7C15ULL;
+    return (uint)(h >> 40);
+}
+
+// call with interrupts disabled
+static void map_spin_lock(spin_lock_t *lock, lockstat_class_t *cls)
+{
+    arch_spin_lock(&table_lock);
+    for (uint n = 0; n < LOCKSTAT_MAP_PROBES; n++) {
+        uint i = (map_hash(lock) + n) & (LOCKSTAT_MAP_SIZE - 1);
+        spin_lock_t *l = spin_map[i].lock;
+        if (l == NULL || l == lock) {
+            // a lock reinitialized at the same address takes the new class
+            __atomic_store_n(&spin_map[i].cls, cls, __ATOMIC_RELAXED);
+            __atomic_store_n(&spin_map[i].lock, lock, __ATOMIC_RELEASE);
+            break;
+        }
+    }
+    arch_spin_unlock(&table_lock);
+}
+
+// call with interrupts disabled
+static lockstat_class_t *spin_class(spin_lock_t *lock)
+{
+    for (uint n = 0; n < LOCKSTAT_MAP_PROBES; n++) {
+        uint i = (map_hash(lock) + n) & (LOCKSTAT_MAP_SIZE - 1);
+        spin_lock_t *l = __atomic_load_n(&spin_map[i].lock, __ATOMIC_ACQUIRE);
+        if (l == lock)
+            return __atomic_load_n(&spin_map[i].cls, __ATOMIC_RELAXED);
+        if (l == NULL)
+            break;
+    }
+
+    // never initialized with spin_lock_init(), so a class of its own
+    lockstat_class_t *cls = get_class(LOCKSTAT_TYPE_SPIN, NULL, 0, lock);
+    map_spin_lock(lock, cls);
+    return cls;
+}
+
+static void push_held(spin_lock_t *lock, lockstat_class_t *cls)
+{
+    uint cpu = arch_curr_cpu_num();
+    uint depth = held_spin[cpu].depth;
+    if (depth < LOCKSTAT_MAX_HELD) {
+        held_t *h = &held_spin[cpu].held[depth];
+        h->lock = lock;
+        h->cls = cls;
+        h->start = lockstat_ticks_raw();
+    }
+    held_spin[cpu].depth = depth + 1;
+}
+
+static void pop_held(spin_lock_t *lock)
+{
+    uint cpu = arch_curr_cpu_num();
+    uint depth = held_spin[cpu].depth;
+    if (depth == 0)
+        return;
+    held_spin[cpu].depth = depth - 1;
+
+    // usually the most recent, but not always
+    uint top = MIN(depth, (uint)LOCKSTAT_MAX_HELD);
+    for (uint i = top; i-- > 0;) {
+        held_t *h = &held_spin[cpu].held[i];
+        if (h->lock == lock) {
+            record_hold(h->cls, lockstat_ticks_raw() - h->start);
+            memmove(h, h + 1, (top - i - 1) * sizeof(held_t));
+            return;
+        }
+    }
+}
+
+void lockstat_spin_lock(spin_lock_t *lock)
+{
+    uintptr_t caller = (uintptr_t)__GET_CALLER();
+
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    lockstat_class_t *cls = spin_class(lock);
+    add(&cls->acquisitions, 1);
+    if (unlikely(arch_spin_trylock(lock))) {
+        uint64_t start = lockstat_ticks_raw();
+        uint64_t trace_start = ktrace_timestamp();
+        arch_spin_lock(lock);
+        record_wait(cls, lockstat_ticks_raw() - start, caller);
+        ktrace_lock_wait(TAG_SPINLOCK_WAIT, lock, trace_start);
+    }
+    push_held(lock, cls);
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+}
+
+int lockstat_spin_trylock(spin_lock_t *lock)
+{
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    int ret = arch_spin_trylock(lock);
+    if (ret == 0) {
+        lockstat_class_t *cls = spin_class(lock);
+        add(&cls->acquisitions, 1);
+        push_held(lock, cls);
+    }
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+    return ret;
+}
+
+void lockstat_spin_unlock(spin_lock_t *lock)
+{
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    pop_held(lock);
+    arch_spin_unlock(lock);
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+}
+
+void lockstat_spin_init(spin_lock_t *lock, const char *file, int line)
+{
+    arch_spin_lock_init(lock);
+
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    map_spin_lock(lock, get_class(LOCKSTAT_TYPE_SPIN, file, line, lock));
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+}
+
+void lockstat_mutex_held(mutex_t *m)
+{
+    if (unlikely(m->lockstat_class == NULL))
+        m->lockstat_class = get_class(LOCKSTAT_TYPE_MUTEX, m->lockstat_file, m->lockstat_line, m);
+    m->lockstat_acquired = lockstat_ticks_raw();
+}
+
+void lockstat_mutex_acquired(mutex_t *m, uint64_t wait_start, bool contended, void *caller)
+{
+    lockstat_class_t *cls = m->lockstat_class;
+    add(&cls->acquisitions, 1);
+    if (contended)
+        record_wait(cls, m->lockstat_acquired - wait_start, (uintptr_t)caller);
+}
+
+void lockstat_mutex_released(mutex_t *m)
+{
+    if (m->lockstat_class)
+        record_hold(m->lockstat_class, lockstat_ticks_raw() - m->lockstat_acquired);
+}
+
+static lockstat_class_t *class_at(uint32_t index)
+{
+    uint32_t n = __atomic_load_n(&num_classes, __ATOMIC_ACQUIRE);
+    if (index < n)
+        return &classes[index];
+    if (index == n)
+        return &overflow_spin;
+    if (index == n + 1)
+        return &overflow_mutex;
+    return NULL;
+}
+
+uint32_t lockstat_num_classes(void)
+{
+    return __atomic_load_n(&num_classes, __ATOMIC_ACQUIRE) + 2;
+}
+
+static void class_name(const lockstat_class_t *cls, char *buf, size_t len)
+{
+    if (cls == &overflow_spin || cls == &overflow_mutex) {
+        snprintf(buf, len, "(overflow)");
+    } else if (cls->file) {
+        // the end of the path is the useful part
+        size_t flen = strlen(cls->file);
+        size_t keep = len - 8;
+        const char *f = (flen > keep) ? cls->file + flen - keep : cls->file;
+        snprintf(buf, len, "%s:%d", f, cls->line);
+    } else {
+        snprintf(buf, len, "@%p", cls->addr);
+    }
+}
+
+status_t lockstat_get_record(uint32_t index, mx_record_lock_stats_t *rec)
+{
+    const lockstat_class_t *cls = class_at(index);
+    if (!cls)
+        return ERR_OUT_OF_RANGE;
+
+    memset(rec, 0, sizeof(*rec));
+    class_name(cls, rec->name, sizeof(rec->name));
+    rec->type = (cls->type == LOCKSTAT_TYPE_SPIN) ? MX_LOCK_STATS_TYPE_SPIN
+                                                  : MX_LOCK_STATS_TYPE_MUTEX;
+    rec->acquisitions = cls->acquisitions;
+    rec->contended = cls->contended;
+    rec->wait_time = cls->wait_total;
+    rec->max_wait = cls->wait_max;
+    rec->hold_time = cls->hold_total;
+    rec->max_hold = cls->hold_max;
+    for (uint i = 0; i < LOCKSTAT_BUCKETS; i++) {
+        rec->wait_histogram[i] = cls->wait_hist[i];
+        rec->hold_histogram[i] = cls->hold_hist[i];
+    }
+    for (uint i = 0; i < LOCKSTAT_CALLERS; i++) {
+        rec->callers[i] = cls->callers[i].pc;
+        rec->caller_counts[i] = cls->callers[i].count;
+    }
+    return NO_ERROR;
+}
+
+static void reset_class(lockstat_class_t *cls)
+{
+    // racy against lockers, which is fine for counters
+    cls->acquisitions = 0;
+    cls->contended = 0;
+    cls->wait_total = 0;
+    cls->wait_max = 0;
+    cls->hold_total = 0;
+    cls->hold_max = 0;
+    memset(cls->wait_hist, 0, sizeof(cls->wait_hist));
+    memset(cls->hold_hist, 0, sizeof(cls->hold_hist));
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    arch_spin_lock(&cls->callers_lock);
+    for (uint i = 0; i < LOCKSTAT_CALLERS; i++)
+        cls->callers[i].count = 0;
+    arch_spin_unlock(&cls->callers_lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+}
+
+#else // !WITH_LOCK_STATS
+
+status_t lockstat_get_record(uint32_t index, mx_record_lock_stats_t *rec)
+{
+    return ERR_NOT_SUPPORTED;
+}
+
+uint32_t lockstat_num_classes(void)
+{
+    return 0;
+}
+
+#endif // WITH_LOCK_STATS
+
+#if WITH_LIB_CONSOLE && WITH_LOCK_STATS
+
+#include <lib/console.h>
+
+static int cmd_lockstat(int argc, const cmd_args *argv);
+
+STATIC_COMMAND_START
+STATIC_COMMAND("lockstat", "lock contention profile", &cmd_lockstat)
+STATIC_COMMAND_END(lockstat);
+
+static uint64_t avg(uint64_t total, uint64_t n)
+{
+    return n ? total / n : 0;
+}
+
+static void dump_histogram(const char *what, const uint64_t *hist)
+{
+    printf("  %s:", what);
+    for (uint i = 0; i < LOCKSTAT_BUCKETS; i++)
+        printf(" %llu", hist[i]);
+    printf("\n");
+}
+
+static int cmd_lockstat(int argc, const cmd_args *argv)
+{
+    if (argc >= 2 && !strcmp(argv[1].str, "reset")) {
+        uint32_t n = lockstat_num_classes();
+        for (uint32_t i = 0; i < n; i++)
+            reset_class(class_at(i));
+        return 0;
+    }
+    if (argc >= 2 && !strcmp(argv[1].str, "help")) {
+        printf("usage: %s [all|reset|<class>]\n", argv[0].str);
+        printf("  lists the most contended lock classes, or all of them, or the\n");
+        printf("  histograms and waiting callers of one class\n");
+        printf("  histogram bucket n counts times from 4^n to 4^(n+1) ns\n");
+        return 0;
+    }
+
+    mx_record_lock_stats_t rec;
+    if (argc >= 2 && strcmp(argv[1].str, "all")) {
+        uint32_t i = argv[1].u;
+        if (lockstat_get_record(i, &rec) != NO_ERROR) {
+            printf("no lock class %u\n", i);
+            return -1;
+        }
+        printf("%u %s %s: %llu acquired, %llu contended\n", i,
+               rec.type == MX_LOCK_STATS_TYPE_SPIN ? "spin" : "mutex", rec.name,
+               rec.acquisitions, rec.contended);
+        printf("  wait avg %llu max %llu ns, hold avg %llu max %llu ns\n",
+               avg(rec.wait_time, rec.contended), rec.max_wait,
+               avg(rec.hold_time, rec.acquisitions), rec.max_hold);
+        dump_histogram("wait", rec.wait_histogram);
+        dump_histogram("hold", rec.hold_histogram);
+        for (uint c = 0; c < LOCKSTAT_CALLERS; c++) {
+            if (rec.callers[c])
+                printf("  waiter %#llx: %llu\n", rec.callers[c], rec.caller_counts[c]);
+        }
+        return 0;
+    }
+
+    // most contended first
+    static uint16_t order[LOCKSTAT_MAX_CLASSES + 2];
+    uint32_t n = lockstat_num_classes();
+    for (uint32_t i = 0; i < n; i++)
+        order[i] = i;
+    for (uint32_t i = 1; i < n; i++) {
+        uint16_t v = order[i];
+        uint32_t j = i;
+        while (j > 0 && class_at(order[j - 1])->contended < class_at(v)->contended) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = v;
+    }
+
+    uint32_t shown = (argc >= 2) ? n : MIN(n, 20u);
+    printf("%4s %-5s %-40s %12s %10s %10s %10s %10s\n", "id", "type", "class",
+           "acquired", "contended", "wait avg", "wait max", "hold avg");
+    for (uint32_t k = 0; k < shown; k++) {
+        uint32_t i = order[k];
+        lockstat_get_record(i, &rec);
+        if (rec.acquisitions == 0)
+            continue;
+        printf("%4u %-5s %-40s %12llu %10llu %10llu %10llu %10llu\n", i,
+               rec.type == MX_LOCK_STATS_TYPE_SPIN ? "spin" : "mutex", rec.name,
+               rec.acquisitions, rec.contended, avg(rec.wait_time, rec.contended), rec.max_wait,
+               avg(rec.hold_time, rec.acquisitions));
+    }
+    return 0;
+}
+
+#endif // WITH_LIB_CONSOLE && WITH_LOCK_STATS
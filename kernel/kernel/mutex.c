@@ -20,15 +20,30 @@
 #include <assert.h>
 #include <err.h>
 #include <kernel/thread.h>
+#include <lib/ktrace.h>
 
 /**
  * @brief  Initialize a mutex_t
  */
-void mutex_init(mutex_t *m)
+void (mutex_init)(mutex_t *m)
 {
+#if WITH_LOCK_STATS
+    *m = (mutex_t)MUTEX_INITIAL_VALUE_SITE(*m, NULL, 0);
+#else
     *m = (mutex_t)MUTEX_INITIAL_VALUE(*m);
+#endif
 }
 
+#if WITH_LOCK_STATS
+/**
+ * @brief  Initialize a mutex_t, recording the call site for the lock profiler
+ */
+void mutex_init_etc(mutex_t *m, const char *file, int line)
+{
+    *m = (mutex_t)MUTEX_INITIAL_VALUE_SITE(*m, file, line);
+}
+#endif
+
 /**
  * @brief  Destroy a mutex_t
  *
@@ -60,7 +75,9 @@ void mutex_destroy(mutex_t *m)
 status_t mutex_acquire_timeout_internal(mutex_t *m, lk_time_t timeout)
 {
     if (unlikely(++m->count > 1)) {
+        uint64_t start = ktrace_timestamp();
         status_t ret = wait_queue_block(&m->wait, timeout);
+        ktrace_lock_wait(TAG_MUTEX_WAIT, m, start);
         if (unlikely(ret < NO_ERROR)) {
             /* if the acquisition timed out, back out the acquire and exit */
             if (likely(ret == ERR_TIMED_OUT)) {
@@ -74,6 +91,9 @@ status_t mutex_acquire_timeout_internal(mutex_t *m, lk_time_t timeout)
     }
 
     m->holder = get_current_thread();
+#if WITH_LOCK_STATS
+    lockstat_mutex_held(m);
+#endif
 
     return NO_ERROR;
 }
@@ -98,14 +118,28 @@ status_t mutex_acquire_timeout(mutex_t *m, lk_time_t timeout)
               get_current_thread(), get_current_thread()->name, m);
 #endif
 
+#if WITH_LOCK_STATS
+    uint64_t start = lockstat_ticks();
+#endif
+
     THREAD_LOCK(state);
+#if WITH_LOCK_STATS
+    bool contended = m->count > 0;
+#endif
     status_t ret = mutex_acquire_timeout_internal(m, timeout);
+#if WITH_LOCK_STATS
+    if (ret == NO_ERROR)
+        lockstat_mutex_acquired(m, start, contended, __GET_CALLER());
+#endif
     THREAD_UNLOCK(state);
     return ret;
 }
 
 void mutex_release_internal(mutex_t *m, bool reschedule)
 {
+#if WITH_LOCK_STATS
+    lockstat_mutex_released(m);
+#endif
     m->holder = 0;
 
     if (unlikely(--m->count >= 1)) {
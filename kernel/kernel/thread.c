@@ -77,6 +77,15 @@ static void thread_unblock(thread_t *t, bool resched);
 static timer_t preempt_timer[SMP_MAX_CPUS];
 #endif
 
+/* a thread coming back from a block or sleep ends its wait */
+static inline void thread_end_wait(thread_t *t)
+{
+    if (t->last_blocked_us) {
+        t->wait_time_us += current_time_hires() - t->last_blocked_us;
+        t->last_blocked_us = 0;
+    }
+}
+
 /* run queue manipulation */
 static void insert_in_run_queue_head(thread_t *t)
 {
@@ -86,6 +95,7 @@ static void insert_in_run_queue_head(thread_t *t)
     DEBUG_ASSERT(arch_ints_disabled());
     DEBUG_ASSERT(spin_lock_held(&thread_lock));
 
+    thread_end_wait(t);
     list_add_head(&run_queue[t->priority], &t->queue_node);
     run_queue_bitmap |= (1<<t->priority);
 }
@@ -98,6 +108,7 @@ static void insert_in_run_queue_tail(thread_t *t)
     DEBUG_ASSERT(arch_ints_disabled());
     DEBUG_ASSERT(spin_lock_held(&thread_lock));
 
+    thread_end_wait(t);
     list_add_tail(&run_queue[t->priority], &t->queue_node);
     run_queue_bitmap |= (1<<t->priority);
 }
@@ -543,6 +554,26 @@ done:
     THREAD_UNLOCK(state);
 }
 
+void thread_syscall_enter(void)
+{
+    DEBUG_ASSERT(arch_ints_disabled());
+
+    THREAD_STATS_INC(syscalls);
+    get_current_thread()->syscall_started_us = current_time_hires();
+}
+
+void thread_syscall_exit(void)
+{
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    thread_t *t = get_current_thread();
+    THREAD_STATS_ADD(syscall_time, current_time_hires() - t->syscall_started_us);
+    t->syscall_started_us = 0;
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+}
+
 /* check for any pending signals and handle them */
 void thread_process_pending_signals(void)
 {
@@ -639,6 +670,22 @@ static void thread_resched(void)
     oldthread->runtime_us += now - oldthread->last_started_running_us;
     newthread->last_started_running_us = now;
 
+    oldthread->context_switches++;
+    if (oldthread->state == THREAD_READY) {
+        oldthread->preemptions++;
+    } else if (oldthread->state == THREAD_BLOCKED || oldthread->state == THREAD_SLEEPING) {
+        oldthread->last_blocked_us = now;
+    }
+
+    /* syscall time follows the cpu the syscall is running on */
+    if (oldthread->syscall_started_us) {
+        THREAD_STATS_ADD(syscall_time, now - oldthread->syscall_started_us);
+        oldthread->syscall_started_us = now;
+    }
+    if (newthread->syscall_started_us) {
+        newthread->syscall_started_us = now;
+    }
+
     /* set up quantum for the new thread if it was consumed */
     if (newthread->remaining_quantum <= 0) {
         newthread->remaining_quantum = 5; // XXX make this smarter
@@ -1188,6 +1235,8 @@ void dump_thread(thread_t *t)
             thread_state_to_str(t->state), t->priority, t->remaining_quantum);
 #endif
     dprintf(INFO, "\truntime_us %lld, runtime_s %lld\n", runtime, runtime / 1000000);
+    dprintf(INFO, "\twait_time_us %lld, context switches %llu, preemptions %llu, page faults %llu\n",
+            t->wait_time_us, t->context_switches, t->preemptions, t->page_faults);
     dprintf(INFO, "\tstack %p, stack_size %zd\n", t->stack, t->stack_size);
     dprintf(INFO, "\tentry %p, arg %p, flags 0x%x %s%s%s%s%s%s\n", t->entry, t->arg, t->flags,
             (t->flags & THREAD_FLAG_DETACHED) ? "Dt" :"",
@@ -27,6 +27,7 @@
 #include <kernel/timer.h>
 #include <kernel/debug.h>
 #include <kernel/spinlock.h>
+#include <lib/ktrace.h>
 #include <platform/timer.h>
 #include <platform.h>
 
@@ -36,6 +37,8 @@ spin_lock_t timer_lock;
 
 struct timer_state {
     struct list_node timer_queue;
+    /* timer whose callback this cpu is running, for timer_cancel_sync() */
+    timer_t *running;
 } __CPU_ALIGN;
 
 static struct timer_state timers[SMP_MAX_CPUS];
@@ -151,16 +154,10 @@ void timer_set_periodic(timer_t *timer, lk_time_t period, timer_callback callbac
     timer_set(timer, period, period, callback, arg);
 }
 
-/**
- * @brief  Cancel a pending timer
- */
-void timer_cancel(timer_t *timer)
+static void timer_cancel_locked(timer_t *timer)
 {
     DEBUG_ASSERT(timer->magic == TIMER_MAGIC);
 
-    spin_lock_saved_state_t state;
-    spin_lock_irqsave(&timer_lock, state);
-
 #if PLATFORM_HAS_DYNAMIC_TIMER
     uint cpu = arch_curr_cpu_num();
 
@@ -196,10 +193,49 @@ void timer_cancel(timer_t *timer)
         platform_set_oneshot_timer(timer_tick, NULL, delay);
     }
 #endif
+}
+
+/**
+ * @brief  Cancel a pending timer
+ */
+void timer_cancel(timer_t *timer)
+{
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&timer_lock, state);
+
+    timer_cancel_locked(timer);
 
     spin_unlock_irqrestore(&timer_lock, state);
 }
 
+/**
+ * @brief  Cancel a timer and wait for its callback, if running, to return
+ */
+void timer_cancel_sync(timer_t *timer)
+{
+    for (;;) {
+        spin_lock_saved_state_t state;
+        spin_lock_irqsave(&timer_lock, state);
+
+        timer_cancel_locked(timer);
+
+        /* the callback may be running on another cpu, and may re-arm
+         * the timer before it returns, so cancel again once it has */
+        uint curr = arch_curr_cpu_num();
+        bool running = false;
+        for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+            if (cpu != curr && timers[cpu].running == timer)
+                running = true;
+        }
+
+        spin_unlock_irqrestore(&timer_lock, state);
+
+        if (!running)
+            return;
+        arch_spinloop_pause();
+    }
+}
+
 /* called at interrupt time to process any pending timers */
 static enum handler_return timer_tick(void *arg, lk_time_t now)
 {
@@ -230,6 +266,7 @@ static enum handler_return timer_tick(void *arg, lk_time_t now)
         LTRACEF("timer %p\n", timer);
         DEBUG_ASSERT(timer && timer->magic == TIMER_MAGIC);
         list_delete(&timer->node);
+        timers[cpu].running = timer;
 
         /* we pulled it off the list, release the list lock to handle it */
         spin_unlock(&timer_lock);
@@ -242,12 +279,16 @@ static enum handler_return timer_tick(void *arg, lk_time_t now)
 
         LTRACEF("timer %p firing callback %p, arg %p\n", timer, timer->callback, timer->arg);
         KEVLOG_TIMER_CALL(timer->callback, timer->arg);
+        uint64_t func = (uintptr_t)timer->callback;
+        ktrace(TAG_TIMER_CALL, (uint32_t)func, (uint32_t)(func >> 32), 0, 0);
         if (timer->callback(timer, now, timer->arg) == INT_RESCHEDULE)
             ret = INT_RESCHEDULE;
+        ktrace(TAG_TIMER_EXIT, (uint32_t)func, (uint32_t)(func >> 32), 0, 0);
 
         DEBUG_ASSERT(arch_ints_disabled());
         /* it may have been requeued or periodic, grab the lock so we can safely inspect it */
         spin_lock(&timer_lock);
+        timers[cpu].running = NULL;
 
         /* if it was a periodic timer and it hasn't been requeued
          * by the callback put it back in the list
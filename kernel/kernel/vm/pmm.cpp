@@ -23,6 +23,13 @@
 static struct list_node arena_list = LIST_INITIAL_VALUE(arena_list);
 static mutex_t lock = MUTEX_INITIAL_VALUE(lock);
 
+/* the smallest, least aligned run pmm_alloc_contiguous() could not find in any arena
+ * since pages were last freed. runs at least as long and as aligned cannot be found
+ * either, so large page allocations fail fast instead of rescanning every arena.
+ */
+static size_t failed_run_count;
+static uint8_t failed_run_align;
+
 #define PAGE_BELONGS_TO_ARENA(page, arena)                    \
     (((uintptr_t)(page) >= (uintptr_t)(arena)->page_array) && \
      ((uintptr_t)(page) <                                     \
@@ -81,6 +88,7 @@ status_t pmm_add_arena(pmm_arena_t* arena) {
     list_add_tail(&arena_list, &arena->node);
 
 done_add:
+    failed_run_count = 0;
 
     /* zero out some of the structure */
     arena->free_count = 0;
@@ -235,6 +243,13 @@ size_t pmm_alloc_contiguous(size_t count, uint alloc_flags, uint8_t alignment_lo
 
     AutoLock al(lock);
 
+    bool any_arena = !(alloc_flags & PMM_ALLOC_FLAG_KMAP);
+    if (any_arena && failed_run_count && count >= failed_run_count &&
+        alignment_log2 >= failed_run_align) {
+        LTRACEF("no run since the last failure\n");
+        return 0;
+    }
+
     pmm_arena_t* a;
     list_for_every_entry (&arena_list, a, pmm_arena_t, node) {
         /* skip the arena if it's not KMAP and the KMAP only allocation flag was passed */
@@ -242,6 +257,10 @@ size_t pmm_alloc_contiguous(size_t count, uint alloc_flags, uint8_t alignment_lo
             if ((a->flags & PMM_ARENA_FLAG_KMAP) == 0)
                 continue;
         }
+        /* not enough free pages to hold the run */
+        if (a->free_count < count)
+            continue;
+
         /* walk the list starting at alignment boundaries.
          * calculate the starting offset into this arena, based on the
          * base address of the arena to handle the case where the arena
@@ -299,6 +318,11 @@ size_t pmm_alloc_contiguous(size_t count, uint alloc_flags, uint8_t alignment_lo
     }
 
     LTRACEF("couldn't find run\n");
+    if (any_arena && (failed_run_count == 0 ||
+                      (count <= failed_run_count && alignment_log2 <= failed_run_align))) {
+        failed_run_count = count;
+        failed_run_align = alignment_log2;
+    }
     return 0;
 }
 
@@ -393,6 +417,7 @@ size_t pmm_free(struct list_node* list) {
                 list_add_head(&a->free_list, &page->node);
                 a->free_count++;
                 count++;
+                failed_run_count = 0;
                 break;
             }
         }
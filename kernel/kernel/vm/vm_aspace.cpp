@@ -451,6 +451,12 @@ status_t VmAspace::MapObject(mxtl::RefPtr<VmObject> vmo, const char* name, uint6
             return ERR_INVALID_ARGS;
     }
 
+    // line the region up with the object's large pages, so they can be
+    // mapped whole
+    if (vmo->large_pages() && !(vmm_flags & VMM_FLAG_VALLOC_SPECIFIC) &&
+        size >= VmObject::LARGE_PAGE_SIZE && offset % VmObject::LARGE_PAGE_SIZE == 0)
+        align_pow2 = MAX(align_pow2, VmObject::LARGE_PAGE_SHIFT);
+
     // hold the vmm lock for the rest of the function
     AutoLock a(lock_);
 
@@ -609,7 +615,8 @@ status_t VmAspace::Alloc(const char* name, size_t size, void** ptr, uint8_t alig
         return ERR_INVALID_ARGS;
 
     // allocate a vm object to back it
-    auto vmo = VmObject::Create(PMM_ALLOC_FLAG_ANY, size);
+    uint32_t vmo_flags = (vmm_flags & VMM_FLAG_LARGE_PAGES) ? VmObject::FLAG_LARGE_PAGES : 0;
+    auto vmo = VmObject::Create(PMM_ALLOC_FLAG_ANY, size, vmo_flags);
     if (!vmo)
         return ERR_NO_MEMORY;
 
@@ -653,6 +660,81 @@ status_t VmAspace::FreeRegion(vaddr_t vaddr) {
     return NO_ERROR;
 }
 
+void VmAspace::UnmapObjectRange(VmRegion& r, uint64_t offset, uint64_t len) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(offset) && IS_PAGE_ALIGNED(len));
+
+    AutoLock a(lock_);
+
+    // the region may have been unmapped, and its range reused, since the
+    // object last looked
+    if (FindRegionLocked(r.base()).get() != &r)
+        return;
+
+    uint64_t start = MAX(offset, r.object_offset());
+    uint64_t end = MIN(offset + len, r.object_offset() + r.size());
+    if (start >= end)
+        return;
+
+    vaddr_t va = r.base() + static_cast<vaddr_t>(start - r.object_offset());
+    arch_mmu_unmap(&arch_aspace_, va, static_cast<size_t>((end - start) / PAGE_SIZE));
+}
+
+// call fn(region, vmo, offset, len) for the object behind each region in [vaddr, vaddr + len)
+template <typename T>
+static status_t ForEachObjectRange(VmAspace* aspace, vaddr_t vaddr, size_t len, T fn) {
+    if (!IS_PAGE_ALIGNED(vaddr))
+        return ERR_INVALID_ARGS;
+    len = ROUNDUP(len, PAGE_SIZE);
+    if (len == 0 || vaddr + len < vaddr)
+        return ERR_INVALID_ARGS;
+
+    vaddr_t end = vaddr + len;
+    while (vaddr < end) {
+        // look each region up afresh, since the object work below may block
+        auto r = aspace->FindRegion(vaddr);
+        if (!r)
+            return ERR_NOT_FOUND;
+        auto vmo = r->vmo();
+        if (!vmo)
+            return ERR_NOT_SUPPORTED;
+
+        vaddr_t chunk_end = MIN(end, r->base() + r->size());
+        status_t status = fn(*r, vmo, r->object_offset() + (vaddr - r->base()),
+                             chunk_end - vaddr);
+        if (status < 0)
+            return status;
+        vaddr = chunk_end;
+    }
+    return NO_ERROR;
+}
+
+status_t VmAspace::DecommitRange(vaddr_t vaddr, size_t len) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+    LTRACEF("vaddr 0x%lx len 0x%zx\n", vaddr, len);
+
+    return ForEachObjectRange(this, vaddr, len,
+                              [](VmRegion& r, mxtl::RefPtr<VmObject>& vmo, uint64_t offset,
+                                 uint64_t len) {
+        // the contents go, so only where they could have been written
+        if (!(r.arch_mmu_flags() & ARCH_MMU_FLAG_PERM_WRITE))
+            return ERR_ACCESS_DENIED;
+        int64_t ret = vmo->DecommitRange(offset, len);
+        return (ret < 0) ? static_cast<status_t>(ret) : NO_ERROR;
+    });
+}
+
+status_t VmAspace::PrefetchRange(vaddr_t vaddr, size_t len) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+    LTRACEF("vaddr 0x%lx len 0x%zx\n", vaddr, len);
+
+    return ForEachObjectRange(this, vaddr, len,
+                              [](VmRegion& r, mxtl::RefPtr<VmObject>& vmo, uint64_t offset,
+                                 uint64_t len) {
+        return vmo->PrefetchRange(offset, len);
+    });
+}
+
 void VmAspace::AttachToThread(thread_t* t) {
     DEBUG_ASSERT(magic_ == MAGIC);
     DEBUG_ASSERT(t);
@@ -696,6 +778,31 @@ void VmAspace::Dump() const {
     }
 }
 
+void VmAspace::GetMemoryUsage(size_t* mapped, size_t* committed, size_t* large,
+                              uint32_t* regions) const {
+    DEBUG_ASSERT(magic_ == MAGIC);
+
+    *mapped = 0;
+    *committed = 0;
+    *large = 0;
+    *regions = 0;
+
+    AutoLock a(lock_);
+    for (const auto& r : regions_) {
+        *mapped += r.size();
+        (*regions)++;
+
+        // objects shared between mappings are counted once per mapping
+        auto vmo = r.vmo();
+        if (vmo) {
+            size_t large_pages;
+            size_t pages = vmo->AllocatedPages(r.object_offset(), r.size(), &large_pages);
+            *committed += pages * PAGE_SIZE;
+            *large += large_pages * PAGE_SIZE;
+        }
+    }
+}
+
 void DumpAllAspaces() {
     AutoLock a(aspace_list_lock);
 
@@ -7,11 +7,16 @@
 #include "kernel/vm/vm_object.h"
 
 #include "vm_priv.h"
+#include <arch/ops.h>
 #include <assert.h>
 #include <err.h>
 #include <kernel/auto_lock.h>
+#include <kernel/event.h>
+#include <kernel/thread.h>
 #include <kernel/vm.h>
+#include <kernel/vm/vm_aspace.h>
 #include <lib/user_copy.h>
+#include <lk/init.h>
 #include <new.h>
 #include <stdlib.h>
 #include <string.h>
@@ -39,8 +44,15 @@ static size_t OffsetToIndex(uint64_t offset) {
     return static_cast<size_t>(index64);
 }
 
-VmObject::VmObject(uint32_t pmm_alloc_flags)
-    : pmm_alloc_flags_(pmm_alloc_flags) {
+// large page counters, across all objects
+static struct {
+    int live;      // chunks currently backed by a large page
+    int allocated; // large pages ever allocated
+    int fallbacks; // chunks that could not get one and used separate pages
+} large_page_stats;
+
+VmObject::VmObject(uint32_t pmm_alloc_flags, uint32_t flags)
+    : pmm_alloc_flags_(pmm_alloc_flags), flags_(flags) {
     LTRACEF("%p\n", this);
 }
 
@@ -69,6 +81,12 @@ VmObject::~VmObject() {
     }
 
     DEBUG_ASSERT(list_length(&page_list_) == 0);
+    DEBUG_ASSERT(mapping_list_.is_empty());
+
+    for (size_t i = 0; i < chunk_state_.size(); i++) {
+        if (chunk_state_[i] == CHUNK_LARGE)
+            atomic_add(&large_page_stats.live, -1);
+    }
 
     __UNUSED auto freed = pmm_free(&list);
     DEBUG_ASSERT(freed == count);
@@ -77,13 +95,14 @@ VmObject::~VmObject() {
     magic_ = 0;
 }
 
-mxtl::RefPtr<VmObject> VmObject::Create(uint32_t pmm_alloc_flags, uint64_t size) {
+mxtl::RefPtr<VmObject> VmObject::Create(uint32_t pmm_alloc_flags, uint64_t size,
+                                        uint32_t flags) {
     // there's a max size to keep indexes within range
     if (size > MAX_SIZE)
         return nullptr;
 
     AllocChecker ac;
-    auto vmo = mxtl::AdoptRef(new (&ac) VmObject(pmm_alloc_flags));
+    auto vmo = mxtl::AdoptRef(new (&ac) VmObject(pmm_alloc_flags, flags));
     if (!ac.check())
         return nullptr;
 
@@ -102,15 +121,55 @@ void VmObject::Dump() {
     DEBUG_ASSERT(magic_ == MAGIC);
 
     size_t count = 0;
+    size_t large = 0;
     {
         AutoLock a(lock_);
         for (size_t i = 0; i < page_array_.size(); i++) {
             if (page_array_[i])
                 count++;
         }
+        for (size_t i = 0; i < chunk_state_.size(); i++) {
+            if (chunk_state_[i] == CHUNK_LARGE)
+                large++;
+        }
     }
-    printf("\t\tobject %p: ref %u size 0x%llx, %zu allocated pages\n", this, ref_count_debug(),
-           size_, count);
+    printf("\t\tobject %p: ref %u size 0x%llx, %zu allocated pages, %zu large pages\n", this,
+           ref_count_debug(), size_, count, large);
+}
+
+void VmObject::DumpLargePageStats() {
+    int live = large_page_stats.live;
+    printf("large pages: %d in use (%zu KB), %d allocated, %d fallbacks\n", live,
+           (size_t)live * LARGE_PAGE_PAGES * PAGE_SIZE / 1024, large_page_stats.allocated,
+           large_page_stats.fallbacks);
+}
+
+size_t VmObject::AllocatedPages(uint64_t offset, uint64_t len, size_t* large_pages) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+
+    if (large_pages)
+        *large_pages = 0;
+
+    AutoLock a(lock_);
+    if (offset >= size_ || len == 0)
+        return 0;
+    size_t start = static_cast<size_t>(offset / PAGE_SIZE);
+    size_t end = static_cast<size_t>(ROUNDUP_PAGE_SIZE(MIN(offset + len, size_)) / PAGE_SIZE);
+    end = MIN(end, page_array_.size());
+
+    size_t count = 0;
+    size_t large = 0;
+    for (size_t i = start; i < end; i++) {
+        if (page_array_[i]) {
+            count++;
+            size_t chunk = i / LARGE_PAGE_PAGES;
+            if (chunk < chunk_state_.size() && chunk_state_[chunk] == CHUNK_LARGE)
+                large++;
+        }
+    }
+    if (large_pages)
+        *large_pages = large;
+    return count;
 }
 
 status_t VmObject::Resize(uint64_t s) {
@@ -142,6 +201,17 @@ status_t VmObject::Resize(uint64_t s) {
 
     page_array_.reset(pa, page_count);
 
+    // only whole chunks can be large pages
+    if (large_pages()) {
+        size_t chunk_count = page_count / LARGE_PAGE_PAGES;
+        if (chunk_count > 0) {
+            uint8_t* cs = new (&ac) uint8_t[chunk_count] {};
+            if (!ac.check())
+                return ERR_NO_MEMORY;
+            chunk_state_.reset(cs, chunk_count);
+        }
+    }
+
     return NO_ERROR;
 }
 
@@ -156,6 +226,96 @@ void VmObject::AddPageToArray(size_t index, vm_page_t* p) {
 
     DEBUG_ASSERT(!list_in_list(&p->node));
     list_add_tail(&page_list_, &p->node);
+
+    // a page on its own spoils the chunk for a large page
+    size_t chunk = index / LARGE_PAGE_PAGES;
+    if (chunk < chunk_state_.size() && chunk_state_[chunk] == CHUNK_EMPTY)
+        chunk_state_[chunk] = CHUNK_SMALL;
+}
+
+// back an empty chunk with a large page, returning false if there isn't a
+// free, suitably aligned run of physical memory for one
+bool VmObject::CommitLargePageLocked(size_t chunk) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+    DEBUG_ASSERT(is_mutex_held(&lock_));
+    DEBUG_ASSERT(chunk < chunk_state_.size());
+    DEBUG_ASSERT(chunk_state_[chunk] == CHUNK_EMPTY);
+
+    list_node page_list;
+    list_initialize(&page_list);
+
+    paddr_t pa;
+    size_t allocated = pmm_alloc_contiguous(LARGE_PAGE_PAGES, pmm_alloc_flags_, LARGE_PAGE_SHIFT,
+                                            &pa, &page_list);
+    if (allocated < LARGE_PAGE_PAGES) {
+        LTRACEF("no large page for chunk %zu\n", chunk);
+        pmm_free(&page_list);
+        atomic_add(&large_page_stats.fallbacks, 1);
+        return false;
+    }
+
+    LTRACEF("chunk %zu gets large page at pa 0x%lx\n", chunk, pa);
+
+    chunk_state_[chunk] = CHUNK_LARGE;
+    size_t index = chunk * LARGE_PAGE_PAGES;
+    for (size_t i = 0; i < LARGE_PAGE_PAGES; i++) {
+        vm_page_t* p = list_remove_head_type(&page_list, vm_page_t, node);
+        DEBUG_ASSERT(p);
+
+        // TODO: remove once pmm returns zeroed pages
+        ZeroPage(p);
+
+        AddPageToArray(index + i, p);
+    }
+    DEBUG_ASSERT(list_is_empty(&page_list));
+
+    atomic_add(&large_page_stats.live, 1);
+    atomic_add(&large_page_stats.allocated, 1);
+
+    return true;
+}
+
+// after pages in [offset, end) were removed, work out what the chunks
+// they came from are backed by now
+void VmObject::UpdateChunksLocked(uint64_t offset, uint64_t end) {
+    DEBUG_ASSERT(is_mutex_held(&lock_));
+
+    if (chunk_state_.size() == 0 || end <= offset)
+        return;
+
+    size_t first = OffsetToIndex(offset) / LARGE_PAGE_PAGES;
+    size_t last = MIN(OffsetToIndex(end - 1) / LARGE_PAGE_PAGES, chunk_state_.size() - 1);
+    for (size_t chunk = first; chunk <= last; chunk++) {
+        if (chunk_state_[chunk] == CHUNK_EMPTY)
+            continue;
+
+        bool empty = true;
+        for (size_t i = 0; i < LARGE_PAGE_PAGES; i++) {
+            if (page_array_[chunk * LARGE_PAGE_PAGES + i]) {
+                empty = false;
+                break;
+            }
+        }
+
+        // large pages only ever go as a whole, see SplitsChunkLocked()
+        if (chunk_state_[chunk] == CHUNK_LARGE) {
+            DEBUG_ASSERT(empty);
+            atomic_add(&large_page_stats.live, -1);
+        }
+
+        // once empty it can have a large page again
+        chunk_state_[chunk] = empty ? CHUNK_EMPTY : CHUNK_SMALL;
+    }
+}
+
+// true if offset falls inside a whole chunk rather than on its edge.
+// Unmapping part of a large page mapping has to split it, which the arch
+// layer cannot back out of if it runs out of memory for the page table.
+bool VmObject::SplitsChunkLocked(uint64_t offset) const {
+    DEBUG_ASSERT(is_mutex_held(&lock_));
+
+    return (offset % LARGE_PAGE_SIZE) != 0 &&
+           OffsetToIndex(offset) / LARGE_PAGE_PAGES < chunk_state_.size();
 }
 
 status_t VmObject::AddPage(vm_page_t* p, uint64_t offset) {
@@ -194,6 +354,21 @@ vm_page_t* VmObject::GetPage(uint64_t offset) {
     return GetPageLocked(offset);
 }
 
+bool VmObject::GetLargePage(uint64_t offset, paddr_t* pa) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+    AutoLock a(lock_);
+
+    if (offset >= size_)
+        return false;
+
+    size_t chunk = OffsetToIndex(offset) / LARGE_PAGE_PAGES;
+    if (chunk >= chunk_state_.size() || chunk_state_[chunk] != CHUNK_LARGE)
+        return false;
+
+    *pa = vm_page_to_paddr(page_array_[chunk * LARGE_PAGE_PAGES]);
+    return true;
+}
+
 vm_page_t* VmObject::FaultPageLocked(uint64_t offset, uint pf_flags) {
     DEBUG_ASSERT(magic_ == MAGIC);
     DEBUG_ASSERT(is_mutex_held(&lock_));
@@ -209,6 +384,13 @@ vm_page_t* VmObject::FaultPageLocked(uint64_t offset, uint pf_flags) {
     if (p)
         return p;
 
+    // the first fault in an empty chunk brings in the whole large page
+    size_t chunk = index / LARGE_PAGE_PAGES;
+    if (chunk < chunk_state_.size() && chunk_state_[chunk] == CHUNK_EMPTY) {
+        if (CommitLargePageLocked(chunk))
+            return page_array_[index];
+    }
+
     // allocate a page
     paddr_t pa;
     p = pmm_alloc_page(pmm_alloc_flags_, &pa);
@@ -250,6 +432,16 @@ int64_t VmObject::CommitRange(uint64_t offset, uint64_t len) {
     uint64_t end = ROUNDUP_PAGE_SIZE(offset + len);
     DEBUG_ASSERT(end > offset);
 
+    // give the empty chunks wholly inside the range large pages first
+    if (chunk_state_.size() > 0) {
+        size_t first = OffsetToIndex(ROUNDUP(offset, LARGE_PAGE_SIZE)) / LARGE_PAGE_PAGES;
+        size_t last = OffsetToIndex(ROUNDDOWN(end, LARGE_PAGE_SIZE)) / LARGE_PAGE_PAGES;
+        for (size_t chunk = first; chunk < last && chunk < chunk_state_.size(); chunk++) {
+            if (chunk_state_[chunk] == CHUNK_EMPTY)
+                CommitLargePageLocked(chunk);
+        }
+    }
+
     // make a pass through the list, counting the number of pages we need to allocate
     size_t count = 0;
     for (uint64_t o = offset; o < end; o += PAGE_SIZE) {
@@ -272,10 +464,13 @@ int64_t VmObject::CommitRange(uint64_t offset, uint64_t len) {
         return ERR_NO_MEMORY;
     }
 
-    // add them to the appropriate range of the object
+    // add them to the holes in the range of the object
     for (uint64_t o = offset; o < end; o += PAGE_SIZE) {
         size_t index = OffsetToIndex(o);
 
+        if (page_array_[index])
+            continue;
+
         vm_page_t* p = list_remove_head_type(&page_list, vm_page_t, node);
         DEBUG_ASSERT(p);
 
@@ -351,6 +546,243 @@ int64_t VmObject::CommitRangeContiguous(uint64_t offset, uint64_t len, uint8_t a
     return count * PAGE_SIZE;
 }
 
+void VmObject::AddMapping(VmRegion* r) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+    AutoLock a(lock_);
+
+    mapping_list_.push_front(r);
+    mapping_count_++;
+}
+
+void VmObject::RemoveMapping(VmRegion* r) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+    AutoLock a(lock_);
+
+    // regions leave when unmapped and again when destroyed
+    if (!VmRegion::ObjectMappingListTraits::node_state(*r).InContainer())
+        return;
+    mapping_list_.erase(*r);
+    mapping_count_--;
+}
+
+int64_t VmObject::DecommitRange(uint64_t offset, uint64_t len) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+    LTRACEF("offset 0x%llx, len 0x%llx\n", offset, len);
+
+    list_node freed_list;
+    list_initialize(&freed_list);
+    mxtl::Array<mxtl::RefPtr<VmRegion>> mappings;
+    size_t count = 0;
+    uint64_t end;
+    {
+        AutoLock a(lock_);
+
+        // trim the size
+        if (!TrimRange(offset, len, size_))
+            return ERR_OUT_OF_RANGE;
+
+        // pinned pages may be the target of device dma
+        if (PinnedLocked(offset, len))
+            return ERR_BAD_STATE;
+
+        // was in range, just zero length
+        if (len == 0)
+            return 0;
+
+        // only whole pages, so no data outside the range is lost
+        if (!IS_PAGE_ALIGNED(offset) || (!IS_PAGE_ALIGNED(len) && offset + len != size_))
+            return ERR_INVALID_ARGS;
+        end = ROUNDUP_PAGE_SIZE(offset + len);
+
+        // whole chunks of a large page object go all at once
+        if (SplitsChunkLocked(offset) || SplitsChunkLocked(end))
+            return ERR_INVALID_ARGS;
+
+        // note who maps the object before letting go of any pages
+        if (mapping_count_ > 0) {
+            AllocChecker ac;
+            auto regions = new (&ac) mxtl::RefPtr<VmRegion>[mapping_count_];
+            if (!ac.check())
+                return ERR_NO_MEMORY;
+            mappings.reset(regions, mapping_count_);
+
+            size_t i = 0;
+            for (auto& r : mapping_list_)
+                mappings[i++] = mxtl::WrapRefPtr(&r);
+        }
+
+        // take the pages out of the object, so new faults get fresh ones
+        for (uint64_t o = offset; o < end; o += PAGE_SIZE) {
+            size_t index = OffsetToIndex(o);
+
+            vm_page_t* p = page_array_[index];
+            if (!p)
+                continue;
+
+            page_array_[index] = nullptr;
+            list_delete(&p->node);
+            list_add_tail(&freed_list, &p->node);
+            count++;
+        }
+
+        // emptied chunks can get a large page again
+        UpdateChunksLocked(offset, end);
+    }
+
+    if (count == 0)
+        return 0;
+
+    // a fault that picked up one of the old pages mapped it before letting
+    // go of its aspace lock, which UnmapObjectRange() takes, so once every
+    // mapping has been through it nothing can reach the pages any more
+    for (size_t i = 0; i < mappings.size(); i++)
+        mappings[i]->aspace().UnmapObjectRange(*mappings[i], offset, end - offset);
+
+    __UNUSED auto freed = pmm_free(&freed_list);
+    DEBUG_ASSERT(freed == count);
+
+    return count * PAGE_SIZE;
+}
+
+status_t VmObject::QueryResidency(uint64_t offset, uint64_t len, user_ptr<uint8_t> bitmap,
+                                  size_t bitmap_size) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+    LTRACEF("offset 0x%llx, len 0x%llx\n", offset, len);
+
+    if (unlikely(len == 0))
+        return ERR_INVALID_ARGS;
+
+    // size_ never changes once set
+    if (unlikely(!InRange(offset, len, size_)))
+        return ERR_OUT_OF_RANGE;
+
+    size_t start = OffsetToIndex(offset);
+    size_t end = OffsetToIndex(ROUNDUP_PAGE_SIZE(offset + len));
+    if (unlikely(bitmap_size < (end - start + 7) / 8))
+        return ERR_BUFFER_TOO_SMALL;
+
+    // build the bitmap a piece at a time and copy it out without holding
+    // the lock, since it may well be in a mapping of this object
+    uint8_t chunk[64];
+    const size_t chunk_pages = sizeof(chunk) * 8;
+    for (size_t base = start; base < end; base += chunk_pages) {
+        size_t n = MIN(end - base, chunk_pages);
+        memset(chunk, 0, sizeof(chunk));
+        {
+            AutoLock a(lock_);
+            for (size_t i = 0; i < n; i++) {
+                if (page_array_[base + i])
+                    chunk[i / 8] |= static_cast<uint8_t>(1u << (i % 8));
+            }
+        }
+
+        auto status = copy_to_user(bitmap + (base - start) / 8, chunk, (n + 7) / 8);
+        if (unlikely(status < 0))
+            return status;
+    }
+
+    return NO_ERROR;
+}
+
+namespace {
+
+// PrefetchRange() queues requests for a low priority thread to commit
+struct PrefetchRequest : public mxtl::DoublyLinkedListable<PrefetchRequest*> {
+    mxtl::RefPtr<VmObject> vmo;
+    uint64_t offset;
+    uint64_t len;
+};
+
+const size_t kMaxPrefetchRequests = 64;
+
+// committed per hold of the object lock, so faults are not held up long
+const uint64_t kPrefetchChunk = 16 * PAGE_SIZE;
+
+mutex_t prefetch_lock = MUTEX_INITIAL_VALUE(prefetch_lock);
+event_t prefetch_event = EVENT_INITIAL_VALUE(prefetch_event, false, 0);
+mxtl::DoublyLinkedList<PrefetchRequest*> prefetch_queue;
+size_t prefetch_queued;
+
+int PrefetchThread(void* arg) {
+    for (;;) {
+        __UNUSED status_t err = event_wait(&prefetch_event);
+        DEBUG_ASSERT(err == NO_ERROR);
+
+        PrefetchRequest* req;
+        {
+            AutoLock a(prefetch_lock);
+            req = prefetch_queue.pop_front();
+            if (!req) {
+                event_unsignal(&prefetch_event);
+                continue;
+            }
+            prefetch_queued--;
+        }
+
+        req->vmo->PrefetchCommit(req->offset, req->len);
+        delete req;
+    }
+    return 0;
+}
+
+void PrefetchInit(uint level) {
+    thread_t* t = thread_create("vm prefetch", PrefetchThread, nullptr, LOW_PRIORITY,
+                                DEFAULT_STACK_SIZE);
+    thread_detach_and_resume(t);
+}
+
+} // namespace
+
+LK_INIT_HOOK(vm_prefetch, PrefetchInit, LK_INIT_LEVEL_THREADING);
+
+void VmObject::PrefetchCommit(uint64_t offset, uint64_t len) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+
+    // whole chunks of large page objects, so they can get large pages
+    uint64_t step = large_pages() ? LARGE_PAGE_SIZE : kPrefetchChunk;
+    uint64_t end = offset + len;
+    for (uint64_t o = offset; o < end;) {
+        // if the prefetch request holds the last reference, nobody is going
+        // to use the pages.  the count is only a hint, a stale read just
+        // commits a chunk too many or stops a chunk early
+        if (ref_count_debug() == 1)
+            break;
+        uint64_t next = MIN(ROUNDUP(o + 1, step), end);
+        if (CommitRange(o, next - o) < 0)
+            break;
+        o = next;
+    }
+}
+
+status_t VmObject::PrefetchRange(uint64_t offset, uint64_t len) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+    LTRACEF("offset 0x%llx, len 0x%llx\n", offset, len);
+
+    if (!TrimRange(offset, len, size_))
+        return ERR_OUT_OF_RANGE;
+    if (len == 0)
+        return NO_ERROR;
+
+    AllocChecker ac;
+    auto req = new (&ac) PrefetchRequest;
+    if (!ac.check())
+        return ERR_NO_MEMORY;
+    req->vmo = mxtl::WrapRefPtr(this);
+    req->offset = ROUNDDOWN(offset, PAGE_SIZE);
+    req->len = offset + len - req->offset;
+
+    AutoLock a(prefetch_lock);
+    if (prefetch_queued >= kMaxPrefetchRequests) {
+        delete req;
+        return ERR_NO_RESOURCES;
+    }
+    prefetch_queue.push_back(req);
+    prefetch_queued++;
+    event_signal(&prefetch_event, false);
+
+    return NO_ERROR;
+}
+
 // perform some sort of copy in/out on a range of the object using a passed in lambda
 // for the copy routine
 template <typename T>
@@ -468,6 +900,74 @@ status_t VmObject::WriteUser(user_ptr<const void> ptr, uint64_t offset, size_t l
     return ReadWriteInternal(offset, len, bytes_written, true, write_routine);
 }
 
+status_t VmObject::Pin(const void* owner, uint64_t id, uint64_t offset, uint64_t len) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+    LTRACEF("owner %p id %llu offset %#llx, len %#llx\n", owner, id, offset, len);
+
+    if (unlikely(len == 0) || unlikely(!InRange(offset, len, size_)))
+        return ERR_OUT_OF_RANGE;
+
+    AllocChecker ac;
+    mxtl::unique_ptr<PinnedRange> pin(new (&ac) PinnedRange);
+    if (!ac.check())
+        return ERR_NO_MEMORY;
+    pin->owner = owner;
+    pin->id = id;
+    pin->offset = offset;
+    pin->len = len;
+
+    int64_t committed = CommitRange(offset, len);
+    if (committed < 0)
+        return static_cast<status_t>(committed);
+
+    // pages are never moved or evicted once committed, so a pin only
+    // has to keep a future decommit from releasing them
+    AutoLock a(lock_);
+    pin_list_.push_front(mxtl::move(pin));
+    return NO_ERROR;
+}
+
+status_t VmObject::Unpin(const void* owner, uint64_t id, uint64_t offset, uint64_t len) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+    LTRACEF("owner %p id %llu offset %#llx, len %#llx\n", owner, id, offset, len);
+
+    mxtl::unique_ptr<PinnedRange> pin;
+    {
+        AutoLock a(lock_);
+        pin = pin_list_.erase_if([&](const PinnedRange& p) -> bool {
+            return (p.owner == owner) && (p.id == id) && (p.offset == offset) && (p.len == len);
+        });
+    }
+    return pin ? NO_ERROR : ERR_NOT_FOUND;
+}
+
+void VmObject::UnpinAll(const void* owner) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+
+    // freed as it goes out of scope, after the lock is dropped
+    mxtl::DoublyLinkedList<mxtl::unique_ptr<PinnedRange>> dropped;
+
+    AutoLock a(lock_);
+    for (;;) {
+        auto pin = pin_list_.erase_if([owner](const PinnedRange& p) -> bool {
+            return p.owner == owner;
+        });
+        if (!pin)
+            break;
+        dropped.push_front(mxtl::move(pin));
+    }
+}
+
+bool VmObject::PinnedLocked(uint64_t offset, uint64_t len) const {
+    DEBUG_ASSERT(is_mutex_held(&lock_));
+
+    for (const auto& p : pin_list_) {
+        if ((offset < p.offset + p.len) && (p.offset < offset + len))
+            return true;
+    }
+    return false;
+}
+
 status_t VmObject::Lookup(uint64_t offset, uint64_t len, user_ptr<paddr_t> buffer, size_t buffer_size) {
     DEBUG_ASSERT(magic_ == MAGIC);
 
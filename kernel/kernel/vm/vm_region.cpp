@@ -48,7 +48,10 @@ status_t VmRegion::Destroy() {
     LTRACEF("%p '%s'\n", this, name_);
 
     // detach from any object we have mapped
-    object_.reset();
+    if (object_) {
+        object_->RemoveMapping(this);
+        object_.reset();
+    }
 
     return NO_ERROR;
 }
@@ -80,6 +83,10 @@ int VmRegion::Unmap() {
     DEBUG_ASSERT(magic_ == MAGIC);
     LTRACEF("%p '%s'\n", this, name_);
 
+    // stop the object from reaching into the range, which may be reused
+    if (object_)
+        object_->RemoveMapping(this);
+
     // unmap the section of address space we cover
     return arch_mmu_unmap(&aspace_->arch_aspace(), base_, size_ / PAGE_SIZE);
 }
@@ -94,6 +101,7 @@ status_t VmRegion::SetObject(mxtl::RefPtr<VmObject> o, uint64_t offset) {
 
     object_ = o;
     object_offset_ = offset;
+    object_->AddMapping(this);
 
     return NO_ERROR;
 }
@@ -132,6 +140,29 @@ status_t VmRegion::MapPhysicalRange(size_t offset, size_t len, paddr_t paddr, bo
     return (ret < 0) ? ret : 0;
 }
 
+bool VmRegion::LargePageAt(size_t offset, size_t* start, paddr_t* pa) const {
+    DEBUG_ASSERT(object_);
+
+    if (!object_->large_pages())
+        return false;
+
+    const size_t large_size = static_cast<size_t>(VmObject::LARGE_PAGE_SIZE);
+    vaddr_t va = ROUNDDOWN(base_ + offset, large_size);
+    if (va < base_ || va + large_size - 1 > base_ + size_ - 1)
+        return false;
+
+    // the object's chunks need to line up with the page tables
+    uint64_t vmo_offset = object_offset_ + (va - base_);
+    if (vmo_offset % large_size != 0)
+        return false;
+
+    if (!object_->GetLargePage(vmo_offset, pa))
+        return false;
+
+    *start = va - base_;
+    return true;
+}
+
 status_t VmRegion::MapRange(size_t offset, size_t len, bool commit) {
     DEBUG_ASSERT(magic_ == MAGIC);
     LTRACEF("region %p '%s', offset 0x%zu, size 0x%zx\n", this, name_, offset, len);
@@ -146,9 +177,34 @@ status_t VmRegion::MapRange(size_t offset, size_t len, bool commit) {
         return ERR_NO_MEMORY;
     }
 
+    // commit it all at once, so whole chunks can get large pages
+    if (commit && object_->large_pages()) {
+        int64_t committed = object_->CommitRange(object_offset_ + offset, len);
+        if (committed < 0) {
+            LTRACEF("error committing memory for region\n");
+            return (status_t)committed;
+        }
+    }
+
     // iterate through the range, grabbing a page from the underlying object and mapping it in
     size_t o;
     for (o = offset; o < offset + len; o += PAGE_SIZE) {
+        // map large pages whole where the range covers them
+        size_t large_start;
+        paddr_t large_pa;
+        if (LargePageAt(o, &large_start, &large_pa) && large_start >= offset &&
+            large_start + VmObject::LARGE_PAGE_SIZE <= offset + len) {
+            const size_t count = static_cast<size_t>(VmObject::LARGE_PAGE_SIZE / PAGE_SIZE);
+            auto ret = arch_mmu_map(&aspace_->arch_aspace(), base_ + large_start, large_pa, count,
+                                    arch_mmu_flags_);
+            if (ret >= 0) {
+                o = large_start + (count - 1) * PAGE_SIZE;
+                continue;
+            }
+            // some of it is mapped already, carry on a page at a time
+            LTRACEF("error %d mapping large page at va 0x%lx\n", ret, base_ + large_start);
+        }
+
         uint64_t vmo_offset = object_offset_ + o;
         vm_page_t* p = object_->GetPage(vmo_offset);
         if (!p) {
@@ -230,6 +286,10 @@ status_t VmRegion::PageFault(vaddr_t va, uint pf_flags) {
     }
     paddr_t new_pa = vm_page_to_paddr(new_p);
 
+    // what got mapped below
+    __UNUSED vaddr_t map_va = va;
+    __UNUSED size_t map_len = PAGE_SIZE;
+
     // see if something is mapped here now
     // this may happen if we are one of multiple threads racing on a single address
     uint page_flags;
@@ -258,19 +318,37 @@ status_t VmRegion::PageFault(vaddr_t va, uint pf_flags) {
             return ERR_NOT_SUPPORTED;
         }
     } else {
-        // nothing was mapped there before, map it now
-        LTRACEF("mapping pa 0x%lx to va 0x%lx\n", new_pa, va);
-        auto ret = arch_mmu_map(&aspace_->arch_aspace(), va, new_pa, 1, arch_mmu_flags_);
-        if (ret < 0) {
-            TRACEF("failed to map page\n");
-            return ERR_NO_MEMORY;
+        // nothing was mapped there before, map it now, all of its large
+        // page if it has one
+        bool mapped = false;
+        size_t large_start;
+        paddr_t large_pa;
+        if (LargePageAt(va - base_, &large_start, &large_pa)) {
+            const size_t count = static_cast<size_t>(VmObject::LARGE_PAGE_SIZE / PAGE_SIZE);
+            LTRACEF("mapping large page pa 0x%lx to va 0x%lx\n", large_pa, base_ + large_start);
+            auto ret = arch_mmu_map(&aspace_->arch_aspace(), base_ + large_start, large_pa, count,
+                                    arch_mmu_flags_);
+            if (ret >= 0) {
+                map_va = base_ + large_start;
+                map_len = count * PAGE_SIZE;
+                mapped = true;
+            }
+            // otherwise some of it is mapped already, so just map the page
+        }
+        if (!mapped) {
+            LTRACEF("mapping pa 0x%lx to va 0x%lx\n", new_pa, va);
+            auto ret = arch_mmu_map(&aspace_->arch_aspace(), va, new_pa, 1, arch_mmu_flags_);
+            if (ret < 0) {
+                TRACEF("failed to map page\n");
+                return ERR_NO_MEMORY;
+            }
         }
     }
 #if ARCH_ARM64
     if (arch_mmu_flags_ & ARCH_MMU_FLAG_PERM_EXECUTE)
-        arch_sync_cache_range(va,PAGE_SIZE);
+        arch_sync_cache_range(map_va, map_len);
 #endif
     return NO_ERROR;
 }
 
-mxtl::RefPtr<VmObject> VmRegion::vmo() { return object_; }
+mxtl::RefPtr<VmObject> VmRegion::vmo() const { return object_; }
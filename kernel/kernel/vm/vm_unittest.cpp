@@ -360,6 +360,85 @@ static bool vmm_object_tests(void* context) {
         EXPECT_EQ(NO_ERROR, err, "unmapping object");
     }
 
+    unittest_printf("creating large page vm object, mapping it, demand paged\n");
+    {
+        const uint arch_rw_flags = ARCH_MMU_FLAG_PERM_READ | ARCH_MMU_FLAG_PERM_WRITE;
+        const size_t large_size = VmObject::LARGE_PAGE_SIZE;
+        const size_t alloc_size = large_size * 2;
+        auto vmo = VmObject::Create(PMM_ALLOC_FLAG_ANY, alloc_size, VmObject::FLAG_LARGE_PAGES);
+        EXPECT_TRUE(vmo, "vmobject creation\n");
+
+        auto ka = VmAspace::kernel_aspace();
+        void* ptr;
+        auto ret = ka->MapObject(vmo, "test", 0, alloc_size, &ptr, 0, 0, arch_rw_flags);
+        EXPECT_EQ(NO_ERROR, ret, "mapping object");
+        EXPECT_EQ(0u, (vaddr_t)ptr % large_size, "mapping lined up with large pages");
+
+        // fill with known pattern and test
+        if (!fill_and_test(ptr, alloc_size))
+            all_ok = false;
+
+        // a chunk that got a large page is physically contiguous and counted
+        paddr_t large_pa;
+        if (vmo->GetLargePage(0, &large_pa)) {
+            EXPECT_EQ(0u, large_pa % large_size, "large page aligned");
+
+            paddr_t pa = 0;
+            vaddr_t va = (vaddr_t)ptr + large_size - PAGE_SIZE;
+            auto err = arch_mmu_query(&ka->arch_aspace(), va, &pa, nullptr);
+            EXPECT_EQ(NO_ERROR, err, "querying mapping");
+            EXPECT_EQ(large_pa + large_size - PAGE_SIZE, pa, "large page contiguous");
+
+            size_t large_pages = 0;
+            vmo->AllocatedPages(0, alloc_size, &large_pages);
+            EXPECT_LE(large_size / PAGE_SIZE, large_pages, "counting large pages");
+
+            // it can only be decommitted whole
+            auto decommitted = vmo->DecommitRange(PAGE_SIZE, PAGE_SIZE);
+            EXPECT_EQ((int64_t)ERR_INVALID_ARGS, decommitted, "decommitting part of a large page");
+            EXPECT_TRUE(vmo->GetLargePage(0, &pa), "large page kept");
+
+            decommitted = vmo->DecommitRange(0, large_size);
+            EXPECT_EQ((int64_t)large_size, decommitted, "decommitting a large page");
+            EXPECT_FALSE(vmo->GetLargePage(0, &pa), "large page freed");
+
+            err = arch_mmu_query(&ka->arch_aspace(), va, &pa, nullptr);
+            EXPECT_NEQ(NO_ERROR, err, "large page unmapped");
+
+            if (!fill_and_test(ptr, alloc_size))
+                all_ok = false;
+        } else {
+            unittest_printf("no large page available, skipping large page checks\n");
+        }
+
+        auto err = ka->FreeRegion((vaddr_t)ptr);
+        EXPECT_EQ(NO_ERROR, err, "unmapping object");
+    }
+
+    unittest_printf("creating large page vm object with a tail, mapping it, precommitted\n");
+    {
+        const uint arch_rw_flags = ARCH_MMU_FLAG_PERM_READ | ARCH_MMU_FLAG_PERM_WRITE;
+        const size_t alloc_size = VmObject::LARGE_PAGE_SIZE + PAGE_SIZE * 3;
+        auto vmo = VmObject::Create(PMM_ALLOC_FLAG_ANY, alloc_size, VmObject::FLAG_LARGE_PAGES);
+        EXPECT_TRUE(vmo, "vmobject creation\n");
+
+        auto ka = VmAspace::kernel_aspace();
+        void* ptr;
+        auto ret = ka->MapObject(vmo, "test", 0, alloc_size, &ptr, 0, VMM_FLAG_COMMIT,
+                                 arch_rw_flags);
+        EXPECT_EQ(NO_ERROR, ret, "mapping object");
+
+        // committing again finds nothing missing
+        EXPECT_EQ(0, vmo->CommitRange(0, alloc_size), "recommitting");
+
+        // fill with known pattern and test
+        if (!fill_and_test(ptr, alloc_size))
+            all_ok = false;
+
+        auto err = ka->FreeRegion((vaddr_t)ptr);
+        EXPECT_EQ(NO_ERROR, err, "unmapping object");
+    }
+
     unittest_printf("creating vm object, mapping it, dropping ref before unmapping\n");
     {
         const uint arch_rw_flags = ARCH_MMU_FLAG_PERM_READ | ARCH_MMU_FLAG_PERM_WRITE;
@@ -10,10 +10,13 @@
 #include <err.h>
 #include <kernel/auto_lock.h>
 #include <kernel/mutex.h>
+#include <kernel/thread.h>
 #include <kernel/vm.h>
 #include <kernel/vm/vm_aspace.h>
+#include <kernel/vm/vm_object.h>
 #include <kernel/vm/vm_region.h>
 #include <lib/console.h>
+#include <lib/ktrace.h>
 #include <string.h>
 #include <trace.h>
 
@@ -156,8 +159,16 @@ status_t vmm_page_fault_handler(vaddr_t addr, uint flags) {
     if (!aspace)
         return ERR_NOT_FOUND;
 
+    ktrace(TAG_PAGE_FAULT, (uint32_t)addr, (uint32_t)((uint64_t)addr >> 32), flags, 0);
+
+    get_current_thread()->page_faults++;
+    THREAD_STATS_INC(page_faults);
+
     // page fault it
-    return aspace->PageFault(addr, flags);
+    status_t status = aspace->PageFault(addr, flags);
+
+    ktrace(TAG_PAGE_FAULT_EXIT, (uint32_t)addr, (uint32_t)((uint64_t)addr >> 32), flags, status);
+    return status;
 }
 
 void vmm_set_active_aspace(vmm_aspace_t* aspace) {
@@ -201,6 +212,7 @@ static int cmd_vmm(int argc, const cmd_args* argv) {
         printf("%s create_test_aspace\n", argv[0].str);
         printf("%s free_aspace <address>\n", argv[0].str);
         printf("%s set_test_aspace <address>\n", argv[0].str);
+        printf("%s largepages\n", argv[0].str);
         return ERR_INTERNAL;
     }
 
@@ -280,6 +292,8 @@ static int cmd_vmm(int argc, const cmd_args* argv) {
         test_aspace = (vmm_aspace_t*)(void*)argv[2].u;
         get_current_thread()->aspace = test_aspace;
         thread_sleep(1); // XXX hack to force it to reschedule and thus load the aspace
+    } else if (!strcmp(argv[1].str, "largepages")) {
+        VmObject::DumpLargePageStats();
     } else {
         printf("unknown command\n");
         goto usage;
@@ -26,6 +26,7 @@
 #include <arch/ops.h>
 #include <sys/types.h>
 #include <lib/gfx.h>
+#include <gfx/pixel.h>
 #include <dev/display.h>
 
 #define LOCAL_TRACE 0
@@ -172,160 +173,79 @@ static void putpixel8(gfx_surface *surface, uint x, uint y, uint color)
     *dest = (uint8_t)(surface->translate_color(color));
 }
 
-static void copyrect8(gfx_surface *surface, uint x, uint y, uint width, uint height, uint x2, uint y2)
+// copies a rectangle a row at a time, in an order that is safe when the
+// source and destination overlap
+static void copyrect_rows(gfx_surface *surface, uint pixelsize, uint x, uint y, uint width, uint height, uint x2, uint y2)
 {
-    // copy
-    const uint8_t *src = &((const uint8_t *)surface->ptr)[x + y * surface->stride];
-    uint8_t *dest = &((uint8_t *)surface->ptr)[x2 + y2 * surface->stride];
-    uint stride_diff = surface->stride - width;
+    size_t stride = surface->stride * pixelsize;
+    size_t len = width * pixelsize;
+    const uint8_t *src = (const uint8_t *)surface->ptr + x * pixelsize + y * stride;
+    uint8_t *dest = (uint8_t *)surface->ptr + x2 * pixelsize + y2 * stride;
 
     if (dest < src) {
-        uint i, j;
-        for (i=0; i < height; i++) {
-            for (j=0; j < width; j++) {
-                *dest = *src;
-                dest++;
-                src++;
-            }
-            dest += stride_diff;
-            src += stride_diff;
+        for (uint i = 0; i < height; i++) {
+            memmove(dest, src, len);
+            dest += stride;
+            src += stride;
         }
     } else {
         // copy backwards
-        src += height * surface->stride + width;
-        dest += height * surface->stride + width;
-
-        uint i, j;
-        for (i=0; i < height; i++) {
-            for (j=0; j < width; j++) {
-                *dest = *src;
-                dest--;
-                src--;
-            }
-            dest -= stride_diff;
-            src -= stride_diff;
+        src += (height - 1) * stride;
+        dest += (height - 1) * stride;
+        for (uint i = 0; i < height; i++) {
+            memmove(dest, src, len);
+            dest -= stride;
+            src -= stride;
         }
     }
 }
 
+static void copyrect8(gfx_surface *surface, uint x, uint y, uint width, uint height, uint x2, uint y2)
+{
+    copyrect_rows(surface, 1, x, y, width, height, x2, y2);
+}
+
 static void fillrect8(gfx_surface *surface, uint x, uint y, uint width, uint height, uint color)
 {
     uint8_t *dest = &((uint8_t *)surface->ptr)[x + y * surface->stride];
-    uint stride_diff = surface->stride - width;
 
     uint8_t color8 = (uint8_t)(surface->translate_color(color));
 
-    uint i, j;
-    for (i=0; i < height; i++) {
-        for (j=0; j < width; j++) {
-            *dest = color8;
-            dest++;
-        }
-        dest += stride_diff;
+    for (uint i = 0; i < height; i++) {
+        gfx_pixel_fill8(dest, color8, width);
+        dest += surface->stride;
     }
 }
 
 static void copyrect16(gfx_surface *surface, uint x, uint y, uint width, uint height, uint x2, uint y2)
 {
-    // copy
-    const uint16_t *src = &((const uint16_t *)surface->ptr)[x + y * surface->stride];
-    uint16_t *dest = &((uint16_t *)surface->ptr)[x2 + y2 * surface->stride];
-    uint stride_diff = surface->stride - width;
-
-    if (dest < src) {
-        uint i, j;
-        for (i=0; i < height; i++) {
-            for (j=0; j < width; j++) {
-                *dest = *src;
-                dest++;
-                src++;
-            }
-            dest += stride_diff;
-            src += stride_diff;
-        }
-    } else {
-        // copy backwards
-        src += height * surface->stride + width;
-        dest += height * surface->stride + width;
-
-        uint i, j;
-        for (i=0; i < height; i++) {
-            for (j=0; j < width; j++) {
-                *dest = *src;
-                dest--;
-                src--;
-            }
-            dest -= stride_diff;
-            src -= stride_diff;
-        }
-    }
+    copyrect_rows(surface, 2, x, y, width, height, x2, y2);
 }
 
 static void fillrect16(gfx_surface *surface, uint x, uint y, uint width, uint height, uint color)
 {
     uint16_t *dest = &((uint16_t *)surface->ptr)[x + y * surface->stride];
-    uint stride_diff = surface->stride - width;
 
     uint16_t color16 = (uint16_t)(surface->translate_color(color));
 
-    uint i, j;
-    for (i=0; i < height; i++) {
-        for (j=0; j < width; j++) {
-            *dest = color16;
-            dest++;
-        }
-        dest += stride_diff;
+    for (uint i = 0; i < height; i++) {
+        gfx_pixel_fill16(dest, color16, width);
+        dest += surface->stride;
     }
 }
 
 static void copyrect32(gfx_surface *surface, uint x, uint y, uint width, uint height, uint x2, uint y2)
 {
-    // copy
-    const uint32_t *src = &((const uint32_t *)surface->ptr)[x + y * surface->stride];
-    uint32_t *dest = &((uint32_t *)surface->ptr)[x2 + y2 * surface->stride];
-    uint stride_diff = surface->stride - width;
-
-    if (dest < src) {
-        uint i, j;
-        for (i=0; i < height; i++) {
-            for (j=0; j < width; j++) {
-                *dest = *src;
-                dest++;
-                src++;
-            }
-            dest += stride_diff;
-            src += stride_diff;
-        }
-    } else {
-        // copy backwards
-        src += height * surface->stride + width;
-        dest += height * surface->stride + width;
-
-        uint i, j;
-        for (i=0; i < height; i++) {
-            for (j=0; j < width; j++) {
-                *dest = *src;
-                dest--;
-                src--;
-            }
-            dest -= stride_diff;
-            src -= stride_diff;
-        }
-    }
+    copyrect_rows(surface, 4, x, y, width, height, x2, y2);
 }
 
 static void fillrect32(gfx_surface *surface, uint x, uint y, uint width, uint height, uint color)
 {
     uint32_t *dest = &((uint32_t *)surface->ptr)[x + y * surface->stride];
-    uint stride_diff = surface->stride - width;
 
-    uint i, j;
-    for (i=0; i < height; i++) {
-        for (j=0; j < width; j++) {
-            *dest = color;
-            dest++;
-        }
-        dest += stride_diff;
+    for (uint i = 0; i < height; i++) {
+        gfx_pixel_fill32(dest, color, width);
+        dest += surface->stride;
     }
 }
 
@@ -383,39 +303,8 @@ void gfx_line(gfx_surface *surface, uint x1, uint y1, uint x2, uint y2, uint col
 
 uint32_t alpha32_add_ignore_destalpha(uint32_t dest, uint32_t src)
 {
-    uint32_t cdest[3];
-    uint32_t csrc[3];
-
-    uint32_t srca;
-    uint32_t srcainv;
-
-    srca = (src >> 24) & 0xff;
-    if (srca == 0) {
-        return dest;
-    } else if (srca == 255) {
-        return src;
-    }
-    srca++;
-    srcainv = (255 - srca);
-
-    cdest[0] = (dest >> 16) & 0xff;
-    cdest[1] = (dest >> 8) & 0xff;
-    cdest[2] = (dest >> 0) & 0xff;
-
-    csrc[0] = (src >> 16) & 0xff;
-    csrc[1] = (src >> 8) & 0xff;
-    csrc[2] = (src >> 0) & 0xff;
-
-//    if (srca > 0)
-//        printf("s %d %d %d d %d %d %d a %d ai %d\n", csrc[0], csrc[1], csrc[2], cdest[0], cdest[1], cdest[2], srca, srcainv);
-
-    uint32_t cres[3];
-
-    cres[0] = ((csrc[0] * srca) / 256) + ((cdest[0] * srcainv) / 256);
-    cres[1] = ((csrc[1] * srca) / 256) + ((cdest[1] * srcainv) / 256);
-    cres[2] = ((csrc[2] * srca) / 256) + ((cdest[2] * srcainv) / 256);
-
-    return (srca << 24) | (cres[0] << 16) | (cres[1] << 8) | (cres[2]);
+    gfx_pixel_blend32(&dest, &src, 1);
+    return dest;
 }
 
 /**
@@ -471,16 +360,11 @@ void gfx_surface_blend(struct gfx_surface *target, struct gfx_surface *source, u
 
         LTRACEF("w %u h %u dstride %u sstride %u\n", width, height, dest_stride_diff, source_stride_diff);
 
-        uint i, j;
-        for (i=0; i < height; i++) {
-            for (j=0; j < width; j++) {
-                // XXX ignores destination alpha
-                *dest = alpha32_add_ignore_destalpha(*dest, *src);
-                dest++;
-                src++;
-            }
-            dest += dest_stride_diff;
-            src += source_stride_diff;
+        for (uint i = 0; i < height; i++) {
+            // XXX ignores destination alpha
+            gfx_pixel_blend32(dest, src, width);
+            dest += width + dest_stride_diff;
+            src += width + source_stride_diff;
         }
     } else if (source->format == GFX_FORMAT_RGB_x888 && target->format == GFX_FORMAT_RGB_x888) {
         // both are 32 bit modes, no alpha
@@ -5,11 +5,15 @@
 # license that can be found in the LICENSE file or at
 # https://opensource.org/licenses/MIT
 
+SRC_DIR := system/ulib/gfx
 LOCAL_DIR := $(GET_LOCAL_DIR)
 
 MODULE := $(LOCAL_DIR)
 
+KERNEL_INCLUDES += $(SRC_DIR)/include
+
 MODULE_SRCS += \
-	$(LOCAL_DIR)/gfx.c
+	$(LOCAL_DIR)/gfx.c \
+	$(SRC_DIR)/pixel.c
 
 include make/module.mk
@@ -6,11 +6,16 @@
 
 #include <debug.h>
 #include <err.h>
+#include <limits.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <arch/ops.h>
 #include <arch/user_copy.h>
+#include <kernel/auto_lock.h>
 #include <kernel/cmdline.h>
+#include <kernel/mutex.h>
+#include <kernel/spinlock.h>
 #include <kernel/vm/vm_aspace.h>
 #include <lib/ktrace.h>
 #include <lk/init.h>
@@ -18,14 +23,34 @@
 
 #if __x86_64__
 extern "C" uint64_t get_tsc_ticks_per_ms(void);
-#define ktrace_timestamp() rdtsc();
+#define ktrace_ticks() rdtsc()
 #define ktrace_ticks_per_ms() get_tsc_ticks_per_ms()
 #else
 #include <platform.h>
-#define ktrace_timestamp() current_time_hires()
+#define ktrace_ticks() current_time_hires()
 #define ktrace_ticks_per_ms() (1000)
 #endif
 
+// A per-cpu ring, used in the FLIGHT and STREAM modes.  Only the cpu
+// that owns a ring writes to it, with interrupts disabled, so writers
+// never contend.  head and tail are byte counts that only grow; the
+// ring offset is the count modulo the ring size.
+typedef struct ktrace_cpu {
+    // bytes written, advanced by the owning cpu
+    volatile uint64_t head;
+
+    // bytes consumed, advanced by readers
+    volatile uint64_t tail;
+
+    // records dropped because the ring was full (STREAM mode)
+    volatile uint64_t lost;
+
+    // value of lost when the last chunk was handed to a reader
+    uint64_t lost_reported;
+
+    uint8_t* buffer;
+} __CPU_ALIGN ktrace_cpu_t;
+
 typedef struct ktrace_state {
     // where the next record will be written
     int offset;
@@ -41,13 +66,180 @@ typedef struct ktrace_state {
 
     // raw trace buffer
     uint8_t* buffer;
+
+    // KTRACE_MODE_*, only changed while tracing is stopped
+    uint32_t mode;
+
+    // size of each per-cpu ring (a power of two) and number of rings
+    uint32_t ringsize;
+    uint32_t ringcount;
+
+    // reset the rings on the next start
+    bool rewind;
+
+    // the version and ticks records are owed to the next reader
+    bool meta;
+
+    // ring the next read starts with, so that a small read
+    // buffer does not starve the higher numbered cpus
+    uint32_t next_cpu;
+
+    ktrace_cpu_t cpu[SMP_MAX_CPUS];
 } ktrace_state_t;
 
 static ktrace_state_t KTRACE_STATE;
 
+// serializes readers of the rings against each other
+// and against mode changes
+static Mutex ktrace_lock;
+
+static void ktrace_fill_meta(ktrace_record_t rec[2]) {
+    uint64_t n = ktrace_ticks_per_ms();
+    memset(rec, 0, KTRACE_RECSIZE * 2);
+    rec[0].tag = TAG_VERSION;
+    rec[0].a = KTRACE_VERSION;
+    rec[1].tag = TAG_TICKS_PER_MS;
+    rec[1].a = (uint32_t)n;
+    rec[1].b = (uint32_t)(n >> 32);
+}
+
+// Oldest byte of a FLIGHT ring that is safe to read: the slot at
+// head is the next one to be overwritten, and may be in progress.
+static uint64_t ktrace_ring_oldest(ktrace_state_t* ks, uint64_t head) {
+    uint64_t span = ks->ringsize - KTRACE_RECSIZE;
+    return (head > span) ? (head - span) : 0;
+}
+
+static status_t ktrace_ring_copy(ktrace_state_t* ks, ktrace_cpu_t* kc,
+                                 uint8_t* ptr, uint64_t pos, uint32_t len) {
+    uint32_t off = (uint32_t)(pos & (ks->ringsize - 1));
+    uint32_t n = MIN(len, ks->ringsize - off);
+    if (arch_copy_to_user(ptr, kc->buffer + off, n) != NO_ERROR) {
+        return ERR_INVALID_ARGS;
+    }
+    if ((n < len) && (arch_copy_to_user(ptr + n, kc->buffer, len - n) != NO_ERROR)) {
+        return ERR_INVALID_ARGS;
+    }
+    return NO_ERROR;
+}
+
+static status_t ktrace_zero_user(uint8_t* ptr, uint32_t len) {
+    static const ktrace_record_t zero = {};
+    for (uint32_t n = 0; n < len; n += KTRACE_RECSIZE) {
+        if (arch_copy_to_user(ptr + n, &zero, KTRACE_RECSIZE) != NO_ERROR) {
+            return ERR_INVALID_ARGS;
+        }
+    }
+    return NO_ERROR;
+}
+
+static int ktrace_read_rings(ktrace_state_t* ks, uint8_t* ptr, uint32_t len) {
+    AutoLock lock(&ktrace_lock);
+    bool flight = (ks->mode == KTRACE_MODE_FLIGHT);
+
+    // null read is a query for the bytes available
+    if (ptr == NULL) {
+        uint64_t total = ks->meta ? (KTRACE_RECSIZE * 2) : 0;
+        for (uint32_t n = 0; n < ks->ringcount; n++) {
+            ktrace_cpu_t* kc = &ks->cpu[n];
+            uint64_t head = kc->head;
+            uint64_t tail = kc->tail;
+            if (flight) {
+                tail = MAX(tail, ktrace_ring_oldest(ks, head));
+            }
+            if ((head != tail) || (kc->lost != kc->lost_reported)) {
+                total += KTRACE_RECSIZE + (head - tail);
+            }
+        }
+        return (int)MIN(total, (uint64_t)INT_MAX);
+    }
+
+    len = MIN(ROUNDDOWN(len, KTRACE_RECSIZE), (uint32_t)INT_MAX & ~(KTRACE_RECSIZE - 1));
+
+    uint32_t done = 0;
+    if (ks->meta) {
+        ktrace_record_t meta[2];
+        if (len < sizeof(meta)) {
+            return 0;
+        }
+        ktrace_fill_meta(meta);
+        if (arch_copy_to_user(ptr, meta, sizeof(meta)) != NO_ERROR) {
+            return ERR_INVALID_ARGS;
+        }
+        ks->meta = false;
+        done = sizeof(meta);
+    }
+
+    for (uint32_t i = 0; i < ks->ringcount; i++) {
+        uint32_t cpu = (ks->next_cpu + i) % ks->ringcount;
+        ktrace_cpu_t* kc = &ks->cpu[cpu];
+        if ((len - done) < KTRACE_RECSIZE) {
+            ks->next_cpu = cpu;
+            break;
+        }
+
+        uint64_t head = kc->head;
+        smp_rmb();
+        uint64_t tail = kc->tail;
+        uint64_t lost = kc->lost;
+        uint64_t dropped = lost - kc->lost_reported;
+        if (flight) {
+            uint64_t oldest = ktrace_ring_oldest(ks, head);
+            if (tail < oldest) {
+                dropped += (oldest - tail) / KTRACE_RECSIZE;
+                tail = oldest;
+            }
+        }
+        if ((head == tail) && (dropped == 0)) {
+            continue;
+        }
+
+        uint32_t count = (uint32_t)MIN(head - tail, (uint64_t)(len - done - KTRACE_RECSIZE));
+        uint8_t* out = ptr + done + KTRACE_RECSIZE;
+        if (ktrace_ring_copy(ks, kc, out, tail, count) != NO_ERROR) {
+            return ERR_INVALID_ARGS;
+        }
+        if (flight) {
+            // the writer may have lapped us while we copied,
+            // in which case the front of the copy is garbage
+            smp_rmb();
+            uint64_t oldest = ktrace_ring_oldest(ks, kc->head);
+            if (tail < oldest) {
+                uint32_t torn = (uint32_t)MIN(oldest - tail, (uint64_t)count);
+                if (ktrace_zero_user(out, torn) != NO_ERROR) {
+                    return ERR_INVALID_ARGS;
+                }
+                dropped += torn / KTRACE_RECSIZE;
+            }
+        }
+
+        ktrace_record_t hdr = {};
+        hdr.tag = TAG_CPU_CHUNK | cpu;
+        hdr.a = count;
+        hdr.b = (uint32_t)dropped;
+        hdr.c = (uint32_t)(dropped >> 32);
+        if (arch_copy_to_user(ptr + done, &hdr, sizeof(hdr)) != NO_ERROR) {
+            return ERR_INVALID_ARGS;
+        }
+
+        kc->lost_reported = lost;
+        // finish reading the records before the writer may reuse them
+        smp_mb();
+        kc->tail = tail + count;
+        done += KTRACE_RECSIZE + count;
+        ks->next_cpu = (cpu + 1) % ks->ringcount;
+    }
+    return done;
+}
+
 int ktrace_read_user(void* ptr, uint32_t off, uint32_t len) {
     ktrace_state_t* ks = &KTRACE_STATE;
 
+    // the ring modes are consumed in order, not read by offset
+    if (ks->mode != KTRACE_MODE_LINEAR) {
+        return ktrace_read_rings(ks, (uint8_t*)ptr, len);
+    }
+
     // Buffer size is limited by the marker if set,
     // otherwise limited by offset (last written point).
     // Offset can end up pointing past the end, so clip
@@ -81,12 +273,68 @@ int ktrace_read_user(void* ptr, uint32_t off, uint32_t len) {
     return len;
 }
 
+static void ktrace_reset_rings(ktrace_state_t* ks) {
+    for (uint32_t n = 0; n < ks->ringcount; n++) {
+        ktrace_cpu_t* kc = &ks->cpu[n];
+        kc->head = 0;
+        kc->tail = 0;
+        kc->lost = 0;
+        kc->lost_reported = 0;
+    }
+    ks->next_cpu = 0;
+    ks->rewind = false;
+}
+
+// called with tracing stopped
+static status_t ktrace_set_mode(ktrace_state_t* ks, uint32_t mode) {
+    if (mode > KTRACE_MODE_STREAM) {
+        return ERR_INVALID_ARGS;
+    }
+    if (ks->buffer == NULL) {
+        return ERR_NOT_SUPPORTED;
+    }
+
+    AutoLock lock(&ktrace_lock);
+    if (mode == KTRACE_MODE_LINEAR) {
+        // the rings may have overwritten the metadata
+        ktrace_fill_meta((ktrace_record_t*) ks->buffer);
+        ks->marker = 0;
+        atomic_store(&ks->offset, KTRACE_RECSIZE * 2);
+    } else {
+        uint32_t count = MIN(arch_max_num_cpus(), (uint)SMP_MAX_CPUS);
+        uint32_t size = ks->bufsize / count;
+        // round down to a power of two so ring offsets are a mask
+        while (size & (size - 1)) {
+            size &= size - 1;
+        }
+        if (size < KTRACE_RECSIZE) {
+            return ERR_NO_MEMORY;
+        }
+        ks->ringsize = size;
+        ks->ringcount = count;
+        for (uint32_t n = 0; n < count; n++) {
+            ks->cpu[n].buffer = ks->buffer + n * size;
+        }
+        ktrace_reset_rings(ks);
+        ks->meta = true;
+    }
+    ks->mode = mode;
+    return NO_ERROR;
+}
+
 status_t ktrace_control(uint32_t action, uint32_t options) {
     ktrace_state_t* ks = &KTRACE_STATE;
     switch (action) {
     case KTRACE_ACTION_START:
         options = GRP_MASK(options);
         ks->marker = 0;
+        if ((ks->mode != KTRACE_MODE_LINEAR) && (atomic_load(&ks->grpmask) == 0)) {
+            AutoLock lock(&ktrace_lock);
+            if (ks->rewind) {
+                ktrace_reset_rings(ks);
+            }
+            ks->meta = true;
+        }
         atomic_store(&ks->grpmask, options ? options : GRP_MASK(GRP_ALL));
         break;
     case KTRACE_ACTION_STOP: {
@@ -100,9 +348,21 @@ status_t ktrace_control(uint32_t action, uint32_t options) {
         break;
     }
     case KTRACE_ACTION_REWIND:
+        if (ks->mode != KTRACE_MODE_LINEAR) {
+            // keep what is in the rings readable until tracing restarts
+            ks->rewind = true;
+            break;
+        }
         // roll back to just after the metadata
         atomic_store(&ks->offset, KTRACE_RECSIZE * 2);
         break;
+    case KTRACE_ACTION_MODE:
+        if (atomic_load(&ks->grpmask)) {
+            return ERR_BAD_STATE;
+        }
+        return ktrace_set_mode(ks, options);
+    case KTRACE_ACTION_PROFILE:
+        return ktrace_profile_control(options);
     default:
         return ERR_INVALID_ARGS;
     }
@@ -116,6 +376,7 @@ void ktrace_init(unsigned level) {
 
     uint32_t mb = cmdline_get_uint32("ktrace.bufsize", KTRACE_DEFAULT_BUFSIZE);
     uint32_t grpmask = cmdline_get_uint32("ktrace.grpmask", KTRACE_DEFAULT_GRPMASK);
+    uint32_t mode = cmdline_get_uint32("ktrace.mode", KTRACE_DEFAULT_MODE);
 
     if (mb == 0) {
         dprintf(INFO, "ktrace: disabled\n");
@@ -126,7 +387,8 @@ void ktrace_init(unsigned level) {
 
     status_t status;
     VmAspace* aspace = VmAspace::kernel_aspace();
-    if ((status = aspace->Alloc("ktrace", mb, (void**)&ks->buffer, 0, VMM_FLAG_COMMIT,
+    if ((status = aspace->Alloc("ktrace", mb, (void**)&ks->buffer, 0,
+                                VMM_FLAG_COMMIT | VMM_FLAG_LARGE_PAGES,
                                 ARCH_MMU_FLAG_PERM_READ | ARCH_MMU_FLAG_PERM_WRITE)) < 0) {
         dprintf(INFO, "ktrace: cannot alloc buffer %d\n", status);
         return;
@@ -134,54 +396,108 @@ void ktrace_init(unsigned level) {
     ks->bufsize = mb;
     dprintf(INFO, "ktrace: buffer at %p (%u bytes)\n", ks->buffer, mb);
 
-    // write metadata to the first two event slots
-    uint64_t n = ktrace_ticks_per_ms();
-    ktrace_record_t* rec = (ktrace_record_t*) ks->buffer;
-    rec[0].tag = TAG_VERSION;
-    rec[0].a = KTRACE_VERSION;
-    rec[1].tag = TAG_TICKS_PER_MS;
-    rec[1].a = (uint32_t)n;
-    rec[1].b = (uint32_t)(n >> 32);
+    // writes the metadata to the first two event slots in linear mode
+    if ((status = ktrace_set_mode(ks, mode)) < 0) {
+        dprintf(INFO, "ktrace: bad mode %u (%d), using linear\n", mode, status);
+        ktrace_set_mode(ks, KTRACE_MODE_LINEAR);
+    } else if (mode != KTRACE_MODE_LINEAR) {
+        dprintf(INFO, "ktrace: %u rings of %u bytes\n", ks->ringcount, ks->ringsize);
+    }
 
     // enable tracing
-    atomic_store(&ks->offset, KTRACE_RECSIZE * 2);
     atomic_store(&ks->grpmask, GRP_MASK(grpmask));
 }
 
-void ktrace_name(uint32_t tag, uint32_t id, const char name[KTRACE_NAMESIZE]) {
-    ktrace_state_t* ks = &KTRACE_STATE;
-    if (tag & atomic_load(&ks->grpmask)) {
+// Find space for a record, with interrupts disabled.
+static ktrace_record_t* ktrace_reserve(ktrace_state_t* ks, uint32_t mode, uint cpu) {
+    if (mode == KTRACE_MODE_LINEAR) {
         int off;
         if ((off = atomic_add(&ks->offset, KTRACE_RECSIZE)) >= (int)ks->bufsize) {
             // if we arrive at the end, stop
             atomic_store(&ks->grpmask, 0);
-            return;
+            return NULL;
+        }
+        return (ktrace_record_t*) (ks->buffer + off);
+    }
+
+    ktrace_cpu_t* kc = &ks->cpu[cpu];
+    uint64_t head = kc->head;
+    if ((mode == KTRACE_MODE_STREAM) && ((head - kc->tail) >= ks->ringsize)) {
+        kc->lost++;
+        return NULL;
+    }
+    return (ktrace_record_t*) (kc->buffer + (head & (ks->ringsize - 1)));
+}
+
+static void ktrace_commit(ktrace_state_t* ks, uint32_t mode, uint cpu) {
+    if (mode != KTRACE_MODE_LINEAR) {
+        // the record must be visible before head moves past it
+        smp_wmb();
+        ks->cpu[cpu].head += KTRACE_RECSIZE;
+    }
+}
+
+void ktrace_name(uint32_t tag, uint32_t id, const char name[KTRACE_NAMESIZE]) {
+    ktrace_state_t* ks = &KTRACE_STATE;
+    if (tag & atomic_load(&ks->grpmask)) {
+        spin_lock_saved_state_t state;
+        arch_interrupt_save(&state, ARCH_DEFAULT_SPIN_LOCK_FLAG_INTERRUPTS);
+        uint32_t mode = ks->mode;
+        uint cpu = arch_curr_cpu_num();
+        ktrace_record_t* rec = ktrace_reserve(ks, mode, cpu);
+        if (rec != NULL) {
+            rec->tag = (tag & 0xFFFFFF00) | cpu;
+            rec->id = id;
+            memcpy((uint8_t*)rec + KTRACE_NAMEOFF, name, KTRACE_NAMESIZE);
+            ktrace_commit(ks, mode, cpu);
         }
-        ktrace_record_t* rec = (ktrace_record_t*) (ks->buffer + off);
-        rec->tag = (tag & 0xFFFFFF00);
-        rec->id = id;
-        memcpy(ks->buffer + off + KTRACE_NAMEOFF, name, KTRACE_NAMESIZE);
+        arch_interrupt_restore(state, ARCH_DEFAULT_SPIN_LOCK_FLAG_INTERRUPTS);
     }
 }
 
 void ktrace(uint32_t tag, uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
     ktrace_state_t* ks = &KTRACE_STATE;
     if (tag & atomic_load(&ks->grpmask)) {
-        int off;
-        if ((off = atomic_add(&ks->offset, KTRACE_RECSIZE)) >= (int)ks->bufsize) {
-            // if we arrive at the end, stop
-            atomic_store(&ks->grpmask, 0);
-            return;
+        spin_lock_saved_state_t state;
+        arch_interrupt_save(&state, ARCH_DEFAULT_SPIN_LOCK_FLAG_INTERRUPTS);
+        uint32_t mode = ks->mode;
+        uint cpu = arch_curr_cpu_num();
+        ktrace_record_t* rec = ktrace_reserve(ks, mode, cpu);
+        if (rec != NULL) {
+            rec->ts = ktrace_ticks();
+            rec->tag = (tag & 0xFFFFFF00) | cpu;
+            rec->id = (uint32_t)get_current_thread()->user_tid;
+            rec->a = a;
+            rec->b = b;
+            rec->c = c;
+            rec->d = d;
+            ktrace_commit(ks, mode, cpu);
         }
-        ktrace_record_t* rec = (ktrace_record_t*) (ks->buffer + off);
-        rec->ts = ktrace_timestamp();
-        rec->tag = (tag & 0xFFFFFF00);
-        rec->id = (uint32_t)get_current_thread()->user_tid;
-        rec->a = a;
-        rec->b = b;
-        rec->c = c;
-        rec->d = d;
+        arch_interrupt_restore(state, ARCH_DEFAULT_SPIN_LOCK_FLAG_INTERRUPTS);
+    }
+}
+
+uint64_t ktrace_timestamp(void) {
+    return ktrace_ticks();
+}
+
+void ktrace_lock_wait(uint32_t tag, const void* lock, uint64_t start) {
+    uint64_t waited = ktrace_ticks() - start;
+    uint64_t addr = (uintptr_t)lock;
+    ktrace(tag, (uint32_t)addr, (uint32_t)(addr >> 32), (uint32_t)waited, (uint32_t)(waited >> 32));
+}
+
+#if WITH_SMP && !WITH_LOCK_STATS
+// spin_lock() comes here when the lock is already held
+void spin_lock_contended(spin_lock_t* lock) {
+    if (!(TAG_SPINLOCK_WAIT & atomic_load(&KTRACE_STATE.grpmask))) {
+        arch_spin_lock(lock);
+        return;
     }
+    uint64_t start = ktrace_ticks();
+    arch_spin_lock(lock);
+    ktrace_lock_wait(TAG_SPINLOCK_WAIT, lock, start);
 }
+#endif
 
 LK_INIT_HOOK(ktrace, ktrace_init, LK_INIT_LEVEL_APPS - 1);
\ No newline at end of file
@@ -0,0 +1,218 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <debug.h>
+#include <err.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <arch/mmu.h>
+#include <arch/ops.h>
+#include <kernel/auto_lock.h>
+#include <kernel/cmdline.h>
+#include <kernel/mp.h>
+#include <kernel/mutex.h>
+#include <kernel/thread.h>
+#include <kernel/timer.h>
+#include <kernel/vm.h>
+#include <kernel/vm/vm_aspace.h>
+#include <lib/ktrace.h>
+#include <lk/init.h>
+
+// Sampling profiler
+//
+// While enabled, a periodic timer on every cpu takes a sample each
+// period.  The timer callback runs inside the timer interrupt, and the
+// arch irq code has already handed the context that interrupt arrived
+// in to ktrace_profile_irq(), so the sample is of whatever the cpu was
+// doing: the interrupted pc, whether it was in user mode, and the
+// return addresses found walking the frame pointer chain from there.
+//
+// The walk runs with interrupts disabled and must never fault.  Kernel
+// frames have to lie within the current thread's kernel stack.  User
+// frames can't be read with a user copy, since resolving a fault needs
+// locks an interrupt can't take.  Instead the page is looked up in the
+// thread's address space and read through the physmap.  That lookup
+// takes no locks, so it can race with an unmap and return any physical
+// page.  Only cached user mappings of pages the pmm manages are read,
+// so a race gives a bad sample and never a device register read.  Any
+// other page ends the walk.
+
+typedef struct profile_cpu {
+    // context of the timer interrupt in progress, pc 0 if none
+    uintptr_t pc;
+    uintptr_t fp;
+    bool user;
+
+    timer_t timer;
+} profile_cpu_t;
+
+static profile_cpu_t profile_cpus[SMP_MAX_CPUS];
+
+// serializes starting and stopping
+static Mutex profile_lock;
+
+static int profile_active;
+static lk_time_t profile_period;
+static uint32_t profile_depth = KTRACE_DEFAULT_PROFILE_DEPTH;
+
+void ktrace_profile_irq(uintptr_t pc, uintptr_t fp, bool user) {
+    if (atomic_load(&profile_active)) {
+        profile_cpu_t* cpu = &profile_cpus[arch_curr_cpu_num()];
+        cpu->pc = pc;
+        cpu->fp = fp;
+        cpu->user = user;
+    }
+}
+
+static uint32_t walk_kernel(thread_t* t, uintptr_t fp, uintptr_t* out, uint32_t max) {
+    uintptr_t lo = (uintptr_t)t->stack;
+    uintptr_t hi = lo + t->stack_size;
+    uint32_t n = 0;
+    while (n < max) {
+        if ((fp < lo) || (fp > (hi - 2 * sizeof(uintptr_t))) || (fp & (sizeof(uintptr_t) - 1))) {
+            break;
+        }
+        uintptr_t* frame = (uintptr_t*)fp;
+        if (frame[1] == 0) {
+            break;
+        }
+        out[n++] = frame[1];
+        // callers' frames are further up the stack
+        if (frame[0] <= fp) {
+            break;
+        }
+        fp = frame[0];
+    }
+    return n;
+}
+
+static bool read_user_frame(VmAspace* aspace, uintptr_t fp, uintptr_t frame[2]) {
+    // keep to one page, which is all we look up
+    if ((fp & (PAGE_SIZE - 1)) > (PAGE_SIZE - 2 * sizeof(uintptr_t))) {
+        return false;
+    }
+    paddr_t pa;
+    uint flags;
+    if (arch_mmu_query(&aspace->arch_aspace(), fp, &pa, &flags) != NO_ERROR) {
+        return false;
+    }
+    if (!(flags & ARCH_MMU_FLAG_PERM_USER) ||
+        ((flags & ARCH_MMU_FLAG_CACHE_MASK) != ARCH_MMU_FLAG_CACHED)) {
+        return false;
+    }
+    // normal memory only, never device memory
+    if (paddr_to_vm_page(pa) == NULL) {
+        return false;
+    }
+    void* ptr = paddr_to_kvaddr(pa);
+    if (ptr == NULL) {
+        return false;
+    }
+    memcpy(frame, ptr, 2 * sizeof(uintptr_t));
+    return true;
+}
+
+static uint32_t walk_user(thread_t* t, uintptr_t fp, uintptr_t* out, uint32_t max) {
+    VmAspace* aspace = vmm_aspace_to_obj(t->aspace);
+    if (aspace == NULL) {
+        return 0;
+    }
+    uint32_t n = 0;
+    while (n < max) {
+        uintptr_t frame[2];
+        if (!is_user_address(fp) || (fp & (sizeof(uintptr_t) - 1)) ||
+            !read_user_frame(aspace, fp, frame)) {
+            break;
+        }
+        if (frame[1] == 0) {
+            break;
+        }
+        out[n++] = frame[1];
+        if (frame[0] <= fp) {
+            break;
+        }
+        fp = frame[0];
+    }
+    return n;
+}
+
+static enum handler_return profile_tick(timer_t* timer, lk_time_t now, void* arg) {
+    profile_cpu_t* cpu = &profile_cpus[arch_curr_cpu_num()];
+
+    // only sample from the interrupt whose context we were given
+    uintptr_t pc = cpu->pc;
+    if (pc == 0) {
+        return INT_NO_RESCHEDULE;
+    }
+    cpu->pc = 0;
+
+    thread_t* t = get_current_thread();
+    uintptr_t frames[KTRACE_PROFILE_MAX_DEPTH];
+    uint32_t n = 0;
+    if (cpu->fp) {
+        if (cpu->user) {
+            n = walk_user(t, cpu->fp, frames, profile_depth);
+        } else {
+            n = walk_kernel(t, cpu->fp, frames, profile_depth);
+        }
+    }
+
+    uint64_t pc64 = pc;
+    ktrace(TAG_PROFILE_SAMPLE, (uint32_t)pc64, (uint32_t)(pc64 >> 32),
+           cpu->user ? KTRACE_PROFILE_USER : 0, n);
+    for (uint32_t i = 0; i < n; i += 2) {
+        uint64_t a = frames[i];
+        uint64_t b = ((i + 1) < n) ? frames[i + 1] : 0;
+        ktrace(TAG_PROFILE_FRAMES, (uint32_t)a, (uint32_t)(a >> 32),
+               (uint32_t)b, (uint32_t)(b >> 32));
+    }
+    return INT_NO_RESCHEDULE;
+}
+
+// run on each cpu, since timers fire on the cpu that set them
+static void profile_start_cpu(void* arg) {
+    profile_cpu_t* cpu = &profile_cpus[arch_curr_cpu_num()];
+    cpu->pc = 0;
+    timer_set_periodic(&cpu->timer, profile_period, profile_tick, NULL);
+}
+
+static void profile_stop_cpu(void* arg) {
+    timer_cancel(&profile_cpus[arch_curr_cpu_num()].timer);
+}
+
+// Timers count in milliseconds, so rates above 1000Hz become 1000Hz.
+status_t ktrace_profile_control(uint32_t hz) {
+    AutoLock lock(&profile_lock);
+    if (atomic_load(&profile_active)) {
+        mp_sync_exec(MP_CPU_ALL, profile_stop_cpu, NULL);
+        atomic_store(&profile_active, 0);
+    }
+    if (hz == 0) {
+        return NO_ERROR;
+    }
+    profile_period = (hz >= 1000) ? 1 : (1000 / hz);
+    atomic_store(&profile_active, 1);
+    mp_sync_exec(MP_CPU_ALL, profile_start_cpu, NULL);
+    return NO_ERROR;
+}
+
+static void ktrace_profile_init(unsigned level) {
+    for (uint n = 0; n < SMP_MAX_CPUS; n++) {
+        timer_initialize(&profile_cpus[n].timer);
+    }
+
+    uint32_t depth = cmdline_get_uint32("ktrace.profile.depth", KTRACE_DEFAULT_PROFILE_DEPTH);
+    profile_depth = MIN(depth, (uint32_t)KTRACE_PROFILE_MAX_DEPTH);
+
+    uint32_t hz = cmdline_get_uint32("ktrace.profile.hz", KTRACE_DEFAULT_PROFILE_HZ);
+    if (hz) {
+        dprintf(INFO, "ktrace: profiling at %u Hz, %u frames\n", hz, profile_depth);
+        ktrace_profile_control(hz);
+    }
+}
+
+LK_INIT_HOOK(ktrace_profile, ktrace_profile_init, LK_INIT_LEVEL_APPS - 1);
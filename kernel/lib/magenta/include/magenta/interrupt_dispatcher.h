@@ -6,16 +6,34 @@
 
 #pragma once
 
+#include <kernel/spinlock.h>
+#include <kernel/timer.h>
 #include <magenta/dispatcher.h>
+#include <magenta/io_port_dispatcher.h>
 #include <magenta/state_tracker.h>
+#include <mxtl/ref_ptr.h>
 #include <sys/types.h>
 
+// Interrupts are delivered either by asserting MX_SIGNAL_SIGNALED on the
+// handle, which mx_interrupt_complete() clears, or, once bound with
+// BindPort(), as IOP_Irq packets on an IO port.
+//
+// A bound interrupt has at most one packet outstanding. It is queued
+// once |max_count_| interrupts have fired or |max_delay_| after the
+// first of them, and the count restarts when a thread dequeues it.
+// When the count is reached the source is left masked until the thread
+// that dequeued the packet next calls mx_port_wait(), so that the driver
+// has serviced the device first and a source with no one servicing it
+// can't keep interrupting.
 class InterruptDispatcher : public Dispatcher {
 public:
     InterruptDispatcher& operator=(const InterruptDispatcher &) = delete;
 
+    ~InterruptDispatcher() override;
+
     mx_obj_type_t get_type() const final { return MX_OBJ_TYPE_INTERRUPT; }
     StateTracker* get_state_tracker() final { return &state_tracker_; }
+    void on_zero_handles() final;
 
     status_t UserSignal(uint32_t clear_mask, uint32_t set_mask) final {
         if ((set_mask & ~MX_SIGNAL_SIGNALED) || (clear_mask & ~MX_SIGNAL_SIGNALED))
@@ -29,9 +47,54 @@ public:
     // Required before the handle can be waited upon again.
     virtual status_t InterruptComplete() = 0;
 
+    status_t BindPort(mxtl::RefPtr<IOPortDispatcher> port, uint64_t key,
+                      uint32_t max_count, mx_time_t max_delay);
+
+    void GetInfo(mx_record_interrupt_t* info);
+
+    // Called by the IO port when a thread dequeues our packet, and when
+    // it next waits on the port.
+    void PacketDequeued(IOP_Irq* packet);
+    void PacketDone();
+
 protected:
-    InterruptDispatcher()
-        : state_tracker_(true, mx_signals_state_t{0u, MX_SIGNAL_SIGNALED}) { }
+    InterruptDispatcher();
+
+    // Called from the subclass's irq handler. Returns true if the source
+    // should be left masked, and sets |*resched| if a thread was woken.
+    bool OnInterrupt(bool* resched);
+
+    // Unmask the source after OnInterrupt() asked for it to be masked.
+    virtual void UnmaskInterrupt() = 0;
+
+    // True once BindPort() has succeeded.
+    bool bound() const { return packet_ != nullptr; }
 
     IrqStateTracker state_tracker_;
+
+private:
+    enum class PacketState { IDLE, QUEUED, DEQUEUED };
+
+    bool QueuePacket_Locked();
+    void ArmTimer_Locked(mx_time_t now);
+    static enum handler_return TimerThunk(timer_t* timer, lk_time_t now, void* arg);
+
+    spin_lock_t lock_;
+
+    // Set once by BindPort() and not changed after.
+    mxtl::RefPtr<IOPortDispatcher> port_;
+    IOP_Irq* packet_;
+    uint32_t max_count_;
+    mx_time_t max_delay_;
+
+    // Guarded by |lock_|.
+    PacketState state_;
+    bool closed_;
+    bool masked_;
+    bool timer_armed_;
+    uint32_t pending_;
+    mx_time_t pending_since_;
+    timer_t timer_;
+
+    mx_record_interrupt_t stats_;
 };
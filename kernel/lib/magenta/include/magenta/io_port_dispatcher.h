@@ -9,6 +9,8 @@
 #include <new.h>
 #include <kernel/mutex.h>
 #include <kernel/event.h>
+#include <kernel/spinlock.h>
+#include <kernel/thread.h>
 
 #include <magenta/dispatcher.h>
 #include <magenta/types.h>
@@ -29,12 +31,13 @@ struct IOP_Packet : public mxtl::DoublyLinkedListable<IOP_Packet*> {
     IOP_Packet(mx_size_t data_size)
         : is_signal(false), data_size(data_size) {}
 
-    IOP_Packet(mx_size_t data_size, bool is_signal)
-        : is_signal(is_signal), data_size(data_size) {}
+    IOP_Packet(mx_size_t data_size, bool is_signal, bool is_irq = false)
+        : is_signal(is_signal), is_irq(is_irq), data_size(data_size) {}
 
     bool CopyToUser(void* data, mx_size_t* size);
 
     bool is_signal;
+    bool is_irq;
     mx_size_t data_size;
 };
 
@@ -45,6 +48,24 @@ struct IOP_Signal : public IOP_Packet {
     IOP_Signal(uint64_t key, mx_signals_t signal);
 };
 
+class InterruptDispatcher;
+
+class IOPortDispatcher;
+
+// Owned by the InterruptDispatcher bound to |port|.  From the time a
+// thread dequeues it until the interrupt is re-armed, |owner_ref|
+// keeps the interrupt alive.
+struct IOP_Irq : public IOP_Packet {
+    mx_irq_packet_t payload;
+    InterruptDispatcher* owner;
+    IOPortDispatcher* port;
+    mxtl::RefPtr<Dispatcher> owner_ref;
+    // the thread that dequeued it, until it waits again
+    thread_t* consumer;
+
+    IOP_Irq(uint64_t key, InterruptDispatcher* owner, IOPortDispatcher* port);
+};
+
 // IO Port job is to deliver packets to threads waiting in Wait(). There
 // are two types of packets:
 //
@@ -67,6 +88,14 @@ struct IOP_Signal : public IOP_Packet {
 //                           |          |           |
 //                           +------>at_zero_ <-----+
 //
+// Interrupts bound to the port post IOP_Irq packets from irq context
+// via QueueIrq(). Those go on the spinlock protected |irq_packets_|
+// list, which Wait() drains first. When mx_port_wait() is done with the
+// packet, Delete() parks it on |irq_done_|, and the interrupt is re-armed
+// when the same thread next calls Wait(): by then the driver has serviced
+// the device, so a level-triggered source doesn't fire again straight
+// away, and no other thread can be handed the source while it does.
+//
 
 class IOPortDispatcher final : public Dispatcher {
 public:
@@ -83,9 +112,22 @@ public:
 
     mx_status_t Wait(IOP_Packet** packet);
 
+    // Safe to call from irq context. Returns false if the port has no
+    // clients left, otherwise sets |*woke| if a waiter was woken.
+    bool QueueIrq(IOP_Irq* packet, bool* woke);
+    // Removes |packet| if it is still queued.
+    void CancelIrq(IOP_Irq* packet);
+    // Called by Delete(). Re-arms the interrupt on the next Wait().
+    void IrqConsumed(IOP_Irq* packet);
+
 private:
     IOPortDispatcher(uint32_t options);
     void FreePackets_NoLock();
+    IOP_Irq* PopIrq();
+    // Re-arms the interrupts whose packets |consumer| is done with, or
+    // all of them if it is null.
+    void RetireIrqs(thread_t* consumer);
+    static void RetireIrq(IOP_Irq* packet);
 
     const uint32_t options_;
 
@@ -94,4 +136,9 @@ private:
     mxtl::DoublyLinkedList<IOP_Packet*> packets_;
     mxtl::DoublyLinkedList<IOP_Packet*> at_zero_;
     event_t event_;
+
+    spin_lock_t irq_lock_;
+    bool irq_closed_;                                // guarded by irq_lock_
+    mxtl::DoublyLinkedList<IOP_Packet*> irq_packets_;  // guarded by irq_lock_
+    mxtl::DoublyLinkedList<IOP_Packet*> irq_done_;     // guarded by irq_lock_
 };
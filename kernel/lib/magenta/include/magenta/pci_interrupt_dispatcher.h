@@ -28,6 +28,8 @@ private:
     static pcie_irq_handler_retval_t IrqThunk(struct pcie_device_state* dev,
                                               uint irq_id,
                                               void* ctx);
+    void UnmaskInterrupt() final;
+
     PciInterruptDispatcher(uint32_t irq_id, bool maskable)
         : irq_id_(irq_id),
           maskable_(maskable) { }
@@ -127,6 +127,7 @@ public:
     void Kill();
 
     status_t GetInfo(mx_record_process_t* info);
+    status_t GetStats(mx_record_process_stats_t* info);
 
     status_t CreateUserThread(mxtl::StringPiece name, uint32_t flags, mxtl::RefPtr<UserThread>* user_thread);
 
@@ -85,6 +85,9 @@ public:
     // privileged and unprivileged fields.
     status_t WriteState(uint32_t state_kind, const void* buffer, uint32_t buffer_len, bool priv);
 
+    // scheduler accounting, times in nanoseconds
+    void GetStats(mx_record_thread_stats_t* info);
+
     mx_koid_t get_koid() const { return koid_; }
     void set_dispatcher(ThreadDispatcher* dispatcher) { dispatcher_ = dispatcher; }
 
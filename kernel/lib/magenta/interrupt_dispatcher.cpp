@@ -0,0 +1,232 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <magenta/interrupt_dispatcher.h>
+
+#include <assert.h>
+#include <err.h>
+#include <new.h>
+#include <platform.h>
+
+#include <kernel/auto_spinlock.h>
+#include <kernel/thread.h>
+
+// Timers count in milliseconds, and compare times as signed differences.
+constexpr lk_time_t kMaxTimerDelay = 1u << 30;
+
+static mx_time_t now_ns() {
+    return current_time_hires() * 1000;
+}
+
+InterruptDispatcher::InterruptDispatcher()
+    : state_tracker_(true, mx_signals_state_t{0u, MX_SIGNAL_SIGNALED}),
+      packet_(nullptr),
+      max_count_(0u),
+      max_delay_(0u),
+      state_(PacketState::IDLE),
+      closed_(false),
+      masked_(false),
+      timer_armed_(false),
+      pending_(0u),
+      pending_since_(0u),
+      stats_{} {
+    spin_lock_init(&lock_);
+    timer_initialize(&timer_);
+}
+
+InterruptDispatcher::~InterruptDispatcher() {
+    // The subclass has already unhooked us from the irq, so only the
+    // timer can still call in. Wait out a callback already running on
+    // another cpu.
+    timer_cancel_sync(&timer_);
+    {
+        AutoSpinLock<> asl(&lock_);
+        DEBUG_ASSERT(state_ != PacketState::DEQUEUED);
+    }
+    delete packet_;
+}
+
+void InterruptDispatcher::on_zero_handles() {
+    AutoSpinLock<> asl(&lock_);
+    closed_ = true;
+    if (state_ == PacketState::QUEUED) {
+        port_->CancelIrq(packet_);
+        state_ = PacketState::IDLE;
+    }
+}
+
+status_t InterruptDispatcher::BindPort(mxtl::RefPtr<IOPortDispatcher> port, uint64_t key,
+                                       uint32_t max_count, mx_time_t max_delay) {
+    if (max_count == 0u || (max_count > 1u && max_delay == 0u))
+        return ERR_INVALID_ARGS;
+
+    AllocChecker ac;
+    auto packet = new (&ac) IOP_Irq(key, this, port.get());
+    if (!ac.check())
+        return ERR_NO_MEMORY;
+
+    bool woke = false;
+    {
+        AutoSpinLock<> asl(&lock_);
+        if (packet_ == nullptr) {
+            port_ = mxtl::move(port);
+            packet_ = packet;
+            packet = nullptr;
+            max_count_ = max_count;
+            max_delay_ = max_delay;
+
+            // An interrupt that was signaled but not yet completed is
+            // still masked. Hand it to the port instead.
+            if (state_tracker_.GetSignalsState().satisfied & MX_SIGNAL_SIGNALED) {
+                state_tracker_.UpdateSatisfiedFromIrq(MX_SIGNAL_SIGNALED, 0u);
+                pending_ = 1u;
+                pending_since_ = now_ns();
+                masked_ = true;
+                woke = QueuePacket_Locked();
+            }
+        }
+    }
+
+    if (packet != nullptr) {
+        delete packet;
+        return ERR_BAD_STATE;
+    }
+
+    if (woke)
+        thread_preempt(false);
+
+    return NO_ERROR;
+}
+
+void InterruptDispatcher::GetInfo(mx_record_interrupt_t* info) {
+    AutoSpinLock<> asl(&lock_);
+    *info = stats_;
+}
+
+bool InterruptDispatcher::OnInterrupt(bool* resched) {
+    mx_time_t now = now_ns();
+    *resched = false;
+
+    {
+        AutoSpinLock<> asl(&lock_);
+        if (stats_.interrupts++ == 0u)
+            stats_.first_time = now;
+        stats_.last_time = now;
+
+        if (packet_ != nullptr) {
+            // With no handles left nobody will ever service it.
+            if (closed_)
+                return true;
+
+            if (pending_++ == 0u)
+                pending_since_ = now;
+
+            if (pending_ >= max_count_) {
+                masked_ = true;
+                if (state_ == PacketState::IDLE)
+                    *resched = QueuePacket_Locked();
+                return true;
+            }
+
+            // Otherwise the packet goes out when the timer fires, or
+            // when the outstanding one is done with.
+            if (state_ == PacketState::IDLE)
+                ArmTimer_Locked(now);
+            return false;
+        }
+    }
+
+    *resched = state_tracker_.UpdateSatisfiedFromIrq(0u, MX_SIGNAL_SIGNALED);
+    return true;
+}
+
+void InterruptDispatcher::PacketDequeued(IOP_Irq* packet) {
+    AutoSpinLock<> asl(&lock_);
+    DEBUG_ASSERT(packet == packet_);
+
+    packet->payload.timestamp = pending_since_;
+    packet->payload.count = pending_;
+    if (pending_ > stats_.max_batch)
+        stats_.max_batch = pending_;
+
+    pending_ = 0u;
+    state_ = PacketState::DEQUEUED;
+}
+
+void InterruptDispatcher::PacketDone() {
+    bool unmask = false;
+    bool woke = false;
+    {
+        AutoSpinLock<> asl(&lock_);
+        DEBUG_ASSERT(state_ == PacketState::DEQUEUED);
+        state_ = PacketState::IDLE;
+        if (closed_)
+            return;
+
+        // Interrupts that came in while the packet was out go out
+        // straight away if their batch is already complete.
+        mx_time_t now = now_ns();
+        if (pending_ >= max_count_ ||
+            (pending_ > 0u && now - pending_since_ >= max_delay_)) {
+            woke = QueuePacket_Locked();
+        } else {
+            if (pending_ > 0u)
+                ArmTimer_Locked(now);
+            if (masked_) {
+                masked_ = false;
+                unmask = true;
+            }
+        }
+    }
+
+    if (unmask)
+        UnmaskInterrupt();
+
+    if (woke)
+        thread_preempt(false);
+}
+
+bool InterruptDispatcher::QueuePacket_Locked() {
+    bool woke = false;
+    if (port_->QueueIrq(packet_, &woke)) {
+        state_ = PacketState::QUEUED;
+        stats_.packets++;
+    }
+    return woke;
+}
+
+void InterruptDispatcher::ArmTimer_Locked(mx_time_t now) {
+    if (timer_armed_)
+        return;
+
+    mx_time_t elapsed = now - pending_since_;
+    mx_time_t remaining = (elapsed < max_delay_) ? max_delay_ - elapsed : 0u;
+    mx_time_t delay = (remaining + 999999u) / 1000000u;
+    if (delay > kMaxTimerDelay)
+        delay = kMaxTimerDelay;
+
+    timer_armed_ = true;
+    timer_set_oneshot(&timer_, static_cast<lk_time_t>(delay), TimerThunk, this);
+}
+
+enum handler_return InterruptDispatcher::TimerThunk(timer_t* timer, lk_time_t now, void* arg) {
+    InterruptDispatcher* thiz = reinterpret_cast<InterruptDispatcher*>(arg);
+    bool resched = false;
+
+    AutoSpinLock<> asl(&thiz->lock_);
+    thiz->timer_armed_ = false;
+    if (!thiz->closed_ && thiz->state_ == PacketState::IDLE && thiz->pending_ > 0u) {
+        // A timer left over from an earlier batch can fire early.
+        mx_time_t ns = now_ns();
+        if (ns - thiz->pending_since_ >= thiz->max_delay_) {
+            resched = thiz->QueuePacket_Locked();
+        } else {
+            thiz->ArmTimer_Locked(ns);
+        }
+    }
+
+    return resched ? INT_RESCHEDULE : INT_NO_RESCHEDULE;
+}
@@ -77,19 +77,28 @@ InterruptEventDispatcher::~InterruptEventDispatcher() {
 }
 
 status_t InterruptEventDispatcher::InterruptComplete() {
+    // Bound interrupts are re-armed by the port.
+    if (bound())
+        return ERR_BAD_STATE;
+
     // Clear the state in the state tracker, then unmask the interrupt.
     state_tracker_.UpdateSatisfied(MX_SIGNAL_SIGNALED, 0u);
     unmask_interrupt(vector_);
     return NO_ERROR;
 }
 
+void InterruptEventDispatcher::UnmaskInterrupt() {
+    unmask_interrupt(vector_);
+}
+
 enum handler_return InterruptEventDispatcher::IrqHandler(void* ctx) {
     InterruptEventDispatcher* thiz = reinterpret_cast<InterruptEventDispatcher*>(ctx);
 
-    // TODO(johngro): make sure that this is safe to do from an IRQ.
-    mask_interrupt(thiz->vector_);
+    bool resched;
+    if (thiz->OnInterrupt(&resched)) {
+        // TODO(johngro): make sure that this is safe to do from an IRQ.
+        mask_interrupt(thiz->vector_);
+    }
 
-    return thiz->state_tracker_.UpdateSatisfiedFromIrq(0u, MX_SIGNAL_SIGNALED)
-            ? INT_RESCHEDULE
-            : INT_NO_RESCHEDULE;
+    return resched ? INT_RESCHEDULE : INT_NO_RESCHEDULE;
 }
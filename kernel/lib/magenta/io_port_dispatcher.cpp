@@ -14,8 +14,10 @@
 #include <arch/user_copy.h>
 
 #include <kernel/auto_lock.h>
+#include <kernel/auto_spinlock.h>
 #include <lib/user_copy.h>
 
+#include <magenta/interrupt_dispatcher.h>
 #include <magenta/state_tracker.h>
 #include <magenta/user_copy.h>
 
@@ -53,6 +55,11 @@ IOP_Packet* IOP_Packet::MakeFromUser(const void* data, mx_size_t size) {
 }
 
 void IOP_Packet::Delete(IOP_Packet* packet) {
+    if (packet->is_irq) {
+        auto irq = static_cast<IOP_Irq*>(packet);
+        irq->port->IrqConsumed(irq);
+        return;
+    }
     if (packet->is_signal)
         return;
     packet->~IOP_Packet();
@@ -73,6 +80,14 @@ IOP_Signal::IOP_Signal(uint64_t key, mx_signals_t signal)
       count(1u) {
 }
 
+IOP_Irq::IOP_Irq(uint64_t key, InterruptDispatcher* owner, IOPortDispatcher* port)
+    : IOP_Packet(sizeof(payload), false, true),
+      payload {{key, MX_PORT_PKT_TYPE_IRQ, 0u}, 0u, 0u, 0u},
+      owner(owner),
+      port(port),
+      consumer(nullptr) {
+}
+
 mx_status_t IOPortDispatcher::Create(uint32_t options,
                                      mxtl::RefPtr<Dispatcher>* dispatcher,
                                      mx_rights_t* rights) {
@@ -88,13 +103,17 @@ mx_status_t IOPortDispatcher::Create(uint32_t options,
 
 IOPortDispatcher::IOPortDispatcher(uint32_t options)
     : options_(options),
-      no_clients_(false) {
+      no_clients_(false),
+      irq_closed_(false) {
     event_init(&event_, false, EVENT_FLAG_AUTOUNSIGNAL);
+    spin_lock_init(&irq_lock_);
 }
 
 IOPortDispatcher::~IOPortDispatcher() {
     FreePackets_NoLock();
     DEBUG_ASSERT(packets_.is_empty());
+    DEBUG_ASSERT(irq_packets_.is_empty());
+    DEBUG_ASSERT(irq_done_.is_empty());
     event_destroy(&event_);
 }
 
@@ -110,9 +129,84 @@ void IOPortDispatcher::FreePackets_NoLock() {
 }
 
 void IOPortDispatcher::on_zero_handles() {
-    AutoLock al(&lock_);
-    no_clients_ = true;
-    FreePackets_NoLock();
+    {
+        AutoLock al(&lock_);
+        no_clients_ = true;
+        FreePackets_NoLock();
+
+        // Irq packets belong to their interrupts, which find out the port
+        // is gone the next time they try to queue one.
+        AutoSpinLock<> asl(&irq_lock_);
+        irq_closed_ = true;
+        irq_packets_.clear();
+    }
+
+    // Nobody will wait again, so re-arm whatever was consumed last.
+    RetireIrqs(nullptr);
+}
+
+bool IOPortDispatcher::QueueIrq(IOP_Irq* packet, bool* woke) {
+    {
+        AutoSpinLock<> asl(&irq_lock_);
+        if (irq_closed_)
+            return false;
+        irq_packets_.push_back(packet);
+    }
+    *woke = event_signal_etc(&event_, false, NO_ERROR) > 0;
+    return true;
+}
+
+void IOPortDispatcher::CancelIrq(IOP_Irq* packet) {
+    AutoSpinLock<> asl(&irq_lock_);
+    if (packet->InContainer())
+        irq_packets_.erase(*packet);
+}
+
+void IOPortDispatcher::IrqConsumed(IOP_Irq* packet) {
+    {
+        AutoSpinLock<> asl(&irq_lock_);
+        if (!irq_closed_) {
+            packet->consumer = get_current_thread();
+            irq_done_.push_back(packet);
+            return;
+        }
+    }
+    RetireIrq(packet);
+}
+
+void IOPortDispatcher::RetireIrqs(thread_t* consumer) {
+    mxtl::DoublyLinkedList<IOP_Packet*> done;
+    {
+        AutoSpinLock<> asl(&irq_lock_);
+        for (;;) {
+            auto pk = irq_done_.erase_if([consumer](const IOP_Packet& p) -> bool {
+                return !consumer || static_cast<const IOP_Irq&>(p).consumer == consumer;
+            });
+            if (!pk)
+                break;
+            done.push_back(pk);
+        }
+    }
+    while (!done.is_empty())
+        RetireIrq(static_cast<IOP_Irq*>(done.pop_front()));
+}
+
+void IOPortDispatcher::RetireIrq(IOP_Irq* packet) {
+    // The reference is dropped after PacketDone(), which may free the
+    // interrupt and with it the packet.
+    auto owner = mxtl::move(packet->owner_ref);
+    packet->owner->PacketDone();
+}
+
+IOP_Irq* IOPortDispatcher::PopIrq() {
+    AutoSpinLock<> asl(&irq_lock_);
+    if (irq_packets_.is_empty())
+        return nullptr;
+    auto irq = static_cast<IOP_Irq*>(irq_packets_.pop_front());
+    // The interrupt can't go away while its packet is queued, since
+    // it cancels the packet when its last handle is closed.
+    irq->owner_ref = mxtl::RefPtr<Dispatcher>(irq->owner);
+    return irq;
 }
 
 mx_status_t IOPortDispatcher::Queue(IOP_Packet* packet) {
@@ -176,7 +270,18 @@ void* IOPortDispatcher::Signal(void* cookie, uint64_t key, mx_signals_t signal)
 }
 
 mx_status_t IOPortDispatcher::Wait(IOP_Packet** packet) {
+    // Coming back to wait means the packets this thread was handed
+    // before have been dealt with.
+    RetireIrqs(get_current_thread());
+
     while (true) {
+        auto irq = PopIrq();
+        if (irq) {
+            irq->owner->PacketDequeued(irq);
+            *packet = irq;
+            return NO_ERROR;
+        }
+
         {
             AutoLock al(&lock_);
             if (!packets_.is_empty()) {
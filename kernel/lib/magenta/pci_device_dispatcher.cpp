@@ -222,6 +222,15 @@ status_t PciDeviceDispatcher::SetIrqMode(mx_pci_irq_mode_t mode, uint32_t reques
     return ret;
 }
 
+status_t PciDeviceDispatcher::SetIrqAffinity(uint32_t which_irq, uint32_t cpu_num) {
+    AutoLock lock(&lock_);
+    DEBUG_ASSERT(device_ && device_->device());
+
+    if (!device_->claimed()) return ERR_BAD_STATE;  // Are we not claimed yet?
+
+    return pcie_set_irq_affinity(device_->device(), which_irq, cpu_num);
+}
+
 PciDeviceDispatcher::PciDeviceWrapper::PciDeviceWrapper(pcie_device_state_t* device)
     : device_(device) {
     DEBUG_ASSERT(device_);
@@ -32,11 +32,14 @@ pcie_irq_handler_retval_t PciInterruptDispatcher::IrqThunk(struct pcie_device_st
     DEBUG_ASSERT(ctx);
     PciInterruptDispatcher* thiz = (PciInterruptDispatcher*)ctx;
 
-    // Mask the IRQ at the PCIe hardware level if we can, and (if any threads
-    // just became runable) tell the kernel to trigger a reschedule event.
-    return thiz->state_tracker_.UpdateSatisfiedFromIrq(0u, MX_SIGNAL_SIGNALED)
-        ? PCIE_IRQRET_MASK_AND_RESCHED
-        : PCIE_IRQRET_MASK;
+    // Mask the IRQ at the PCIe hardware level if we can (unless it is
+    // being coalesced), and (if any threads just became runable) tell the
+    // kernel to trigger a reschedule event.
+    bool resched;
+    bool mask = thiz->OnInterrupt(&resched);
+    if (mask)
+        return resched ? PCIE_IRQRET_MASK_AND_RESCHED : PCIE_IRQRET_MASK;
+    return resched ? PCIE_IRQRET_RESCHED : PCIE_IRQRET_NO_ACTION;
 }
 
 status_t PciInterruptDispatcher::Create(
@@ -79,10 +82,19 @@ status_t PciInterruptDispatcher::Create(
 
 status_t PciInterruptDispatcher::InterruptComplete() {
     DEBUG_ASSERT(device_ != nullptr);
+
+    // Bound interrupts are re-armed by the port.
+    if (bound())
+        return ERR_BAD_STATE;
+
     state_tracker_.UpdateSatisfied(MX_SIGNAL_SIGNALED, 0u);
+    UnmaskInterrupt();
+
+    return NO_ERROR;
+}
 
+void PciInterruptDispatcher::UnmaskInterrupt() {
+    DEBUG_ASSERT(device_ != nullptr);
     if (maskable_)
         pcie_unmask_irq(device_->device(), irq_id_);
-
-    return NO_ERROR;
 }
@@ -371,6 +371,31 @@ status_t ProcessDispatcher::GetInfo(mx_record_process_t* info) {
     return NO_ERROR;
 }
 
+status_t ProcessDispatcher::GetStats(mx_record_process_stats_t* info) {
+    size_t mapped = 0;
+    size_t committed = 0;
+    size_t large = 0;
+    uint32_t regions = 0;
+    if (aspace_)
+        aspace_->GetMemoryUsage(&mapped, &committed, &large, &regions);
+    info->mapped_bytes = mapped;
+    info->committed_bytes = committed;
+    info->large_page_bytes = large;
+    info->regions = regions;
+
+    AutoLock lock(&thread_list_lock_);
+    info->threads = 0;
+    info->runtime = 0;
+    for (auto& thread : thread_list_) {
+        mx_record_thread_stats_t stats;
+        thread.GetStats(&stats);
+        info->threads++;
+        info->runtime += stats.runtime;
+    }
+
+    return NO_ERROR;
+}
+
 status_t ProcessDispatcher::CreateUserThread(mxtl::StringPiece name, uint32_t flags, mxtl::RefPtr<UserThread>* user_thread) {
     AllocChecker ac;
     auto ut = mxtl::AdoptRef(new (&ac) UserThread(GenerateKernelObjectId(),
@@ -355,6 +355,24 @@ uint32_t UserThread::get_num_state_kinds() const {
 
 // Note: buffer must be sufficiently aligned
 
+void UserThread::GetStats(mx_record_thread_stats_t* info) {
+    THREAD_LOCK(state);
+    lk_bigtime_t now = current_time_hires();
+    lk_bigtime_t runtime = thread_.runtime_us;
+    if (thread_.state == THREAD_RUNNING)
+        runtime += now - thread_.last_started_running_us;
+    lk_bigtime_t wait_time = thread_.wait_time_us;
+    if (thread_.last_blocked_us)
+        wait_time += now - thread_.last_blocked_us;
+    info->context_switches = thread_.context_switches;
+    info->preemptions = thread_.preemptions;
+    info->page_faults = thread_.page_faults;
+    THREAD_UNLOCK(state);
+
+    info->runtime = runtime * 1000;
+    info->wait_time = wait_time * 1000;
+}
+
 status_t UserThread::ReadState(uint32_t state_kind, void* buffer, uint32_t* buffer_len) {
     LTRACE_ENTRY_OBJ;
 
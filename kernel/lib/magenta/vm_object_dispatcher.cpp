@@ -6,6 +6,7 @@
 
 #include <magenta/vm_object_dispatcher.h>
 
+#include <magenta/process_dispatcher.h>
 #include <kernel/vm/vm_aspace.h>
 #include <kernel/vm/vm_object.h>
 
@@ -35,7 +36,10 @@ status_t VmObjectDispatcher::Create(mxtl::RefPtr<VmObject> vmo,
 VmObjectDispatcher::VmObjectDispatcher(mxtl::RefPtr<VmObject> vmo)
     : vmo_(vmo) {}
 
-VmObjectDispatcher::~VmObjectDispatcher() {}
+VmObjectDispatcher::~VmObjectDispatcher() {
+    // pins made through this object die with it
+    vmo_->UnpinAll(this);
+}
 
 mx_ssize_t VmObjectDispatcher::Read(user_ptr<void> user_data, mx_size_t length, uint64_t offset) {
 
@@ -83,13 +87,28 @@ mx_status_t VmObjectDispatcher::RangeOp(uint32_t op, uint64_t offset, uint64_t s
             // TODO: handle partial commits
             return NO_ERROR;
         }
-        case MX_VMO_OP_DECOMMIT:
-            // TODO: handle
-            return ERR_NOT_SUPPORTED;
+        case MX_VMO_OP_DECOMMIT: {
+            // throws away contents, so it takes the right to change them
+            if (!(rights & MX_RIGHT_WRITE))
+                return ERR_ACCESS_DENIED;
+
+            auto decommitted = vmo_->DecommitRange(offset, size);
+            if (decommitted < 0)
+                return static_cast<mx_status_t>(decommitted);
+            return NO_ERROR;
+        }
+        case MX_VMO_OP_PREFETCH:
+            return vmo_->PrefetchRange(offset, size);
+        case MX_VMO_OP_RESIDENCY:
+            if (!buffer)
+                return ERR_INVALID_ARGS;
+            return vmo_->QueryResidency(offset, size, buffer.reinterpret<uint8_t>(), buffer_size);
         case MX_VMO_OP_LOCK:
+            return vmo_->Pin(this, ProcessDispatcher::GetCurrent()->get_koid(), offset, size);
         case MX_VMO_OP_UNLOCK:
-            // TODO: handle
-            return ERR_NOT_SUPPORTED;
+            // only the process that pinned a range, through this
+            // object, can unpin it
+            return vmo_->Unpin(this, ProcessDispatcher::GetCurrent()->get_koid(), offset, size);
         case MX_VMO_OP_LOOKUP:
             // we will be using the user pointer
             if (!buffer)
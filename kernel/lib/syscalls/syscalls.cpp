@@ -5,6 +5,8 @@
 // https://opensource.org/licenses/MIT
 
 #include <err.h>
+#include <kernel/thread.h>
+#include <lib/ktrace.h>
 #include <lib/user_copy.h>
 
 #include <magenta/magenta.h>
@@ -47,6 +49,7 @@ extern "C" void arm_syscall_handler(struct arm_fault_frame* frame) {
     syscall_num &= 0x000fffff;
 
     /* re-enable interrupts to maintain kernel preemptiveness */
+    thread_syscall_enter();
     arch_enable_ints();
 
     LTRACEF_LEVEL(2, "arm syscall: num 0x%x, pc 0x%x\n", syscall_num, frame->pc);
@@ -68,8 +71,11 @@ extern "C" void arm_syscall_handler(struct arm_fault_frame* frame) {
     }
 
     /* call the routine */
+    ktrace(TAG_SYSCALL_ENTER, syscall_num, 0, 0, 0);
     ret = sfunc(frame->r[0], frame->r[1], frame->r[2], frame->r[3], frame->r[4],
                          frame->r[5], frame->r[6], frame->r[7]);
+    thread_syscall_exit();
+    ktrace(TAG_SYSCALL_EXIT, syscall_num, (uint32_t)ret, (uint32_t)(ret >> 32), 0);
 
     LTRACEF_LEVEL(2, "ret 0x%llx\n", ret);
 
@@ -100,6 +106,7 @@ extern "C" void arm64_syscall(struct arm64_iframe_long* frame, bool is_64bit, ui
     }
 
     /* re-enable interrupts to maintain kernel preemptiveness */
+    thread_syscall_enter();
     arch_enable_ints();
 
     LTRACEF_LEVEL(2, "num %llu\n", syscall_num);
@@ -121,8 +128,11 @@ extern "C" void arm64_syscall(struct arm64_iframe_long* frame, bool is_64bit, ui
     }
 
     /* call the routine */
+    ktrace(TAG_SYSCALL_ENTER, (uint32_t)syscall_num, 0, 0, 0);
     uint64_t ret = sfunc(frame->r[0], frame->r[1], frame->r[2], frame->r[3], frame->r[4],
                          frame->r[5], frame->r[6], frame->r[7]);
+    thread_syscall_exit();
+    ktrace(TAG_SYSCALL_EXIT, (uint32_t)syscall_num, (uint32_t)ret, (uint32_t)(ret >> 32), 0);
 
     LTRACEF_LEVEL(2, "ret 0x%llx\n", ret);
 
@@ -156,6 +166,7 @@ extern "C" uint64_t x86_64_syscall(uint64_t arg1, uint64_t arg2, uint64_t arg3,
     syscall_num &= 0xffffffff;
 
     /* re-enable interrupts to maintain kernel preemptiveness */
+    thread_syscall_enter();
     arch_enable_ints();
 
     LTRACEF_LEVEL(2, "t %p syscall num %llu ip 0x%llx\n", get_current_thread(), syscall_num, ip);
@@ -177,7 +188,10 @@ extern "C" uint64_t x86_64_syscall(uint64_t arg1, uint64_t arg2, uint64_t arg3,
     }
 
     /* call the routine */
+    ktrace(TAG_SYSCALL_ENTER, (uint32_t)syscall_num, 0, 0, 0);
     uint64_t ret = sfunc(arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8);
+    thread_syscall_exit();
+    ktrace(TAG_SYSCALL_EXIT, (uint32_t)syscall_num, (uint32_t)ret, (uint32_t)(ret >> 32), 0);
 
     /* check to see if there are any pending signals */
     thread_process_pending_signals();
@@ -5,6 +5,7 @@
 // https://opensource.org/licenses/MIT
 
 #include <err.h>
+#include <inttypes.h>
 #include <platform.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -20,6 +21,7 @@
 
 #include <magenta/interrupt_dispatcher.h>
 #include <magenta/interrupt_event_dispatcher.h>
+#include <magenta/io_port_dispatcher.h>
 #include <magenta/magenta.h>
 #include <magenta/pci_device_dispatcher.h>
 #include <magenta/pci_interrupt_dispatcher.h>
@@ -75,6 +77,25 @@ mx_status_t sys_interrupt_complete(mx_handle_t handle_value) {
     return interrupt->InterruptComplete();
 }
 
+mx_status_t sys_interrupt_bind(mx_handle_t handle_value, mx_handle_t port_value, uint64_t key,
+                               uint32_t max_count, mx_time_t max_delay) {
+    LTRACEF("handle %u port %u max_count %u max_delay %" PRIu64 "\n",
+            handle_value, port_value, max_count, max_delay);
+
+    auto up = ProcessDispatcher::GetCurrent();
+    mxtl::RefPtr<InterruptDispatcher> interrupt;
+    mx_status_t status = up->GetDispatcher(handle_value, &interrupt, MX_RIGHT_READ);
+    if (status != NO_ERROR)
+        return status;
+
+    mxtl::RefPtr<IOPortDispatcher> ioport;
+    status = up->GetDispatcher(port_value, &ioport, MX_RIGHT_WRITE);
+    if (status != NO_ERROR)
+        return status;
+
+    return interrupt->BindPort(mxtl::move(ioport), key, max_count, max_delay);
+}
+
 mx_status_t sys_mmap_device_memory(mx_handle_t hrsrc, uintptr_t paddr, uint32_t len,
                                    mx_cache_policy_t cache_policy,
                                    user_ptr<void*> out_vaddr) {
@@ -632,6 +653,27 @@ mx_status_t sys_pci_set_irq_mode(mx_handle_t handle,
     return pci_device->SetIrqMode(mode, requested_irq_count);
 }
 
+/**
+ * Steers one of a PCI device's IRQs to a specific CPU.
+ * @param handle Handle associated with a PCI device
+ * @param which_irq The IRQ to steer.
+ * @param cpu_num The number of the CPU which should handle the IRQ.
+ */
+mx_status_t sys_pci_set_irq_affinity(mx_handle_t handle,
+                                     uint32_t which_irq,
+                                     uint32_t cpu_num) {
+    LTRACEF("handle %u\n", handle);
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    mxtl::RefPtr<PciDeviceDispatcher> pci_device;
+    mx_status_t status = up->GetDispatcher(handle, &pci_device, MX_RIGHT_WRITE);
+    if (status != NO_ERROR)
+        return status;
+
+    return pci_device->SetIrqAffinity(which_irq, cpu_num);
+}
+
 /**
  * Gets info about an I/O mapping object.
  * @param handle Handle associated with an I/O mapping object.
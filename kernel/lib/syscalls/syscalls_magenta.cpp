@@ -18,6 +18,7 @@
 #include <arch/ops.h>
 
 #include <kernel/auto_lock.h>
+#include <kernel/lockstat.h>
 #include <kernel/mp.h>
 #include <kernel/thread.h>
 #include <kernel/vm/vm_object.h>
@@ -34,6 +35,7 @@
 #include <magenta/data_pipe_producer_dispatcher.h>
 #include <magenta/event_dispatcher.h>
 #include <magenta/event_pair_dispatcher.h>
+#include <magenta/interrupt_dispatcher.h>
 #include <magenta/io_port_dispatcher.h>
 #include <magenta/log_dispatcher.h>
 #include <magenta/magenta.h>
@@ -68,6 +70,36 @@ mx_status_t get_process(ProcessDispatcher* up,
     return up->GetDispatcher(proc_handle, proc, MX_RIGHT_WRITE);
 }
 
+void get_cpu_stats(uint cpu, mx_record_cpu_stats_t* info) {
+    info->cpu_number = cpu;
+    if (!mp_is_cpu_active(cpu))
+        return;
+    info->flags = MX_CPU_STATS_FLAG_ONLINE;
+
+#if THREAD_STATS
+    const struct thread_stats* stats = &thread_stats[cpu];
+
+    // include the idle period in progress, as the threadload command does
+    lk_bigtime_t idle_time = stats->idle_time;
+    if (mp_is_cpu_idle(cpu))
+        idle_time += current_time_hires() - stats->last_idle_timestamp;
+
+    info->idle_time = idle_time * 1000;
+    info->irq_time = stats->irq_time * 1000;
+    info->syscall_time = stats->syscall_time * 1000;
+    info->context_switches = stats->context_switches;
+    info->preempts = stats->preempts + stats->irq_preempts;
+    info->yields = stats->yields;
+    info->interrupts = stats->interrupts;
+    info->timer_ints = stats->timer_ints;
+#if WITH_SMP
+    info->reschedule_ipis = stats->reschedule_ipis;
+#endif
+    info->syscalls = stats->syscalls;
+    info->page_faults = stats->page_faults;
+#endif
+}
+
 } // anonymous namespace
 
 void sys_exit(int retcode) {
@@ -208,6 +240,222 @@ mx_ssize_t sys_object_get_info(mx_handle_t handle, uint32_t topic, uint16_t topi
 
             return tocopy;
         }
+        case MX_INFO_INTERRUPT: {
+            mxtl::RefPtr<InterruptDispatcher> interrupt;
+            auto error = up->GetDispatcher<InterruptDispatcher>(handle, &interrupt, MX_RIGHT_READ);
+            if (error < 0)
+                return error;
+
+            // test that they've asking for an appropriate version
+            if (topic_size != 0 && topic_size != sizeof(mx_record_interrupt_t))
+                return ERR_INVALID_ARGS;
+
+            // make sure they passed us a buffer
+            if (!_buffer)
+                return ERR_INVALID_ARGS;
+
+            // test that we have at least enough target buffer to support the header and one record
+            if (buffer_size < sizeof(mx_info_header_t) + topic_size)
+                return ERR_BUFFER_TOO_SMALL;
+
+            mx_info_interrupt_t info = {};
+
+            info.hdr.topic = topic;
+            info.hdr.avail_topic_size = sizeof(info.rec);
+            info.hdr.topic_size = topic_size;
+            info.hdr.avail_count = 1;
+            info.hdr.count = 1;
+
+            mx_size_t tocopy;
+            if (topic_size == 0) {
+                tocopy = sizeof(info.hdr);
+            } else {
+                interrupt->GetInfo(&info.rec);
+                tocopy = sizeof(info);
+            }
+
+            if (copy_to_user(_buffer.reinterpret<uint8_t>(), &info, tocopy) != NO_ERROR)
+                return ERR_INVALID_ARGS;
+
+            return tocopy;
+        }
+        case MX_INFO_THREAD_STATS: {
+            mxtl::RefPtr<ThreadDispatcher> thread;
+            auto error = up->GetDispatcher<ThreadDispatcher>(handle, &thread, MX_RIGHT_READ);
+            if (error < 0)
+                return error;
+
+            // test that they've asking for an appropriate version
+            if (topic_size != 0 && topic_size != sizeof(mx_record_thread_stats_t))
+                return ERR_INVALID_ARGS;
+
+            // make sure they passed us a buffer
+            if (!_buffer)
+                return ERR_INVALID_ARGS;
+
+            // test that we have at least enough target buffer to support the header and one record
+            if (buffer_size < sizeof(mx_info_header_t) + topic_size)
+                return ERR_BUFFER_TOO_SMALL;
+
+            mx_info_thread_stats_t info = {};
+
+            info.hdr.topic = topic;
+            info.hdr.avail_topic_size = sizeof(info.rec);
+            info.hdr.topic_size = topic_size;
+            info.hdr.avail_count = 1;
+            info.hdr.count = 1;
+
+            mx_size_t tocopy;
+            if (topic_size == 0) {
+                tocopy = sizeof(info.hdr);
+            } else {
+                thread->thread()->GetStats(&info.rec);
+                tocopy = sizeof(info);
+            }
+
+            if (copy_to_user(_buffer.reinterpret<uint8_t>(), &info, tocopy) != NO_ERROR)
+                return ERR_INVALID_ARGS;
+
+            return tocopy;
+        }
+        case MX_INFO_PROCESS_STATS: {
+            mxtl::RefPtr<ProcessDispatcher> process;
+            auto error = up->GetDispatcher<ProcessDispatcher>(handle, &process, MX_RIGHT_READ);
+            if (error < 0)
+                return error;
+
+            // test that they've asking for an appropriate version
+            if (topic_size != 0 && topic_size != sizeof(mx_record_process_stats_t))
+                return ERR_INVALID_ARGS;
+
+            // make sure they passed us a buffer
+            if (!_buffer)
+                return ERR_INVALID_ARGS;
+
+            // test that we have at least enough target buffer to support the header and one record
+            if (buffer_size < sizeof(mx_info_header_t) + topic_size)
+                return ERR_BUFFER_TOO_SMALL;
+
+            mx_info_process_stats_t info = {};
+
+            info.hdr.topic = topic;
+            info.hdr.avail_topic_size = sizeof(info.rec);
+            info.hdr.topic_size = topic_size;
+            info.hdr.avail_count = 1;
+            info.hdr.count = 1;
+
+            mx_size_t tocopy;
+            if (topic_size == 0) {
+                tocopy = sizeof(info.hdr);
+            } else {
+                auto err = process->GetStats(&info.rec);
+                if (err != NO_ERROR)
+                    return err;
+
+                tocopy = sizeof(info);
+            }
+
+            if (copy_to_user(_buffer.reinterpret<uint8_t>(), &info, tocopy) != NO_ERROR)
+                return ERR_INVALID_ARGS;
+
+            return tocopy;
+        }
+        case MX_INFO_CPU_STATS: {
+            // system wide, so it takes the root resource
+            auto error = validate_resource_handle(handle);
+            if (error < 0)
+                return error;
+
+            // test that they've asking for an appropriate version
+            if (topic_size != 0 && topic_size != sizeof(mx_record_cpu_stats_t))
+                return ERR_INVALID_ARGS;
+
+            // make sure they passed us a buffer
+            if (!_buffer)
+                return ERR_INVALID_ARGS;
+
+            if (buffer_size < sizeof(mx_info_header_t) + topic_size)
+                return ERR_BUFFER_TOO_SMALL;
+
+            // one record per cpu, as many as fit
+            uint32_t num_cpus = arch_max_num_cpus();
+            uint32_t count = 0;
+            if (topic_size != 0) {
+                count = static_cast<uint32_t>(MIN((buffer_size - sizeof(mx_info_header_t)) /
+                                                  topic_size, num_cpus));
+            }
+
+            mx_info_header_t hdr = {};
+            hdr.topic = topic;
+            hdr.avail_topic_size = sizeof(mx_record_cpu_stats_t);
+            hdr.topic_size = topic_size;
+            hdr.avail_count = num_cpus;
+            hdr.count = count;
+
+            auto dst = _buffer.reinterpret<uint8_t>();
+            if (copy_to_user(dst, &hdr, sizeof(hdr)) != NO_ERROR)
+                return ERR_INVALID_ARGS;
+            dst = dst + sizeof(hdr);
+
+            for (uint32_t i = 0; i < count; i++) {
+                mx_record_cpu_stats_t rec = {};
+                get_cpu_stats(i, &rec);
+                if (copy_to_user(dst, &rec, sizeof(rec)) != NO_ERROR)
+                    return ERR_INVALID_ARGS;
+                dst = dst + sizeof(rec);
+            }
+
+            return sizeof(hdr) + count * sizeof(mx_record_cpu_stats_t);
+        }
+        case MX_INFO_LOCK_STATS: {
+            auto error = validate_resource_handle(handle);
+            if (error < 0)
+                return error;
+
+            // nothing to report unless the kernel was built with ENABLE_LOCK_STATS
+            uint32_t num_classes = lockstat_num_classes();
+            if (num_classes == 0)
+                return ERR_NOT_SUPPORTED;
+
+            if (topic_size != 0 && topic_size != sizeof(mx_record_lock_stats_t))
+                return ERR_INVALID_ARGS;
+
+            if (!_buffer)
+                return ERR_INVALID_ARGS;
+
+            if (buffer_size < sizeof(mx_info_header_t) + topic_size)
+                return ERR_BUFFER_TOO_SMALL;
+
+            // one record per lock class, as many as fit
+            uint32_t count = 0;
+            if (topic_size != 0) {
+                count = static_cast<uint32_t>(MIN((buffer_size - sizeof(mx_info_header_t)) /
+                                                  topic_size, num_classes));
+            }
+
+            mx_info_header_t hdr = {};
+            hdr.topic = topic;
+            hdr.avail_topic_size = sizeof(mx_record_lock_stats_t);
+            hdr.topic_size = topic_size;
+            hdr.avail_count = num_classes;
+            hdr.count = count;
+
+            auto dst = _buffer.reinterpret<uint8_t>();
+            if (copy_to_user(dst, &hdr, sizeof(hdr)) != NO_ERROR)
+                return ERR_INVALID_ARGS;
+            dst = dst + sizeof(hdr);
+
+            for (uint32_t i = 0; i < count; i++) {
+                mx_record_lock_stats_t rec;
+                if (lockstat_get_record(i, &rec) != NO_ERROR)
+                    return ERR_BAD_STATE;
+                if (copy_to_user(dst, &rec, sizeof(rec)) != NO_ERROR)
+                    return ERR_INVALID_ARGS;
+                dst = dst + sizeof(rec);
+            }
+
+            return sizeof(hdr) + count * sizeof(mx_record_lock_stats_t);
+        }
         default:
             return ERR_NOT_FOUND;
     }
@@ -676,10 +924,21 @@ mx_status_t sys_futex_requeue(int* wake_ptr, uint32_t wake_count, int current_va
 }
 
 mx_handle_t sys_vmo_create(uint64_t size) {
-    LTRACEF("size 0x%llx\n", size);
+    return sys_vmo_create_etc(size, 0);
+}
+
+mx_handle_t sys_vmo_create_etc(uint64_t size, uint32_t flags) {
+    LTRACEF("size 0x%llx, flags 0x%x\n", size, flags);
+
+    if (flags & ~MX_VMO_FLAG_MASK)
+        return ERR_INVALID_ARGS;
+
+    uint32_t vmo_flags = 0;
+    if (flags & MX_VMO_FLAG_LARGE_PAGES)
+        vmo_flags |= VmObject::FLAG_LARGE_PAGES;
 
     // create a vm object
-    mxtl::RefPtr<VmObject> vmo = VmObject::Create(0, size);
+    mxtl::RefPtr<VmObject> vmo = VmObject::Create(0, size, vmo_flags);
     if (!vmo)
         return ERR_NO_MEMORY;
 
@@ -890,6 +1149,31 @@ mx_status_t sys_process_protect_vm(mx_handle_t proc_handle, uintptr_t address, m
     return r->Protect(arch_mmu_flags);
 }
 
+mx_status_t sys_process_op_vm(mx_handle_t proc_handle, uint32_t op, uintptr_t address,
+                              mx_size_t len) {
+    LTRACEF("proc handle %d, op %u, address 0x%lx, len 0x%lx\n", proc_handle, op, address, len);
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    mxtl::RefPtr<ProcessDispatcher> process;
+    mx_status_t status = get_process(up, proc_handle, &process);
+    if (status != NO_ERROR)
+        return status;
+
+    mxtl::RefPtr<VmAspace> aspace = process->aspace();
+    if (!aspace)
+        return ERR_INVALID_ARGS;
+
+    switch (op) {
+    case MX_VMO_OP_DECOMMIT:
+        return aspace->DecommitRange(address, len);
+    case MX_VMO_OP_PREFETCH:
+        return aspace->PrefetchRange(address, len);
+    default:
+        return ERR_INVALID_ARGS;
+    }
+}
+
 int sys_log_create(uint32_t flags) {
     LTRACEF("flags 0x%x\n", flags);
 
@@ -1025,11 +1309,11 @@ mx_status_t sys_port_wait(mx_handle_t handle, user_ptr<void> packet, mx_size_t s
     if (status < 0)
         return status;
 
-    if (!iopk->CopyToUser(packet.get(), &size))
-        return ERR_INVALID_ARGS;
-
+    // Always release the packet: an interrupt's goes back to the port,
+    // which re-arms it when this thread next waits.
+    bool copied = iopk->CopyToUser(packet.get(), &size);
     IOP_Packet::Delete(iopk);
-    return NO_ERROR;
+    return copied ? NO_ERROR : ERR_INVALID_ARGS;
 }
 
 mx_status_t sys_port_bind(mx_handle_t handle, uint64_t key, mx_handle_t source, mx_signals_t signals) {
@@ -96,15 +96,6 @@ mx_status_t sys_msgpipe_read(mx_handle_t handle_value,
     if (_handles && !_num_handles)
         return ERR_INVALID_ARGS;
 
-    mxtl::unique_ptr<uint32_t[]> handles;
-
-    AllocChecker ac;
-    if (num_handles) {
-        handles.reset(new (&ac) uint32_t[num_handles]());
-        if (!ac.check())
-            return ERR_NO_MEMORY;
-    }
-
     uint32_t next_message_size = 0u;
     uint32_t next_message_num_handles = 0u;
     status_t result = msg_pipe->BeginRead(&next_message_size, &next_message_num_handles);
@@ -125,6 +116,16 @@ mx_status_t sys_msgpipe_read(mx_handle_t handle_value,
     if (num_bytes < next_message_size || num_handles < next_message_num_handles)
         return ERR_BUFFER_TOO_SMALL;
 
+    // Handle values are gathered here and copied out in one go.
+    mxtl::unique_ptr<mx_handle_t[]> handles;
+
+    AllocChecker ac;
+    if (next_message_num_handles) {
+        handles.reset(new (&ac) mx_handle_t[next_message_num_handles]);
+        if (!ac.check())
+            return ERR_NO_MEMORY;
+    }
+
     // OK, now we can accept the message.
     mxtl::Array<uint8_t> bytes;
     mxtl::Array<Handle*> handle_list;
@@ -140,12 +141,10 @@ mx_status_t sys_msgpipe_read(mx_handle_t handle_value,
     }
 
     if (next_message_num_handles != 0u) {
-        // TODO(vtl): Should probably do one big copy-out, instead of one for each handle.
-        for (size_t ix = 0u; ix < next_message_num_handles; ++ix) {
-            auto hv = up->MapHandleToValue(handle_list[ix]);
-            if (copy_to_user_32_unsafe(&_handles.get()[ix], hv) != NO_ERROR)
-                return ERR_INVALID_ARGS;
-        }
+        for (size_t ix = 0u; ix < next_message_num_handles; ++ix)
+            handles[ix] = up->MapHandleToValue(handle_list[ix]);
+        if (copy_to_user_array(_handles, handles.get(), next_message_num_handles) != NO_ERROR)
+            return ERR_INVALID_ARGS;
     }
 
     for (size_t idx = 0u; idx < next_message_num_handles; ++idx) {
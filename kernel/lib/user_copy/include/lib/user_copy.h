@@ -98,4 +98,24 @@ MAKE_COPY_FROM_USER(copy_from_user_iptr, intptr_t);
 
 #undef MAKE_COPY_FROM_USER
 
+// Copy an array of |count| elements with one call, rather than one per element.
+template <typename T>
+inline status_t copy_to_user_array(user_ptr<T> dst, const T* src, size_t count) {
+  if (count > SIZE_MAX / sizeof(T))
+    return ERR_INVALID_ARGS;
+  return copy_to_user(dst, src, count * sizeof(T));
+}
+template <typename T>
+inline status_t copy_from_user_array(T* dst, const user_ptr<const T> src, size_t count) {
+  if (count > SIZE_MAX / sizeof(T))
+    return ERR_INVALID_ARGS;
+  return copy_from_user(dst, src, count * sizeof(T));
+}
+template <typename T>
+inline status_t copy_from_user_array(T* dst, const user_ptr<T> src, size_t count) {
+  if (count > SIZE_MAX / sizeof(T))
+    return ERR_INVALID_ARGS;
+  return copy_from_user(dst, src, count * sizeof(T));
+}
+
 #endif  // __cplusplus
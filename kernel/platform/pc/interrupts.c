@@ -12,10 +12,12 @@
 #include <reg.h>
 #include <assert.h>
 #include <kernel/thread.h>
+#include <kernel/mp.h>
 #include <dev/interrupt.h>
 #include <arch/x86.h>
 #include <arch/x86/interrupts.h>
 #include <arch/x86/apic.h>
+#include <arch/x86/mp.h>
 #include <lk/init.h>
 #include <kernel/spinlock.h>
 #include "platform_p.h"
@@ -340,4 +342,24 @@ void x86_register_msi_handler(const pcie_msi_block_t* block,
     int_handler_table[x86_vector].arg     = handler ? ctx : NULL;
     spin_unlock(&int_handler_table[x86_vector].lock);
 }
+
+status_t x86_get_msi_target(const pcie_msi_block_t* block,
+                            uint                    cpu_num,
+                            uint64_t*               out_tgt_addr) {
+    DEBUG_ASSERT(block && block->allocated);
+    DEBUG_ASSERT(out_tgt_addr);
+
+    // The vector in the target data selects the same handler on every CPU, so
+    // only the Dest ID field of the address needs to change.  Physical
+    // destination mode can only name the first 256 APIC IDs.
+    if ((cpu_num >= SMP_MAX_CPUS) || !mp_is_cpu_online(cpu_num))
+        return ERR_INVALID_ARGS;
+
+    uint32_t apic_id = x86_cpu_num_to_apic_id(cpu_num);
+    if ((apic_id == INVALID_APIC_ID) || (apic_id > 0xFF))
+        return ERR_INVALID_ARGS;
+
+    *out_tgt_addr = (block->tgt_addr & ~(uint64_t)0x000FF000) | ((uint64_t)apic_id << 12);
+    return NO_ERROR;
+}
 #endif  // WITH_DEV_PCIE
@@ -42,6 +42,9 @@ extern void x86_register_msi_handler(const pcie_msi_block_t* block,
                                      uint                    msi_id,
                                      int_handler             handler,
                                      void*                   ctx);
+extern status_t x86_get_msi_target(const pcie_msi_block_t* block,
+                                   uint                    cpu_num,
+                                   uint64_t*               out_tgt_addr);
 
 #if WITH_KERNEL_VM
 struct mmu_initial_mapping mmu_initial_mappings[] = {
@@ -345,6 +348,7 @@ void platform_pcie_init_info(pcie_init_info_t *out)
         .free_msi_block       = x86_free_msi_block,
         .register_msi_handler = x86_register_msi_handler,
         .mask_unmask_msi      = NULL,
+        .get_msi_target       = x86_get_msi_target,
     };
 }
 
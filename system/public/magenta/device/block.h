@@ -4,7 +4,9 @@
 
 #pragma once
 
+#include <stdint.h>
 #include <magenta/device/ioctl.h>
+#include <magenta/types.h>
 
 #define IOCTL_BLOCK_GET_SIZE \
     IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_BLOCK, 1)
@@ -17,4 +19,79 @@
 #define IOCTL_BLOCK_RR_PART \
     IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_BLOCK, 5)
 
+// Returns a message pipe over which batches of block_fifo_request_t
+// are submitted and block_fifo_response_t are received
+//   in: none
+//   out: mx_handle_t
+#define IOCTL_BLOCK_GET_FIFO \
+    IOCTL(IOCTL_KIND_GET_HANDLE, IOCTL_FAMILY_BLOCK, 6)
 
+// Returns queueing statistics for the device
+//   in: none
+//   out: block_stats_t
+#define IOCTL_BLOCK_GET_STATS \
+    IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_BLOCK, 7)
+
+// Selects how the device orders queued requests
+//   in: uint32_t (BLOCK_SCHED_*)
+//   out: none
+#define IOCTL_BLOCK_SET_SCHED \
+    IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_BLOCK, 8)
+
+// Requests are issued in the order they were queued
+#define BLOCK_SCHED_FIFO     0
+// Requests are issued in ascending block order, unless the oldest
+// one has waited past its deadline
+#define BLOCK_SCHED_DEADLINE 1
+
+// Times are in nanoseconds, counted from when the device was bound.
+// Average queue depth is depth_time / busy_time, and IOPS is
+// ops / elapsed.
+typedef struct block_stats {
+    uint64_t elapsed;     // time the counters cover
+    uint64_t ops;         // requests completed
+    uint64_t commands;    // device commands issued
+    uint64_t merged;      // requests folded into another request's command
+    uint64_t busy_time;   // time with at least one command outstanding
+    uint64_t depth_time;  // sum over time of commands outstanding
+    uint32_t depth;       // commands outstanding now
+    uint32_t max_depth;   // most commands ever outstanding at once
+} block_stats_t;
+
+// Block FIFO protocol
+//
+// Before any io is submitted, the client attaches a vmo by writing a
+// message containing a single BLOCK_FIFO_OP_ATTACH_VMO request and the
+// vmo handle.  Data for every subsequent request moves directly between
+// that vmo and the device.
+//
+// Each message written to the pipe carries 1..BLOCK_FIFO_MAX_BATCH
+// requests.  Requests in a batch are issued concurrently and may
+// complete in any order.  Each completes with one response, and
+// responses are delivered in messages of 1..BLOCK_FIFO_MAX_BATCH.
+// The txnid is opaque to the device and is echoed in the response.
+//
+// The length, vmo_offset and dev_offset of a read or write must be
+// multiples of the device's block size (IOCTL_BLOCK_GET_BLOCKSIZE),
+// or the request fails with ERR_INVALID_ARGS.
+
+#define BLOCK_FIFO_OP_ATTACH_VMO 1
+#define BLOCK_FIFO_OP_READ       2
+#define BLOCK_FIFO_OP_WRITE      3
+
+#define BLOCK_FIFO_MAX_BATCH     64
+#define BLOCK_FIFO_MAX_XFER      (64 * 1024)
+
+typedef struct block_fifo_request {
+    uint32_t opcode;
+    uint32_t txnid;
+    uint64_t length;
+    uint64_t vmo_offset;
+    uint64_t dev_offset;
+} block_fifo_request_t;
+
+typedef struct block_fifo_response {
+    mx_status_t status;
+    uint32_t txnid;
+    uint64_t actual;
+} block_fifo_response_t;
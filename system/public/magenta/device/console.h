@@ -15,3 +15,21 @@ typedef struct {
     uint32_t height;
 } ioctl_console_dimensions_t;
 
+
+// returns ioctl_console_stats_t
+#define IOCTL_CONSOLE_GET_STATS \
+    IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_CONSOLE, 2)
+
+typedef struct {
+    // redrawing text into the console's surface
+    uint64_t chars_drawn;
+    uint64_t glyph_cache_misses;
+    uint64_t draw_time;
+
+    // copying damage to the framebuffer, shared by all consoles
+    uint64_t invalidations;
+    uint64_t flushes;
+    uint64_t flush_rows;
+    uint64_t flush_time;
+    uint64_t flush_time_max;
+} ioctl_console_stats_t;
@@ -0,0 +1,76 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stdint.h>
+#include <magenta/compiler.h>
+#include <magenta/device/ioctl.h>
+#include <magenta/types.h>
+
+__BEGIN_CDECLS
+
+// Returns a message pipe used to attach shared tx/rx rings
+//   in: none
+//   out: mx_handle_t
+#define IOCTL_ETHERNET_GET_FIFO \
+    IOCTL(IOCTL_KIND_GET_HANDLE, IOCTL_FAMILY_ETH, 1)
+
+// Ethernet FIFO protocol
+//
+// The client creates a vmo which begins with an eth_fifo_rings_t and
+// holds its packet buffers after that, and an event.  It attaches both
+// by writing a single eth_fifo_attach_t message carrying the vmo and
+// event handles (in that order) to the pipe.  The device replies with
+// one eth_fifo_attach_t whose status field reports the result.
+//
+// Each ring is a single-producer, single-consumer queue of entries.
+// Indices are free running and taken modulo ETH_FIFO_RING_SIZE.  The
+// client owns the entries in [used, avail + ETH_FIFO_RING_SIZE) and
+// the device owns those in [used, avail):
+//   rx: the client fills in offset and length (the buffer size) and
+//       advances avail.  The device writes the frame into the buffer,
+//       sets length to its size, and advances used.
+//   tx: the client fills in offset and length (the frame size) and
+//       advances avail.  The device advances used once the frame has
+//       been sent, and is then done with the buffer.
+//
+// Rather than one syscall per frame, each side signals the event once
+// per batch: the client sets ETH_FIFO_SIGNAL_KICK after advancing avail
+// on either ring, the device sets ETH_FIFO_SIGNAL_DONE after advancing
+// used on either ring.  Each side clears its own signal before looking
+// at the rings.  Closing the pipe detaches the rings.
+
+#define ETH_FIFO_RING_SIZE 64
+
+#define ETH_FIFO_SIGNAL_KICK MX_SIGNAL_SIGNAL0
+#define ETH_FIFO_SIGNAL_DONE MX_SIGNAL_SIGNAL1
+
+// entry flags set by the device
+#define ETH_FIFO_FLAG_ERROR  1 // the frame was dropped
+
+typedef struct eth_fifo_entry {
+    uint32_t offset; // of the buffer in the vmo
+    uint16_t length;
+    uint16_t flags;
+    uint64_t cookie; // not touched by the device
+} eth_fifo_entry_t;
+
+typedef struct eth_fifo_ring {
+    uint32_t avail; // written by the client
+    uint32_t used;  // written by the device
+    eth_fifo_entry_t entries[ETH_FIFO_RING_SIZE];
+} eth_fifo_ring_t;
+
+typedef struct eth_fifo_rings {
+    eth_fifo_ring_t rx;
+    eth_fifo_ring_t tx;
+} eth_fifo_rings_t;
+
+typedef struct eth_fifo_attach {
+    mx_status_t status;
+    uint32_t reserved;
+} eth_fifo_attach_t;
+
+__END_CDECLS
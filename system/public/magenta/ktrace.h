@@ -22,7 +22,10 @@ __BEGIN_CDECLS
 #define KTRACE_NAMESIZE   (24)
 #define KTRACE_NAMEOFF    (8)
 
-#define KTRACE_VERSION    (0x00010000)
+// Version 2 records carry the cpu they were written on in the
+// low bits of the tag (see KTRACE_CPUID), and reads of the per-cpu
+// ring modes return TAG_CPU_CHUNK records ahead of each cpu's data.
+#define KTRACE_VERSION    (0x00020000)
 
 typedef struct ktrace_record {
     uint32_t tag;
@@ -45,6 +48,12 @@ static_assert(sizeof(ktrace_record_t) == KTRACE_RECSIZE,
 #define GRP_SCHEDULER         0x004
 #define GRP_TASKS             0x008
 #define GRP_IPC               0x010
+#define GRP_SYSCALL           0x020
+#define GRP_FAULT             0x040
+#define GRP_IRQ               0x080
+#define GRP_TIMER             0x100
+#define GRP_LOCK              0x200
+#define GRP_PROFILE           0x400
 
 #define GRP_MASK(grp)         ((grp) << 20)
 
@@ -52,6 +61,7 @@ static_assert(sizeof(ktrace_record_t) == KTRACE_RECSIZE,
 
 #define TAG_VERSION           KTRACE_TAG(0x000, GRP_META) // version
 #define TAG_TICKS_PER_MS      KTRACE_TAG(0x001, GRP_META) // lo32 hi32
+#define TAG_CPU_CHUNK         KTRACE_TAG(0x002, GRP_META) // bytes lostlo32 losthi32
 
 #define TAG_CONTEXT_SWITCH    KTRACE_TAG(0x010, GRP_SCHEDULER) // to-tid (tstate<<16)|cpuid from-kt to-kt
 
@@ -79,10 +89,55 @@ static_assert(sizeof(ktrace_record_t) == KTRACE_RECSIZE,
 #define TAG_WAIT_ONE          KTRACE_TAG(0x070, GRP_IPC) // id signals timeoutlo timeouthi
 #define TAG_WAIT_ONE_DONE     KTRACE_TAG(0x071, GRP_IPC) // id status pending
 
+#define TAG_SYSCALL_ENTER     KTRACE_TAG(0x080, GRP_SYSCALL) // num
+#define TAG_SYSCALL_EXIT      KTRACE_TAG(0x081, GRP_SYSCALL) // num retlo32 rethi32
+
+#define TAG_PAGE_FAULT        KTRACE_TAG(0x090, GRP_FAULT) // addrlo32 addrhi32 flags
+#define TAG_PAGE_FAULT_EXIT   KTRACE_TAG(0x091, GRP_FAULT) // addrlo32 addrhi32 flags status
+
+#define TAG_IRQ_ENTER         KTRACE_TAG(0x0A0, GRP_IRQ) // vector
+#define TAG_IRQ_EXIT          KTRACE_TAG(0x0A1, GRP_IRQ) // vector
+
+#define TAG_TIMER_CALL        KTRACE_TAG(0x0B0, GRP_TIMER) // funclo32 funchi32
+#define TAG_TIMER_EXIT        KTRACE_TAG(0x0B1, GRP_TIMER) // funclo32 funchi32
+
+// lock waits are recorded when the wait ends, with its length in ticks
+#define TAG_MUTEX_WAIT        KTRACE_TAG(0x0C0, GRP_LOCK) // locklo32 lockhi32 ticklo32 tickhi32
+#define TAG_SPINLOCK_WAIT     KTRACE_TAG(0x0C1, GRP_LOCK) // locklo32 lockhi32 ticklo32 tickhi32
+
+// a sample is followed on the same cpu by (frames + 1) / 2 FRAMES records,
+// holding the return addresses found walking the stack, innermost first
+#define TAG_PROFILE_SAMPLE    KTRACE_TAG(0x0D0, GRP_PROFILE) // pclo32 pchi32 flags frames
+#define TAG_PROFILE_FRAMES    KTRACE_TAG(0x0D1, GRP_PROFILE) // retlo32 rethi32 retlo32 rethi32
+
+#define KTRACE_PROFILE_USER   1 // sample flags: interrupted in user mode
+
 // Actions for ktrace control
 
 #define KTRACE_ACTION_START    1 // options = grpmask, 0 = all
 #define KTRACE_ACTION_STOP     2 // options ignored
 #define KTRACE_ACTION_REWIND   3 // options ignored
+#define KTRACE_ACTION_MODE     4 // options = KTRACE_MODE_*, only while stopped
+#define KTRACE_ACTION_PROFILE  5 // options = samples per second per cpu, 0 = off
+
+// Buffer modes
+//
+// In LINEAR mode all cpus append to one buffer and tracing stops when
+// it fills.  mx_ktrace_read() returns the bytes at the requested offset.
+//
+// FLIGHT and STREAM split the buffer into one ring per cpu.  A FLIGHT
+// ring overwrites its oldest records, so it always holds the most
+// recent history; read it after stopping.  A STREAM ring drops new
+// records when full and counts them as lost; it may be read while
+// tracing continues.  In both, mx_ktrace_read() ignores the offset and
+// consumes what it returns: each cpu's records are preceded by a
+// TAG_CPU_CHUNK record (cpu in KTRACE_CPUID, byte count in a, records
+// lost since the previous chunk in b and c), and the version and
+// ticks-per-ms records are repeated at the start of the first read
+// after tracing starts.  A chunk may contain zero-tag records where
+// data was overwritten while being copied out; skip them.
+#define KTRACE_MODE_LINEAR     0
+#define KTRACE_MODE_FLIGHT     1
+#define KTRACE_MODE_STREAM     2
 
 __END_CDECLS
\ No newline at end of file
@@ -42,6 +42,44 @@ typedef struct nbmsg_t {
     uint8_t  data[0];
 } nbmsg;
 
+// Sliding window transfers
+//
+// NB_OPEN and NB_SEND_FILE may carry an nbwindow trailer after the
+// filename's NUL terminator.  A peer that supports windowed transfers
+// echoes the trailer in its NB_ACK with the window it is willing to
+// use (never larger than requested).  Older peers ignore the trailer
+// and send a bare NB_ACK, in which case the transfer stays stop-and-wait.
+//
+// Once a window is agreed, NB_DATA, NB_READ and NB_WRITE use arg as a
+// block index (blocks are NB_WINDOW_BLOCKSIZE bytes, the last may be
+// short) rather than a byte offset, and every packet of the transfer
+// carries the same cookie.  Up to window blocks may be outstanding.
+// The receiver acknowledges with arg = the next block it needs and an
+// nbsack payload whose bitmap names the blocks beyond it that it
+// already holds, so the sender only retransmits the holes.
+//
+// For NB_WRITE and NB_DATA the receiver's NB_ACKs are the
+// acknowledgements.  For NB_READ the roles are reversed: the client's
+// NB_READ packets (arg and nbsack as above) are the acknowledgements,
+// and the server replies with NB_ACK packets whose arg is the index of
+// the block they carry.  A zero length block marks end of file.
+
+#define NB_WINDOW_MAGIC       0x4e425749 // "IWBN"
+#define NB_WINDOW_MAX         32 // limited by the nbsack bitmap
+#define NB_WINDOW_BLOCKSIZE   1024
+
+#define NB_SACK_RETRY         1 // receiver timed out, resend all holes
+
+typedef struct nbwindow_t {
+    uint32_t magic;
+    uint32_t window;
+} nbwindow;
+
+typedef struct nbsack_t {
+    uint32_t sack;  // bit n set: block arg + 1 + n has been received
+    uint32_t flags;
+} nbsack;
+
 int netboot_init(void *buf, size_t len);
 int netboot_poll(void);
 
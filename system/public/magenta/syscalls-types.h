@@ -134,6 +134,11 @@ typedef enum {
     MX_INFO_HANDLE_VALID = 1,
     MX_INFO_HANDLE_BASIC,
     MX_INFO_PROCESS,
+    MX_INFO_INTERRUPT,
+    MX_INFO_THREAD_STATS,
+    MX_INFO_PROCESS_STATS,
+    MX_INFO_CPU_STATS,
+    MX_INFO_LOCK_STATS,
 } mx_object_info_topic_t;
 
 typedef enum {
@@ -196,6 +201,109 @@ typedef struct mx_info_process {
     mx_record_process_t rec;
 } mx_info_process_t;
 
+typedef struct mx_record_interrupt {
+    uint64_t interrupts;         // times the interrupt has fired
+    uint64_t packets;            // port packets delivered for it
+    mx_time_t first_time;        // when it first fired (0 if never)
+    mx_time_t last_time;         // when it last fired
+    uint32_t max_batch;          // most interrupts coalesced into one packet
+    uint32_t reserved;
+} mx_record_interrupt_t;
+
+// Returned for topic MX_INFO_INTERRUPT
+typedef struct mx_info_interrupt {
+    mx_info_header_t hdr;
+    mx_record_interrupt_t rec;
+} mx_info_interrupt_t;
+
+typedef struct mx_record_thread_stats {
+    mx_time_t runtime;           // time spent running
+    mx_time_t wait_time;         // time spent blocked or sleeping
+    uint64_t context_switches;   // times switched out
+    uint64_t preemptions;        // of those, times switched out while still runnable
+    uint64_t page_faults;
+} mx_record_thread_stats_t;
+
+// Returned for topic MX_INFO_THREAD_STATS
+typedef struct mx_info_thread_stats {
+    mx_info_header_t hdr;
+    mx_record_thread_stats_t rec;
+} mx_info_thread_stats_t;
+
+typedef struct mx_record_process_stats {
+    uint64_t mapped_bytes;       // address space covered by mappings
+    uint64_t committed_bytes;    // pages committed behind those mappings, shared
+                                 // objects counted once per mapping
+    uint32_t regions;            // number of mappings
+    uint32_t threads;            // number of live threads
+    mx_time_t runtime;           // time spent running by the live threads
+    uint64_t large_page_bytes;   // of committed_bytes, those in large pages
+} mx_record_process_stats_t;
+
+// Returned for topic MX_INFO_PROCESS_STATS
+typedef struct mx_info_process_stats {
+    mx_info_header_t hdr;
+    mx_record_process_stats_t rec;
+} mx_info_process_stats_t;
+
+typedef struct mx_record_cpu_stats {
+    uint32_t cpu_number;
+    uint32_t flags;              // MX_CPU_STATS_FLAG_*
+    mx_time_t idle_time;
+    mx_time_t irq_time;          // time in device and timer interrupt handlers
+    mx_time_t syscall_time;      // time running syscalls
+    uint64_t context_switches;
+    uint64_t preempts;
+    uint64_t yields;
+    uint64_t interrupts;
+    uint64_t timer_ints;
+    uint64_t reschedule_ipis;
+    uint64_t syscalls;
+    uint64_t page_faults;
+} mx_record_cpu_stats_t;
+
+#define MX_CPU_STATS_FLAG_ONLINE (1u << 0)
+
+// Returned for topic MX_INFO_CPU_STATS, one record per cpu, on the
+// root resource
+typedef struct mx_info_cpu_stats {
+    mx_info_header_t hdr;
+    mx_record_cpu_stats_t rec[1];
+} mx_info_cpu_stats_t;
+
+#define MX_LOCK_STATS_BUCKETS 16
+#define MX_LOCK_STATS_CALLERS 8
+
+// One lock class: the locks initialized at one place in the kernel.
+// Times are in nanoseconds.  Histogram bucket n counts times from 4^n
+// to 4^(n+1) ns, bucket 0 everything under 4ns and the last everything
+// longer.  callers are kernel pcs that had to wait for the lock.
+typedef struct mx_record_lock_stats {
+    char name[64];               // "file:line" or "@address"
+    uint32_t type;               // MX_LOCK_STATS_TYPE_*
+    uint32_t reserved;
+    uint64_t acquisitions;
+    uint64_t contended;
+    uint64_t wait_time;          // total over contended acquisitions
+    uint64_t max_wait;
+    uint64_t hold_time;
+    uint64_t max_hold;
+    uint64_t wait_histogram[MX_LOCK_STATS_BUCKETS];
+    uint64_t hold_histogram[MX_LOCK_STATS_BUCKETS];
+    uint64_t callers[MX_LOCK_STATS_CALLERS];
+    uint64_t caller_counts[MX_LOCK_STATS_CALLERS];
+} mx_record_lock_stats_t;
+
+#define MX_LOCK_STATS_TYPE_SPIN  1
+#define MX_LOCK_STATS_TYPE_MUTEX 2
+
+// Returned for topic MX_INFO_LOCK_STATS, one record per lock class, on
+// the root resource of kernels built with the lock profiler
+typedef struct mx_info_lock_stats {
+    mx_info_header_t hdr;
+    mx_record_lock_stats_t rec[1];
+} mx_info_lock_stats_t;
+
 // Defines and structures related to mx_pci_*()
 // Info returned to dev manager for PCIe devices when probing.
 typedef struct mx_pcie_get_nth_info {
@@ -285,6 +393,7 @@ typedef struct mx_log_record {
 #define MX_PORT_PKT_TYPE_IOSN      1u
 #define MX_PORT_PKT_TYPE_USER      2u
 #define MX_PORT_PKT_TYPE_EXCEPTION 3u
+#define MX_PORT_PKT_TYPE_IRQ       4u
 
 typedef struct mx_packet_header {
     uint64_t key;
@@ -300,6 +409,13 @@ typedef struct mx_io_packet {
     uint32_t reserved;
 } mx_io_packet_t;
 
+typedef struct mx_irq_packet {
+    mx_packet_header_t hdr;
+    mx_time_t timestamp;         // when the first interrupt in the batch fired
+    uint32_t count;              // interrupts since the last packet
+    uint32_t reserved;
+} mx_irq_packet_t;
+
 typedef struct mx_exception_packet {
     mx_packet_header_t hdr;
     mx_exception_report_t report;
@@ -387,6 +503,12 @@ typedef struct mx_waitset_result mx_wait_set_result_t;
 #define MX_VMO_OP_UNLOCK                4u
 #define MX_VMO_OP_LOOKUP                5u
 #define MX_VMO_OP_CACHE_SYNC            6u
+#define MX_VMO_OP_RESIDENCY             7u  // bitmap of committed pages, one bit per page
+#define MX_VMO_OP_PREFETCH              8u  // commit in the background
+
+// Flags for mx_vmo_create_etc()
+#define MX_VMO_FLAG_LARGE_PAGES         (1u << 0)  // back 2MB chunks with large pages
+#define MX_VMO_FLAG_MASK                MX_VMO_FLAG_LARGE_PAGES
 
 #ifdef __cplusplus
 }
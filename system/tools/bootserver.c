@@ -21,8 +21,11 @@
 
 #include <magenta/netboot.h>
 
+#include "netprotocol.h"
+
 static uint32_t cookie = 1;
 static char* appname;
+static uint32_t window = 16;
 
 static int io(int s, nbmsg* msg, size_t len, nbmsg* ack) {
     int retries = 5;
@@ -72,7 +75,7 @@ static int io(int s, nbmsg* msg, size_t len, nbmsg* ack) {
             goto again;
         }
         if (ack->cmd == NB_ACK)
-            return 0;
+            return r;
         fprintf(stderr, "?");
         goto again;
     }
@@ -84,7 +87,8 @@ typedef struct {
     size_t datalen;
 } xferdata;
 
-static ssize_t xread(xferdata *xd, void* data, size_t len) {
+static ssize_t xread(void* ctx, void* data, size_t len) {
+    xferdata* xd = ctx;
     if (xd->fp == NULL) {
         if (len > xd->datalen) {
             len = xd->datalen;
@@ -141,11 +145,21 @@ static int xfer(struct sockaddr_in6* addr, const char* fn, const char* name, boo
     msg->cmd = NB_SEND_FILE;
     msg->arg = 0;
     strcpy((void*)msg->data, name);
-    if (io(s, msg, sizeof(nbmsg) + strlen(name) + 1, ack)) {
+    size_t len = netboot_window_offer(msg->data, strlen(name) + 1, window);
+    if ((r = io(s, msg, sizeof(nbmsg) + len, ack)) < 0) {
         fprintf(stderr, "%s: failed to start transfer\n", appname);
         goto done;
     }
 
+    uint32_t granted = netboot_window_granted((void*)ack, r);
+    if (granted) {
+        if (netboot_send_window(s, NB_DATA, granted, xread, &xd) < 0) {
+            fprintf(stderr, "\n%s: error: sending '%s' (%d)\n", appname, fn, errno);
+            goto done;
+        }
+        goto sent;
+    }
+
     msg->cmd = NB_DATA;
     msg->arg = 0;
     do {
@@ -162,19 +176,20 @@ static int xfer(struct sockaddr_in6* addr, const char* fn, const char* name, boo
             count = 0;
             fprintf(stderr, "#");
         }
-        if (io(s, msg, sizeof(nbmsg) + r, ack)) {
+        if (io(s, msg, sizeof(nbmsg) + r, ack) < 0) {
             fprintf(stderr, "\n%s: error: sending '%s'\n", appname, fn);
             goto done;
         }
         msg->arg += r;
     } while (r != 0);
 
+sent:
     status = 0;
 
     if (boot) {
         msg->cmd = NB_BOOT;
         msg->arg = 0;
-        if (io(s, msg, sizeof(nbmsg), ack)) {
+        if (io(s, msg, sizeof(nbmsg), ack) < 0) {
             fprintf(stderr, "\n%s: failed to send boot command\n", appname);
         } else {
             fprintf(stderr, "\n%s: sent boot command\n", appname);
@@ -196,8 +211,9 @@ void usage(void) {
     fprintf(stderr,
             "usage:   %s [ <option> ]* <kernel> [ <ramdisk> ] [ -- [ <kerneloption> ]* ]\n"
             "\n"
-            "options: -1  only boot once, then exit\n",
-            appname);
+            "options: -1  only boot once, then exit\n"
+            "         -w  <n> blocks in flight, 0 for stop-and-wait (default 16, max %d)\n",
+            appname, NB_WINDOW_MAX);
     exit(1);
 }
 
@@ -239,6 +255,13 @@ int main(int argc, char** argv) {
             }
         } else if (!strcmp(argv[1], "-1")) {
             once = 1;
+        } else if (!strcmp(argv[1], "-w")) {
+            if (argc < 3) {
+                usage();
+            }
+            window = strtoul(argv[2], NULL, 0);
+            argc--;
+            argv++;
         } else if (!strcmp(argv[1], "--")) {
             while (argc > 2) {
                 size_t len = strlen(argv[2]);
@@ -10,10 +10,11 @@ LOGLISTENER := $(BUILDDIR)/tools/loglistener
 NETRUNCMD := $(BUILDDIR)/tools/netruncmd
 NETCP:= $(BUILDDIR)/tools/netcp
 KTRACEDUMP:= $(BUILDDIR)/tools/ktracedump
+NETLOOPBACK:= $(BUILDDIR)/tools/netloopback
 
 TOOLS_CFLAGS := -std=c11 -Wall -Isystem/public -Isystem/private
 
-ALL_TOOLS := $(MKBOOTFS) $(BOOTSERVER) $(LOGLISTENER) $(NETRUNCMD) $(NETCP) $(KTRACEDUMP)
+ALL_TOOLS := $(MKBOOTFS) $(BOOTSERVER) $(LOGLISTENER) $(NETRUNCMD) $(NETCP) $(KTRACEDUMP) $(NETLOOPBACK)
 
 $(BUILDDIR)/tools/%: system/tools/%.c
 	@echo compiling $@
@@ -30,5 +31,18 @@ $(BUILDDIR)/tools/netcp: system/tools/netcp.c system/tools/netprotocol.c
 	@$(MKDIR)
 	$(NOECHO)cc $(TOOLS_CFLAGS) -o $@ $^
 
+$(BUILDDIR)/tools/bootserver: system/tools/bootserver.c system/tools/netprotocol.c
+	@echo compiling $@
+	@$(MKDIR)
+	$(NOECHO)cc $(TOOLS_CFLAGS) -o $@ $^
+
+# runs netsvc's file transfer code on the host
+$(BUILDDIR)/tools/netloopback: system/tools/netloopback.c system/tools/netprotocol.c \
+                               system/uapp/netsvc/netfile.c
+	@echo compiling $@
+	@$(MKDIR)
+	$(NOECHO)cc $(TOOLS_CFLAGS) -D_POSIX_C_SOURCE=200809L -Isystem/uapp/netsvc \
+	    -Isystem/ulib/inet6/include -o $@ $^
+
 GENERATED += $(ALL_TOOLS)
 EXTRA_BUILDDEPS += $(ALL_TOOLS)
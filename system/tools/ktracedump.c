@@ -39,6 +39,12 @@ static inline uint32_t fnv1a_tiny(uint32_t n, uint32_t bits) {
     return ((hash >> bits) ^ hash) & ((1 << bits) - 1);
 }
 
+// an operation seen to start but not yet to end
+typedef struct {
+    uint64_t ts;
+    uint32_t what;
+} span_t;
+
 typedef struct objinfo objinfo_t;
 struct objinfo {
     objinfo_t* next;
@@ -51,6 +57,8 @@ struct objinfo {
     uint32_t seq_dst;
     uint32_t last_state;
     uint64_t last_ts;
+    span_t syscall;
+    span_t fault;
 };
 
 #define F_DEAD 1
@@ -200,11 +208,15 @@ int with_kthreads = 0;
 int with_msgpipe_io = 0;
 int with_waiting = 0;
 int with_syscalls = 0;
+int with_faults = 0;
+int with_irqs = 0;
+int with_locks = 0;
 
 typedef struct evtinfo {
     uint64_t ts;
     uint32_t pid;
     uint32_t tid;
+    uint32_t cpu;
 } evt_info_t;
 
 #define trace(fmt...) do { if(!json) printf(fmt); } while (0)
@@ -528,6 +540,19 @@ void evt_thread_name(uint32_t pid, uint32_t tid, const char* name) {
     if (pid == 0) {
         return;
     }
+    if (with_syscalls || with_faults || with_locks) {
+        // and one for the time it spends in the kernel
+        sprintf(tmp, "%s-sys (%u)", name, tid);
+        char tmp2[64];
+        sprintf(tmp2, "sys:%u", tid);
+        json_obj("ph", "M",
+                 "name", "thread_name",
+                 "#pid", pid,
+                 "tid", tmp2,
+                 "{args",
+                 "name", tmp,
+                 "}", NULL);
+    }
     if (!with_msgpipe_io) {
         return;
     }
@@ -698,6 +723,147 @@ void evt_wait_one_done(evt_info_t* ei, uint32_t id, uint32_t pending, uint32_t s
     SYSCALL("op", "wait_one() done", "#oid", id, "#pending", pending, "#status", status);
 }
 
+// syscall names, from the table the kernel dispatches with
+typedef struct {
+    uint32_t num;
+    const char* name;
+} syscall_name_t;
+
+const syscall_name_t syscall_names[] = {
+#define MAGENTA_SYSCALL_DEF(nargs64, nargs32, n, ret, name, args...) { n, #name "()" },
+#include <magenta/syscalls.inc>
+};
+
+const char* syscall_name(uint32_t num) {
+    for (unsigned n = 0; n < sizeof(syscall_names) / sizeof(syscall_names[0]); n++) {
+        if (syscall_names[n].num == num) {
+            return syscall_names[n].name;
+        }
+    }
+    return "unknown()";
+}
+
+// Syscalls and faults are timed per thread, on a track beside the
+// thread's own.  Anything that happens with no user thread to charge
+// it to, and all interrupts and timers, go on per-cpu tracks in the
+// kernel process.
+#define MAX_CPUS (KTRACE_CPUID(0xFFFFFFFF) + 1)
+
+typedef struct {
+    span_t syscall;
+    span_t fault;
+    span_t irq;
+    span_t timer;
+    uint32_t named;
+} cpuinfo_t;
+
+cpuinfo_t cpus[MAX_CPUS];
+
+#define TRACK_KERNEL 1
+#define TRACK_IRQ 2
+
+span_t* thread_span(evt_info_t* ei, int fault) {
+    objinfo_t* oi = ei->tid ? find_object(ei->tid, KTHREAD) : NULL;
+    if (oi) {
+        return fault ? &oi->fault : &oi->syscall;
+    }
+    return fault ? &cpus[ei->cpu].fault : &cpus[ei->cpu].syscall;
+}
+
+void evt_span(evt_info_t* ei, uint32_t track, uint64_t start,
+              const char* name, const char* cat, const char* cname) {
+    char tidstr[64];
+    uint32_t pid = 0;
+    if ((track == TRACK_KERNEL) && ei->pid && ei->tid) {
+        if (is_object(ei->pid, F_INVISIBLE)) {
+            return;
+        }
+        pid = ei->pid;
+        sprintf(tidstr, "sys:%u", ei->tid);
+    } else {
+        const char* kind = (track == TRACK_IRQ) ? "irq" : "kernel";
+        sprintf(tidstr, "%s:cpu%u", kind, ei->cpu);
+        if (!(cpus[ei->cpu].named & track)) {
+            cpus[ei->cpu].named |= track;
+            char tmp[64];
+            sprintf(tmp, "%s (cpu%u)", kind, ei->cpu);
+            json_obj("ph", "M",
+                     "name", "thread_name",
+                     "#pid", 0,
+                     "tid", tidstr,
+                     "{args",
+                     "name", tmp,
+                     "}", NULL);
+        }
+    }
+    // events this short come out as zero after rounding
+    uint64_t dur = (ei->ts > start) ? (ei->ts - start) : 1;
+    json_rec(start, "X", name, cat,
+             "@dur", dur,
+             "cname", cname,
+             "#pid", pid,
+             "tid", tidstr,
+             NULL);
+}
+
+void evt_syscall_enter(evt_info_t* ei, uint32_t num) {
+    span_t* sp = thread_span(ei, 0);
+    sp->ts = ei->ts;
+    sp->what = num;
+}
+void evt_syscall_exit(evt_info_t* ei, uint32_t num) {
+    span_t* sp = thread_span(ei, 0);
+    if (with_syscalls && sp->ts && (sp->what == num)) {
+        evt_span(ei, TRACK_KERNEL, sp->ts, syscall_name(num), "syscall", "thread_state_running");
+    }
+    sp->ts = 0;
+}
+
+void evt_page_fault(evt_info_t* ei) {
+    thread_span(ei, 1)->ts = ei->ts;
+}
+void evt_page_fault_exit(evt_info_t* ei) {
+    span_t* sp = thread_span(ei, 1);
+    if (with_faults && sp->ts) {
+        evt_span(ei, TRACK_KERNEL, sp->ts, "page fault", "fault", "thread_state_iowait");
+    }
+    sp->ts = 0;
+}
+
+void evt_irq_enter(evt_info_t* ei, uint32_t vector) {
+    cpus[ei->cpu].irq.ts = ei->ts;
+    cpus[ei->cpu].irq.what = vector;
+}
+void evt_irq_exit(evt_info_t* ei, uint32_t vector) {
+    span_t* sp = &cpus[ei->cpu].irq;
+    if (with_irqs && sp->ts && (sp->what == vector)) {
+        char name[32];
+        sprintf(name, "irq %u", vector);
+        evt_span(ei, TRACK_IRQ, sp->ts, name, "irq", "thread_state_unknown");
+    }
+    sp->ts = 0;
+}
+
+void evt_timer_call(evt_info_t* ei) {
+    cpus[ei->cpu].timer.ts = ei->ts;
+}
+void evt_timer_exit(evt_info_t* ei, uint64_t func) {
+    span_t* sp = &cpus[ei->cpu].timer;
+    if (with_irqs && sp->ts) {
+        char name[32];
+        sprintf(name, "timer %lx", func);
+        evt_span(ei, TRACK_IRQ, sp->ts, name, "timer", "thread_state_runnable");
+    }
+    sp->ts = 0;
+}
+
+void evt_lock_wait(evt_info_t* ei, const char* name, uint64_t dur) {
+    if (with_locks) {
+        evt_span(ei, TRACK_KERNEL, (dur < ei->ts) ? (ei->ts - dur) : 0,
+                 name, "lock", "thread_state_sleeping");
+    }
+}
+
 int usage(void) {
     fprintf(stderr,
             "usage: ktracedump [ <option> ]* <tracefile>\n\n"
@@ -708,6 +874,9 @@ int usage(void) {
             "        -kthreads    show kernel threads too\n"
             "        -wait-io     show waiting in msgpipe flow tracks\n"
             "        -syscalls    show syscall timelines\n"
+            "        -faults      show page fault durations\n"
+            "        -irqs        show interrupt and timer durations\n"
+            "        -locks       show contended lock waits\n"
             "        -all         enable all tracing features\n"
             "        -stats       print summary of trace at end\n"
             "        -onlypid=... only display pid(s) listed (comma separated)\n"
@@ -746,6 +915,112 @@ void dump_stats(stats_t* s) {
     fprintf(stderr, "process created:  %u\n", s->process_new);
 }
 
+// Records written by one cpu, in the order it wrote them, along with
+// the timestamp each sorts by.  Stream 0 holds the metadata, which
+// sorts ahead of everything; cpu n is stream n + 1.
+typedef struct {
+    ktrace_record_t* rec;
+    uint64_t* key;
+    size_t count;
+    size_t max;
+    size_t next;
+    uint64_t lost;
+} stream_t;
+
+#define MAX_STREAMS (KTRACE_CPUID(0xFFFFFFFF) + 2)
+stream_t streams[MAX_STREAMS];
+
+void stream_add(stream_t* st, const ktrace_record_t* rec, uint64_t key) {
+    if (st->count == st->max) {
+        st->max = st->max ? (st->max * 2) : 4096;
+        st->rec = realloc(st->rec, st->max * sizeof(ktrace_record_t));
+        st->key = realloc(st->key, st->max * sizeof(uint64_t));
+        if ((st->rec == NULL) || (st->key == NULL)) {
+            fprintf(stderr, "error: out of memory\n");
+            exit(-1);
+        }
+    }
+    st->rec[st->count] = *rec;
+    st->key[st->count] = key;
+    st->count++;
+}
+
+// A linear trace is a run of records ending at the first zero tag.
+// A trace drained from the per-cpu rings is a series of chunks, each
+// a TAG_CPU_CHUNK record followed by that many bytes of one cpu's
+// records, with the metadata repeated at the start of each read.
+// Either way, split the records up by the cpu that wrote them.
+void load_trace(int fd) {
+    ktrace_record_t rec;
+    unsigned offset = 0;
+    uint32_t chunk = 0;
+    int have_version = 0;
+    int have_ticks = 0;
+
+    while (read(fd, &rec, sizeof(rec)) == sizeof(rec)) {
+        uint32_t tag = rec.tag & 0xFFFFFF00;
+        offset += 32;
+        if (chunk) {
+            chunk--;
+            if (tag == 0) {
+                // overwritten while being read out
+                continue;
+            }
+        } else if (tag == 0) {
+            fprintf(stderr, "eof: zero tag at offset %08x\n", offset);
+            break;
+        } else if (tag == TAG_CPU_CHUNK) {
+            chunk = rec.a / KTRACE_RECSIZE;
+            streams[KTRACE_CPUID(rec.tag) + 1].lost +=
+                ((uint64_t)rec.b) | (((uint64_t)rec.c) << 32);
+            continue;
+        }
+
+        stream_t* st = &streams[KTRACE_CPUID(rec.tag) + 1];
+        switch (tag) {
+        case TAG_VERSION:
+            if (!have_version) {
+                have_version = 1;
+                stream_add(&streams[0], &rec, 0);
+            }
+            break;
+        case TAG_TICKS_PER_MS:
+            if (!have_ticks) {
+                have_ticks = 1;
+                stream_add(&streams[0], &rec, 0);
+            }
+            break;
+        case TAG_PROC_NAME:
+        case TAG_THREAD_NAME:
+            // names carry no timestamp, keep them behind the record before them
+            stream_add(st, &rec, st->count ? st->key[st->count - 1] : 0);
+            break;
+        default:
+            stream_add(st, &rec, rec.ts);
+            break;
+        }
+    }
+}
+
+// Merge the streams: each is in time order already, so the next
+// record overall is the earliest of the records at their heads.
+ktrace_record_t* next_record(void) {
+    stream_t* best = NULL;
+    for (unsigned n = 0; n < MAX_STREAMS; n++) {
+        stream_t* st = &streams[n];
+        if (st->next == st->count) {
+            continue;
+        }
+        if ((best == NULL) || (st->key[st->next] < best->key[best->next])) {
+            best = st;
+        }
+    }
+    if (best == NULL) {
+        return NULL;
+    }
+    return &best->rec[best->next++];
+}
+
 #define MAX_VIS_PIDS 64
 uint32_t visible_pids[MAX_VIS_PIDS];
 uint32_t visible_count;
@@ -780,11 +1055,20 @@ int main(int argc, char** argv) {
             with_waiting = 1;
         } else if (!strcmp(argv[1], "-syscalls")) {
             with_syscalls = 1;
+        } else if (!strcmp(argv[1], "-faults")) {
+            with_faults = 1;
+        } else if (!strcmp(argv[1], "-irqs")) {
+            with_irqs = 1;
+        } else if (!strcmp(argv[1], "-locks")) {
+            with_locks = 1;
         } else if (!strcmp(argv[1], "-all")) {
             with_msgpipe_io = 1;
             with_kthreads = 1;
             with_waiting = 1;
             with_syscalls = 1;
+            with_faults = 1;
+            with_irqs = 1;
+            with_locks = 1;
         } else if (!strcmp(argv[1], "-stats")) {
             show_stats = 1;
         } else if (!strncmp(argv[1], "-onlypid=", 9)) {
@@ -829,23 +1113,24 @@ int main(int argc, char** argv) {
 #endif
     }
 
-    if (with_kthreads) {
+    if (with_kthreads || with_irqs || with_faults || with_locks) {
         evt_process_name(0, "Magenta Kernel", 0);
     }
 
+    load_trace(fd);
+
     evt_info_t ei;
-    while (read(fd, &rec, sizeof(rec)) == sizeof(rec)) {
+    ktrace_record_t* next;
+    while ((next = next_record()) != NULL) {
+        rec = *next;
         uint32_t tag = rec.tag & 0xFFFFFF00;
         offset += 32;
-        if (tag == 0) {
-            fprintf(stderr, "eof: zero tag at offset %08x\n", offset);
-            break;
-        }
         if (offset > limit) {
             break;
         }
         ei.pid = thread_to_process(rec.id);
         ei.tid = rec.id;
+        ei.cpu = KTRACE_CPUID(rec.tag);
         if ((tag != TAG_PROC_NAME) && (tag != TAG_THREAD_NAME)) {
             ei.ts = ticks_to_ts(rec.ts);
             if (s.ts_first == 0) {
@@ -978,6 +1263,60 @@ int main(int argc, char** argv) {
             trace("WAIT_DONE   id=%08x pending=%08x result=%08x\n", rec.a, rec.b, rec.c);
             evt_wait_one_done(&ei, rec.a, rec.b, rec.c);
             break;
+        case TAG_SYSCALL_ENTER:
+            trace("SYSCALL     n=%u %s\n", rec.a, syscall_name(rec.a));
+            evt_syscall_enter(&ei, rec.a);
+            break;
+        case TAG_SYSCALL_EXIT:
+            t = ((uint64_t)rec.b) | (((uint64_t)rec.c) << 32);
+            trace("SYSCALL_RET n=%u %s ret=%ld\n", rec.a, syscall_name(rec.a), (int64_t)t);
+            evt_syscall_exit(&ei, rec.a);
+            break;
+        case TAG_PAGE_FAULT:
+            t = ((uint64_t)rec.a) | (((uint64_t)rec.b) << 32);
+            trace("PAGE_FAULT  va=%016lx flags=%x\n", t, rec.c);
+            evt_page_fault(&ei);
+            break;
+        case TAG_PAGE_FAULT_EXIT:
+            t = ((uint64_t)rec.a) | (((uint64_t)rec.b) << 32);
+            trace("FAULT_DONE  va=%016lx flags=%x status=%d\n", t, rec.c, (int)rec.d);
+            evt_page_fault_exit(&ei);
+            break;
+        case TAG_IRQ_ENTER:
+            trace("IRQ_ENTER   cpu=%u vector=%u\n", ei.cpu, rec.a);
+            evt_irq_enter(&ei, rec.a);
+            break;
+        case TAG_IRQ_EXIT:
+            trace("IRQ_EXIT    cpu=%u vector=%u\n", ei.cpu, rec.a);
+            evt_irq_exit(&ei, rec.a);
+            break;
+        case TAG_TIMER_CALL:
+            t = ((uint64_t)rec.a) | (((uint64_t)rec.b) << 32);
+            trace("TIMER_CALL  cpu=%u func=%016lx\n", ei.cpu, t);
+            evt_timer_call(&ei);
+            break;
+        case TAG_TIMER_EXIT:
+            t = ((uint64_t)rec.a) | (((uint64_t)rec.b) << 32);
+            trace("TIMER_EXIT  cpu=%u func=%016lx\n", ei.cpu, t);
+            evt_timer_exit(&ei, t);
+            break;
+        case TAG_MUTEX_WAIT:
+        case TAG_SPINLOCK_WAIT: {
+            const char* name = (tag == TAG_MUTEX_WAIT) ? "mutex wait" : "spinlock wait";
+            t = ticks_to_ts(((uint64_t)rec.c) | (((uint64_t)rec.d) << 32));
+            trace("LOCK_WAIT   lock=%08x%08x %s %lu.%03lu us\n", rec.b, rec.a, name,
+                  t / TS1, t % TS1);
+            evt_lock_wait(&ei, name, t);
+            break;
+        }
+        case TAG_PROFILE_SAMPLE:
+            t = ((uint64_t)rec.a) | (((uint64_t)rec.b) << 32);
+            trace("PROFILE     cpu=%u pc=%016lx %s frames=%u\n", ei.cpu, t,
+                  (rec.c & KTRACE_PROFILE_USER) ? "user" : "kernel", rec.d);
+            break;
+        case TAG_PROFILE_FRAMES:
+            trace("FRAMES      %08x%08x %08x%08x\n", rec.b, rec.a, rec.d, rec.c);
+            break;
         default:
             trace("UNKNOWN_TAG id=%08x tag=%08x\n", rec.id, tag);
             break;
@@ -996,6 +1335,12 @@ int main(int argc, char** argv) {
 #endif
     }
 
+    for (unsigned n = 1; n < MAX_STREAMS; n++) {
+        if (streams[n].lost) {
+            fprintf(stderr, "warning: cpu %u lost %lu records\n", n - 1, streams[n].lost);
+        }
+    }
+
     if (show_stats) {
         dump_stats(&s);
     }
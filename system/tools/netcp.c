@@ -24,6 +24,15 @@
 #include <magenta/netboot.h>
 
 static const char* appname;
+static uint32_t window = 16;
+
+static ssize_t fd_read(void* ctx, void* data, size_t len) {
+    return read(*(int*)ctx, data, len);
+}
+
+static ssize_t fd_write(void* ctx, const void* data, size_t len) {
+    return write(*(int*)ctx, data, len);
+}
 
 static int pull_file(int s, const char* dst, const char* src) {
     int r;
@@ -34,13 +43,15 @@ static int pull_file(int s, const char* dst, const char* src) {
     out.hdr.arg = O_RDONLY;
     memcpy(out.data, src, src_len);
     out.data[src_len] = 0;
+    size_t len = netboot_window_offer(out.data, src_len + 1, window);
 
-    r = netboot_txn(s, &in, &out, sizeof(out.hdr) + src_len + 1);
+    r = netboot_txn(s, &in, &out, sizeof(out.hdr) + len);
     if (r < 0) {
         fprintf(stderr, "%s: error opening remote file %s (%d)\n",
                 appname, src, errno);
         return r;
     }
+    uint32_t granted = netboot_window_granted(&in, r);
 
     int fd = open(dst, O_WRONLY|O_TRUNC|O_CREAT, 0664);
     if (!fd) {
@@ -51,7 +62,18 @@ static int pull_file(int s, const char* dst, const char* src) {
 
     int n = 0;
     int blocknum = 0;
-    for (;;) {
+    if (granted) {
+        off_t before = lseek(fd, 0, SEEK_CUR);
+        r = netboot_recv_window(s, granted, fd_write, &fd);
+        if (r < 0) {
+            fprintf(stderr, "%s: error reading %s (%d)\n",
+                    appname, src, errno);
+            close(fd);
+            return r;
+        }
+        n = lseek(fd, 0, SEEK_CUR) - before;
+    }
+    while (!granted) {
         memset(&out, 0, sizeof(out));
         out.hdr.cmd = NB_READ;
         out.hdr.arg = blocknum;
@@ -106,13 +128,15 @@ static int push_file(int s, const char* dst, const char* src) {
     out.hdr.arg = O_WRONLY;
     memcpy(out.data, dst, dst_len);
     out.data[dst_len] = 0;
+    size_t optlen = netboot_window_offer(out.data, dst_len + 1, window);
 
-    r = netboot_txn(s, &in, &out, sizeof(out.hdr) + dst_len + 1);
+    r = netboot_txn(s, &in, &out, sizeof(out.hdr) + optlen);
     if (r < 0) {
         fprintf(stderr, "%s: error opening remote file %s (%d)\n",
                 appname, src, errno);
         return r;
     }
+    uint32_t granted = netboot_window_granted(&in, r);
 
     int fd = open(src, O_RDONLY, 0664);
     if (!fd) {
@@ -124,7 +148,17 @@ static int push_file(int s, const char* dst, const char* src) {
     int n = 0;
     int len = 0;
     int blocknum = 0;
-    for (;;) {
+    if (granted) {
+        r = netboot_send_window(s, NB_WRITE, granted, fd_read, &fd);
+        if (r < 0) {
+            fprintf(stderr, "%s: error writing %s (%d)\n",
+                    appname, dst, errno);
+            close(fd);
+            return r;
+        }
+        n = lseek(fd, 0, SEEK_CUR);
+    }
+    while (!granted) {
         memset(&out, 0, sizeof(out));
         out.hdr.cmd = NB_WRITE;
         out.hdr.arg = blocknum;
@@ -176,8 +210,23 @@ static int push_file(int s, const char* dst, const char* src) {
 int main(int argc, char** argv) {
     appname = argv[0];
 
+    while ((argc > 1) && (argv[1][0] == '-')) {
+        if (!strcmp(argv[1], "-w") && (argc > 2)) {
+            window = strtoul(argv[2], NULL, 0);
+            argc--;
+            argv++;
+        } else {
+            argc = 0;
+            break;
+        }
+        argc--;
+        argv++;
+    }
+
     if (argc != 3) {
-        fprintf(stderr, "usage: %s [hostname:]src [hostname:]dst\n", appname);
+        fprintf(stderr, "usage: %s [-w window] [hostname:]src [hostname:]dst\n"
+                "  -w  blocks in flight, 0 for stop-and-wait (default 16, max %d)\n",
+                appname, NB_WINDOW_MAX);
         return -1;
     }
 
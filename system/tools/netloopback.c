@@ -0,0 +1,531 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Measures netboot file transfer throughput over [::1].
+//
+// A forked server runs netsvc's own netfile.c in a scratch directory,
+// with the UDP and ethernet buffer calls it makes supplied here on top
+// of a socket.  The server can drop and delay packets to stand in for
+// a real link.  The client pushes a test pattern and pulls it back, in
+// stop-and-wait and in windowed mode, checks it, and reports the rate.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "netprotocol.h"
+#include "netsvc.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <stdint.h>
+
+#include <inet6/inet6.h>
+#include <magenta/netboot.h>
+
+static const char* appname;
+
+static size_t size = 4 * 1024 * 1024;
+static uint32_t window = 16;
+static int loss = 0;        // percent of packets dropped, each direction
+static uint64_t delay = 0;  // one way delay in microseconds
+
+static uint8_t pattern(size_t off) {
+    return (off * 7) + (off >> 10);
+}
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// server
+
+#define QUEUE_DEPTH 256
+// received frames netfile.c may hold at once, one per window slot
+#define MAX_HELD (NB_WINDOW_MAX + 1)
+
+typedef struct {
+    uint64_t due;
+    size_t len;
+    msg m;
+} qpacket;
+
+// a received frame, with room for a full block plus the NUL terminator
+typedef struct {
+    nbmsg hdr;
+    uint8_t data[NB_WINDOW_BLOCKSIZE + 1];
+} rxframe;
+
+static struct {
+    int s;
+    struct sockaddr_in6 peer;
+    socklen_t peerlen;
+
+    // delay line, ordered by due time since the delay is constant
+    qpacket queue[QUEUE_DEPTH];
+    unsigned head;
+    unsigned count;
+
+    // the frame being handled, and those netfile.c kept with eth_hold_buffer()
+    rxframe* rx;
+    rxframe* held[MAX_HELD];
+} srv;
+
+static bool dropped(void) {
+    return (loss > 0) && ((rand() % 100) < loss);
+}
+
+static void srv_send(const void* data, size_t len) {
+    if (dropped()) {
+        return;
+    }
+    if (delay == 0) {
+        sendto(srv.s, data, len, 0, (void*)&srv.peer, srv.peerlen);
+        return;
+    }
+    if ((srv.count == QUEUE_DEPTH) || (len > sizeof(msg))) {
+        return;
+    }
+    qpacket* p = &srv.queue[(srv.head + srv.count++) % QUEUE_DEPTH];
+    p->due = now_us() + delay;
+    p->len = len;
+    memcpy(&p->m, data, len);
+}
+
+static void srv_flush(void) {
+    uint64_t t = now_us();
+    while (srv.count && (srv.queue[srv.head].due <= t)) {
+        qpacket* p = &srv.queue[srv.head];
+        sendto(srv.s, &p->m, p->len, 0, (void*)&srv.peer, srv.peerlen);
+        srv.head = (srv.head + 1) % QUEUE_DEPTH;
+        srv.count--;
+    }
+}
+
+// what netsvc gets from inet6 and the ethernet driver, replies always
+// go back to the last peer heard from
+
+int udp6_send(const void* data, size_t len, const ip6_addr_t* daddr, uint16_t dport,
+              uint16_t sport) {
+    srv_send(data, len);
+    return 0;
+}
+
+void* udp6_get_buffer(size_t len) {
+    return malloc(len);
+}
+
+void udp6_put_buffer(void* data) {
+    free(data);
+}
+
+int udp6_send_buffer(void* data, size_t len, const ip6_addr_t* daddr, uint16_t dport,
+                     uint16_t sport) {
+    srv_send(data, len);
+    free(data);
+    return 0;
+}
+
+static bool in_frame(rxframe* f, void* data) {
+    return (f != NULL) && ((uint8_t*)data >= (uint8_t*)f) &&
+           ((uint8_t*)data < (uint8_t*)(f + 1));
+}
+
+int eth_hold_buffer(void* data) {
+    if (!in_frame(srv.rx, data)) {
+        return -1;
+    }
+    for (unsigned n = 0; n < MAX_HELD; n++) {
+        if (srv.held[n] == NULL) {
+            srv.held[n] = srv.rx;
+            srv.rx = NULL;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void eth_put_buffer(void* ptr) {
+    for (unsigned n = 0; n < MAX_HELD; n++) {
+        if (in_frame(srv.held[n], ptr)) {
+            free(srv.held[n]);
+            srv.held[n] = NULL;
+            return;
+        }
+    }
+    fprintf(stderr, "%s: eth_put_buffer() of a frame that is not held\n", appname);
+    exit(1);
+}
+
+// as netsvc's udp6_recv() does for NB_SERVER_PORT
+static void srv_recv(rxframe* f, size_t len) {
+    nbmsg* m = &f->hdr;
+    if ((len < (sizeof(nbmsg) + 1)) || (m->magic != NB_MAGIC)) {
+        return;
+    }
+    len -= sizeof(nbmsg);
+    m->data[len - 1] = 0;
+
+    switch (m->cmd) {
+    case NB_OPEN:
+        netfile_open((char*)m->data, len, m->cookie, m->arg, NULL, 0, 0);
+        break;
+    case NB_READ:
+        netfile_read((char*)m->data, len - 1, m->cookie, m->arg, NULL, 0, 0);
+        break;
+    case NB_WRITE:
+        netfile_write((char*)m->data, len - 1, m->cookie, m->arg, NULL, 0, 0);
+        break;
+    case NB_CLOSE:
+        netfile_close(m->cookie, NULL, 0, 0);
+        break;
+    }
+}
+
+static void server(int s, const char* dir) {
+    srv.s = s;
+    if (chdir(dir) < 0) {
+        exit(1);
+    }
+
+    for (;;) {
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(s, &fds);
+        struct timeval tv;
+        struct timeval* tvp = NULL;
+        if (srv.count) {
+            uint64_t t = now_us();
+            uint64_t due = srv.queue[srv.head].due;
+            uint64_t wait = (due > t) ? (due - t) : 0;
+            tv.tv_sec = wait / 1000000;
+            tv.tv_usec = wait % 1000000;
+            tvp = &tv;
+        }
+        if (select(s + 1, &fds, NULL, NULL, tvp) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            exit(1);
+        }
+        srv_flush();
+        if (!FD_ISSET(s, &fds)) {
+            continue;
+        }
+
+        if ((srv.rx == NULL) && ((srv.rx = malloc(sizeof(rxframe))) == NULL)) {
+            exit(1);
+        }
+        srv.peerlen = sizeof(srv.peer);
+        ssize_t r = recvfrom(s, srv.rx, sizeof(rxframe), 0, (void*)&srv.peer, &srv.peerlen);
+        if ((r < 0) || dropped()) {
+            continue;
+        }
+        srv_recv(srv.rx, r);
+    }
+}
+
+// client
+
+typedef struct {
+    uint8_t* data;
+    size_t len;
+    size_t pos;
+} membuf;
+
+static ssize_t mem_read(void* ctx, void* data, size_t len) {
+    membuf* mb = ctx;
+    if (len > (mb->len - mb->pos)) {
+        len = mb->len - mb->pos;
+    }
+    memcpy(data, mb->data + mb->pos, len);
+    mb->pos += len;
+    return len;
+}
+
+static ssize_t mem_write(void* ctx, const void* data, size_t len) {
+    membuf* mb = ctx;
+    if (len > (mb->len - mb->pos)) {
+        errno = EFBIG;
+        return -1;
+    }
+    memcpy(mb->data + mb->pos, data, len);
+    mb->pos += len;
+    return len;
+}
+
+static int open_remote(int s, uint32_t mode, uint32_t offer, uint32_t* granted) {
+    msg in, out;
+    out.hdr.cmd = NB_OPEN;
+    out.hdr.arg = mode;
+    strcpy((char*)out.data, "loopback");
+    size_t len = netboot_window_offer(out.data, strlen("loopback") + 1, offer);
+    int r = netboot_txn(s, &in, &out, sizeof(out.hdr) + len);
+    if (r < 0) {
+        return r;
+    }
+    *granted = netboot_window_granted(&in, r);
+    return 0;
+}
+
+static int close_remote(int s) {
+    msg in, out;
+    out.hdr.cmd = NB_CLOSE;
+    out.hdr.arg = 0;
+    out.data[0] = 0;
+    return netboot_txn(s, &in, &out, sizeof(out.hdr) + 1) < 0 ? -1 : 0;
+}
+
+static int push(int s, membuf* mb, uint32_t offer) {
+    uint32_t granted;
+    if (open_remote(s, O_WRONLY, offer, &granted) < 0) {
+        return -1;
+    }
+    if (granted != offer) {
+        fprintf(stderr, "%s: asked for window %u, got %u\n", appname, offer, granted);
+        return -1;
+    }
+    if (granted) {
+        if (netboot_send_window(s, NB_WRITE, granted, mem_read, mb) < 0) {
+            return -1;
+        }
+    } else {
+        msg in;
+        struct {
+            msg m;
+            uint8_t spare;
+        } out;
+        for (uint32_t blocknum = 0; ; blocknum++) {
+            ssize_t len = mem_read(mb, out.m.data, NB_WINDOW_BLOCKSIZE);
+            if (len == 0) {
+                break;
+            }
+            out.m.hdr.cmd = NB_WRITE;
+            out.m.hdr.arg = blocknum;
+            out.m.data[len] = 0;
+            if (netboot_txn(s, &in, &out.m, sizeof(out.m.hdr) + len + 1) < 0) {
+                return -1;
+            }
+        }
+    }
+    return close_remote(s);
+}
+
+static int pull(int s, membuf* mb, uint32_t offer) {
+    uint32_t granted;
+    if (open_remote(s, O_RDONLY, offer, &granted) < 0) {
+        return -1;
+    }
+    if (granted != offer) {
+        fprintf(stderr, "%s: asked for window %u, got %u\n", appname, offer, granted);
+        return -1;
+    }
+    if (granted) {
+        if (netboot_recv_window(s, granted, mem_write, mb) < 0) {
+            return -1;
+        }
+    } else {
+        msg in, out;
+        for (uint32_t blocknum = 0; ; blocknum++) {
+            out.hdr.cmd = NB_READ;
+            out.hdr.arg = blocknum;
+            out.data[0] = 0;
+            int r = netboot_txn(s, &in, &out, sizeof(out.hdr) + 1);
+            if (r < 0) {
+                return -1;
+            }
+            r -= sizeof(in.hdr);
+            if (r == 0) {
+                break;
+            }
+            if (mem_write(mb, in.data, r) < 0) {
+                return -1;
+            }
+        }
+    }
+    if (close_remote(s) < 0) {
+        return -1;
+    }
+    if (mb->pos != size) {
+        errno = EIO;
+        return -1;
+    }
+    for (size_t n = 0; n < size; n++) {
+        if (mb->data[n] != pattern(n)) {
+            errno = EIO;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int run(int s, const char* name, uint32_t offer, uint8_t* src, uint8_t* dst) {
+    membuf mb = { .data = src, .len = size, .pos = 0 };
+    uint64_t t0 = now_us();
+    if (push(s, &mb, offer) < 0) {
+        fprintf(stderr, "%s: %s push failed: %s\n", appname, name, strerror(errno));
+        return -1;
+    }
+    uint64_t t1 = now_us();
+    memset(dst, 0, size);
+    mb.data = dst;
+    mb.pos = 0;
+    if (pull(s, &mb, offer) < 0) {
+        fprintf(stderr, "%s: %s pull failed: %s\n", appname, name, strerror(errno));
+        return -1;
+    }
+    uint64_t t2 = now_us();
+
+    printf("%-16s push %8.2f MB/s  pull %8.2f MB/s\n", name,
+           (double)size / (double)(t1 - t0 + 1),
+           (double)size / (double)(t2 - t1 + 1));
+    return 0;
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "usage: %s [ <option> ]*\n"
+            "\n"
+            "options: -s <kb>   transfer size (default %zu)\n"
+            "         -w <n>    window for the windowed run (default %u, max %d)\n"
+            "         -l <pct>  drop this percentage of packets each way\n"
+            "         -d <us>   delay server replies by this many microseconds\n",
+            appname, size / 1024, window, NB_WINDOW_MAX);
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    if ((appname = strrchr(argv[0], '/')) != NULL) {
+        appname++;
+    } else {
+        appname = argv[0];
+    }
+
+    while (argc > 1) {
+        if (argc < 3) {
+            usage();
+        }
+        unsigned long val = strtoul(argv[2], NULL, 0);
+        if (!strcmp(argv[1], "-s")) {
+            size = val * 1024;
+        } else if (!strcmp(argv[1], "-w")) {
+            window = val;
+        } else if (!strcmp(argv[1], "-l")) {
+            loss = val;
+        } else if (!strcmp(argv[1], "-d")) {
+            delay = val;
+        } else {
+            usage();
+        }
+        argc -= 2;
+        argv += 2;
+    }
+    if ((window == 0) || (window > NB_WINDOW_MAX) || (loss >= 100)) {
+        usage();
+    }
+    // With each attempt lost both ways, the default budget runs out
+    // somewhere in a long stop-and-wait transfer at a few percent loss;
+    // give lossier links more tries so a run measures them rather than
+    // the retry limit.
+    if (loss > 0) {
+        netboot_set_retries(5 + loss);
+    }
+
+    struct sockaddr_in6 addr;
+    socklen_t addrlen = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin6_family = AF_INET6;
+    addr.sin6_addr = in6addr_loopback;
+
+    int ss;
+    if ((ss = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
+        fprintf(stderr, "%s: cannot create socket: %s\n", appname, strerror(errno));
+        return -1;
+    }
+    if ((bind(ss, (void*)&addr, sizeof(addr)) < 0) ||
+        (getsockname(ss, (void*)&addr, &addrlen) < 0)) {
+        fprintf(stderr, "%s: cannot bind to [::1]: %s\n", appname, strerror(errno));
+        return -1;
+    }
+
+    char dir[] = "/tmp/netloopback.XXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        fprintf(stderr, "%s: cannot create scratch directory: %s\n", appname, strerror(errno));
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "%s: cannot fork: %s\n", appname, strerror(errno));
+        rmdir(dir);
+        return -1;
+    }
+    if (pid == 0) {
+        server(ss, dir);
+        exit(0);
+    }
+    close(ss);
+
+    int status = -1;
+    int s;
+    uint8_t* src = malloc(size);
+    uint8_t* dst = malloc(size);
+    if ((src == NULL) || (dst == NULL)) {
+        fprintf(stderr, "%s: out of memory\n", appname);
+        goto done;
+    }
+    for (size_t n = 0; n < size; n++) {
+        src[n] = pattern(n);
+    }
+
+    if ((s = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
+        fprintf(stderr, "%s: cannot create socket: %s\n", appname, strerror(errno));
+        goto done;
+    }
+    struct timeval tv;
+    tv.tv_sec = 0;
+    tv.tv_usec = 250 * 1000;
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    if (connect(s, (void*)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "%s: cannot connect: %s\n", appname, strerror(errno));
+        close(s);
+        goto done;
+    }
+
+    printf("%zu KB, loss %d%%, delay %llu us\n", size / 1024, loss,
+           (unsigned long long)delay);
+    char name[32];
+    snprintf(name, sizeof(name), "window %u", window);
+    if ((run(s, "stop-and-wait", 0, src, dst) == 0) &&
+        (run(s, name, window, src, dst) == 0)) {
+        status = 0;
+    }
+    close(s);
+
+done:
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    char path[sizeof(dir) + sizeof("/loopback")];
+    snprintf(path, sizeof(path), "%s/loopback", dir);
+    unlink(path);
+    rmdir(dir);
+    free(src);
+    free(dst);
+    return status;
+}
@@ -15,6 +15,7 @@
 #include <ifaddrs.h>
 
 #include <fcntl.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -24,6 +25,11 @@
 #include <stdint.h>
 
 static uint32_t cookie = 0x12345678;
+static int retries = 5;
+
+void netboot_set_retries(int n) {
+    retries = n;
+}
 
 int netboot_open(const char* hostname, unsigned port, struct sockaddr_in6* addr_out) {
     if ((hostname == NULL) || (hostname[0] == 0)) {
@@ -127,7 +133,7 @@ int netboot_txn(int s, msg* in, msg* out, int outlen) {
     out->hdr.magic = NB_MAGIC;
     out->hdr.cookie = ++cookie;
 
-    int retry = 5;
+    int retry = retries;
 resend:
     write(s, out, outlen);
     for (;;) {
@@ -160,3 +166,267 @@ resend:
         return r;
     }
 }
+
+size_t netboot_window_offer(uint8_t* data, size_t len, uint32_t window) {
+    // leave a spare byte: netsvc NUL-terminates the last byte of every payload
+    if ((window == 0) || ((len + sizeof(nbwindow) + 1) > MAXSIZE)) {
+        return len;
+    }
+    nbwindow w = {
+        .magic = NB_WINDOW_MAGIC,
+        .window = (window > NB_WINDOW_MAX) ? NB_WINDOW_MAX : window,
+    };
+    memcpy(data + len, &w, sizeof(w));
+    data[len + sizeof(w)] = 0;
+    return len + sizeof(w) + 1;
+}
+
+uint32_t netboot_window_granted(const msg* in, int r) {
+    nbwindow w;
+    if (r < (int)(sizeof(in->hdr) + sizeof(w))) {
+        return 0;
+    }
+    memcpy(&w, in->data, sizeof(w));
+    if ((w.magic != NB_WINDOW_MAGIC) || (w.window > NB_WINDOW_MAX)) {
+        return 0;
+    }
+    return w.window;
+}
+
+// A datagram that could not be queued is treated like one lost
+// on the wire; the retransmit logic will take care of it.
+static int window_xmit(int s, const void* data, size_t len) {
+    if (write(s, data, len) < 0) {
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == ENOBUFS)) {
+            return 0;
+        }
+        return -1;
+    }
+    return 0;
+}
+
+typedef struct {
+    size_t len;
+    bool sacked;
+    bool resent;
+    msg m;
+    uint8_t spare; // NB_WRITE pad byte after a full block
+} wblock;
+
+int netboot_send_window(int s, uint32_t cmd, uint32_t window,
+                        netboot_reader reader, void* ctx) {
+    if ((window == 0) || (window > NB_WINDOW_MAX)) {
+        errno = EINVAL;
+        return -1;
+    }
+    wblock* blocks = calloc(window, sizeof(wblock));
+    if (blocks == NULL) {
+        return -1;
+    }
+
+    // netsvc NUL-terminates the last byte of every payload,
+    // so NB_WRITE carries a spare one, as in stop-and-wait mode.
+    size_t pad = (cmd == NB_WRITE) ? 1 : 0;
+    uint32_t xcookie = ++cookie;
+    uint32_t base = 0;
+    uint32_t next = 0;
+    bool eof = false;
+    int retry = retries;
+    int status = -1;
+    msg in;
+
+    for (;;) {
+        // fill the window with new blocks
+        while (!eof && ((next - base) < window)) {
+            wblock* b = &blocks[next % window];
+            ssize_t r = reader(ctx, b->m.data, NB_WINDOW_BLOCKSIZE);
+            if (r < 0) {
+                goto done;
+            }
+            if (r == 0) {
+                eof = true;
+                break;
+            }
+            b->len = sizeof(nbmsg) + r + pad;
+            b->sacked = false;
+            b->resent = false;
+            b->m.hdr.magic = NB_MAGIC;
+            b->m.hdr.cookie = xcookie;
+            b->m.hdr.cmd = cmd;
+            b->m.hdr.arg = next;
+            if (window_xmit(s, &b->m, b->len) < 0) {
+                goto done;
+            }
+            next++;
+        }
+        if (eof && (base == next)) {
+            break;
+        }
+
+        ssize_t r = recv(s, &in, sizeof(in), 0);
+        if (r < 0) {
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+                goto done;
+            }
+            if (retry-- == 0) {
+                errno = ETIMEDOUT;
+                goto done;
+            }
+            for (uint32_t n = base; n != next; n++) {
+                wblock* b = &blocks[n % window];
+                if (!b->sacked) {
+                    if (window_xmit(s, &b->m, b->len) < 0) {
+                        goto done;
+                    }
+                    b->resent = true;
+                }
+            }
+            continue;
+        }
+        if ((r < (ssize_t)sizeof(in.hdr)) ||
+            (in.hdr.magic != NB_MAGIC) ||
+            (in.hdr.cookie != xcookie) ||
+            (in.hdr.cmd != NB_ACK)) {
+            continue;
+        }
+        if ((int32_t)in.hdr.arg < 0) {
+            errno = -(int32_t)in.hdr.arg;
+            goto done;
+        }
+        uint32_t ack = in.hdr.arg;
+        if ((ack - base) > (next - base)) {
+            // stale, or acknowledging something never sent
+            continue;
+        }
+        if (ack != base) {
+            base = ack;
+            retry = retries;
+        }
+        if (r < (ssize_t)(sizeof(in.hdr) + sizeof(nbsack))) {
+            continue;
+        }
+        nbsack sk;
+        memcpy(&sk, in.data, sizeof(sk));
+        uint32_t last = base;
+        for (uint32_t n = 0; (n < 32) && ((base + 1 + n) != next); n++) {
+            if (sk.sack & (1u << n)) {
+                blocks[(base + 1 + n) % window].sacked = true;
+                last = base + 1 + n;
+            }
+        }
+        // anything missing below a block the receiver holds was lost;
+        // resend it once here and leave further attempts to the timeout
+        for (uint32_t n = base; n != last; n++) {
+            wblock* b = &blocks[n % window];
+            if (!b->sacked && !b->resent) {
+                if (window_xmit(s, &b->m, b->len) < 0) {
+                    goto done;
+                }
+                b->resent = true;
+            }
+        }
+    }
+    status = 0;
+
+done:
+    free(blocks);
+    return status;
+}
+
+typedef struct {
+    size_t len;
+    bool valid;
+    uint8_t data[NB_WINDOW_BLOCKSIZE];
+} rblock;
+
+int netboot_recv_window(int s, uint32_t window,
+                        netboot_writer writer, void* ctx) {
+    if ((window == 0) || (window > NB_WINDOW_MAX)) {
+        errno = EINVAL;
+        return -1;
+    }
+    rblock* blocks = calloc(window, sizeof(rblock));
+    if (blocks == NULL) {
+        return -1;
+    }
+
+    uint32_t xcookie = ++cookie;
+    uint32_t base = 0;
+    uint32_t flags = NB_SACK_RETRY;
+    int retry = retries;
+    int status = -1;
+    msg in, out;
+
+    for (;;) {
+        nbsack sk = {
+            .sack = 0,
+            .flags = flags,
+        };
+        for (uint32_t n = 1; n < window; n++) {
+            if (blocks[(base + n) % window].valid) {
+                sk.sack |= 1u << (n - 1);
+            }
+        }
+        out.hdr.magic = NB_MAGIC;
+        out.hdr.cookie = xcookie;
+        out.hdr.cmd = NB_READ;
+        out.hdr.arg = base;
+        memcpy(out.data, &sk, sizeof(sk));
+        out.data[sizeof(sk)] = 0;
+        if (window_xmit(s, &out, sizeof(out.hdr) + sizeof(sk) + 1) < 0) {
+            goto done;
+        }
+        flags = 0;
+
+        ssize_t r = recv(s, &in, sizeof(in), 0);
+        if (r < 0) {
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+                goto done;
+            }
+            if (retry-- == 0) {
+                errno = ETIMEDOUT;
+                goto done;
+            }
+            flags = NB_SACK_RETRY;
+            continue;
+        }
+        if ((r < (ssize_t)sizeof(in.hdr)) ||
+            (in.hdr.magic != NB_MAGIC) ||
+            (in.hdr.cookie != xcookie) ||
+            (in.hdr.cmd != NB_ACK)) {
+            continue;
+        }
+        if ((int32_t)in.hdr.arg < 0) {
+            errno = -(int32_t)in.hdr.arg;
+            goto done;
+        }
+        uint32_t n = in.hdr.arg - base;
+        if (n >= window) {
+            // duplicate of something already delivered; acknowledging
+            // again tells the sender where we really are
+            continue;
+        }
+        rblock* b = &blocks[in.hdr.arg % window];
+        if (!b->valid) {
+            b->len = r - sizeof(in.hdr);
+            b->valid = true;
+            memcpy(b->data, in.data, b->len);
+            retry = retries;
+        }
+        while ((b = &blocks[base % window])->valid) {
+            b->valid = false;
+            base++;
+            if (b->len == 0) {
+                status = 0;
+                goto done;
+            }
+            if (writer(ctx, b->data, b->len) != (ssize_t)b->len) {
+                goto done;
+            }
+        }
+    }
+
+done:
+    free(blocks);
+    return status;
+}
@@ -6,6 +6,8 @@
 
 #include <magenta/netboot.h>
 
+#include <sys/types.h>
+
 #define MAXSIZE 1024
 
 typedef struct {
@@ -18,3 +20,28 @@ struct sockaddr_in6;
 int netboot_open(const char* hostname, unsigned port, struct sockaddr_in6* addr_out);
 
 int netboot_txn(int s, msg* in, msg* out, int outlen);
+
+// Sets how many times a request is resent, 250ms apart, before a
+// transaction or a stalled windowed transfer times out (default 5).
+void netboot_set_retries(int n);
+
+// Windowed transfers (see magenta/netboot.h)
+typedef ssize_t (*netboot_reader)(void* ctx, void* data, size_t len);
+typedef ssize_t (*netboot_writer)(void* ctx, const void* data, size_t len);
+
+// Appends an nbwindow offer after the NUL-terminated name occupying the
+// first len bytes of data.  Returns the new payload length, which is
+// unchanged if window is 0 or there is no room.
+size_t netboot_window_offer(uint8_t* data, size_t len, uint32_t window);
+
+// Returns the window granted by an NB_ACK of r bytes, or 0 if the peer
+// did not agree to a windowed transfer.
+uint32_t netboot_window_granted(const msg* in, int r);
+
+// Sends NB_WRITE or NB_DATA blocks produced by reader until it returns 0.
+int netboot_send_window(int s, uint32_t cmd, uint32_t window,
+                        netboot_reader reader, void* ctx);
+
+// Issues NB_READ acknowledgements and passes blocks to writer until EOF.
+int netboot_recv_window(int s, uint32_t window,
+                        netboot_writer writer, void* ctx);
@@ -10,11 +10,34 @@
 #include <limits.h>
 #include <sys/param.h>
 
+#include <block-client/client.h>
+#include <magenta/syscalls.h>
 #include <magenta/types.h>
 #include <magenta/device/block.h>
 
 #include <mxio/io.h>
 
+// Move count bytes between the vmo and the device starting at offset,
+// as BLOCK_FIFO_MAX_XFER sized requests that are all in flight at once.
+static mx_status_t fifo_xfer(block_client_t* client, uint32_t opcode,
+                             mx_off_t offset, mx_off_t count) {
+    size_t n = (count + BLOCK_FIFO_MAX_XFER - 1) / BLOCK_FIFO_MAX_XFER;
+    block_fifo_request_t* reqs = calloc(n, sizeof(block_fifo_request_t));
+    if (reqs == NULL) {
+        return ERR_NO_MEMORY;
+    }
+    for (size_t i = 0; i < n; i++) {
+        mx_off_t at = i * BLOCK_FIFO_MAX_XFER;
+        reqs[i].opcode = opcode;
+        reqs[i].length = MIN(count - at, BLOCK_FIFO_MAX_XFER);
+        reqs[i].vmo_offset = (opcode == BLOCK_FIFO_OP_WRITE) ? at : count + at;
+        reqs[i].dev_offset = offset + at;
+    }
+    mx_status_t r = block_client_transact(client, reqs, n);
+    free(reqs);
+    return r;
+}
+
 static int do_test(const char* dev, mx_off_t offset, mx_off_t count, uint8_t pattern) {
     int fd = open(dev, O_RDWR);
     if (fd < 0) {
@@ -22,6 +45,8 @@ static int do_test(const char* dev, mx_off_t offset, mx_off_t count, uint8_t pat
         return fd;
     }
 
+    mx_handle_t vmo = 0;
+    block_client_t* client = NULL;
     void* buf = NULL;
     // constrain to device size
     int rc;
@@ -38,37 +63,43 @@ static int do_test(const char* dev, mx_off_t offset, mx_off_t count, uint8_t pat
 
     // write a multiple of block size
     uint64_t blksize;
-    mxio_ioctl(fd, IOCTL_BLOCK_GET_BLOCKSIZE, NULL, 0, &blksize, sizeof(blksize));
+    rc = mxio_ioctl(fd, IOCTL_BLOCK_GET_BLOCKSIZE, NULL, 0, &blksize, sizeof(blksize));
     if (rc < 0) {
         printf("Error getting block size for %s\n", dev);
         goto fail;
     }
     count -= count % blksize;
-
-    printf("Writing 0x%02x from offset %llu to %llu (%llu bytes)...", pattern, offset, offset + count, count);
-
-    if (offset) {
-        rc = lseek(fd, offset, SEEK_SET);
-        if (rc < 0) {
-            printf("Error %d seeking to offset %lld\n", rc, offset);
-            goto fail;
-        }
+    if (offset % blksize) {
+        printf("Offset must be a multiple of blksize=%llu\n", blksize);
+        rc = -1;
+        goto fail;
     }
 
-    buf = malloc(count * 2);
-    if (!buf) {
+    // the first half of the vmo is written out, the second half read back
+    if ((vmo = mx_vmo_create(count * 2)) < 0) {
         printf("Out of memory!\n");
+        rc = vmo;
+        goto fail;
+    }
+    uintptr_t base = 0;
+    rc = mx_process_map_vm(mx_process_self(), vmo, 0, count * 2, &base,
+                           MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE);
+    if (rc < 0) {
+        printf("Error %d mapping vmo\n", rc);
         goto fail;
     }
+    buf = (void*)base;
     memset(buf, pattern, count);
 
-    // FIXME: do multiple writes if too big
+    if ((rc = block_client_create(fd, vmo, &client)) < 0) {
+        printf("Error %d setting up block fifo for %s\n", rc, dev);
+        goto fail;
+    }
 
-    ssize_t c = count;
-    ssize_t actual = write(fd, buf, c);
-    if (actual != c) {
-        printf("requested to write %zd bytes, only %zd bytes written!\n", c, actual);
-        rc = -1;
+    printf("Writing 0x%02x from offset %llu to %llu (%llu bytes)...", pattern, offset, offset + count, count);
+
+    if ((rc = fifo_xfer(client, BLOCK_FIFO_OP_WRITE, offset, count)) < 0) {
+        printf("Error %d writing!\n", rc);
         goto fail;
     }
 
@@ -76,30 +107,26 @@ static int do_test(const char* dev, mx_off_t offset, mx_off_t count, uint8_t pat
 
     printf("Reading back...");
 
-    // reset offset
-    rc = lseek(fd, offset, SEEK_SET);
-    if (rc < 0) {
-        printf("Error %d seeking to offset %lld\n", rc, offset);
-        goto fail;
-    }
-
-    void* buf2 = buf + c;
-    actual = read(fd, buf2, c);
-    if (actual != c) {
-        printf("requested to read %zd bytes, only %zd bytes written!\n", c, actual);
-        rc = -1;
+    if ((rc = fifo_xfer(client, BLOCK_FIFO_OP_READ, offset, count)) < 0) {
+        printf("Error %d reading!\n", rc);
         goto fail;
     }
 
-    rc = memcmp(buf, buf2, count);
+    rc = memcmp(buf, buf + count, count);
     if (rc != 0) {
         printf("Fail\n");
     } else {
         printf("OK\n");
     }
 fail:
+    if (client) {
+        block_client_destroy(client);
+    }
     if (buf) {
-        free(buf);
+        mx_process_unmap_vm(mx_process_self(), (uintptr_t)buf, 0);
+    }
+    if (vmo > 0) {
+        mx_handle_close(vmo);
     }
     close(fd);
     return rc;
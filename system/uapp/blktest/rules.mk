@@ -11,6 +11,8 @@ MODULE_TYPE := userapp
 MODULE_SRCS += \
     $(LOCAL_DIR)/main.c
 
+MODULE_STATIC_LIBS := ulib/block-client
+
 MODULE_LIBS := ulib/magenta ulib/mxio ulib/musl
 
 include make/module.mk
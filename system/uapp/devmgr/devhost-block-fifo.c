@@ -0,0 +1,261 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "devhost.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+#include <ddk/device.h>
+#include <ddk/iotxn.h>
+
+#include <magenta/device/block.h>
+#include <magenta/syscalls.h>
+#include <magenta/types.h>
+
+#define MXDEBUG 0
+
+#include <mxio/debug.h>
+
+// One block fifo per IOCTL_BLOCK_GET_FIFO.
+//
+// The fifo thread reads batches of requests from the pipe and queues
+// an iotxn for each without waiting for earlier ones to finish.  Each
+// iotxn covers its range of the attached vmo directly, so data moves
+// between the client's pages and the device without a copy.
+// Completion callbacks (which run on whatever thread the driver
+// completes from) write the response back to the pipe.
+typedef struct block_fifo {
+    mx_device_t* dev;
+    mx_handle_t h;
+
+    // requests must be aligned to this
+    uint64_t blksize;
+
+    // attached vmo
+    mx_handle_t vmo;
+    uint64_t vmo_size;
+
+    // iotxns queued and not yet completed
+    mtx_t lock;
+    cnd_t idle;
+    uint32_t pending;
+} block_fifo_t;
+
+typedef struct fifo_txn {
+    block_fifo_t* fifo;
+    uint32_t txnid;
+} fifo_txn_t;
+
+static void fifo_respond(block_fifo_t* fifo, uint32_t txnid, mx_status_t status, uint64_t actual) {
+    block_fifo_response_t rsp = {
+        .status = status,
+        .txnid = txnid,
+        .actual = actual,
+    };
+    // if the client has gone away there is no one left to tell
+    mx_msgpipe_write(fifo->h, &rsp, sizeof(rsp), NULL, 0, 0);
+}
+
+static void fifo_txn_complete(iotxn_t* txn, void* cookie) {
+    fifo_txn_t* ft = cookie;
+    block_fifo_t* fifo = ft->fifo;
+
+    fifo_respond(fifo, ft->txnid, txn->status, txn->actual);
+    txn->ops->release(txn);
+
+    mtx_lock(&fifo->lock);
+    if (--fifo->pending == 0) {
+        cnd_broadcast(&fifo->idle);
+    }
+    mtx_unlock(&fifo->lock);
+}
+
+static mx_status_t fifo_attach_vmo(block_fifo_t* fifo, mx_handle_t vmo) {
+    if (fifo->vmo) {
+        return ERR_BAD_STATE;
+    }
+    uint64_t size;
+    mx_status_t r;
+    if ((r = mx_vmo_get_size(vmo, &size)) < 0) {
+        return r;
+    }
+    fifo->vmo = vmo;
+    fifo->vmo_size = size;
+    return NO_ERROR;
+}
+
+static mx_status_t fifo_queue(block_fifo_t* fifo, const block_fifo_request_t* req) {
+    uint32_t opcode;
+    switch (req->opcode) {
+    case BLOCK_FIFO_OP_READ:
+        opcode = IOTXN_OP_READ;
+        break;
+    case BLOCK_FIFO_OP_WRITE:
+        opcode = IOTXN_OP_WRITE;
+        break;
+    default:
+        return ERR_NOT_SUPPORTED;
+    }
+    if (fifo->vmo == 0) {
+        return ERR_BAD_STATE;
+    }
+    if ((req->length == 0) || (req->length > BLOCK_FIFO_MAX_XFER) ||
+        (req->vmo_offset > fifo->vmo_size) ||
+        (req->length > (fifo->vmo_size - req->vmo_offset))) {
+        return ERR_INVALID_ARGS;
+    }
+    // drivers hand the vmo range straight to the hardware, which may
+    // not cope with partial blocks or odd addresses
+    if ((req->length % fifo->blksize) || (req->vmo_offset % fifo->blksize) ||
+        (req->dev_offset % fifo->blksize)) {
+        return ERR_INVALID_ARGS;
+    }
+
+    iotxn_t* txn;
+    mx_status_t r;
+    if ((r = iotxn_alloc_vmo(&txn, 0, fifo->vmo, req->vmo_offset, req->length,
+                             sizeof(fifo_txn_t))) < 0) {
+        return r;
+    }
+    fifo_txn_t* ft = iotxn_to(txn, fifo_txn_t);
+    ft->fifo = fifo;
+    ft->txnid = req->txnid;
+
+    txn->opcode = opcode;
+    txn->offset = req->dev_offset;
+    txn->length = req->length;
+    txn->complete_cb = fifo_txn_complete;
+    txn->cookie = ft;
+
+    mtx_lock(&fifo->lock);
+    fifo->pending++;
+    mtx_unlock(&fifo->lock);
+
+    fifo->dev->ops->iotxn_queue(fifo->dev, txn);
+    return NO_ERROR;
+}
+
+static int fifo_thread(void* arg) {
+    block_fifo_t* fifo = arg;
+    block_fifo_request_t reqs[BLOCK_FIFO_MAX_BATCH];
+
+    for (;;) {
+        mx_signals_state_t pending;
+        mx_status_t r;
+        r = mx_handle_wait_one(fifo->h, MX_SIGNAL_READABLE | MX_SIGNAL_PEER_CLOSED,
+                               MX_TIME_INFINITE, &pending);
+        if (r < 0) {
+            break;
+        }
+        if (!(pending.satisfied & MX_SIGNAL_READABLE)) {
+            // peer closed and nothing left to read
+            break;
+        }
+
+        uint32_t sz = sizeof(reqs);
+        mx_handle_t vmo = 0;
+        uint32_t hcount = 1;
+        if ((r = mx_msgpipe_read(fifo->h, reqs, &sz, &vmo, &hcount, 0)) < 0) {
+            xprintf("block-fifo: read failed %d\n", r);
+            break;
+        }
+        uint32_t count = sz / sizeof(block_fifo_request_t);
+        if ((count == 0) || (sz % sizeof(block_fifo_request_t))) {
+            if (hcount) {
+                mx_handle_close(vmo);
+            }
+            xprintf("block-fifo: malformed batch (%u bytes)\n", sz);
+            break;
+        }
+
+        if (hcount) {
+            if ((count == 1) && (reqs[0].opcode == BLOCK_FIFO_OP_ATTACH_VMO)) {
+                r = fifo_attach_vmo(fifo, vmo);
+            } else {
+                r = ERR_INVALID_ARGS;
+            }
+            if (r < 0) {
+                mx_handle_close(vmo);
+            }
+            fifo_respond(fifo, reqs[0].txnid, r, 0);
+            continue;
+        }
+
+        for (uint32_t n = 0; n < count; n++) {
+            if ((r = fifo_queue(fifo, reqs + n)) < 0) {
+                fifo_respond(fifo, reqs[n].txnid, r, 0);
+            }
+        }
+    }
+
+    // iotxns hold their own vmo handles, but they complete to this fifo
+    mtx_lock(&fifo->lock);
+    while (fifo->pending > 0) {
+        cnd_wait(&fifo->idle, &fifo->lock);
+    }
+    mtx_unlock(&fifo->lock);
+
+    if (fifo->vmo) {
+        mx_handle_close(fifo->vmo);
+    }
+    mx_handle_close(fifo->h);
+    device_close(fifo->dev);
+    free(fifo);
+    return 0;
+}
+
+mx_status_t devhost_block_fifo_create(mx_device_t* dev, mx_handle_t* out) {
+    if (dev->protocol_id != MX_PROTOCOL_BLOCK) {
+        return ERR_NOT_SUPPORTED;
+    }
+
+    block_fifo_t* fifo;
+    if ((fifo = calloc(1, sizeof(block_fifo_t))) == NULL) {
+        return ERR_NO_MEMORY;
+    }
+    mtx_init(&fifo->lock, mtx_plain);
+    cnd_init(&fifo->idle);
+
+    mx_handle_t h[2];
+    mx_status_t r;
+    if ((r = mx_msgpipe_create(h, 0)) < 0) {
+        free(fifo);
+        return r;
+    }
+    fifo->h = h[1];
+
+    // the fifo holds its own open of the device, so it stays
+    // valid after the rpc connection that created it is closed
+    if ((r = device_openat(dev, &fifo->dev, NULL, 0)) < 0) {
+        goto fail;
+    }
+
+    ssize_t rc = fifo->dev->ops->ioctl(fifo->dev, IOCTL_BLOCK_GET_BLOCKSIZE, NULL, 0,
+                                       &fifo->blksize, sizeof(fifo->blksize));
+    if ((rc != sizeof(fifo->blksize)) || (fifo->blksize == 0)) {
+        device_close(fifo->dev);
+        r = (rc < 0) ? rc : ERR_NOT_SUPPORTED;
+        goto fail;
+    }
+
+    thrd_t t;
+    if (thrd_create_with_name(&t, fifo_thread, fifo, "block-fifo") != thrd_success) {
+        device_close(fifo->dev);
+        r = ERR_NO_RESOURCES;
+        goto fail;
+    }
+    thrd_detach(t);
+
+    *out = h[0];
+    return NO_ERROR;
+
+fail:
+    mx_handle_close(h[0]);
+    mx_handle_close(h[1]);
+    free(fifo);
+    return r;
+}
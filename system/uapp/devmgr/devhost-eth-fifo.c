@@ -0,0 +1,314 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "devhost.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+#include <ddk/device.h>
+#include <ddk/protocol/ethernet.h>
+
+#include <magenta/device/ethernet.h>
+#include <magenta/syscalls.h>
+#include <magenta/types.h>
+
+#define MXDEBUG 0
+
+#include <mxio/debug.h>
+
+// how often to retry tx while the driver has no free tx buffers
+// (drivers don't signal when tx buffers are reclaimed)
+#define ETH_FIFO_TX_RETRY MX_MSEC(1)
+
+// frames too long for the client's rx buffer are read into this much
+// scratch space so they can be dropped
+#define ETH_FIFO_SCRATCH_SIZE 16384
+
+// One ethernet fifo per IOCTL_ETHERNET_GET_FIFO.
+//
+// The fifo thread moves frames between the shared rings and the
+// driver's ethernet protocol.  Frames are read and written in place in
+// the client's vmo, and each wakeup services every entry either ring
+// has pending, so there is no rpc and no extra copy per frame.
+typedef struct eth_fifo {
+    mx_device_t* dev;
+    ethernet_protocol_t* proto;
+    size_t mtu;
+
+    mx_handle_t h;
+    mx_handle_t event;
+
+    // attached vmo, mapped into the devhost
+    mx_handle_t vmo;
+    uint64_t vmo_size;
+    uintptr_t base;
+    eth_fifo_rings_t* rings;
+
+    // private copies of the ring indices the device owns, since the
+    // client can write anything it likes to the shared ones
+    uint32_t rx_used;
+    uint32_t tx_used;
+
+    // for dropping oversized frames
+    void* scratch;
+} eth_fifo_t;
+
+static bool fifo_entry_ok(eth_fifo_t* fifo, const eth_fifo_entry_t* e) {
+    return (e->offset >= sizeof(eth_fifo_rings_t)) &&
+           (e->offset <= fifo->vmo_size) &&
+           (e->length <= (fifo->vmo_size - e->offset));
+}
+
+// returns how far the device may advance used, never trusting the
+// client to keep avail within one ring of it
+static uint32_t fifo_ring_avail(eth_fifo_ring_t* ring, uint32_t used) {
+    uint32_t avail = __atomic_load_n(&ring->avail, __ATOMIC_ACQUIRE);
+    if ((avail - used) > ETH_FIFO_RING_SIZE) {
+        avail = used + ETH_FIFO_RING_SIZE;
+    }
+    return avail;
+}
+
+// send every frame queued on the tx ring, returning true if some had
+// to be left for later because the driver is out of tx buffers
+static bool fifo_tx(eth_fifo_t* fifo, bool* done) {
+    eth_fifo_ring_t* ring = &fifo->rings->tx;
+    uint32_t used = fifo->tx_used;
+    uint32_t avail = fifo_ring_avail(ring, used);
+    bool backlog = false;
+
+    while (used != avail) {
+        eth_fifo_entry_t* slot = ring->entries + (used & (ETH_FIFO_RING_SIZE - 1));
+        eth_fifo_entry_t e = *slot;
+        uint16_t flags = 0;
+        if (fifo_entry_ok(fifo, &e)) {
+            mx_status_t r = fifo->proto->send(fifo->dev, (void*)(fifo->base + e.offset), e.length);
+            if ((r == ERR_NO_MEMORY) || (r == ERR_BUFFER_TOO_SMALL)) {
+                backlog = true;
+                break;
+            }
+            if (r < 0) {
+                flags = ETH_FIFO_FLAG_ERROR;
+            }
+        } else {
+            flags = ETH_FIFO_FLAG_ERROR;
+        }
+        slot->flags = flags;
+        used++;
+    }
+
+    if (used != fifo->tx_used) {
+        fifo->tx_used = used;
+        __atomic_store_n(&ring->used, used, __ATOMIC_RELEASE);
+        *done = true;
+    }
+    return backlog;
+}
+
+// fill posted rx buffers with whatever frames the driver has
+static void fifo_rx(eth_fifo_t* fifo, bool* done) {
+    eth_fifo_ring_t* ring = &fifo->rings->rx;
+    uint32_t used = fifo->rx_used;
+    uint32_t avail = fifo_ring_avail(ring, used);
+
+    while (used != avail) {
+        eth_fifo_entry_t* slot = ring->entries + (used & (ETH_FIFO_RING_SIZE - 1));
+        eth_fifo_entry_t e = *slot;
+        if (!fifo_entry_ok(fifo, &e) || (e.length < fifo->mtu)) {
+            slot->length = 0;
+            slot->flags = ETH_FIFO_FLAG_ERROR;
+            used++;
+            continue;
+        }
+        mx_status_t r = fifo->proto->recv(fifo->dev, (void*)(fifo->base + e.offset), e.length);
+        if (r == ERR_INTERNAL) {
+            // the driver dropped a malformed frame, there may be more
+            continue;
+        }
+        if (r == ERR_BUFFER_TOO_SMALL) {
+            // the frame is longer than the mtu, so take it off the driver
+            // and fail the slot rather than leave it blocking the queue
+            r = fifo->proto->recv(fifo->dev, fifo->scratch, ETH_FIFO_SCRATCH_SIZE);
+            if (r == ERR_BUFFER_TOO_SMALL) {
+                xprintf("eth-fifo: cannot drop oversized frame\n");
+                break;
+            }
+            slot->length = 0;
+            slot->flags = ETH_FIFO_FLAG_ERROR;
+            used++;
+            continue;
+        }
+        if (r <= 0) {
+            break;
+        }
+        slot->length = r;
+        slot->flags = 0;
+        used++;
+    }
+
+    if (used != fifo->rx_used) {
+        fifo->rx_used = used;
+        __atomic_store_n(&ring->used, used, __ATOMIC_RELEASE);
+        *done = true;
+    }
+}
+
+static mx_status_t fifo_attach(eth_fifo_t* fifo) {
+    mx_signals_state_t pending;
+    mx_status_t r;
+    if ((r = mx_handle_wait_one(fifo->h, MX_SIGNAL_READABLE | MX_SIGNAL_PEER_CLOSED,
+                                MX_TIME_INFINITE, &pending)) < 0) {
+        return r;
+    }
+    if (!(pending.satisfied & MX_SIGNAL_READABLE)) {
+        return ERR_REMOTE_CLOSED;
+    }
+
+    eth_fifo_attach_t msg;
+    mx_handle_t h[2] = { 0, 0 };
+    uint32_t sz = sizeof(msg);
+    uint32_t hcount = 2;
+    if ((r = mx_msgpipe_read(fifo->h, &msg, &sz, h, &hcount, 0)) < 0) {
+        return r;
+    }
+    if ((sz != sizeof(msg)) || (hcount != 2)) {
+        r = ERR_INVALID_ARGS;
+        goto done;
+    }
+    fifo->vmo = h[0];
+    fifo->event = h[1];
+    if ((r = mx_vmo_get_size(fifo->vmo, &fifo->vmo_size)) < 0) {
+        goto done;
+    }
+    if (fifo->vmo_size < sizeof(eth_fifo_rings_t)) {
+        r = ERR_INVALID_ARGS;
+        goto done;
+    }
+    if ((r = mx_process_map_vm(mx_process_self(), fifo->vmo, 0, fifo->vmo_size, &fifo->base,
+                               MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE)) < 0) {
+        fifo->base = 0;
+        goto done;
+    }
+    fifo->rings = (eth_fifo_rings_t*)fifo->base;
+    fifo->rx_used = fifo->rings->rx.used;
+    fifo->tx_used = fifo->rings->tx.used;
+
+done:
+    msg.status = r;
+    msg.reserved = 0;
+    mx_msgpipe_write(fifo->h, &msg, sizeof(msg), NULL, 0, 0);
+    return r;
+}
+
+static int eth_fifo_thread(void* arg) {
+    eth_fifo_t* fifo = arg;
+
+    if (fifo_attach(fifo) < 0) {
+        goto done;
+    }
+
+    for (;;) {
+        mx_object_signal(fifo->event, ETH_FIFO_SIGNAL_KICK, 0);
+
+        bool done = false;
+        bool backlog = fifo_tx(fifo, &done);
+        fifo_rx(fifo, &done);
+        if (done) {
+            mx_object_signal(fifo->event, 0, ETH_FIFO_SIGNAL_DONE);
+        }
+
+        // only watch for received frames while there are buffers to
+        // put them in, otherwise the device would stay readable
+        mx_handle_t handles[3] = { fifo->h, fifo->event, fifo->dev->event };
+        mx_signals_t signals[3] = {
+            MX_SIGNAL_PEER_CLOSED, ETH_FIFO_SIGNAL_KICK, DEV_STATE_READABLE,
+        };
+        uint32_t count = (fifo_ring_avail(&fifo->rings->rx, fifo->rx_used) != fifo->rx_used) ? 3 : 2;
+        mx_signals_state_t states[3];
+        mx_status_t r = mx_handle_wait_many(count, handles, signals,
+                                            backlog ? ETH_FIFO_TX_RETRY : MX_TIME_INFINITE,
+                                            NULL, states);
+        if (r == ERR_TIMED_OUT) {
+            continue;
+        }
+        if (r < 0) {
+            xprintf("eth-fifo: wait failed %d\n", r);
+            break;
+        }
+        if (states[0].satisfied & MX_SIGNAL_PEER_CLOSED) {
+            break;
+        }
+    }
+
+done:
+    if (fifo->base) {
+        mx_process_unmap_vm(mx_process_self(), fifo->base, 0);
+    }
+    if (fifo->vmo) {
+        mx_handle_close(fifo->vmo);
+    }
+    if (fifo->event) {
+        mx_handle_close(fifo->event);
+    }
+    mx_handle_close(fifo->h);
+    device_close(fifo->dev);
+    free(fifo->scratch);
+    free(fifo);
+    return 0;
+}
+
+mx_status_t devhost_eth_fifo_create(mx_device_t* dev, mx_handle_t* out) {
+    ethernet_protocol_t* proto;
+    if ((dev->protocol_id != MX_PROTOCOL_ETHERNET) ||
+        device_get_protocol(dev, MX_PROTOCOL_ETHERNET, (void**)&proto)) {
+        return ERR_NOT_SUPPORTED;
+    }
+
+    eth_fifo_t* fifo;
+    if ((fifo = calloc(1, sizeof(eth_fifo_t))) == NULL) {
+        return ERR_NO_MEMORY;
+    }
+    fifo->proto = proto;
+    fifo->mtu = proto->get_mtu(dev);
+    if ((fifo->scratch = malloc(ETH_FIFO_SCRATCH_SIZE)) == NULL) {
+        free(fifo);
+        return ERR_NO_MEMORY;
+    }
+
+    mx_handle_t h[2];
+    mx_status_t r;
+    if ((r = mx_msgpipe_create(h, 0)) < 0) {
+        free(fifo->scratch);
+        free(fifo);
+        return r;
+    }
+    fifo->h = h[1];
+
+    // the fifo holds its own open of the device, so it stays
+    // valid after the rpc connection that created it is closed
+    if ((r = device_openat(dev, &fifo->dev, NULL, 0)) < 0) {
+        goto fail;
+    }
+
+    thrd_t t;
+    if (thrd_create_with_name(&t, eth_fifo_thread, fifo, "eth-fifo") != thrd_success) {
+        device_close(fifo->dev);
+        r = ERR_NO_RESOURCES;
+        goto fail;
+    }
+    thrd_detach(t);
+
+    *out = h[0];
+    return NO_ERROR;
+
+fail:
+    mx_handle_close(h[0]);
+    mx_handle_close(h[1]);
+    free(fifo->scratch);
+    free(fifo);
+    return r;
+}
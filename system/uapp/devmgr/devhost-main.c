@@ -99,6 +99,7 @@ mx_status_t devmgr_control(const char* cmd) {
                "kerneldebug - send a command to the kernel\n"
                "ktraceoff   - stop kernel tracing\n"
                "ktraceon    - start kernel tracing\n"
+               "ktracemode  - set kernel trace buffer mode (linear, flight, stream)\n"
                "acpi-ps0    - invoke the _PS0 method on an acpi object\n"
                );
         return NO_ERROR;
@@ -129,6 +130,21 @@ mx_status_t devmgr_control(const char* cmd) {
         mx_ktrace_control(get_root_resource(), KTRACE_ACTION_REWIND, 0);
         return NO_ERROR;
     }
+    const char* modeprefix = "ktracemode:";
+    if (!strncmp(cmd, modeprefix, strlen(modeprefix))) {
+        const char* arg = cmd + strlen(modeprefix);
+        uint32_t mode;
+        if (!strcmp(arg, "linear")) {
+            mode = KTRACE_MODE_LINEAR;
+        } else if (!strcmp(arg, "flight")) {
+            mode = KTRACE_MODE_FLIGHT;
+        } else if (!strcmp(arg, "stream")) {
+            mode = KTRACE_MODE_STREAM;
+        } else {
+            return ERR_INVALID_ARGS;
+        }
+        return mx_ktrace_control(get_root_resource(), KTRACE_ACTION_MODE, mode);
+    }
     const char* ps0prefix = "acpi-ps0:";
     if (!strncmp(cmd, ps0prefix, strlen(ps0prefix))) {
         char* arg = (char*)cmd + strlen(ps0prefix);
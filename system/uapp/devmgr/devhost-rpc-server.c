@@ -5,7 +5,6 @@
 #include "devhost.h"
 #include "device-internal.h"
 
-#include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -18,6 +17,8 @@
 #include <ddk/iotxn.h>
 #include <ddk/protocol/device.h>
 
+#include <magenta/device/block.h>
+#include <magenta/device/ethernet.h>
 #include <magenta/processargs.h>
 #include <magenta/syscalls.h>
 #include <magenta/types.h>
@@ -101,14 +102,17 @@ static void sync_io_complete(iotxn_t* txn, void* cookie) {
 }
 
 static ssize_t do_sync_io(mx_device_t* dev, uint32_t opcode, void* buf, size_t count, mx_off_t off) {
+    // larger transfers go through the block fifo (IOCTL_BLOCK_GET_FIFO)
+    if (count > MXIO_CHUNK_SIZE) {
+        return ERR_INVALID_ARGS;
+    }
+
     iotxn_t* txn;
-    mx_status_t status = iotxn_alloc(&txn, 0, MXIO_CHUNK_SIZE, 0);
+    mx_status_t status = iotxn_alloc(&txn, 0, count, 0);
     if (status != NO_ERROR) {
         return status;
     }
 
-    assert(count <= MXIO_CHUNK_SIZE);
-
     completion_t completion = COMPLETION_INIT;
 
     txn->opcode = opcode;
@@ -187,6 +191,22 @@ static ssize_t do_ioctl(mx_device_t* dev, uint32_t op, const void* in_buf, size_
         }
         break;
     }
+    case IOCTL_BLOCK_GET_FIFO: {
+        if (out_len < sizeof(mx_handle_t)) {
+            r = ERR_BUFFER_TOO_SMALL;
+        } else if ((r = devhost_block_fifo_create(dev, out_buf)) == NO_ERROR) {
+            r = sizeof(mx_handle_t);
+        }
+        break;
+    }
+    case IOCTL_ETHERNET_GET_FIFO: {
+        if (out_len < sizeof(mx_handle_t)) {
+            r = ERR_BUFFER_TOO_SMALL;
+        } else if ((r = devhost_eth_fifo_create(dev, out_buf)) == NO_ERROR) {
+            r = sizeof(mx_handle_t);
+        }
+        break;
+    }
     default:
         r = dev->ops->ioctl(dev, op, in_buf, in_len, out_buf, out_len);
     }
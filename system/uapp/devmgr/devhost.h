@@ -52,6 +52,14 @@ typedef struct iostate {
 iostate_t* create_iostate(mx_device_t* dev);
 mx_status_t devhost_rio_handler(mxrio_msg_t* msg, mx_handle_t rh, void* cookie);
 
+// creates a block fifo server for dev (see magenta/device/block.h)
+// returning the client end of its pipe
+mx_status_t devhost_block_fifo_create(mx_device_t* dev, mx_handle_t* out);
+
+// creates an ethernet fifo server for dev (see magenta/device/ethernet.h)
+// returning the client end of its pipe
+mx_status_t devhost_eth_fifo_create(mx_device_t* dev, mx_handle_t* out);
+
 // routines devhost uses to talk to devmgr
 mx_status_t devhost_add(mx_device_t* dev, mx_device_t* child);
 mx_status_t devhost_remove(mx_device_t* dev);
@@ -10,6 +10,8 @@
 #include <mxio/vfs.h>
 
 #include <fcntl.h>
+#include <magenta/syscalls.h>
+#include <mxio/io.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
@@ -19,14 +21,16 @@
 
 #define MXDEBUG 0
 
-#define MAXBLOCKS 64
-#define BLOCKSIZE 8192
+// File data lives in a vmo which is handed out as-is to mmap()
+// and to positioned reads, so memfs files are their own page cache.
+// Vmos cannot grow, so each one is sized for the largest file.
+#define MAXSIZE (64 * 8192)
 
 typedef struct mnode mnode_t;
 struct mnode {
     vnode_t vn;
     size_t datalen;
-    uint8_t* block[MAXBLOCKS];
+    mx_handle_t vmo;
 };
 
 mx_status_t mem_get_node(vnode_t** out, mx_device_t* dev);
@@ -36,10 +40,8 @@ static void mem_release(vnode_t* vn) {
     printf("memfs: vn %p destroyed\n", vn);
 
     mnode_t* mem = vn->pdata;
-    for (int i = 0; i < MAXBLOCKS; i++) {
-        if (mem->block[i]) {
-            free(mem->block[i]);
-        }
+    if (mem->vmo > 0) {
+        mx_handle_close(mem->vmo);
     }
     free(mem);
 }
@@ -58,70 +60,73 @@ mx_status_t memfs_close(vnode_t* vn) {
     return NO_ERROR;
 }
 
-static ssize_t mem_read(vnode_t* vn, void* _data, size_t len, size_t off) {
+static ssize_t mem_read(vnode_t* vn, void* data, size_t len, size_t off) {
     mnode_t* mem = vn->pdata;
-    uint8_t* data = _data;
-    ssize_t count = 0;
     if (off >= mem->datalen)
         return 0;
     if (len > (mem->datalen - off))
         len = mem->datalen - off;
+    return mx_vmo_read(mem->vmo, data, off, len);
+}
 
-    size_t bno = off / BLOCKSIZE;
-    off = off % BLOCKSIZE;
-    while (len > 0) {
-        size_t xfer = (BLOCKSIZE - off);
-        if (len < xfer)
-            xfer = len;
-        if (mem->block[bno] == NULL) {
-            xprintf("mem_read: hole at %zu\n", bno);
-            memset(data, 0, xfer);
-        } else {
-            memcpy(data, mem->block[bno] + off, xfer);
-        }
-        data += xfer;
-        len -= xfer;
-        count += xfer;
-        bno++;
-        off = 0;
+static mx_status_t mem_get_vmo(mnode_t* mem) {
+    if (mem->vmo > 0) {
+        return NO_ERROR;
     }
-    return count;
+    mx_handle_t vmo = mx_vmo_create(MAXSIZE);
+    if (vmo < 0) {
+        return ERR_NO_MEMORY;
+    }
+    mem->vmo = vmo;
+    return NO_ERROR;
 }
 
-static ssize_t mem_write(vnode_t* vn, const void* _data, size_t len, size_t off) {
+static ssize_t mem_write(vnode_t* vn, const void* data, size_t len, size_t off) {
     mnode_t* mem = vn->pdata;
-    const uint8_t* data = _data;
-    ssize_t count = 0;
-    size_t bno = off / BLOCKSIZE;
-    off = off % BLOCKSIZE;
-    while (len > 0) {
-        size_t xfer = (BLOCKSIZE - off);
-        if (len < xfer)
-            xfer = len;
-        if (bno >= MAXBLOCKS) {
-            return count ? count : ERR_NO_MEMORY;
-        }
-        if (mem->block[bno] == NULL) {
-            xprintf("mem_write: alloc at %zu\n", bno);
-            if ((mem->block[bno] = calloc(1, BLOCKSIZE)) == NULL) {
-                return count ? count : ERR_NO_MEMORY;
-            }
-        }
-        memcpy(mem->block[bno] + off, data, xfer);
-
-        size_t pos = bno * BLOCKSIZE + off + xfer;
-        if (pos > mem->datalen)
-            mem->datalen = pos;
-
-        data += xfer;
-        len -= xfer;
-        count += xfer;
-        bno++;
-        off = 0;
+    if (off >= MAXSIZE) {
+        return ERR_NO_MEMORY;
+    }
+    if (len > (MAXSIZE - off))
+        len = MAXSIZE - off;
+    mx_status_t r;
+    if ((r = mem_get_vmo(mem)) < 0) {
+        return r;
+    }
+    mx_ssize_t count = mx_vmo_write(mem->vmo, data, off, len);
+    if (count > 0) {
+        if ((off + count) > mem->datalen)
+            mem->datalen = off + count;
     }
     return count;
 }
 
+// Writes through a writable mapping land directly in the file data
+// but, as with other systems, do not extend the file.
+static mx_status_t mem_mmap(vnode_t* vn, uint32_t flags, mx_handle_t* out, size_t* len) {
+    mnode_t* mem = vn->pdata;
+    if (vn->dnode != NULL) {
+        return ERR_NOT_SUPPORTED;
+    }
+    mx_status_t r;
+    if ((r = mem_get_vmo(mem)) < 0) {
+        return r;
+    }
+    mx_rights_t rights = MX_RIGHT_DUPLICATE | MX_RIGHT_TRANSFER | MX_RIGHT_READ | MX_RIGHT_MAP;
+    if (flags & MXIO_MMAP_FLAG_WRITE) {
+        rights |= MX_RIGHT_WRITE;
+    }
+    if (flags & MXIO_MMAP_FLAG_EXEC) {
+        rights |= MX_RIGHT_EXECUTE;
+    }
+    mx_handle_t h = mx_handle_duplicate(mem->vmo, rights);
+    if (h < 0) {
+        return h;
+    }
+    *out = h;
+    *len = mem->datalen;
+    return NO_ERROR;
+}
+
 mx_status_t memfs_rename(vnode_t* olddir, vnode_t* newdir,
                          const char* oldname, size_t oldlen,
                          const char* newname, size_t newlen) {
@@ -280,6 +285,7 @@ static vnode_ops_t vn_mem_ops = {
     .create = mem_create,
     .unlink = memfs_unlink,
     .rename = memfs_rename,
+    .mmap = mem_mmap,
 };
 
 static vnode_ops_t vn_mem_ops_dir = {
@@ -320,8 +320,13 @@ static ssize_t do_ioctl(vnode_t* vn, uint32_t op, const void* in_buf, size_t in_
         memcpy(out_buf, h, sizeof(mx_handle_t));
         return sizeof(mx_handle_t);
     }
-    default:
-        return vn->ops->ioctl(vn, op, in_buf, in_len, out_buf, out_len);
+    default: {
+        ssize_t r;
+        mtx_lock(&vfs_lock);
+        r = vn->ops->ioctl(vn, op, in_buf, in_len, out_buf, out_len);
+        mtx_unlock(&vfs_lock);
+        return r;
+    }
     }
 }
 
@@ -353,7 +358,9 @@ static mx_status_t _vfs_handler(mxrio_msg_t* msg, mx_handle_t rh, void* cookie)
     }
     case MXRIO_CLOSE:
         // this will drop the ref on the vn
+        mtx_lock(&vfs_lock);
         vn->ops->close(vn);
+        mtx_unlock(&vfs_lock);
         untrack_iostate(ios);
         free(ios);
         return NO_ERROR;
@@ -365,7 +372,9 @@ static mx_status_t _vfs_handler(mxrio_msg_t* msg, mx_handle_t rh, void* cookie)
         msg->hcount = 1;
         return NO_ERROR;
     case MXRIO_READ: {
+        mtx_lock(&vfs_lock);
         ssize_t r = vn->ops->read(vn, msg->data, arg, ios->io_off);
+        mtx_unlock(&vfs_lock);
         if (r >= 0) {
             ios->io_off += r;
             msg->arg2.off = ios->io_off;
@@ -374,14 +383,18 @@ static mx_status_t _vfs_handler(mxrio_msg_t* msg, mx_handle_t rh, void* cookie)
         return r;
     }
     case MXRIO_READ_AT: {
+        mtx_lock(&vfs_lock);
         ssize_t r = vn->ops->read(vn, msg->data, arg, msg->arg2.off);
+        mtx_unlock(&vfs_lock);
         if (r >= 0) {
             msg->datalen = r;
         }
         return r;
     }
     case MXRIO_WRITE: {
+        mtx_lock(&vfs_lock);
         ssize_t r = vn->ops->write(vn, msg->data, len, ios->io_off);
+        mtx_unlock(&vfs_lock);
         if (r >= 0) {
             ios->io_off += r;
             msg->arg2.off = ios->io_off;
@@ -389,13 +402,18 @@ static mx_status_t _vfs_handler(mxrio_msg_t* msg, mx_handle_t rh, void* cookie)
         return r;
     }
     case MXRIO_WRITE_AT: {
+        mtx_lock(&vfs_lock);
         ssize_t r = vn->ops->write(vn, msg->data, len, msg->arg2.off);
+        mtx_unlock(&vfs_lock);
         return r;
     }
     case MXRIO_SEEK: {
         vnattr_t attr;
         mx_status_t r;
-        if ((r = vn->ops->getattr(vn, &attr)) < 0) {
+        mtx_lock(&vfs_lock);
+        r = vn->ops->getattr(vn, &attr);
+        mtx_unlock(&vfs_lock);
+        if (r < 0) {
             return r;
         }
         size_t n;
@@ -454,7 +472,10 @@ static mx_status_t _vfs_handler(mxrio_msg_t* msg, mx_handle_t rh, void* cookie)
     case MXRIO_STAT: {
         mx_status_t r;
         msg->datalen = sizeof(vnattr_t);
-        if ((r = vn->ops->getattr(vn, (vnattr_t*)msg->data)) < 0) {
+        mtx_lock(&vfs_lock);
+        r = vn->ops->getattr(vn, (vnattr_t*)msg->data);
+        mtx_unlock(&vfs_lock);
+        if (r < 0) {
             return r;
         }
         return msg->datalen;
@@ -504,20 +525,27 @@ static mx_status_t _vfs_handler(mxrio_msg_t* msg, mx_handle_t rh, void* cookie)
         }
         vnode_t* oldparent, *newparent;
         mx_status_t r1, r2;
+        mtx_lock(&vfs_lock);
         if ((r1 = vfs_walk(vn, &oldparent, oldpath, &oldpath)) < 0) {
+            mtx_unlock(&vfs_lock);
             return r1;
         } else if ((r2 = vfs_walk(vn, &newparent, newpath, &newpath)) < 0) {
+            mtx_unlock(&vfs_lock);
             return r2;
         } else if (r1 != r2) {
             // Rename can only be directed to one filesystem
+            mtx_unlock(&vfs_lock);
             return ERR_NOT_SUPPORTED;
         }
 
         if (r1 == 0) {
             // Local filesystem
-            return vn->ops->rename(oldparent, newparent, oldpath,
-                                   strlen(oldpath), newpath, strlen(newpath));
+            r1 = vn->ops->rename(oldparent, newparent, oldpath,
+                                 strlen(oldpath), newpath, strlen(newpath));
+            mtx_unlock(&vfs_lock);
+            return r1;
         } else {
+            mtx_unlock(&vfs_lock);
             // Remote filesystem
             if ((r1 = txn_handoff_rename(r1, rh, oldpath, newpath)) < 0) {
                 return r1;
@@ -525,18 +553,44 @@ static mx_status_t _vfs_handler(mxrio_msg_t* msg, mx_handle_t rh, void* cookie)
             return ERR_DISPATCHER_INDIRECT;
         }
     }
-    case MXRIO_UNLINK:
-        return vn->ops->unlink(vn, (const char*)msg->data, len);
+    case MXRIO_UNLINK: {
+        mx_status_t r;
+        mtx_lock(&vfs_lock);
+        r = vn->ops->unlink(vn, (const char*)msg->data, len);
+        mtx_unlock(&vfs_lock);
+        return r;
+    }
+    case MXRIO_MMAP: {
+        if (vn->ops->mmap == NULL) {
+            return ERR_NOT_SUPPORTED;
+        }
+        size_t flen;
+        mx_status_t r;
+        mtx_lock(&vfs_lock);
+        r = vn->ops->mmap(vn, arg, &msg->handle[0], &flen);
+        mtx_unlock(&vfs_lock);
+        if (r < 0) {
+            return r;
+        }
+        msg->arg2.off = flen;
+        msg->hcount = 1;
+        return NO_ERROR;
+    }
     default:
         return ERR_NOT_SUPPORTED;
     }
 }
 
+// number of threads serving vfs requests
+#define VFS_RPC_THREADS 4
+
 static mxio_dispatcher_t* vfs_dispatcher;
 
 static volatile int vfs_txn = -1;
 static int vfs_txn_no = 0;
 
+// with several workers, these only track the most recently
+// started transaction, which is good enough for the watchdog
 static mx_status_t vfs_handler(mxrio_msg_t* msg, mx_handle_t rh, void* cookie) {
     vfs_txn_no = (vfs_txn_no + 1) & 0x0FFFFFFF;
     vfs_txn = vfs_txn_no;
@@ -600,23 +654,23 @@ static int vfs_watchdog(void* arg) {
 void vfs_init(vnode_t* root) {
     vfs_root = root;
     if (mxio_dispatcher_create(&vfs_dispatcher, mxrio_handler) == NO_ERROR) {
-        mxio_dispatcher_start(vfs_dispatcher, "vfs-rio-dispatcher");
+        mxio_dispatcher_start_pool(vfs_dispatcher, "vfs-rio-dispatcher", VFS_RPC_THREADS);
     }
     thrd_t t;
     thrd_create_with_name(&t, vfs_watchdog, NULL, "vfs-watchdog");
 }
 
 void vn_acquire(vnode_t* vn) {
-    vn->refcount++;
+    __atomic_fetch_add(&vn->refcount, 1, __ATOMIC_RELAXED);
 }
 
 void vn_release(vnode_t* vn) {
-    if (vn->refcount == 0) {
+    uint32_t old = __atomic_fetch_sub(&vn->refcount, 1, __ATOMIC_ACQ_REL);
+    if (old == 0) {
         printf("vn %p: ref underflow\n", vn);
         panic();
     }
-    vn->refcount--;
-    if (vn->refcount == 0) {
+    if (old == 1) {
         vn->ops->release(vn);
     }
 }
@@ -88,7 +88,9 @@ ssize_t memfs_ioctl(vnode_t* vn, uint32_t op, const void* in_data, size_t in_len
 
 mx_status_t vfs_install_remote(vnode_t* vn, mx_handle_t h);
 
-// big vfs lock protects lookup and walk operations
+// big vfs lock protects lookup and walk operations, and all
+// local (memfs, bootfs, devfs) vnode state, as the vfs rpc
+// server runs requests on several threads
 //TODO: finer grained locking
 extern mtx_t vfs_lock;
 
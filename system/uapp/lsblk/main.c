@@ -2,6 +2,8 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <block-client/client.h>
+#include <magenta/syscalls.h>
 #include <magenta/types.h>
 #include <mxio/io.h>
 #include <dirent.h>
@@ -11,6 +13,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <limits.h>
+#include <sys/param.h>
 
 #include <magenta/device/block.h>
 #include <magenta/device/device.h>
@@ -133,31 +136,111 @@ static int cmd_read_blk(const char* dev, off_t offset, size_t count) {
         goto out;
     }
 
-    // read the data
-    void* buf = malloc(count);
-    if (offset) {
-        rc = lseek(fd, offset, SEEK_SET);
-        if (rc < 0) {
-            printf("Error %d seeking to offset %lld\n", rc, offset);
-            goto out2;
-        }
+    // read the data, in as many requests as it takes, all at once
+    mx_handle_t vmo = 0;
+    uintptr_t base = 0;
+    block_client_t* client = NULL;
+    block_fifo_request_t* reqs = NULL;
+    if ((vmo = mx_vmo_create(count)) < 0) {
+        printf("Error %d creating vmo\n", vmo);
+        rc = vmo;
+        goto out;
+    }
+    rc = mx_process_map_vm(mx_process_self(), vmo, 0, count, &base, MX_VM_FLAG_PERM_READ);
+    if (rc < 0) {
+        printf("Error %d mapping vmo\n", rc);
+        goto out2;
+    }
+    if ((rc = block_client_create(fd, vmo, &client)) < 0) {
+        printf("Error %d setting up block fifo for %s\n", rc, dev);
+        goto out2;
+    }
+    size_t n = (count + BLOCK_FIFO_MAX_XFER - 1) / BLOCK_FIFO_MAX_XFER;
+    if ((reqs = calloc(n, sizeof(block_fifo_request_t))) == NULL) {
+        rc = ERR_NO_MEMORY;
+        goto out2;
+    }
+    for (size_t i = 0; i < n; i++) {
+        size_t at = i * BLOCK_FIFO_MAX_XFER;
+        reqs[i].opcode = BLOCK_FIFO_OP_READ;
+        reqs[i].length = MIN(count - at, (size_t)BLOCK_FIFO_MAX_XFER);
+        reqs[i].vmo_offset = at;
+        reqs[i].dev_offset = offset + at;
     }
-    ssize_t c = read(fd, buf, count);
-    if (c < 0) {
-        printf("Error %zd in read()\n", c);
-        rc = c;
+    if ((rc = block_client_transact(client, reqs, n)) < 0) {
+        printf("Error %d in read\n", rc);
         goto out2;
     }
 
-    hexdump8_ex(buf, c, offset);
+    hexdump8_ex((void*)base, count, offset);
 
 out2:
-    free(buf);
+    free(reqs);
+    if (client) {
+        block_client_destroy(client);
+    }
+    if (base) {
+        mx_process_unmap_vm(mx_process_self(), base, 0);
+    }
+    if (vmo > 0) {
+        mx_handle_close(vmo);
+    }
 out:
     close(fd);
     return 0;
 }
 
+static int cmd_stats_blk(const char* dev) {
+    int fd = open(dev, O_RDONLY);
+    if (fd < 0) {
+        printf("Error opening %s\n", dev);
+        return fd;
+    }
+    block_stats_t stats;
+    int rc = mxio_ioctl(fd, IOCTL_BLOCK_GET_STATS, NULL, 0, &stats, sizeof(stats));
+    close(fd);
+    if (rc < 0) {
+        printf("Error %d getting stats for %s\n", rc, dev);
+        return rc;
+    }
+    uint64_t secs = stats.elapsed / 1000000000ULL;
+    printf("ops %llu commands %llu merged %llu in %llus\n",
+           stats.ops, stats.commands, stats.merged, secs);
+    if (stats.elapsed) {
+        printf("iops %llu\n", stats.ops * 1000000000ULL / stats.elapsed);
+    }
+    if (stats.busy_time) {
+        printf("queue depth avg %llu.%02llu max %u now %u\n",
+               stats.depth_time / stats.busy_time,
+               (stats.depth_time % stats.busy_time) * 100 / stats.busy_time,
+               stats.max_depth, stats.depth);
+    }
+    return 0;
+}
+
+static int cmd_sched_blk(const char* dev, const char* name) {
+    uint32_t sched;
+    if (!strcmp(name, "fifo")) {
+        sched = BLOCK_SCHED_FIFO;
+    } else if (!strcmp(name, "deadline")) {
+        sched = BLOCK_SCHED_DEADLINE;
+    } else {
+        printf("Unknown scheduler %s\n", name);
+        return -1;
+    }
+    int fd = open(dev, O_RDWR);
+    if (fd < 0) {
+        printf("Error opening %s\n", dev);
+        return fd;
+    }
+    int rc = mxio_ioctl(fd, IOCTL_BLOCK_SET_SCHED, &sched, sizeof(sched), NULL, 0);
+    close(fd);
+    if (rc < 0) {
+        printf("Error %d setting scheduler for %s\n", rc, dev);
+    }
+    return rc;
+}
+
 int main(int argc, const char** argv) {
     int rc = 0;
     const char *cmd = argc > 1 ? argv[1] : NULL;
@@ -167,6 +250,12 @@ int main(int argc, const char** argv) {
         } else if (!strcmp(cmd, "read")) {
             if (argc < 5) goto usage;
             rc = cmd_read_blk(argv[2], strtoul(argv[3], NULL, 10), strtoull(argv[4], NULL, 10));
+        } else if (!strcmp(cmd, "stats")) {
+            if (argc < 3) goto usage;
+            rc = cmd_stats_blk(argv[2]);
+        } else if (!strcmp(cmd, "sched")) {
+            if (argc < 4) goto usage;
+            rc = cmd_sched_blk(argv[2], argv[3]);
         } else {
             printf("Unrecognized command %s!\n", cmd);
             goto usage;
@@ -179,5 +268,7 @@ usage:
     printf("Usage:\n");
     printf("%s\n", argv[0]);
     printf("%s read <blkdev> <offset> <count>\n", argv[0]);
+    printf("%s stats <blkdev>\n", argv[0]);
+    printf("%s sched <blkdev> fifo|deadline\n", argv[0]);
     return 0;
 }
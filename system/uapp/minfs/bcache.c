@@ -6,11 +6,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <threads.h>
 #include <unistd.h>
 #include <sys/types.h>
 
 #include <magenta/listnode.h>
 
+#ifdef __Fuchsia__
+#include <block-client/client.h>
+#include <magenta/syscalls.h>
+#endif
+
 #include "minfs.h"
 #include "minfs-private.h"
 
@@ -20,7 +26,7 @@
 
 #define BLOCK_FLAGS 0xF
 
-static int readblk(int fd, uint32_t bno, void* data) {
+static int _readblk(int fd, uint32_t bno, void* data) {
     off_t off = bno * MINFS_BLOCK_SIZE;
     trace(IO, "readblk() bno=%u off=%#llx\n", bno, (unsigned long long)off);
     if (lseek(fd, off, SEEK_SET) < 0) {
@@ -34,7 +40,7 @@ static int readblk(int fd, uint32_t bno, void* data) {
     return 0;
 }
 
-static int writeblk(int fd, uint32_t bno, void* data) {
+static int _writeblk(int fd, uint32_t bno, void* data) {
     off_t off = bno * MINFS_BLOCK_SIZE;
     trace(IO, "writeblk() bno=%u off=%#llx\n", bno, (unsigned long long)off);
     if (lseek(fd, off, SEEK_SET) < 0) {
@@ -56,7 +62,21 @@ struct block {
     void* data;
 };
 
+// The cache lock protects the lists, the hash, and block flags.
+// A block marked BLOCK_BUSY belongs to one thread (including
+// while it is being read from or written to disk, which happens
+// without the cache lock held) and others wait on the condition
+// variable for it to be put back.
+//
+// A thread may hold several blocks at once, so when every block
+// is busy nobody waits for one to come free (all the holders
+// could be waiting too); instead a BLOCK_OVERFLOW block is taken
+// from the heap and freed again when it is put back.
 struct bcache {
+    mtx_t lock;
+    cnd_t cond;
+    // seek + read/write on the fd must not interleave
+    mtx_t io_lock;
     list_node_t list_busy;  // between bcache_get() and bcache_put()
     list_node_t list_dirty; // waiting for write
     list_node_t list_lru;   // available for re-use
@@ -65,8 +85,66 @@ struct bcache {
     int fd;
     uint32_t blocksize;
     uint32_t blockmax;
+#ifdef __Fuchsia__
+    // block data lives in this vmo, and when the device speaks the
+    // block fifo protocol, io moves directly between it and the disk
+    // with no fd lock, so every thread can have a request in flight
+    mx_handle_t vmo;
+    uintptr_t vmo_base;
+    size_t vmo_size;
+    block_client_t* client;
+#endif
 };
 
+#ifdef __Fuchsia__
+static int fifo_io(bcache_t* bc, uint32_t opcode, uint32_t bno, void* data) {
+    block_fifo_request_t req = {
+        .opcode = opcode,
+        .length = bc->blocksize,
+        .vmo_offset = (uintptr_t)data - bc->vmo_base,
+        .dev_offset = (uint64_t)bno * bc->blocksize,
+    };
+    mx_status_t r;
+    if ((r = block_client_transact(bc->client, &req, 1)) < 0) {
+        error("minfs: fifo %s of block %u failed %d\n",
+              (opcode == BLOCK_FIFO_OP_READ) ? "read" : "write", bno, r);
+        return -1;
+    }
+    return 0;
+}
+
+// overflow blocks live on the heap, outside the vmo the fifo uses
+static bool fifo_ok(bcache_t* bc, void* data) {
+    return (bc->client != NULL) &&
+           ((uintptr_t)data >= bc->vmo_base) &&
+           ((uintptr_t)data - bc->vmo_base < bc->vmo_size);
+}
+#endif
+
+static int readblk(bcache_t* bc, uint32_t bno, void* data) {
+#ifdef __Fuchsia__
+    if (fifo_ok(bc, data)) {
+        return fifo_io(bc, BLOCK_FIFO_OP_READ, bno, data);
+    }
+#endif
+    mtx_lock(&bc->io_lock);
+    int r = _readblk(bc->fd, bno, data);
+    mtx_unlock(&bc->io_lock);
+    return r;
+}
+
+static int writeblk(bcache_t* bc, uint32_t bno, void* data) {
+#ifdef __Fuchsia__
+    if (fifo_ok(bc, data)) {
+        return fifo_io(bc, BLOCK_FIFO_OP_WRITE, bno, data);
+    }
+#endif
+    mtx_lock(&bc->io_lock);
+    int r = _writeblk(bc->fd, bno, data);
+    mtx_unlock(&bc->io_lock);
+    return r;
+}
+
 #define bno_hash(bno) fnv1a_tiny(bno, MINFS_HASH_BITS)
 
 static_assert((1<<MINFS_HASH_BITS) == MINFS_BUCKETS,
@@ -90,11 +168,13 @@ static const char* modestr(uint32_t mode) {
 }
 
 #define BLOCK_BUSY 0x10
+#define BLOCK_OVERFLOW 0x20
 
 
 void bcache_invalidate(bcache_t* bc) {
     block_t* blk;
     uint32_t n = 0;
+    mtx_lock(&bc->lock);
     while ((blk = list_remove_head_type(&bc->list_lru, block_t, listnode)) != NULL) {
         if (blk->flags & BLOCK_BUSY) {
             panic("blk %p bno %u is busy on lru\n", blk, blk->bno);
@@ -104,6 +184,7 @@ void bcache_invalidate(bcache_t* bc) {
         list_add_tail(&bc->list_free, &blk->listnode);
         n++;
     }
+    mtx_unlock(&bc->lock);
     trace(BCACHE, "[ %d blocks dropped ]\n", n);
 }
 
@@ -114,13 +195,19 @@ static block_t* _bcache_get(bcache_t* bc, uint32_t bno, void** data, uint32_t mo
     }
     block_t* blk;
     uint32_t bucket = bno_hash(bno);
+    mtx_lock(&bc->lock);
+again:
     list_for_every_entry(bc->hash + bucket, blk, block_t, hashnode) {
         if (blk->bno == bno) {
             if (blk->flags & BLOCK_BUSY) {
-                panic("blk %p bno %u is busy\n", blk, bno);
+                // in use by (or being loaded for) another thread
+                cnd_wait(&bc->cond, &bc->lock);
+                goto again;
             }
             // remove from dirty or lru
             list_delete(&blk->listnode);
+            blk->flags |= BLOCK_BUSY;
+            list_add_tail(&bc->list_busy, &blk->listnode);
             goto done;
         }
     }
@@ -135,24 +222,38 @@ static block_t* _bcache_get(bcache_t* bc, uint32_t bno, void** data, uint32_t mo
             }
             // remove from hash, bno to be reassigned
             list_delete(&blk->hashnode);
+        } else if ((blk = calloc(1, sizeof(block_t))) != NULL) {
+            // every block is busy, borrow one for now
+            trace(BCACHE, "bcache: out of blocks, overflowing\n");
+            if ((blk->data = malloc(bc->blocksize)) == NULL) {
+                free(blk);
+                blk = NULL;
+                goto done;
+            }
+            blk->flags = BLOCK_OVERFLOW;
         } else {
-            panic("bcache: out of blocks\n");
+            goto done;
         }
         blk->bno = bno;
+        blk->flags |= BLOCK_BUSY;
         list_add_tail(bc->hash + bucket, &blk->hashnode);
+        list_add_tail(&bc->list_busy, &blk->listnode);
         if (mode == MODE_ZERO) {
             blk->flags |= BLOCK_DIRTY;
             memset(blk->data, 0, bc->blocksize);
         } else {
-            if (readblk(bc->fd, bno, blk->data) < 0) {
+            // the block is busy and hashed, so anyone else
+            // looking for it will wait until the read is done
+            mtx_unlock(&bc->lock);
+            if (readblk(bc, bno, blk->data) < 0) {
                 panic("bcache: bno %u read error!\n", bno);
             }
+            mtx_lock(&bc->lock);
         }
     }
 done:
+    mtx_unlock(&bc->lock);
     if (blk) {
-        blk->flags |= BLOCK_BUSY;
-        list_add_tail(&bc->list_busy, &blk->listnode);
         *data = blk->data;
     }
     trace(BCACHE, "bcache_get bno=%u %p\n", bno, blk);
@@ -169,20 +270,34 @@ block_t* bcache_get_zero(bcache_t* bc, uint32_t bno, void** bdata) {
 
 void bcache_put(bcache_t* bc, block_t* blk, uint32_t flags) {
     trace(BCACHE, "bcache_put() bno=%u%s\n", blk->bno, (flags & BLOCK_DIRTY) ? " DIRTY" : "");
+    mtx_lock(&bc->lock);
     if (!(blk->flags & BLOCK_BUSY)) {
         panic("bcache_put() bno=%u NOT BUSY!\n", blk->bno);
     }
     // remove from busy list
     list_delete(&blk->listnode);
     if ((flags | blk->flags) & BLOCK_DIRTY) {
-        if (writeblk(bc->fd, blk->bno, blk->data) < 0) {
+        // still busy, so nobody else touches it during the write
+        mtx_unlock(&bc->lock);
+        if (writeblk(bc, blk->bno, blk->data) < 0) {
             error("block write error!\n");
         }
+        mtx_lock(&bc->lock);
         blk->flags &= (~(BLOCK_DIRTY|BLOCK_BUSY));
     } else {
         blk->flags &= (~BLOCK_BUSY);
     }
+    if (blk->flags & BLOCK_OVERFLOW) {
+        list_delete(&blk->hashnode);
+        cnd_broadcast(&bc->cond);
+        mtx_unlock(&bc->lock);
+        free(blk->data);
+        free(blk);
+        return;
+    }
     list_add_tail(&bc->list_lru, &blk->listnode);
+    cnd_broadcast(&bc->cond);
+    mtx_unlock(&bc->lock);
 }
 
 mx_status_t bcache_read(bcache_t* bc, uint32_t bno, void* data, uint32_t off, uint32_t len) {
@@ -201,6 +316,32 @@ mx_status_t bcache_read(bcache_t* bc, uint32_t bno, void* data, uint32_t off, ui
     }
 }
 
+#ifdef __Fuchsia__
+static mx_status_t bcache_init_vmo(bcache_t* bc, uint32_t num) {
+    size_t size = (size_t)num * bc->blocksize;
+    mx_handle_t vmo;
+    if ((vmo = mx_vmo_create(size)) < 0) {
+        return vmo;
+    }
+    uintptr_t base = 0;
+    mx_status_t r;
+    if ((r = mx_process_map_vm(mx_process_self(), vmo, 0, size, &base,
+                               MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE)) < 0) {
+        mx_handle_close(vmo);
+        return r;
+    }
+    bc->vmo = vmo;
+    bc->vmo_base = base;
+    bc->vmo_size = size;
+    // not every block device does fifo io; readblk/writeblk
+    // fall back to the fd if this fails
+    if (block_client_create(bc->fd, vmo, &bc->client) < 0) {
+        bc->client = NULL;
+    }
+    return NO_ERROR;
+}
+#endif
+
 int bcache_create(bcache_t** out, int fd, uint32_t blockmax, uint32_t blocksize, uint32_t num) {
     bcache_t* bc;
     if ((bc = calloc(1, sizeof(bcache_t))) == NULL) {
@@ -209,6 +350,9 @@ int bcache_create(bcache_t** out, int fd, uint32_t blockmax, uint32_t blocksize,
     bc->fd = fd;
     bc->blockmax = blockmax;
     bc->blocksize = blocksize;
+    mtx_init(&bc->lock, mtx_plain);
+    mtx_init(&bc->io_lock, mtx_plain);
+    cnd_init(&bc->cond);
     list_initialize(&bc->list_busy);
     list_initialize(&bc->list_dirty);
     list_initialize(&bc->list_lru);
@@ -216,6 +360,20 @@ int bcache_create(bcache_t** out, int fd, uint32_t blockmax, uint32_t blocksize,
     for (int n = 0; n < MINFS_BUCKETS; n++) {
         list_initialize(bc->hash + n);
     }
+#ifdef __Fuchsia__
+    if (bcache_init_vmo(bc, num) == NO_ERROR) {
+        uint32_t n;
+        for (n = 0; n < num; n++) {
+            block_t* blk;
+            if ((blk = calloc(1, sizeof(block_t))) == NULL) {
+                break;
+            }
+            blk->data = (void*)(bc->vmo_base + n * bc->blocksize);
+            list_add_tail(&bc->list_free, &blk->listnode);
+        }
+        num -= n;
+    }
+#endif
     while (num > 0) {
         block_t* blk;
         if ((blk = calloc(1, sizeof(block_t))) == NULL) {
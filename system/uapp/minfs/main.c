@@ -12,6 +12,9 @@
 
 #include "minfs-private.h"
 
+// number of threads serving rpc requests when mounted
+static uint32_t rpc_threads = 4;
+
 int do_minfs_check(bcache_t* bc, int argc, char** argv) {
     return minfs_check(bc);
 }
@@ -22,7 +25,7 @@ int do_minfs_mount(bcache_t* bc, int argc, char** argv) {
     if (minfs_mount(&vn, bc) < 0) {
         return -1;
     }
-    vfs_rpc_server(vn, "/data");
+    vfs_rpc_server(vn, "/data", rpc_threads);
     return 0;
 }
 #else
@@ -128,6 +131,7 @@ int usage(void) {
             "\n"
             "options:  -v         some debug messages\n"
             "          -vv        all debug messages\n"
+            "          -t <n>     serve requests with n threads (default 4)\n"
             "\n");
     for (unsigned n = 0; n < (sizeof(CMDS) / sizeof(CMDS[0])); n++) {
         fprintf(stderr, "%9s %-10s %s\n", n ? "" : "commands:",
@@ -158,6 +162,14 @@ int main(int argc, char** argv) {
             trace_on(TRACE_SOME);
         } else if (!strcmp(argv[1], "-vv")) {
             trace_on(TRACE_ALL);
+        } else if (!strcmp(argv[1], "-t") && (argc > 2)) {
+            rpc_threads = strtoul(argv[2], NULL, 10);
+            if (rpc_threads == 0) {
+                fprintf(stderr, "minfs: bad thread count: %s\n", argv[2]);
+                return usage();
+            }
+            argc--;
+            argv++;
         } else {
             break;
         }
@@ -12,15 +12,16 @@
 
 #include <mxio/vfs.h>
 
+#ifdef __Fuchsia__
+#include <magenta/syscalls.h>
+#include <mxio/io.h>
+#endif
+
 #include "minfs-private.h"
 
 //TODO: better bitmap block read/write functions
 
-// Allocate a new data block from the block bitmap.
-// Return the underlying block (obtained via bcache_get()).
-// If hint is nonzero it indicates which block number
-// to start the search for free blocks from.
-block_t* minfs_new_block(minfs_t* fs, uint32_t hint, uint32_t* out_bno, void** bdata) {
+static block_t* _minfs_new_block(minfs_t* fs, uint32_t hint, uint32_t* out_bno, void** bdata) {
     uint32_t bno = bitmap_alloc(&fs->block_map, hint);
     if ((bno == BITMAP_FAIL) && (hint != 0)) {
         bno = bitmap_alloc(&fs->block_map, 0);
@@ -56,6 +57,17 @@ block_t* minfs_new_block(minfs_t* fs, uint32_t hint, uint32_t* out_bno, void** b
     return block;
 }
 
+// Allocate a new data block from the block bitmap.
+// Return the underlying block (obtained via bcache_get()).
+// If hint is nonzero it indicates which block number
+// to start the search for free blocks from.
+block_t* minfs_new_block(minfs_t* fs, uint32_t hint, uint32_t* out_bno, void** bdata) {
+    mtx_lock(&fs->alloc_lock);
+    block_t* block = _minfs_new_block(fs, hint, out_bno, bdata);
+    mtx_unlock(&fs->alloc_lock);
+    return block;
+}
+
 typedef struct {
     block_t* blk;
     uint32_t bno;
@@ -91,7 +103,7 @@ static void put_bitmap_block(minfs_t* fs, gbb_ctxt_t* gbb) {
     }
 }
 
-static mx_status_t minfs_inode_destroy(vnode_t* vn) {
+static mx_status_t _minfs_inode_destroy(vnode_t* vn) {
     mx_status_t status;
     minfs_inode_t inode;
     gbb_ctxt_t gbb;
@@ -150,6 +162,13 @@ static mx_status_t minfs_inode_destroy(vnode_t* vn) {
     return NO_ERROR;
 }
 
+static mx_status_t minfs_inode_destroy(vnode_t* vn) {
+    mtx_lock(&vn->fs->alloc_lock);
+    mx_status_t status = _minfs_inode_destroy(vn);
+    mtx_unlock(&vn->fs->alloc_lock);
+    return status;
+}
+
 // Obtain the nth block of a vnode.
 // If alloc is true, allocate that block if it doesn't already exist.
 static block_t* vn_get_block(vnode_t* vn, uint32_t n, void** bdata, bool alloc) {
@@ -272,6 +291,7 @@ static mx_status_t cb_dir_find(vnode_t* vndir, minfs_dirent_t* de, dir_args_t* a
     }
 }
 
+// caller must hold vn->lock
 static mx_status_t can_unlink(vnode_t* vn) {
     // directories must be empty (dirent_count == 2)
     if (vn->inode.magic == MINFS_MAGIC_DIR) {
@@ -286,8 +306,10 @@ static mx_status_t can_unlink(vnode_t* vn) {
     return NO_ERROR;
 }
 
+// called with vn->lock held, which is released
 static mx_status_t do_unlink(vnode_t* vndir, vnode_t* vn, minfs_dirent_t* de) {
     vn->inode.link_count--;
+    mtx_unlock(&vn->lock);
 
     //TODO: it would be safer to do this *after* we update the directory block
     vn_release(vn);
@@ -311,7 +333,9 @@ static mx_status_t cb_dir_unlink(vnode_t* vndir, minfs_dirent_t* de, dir_args_t*
         return status;
     }
 
+    mtx_lock(&vn->lock);
     if ((status = can_unlink(vn)) < 0) {
+        mtx_unlock(&vn->lock);
         vn_release(vn);
         return status;
     }
@@ -330,6 +354,7 @@ static mx_status_t cb_dir_force_unlink(vnode_t* vndir, minfs_dirent_t* de, dir_a
     if ((status = minfs_vnode_get(vndir->fs, &vn, de->ino)) < 0) {
         return status;
     }
+    mtx_lock(&vn->lock);
     return do_unlink(vndir, vn, de);
 }
 
@@ -353,7 +378,11 @@ static mx_status_t cb_dir_rename(vnode_t* vndir, minfs_dirent_t* de, dir_args_t*
         // cannot rename directory to file (or vice versa)
         vn_release(vn);
         return ERR_BAD_STATE;
-    } else if ((status = can_unlink(vn)) < 0) {
+    }
+    mtx_lock(&vn->lock);
+    status = can_unlink(vn);
+    mtx_unlock(&vn->lock);
+    if (status < 0) {
         // if we cannot unlink the target, we cannot rename the target
         vn_release(vn);
         return status;
@@ -449,9 +478,21 @@ static mx_status_t vn_dir_for_each(vnode_t* vn, dir_args_t* args,
 static void fs_release(vnode_t* vn) {
     trace(MINFS, "minfs_release() vn=%p(#%u)%s\n", vn, vn->ino,
           vn->inode.link_count ? "" : " link-count is zero");
+    // the page cache vmo stays with the vnode while it is cached, as
+    // mappings of it may outlive every open file
     if (vn->inode.link_count == 0) {
-        minfs_inode_destroy(vn);
+        // unhash before the inode number can be handed out again,
+        // or a lookup of the new inode could find this vnode
+        mtx_lock(&vn->fs->hash_lock);
         list_delete(&vn->hashnode);
+        mtx_unlock(&vn->fs->hash_lock);
+        minfs_inode_destroy(vn);
+#ifdef __Fuchsia__
+        if (vn->vmo > 0) {
+            mx_handle_close(vn->vmo);
+        }
+#endif
+        mtx_destroy(&vn->lock);
         free(vn);
     }
 }
@@ -471,9 +512,7 @@ static mx_status_t fs_close(vnode_t* vn) {
 // due to the limitations of the inode and indirect blocks
 #define MAX_FILE_BLOCK (MINFS_DIRECT + MINFS_INDIRECT * (MINFS_BLOCK_SIZE / sizeof(uint32_t)))
 
-static ssize_t fs_read(vnode_t* vn, void* data, size_t len, size_t off) {
-    trace(MINFS, "minfs_read() vn=%p(#%u) len=%zd off=%zd\n", vn, vn->ino, len, off);
-
+static ssize_t _fs_read(vnode_t* vn, void* data, size_t len, size_t off) {
     // clip to EOF
     if (off >= vn->inode.size) {
         return 0;
@@ -510,9 +549,124 @@ static ssize_t fs_read(vnode_t* vn, void* data, size_t len, size_t off) {
     return data - start;
 }
 
-static ssize_t fs_write(vnode_t* vn, const void* data, size_t len, size_t off) {
-    trace(MINFS, "minfs_write() vn=%p(#%u) len=%zd off=%zd\n", vn, vn->ino, len, off);
+#ifdef __Fuchsia__
+// The page cache vmo mirrors the start of a file.  It is created and
+// filled from disk on the first mmap request, kept coherent by fs_write(),
+// and serves fs_read() for the range it covers.  Vmos cannot grow, so it
+// is sized with room to spare; the part of a file beyond it is served
+// from the block cache until the vnode is next instantiated.
+#define MINFS_VMO_MIN (1024 * 1024)
+
+static mx_status_t vn_init_vmo(vnode_t* vn) {
+    if (vn->vmo > 0) {
+        return NO_ERROR;
+    }
+    uint64_t size = (uint64_t)vn->inode.size * 2;
+    if (size < MINFS_VMO_MIN) {
+        size = MINFS_VMO_MIN;
+    }
+    if (size > (uint64_t)MAX_FILE_BLOCK * MINFS_BLOCK_SIZE) {
+        size = (uint64_t)MAX_FILE_BLOCK * MINFS_BLOCK_SIZE;
+    }
+    size = (size + MINFS_BLOCK_SIZE - 1) & ~((uint64_t)MINFS_BLOCK_SIZE - 1);
+
+    mx_handle_t vmo;
+    if ((vmo = mx_vmo_create(size)) < 0) {
+        return vmo;
+    }
+    void* buf;
+    if ((buf = malloc(MINFS_BLOCK_SIZE)) == NULL) {
+        mx_handle_close(vmo);
+        return ERR_NO_MEMORY;
+    }
+    mx_status_t status = NO_ERROR;
+    for (size_t off = 0; off < vn->inode.size; off += MINFS_BLOCK_SIZE) {
+        size_t xfer = vn->inode.size - off;
+        if (xfer > MINFS_BLOCK_SIZE) {
+            xfer = MINFS_BLOCK_SIZE;
+        }
+        ssize_t r;
+        if ((r = _fs_read(vn, buf, xfer, off)) != (ssize_t)xfer) {
+            status = (r < 0) ? r : ERR_IO;
+            break;
+        }
+        if ((r = mx_vmo_write(vmo, buf, off, xfer)) != (ssize_t)xfer) {
+            status = (r < 0) ? r : ERR_IO;
+            break;
+        }
+    }
+    free(buf);
+    if (status < 0) {
+        mx_handle_close(vmo);
+        return status;
+    }
+    vn->vmo = vmo;
+    vn->vmo_size = size;
+    return NO_ERROR;
+}
+
+// true if the vmo holds all of [off, off + len) that lies before EOF
+static bool vn_vmo_covers(vnode_t* vn, size_t len, size_t off) {
+    if ((vn->vmo <= 0) || (off >= vn->inode.size)) {
+        return false;
+    }
+    if (len > (vn->inode.size - off)) {
+        len = vn->inode.size - off;
+    }
+    return (off + len) <= vn->vmo_size;
+}
+
+static ssize_t vn_vmo_read(vnode_t* vn, void* data, size_t len, size_t off) {
+    if (len > (vn->inode.size - off)) {
+        len = vn->inode.size - off;
+    }
+    return mx_vmo_read(vn->vmo, data, off, len);
+}
+
+static void vn_vmo_write(vnode_t* vn, const void* data, size_t len, size_t off) {
+    if ((vn->vmo <= 0) || (off >= vn->vmo_size)) {
+        return;
+    }
+    if (len > (vn->vmo_size - off)) {
+        len = vn->vmo_size - off;
+    }
+    mx_ssize_t r;
+    if ((r = mx_vmo_write(vn->vmo, data, off, len)) != (mx_ssize_t)len) {
+        // stop using a cache that no longer matches the disk;
+        // vmos already handed out are stale from here on
+        error("minfs: vn #%u: page cache write failed: %d\n", vn->ino, (int)r);
+        mx_handle_close(vn->vmo);
+        vn->vmo = 0;
+        vn->vmo_size = 0;
+    }
+}
+#else
+static inline bool vn_vmo_covers(vnode_t* vn, size_t len, size_t off) {
+    return false;
+}
 
+static inline ssize_t vn_vmo_read(vnode_t* vn, void* data, size_t len, size_t off) {
+    return ERR_NOT_SUPPORTED;
+}
+
+static inline void vn_vmo_write(vnode_t* vn, const void* data, size_t len, size_t off) {
+}
+#endif
+
+static ssize_t fs_read(vnode_t* vn, void* data, size_t len, size_t off) {
+    trace(MINFS, "minfs_read() vn=%p(#%u) len=%zd off=%zd\n", vn, vn->ino, len, off);
+    ssize_t r;
+    mtx_lock(&vn->lock);
+    if (vn_vmo_covers(vn, len, off)) {
+        r = vn_vmo_read(vn, data, len, off);
+    } else {
+        r = _fs_read(vn, data, len, off);
+    }
+    mtx_unlock(&vn->lock);
+    return r;
+}
+
+static ssize_t _fs_write(vnode_t* vn, const void* data, size_t len, size_t off) {
     const void* start = data;
     uint32_t n = off / MINFS_BLOCK_SIZE;
     size_t adjust = off % MINFS_BLOCK_SIZE;
@@ -547,6 +701,45 @@ static ssize_t fs_write(vnode_t* vn, const void* data, size_t len, size_t off) {
     return data - start;
 }
 
+static ssize_t fs_write(vnode_t* vn, const void* data, size_t len, size_t off) {
+    trace(MINFS, "minfs_write() vn=%p(#%u) len=%zd off=%zd\n", vn, vn->ino, len, off);
+    mtx_lock(&vn->lock);
+    ssize_t r = _fs_write(vn, data, len, off);
+    if (r > 0) {
+        vn_vmo_write(vn, data, r, off);
+    }
+    mtx_unlock(&vn->lock);
+    return r;
+}
+
+#ifdef __Fuchsia__
+// the block cache is only written through fs_write(), so mappings
+// are read-only: stores to a shared vmo would never reach the disk
+static mx_status_t fs_mmap(vnode_t* vn, uint32_t flags, mx_handle_t* out, size_t* len) {
+    trace(MINFS, "minfs_mmap() vn=%p(#%u) flags=%x\n", vn, vn->ino, flags);
+    if (flags & MXIO_MMAP_FLAG_WRITE) {
+        return ERR_ACCESS_DENIED;
+    }
+    mx_rights_t rights = MX_RIGHT_DUPLICATE | MX_RIGHT_TRANSFER | MX_RIGHT_READ | MX_RIGHT_MAP;
+    if (flags & MXIO_MMAP_FLAG_EXEC) {
+        rights |= MX_RIGHT_EXECUTE;
+    }
+    mx_status_t r;
+    mtx_lock(&vn->lock);
+    if (vn->inode.magic != MINFS_MAGIC_FILE) {
+        r = ERR_NOT_SUPPORTED;
+    } else if ((r = vn_init_vmo(vn)) == NO_ERROR) {
+        if ((r = mx_handle_duplicate(vn->vmo, rights)) >= 0) {
+            *out = r;
+            *len = (vn->inode.size < vn->vmo_size) ? vn->inode.size : vn->vmo_size;
+            r = NO_ERROR;
+        }
+    }
+    mtx_unlock(&vn->lock);
+    return r;
+}
+#endif
+
 static mx_status_t fs_lookup(vnode_t* vn, vnode_t** out, const char* name, size_t len) {
     trace(MINFS, "minfs_lookup() vn=%p(#%u) name='%.*s'\n", vn, vn->ino, (int)len, name);
     if (vn->inode.magic != MINFS_MAGIC_DIR) {
@@ -558,21 +751,23 @@ static mx_status_t fs_lookup(vnode_t* vn, vnode_t** out, const char* name, size_
         .len = len,
     };
     mx_status_t status;
-    if ((status = vn_dir_for_each(vn, &args, cb_dir_find)) < 0) {
-        return status;
+    // hold the directory lock until the child is referenced,
+    // so a racing unlink cannot destroy it out from under us
+    mtx_lock(&vn->lock);
+    if ((status = vn_dir_for_each(vn, &args, cb_dir_find)) >= 0) {
+        status = minfs_vnode_get(vn->fs, out, args.ino);
     }
-    if ((status = minfs_vnode_get(vn->fs, &vn, args.ino)) < 0) {
-        return status;
-    }
-    *out = vn;
-    return NO_ERROR;
+    mtx_unlock(&vn->lock);
+    return status;
 }
 
 static mx_status_t fs_getattr(vnode_t* vn, vnattr_t* a) {
     trace(MINFS, "minfs_getattr() vn=%p(#%u)\n", vn, vn->ino);
+    mtx_lock(&vn->lock);
     a->inode = vn->ino;
     a->size = vn->inode.size;
     a->mode = DTYPE_TO_VTYPE(MINFS_MAGIC_TYPE(vn->inode.magic));
+    mtx_unlock(&vn->lock);
     return NO_ERROR;
 }
 
@@ -583,8 +778,7 @@ typedef struct dircookie {
     uint32_t seqno;  // inode seq no
 } dircookie_t;
 
-static mx_status_t fs_readdir(vnode_t* vn, void* cookie, void* dirents, size_t len) {
-    trace(MINFS, "minfs_readdir() vn=%p(#%u) cookie=%p len=%zd\n", vn, vn->ino, cookie, len);
+static mx_status_t _fs_readdir(vnode_t* vn, void* cookie, void* dirents, size_t len) {
     dircookie_t* dc = cookie;
     vdirent_t* out = dirents;
 
@@ -658,10 +852,16 @@ fail:
     return ERR_IO;
 }
 
-static mx_status_t fs_create(vnode_t* vndir, vnode_t** out,
-                             const char* name, size_t len, uint32_t mode) {
-    trace(MINFS, "minfs_create() vn=%p(#%u) name='%.*s' mode=%#x\n",
-          vndir, vndir->ino, (int)len, name, mode);
+static mx_status_t fs_readdir(vnode_t* vn, void* cookie, void* dirents, size_t len) {
+    trace(MINFS, "minfs_readdir() vn=%p(#%u) cookie=%p len=%zd\n", vn, vn->ino, cookie, len);
+    mtx_lock(&vn->lock);
+    mx_status_t status = _fs_readdir(vn, cookie, dirents, len);
+    mtx_unlock(&vn->lock);
+    return status;
+}
+
+static mx_status_t _fs_create(vnode_t* vndir, vnode_t** out,
+                              const char* name, size_t len, uint32_t mode) {
     if (vndir->inode.magic != MINFS_MAGIC_DIR) {
         return ERR_NOT_SUPPORTED;
     }
@@ -711,6 +911,16 @@ static mx_status_t fs_create(vnode_t* vndir, vnode_t** out,
     return NO_ERROR;
 }
 
+static mx_status_t fs_create(vnode_t* vndir, vnode_t** out,
+                             const char* name, size_t len, uint32_t mode) {
+    trace(MINFS, "minfs_create() vn=%p(#%u) name='%.*s' mode=%#x\n",
+          vndir, vndir->ino, (int)len, name, mode);
+    mtx_lock(&vndir->lock);
+    mx_status_t status = _fs_create(vndir, out, name, len, mode);
+    mtx_unlock(&vndir->lock);
+    return status;
+}
+
 static ssize_t fs_ioctl(vnode_t* vn, uint32_t op, const void* in_buf,
                         size_t in_len, void* out_buf, size_t out_len) {
     return ERR_NOT_SUPPORTED;
@@ -731,15 +941,15 @@ static mx_status_t fs_unlink(vnode_t* vn, const char* name, size_t len) {
         .name = name,
         .len = len,
     };
-    return vn_dir_for_each(vn, &args, cb_dir_unlink);
+    mtx_lock(&vn->lock);
+    mx_status_t status = vn_dir_for_each(vn, &args, cb_dir_unlink);
+    mtx_unlock(&vn->lock);
+    return status;
 }
 
-static mx_status_t fs_rename(vnode_t* olddir, vnode_t* newdir,
-                             const char* oldname, size_t oldlen,
-                             const char* newname, size_t newlen) {
-    trace(MINFS, "minfs_rename() olddir=%p(#%u) newdir=%p(#%u) oldname='%.*s' newname='%.*s'\n",
-          olddir, olddir->ino, newdir, newdir->ino, (int)oldlen, oldname, (int)newlen, newname);
-
+static mx_status_t _fs_rename(vnode_t* olddir, vnode_t* newdir,
+                              const char* oldname, size_t oldlen,
+                              const char* newname, size_t newlen) {
     // ensure that the vnodes containin oldname and newname are directories
     if (olddir->inode.magic != MINFS_MAGIC_DIR || newdir->inode.magic != MINFS_MAGIC_DIR)
         return ERR_NOT_SUPPORTED;
@@ -792,7 +1002,9 @@ static mx_status_t fs_rename(vnode_t* olddir, vnode_t* newdir,
     }
     // at this point, the oldvn exists with multiple names (or the same name in
     // different directories)
+    mtx_lock(&oldvn->lock);
     oldvn->inode.link_count++;
+    mtx_unlock(&oldvn->lock);
 
     // finally, remove oldname from its original position
     args.name = oldname;
@@ -802,6 +1014,21 @@ static mx_status_t fs_rename(vnode_t* olddir, vnode_t* newdir,
     return status;
 }
 
+static mx_status_t fs_rename(vnode_t* olddir, vnode_t* newdir,
+                             const char* oldname, size_t oldlen,
+                             const char* newname, size_t newlen) {
+    trace(MINFS, "minfs_rename() olddir=%p(#%u) newdir=%p(#%u) oldname='%.*s' newname='%.*s'\n",
+          olddir, olddir->ino, newdir, newdir->ino, (int)oldlen, oldname, (int)newlen, newname);
+    // only same-directory rename is supported, so one lock covers both
+    if (olddir != newdir) {
+        return ERR_NOT_SUPPORTED;
+    }
+    mtx_lock(&olddir->lock);
+    mx_status_t status = _fs_rename(olddir, newdir, oldname, oldlen, newname, newlen);
+    mtx_unlock(&olddir->lock);
+    return status;
+}
+
 vnode_ops_t minfs_ops = {
     .release = fs_release,
     .open = fs_open,
@@ -815,5 +1042,8 @@ vnode_ops_t minfs_ops = {
     .ioctl = fs_ioctl,
     .unlink = fs_unlink,
     .rename = fs_rename,
+#ifdef __Fuchsia__
+    .mmap = fs_mmap,
+#endif
 };
 
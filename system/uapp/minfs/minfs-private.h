@@ -4,6 +4,8 @@
 
 #pragma once
 
+#include <threads.h>
+
 #include "vfs.h"
 #include "minfs.h"
 
@@ -12,13 +14,19 @@
 
 typedef struct minfs minfs_t;
 
+// Lock ordering: vnode lock (parent directory before child),
+// then alloc_lock, then the block cache.  hash_lock is a leaf.
 struct minfs {
+    // protects block_map and inode_map and their on-disk blocks
+    mtx_t alloc_lock;
     bitmap_t block_map;
     bitmap_t inode_map;
     bcache_t* bc;
     uint32_t abmblks;
     uint32_t ibmblks;
     minfs_info_t info;
+    // protects vnode_hash
+    mtx_t hash_lock;
     list_node_t vnode_hash[MINFS_BUCKETS];
 };
 
@@ -28,11 +36,19 @@ struct vnode {
 
     minfs_t* fs;
 
+    // protects inode and the data and directory blocks it owns
+    mtx_t lock;
+
     uint32_t ino;
     uint32_t reserved;
 
     list_node_t hashnode;
 
+    // page cache of the first vmo_size bytes of the file,
+    // created on demand and dropped with the last reference
+    mx_handle_t vmo;
+    uint64_t vmo_size;
+
     minfs_inode_t inode;
 };
 
@@ -51,6 +67,7 @@ mx_status_t minfs_vnode_new(minfs_t* fs, vnode_t** out, uint32_t type);
 block_t* minfs_new_block(minfs_t* fs, uint32_t hint, uint32_t* out_bno, void** bdata);
 
 // free ino in inode bitmap
+// caller must hold fs->alloc_lock
 mx_status_t minfs_ino_free(minfs_t* fs, uint32_t ino);
 
 // write the inode data of this vnode to disk
@@ -81,7 +81,7 @@ mx_status_t minfs_ino_free(minfs_t* fs, uint32_t ino) {
     return NO_ERROR;
 }
 
-mx_status_t minfs_ino_alloc(minfs_t* fs, minfs_inode_t* inode, uint32_t* ino_out) {
+static mx_status_t _minfs_ino_alloc(minfs_t* fs, minfs_inode_t* inode, uint32_t* ino_out) {
     uint32_t ino = bitmap_alloc(&fs->inode_map, 0);
     if (ino == BITMAP_FAIL) {
         return ERR_NO_RESOURCES;
@@ -128,6 +128,13 @@ mx_status_t minfs_ino_alloc(minfs_t* fs, minfs_inode_t* inode, uint32_t* ino_out
     return NO_ERROR;
 }
 
+mx_status_t minfs_ino_alloc(minfs_t* fs, minfs_inode_t* inode, uint32_t* ino_out) {
+    mtx_lock(&fs->alloc_lock);
+    mx_status_t status = _minfs_ino_alloc(fs, inode, ino_out);
+    mtx_unlock(&fs->alloc_lock);
+    return status;
+}
+
 mx_status_t minfs_vnode_new(minfs_t* fs, vnode_t** out, uint32_t type) {
     vnode_t* vn;
     if ((type != MINFS_TYPE_FILE) && (type != MINFS_TYPE_DIR)) {
@@ -145,7 +152,10 @@ mx_status_t minfs_vnode_new(minfs_t* fs, vnode_t** out, uint32_t type) {
         return ERR_NO_RESOURCES;
     }
     vn->fs = fs;
+    mtx_init(&vn->lock, mtx_plain);
+    mtx_lock(&fs->hash_lock);
     list_add_tail(fs->vnode_hash + INO_HASH(vn->ino), &vn->hashnode);
+    mtx_unlock(&fs->hash_lock);
 
     trace(MINFS, "new_vnode() %p(#%u) { magic=%#08x }\n",
           vn, vn->ino, vn->inode.magic);
@@ -154,19 +164,34 @@ mx_status_t minfs_vnode_new(minfs_t* fs, vnode_t** out, uint32_t type) {
     return 0;
 }
 
+// find a vnode in the hash and acquire a reference to it
+// caller must hold fs->hash_lock
+static vnode_t* minfs_vnode_lookup(minfs_t* fs, uint32_t ino) {
+    vnode_t* vn;
+    list_for_every_entry(fs->vnode_hash + INO_HASH(ino), vn, vnode_t, hashnode) {
+        if (vn->ino == ino) {
+            vn_acquire(vn);
+            return vn;
+        }
+    }
+    return NULL;
+}
+
 mx_status_t minfs_vnode_get(minfs_t* fs, vnode_t** out, uint32_t ino) {
     if ((ino < 1) || (ino >= fs->info.inode_count)) {
         return ERR_OUT_OF_RANGE;
     }
     vnode_t* vn;
     uint32_t bucket = INO_HASH(ino);
-    list_for_every_entry(fs->vnode_hash + bucket, vn, vnode_t, hashnode) {
-        if (vn->ino == ino) {
-            vn_acquire(vn);
-            *out = vn;
-            return NO_ERROR;
-        }
+    mtx_lock(&fs->hash_lock);
+    if ((vn = minfs_vnode_lookup(fs, ino)) != NULL) {
+        mtx_unlock(&fs->hash_lock);
+        *out = vn;
+        return NO_ERROR;
     }
+    mtx_unlock(&fs->hash_lock);
+
+    // read the inode without holding the hash lock
     if ((vn = calloc(1, sizeof(vnode_t))) == NULL) {
         return ERR_NO_MEMORY;
     }
@@ -174,6 +199,7 @@ mx_status_t minfs_vnode_get(minfs_t* fs, vnode_t** out, uint32_t ino) {
     uint32_t ino_per_blk = fs->info.block_size / MINFS_INODE_SIZE;
     if ((status = bcache_read(fs->bc, fs->info.ino_block + ino / ino_per_blk, &vn->inode,
                               MINFS_INODE_SIZE * (ino % ino_per_blk), MINFS_INODE_SIZE)) < 0) {
+        free(vn);
         return status;
     }
     trace(MINFS, "get_vnode() %p(#%u) { magic=%#08x size=%u blks=%u dn=%u,%u,%u,%u... }\n",
@@ -184,7 +210,20 @@ mx_status_t minfs_vnode_get(minfs_t* fs, vnode_t** out, uint32_t ino) {
     vn->ino = ino;
     vn->refcount = 1;
     vn->ops = &minfs_ops;
+    mtx_init(&vn->lock, mtx_plain);
+
+    mtx_lock(&fs->hash_lock);
+    vnode_t* other;
+    if ((other = minfs_vnode_lookup(fs, ino)) != NULL) {
+        // another thread loaded this inode while we were reading it
+        mtx_unlock(&fs->hash_lock);
+        mtx_destroy(&vn->lock);
+        free(vn);
+        *out = other;
+        return NO_ERROR;
+    }
     list_add_tail(fs->vnode_hash + bucket, &vn->hashnode);
+    mtx_unlock(&fs->hash_lock);
 
     *out = vn;
     return NO_ERROR;
@@ -227,6 +266,8 @@ mx_status_t minfs_create(minfs_t** out, bcache_t* bc, minfs_info_t* info) {
     for (int n = 0; n < MINFS_BUCKETS; n++) {
         list_initialize(fs->vnode_hash + n);
     }
+    mtx_init(&fs->alloc_lock, mtx_plain);
+    mtx_init(&fs->hash_lock, mtx_plain);
     memcpy(&fs->info, info, sizeof(minfs_info_t));
     fs->bc = bc;
 
@@ -73,7 +73,7 @@ static mx_handle_t devmgr_connect(const char* where) {
     return h;
 }
 
-mx_handle_t vfs_rpc_server(vnode_t* vn, const char* where) {
+mx_handle_t vfs_rpc_server(vnode_t* vn, const char* where, uint32_t threads) {
     iostate_t* ios;
     mx_status_t r;
 
@@ -99,6 +99,12 @@ mx_handle_t vfs_rpc_server(vnode_t* vn, const char* where) {
     }
     //TODO: ref count
     //vn_acquire(vn);
+
+    // the current thread is the last member of the worker pool
+    if ((threads > 1) &&
+        (r = mxio_dispatcher_start_pool(vfs_dispatcher, "minfs-rpc", threads - 1)) < 0) {
+        error("minfs: failed to start all rpc workers: %d\n", r);
+    }
     mxio_dispatcher_run(vfs_dispatcher);
     return NO_ERROR;
 }
@@ -281,6 +287,19 @@ static mx_status_t vfs_handler(mxrio_msg_t* msg, mx_handle_t rh, void* cookie) {
     }
     case MXRIO_UNLINK:
         return vn->ops->unlink(vn, (const char*)msg->data, len);
+    case MXRIO_MMAP: {
+        if (vn->ops->mmap == NULL) {
+            return ERR_NOT_SUPPORTED;
+        }
+        size_t flen;
+        mx_status_t r;
+        if ((r = vn->ops->mmap(vn, arg, &msg->handle[0], &flen)) < 0) {
+            return r;
+        }
+        msg->arg2.off = flen;
+        msg->hcount = 1;
+        return NO_ERROR;
+    }
     default:
         return ERR_NOT_SUPPORTED;
     }
@@ -137,18 +137,20 @@ mx_status_t vfs_fill_dirent(vdirent_t* de, size_t delen,
     return sz;
 }
 
+// refcounts are atomic as the rpc server may run
+// operations on behalf of many clients concurrently
 void vn_acquire(vnode_t* vn) {
     trace(REFS, "acquire vn=%p ref=%u\n", vn, vn->refcount);
-    vn->refcount++;
+    __atomic_fetch_add(&vn->refcount, 1, __ATOMIC_RELAXED);
 }
 
 void vn_release(vnode_t* vn) {
     trace(REFS, "release vn=%p ref=%u\n", vn, vn->refcount);
-    if (vn->refcount == 0) {
+    uint32_t old = __atomic_fetch_sub(&vn->refcount, 1, __ATOMIC_ACQ_REL);
+    if (old == 0) {
         panic("vn %p: ref underflow\n", vn);
     }
-    vn->refcount--;
-    if (vn->refcount == 0) {
+    if (old == 1) {
         trace(VFS, "vfs_release: vn=%p\n", vn);
         vn->ops->release(vn);
     }
@@ -31,7 +31,9 @@ mx_status_t vfs_fill_dirent(vdirent_t* de, size_t delen,
 
 // VFS RPC Server (rpc.c)
 
-mx_handle_t vfs_rpc_server(vnode_t* vn, const char* where);
+// Serve vn at where, running requests from up to threads
+// clients concurrently.  The vnode ops must be thread safe.
+mx_handle_t vfs_rpc_server(vnode_t* vn, const char* where, uint32_t threads);
 
 
 // Allocation Bitmap (bitmap.c)
@@ -14,23 +14,30 @@
 #include <inet6/inet6.h>
 #include <inet6/netifc.h>
 
-#include <magenta/processargs.h>
-#include <magenta/syscalls.h>
-#include <launchpad/launchpad.h>
-
 #include <magenta/netboot.h>
 
 netfile_state netfile = {
     .fd = -1,
 };
 
-void netfile_open(const char *filename, uint32_t cookie, uint32_t arg,
+// give back any received frames a windowed write was holding
+static void netfile_release_blocks(void) {
+    for (uint32_t n = 0; n < NB_WINDOW_MAX; n++) {
+        if (netfile.blocks[n].held) {
+            eth_put_buffer(netfile.blocks[n].held);
+            netfile.blocks[n].held = NULL;
+        }
+    }
+    netfile.present = 0;
+}
+
+void netfile_open(const char *filename, size_t len, uint32_t cookie, uint32_t arg,
                   const ip6_addr_t* saddr, uint16_t sport, uint16_t dport) {
-    nbmsg m;
-    m.magic = NB_MAGIC;
-    m.cookie = cookie;
-    m.cmd = NB_ACK;
-    m.arg = 0;
+    netfilemsg m;
+    m.hdr.magic = NB_MAGIC;
+    m.hdr.cookie = cookie;
+    m.hdr.cmd = NB_ACK;
+    m.hdr.arg = 0;
 
     if (netfile.fd >= 0) {
         printf("netsvc: closing still-open '%s', replacing with '%s'\n", netfile.filename, filename);
@@ -40,29 +47,157 @@ void netfile_open(const char *filename, uint32_t cookie, uint32_t arg,
     netfile.blocknum = 0;
     netfile.cookie = cookie;
 
+    // an nbwindow trailer after the filename asks for a windowed transfer
+    nbwindow w = { 0 };
+    size_t namelen = strnlen(filename, len) + 1;
+    if (len >= (namelen + sizeof(w))) {
+        memcpy(&w, filename + namelen, sizeof(w));
+    }
+    if ((w.magic != NB_WINDOW_MAGIC) || (w.window == 0)) {
+        w.window = 0;
+    } else if (w.window > NB_WINDOW_MAX) {
+        w.window = NB_WINDOW_MAX;
+    }
+    netfile_release_blocks();
+    netfile.window = w.window;
+    netfile.base = 0;
+    netfile.next = 0;
+    netfile.present = 0;
+    netfile.resent = 0;
+    netfile.eof = false;
+    netfile.latched = false;
+
     switch (arg) {
     case O_RDONLY:
         netfile.fd = open(filename, O_RDONLY);
         break;
     case O_WRONLY:
-        netfile.fd = open(filename, O_WRONLY|O_CREAT|O_TRUNC);
+        netfile.fd = open(filename, O_WRONLY|O_CREAT|O_TRUNC, 0666);
         break;
     default:
         printf("netsvc: open '%s' with invalid mode %d\n", filename, arg);
         errno = -EINVAL;
     }
     if (netfile.fd < 0) {
-        m.arg = -errno;
-        udp6_send(&m, sizeof(m), saddr, sport, dport);
+        m.hdr.arg = -errno;
+        udp6_send(&m.hdr, sizeof(m.hdr), saddr, sport, dport);
         return;
     } else {
-        strlcpy(netfile.filename, filename, sizeof(netfile.filename));
+        snprintf(netfile.filename, sizeof(netfile.filename), "%s", filename);
     }
 
+    if (netfile.window) {
+        memcpy(m.data, &w, sizeof(w));
+        udp6_send(&m, sizeof(m.hdr) + sizeof(w), saddr, sport, dport);
+    } else {
+        udp6_send(&m.hdr, sizeof(m.hdr), saddr, sport, dport);
+    }
+}
+
+// Sends a data reply built directly in a transmit buffer.
+static void netfile_send_data(uint32_t cookie, uint32_t arg, const void* data, size_t len,
+                              const ip6_addr_t* saddr, uint16_t sport, uint16_t dport) {
+    netfilemsg* m = udp6_get_buffer(sizeof(m->hdr) + len);
+    if (m == NULL) {
+        // same as a dropped packet; the host will ask again
+        return;
+    }
+    m->hdr.magic = NB_MAGIC;
+    m->hdr.cookie = cookie;
+    m->hdr.cmd = NB_ACK;
+    m->hdr.arg = arg;
+    memcpy(m->data, data, len);
+    udp6_send_buffer(m, sizeof(m->hdr) + len, saddr, sport, dport);
+}
+
+static void netfile_send_block(uint32_t block, uint32_t cookie,
+                               const ip6_addr_t* saddr, uint16_t sport, uint16_t dport) {
+    netfile_block* b = &netfile.blocks[block % netfile.window];
+    netfile_send_data(cookie, block, b->data, b->len, saddr, sport, dport);
+}
+
+static uint32_t window_shift(uint32_t bits, uint32_t n) {
+    return (n >= 32) ? 0 : (bits >> n);
+}
+
+// Every packet of a windowed transfer carries the cookie of the first
+// one.  As with a stop-and-wait repeat, a packet with any other cookie
+// is answered with an error and otherwise ignored.
+static bool netfile_window_cookie(uint32_t cookie,
+                                  const ip6_addr_t* saddr, uint16_t sport, uint16_t dport) {
+    if (!netfile.latched) {
+        netfile.cookie = cookie;
+        netfile.latched = true;
+        return true;
+    }
+    if (cookie == netfile.cookie) {
+        return true;
+    }
+    nbmsg m;
+    m.magic = NB_MAGIC;
+    m.cookie = cookie;
+    m.cmd = NB_ACK;
+    m.arg = -EIO;
     udp6_send(&m, sizeof(m), saddr, sport, dport);
+    return false;
+}
+
+// Windowed read: each NB_READ acknowledges everything before arg plus
+// the blocks named in its nbsack; reply with the holes and as many new
+// blocks as the window allows.
+static void netfile_read_window(const char* data, size_t len, uint32_t cookie, uint32_t arg,
+                                const ip6_addr_t* saddr, uint16_t sport, uint16_t dport) {
+    nbsack sk = { 0 };
+    if (len >= sizeof(sk)) {
+        memcpy(&sk, data, sizeof(sk));
+    }
+    if ((arg - netfile.base) > (netfile.next - netfile.base)) {
+        // stale, or ahead of anything we sent
+        return;
+    }
+    netfile.resent = window_shift(netfile.resent, arg - netfile.base);
+    netfile.base = arg;
+
+    // bit n of held is block base + n
+    uint32_t held = sk.sack << 1;
+    uint32_t count = netfile.next - netfile.base;
+    for (uint32_t n = 0; n < count; n++) {
+        uint32_t bit = 1u << n;
+        if (held & bit) {
+            continue;
+        }
+        // a hole below a block the host holds was lost, so resend
+        // it once; a timed out host asks for all of them again
+        if ((sk.flags & NB_SACK_RETRY) ||
+            ((window_shift(held, n) != 0) && !(netfile.resent & bit))) {
+            netfile_send_block(netfile.base + n, cookie, saddr, sport, dport);
+            netfile.resent |= bit;
+        }
+    }
+
+    while (!netfile.eof && ((netfile.next - netfile.base) < netfile.window)) {
+        netfile_block* b = &netfile.blocks[netfile.next % netfile.window];
+        ssize_t n = read(netfile.fd, b->data, sizeof(b->data));
+        if (n < 0) {
+            printf("netsvc: error reading '%s': %d\n", netfile.filename, errno);
+            nbmsg m;
+            m.magic = NB_MAGIC;
+            m.cookie = cookie;
+            m.cmd = NB_ACK;
+            m.arg = -errno;
+            close(netfile.fd);
+            netfile.fd = -1;
+            udp6_send(&m, sizeof(m), saddr, sport, dport);
+            return;
+        }
+        // a zero length block tells the host it has reached the end
+        b->len = n;
+        netfile.eof = (n == 0);
+        netfile_send_block(netfile.next++, cookie, saddr, sport, dport);
+    }
 }
 
-void netfile_read(uint32_t cookie, uint32_t arg,
+void netfile_read(const char* data, size_t len, uint32_t cookie, uint32_t arg,
                   const ip6_addr_t* saddr, uint16_t sport, uint16_t dport) {
     netfilemsg m;
     m.hdr.magic = NB_MAGIC;
@@ -75,6 +210,13 @@ void netfile_read(uint32_t cookie, uint32_t arg,
         udp6_send(&m.hdr, sizeof(m.hdr), saddr, sport, dport);
         return;
     }
+    if (netfile.window) {
+        if (!netfile_window_cookie(cookie, saddr, sport, dport)) {
+            return;
+        }
+        netfile_read_window(data, len, cookie, arg, saddr, sport, dport);
+        return;
+    }
     if (arg == (netfile.blocknum - 1)) {
         // repeat of last block read, probably due to dropped packet
         // unless cookie doesn't match, in which case it's an error
@@ -102,9 +244,66 @@ void netfile_read(uint32_t cookie, uint32_t arg,
         netfile.cookie = cookie;
     }
 
-    m.hdr.arg = arg;
-    memcpy(m.data, netfile.data, netfile.datasize);
-    udp6_send(&m, sizeof(m.hdr) + netfile.datasize, saddr, sport, dport);
+    netfile_send_data(cookie, arg, netfile.data, netfile.datasize, saddr, sport, dport);
+}
+
+// Windowed write: buffer blocks that arrive out of order, write out
+// the in-order prefix, and acknowledge with the next block needed and
+// an nbsack naming the blocks already buffered beyond it.
+static void netfile_write_window(const char* data, size_t len, uint32_t cookie, uint32_t arg,
+                                 const ip6_addr_t* saddr, uint16_t sport, uint16_t dport) {
+    struct {
+        nbmsg  hdr;
+        nbsack sk;
+    } m;
+    m.hdr.magic = NB_MAGIC;
+    m.hdr.cookie = cookie;
+    m.hdr.cmd = NB_ACK;
+
+    uint32_t n = arg - netfile.base;
+    if ((n < netfile.window) && !(netfile.present & (1u << n)) &&
+        (len <= NB_WINDOW_BLOCKSIZE)) {
+        // Blocks that arrive in order go straight from the received
+        // frame to the file.  Others wait for the gap to fill, in the
+        // frame itself if the driver will lend it to us.
+        netfile_block* b = &netfile.blocks[arg % netfile.window];
+        if (n == 0) {
+            b->held = (uint8_t*)data;
+        } else if (eth_hold_buffer((void*)data) == 0) {
+            b->held = (uint8_t*)data;
+        } else {
+            memcpy(b->data, data, len);
+        }
+        b->len = len;
+        netfile.present |= 1u << n;
+    }
+    while (netfile.present & 1) {
+        netfile_block* b = &netfile.blocks[netfile.base % netfile.window];
+        const uint8_t* bdata = b->held ? b->held : b->data;
+        ssize_t r = write(netfile.fd, bdata, b->len);
+        if ((b->held != NULL) && (b->held != (const uint8_t*)data)) {
+            eth_put_buffer(b->held);
+        }
+        b->held = NULL;
+        if (r != (ssize_t)b->len) {
+            printf("netsvc: error writing %s: %d\n", netfile.filename, errno);
+            m.hdr.arg = -errno;
+            if (m.hdr.arg == 0) {
+                m.hdr.arg = -EIO;
+            }
+            close(netfile.fd);
+            netfile.fd = -1;
+            udp6_send(&m.hdr, sizeof(m.hdr), saddr, sport, dport);
+            return;
+        }
+        netfile.present >>= 1;
+        netfile.base++;
+    }
+
+    m.hdr.arg = netfile.base;
+    m.sk.sack = netfile.present >> 1;
+    m.sk.flags = 0;
+    udp6_send(&m, sizeof(m), saddr, sport, dport);
 }
 
 void netfile_write(const char* data, size_t len, uint32_t cookie, uint32_t arg,
@@ -121,6 +320,13 @@ void netfile_write(const char* data, size_t len, uint32_t cookie, uint32_t arg,
         udp6_send(&m, sizeof(m), saddr, sport, dport);
         return;
     }
+    if (netfile.window) {
+        if (!netfile_window_cookie(cookie, saddr, sport, dport)) {
+            return;
+        }
+        netfile_write_window(data, len, cookie, arg, saddr, sport, dport);
+        return;
+    }
 
     if (arg == (netfile.blocknum - 1)) {
         // repeat of last block write, probably due to dropped packet
@@ -172,5 +378,7 @@ void netfile_close(uint32_t cookie,
         }
         netfile.fd = -1;
     }
+    netfile_release_blocks();
+    netfile.window = 0;
     udp6_send(&m, sizeof(m), saddr, sport, dport);
 }
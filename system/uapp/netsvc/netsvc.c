@@ -126,10 +126,11 @@ void udp6_recv(void* data, size_t len,
             }
             break;
         case NB_OPEN:
-            netfile_open((char*)msg->data, msg->cookie, msg->arg, saddr, sport, dport);
+            netfile_open((char*)msg->data, len, msg->cookie, msg->arg, saddr, sport, dport);
             break;
         case NB_READ:
-            netfile_read(msg->cookie, msg->arg, saddr, sport, dport);
+            len--; // NB NUL-terminator is not part of the data
+            netfile_read((char*)msg->data, len, msg->cookie, msg->arg, saddr, sport, dport);
             break;
         case NB_WRITE:
             len--; // NB NUL-terminator is not part of the data
@@ -4,12 +4,19 @@
 
 #pragma once
 
+#include <stdbool.h>
 #include <stdio.h>
 
 #include <inet6/inet6.h>
 
 #include <magenta/netboot.h>
 
+typedef struct netfile_block_t {
+    size_t   len;
+    uint8_t* held; // write: the received frame, if the driver lent it to us
+    uint8_t  data[NB_WINDOW_BLOCKSIZE];
+} netfile_block;
+
 typedef struct netfile_state_t {
     int      fd;
     char     filename[1024]; // for debugging
@@ -17,6 +24,16 @@ typedef struct netfile_state_t {
     uint32_t cookie;
     uint8_t  data[1024];
     size_t   datasize;
+
+    // windowed transfers, if window != 0
+    uint32_t window;
+    uint32_t base;    // oldest block not yet written (write) or acked (read)
+    uint32_t next;    // next block to read from the file (read)
+    uint32_t present; // write: bit n set if block base + n is buffered
+    uint32_t resent;  // read: bit n set if block base + n was fast-retransmitted
+    bool     eof;
+    bool     latched; // cookie is the transfer's, taken from its first packet
+    netfile_block blocks[NB_WINDOW_MAX];
 } netfile_state;
 
 extern netfile_state netfile;
@@ -26,10 +43,10 @@ typedef struct netfilemsg_t {
     uint8_t data[1024];
 } netfilemsg;
 
-void netfile_open(const char* filename, uint32_t cookie, uint32_t arg,
+void netfile_open(const char* filename, size_t len, uint32_t cookie, uint32_t arg,
                 const ip6_addr_t* saddr, uint16_t sport, uint16_t dport);
 
-void netfile_read(uint32_t cookie, uint32_t arg,
+void netfile_read(const char* data, size_t len, uint32_t cookie, uint32_t arg,
                   const ip6_addr_t* saddr, uint16_t sport, uint16_t dport);
 
 void netfile_write(const char* data, size_t len, uint32_t cookie, uint32_t arg,
@@ -15,11 +15,21 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/param.h>
+#include <threads.h>
 #include <unistd.h>
 
+#include <ddk/completion.h>
+
 #define QEMU_VGA_VID (0x1234)
 #define QEMU_VGA_DID (0x1111)
 
+#define BOCHS_VBE_MAX_BUFFERS 3
+
+// qemu redraws the display from its own timer and has no vblank to
+// report, so flips are completed on a 60Hz tick
+#define BOCHS_VBE_FRAME_TIME (MX_SEC(1) / 60)
+
 #define TRACE 0
 
 #if TRACE
@@ -42,6 +52,18 @@ typedef struct bochs_vbe_device {
     mx_handle_t framebuffer_handle;
 
     mx_display_info_t info;
+
+    // page flipping, buffers are stacked vertically in the framebuffer
+    // and selected with the y offset
+    void* buffers[BOCHS_VBE_MAX_BUFFERS];
+    uint32_t buffer_count;
+    size_t buffer_size;
+
+    mtx_t flip_lock;
+    completion_t flip_completion;
+    mx_handle_t flip_event;
+    bool flip_pending;
+    bool flip_supported;
 } bochs_vbe_device_t;
 
 #define get_bochs_vbe_device(dev) containerof(dev, bochs_vbe_device_t, device)
@@ -99,13 +121,24 @@ static void set_hw_mode(bochs_vbe_device_t* dev) {
     int bpp = mx_display_format_to_bpp(dev->info.format);
     assert(bpp >= 0);
 
+    // fit as many buffers as the video memory holds
+    size_t buffer_size = (size_t)dev->info.stride * dev->info.height * ((bpp + 7) / 8);
+    dev->buffer_size = buffer_size;
+    dev->buffer_count = 0;
+    while ((dev->buffer_count < BOCHS_VBE_MAX_BUFFERS) &&
+           ((dev->buffer_count + 1) * buffer_size <= dev->framebuffer_size)) {
+        dev->buffers[dev->buffer_count] = (uint8_t*)dev->framebuffer + dev->buffer_count * buffer_size;
+        dev->buffer_count++;
+    }
+    assert(dev->buffer_count > 0);
+
     bochs_vbe_dispi_write(dev->regs, BOCHS_VBE_DISPI_ENABLE, 0);
     bochs_vbe_dispi_write(dev->regs, BOCHS_VBE_DISPI_BPP, bpp);
     bochs_vbe_dispi_write(dev->regs, BOCHS_VBE_DISPI_XRES, dev->info.width);
     bochs_vbe_dispi_write(dev->regs, BOCHS_VBE_DISPI_YRES, dev->info.height);
     bochs_vbe_dispi_write(dev->regs, BOCHS_VBE_DISPI_BANK, 0);
     bochs_vbe_dispi_write(dev->regs, BOCHS_VBE_DISPI_VIRT_WIDTH, dev->info.stride);
-    bochs_vbe_dispi_write(dev->regs, BOCHS_VBE_DISPI_VIRT_HEIGHT, dev->framebuffer_size / dev->info.stride);
+    bochs_vbe_dispi_write(dev->regs, BOCHS_VBE_DISPI_VIRT_HEIGHT, dev->info.height * dev->buffer_count);
     bochs_vbe_dispi_write(dev->regs, BOCHS_VBE_DISPI_X_OFFSET, 0);
     bochs_vbe_dispi_write(dev->regs, BOCHS_VBE_DISPI_Y_OFFSET, 0);
     bochs_vbe_dispi_write(dev->regs, BOCHS_VBE_DISPI_ENABLE, 0x41);
@@ -154,10 +187,68 @@ static mx_status_t bochs_vbe_get_framebuffer(mx_device_t* dev, void** framebuffe
     return NO_ERROR;
 }
 
+static mx_status_t bochs_vbe_get_buffers(mx_device_t* dev, void** buffers, uint32_t* count) {
+    bochs_vbe_device_t* vdev = get_bochs_vbe_device(dev);
+    uint32_t n = vdev->flip_supported ? vdev->buffer_count : 1;
+    for (uint32_t i = 0; i < MIN(*count, n); i++) {
+        buffers[i] = vdev->buffers[i];
+    }
+    *count = n;
+    return NO_ERROR;
+}
+
+static mx_status_t bochs_vbe_flip(mx_device_t* dev, uint32_t buffer, mx_handle_t event) {
+    bochs_vbe_device_t* vdev = get_bochs_vbe_device(dev);
+    if (!vdev->flip_supported)
+        return ERR_NOT_SUPPORTED;
+    if (buffer >= vdev->buffer_count)
+        return ERR_INVALID_ARGS;
+
+    mtx_lock(&vdev->flip_lock);
+    if (vdev->flip_pending) {
+        mtx_unlock(&vdev->flip_lock);
+        return ERR_SHOULD_WAIT;
+    }
+    bochs_vbe_dispi_write(vdev->regs, BOCHS_VBE_DISPI_Y_OFFSET, buffer * vdev->info.height);
+    vdev->flip_event = event;
+    vdev->flip_pending = true;
+    completion_signal(&vdev->flip_completion);
+    mtx_unlock(&vdev->flip_lock);
+
+    // the kernel draws panics into the buffer it was given, keep that on screen
+    mx_set_framebuffer(get_root_resource(), vdev->buffers[buffer], vdev->buffer_size,
+                       vdev->info.format, vdev->info.width, vdev->info.height,
+                       vdev->info.stride);
+    return NO_ERROR;
+}
+
+static int bochs_vbe_vblank_thread(void* arg) {
+    bochs_vbe_device_t* vdev = arg;
+    for (;;) {
+        completion_wait(&vdev->flip_completion, MX_TIME_INFINITE);
+
+        // complete on the next tick
+        mx_time_t now = mx_current_time();
+        mx_nanosleep(BOCHS_VBE_FRAME_TIME - (now % BOCHS_VBE_FRAME_TIME));
+
+        mtx_lock(&vdev->flip_lock);
+        completion_reset(&vdev->flip_completion);
+        if (vdev->flip_event != MX_HANDLE_INVALID) {
+            mx_object_signal(vdev->flip_event, 0, MX_SIGNAL_SIGNALED);
+            vdev->flip_event = MX_HANDLE_INVALID;
+        }
+        vdev->flip_pending = false;
+        mtx_unlock(&vdev->flip_lock);
+    }
+    return 0;
+}
+
 static mx_display_protocol_t bochs_vbe_display_proto = {
     .set_mode = bochs_vbe_set_mode,
     .get_mode = bochs_vbe_get_mode,
     .get_framebuffer = bochs_vbe_get_framebuffer,
+    .get_buffers = bochs_vbe_get_buffers,
+    .flip = bochs_vbe_flip,
 };
 
 // implement device protocol
@@ -227,6 +318,14 @@ static mx_status_t bochs_vbe_bind(mx_driver_t* drv, mx_device_t* dev) {
     device->info.stride = 1024;
     set_hw_mode(device);
 
+    mtx_init(&device->flip_lock, mtx_plain);
+    device->flip_completion = COMPLETION_INIT;
+    thrd_t t;
+    if (thrd_create_with_name(&t, bochs_vbe_vblank_thread, device, "bochs_vbe-vblank") == thrd_success) {
+        thrd_detach(t);
+        device->flip_supported = true;
+    }
+
     device_add(&device->device, dev);
 
     xprintf("initialized bochs_vbe display driver, reg=0x%x regsize=0x%x fb=0x%x fbsize=0x%x\n",
@@ -514,12 +514,14 @@ static ssize_t vc_device_read(mx_device_t* dev, void* buf, size_t count, mx_off_
 static ssize_t vc_device_write(mx_device_t* dev, const void* buf, size_t count, mx_off_t off) {
     vc_device_t* vc = get_vc_device(dev);
     mtx_lock(&vc->lock);
+    mx_time_t t0 = mx_current_time();
     vc->invy0 = vc->rows + 1;
     vc->invy1 = -1;
     const uint8_t* str = (const uint8_t*)buf;
     for (size_t i = 0; i < count; i++) {
         vc->textcon.putc(&vc->textcon, str[i]);
     }
+    vc->draw_time += mx_current_time() - t0;
     if (vc->invy1 >= 0) {
         vc_gfx_invalidate(vc, 0, vc->invy0, vc->columns, vc->invy1 - vc->invy0);
     }
@@ -544,6 +546,19 @@ static ssize_t vc_device_ioctl(mx_device_t* dev, uint32_t op, const void* cmd, s
         dims->height = vc->rows;
         return sizeof(*dims);
     }
+    case IOCTL_CONSOLE_GET_STATS: {
+        ioctl_console_stats_t* stats = reply;
+        if (max < sizeof(*stats)) {
+            return ERR_BUFFER_TOO_SMALL;
+        }
+        mtx_lock(&vc->lock);
+        stats->chars_drawn = vc->chars_drawn;
+        stats->glyph_cache_misses = vc->atlas_misses;
+        stats->draw_time = vc->draw_time;
+        mtx_unlock(&vc->lock);
+        vc_gfx_get_stats(stats);
+        return sizeof(*stats);
+    }
     case IOCTL_DISPLAY_GET_FB: {
         if (max < sizeof(ioctl_display_get_fb_t)) {
             return ERR_BUFFER_TOO_SMALL;
@@ -691,8 +706,20 @@ static mx_status_t vc_root_bind(mx_driver_t* drv, mx_device_t* dev) {
         return status;
     }
 
+    vc_gfx_init_display(dev, disp, &hw_gfx);
+
+    // start a thread to copy damage out to the framebuffer
+    thrd_t t;
+    int ret = thrd_create_with_name(&t, vc_gfx_flush_thread, NULL, "vc-flush");
+    if (ret != thrd_success) {
+        xprintf("vc: flush thread did not start (return value=%d)\n", ret);
+        status = ERR_NO_RESOURCES;
+        goto fail;
+    }
+    thrd_detach(t);
+
     // start a thread to listen for new input devices
-    int ret = thrd_create_with_name(&input_poll_thread, vc_input_devices_poll_thread, NULL, "vc-inputdev-poll");
+    ret = thrd_create_with_name(&input_poll_thread, vc_input_devices_poll_thread, NULL, "vc-inputdev-poll");
     if (ret != thrd_success) {
         xprintf("vc: input polling thread did not start (return value=%d)\n", ret);
     }
@@ -708,7 +735,6 @@ static mx_status_t vc_root_bind(mx_driver_t* drv, mx_device_t* dev) {
             dev->name, info.width, info.height, info.stride, info.format);
 
     if (vc_root_open(NULL, &dev, 0) == NO_ERROR) {
-        thrd_t t;
         thrd_create_with_name(&t, vc_log_reader_thread, dev, "vc-log-reader");
     }
 
@@ -150,19 +150,23 @@ static void vc_tc_scroll(void* cookie, int y0, int y1, int dir) {
         return;
     // invalidate the cursor before copying
     vc_device_invalidate(cookie, dev->x, dev->y, 1, 1);
+    // move what is already drawn and only draw the uncovered lines
     int delta = ABS(dir);
     if (dir > 0) {
         gfx_copyrect(dev->gfx, 0, (y0 + delta) * dev->charh,
-                     dev->gfx->width, (y1 - y0 - delta) * dev->charh, 0, y0);
+                     dev->gfx->width, (y1 - y0 - delta) * dev->charh, 0, y0 * dev->charh);
         vc_device_invalidate(cookie, 0, y1 - delta, dev->columns, delta);
     } else {
-        gfx_copyrect(dev->gfx, 0, y0, dev->gfx->width, (y1 - y0 - delta) * dev->charh,
+        gfx_copyrect(dev->gfx, 0, y0 * dev->charh, dev->gfx->width, (y1 - y0 - delta) * dev->charh,
                      0, (y0 + delta) * dev->charh);
         vc_device_invalidate(cookie, 0, y0, dev->columns, delta);
     }
-    vc_device_write_status(dev);
-    vc_gfx_invalidate_status(dev);
-    vc_invalidate_lines(dev, 0, dev->rows);
+    // the scrollback indicator only changes when the first line is pushed
+    if (vc_device_get_scrollback_lines(dev) == 1) {
+        vc_device_write_status(dev);
+        vc_gfx_invalidate_status(dev);
+    }
+    vc_invalidate_lines(dev, y0, y1 - y0);
 }
 
 static void vc_tc_setparam(void* cookie, int param, uint8_t* arg, size_t arglen) {
@@ -362,6 +366,8 @@ fail:
 }
 
 void vc_device_free(vc_device_t* device) {
+    vc_gfx_release(device);
+    vc_gfx_free_atlas(device);
     if (device->st_gfx)
         gfx_surface_destroy(device->st_gfx);
     if (device->gfx_vmo)
@@ -2,52 +2,405 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <ddk/completion.h>
+#include <ddk/protocol/display.h>
 #include <gfx/gfx.h>
+#include <magenta/syscalls.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <threads.h>
 
 #define VCDEBUG 1
 
 #include "vc.h"
 #include "vcdebug.h"
 
+// only chars up to 127 are in the fonts, the rest draw as blanks
+#define VC_ATLAS_GLYPHS 128
+
+static vc_glyph_atlas_t* vc_gfx_get_atlas(vc_device_t* dev, vc_char_t colors) {
+    vc_glyph_atlas_t* victim = NULL;
+    for (unsigned i = 0; i < VC_GLYPH_ATLASES; i++) {
+        vc_glyph_atlas_t* atlas = &dev->atlas[i];
+        if (atlas->pixels && atlas->colors == colors) {
+            atlas->last_used = ++dev->atlas_clock;
+            return atlas;
+        }
+        // prefer an unused slot, then the least recently used
+        if (!victim || (victim->pixels && (!atlas->pixels || atlas->last_used < victim->last_used))) {
+            victim = atlas;
+        }
+    }
+    if (!victim->pixels) {
+        size_t sz = VC_ATLAS_GLYPHS * dev->charw * dev->charh * dev->gfx->pixelsize;
+        if ((victim->pixels = malloc(sz)) == NULL) {
+            return NULL;
+        }
+    }
+    victim->colors = colors;
+    victim->last_used = ++dev->atlas_clock;
+    memset(victim->rendered, 0, sizeof(victim->rendered));
+    return victim;
+}
+
+void vc_gfx_free_atlas(vc_device_t* dev) {
+    for (unsigned i = 0; i < VC_GLYPH_ATLASES; i++) {
+        free(dev->atlas[i].pixels);
+        dev->atlas[i].pixels = NULL;
+    }
+}
+
 void vc_gfx_draw_char(vc_device_t* dev, vc_char_t ch, unsigned x, unsigned y) {
-    gfx_putchar(dev->gfx, dev->font, TOCHAR(ch), x * dev->charw, y * dev->charh,
-                palette_to_color(dev, TOFG(ch)), palette_to_color(dev, TOBG(ch)));
+    gfx_surface* gfx = dev->gfx;
+    if (((x + 1) * dev->charw > gfx->width) || ((y + 1) * dev->charh > gfx->height)) {
+        return;
+    }
+    unsigned c = TOCHAR(ch) < VC_ATLAS_GLYPHS ? TOCHAR(ch) : ' ';
+    uint32_t fg = palette_to_color(dev, TOFG(ch));
+    uint32_t bg = palette_to_color(dev, TOBG(ch));
+
+    vc_glyph_atlas_t* atlas = vc_gfx_get_atlas(dev, ch & ~0xff);
+    if (atlas == NULL) {
+        gfx_putchar(gfx, dev->font, c, x * dev->charw, y * dev->charh, fg, bg);
+        dev->chars_drawn++;
+        return;
+    }
+
+    size_t rowlen = dev->charw * gfx->pixelsize;
+    uint8_t* glyph = atlas->pixels + c * rowlen * dev->charh;
+    if (!(atlas->rendered[c / 32] & (1u << (c % 32)))) {
+        // draw it once with the regular renderer, into a surface that is
+        // just this glyph
+        gfx_surface glyph_gfx;
+        gfx_init_surface(&glyph_gfx, glyph, dev->charw, dev->charh, dev->charw, gfx->format, 0);
+        gfx_putchar(&glyph_gfx, dev->font, c, 0, 0, fg, bg);
+        atlas->rendered[c / 32] |= 1u << (c % 32);
+        dev->atlas_misses++;
+    }
+
+    size_t stride = gfx->stride * gfx->pixelsize;
+    uint8_t* dst = (uint8_t*)gfx->ptr + y * dev->charh * stride + x * rowlen;
+    for (unsigned i = 0; i < dev->charh; i++) {
+        memcpy(dst, glyph, rowlen);
+        dst += stride;
+        glyph += rowlen;
+    }
+    dev->chars_drawn++;
+}
+
+// Damage to the framebuffer, in pixels of the vc's main surface.
+// Overlapping or touching rectangles are merged as they come in, so a
+// stream of output lines collapses into one rectangle.
+//
+// If the display can flip between two framebuffers the damage is drawn
+// into the one not being scanned out and then flipped to, so the screen
+// never shows a half drawn frame.  That buffer is a frame behind, so
+// the previous frame's damage is drawn into it as well.
+
+#define VC_MAX_DAMAGE 8
+#define VC_FLUSH_INTERVAL MX_MSEC(16)
+#define VC_FLIP_TIMEOUT MX_MSEC(100)
+
+typedef struct vc_rect {
+    unsigned x, y, w, h;
+} vc_rect_t;
+
+static mtx_t flush_lock = MTX_INIT;
+static completion_t flush_completion = COMPLETION_INIT;
+
+// guarded by flush_lock, which is also held while copying out, so that
+// vc_gfx_release() can wait for a flush that is reading a vc
+static vc_device_t* damage_dev;
+static vc_rect_t damage[VC_MAX_DAMAGE];
+static unsigned damage_count;
+static vc_device_t* status_dev;
+
+static mx_device_t* disp_dev;
+static mx_display_protocol_t* disp;
+static gfx_surface* hw_buffers[2];
+// the buffer to draw into, the one on screen if not double buffering
+static unsigned hw_back;
+static bool double_buffered;
+static mx_handle_t flip_event;
+// damage from the previous frame, and the last vc to draw the status bar
+static vc_device_t* prev_dev;
+static vc_rect_t prev_damage[VC_MAX_DAMAGE];
+static unsigned prev_count;
+static vc_device_t* prev_status_dev;
+
+static uint64_t invalidations;
+static uint64_t flushes;
+static uint64_t flush_rows;
+static mx_time_t flush_time;
+static mx_time_t flush_time_max;
+
+void vc_gfx_init_display(mx_device_t* dev, mx_display_protocol_t* proto, gfx_surface* hw_gfx) {
+    disp_dev = dev;
+    disp = proto;
+    hw_buffers[0] = hw_gfx;
+
+    if (!proto->get_buffers || !proto->flip)
+        return;
+    void* buffers[2];
+    uint32_t count = countof(buffers);
+    if ((proto->get_buffers(dev, buffers, &count) < 0) || (count < 2))
+        return;
+    if ((flip_event = mx_event_create(0)) < 0)
+        return;
+    hw_buffers[1] = gfx_create_surface(buffers[1], hw_gfx->width, hw_gfx->height,
+                                       hw_gfx->stride, hw_gfx->format, 0);
+    if (hw_buffers[1] == NULL) {
+        mx_handle_close(flip_event);
+        return;
+    }
+    // buffer 0 is on screen
+    hw_back = 1;
+    double_buffered = true;
+    xprintf("vc: double buffering with page flips\n");
+}
+
+static bool rect_touches(const vc_rect_t* a, const vc_rect_t* b) {
+    return (a->x <= b->x + b->w) && (b->x <= a->x + a->w) &&
+           (a->y <= b->y + b->h) && (b->y <= a->y + a->h);
+}
+
+static void rect_union(vc_rect_t* a, const vc_rect_t* b) {
+    unsigned x1 = MAX(a->x + a->w, b->x + b->w);
+    unsigned y1 = MAX(a->y + a->h, b->y + b->h);
+    a->x = MIN(a->x, b->x);
+    a->y = MIN(a->y, b->y);
+    a->w = x1 - a->x;
+    a->h = y1 - a->y;
+}
+
+static void vc_gfx_add_damage(vc_device_t* dev, unsigned x, unsigned y, unsigned w, unsigned h) {
+    if ((x >= dev->gfx->width) || (y >= dev->gfx->height))
+        return;
+    vc_rect_t r = {
+        .x = x,
+        .y = y,
+        .w = MIN(w, dev->gfx->width - x),
+        .h = MIN(h, dev->gfx->height - y),
+    };
+    if ((r.w == 0) || (r.h == 0))
+        return;
+
+    mtx_lock(&flush_lock);
+    if (damage_dev != dev) {
+        // the active vc changed, what is left belongs to the old one
+        damage_dev = dev;
+        damage_count = 0;
+    }
+    unsigned i;
+    for (i = 0; i < damage_count; i++) {
+        if (rect_touches(&damage[i], &r)) {
+            rect_union(&damage[i], &r);
+            break;
+        }
+    }
+    if (i == damage_count) {
+        if (damage_count < VC_MAX_DAMAGE) {
+            damage[damage_count++] = r;
+        } else {
+            rect_union(&damage[damage_count - 1], &r);
+        }
+    }
+    invalidations++;
+    completion_signal(&flush_completion);
+    mtx_unlock(&flush_lock);
+}
+
+static void vc_gfx_add_status_damage(vc_device_t* dev) {
+    mtx_lock(&flush_lock);
+    status_dev = dev;
+    invalidations++;
+    completion_signal(&flush_completion);
+    mtx_unlock(&flush_lock);
+}
+
+static void vc_gfx_copy_rect(gfx_surface* hw_gfx, vc_device_t* dev, const vc_rect_t* r) {
+    unsigned offset = dev->st_gfx->height;
+    if ((r->x == 0) && (r->w == dev->gfx->width)) {
+        gfx_copylines(hw_gfx, dev->gfx, r->y, offset + r->y, r->h);
+    } else {
+        gfx_blend(hw_gfx, dev->gfx, r->x, r->y, r->w, r->h, r->x, offset + r->y);
+    }
+    if (!double_buffered && disp->flush_region) {
+        disp->flush_region(disp_dev, r->x, offset + r->y, r->w, r->h);
+    }
+}
+
+// called with flush_lock held, returns true if a flip was started
+static bool vc_gfx_flush_locked(void) {
+    vc_device_t* dev = damage_dev ? damage_dev : prev_dev;
+    if (!double_buffered) {
+        dev = damage_dev;
+        prev_status_dev = NULL;
+    }
+    vc_device_t* st_dev = status_dev ? status_dev : prev_status_dev;
+    if ((dev == NULL) && (st_dev == NULL))
+        return false;
+
+    mx_time_t t0 = mx_current_time();
+    gfx_surface* hw_gfx = hw_buffers[hw_back];
+    unsigned rows = 0;
+    unsigned y0 = UINT32_MAX;
+    unsigned y1 = 0;
+
+    if (st_dev) {
+        unsigned h = st_dev->st_gfx->height;
+        gfx_copylines(hw_gfx, st_dev->st_gfx, 0, 0, h);
+        if (!double_buffered && disp->flush_region) {
+            disp->flush_region(disp_dev, 0, 0, hw_gfx->width, h);
+        }
+        rows += h;
+        y0 = 0;
+        y1 = h;
+        prev_status_dev = status_dev;
+        status_dev = NULL;
+    }
+    if (dev) {
+        unsigned offset = dev->st_gfx->height;
+        if (double_buffered && (prev_dev != dev)) {
+            // nothing is known about what the back buffer holds
+            vc_rect_t all = { 0, 0, dev->gfx->width, dev->gfx->height };
+            vc_gfx_copy_rect(hw_gfx, dev, &all);
+            rows += all.h;
+            y0 = MIN(y0, offset);
+            y1 = MAX(y1, offset + all.h);
+        } else {
+            for (unsigned i = 0; i < damage_count + (double_buffered ? prev_count : 0); i++) {
+                vc_rect_t* r = (i < damage_count) ? &damage[i] : &prev_damage[i - damage_count];
+                vc_gfx_copy_rect(hw_gfx, dev, r);
+                rows += r->h;
+                y0 = MIN(y0, offset + r->y);
+                y1 = MAX(y1, offset + r->y + r->h);
+            }
+        }
+        memcpy(prev_damage, damage, damage_count * sizeof(vc_rect_t));
+        prev_count = damage_count;
+        prev_dev = dev;
+        damage_count = 0;
+        damage_dev = NULL;
+    }
+    if (rows == 0) {
+        // the damage was empty, nothing to flush or flip to
+        return false;
+    }
+    gfx_flush_rows(hw_gfx, y0, y1);
+
+    bool flipped = false;
+    if (double_buffered) {
+        mx_status_t status = disp->flip(disp_dev, hw_back, flip_event);
+        if (status == NO_ERROR) {
+            hw_back = 1 - hw_back;
+            flipped = true;
+        } else {
+            if ((status == ERR_NOT_SUPPORTED) || (status == ERR_INVALID_ARGS)) {
+                // the display can't flip, go back to drawing straight into
+                // the buffer on screen, which this frame didn't go to
+                xprintf("vc: flip failed (%d), not double buffering\n", status);
+                double_buffered = false;
+                hw_back = 1 - hw_back;
+            } else {
+                // most likely the last flip is still pending, so show this
+                // frame on the next flush. Redraw it whole, since the other
+                // buffer misses this frame's damage as well
+                xprintf("vc: flip failed (%d), retrying\n", status);
+            }
+            status_dev = st_dev;
+            damage_dev = dev;
+            damage[0] = (vc_rect_t){ 0, 0, dev ? dev->gfx->width : 0, dev ? dev->gfx->height : 0 };
+            damage_count = dev ? 1 : 0;
+            completion_signal(&flush_completion);
+        }
+    }
+
+    mx_time_t t = mx_current_time() - t0;
+    flushes++;
+    flush_rows += rows;
+    flush_time += t;
+    if (t > flush_time_max)
+        flush_time_max = t;
+    return flipped;
+}
+
+int vc_gfx_flush_thread(void* arg) {
+    mx_time_t next = 0;
+    for (;;) {
+        completion_wait(&flush_completion, MX_TIME_INFINITE);
+
+        // let damage pile up until the next frame is due
+        mx_time_t now = mx_current_time();
+        if (now < next) {
+            mx_nanosleep(next - now);
+            now = next;
+        }
+        next = now + VC_FLUSH_INTERVAL;
+
+        mtx_lock(&flush_lock);
+        completion_reset(&flush_completion);
+        bool flipped = vc_gfx_flush_locked();
+        mtx_unlock(&flush_lock);
+
+        if (flipped) {
+            // the old front buffer can't be drawn into until it is off screen
+            mx_handle_wait_one(flip_event, MX_SIGNAL_SIGNALED, VC_FLIP_TIMEOUT, NULL);
+            mx_object_signal(flip_event, MX_SIGNAL_SIGNALED, 0);
+        }
+    }
+    return 0;
+}
+
+void vc_gfx_get_stats(ioctl_console_stats_t* stats) {
+    mtx_lock(&flush_lock);
+    stats->invalidations = invalidations;
+    stats->flushes = flushes;
+    stats->flush_rows = flush_rows;
+    stats->flush_time = flush_time;
+    stats->flush_time_max = flush_time_max;
+    mtx_unlock(&flush_lock);
+}
+
+void vc_gfx_release(vc_device_t* dev) {
+    mtx_lock(&flush_lock);
+    if (damage_dev == dev) {
+        damage_dev = NULL;
+        damage_count = 0;
+    }
+    if (prev_dev == dev) {
+        prev_dev = NULL;
+        prev_count = 0;
+    }
+    if (status_dev == dev) {
+        status_dev = NULL;
+    }
+    if (prev_status_dev == dev) {
+        prev_status_dev = NULL;
+    }
+    mtx_unlock(&flush_lock);
 }
 
 void vc_gfx_invalidate_all(vc_device_t* dev) {
     if (!dev->active)
         return;
-    gfx_copylines(dev->hw_gfx, dev->st_gfx, 0, 0, dev->st_gfx->height);
-    gfx_copylines(dev->hw_gfx, dev->gfx, 0, dev->st_gfx->height, dev->gfx->height);
-    gfx_flush(dev->hw_gfx);
+    vc_gfx_add_status_damage(dev);
+    vc_gfx_add_damage(dev, 0, 0, dev->gfx->width, dev->gfx->height);
 }
 
 void vc_gfx_invalidate_status(vc_device_t* dev) {
-    gfx_copylines(dev->hw_gfx, dev->st_gfx, 0, 0, dev->st_gfx->height);
-    gfx_flush_rows(dev->hw_gfx, 0, dev->st_gfx->height);
+    vc_gfx_add_status_damage(dev);
 }
 
 void vc_gfx_invalidate(vc_device_t* dev, unsigned x, unsigned y, unsigned w, unsigned h) {
     if (!dev->active)
         return;
-    unsigned desty = dev->st_gfx->height + y * dev->charh;
-    if ((x == 0) && (w == dev->columns)) {
-        gfx_copylines(dev->hw_gfx, dev->gfx, y * dev->charh, desty, h * dev->charh);
-    } else {
-        gfx_blend(dev->hw_gfx, dev->gfx, x * dev->charw, y * dev->charh,
-                  w * dev->charw, h * dev->charh, x * dev->charw, desty);
-    }
-    gfx_flush_rows(dev->hw_gfx, desty, desty + h * dev->charh);
+    vc_gfx_add_damage(dev, x * dev->charw, y * dev->charh, w * dev->charw, h * dev->charh);
 }
 
 void vc_gfx_invalidate_region(vc_device_t* dev, unsigned x, unsigned y, unsigned w, unsigned h) {
     if (!dev->active)
         return;
-    unsigned desty = dev->st_gfx->height + y;
-    if ((x == 0) && (w == dev->columns)) {
-        gfx_copylines(dev->hw_gfx, dev->gfx, y, desty, h);
-    } else {
-        gfx_blend(dev->hw_gfx, dev->gfx, x, y, w, h, x, desty);
-    }
-    gfx_flush_rows(dev->hw_gfx, desty, desty + h);
+    vc_gfx_add_damage(dev, x, y, w, h);
 }
@@ -5,8 +5,10 @@
 #include <assert.h>
 #include <ddk/device.h>
 #include <ddk/common/hid-fifo.h>
+#include <ddk/protocol/display.h>
 #include <gfx/gfx.h>
 #include <hid/hid.h>
+#include <magenta/device/console.h>
 #include <mxio/vfs.h>
 #include <magenta/listnode.h>
 #include <stdbool.h>
@@ -22,6 +24,19 @@ typedef uint16_t vc_char_t;
 
 #define MAX_COLOR 0xf
 
+// glyphs pre-rendered in one fg/bg color pair, in the framebuffer's
+// format, so drawing a character is a copy of charh rows
+#define VC_GLYPH_ATLASES 4
+
+typedef struct vc_glyph_atlas {
+    vc_char_t colors;
+    // fg/bg bits of the vc_char_t, valid if pixels is set
+    uint32_t last_used;
+    uint32_t rendered[256 / 32];
+    // bitmap of the glyphs drawn so far
+    uint8_t* pixels;
+} vc_glyph_atlas_t;
+
 typedef struct vc_device {
     mx_device_t device;
 
@@ -74,6 +89,15 @@ typedef struct vc_device {
     unsigned back_color;
     // color
 
+    vc_glyph_atlas_t atlas[VC_GLYPH_ATLASES];
+    uint32_t atlas_clock;
+    // glyph cache, see vc_gfx_draw_char()
+
+    uint64_t chars_drawn;
+    uint64_t atlas_misses;
+    mx_time_t draw_time;
+    // cost of redrawing invalidated text
+
     textcon_t textcon;
 
     mx_hid_fifo_t fifo;
@@ -108,6 +132,16 @@ int vc_device_get_scrollback_lines(vc_device_t* dev);
 void vc_device_scroll_viewport(vc_device_t* dev, int dir);
 
 // drawing:
+//
+// The invalidate calls only record damage to the framebuffer.  The damage
+// is copied out by vc_gfx_flush_thread() at most once per frame interval.
+
+void vc_gfx_init_display(mx_device_t* dev, mx_display_protocol_t* disp, gfx_surface* hw_gfx);
+int vc_gfx_flush_thread(void* arg);
+void vc_gfx_get_stats(ioctl_console_stats_t* stats);
+// stops any pending flush from reading the vc's surface
+void vc_gfx_release(vc_device_t* dev);
+void vc_gfx_free_atlas(vc_device_t* dev);
 
 void vc_gfx_invalidate_all(vc_device_t* dev);
 void vc_gfx_invalidate_status(vc_device_t* dev);
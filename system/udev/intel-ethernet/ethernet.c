@@ -33,32 +33,48 @@ struct ethernet_device {
     mx_device_t* pcidev;
     mx_handle_t ioh;
     mx_handle_t irqh;
+    mx_handle_t irq_port;
     bool edge_triggered_irq;
     thrd_t thread;
 };
 
 #define get_eth_device(d) containerof(d, ethernet_device_t, dev)
 
+// msi interrupts are delivered to a port, and re-armed when this
+// thread next waits.  legacy interrupts are level triggered, so
+// they must stay masked until the device has been serviced.
+static mx_status_t irq_wait(ethernet_device_t* edev) {
+    if (edev->irq_port > 0) {
+        mx_irq_packet_t pkt;
+        return mx_port_wait(edev->irq_port, &pkt, sizeof(pkt));
+    }
+
+    mx_status_t r;
+    if ((r = mx_handle_wait_one(edev->irqh, MX_SIGNAL_SIGNALED, MX_TIME_INFINITE, NULL)) < 0) {
+        mx_interrupt_complete(edev->irqh);
+        return r;
+    }
+    if (edev->edge_triggered_irq)
+        mx_interrupt_complete(edev->irqh);
+    return NO_ERROR;
+}
+
 static int irq_thread(void* arg) {
     ethernet_device_t* edev = arg;
     for (;;) {
         mx_status_t r;
-        if ((r = mx_handle_wait_one(edev->irqh, MX_SIGNAL_SIGNALED, MX_TIME_INFINITE, NULL)) < 0) {
+        if ((r = irq_wait(edev)) < 0) {
             printf("eth: irq wait failed? %d\n", r);
-            mx_interrupt_complete(edev->irqh);
             break;
         }
 
-        if (edev->edge_triggered_irq)
-            mx_interrupt_complete(edev->irqh);
-
         mtx_lock(&edev->lock);
         if (eth_handle_irq(&edev->eth) & ETH_IRQ_RX) {
             device_state_set(&edev->dev, DEV_STATE_READABLE);
         }
         mtx_unlock(&edev->lock);
 
-        if (!edev->edge_triggered_irq)
+        if (edev->irq_port <= 0 && !edev->edge_triggered_irq)
             mx_interrupt_complete(edev->irqh);
     }
     return 0;
@@ -133,6 +149,9 @@ static mx_status_t eth_release(mx_device_t* dev) {
     eth_reset_hw(&edev->eth);
     edev->pci->enable_bus_master(edev->pcidev, true);
     mx_handle_close(edev->irqh);
+    if (edev->irq_port > 0) {
+        mx_handle_close(edev->irq_port);
+    }
     mx_handle_close(edev->ioh);
     free(dev);
     return ERR_NOT_SUPPORTED;
@@ -181,6 +200,17 @@ static mx_status_t eth_bind(mx_driver_t* drv, mx_device_t* dev) {
         goto fail;
     }
 
+    if (edev->edge_triggered_irq) {
+        if ((edev->irq_port = mx_port_create(0)) < 0 ||
+            mx_interrupt_bind(edev->irqh, edev->irq_port, 0, 1, 0) < 0) {
+            // fall back to waiting on the interrupt handle
+            if (edev->irq_port > 0) {
+                mx_handle_close(edev->irq_port);
+            }
+            edev->irq_port = 0;
+        }
+    }
+
     // map iomem
     uint64_t sz;
     mx_handle_t h;
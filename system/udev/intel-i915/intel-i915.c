@@ -15,6 +15,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/param.h>
+#include <threads.h>
+
+#include <ddk/completion.h>
 
 #define INTEL_I915_VID (0x8086)
 #define INTEL_I915_BROADWELL_DID (0x1616)
@@ -25,6 +29,21 @@
 #define BACKLIGHT_CTRL_OFFSET (0xc8250)
 #define BACKLIGHT_CTRL_BIT ((uint32_t)(1u << 31))
 
+// primary plane of pipe A, which the firmware leaves the console on
+#define DSPASURF_OFFSET (0x7019c)
+#define DSPASURFLIVE_OFFSET (0x701ac)
+
+// on gen8 the global GTT is the upper half of the register window,
+// with 64 bit entries mapping the framebuffer aperture in 4K pages
+#define GEN8_GTT_OFFSET (0x800000u)
+#define GEN8_GTT_PTE_SIZE (8)
+#define GTT_PTE_VALID (1u << 0)
+#define GTT_PAGE_SIZE (4096u)
+
+#define INTEL_I915_MAX_BUFFERS 3
+#define INTEL_I915_SURF_ALIGN (256u * 1024)
+#define INTEL_I915_FLIP_TIMEOUT MX_MSEC(100)
+
 #define TRACE 0
 
 #if TRACE
@@ -47,9 +66,21 @@ typedef struct intel_i915_device {
 
     mx_display_info_t info;
     uint32_t flags;
+
+    // page flipping, buffers are at surf_size intervals in the aperture
+    void* buffers[INTEL_I915_MAX_BUFFERS];
+    uint32_t buffer_count;
+    uint32_t surf_size;
+
+    mtx_t flip_lock;
+    completion_t flip_completion;
+    mx_handle_t flip_event;
+    uint32_t flip_surf;
+    bool flip_pending;
 } intel_i915_device_t;
 
 #define FLAGS_BACKLIGHT 1
+#define FLAGS_GEN8_GTT 2
 
 #define get_i915_device(dev) containerof(dev, intel_i915_device_t, device)
 
@@ -87,10 +118,131 @@ static mx_status_t intel_i915_get_framebuffer(mx_device_t* dev, void** framebuff
     return NO_ERROR;
 }
 
+static mx_status_t intel_i915_get_buffers(mx_device_t* dev, void** buffers, uint32_t* count) {
+    intel_i915_device_t* device = get_i915_device(dev);
+    for (uint32_t i = 0; i < MIN(*count, device->buffer_count); i++) {
+        buffers[i] = device->buffers[i];
+    }
+    *count = device->buffer_count;
+    return NO_ERROR;
+}
+
+static mx_status_t intel_i915_flip(mx_device_t* dev, uint32_t buffer, mx_handle_t event) {
+    intel_i915_device_t* device = get_i915_device(dev);
+    if (buffer >= device->buffer_count)
+        return ERR_INVALID_ARGS;
+
+    mtx_lock(&device->flip_lock);
+    if (device->flip_pending) {
+        mtx_unlock(&device->flip_lock);
+        return ERR_SHOULD_WAIT;
+    }
+    // the plane latches the new surface address at the next vblank
+    device->flip_surf = buffer * device->surf_size;
+    pcie_write32((uint32_t*)((uint8_t*)device->regs + DSPASURF_OFFSET), device->flip_surf);
+    device->flip_event = event;
+    device->flip_pending = true;
+    completion_signal(&device->flip_completion);
+    mtx_unlock(&device->flip_lock);
+
+    // the kernel draws panics into the buffer it was given, keep that on screen
+    mx_set_framebuffer(get_root_resource(), device->buffers[buffer], device->surf_size,
+                       device->info.format, device->info.width, device->info.height,
+                       device->info.stride);
+    return NO_ERROR;
+}
+
+static int intel_i915_vblank_thread(void* arg) {
+    intel_i915_device_t* device = arg;
+    volatile uint32_t* live = (uint32_t*)((uint8_t*)device->regs + DSPASURFLIVE_OFFSET);
+    for (;;) {
+        completion_wait(&device->flip_completion, MX_TIME_INFINITE);
+
+        // there is no interrupt wired up, so watch for the plane to
+        // start scanning out of the new surface
+        mx_time_t deadline = mx_current_time() + INTEL_I915_FLIP_TIMEOUT;
+        while ((pcie_read32(live) & ~(GTT_PAGE_SIZE - 1)) != device->flip_surf) {
+            if (mx_current_time() > deadline) {
+                xprintf("intel-i915: flip to 0x%x timed out\n", device->flip_surf);
+                break;
+            }
+            mx_nanosleep(MX_MSEC(1));
+        }
+
+        mtx_lock(&device->flip_lock);
+        completion_reset(&device->flip_completion);
+        if (device->flip_event != MX_HANDLE_INVALID) {
+            mx_object_signal(device->flip_event, 0, MX_SIGNAL_SIGNALED);
+            device->flip_event = MX_HANDLE_INVALID;
+        }
+        device->flip_pending = false;
+        mtx_unlock(&device->flip_lock);
+    }
+    return 0;
+}
+
+static uint32_t intel_i915_pixelsize(uint32_t format) {
+    switch (format) {
+    case MX_PIXEL_FORMAT_RGB_565:
+        return 2;
+    case MX_PIXEL_FORMAT_ARGB_8888:
+    case MX_PIXEL_FORMAT_RGB_x888:
+        return 4;
+    default:
+        return 1;
+    }
+}
+
+// Finds how many buffers fit in the part of the aperture the firmware
+// mapped through the GTT.  The GTT is not reprogrammed.
+static void intel_i915_init_buffers(intel_i915_device_t* device) {
+    device->buffers[0] = device->framebuffer;
+    device->buffer_count = 1;
+
+    if (!(device->flags & FLAGS_GEN8_GTT))
+        return;
+    // the console is expected to be at the start of the aperture
+    if (pcie_read32((uint32_t*)((uint8_t*)device->regs + DSPASURF_OFFSET)) & ~(GTT_PAGE_SIZE - 1))
+        return;
+
+    mx_display_info_t* di = &device->info;
+    device->surf_size = roundup(di->stride * di->height * intel_i915_pixelsize(di->format),
+                                INTEL_I915_SURF_ALIGN);
+    uint64_t want = (uint64_t)device->surf_size * INTEL_I915_MAX_BUFFERS;
+    uint64_t pages = MIN(want, device->framebuffer_size) / GTT_PAGE_SIZE;
+    if (device->regs_size < GEN8_GTT_OFFSET + pages * GEN8_GTT_PTE_SIZE)
+        return;
+
+    uint8_t* gtt = (uint8_t*)device->regs + GEN8_GTT_OFFSET;
+    uint64_t mapped;
+    for (mapped = 0; mapped < pages; mapped++) {
+        if (!(pcie_read32((uint32_t*)(gtt + mapped * GEN8_GTT_PTE_SIZE)) & GTT_PTE_VALID))
+            break;
+    }
+
+    uint32_t count = (mapped * GTT_PAGE_SIZE) / device->surf_size;
+    if (count < 2)
+        return;
+
+    mtx_init(&device->flip_lock, mtx_plain);
+    device->flip_completion = COMPLETION_INIT;
+    thrd_t t;
+    if (thrd_create_with_name(&t, intel_i915_vblank_thread, device, "intel_i915-vblank") != thrd_success)
+        return;
+    thrd_detach(t);
+
+    for (uint32_t i = 1; i < count; i++) {
+        device->buffers[i] = (uint8_t*)device->framebuffer + i * device->surf_size;
+    }
+    device->buffer_count = count;
+}
+
 static mx_display_protocol_t intel_i915_display_proto = {
     .set_mode = intel_i915_set_mode,
     .get_mode = intel_i915_get_mode,
     .get_framebuffer = intel_i915_get_framebuffer,
+    .get_buffers = intel_i915_get_buffers,
+    .flip = intel_i915_flip,
 };
 
 // implement device protocol
@@ -149,7 +301,7 @@ static mx_status_t intel_i915_bind(mx_driver_t* drv, mx_device_t* dev) {
     if (cfg_handle >= 0) {
         if (pci_config->device_id == INTEL_I915_BROADWELL_DID) {
             // TODO: this should be based on the specific target
-            device->flags |= FLAGS_BACKLIGHT;
+            device->flags |= FLAGS_BACKLIGHT | FLAGS_GEN8_GTT;
         }
         mx_handle_close(cfg_handle);
     }
@@ -190,6 +342,8 @@ static mx_status_t intel_i915_bind(mx_driver_t* drv, mx_device_t* dev) {
     }
     di->flags = MX_DISPLAY_FLAG_HW_FRAMEBUFFER;
 
+    intel_i915_init_buffers(device);
+
     // TODO remove when the gfxconsole moves to user space
     intel_i915_enable_backlight(device, true);
     mx_set_framebuffer(get_root_resource(), device->framebuffer, device->framebuffer_size,
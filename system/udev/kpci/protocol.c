@@ -99,6 +99,14 @@ static mx_status_t pci_set_irq_mode(mx_device_t* dev,
     return mx_pci_set_irq_mode(device->handle, mode, requested_irq_count);
 }
 
+static mx_status_t pci_set_irq_affinity(mx_device_t* dev,
+                                        uint32_t which_irq,
+                                        uint32_t cpu_num) {
+    kpci_device_t* device = get_kpci_device(dev);
+    assert(device->handle != MX_HANDLE_INVALID);
+    return mx_pci_set_irq_affinity(device->handle, which_irq, cpu_num);
+}
+
 static pci_protocol_t _pci_protocol = {
     .claim_device = pci_claim_device,
     .enable_bus_master = pci_enable_bus_master,
@@ -108,4 +116,5 @@ static pci_protocol_t _pci_protocol = {
     .get_config = pci_get_config,
     .query_irq_mode_caps = pci_query_irq_mode_caps,
     .set_irq_mode = pci_set_irq_mode,
+    .set_irq_affinity = pci_set_irq_affinity,
 };
@@ -53,6 +53,14 @@
 #define AHCI_PORT_FLAG_IMPLEMENTED (1 << 0)
 #define AHCI_PORT_FLAG_PRESENT     (1 << 1)
 
+// how long the deadline scheduler lets a txn wait before it is issued
+// ahead of everything else
+#define AHCI_READ_DEADLINE  (50ULL * 1000 * 1000)
+#define AHCI_WRITE_DEADLINE (500ULL * 1000 * 1000)
+
+// largest sector count a single read/write command can carry
+#define AHCI_MAX_CMD_SECTORS 0xffff
+
 typedef struct ahci_port {
     int nr; // 0-based
     int flags;
@@ -63,10 +71,19 @@ typedef struct ahci_port {
     ahci_ct_t* ct[AHCI_MAX_COMMANDS];
 
     uint32_t running; // bitmask of running commands
+    uint32_t queued;  // bitmask of running commands that are ncq
     iotxn_t* commands[AHCI_MAX_COMMANDS]; // commands in flight
+    list_node_t merged[AHCI_MAX_COMMANDS]; // txns sharing a command with commands[i]
 
-    mtx_t lock; // protects txn_list
+    mtx_t lock; // protects txn_list and the command/scheduler state
     list_node_t txn_list;
+
+    uint32_t sched;    // BLOCK_SCHED_*
+    uint64_t next_lba; // where the deadline scheduler's sweep resumes
+
+    block_stats_t stats;
+    mx_time_t stats_start;
+    mx_time_t stats_mark; // when depth last changed
 } ahci_port_t;
 
 typedef struct ahci_device {
@@ -78,8 +95,12 @@ typedef struct ahci_device {
 
     pci_protocol_t* pci;
 
-    mx_handle_t irq_handle;
-    thrd_t irq_thread;
+    // one msi vector per port where the hba supports it, all delivered to
+    // irq_port with the vector as the packet key
+    uint32_t irq_count;
+    mx_handle_t irq_handles[AHCI_MAX_IRQS];
+    mx_handle_t irq_port;
+    thrd_t irq_threads[AHCI_MAX_IRQS];
 
     thrd_t worker_thread;
     completion_t worker_completion;
@@ -179,7 +200,7 @@ static void ahci_port_reset(ahci_port_t* port) {
 }
 
 static bool ahci_port_cmd_busy(ahci_port_t* port, int slot) {
-    return ((ahci_read(&port->regs->sact) | ahci_read(&port->regs->ci)) & slot) || (port->commands[slot] != NULL);
+    return ((ahci_read(&port->regs->sact) | ahci_read(&port->regs->ci)) & (1u << slot)) || (port->commands[slot] != NULL);
 }
 
 static bool cmd_is_write(uint8_t cmd) {
@@ -196,23 +217,88 @@ static bool cmd_is_queued(uint8_t cmd) {
     return (cmd == SATA_CMD_READ_FPDMA_QUEUED) || (cmd == SATA_CMD_WRITE_FPDMA_QUEUED);
 }
 
+static bool cmd_is_rw(uint8_t cmd) {
+    return cmd_is_queued(cmd) ||
+           (cmd == SATA_CMD_READ_DMA_EXT) || (cmd == SATA_CMD_WRITE_DMA_EXT);
+}
+
+// number of prds needed to describe a txn's data
+static uint32_t ahci_txn_prds(iotxn_t* txn) {
+    iotxn_sg_t* sg;
+    uint32_t sg_count;
+    txn->ops->physmap_sg(txn, &sg, &sg_count);
+    mx_off_t remaining = txn->length;
+    uint32_t prds = 0;
+    for (uint32_t i = 0; (i < sg_count) && (remaining > 0); i++) {
+        mx_off_t length = MIN(sg[i].length, remaining);
+        remaining -= length;
+        prds += (length + AHCI_PRD_MAX_SIZE - 1) / AHCI_PRD_MAX_SIZE;
+    }
+    return prds;
+}
+
+// append a txn's physical runs to the slot's prdt, splitting any run the
+// hardware can't describe in one entry
+static mx_status_t ahci_prd_fill(ahci_port_t* port, int slot, iotxn_t* txn, int* prdtl) {
+    iotxn_sg_t* sg;
+    uint32_t sg_count;
+    txn->ops->physmap_sg(txn, &sg, &sg_count);
+    ahci_prd_t* prd = (ahci_prd_t*)((void*)port->ct[slot] + sizeof(ahci_ct_t));
+    mx_off_t remaining = txn->length;
+    for (uint32_t i = 0; (i < sg_count) && (remaining > 0); i++) {
+        mx_paddr_t phys = sg[i].paddr;
+        mx_off_t length = MIN(sg[i].length, remaining);
+        remaining -= length;
+        while (length > 0) {
+            if (*prdtl == AHCI_MAX_PRDS) {
+                xprintf("ahci.%d: txn %p needs more than %d prds\n", port->nr, txn, AHCI_MAX_PRDS);
+                return ERR_INVALID_ARGS;
+            }
+            size_t sz = MIN(length, AHCI_PRD_MAX_SIZE);
+            prd[*prdtl].dba = LO32(phys);
+            prd[*prdtl].dbau = HI32(phys);
+            prd[*prdtl].dbc = ((sz - 1) & (AHCI_PRD_MAX_SIZE - 1)); // 0-based byte count
+            (*prdtl)++;
+            phys += sz;
+            length -= sz;
+        }
+    }
+    return NO_ERROR;
+}
+
+// fold the average queue depth up to now into the stats
+static void ahci_port_account(ahci_port_t* port, mx_time_t now) {
+    if (port->stats.depth > 0) {
+        mx_time_t delta = now - port->stats_mark;
+        port->stats.busy_time += delta;
+        port->stats.depth_time += delta * port->stats.depth;
+    }
+    port->stats_mark = now;
+}
+
 static mx_status_t ahci_do_txn(ahci_device_t* dev, ahci_port_t* port, int slot, iotxn_t* txn) {
     assert(slot < AHCI_MAX_COMMANDS);
     assert(!ahci_port_cmd_busy(port, slot));
 
     sata_pdata_t* pdata = sata_iotxn_pdata(txn);
-    mx_paddr_t phys;
-    txn->ops->physmap(txn, &phys);
-
-    if (dev->cap & AHCI_CAP_NCQ) {
-        if (pdata->cmd == SATA_CMD_READ_DMA_EXT) {
-            pdata->cmd = SATA_CMD_READ_FPDMA_QUEUED;
-        } else if (pdata->cmd == SATA_CMD_WRITE_DMA_EXT) {
-            pdata->cmd = SATA_CMD_WRITE_FPDMA_QUEUED;
+
+    // the prdt covers the txn followed by any txns merged into it
+    int prdtl = 0;
+    uint32_t count = pdata->count;
+    mx_status_t status = ahci_prd_fill(port, slot, txn, &prdtl);
+    iotxn_t* m;
+    list_for_every_entry(&port->merged[slot], m, iotxn_t, node) {
+        if (status != NO_ERROR) {
+            break;
         }
+        count += sata_iotxn_pdata(m)->count;
+        status = ahci_prd_fill(port, slot, m, &prdtl);
+    }
+    if (status != NO_ERROR) {
+        return status;
     }
 
-    //xprintf("ahci.%d: do_txn slot=%d cmd=0x%x device=0x%x lba=0x%llx count=%u phys=0x%lx data_sz=0x%llx offset=0x%llx\n", port->nr, slot, pdata->cmd, pdata->device, pdata->lba, pdata->count, phys, txn->length, txn->offset);
+    //xprintf("ahci.%d: do_txn slot=%d cmd=0x%x device=0x%x lba=0x%llx count=%u prdtl=%d data_sz=0x%llx offset=0x%llx\n", port->nr, slot, pdata->cmd, pdata->device, pdata->lba, pdata->count, prdtl, txn->length, txn->offset);
 
     // build the command
     ahci_cl_t* cl = port->cl + slot;
@@ -220,7 +306,7 @@ static mx_status_t ahci_do_txn(ahci_device_t* dev, ahci_port_t* port, int slot,
     cl->prdtl_flags_cfl = 0;
     cl->cfl = 5; // 20 bytes
     cl->w = cmd_is_write(pdata->cmd) ? 1 : 0;
-    cl->prdtl = txn->length / AHCI_PRD_MAX_SIZE + 1;
+    cl->prdtl = prdtl;
     cl->prdbc = 0;
     memset(port->ct[slot], 0, sizeof(ahci_ct_t));
 
@@ -239,8 +325,8 @@ static mx_status_t ahci_do_txn(ahci_device_t* dev, ahci_port_t* port, int slot,
         cfis[8] = (pdata->lba >> 24) & 0xff;
         cfis[9] = (pdata->lba >> 32) & 0xff;
         cfis[10] = (pdata->lba >> 40) & 0xff;
-        cfis[12] = pdata->count & 0xff;
-        cfis[13] = (pdata->count >> 8) & 0xff;
+        cfis[12] = count & 0xff;
+        cfis[13] = (count >> 8) & 0xff;
     } else if (cmd_is_queued(pdata->cmd)) {
         cfis[4] = pdata->lba & 0xff;
         cfis[5] = (pdata->lba >> 8) & 0xff;
@@ -248,24 +334,27 @@ static mx_status_t ahci_do_txn(ahci_device_t* dev, ahci_port_t* port, int slot,
         cfis[8] = (pdata->lba >> 24) & 0xff;
         cfis[9] = (pdata->lba >> 32) & 0xff;
         cfis[10] = (pdata->lba >> 40) & 0xff;
-        cfis[3] = pdata->count & 0xff;
-        cfis[11] = (pdata->count >> 8) & 0xff;
+        cfis[3] = count & 0xff;
+        cfis[11] = (count >> 8) & 0xff;
         cfis[12] = (slot << 3) & 0xff; // tag
         cfis[13] = 0; // normal priority
     }
 
-    ahci_prd_t* prd = NULL;
-    for (int i = 0; i < cl->prdtl; i++) {
-        prd = (ahci_prd_t*)((void*)port->ct[slot] + sizeof(ahci_ct_t)) + i;
-        prd->dba = LO32(phys);
-        prd->dbau = HI32(phys);
-        prd->dbc = ((txn->length - 1) & 0x3fffff); // 0-based byte count
-
-        phys += AHCI_PRD_MAX_SIZE;
-    }
-
     port->running |= (1 << slot);
+    if (cmd_is_queued(pdata->cmd)) {
+        port->queued |= (1 << slot);
+    }
     port->commands[slot] = txn;
+    port->next_lba = pdata->lba + count;
+
+    mx_time_t now = mx_current_time();
+    ahci_port_account(port, now);
+    port->stats.commands++;
+    port->stats.merged += list_length(&port->merged[slot]);
+    port->stats.depth++;
+    if (port->stats.depth > port->stats.max_depth) {
+        port->stats.max_depth = port->stats.depth;
+    }
 
     // start command
     if (cmd_is_queued(pdata->cmd)) {
@@ -275,29 +364,52 @@ static mx_status_t ahci_do_txn(ahci_device_t* dev, ahci_port_t* port, int slot,
 
     // set the watchdog
     // TODO: general timeout mechanism
-    pdata->timeout = mx_current_time() + 1000 * 1000 * 1000; // 1 second
+    pdata->timeout = now + 1000 * 1000 * 1000; // 1 second
     completion_signal(&dev->watchdog_completion);
     return NO_ERROR;
 }
 
-static void ahci_port_complete_txn(ahci_device_t* dev, ahci_port_t* port, mx_status_t status) {
+// take a finished command out of its slot, moving it and the txns
+// merged into it onto the done list
+// called with port->lock held
+static void ahci_port_retire(ahci_port_t* port, int slot, list_node_t* done) {
+    iotxn_t* txn = port->commands[slot];
+    port->running &= ~(1 << slot);
+    port->queued &= ~(1 << slot);
+    port->commands[slot] = NULL;
+
+    ahci_port_account(port, mx_current_time());
+    port->stats.depth--;
+    port->stats.ops += 1 + list_length(&port->merged[slot]);
+
+    list_add_tail(done, &txn->node);
+    iotxn_t* m;
+    while ((m = list_remove_head_type(&port->merged[slot], iotxn_t, node)) != NULL) {
+        list_add_tail(done, &m->node);
+    }
+}
+
+static void ahci_complete_list(list_node_t* done, mx_status_t status) {
     iotxn_t* txn;
-    uint32_t sact = ahci_read(&port->regs->sact);
-    for (int i = 0; i < AHCI_MAX_COMMANDS; i++) {
-        txn = port->commands[i];
-        if (txn == NULL) {
-            continue;
-        }
-        if (!(sact & (1 << i))) {
-            // clear state before calling the complete() hook
-            mtx_lock(&port->lock);
-            port->running &= ~(1 << i);
-            port->commands[i] = NULL;
-            mtx_unlock(&port->lock);
+    while ((txn = list_remove_head_type(done, iotxn_t, node)) != NULL) {
+        txn->ops->complete(txn, status, status == NO_ERROR ? txn->length : 0);
+    }
+}
 
-            txn->ops->complete(txn, status, txn->length);
+static void ahci_port_complete_txn(ahci_device_t* dev, ahci_port_t* port, mx_status_t status) {
+    list_node_t done = LIST_INITIAL_VALUE(done);
+    mtx_lock(&port->lock);
+    // ncq commands finish when their sact bit clears, others when ci does
+    uint32_t active = ahci_read(&port->regs->sact) | ahci_read(&port->regs->ci);
+    for (int i = 0; i < AHCI_MAX_COMMANDS; i++) {
+        if ((port->commands[i] != NULL) && !(active & (1 << i))) {
+            ahci_port_retire(port, i, &done);
         }
     }
+    mtx_unlock(&port->lock);
+
+    ahci_complete_list(&done, status);
+
     // hit the worker thread to do the next txn
     completion_signal(&dev->worker_completion);
 }
@@ -406,6 +518,17 @@ void ahci_iotxn_queue(mx_device_t* dev, iotxn_t* txn) {
     assert(pdata->port < AHCI_MAX_PORTS);
     assert(port->flags & (AHCI_PORT_FLAG_IMPLEMENTED | AHCI_PORT_FLAG_PRESENT));
 
+    // fall back to non-queued commands if the hba can't do ncq
+    if (!(device->cap & AHCI_CAP_NCQ)) {
+        if (pdata->cmd == SATA_CMD_READ_FPDMA_QUEUED) {
+            pdata->cmd = SATA_CMD_READ_DMA_EXT;
+        } else if (pdata->cmd == SATA_CMD_WRITE_FPDMA_QUEUED) {
+            pdata->cmd = SATA_CMD_WRITE_DMA_EXT;
+        }
+    }
+    pdata->deadline = mx_current_time() +
+                      (cmd_is_write(pdata->cmd) ? AHCI_WRITE_DEADLINE : AHCI_READ_DEADLINE);
+
     // put the cmd on the queue
     mtx_lock(&port->lock);
     list_add_tail(&port->txn_list, &txn->node);
@@ -415,41 +538,162 @@ void ahci_iotxn_queue(mx_device_t* dev, iotxn_t* txn) {
     completion_signal(&device->worker_completion);
 }
 
+void ahci_port_get_stats(mx_device_t* dev, int nr, block_stats_t* stats) {
+    ahci_device_t* device = get_ahci_device(dev);
+    ahci_port_t* port = &device->ports[nr];
+
+    mtx_lock(&port->lock);
+    mx_time_t now = mx_current_time();
+    ahci_port_account(port, now);
+    *stats = port->stats;
+    stats->elapsed = now - port->stats_start;
+    mtx_unlock(&port->lock);
+}
+
+mx_status_t ahci_port_set_sched(mx_device_t* dev, int nr, uint32_t sched) {
+    ahci_device_t* device = get_ahci_device(dev);
+    ahci_port_t* port = &device->ports[nr];
+
+    if ((sched != BLOCK_SCHED_FIFO) && (sched != BLOCK_SCHED_DEADLINE)) {
+        return ERR_INVALID_ARGS;
+    }
+    mtx_lock(&port->lock);
+    port->sched = sched;
+    mtx_unlock(&port->lock);
+    return NO_ERROR;
+}
+
 // worker thread (for iotxn queue):
 
+// choose the next txn to issue
+// called with port->lock held and txn_list not empty
+static iotxn_t* ahci_port_pick(ahci_port_t* port) {
+    iotxn_t* oldest = list_peek_head_type(&port->txn_list, iotxn_t, node);
+    if ((port->sched != BLOCK_SCHED_DEADLINE) ||
+        (sata_iotxn_pdata(oldest)->deadline <= mx_current_time())) {
+        return oldest;
+    }
+
+    // sweep upward from where the last command ended, wrapping
+    // around to the lowest lba when nothing is left ahead
+    iotxn_t* ahead = NULL;
+    iotxn_t* lowest = NULL;
+    iotxn_t* txn;
+    list_for_every_entry(&port->txn_list, txn, iotxn_t, node) {
+        uint64_t lba = sata_iotxn_pdata(txn)->lba;
+        if ((lba >= port->next_lba) && (!ahead || (lba < sata_iotxn_pdata(ahead)->lba))) {
+            ahead = txn;
+        }
+        if (!lowest || (lba < sata_iotxn_pdata(lowest)->lba)) {
+            lowest = txn;
+        }
+    }
+    return ahead ? ahead : lowest;
+}
+
+// move queued txns that continue where txn ends onto the slot's merged
+// list, as long as the combined command stays within hardware limits
+// called with port->lock held
+static void ahci_port_merge(ahci_port_t* port, int slot, iotxn_t* txn) {
+    sata_pdata_t* pdata = sata_iotxn_pdata(txn);
+    if (!cmd_is_rw(pdata->cmd)) {
+        return;
+    }
+    uint32_t count = pdata->count;
+    uint32_t prds = ahci_txn_prds(txn);
+    uint64_t lba = pdata->lba + pdata->count;
+    mx_off_t offset = txn->offset + txn->length;
+    for (;;) {
+        iotxn_t* next;
+        bool found = false;
+        list_for_every_entry(&port->txn_list, next, iotxn_t, node) {
+            sata_pdata_t* np = sata_iotxn_pdata(next);
+            // requiring both the lba and the byte offset to line up
+            // ensures txn's length is a whole number of sectors
+            if ((np->cmd == pdata->cmd) && (np->lba == lba) && (next->offset == offset)) {
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            return;
+        }
+        sata_pdata_t* np = sata_iotxn_pdata(next);
+        uint32_t next_prds = ahci_txn_prds(next);
+        if ((count + np->count > AHCI_MAX_CMD_SECTORS) || (prds + next_prds > AHCI_MAX_PRDS)) {
+            return;
+        }
+        list_delete(&next->node);
+        list_add_tail(&port->merged[slot], &next->node);
+        count += np->count;
+        prds += next_prds;
+        lba += np->count;
+        offset += next->length;
+    }
+}
+
+// issue one command if there is work and a slot for it, returns false
+// if nothing more can be issued on this pass
+// txns that fail to issue are moved to the failed list
+// called with port->lock held
+static bool ahci_port_issue(ahci_device_t* dev, ahci_port_t* port, list_node_t* failed) {
+    if (list_is_empty(&port->txn_list)) {
+        return false;
+    }
+    iotxn_t* txn = ahci_port_pick(port);
+    sata_pdata_t* pdata = sata_iotxn_pdata(txn);
+
+    // ncq and non-ncq commands can't be outstanding together, and only
+    // one non-ncq command can be outstanding at a time
+    if (port->running && (!cmd_is_queued(pdata->cmd) || (port->running != port->queued))) {
+        return false;
+    }
+
+    // find a free command tag
+    int max = MIN(pdata->max_cmd, (int)((dev->cap >> 8) & 0x1f));
+    int slot;
+    for (slot = 0; slot <= max; slot++) {
+        if (!ahci_port_cmd_busy(port, slot)) break;
+    }
+    if (slot > max) {
+        return false;
+    }
+
+    // run the command
+    list_delete(&txn->node);
+    ahci_port_merge(port, slot, txn);
+    mx_status_t status = ahci_do_txn(dev, port, slot, txn);
+    if (status != NO_ERROR) {
+        txn->status = status;
+        list_add_tail(failed, &txn->node);
+        iotxn_t* m;
+        while ((m = list_remove_head_type(&port->merged[slot], iotxn_t, node)) != NULL) {
+            m->status = status;
+            list_add_tail(failed, &m->node);
+        }
+    }
+    return true;
+}
+
 static int ahci_worker_thread(void* arg) {
     ahci_device_t* dev = (ahci_device_t*)arg;
     ahci_port_t* port;
     iotxn_t* txn;
     for (;;) {
-        // iterate all the ports and run commands
+        // iterate all the ports and fill every free command slot
         for (int i = 0; i < AHCI_MAX_PORTS; i++) {
             port = &dev->ports[i];
             if (!(port->flags & (AHCI_PORT_FLAG_IMPLEMENTED | AHCI_PORT_FLAG_PRESENT))) continue;
 
+            list_node_t failed = LIST_INITIAL_VALUE(failed);
             mtx_lock(&port->lock);
-            txn = list_peek_head_type(&port->txn_list, iotxn_t, node);
-            if (!txn) {
-                mtx_unlock(&port->lock);
-                continue;
-            }
+            while (ahci_port_issue(dev, port, &failed))
+                ;
+            mtx_unlock(&port->lock);
 
-            // find a free command tag
-            sata_pdata_t* pdata = sata_iotxn_pdata(txn);
-            int max = MIN(pdata->max_cmd, (int)((dev->cap >> 8) & 0x1f));
-            int i = 0;
-            for (i = 0; i <= max; i++) {
-                if (!ahci_port_cmd_busy(port, i)) break;
-            }
-            if (i > max) {
-                mtx_unlock(&port->lock);
-                continue;
+            while ((txn = list_remove_head_type(&failed, iotxn_t, node)) != NULL) {
+                txn->ops->complete(txn, txn->status, 0);
             }
-
-            // run the command
-            list_delete(&txn->node);
-            ahci_do_txn(dev, port, i, txn);
-            mtx_unlock(&port->lock);
         }
         // wait here until more commands are queued, or a port becomes idle
         completion_wait(&dev->worker_completion, MX_TIME_INFINITE);
@@ -469,6 +713,7 @@ static int ahci_watchdog_thread(void* arg) {
                 continue;
             }
 
+            list_node_t done = LIST_INITIAL_VALUE(done);
             mtx_lock(&port->lock);
             if (port->running) {
                 idle = false;
@@ -480,16 +725,12 @@ static int ahci_watchdog_thread(void* arg) {
                     if (pdata->timeout < now) {
                         // time out
                         printf("ahci: txn time out on port %d\n", port->nr);
-                        iotxn_t* txn = port->commands[i];
-                        port->running &= ~(1 << i);
-                        port->commands[i] = NULL;
-                        mtx_unlock(&port->lock);
-                        txn->ops->complete(txn, ERR_TIMED_OUT, 0);
-                        mtx_lock(&port->lock);
+                        ahci_port_retire(port, j, &done);
                     }
                 }
             }
             mtx_unlock(&port->lock);
+            ahci_complete_list(&done, ERR_TIMED_OUT);
         }
 
         // no need to run the watchdog if there are no active xfers
@@ -526,22 +767,42 @@ static void ahci_port_irq(ahci_device_t* dev, int nr) {
     }
 }
 
+// returns the mask of ports that interrupt on the given msi vector. with
+// fewer vectors than ports the hba sends the remaining ports to the last one,
+// and if it reverted to single message mode everything goes to vector 0.
+static uint32_t ahci_irq_port_mask(ahci_device_t* dev, uint32_t vector) {
+    if (dev->irq_count == 1 || (ahci_read(&dev->regs->ghc) & AHCI_GHC_MRSM)) {
+        return vector == 0 ? 0xffffffff : 0;
+    }
+    if (vector < dev->irq_count - 1) {
+        return 1u << vector;
+    }
+    return ~((1u << vector) - 1);
+}
+
 static int ahci_irq_thread(void* arg) {
     ahci_device_t* dev = (ahci_device_t*)arg;
     mx_status_t status;
     for (;;) {
-        status = mx_handle_wait_one(dev->irq_handle, MX_SIGNAL_SIGNALED, MX_TIME_INFINITE, NULL);
+        // the msi is re-armed when this thread next waits. every irq thread
+        // waits on the same port, a vector only has one packet outstanding
+        // so its ports are only ever handled by one thread at a time.
+        mx_irq_packet_t pkt;
+        status = mx_port_wait(dev->irq_port, &pkt, sizeof(pkt));
         if (status) {
             xprintf("ahci: error %d waiting for interrupt\n", status);
             continue;
         }
-        // mask hba interrupts while interrupts are being handled
-        uint32_t ghc = ahci_read(&dev->regs->ghc);
-        ahci_write(&dev->regs->ghc, ghc & ~AHCI_GHC_IE);
-        mx_interrupt_complete(dev->irq_handle);
+        bool single = dev->irq_count == 1;
+        uint32_t ghc;
+        if (single) {
+            // mask hba interrupts while interrupts are being handled
+            ghc = ahci_read(&dev->regs->ghc);
+            ahci_write(&dev->regs->ghc, ghc & ~AHCI_GHC_IE);
+        }
 
-        // handle interrupt for each port
-        uint32_t is = ahci_read(&dev->regs->is);
+        // handle interrupt for each port on this vector
+        uint32_t is = ahci_read(&dev->regs->is) & ahci_irq_port_mask(dev, (uint32_t)pkt.hdr.key);
         ahci_write(&dev->regs->is, is);
         for (int i = 0; is && i < AHCI_MAX_PORTS; i++) {
             if (is & 0x1) {
@@ -550,13 +811,30 @@ static int ahci_irq_thread(void* arg) {
             is >>= 1;
         }
 
-        // unmask hba interrupts
-        ghc = ahci_read(&dev->regs->ghc);
-        ahci_write(&dev->regs->ghc, ghc | AHCI_GHC_IE);
+        if (single) {
+            // unmask hba interrupts
+            ghc = ahci_read(&dev->regs->ghc);
+            ahci_write(&dev->regs->ghc, ghc | AHCI_GHC_IE);
+        }
     }
     return 0;
 }
 
+// picks the number of msi vectors: one per port up to the highest implemented
+// one, rounded up to the power of 2 that msi requires
+static uint32_t ahci_irq_count(ahci_device_t* dev, mx_device_t* pcidev) {
+    uint32_t max_irqs;
+    if (dev->pci->query_irq_mode_caps(pcidev, MX_PCIE_IRQ_MODE_MSI, &max_irqs) != NO_ERROR) {
+        return 1;
+    }
+    uint32_t port_map = ahci_read(&dev->regs->pi);
+    uint32_t wanted = 1;
+    while (wanted < AHCI_MAX_IRQS && wanted < max_irqs && (port_map >> wanted)) {
+        wanted <<= 1;
+    }
+    return wanted;
+}
+
 // implement device protocol:
 
 static mx_protocol_device_t ahci_device_proto = {
@@ -590,6 +868,10 @@ static int ahci_init_thread(void* arg) {
         port->flags = AHCI_PORT_FLAG_IMPLEMENTED;
         port->regs = &dev->regs->ports[i];
         list_initialize(&port->txn_list);
+        for (int j = 0; j < AHCI_MAX_COMMANDS; j++) {
+            list_initialize(&port->merged[j]);
+        }
+        port->stats_start = port->stats_mark = mx_current_time();
 
         status = ahci_port_initialize(port);
         if (status) goto fail;
@@ -687,26 +969,47 @@ static mx_status_t ahci_bind(mx_driver_t* drv, mx_device_t* dev) {
         goto fail;
     }
 
-    // set msi irq mode
-    status = pci->set_irq_mode(dev, MX_PCIE_IRQ_MODE_MSI, 1);
+    // set msi irq mode, falling back to a single vector
+    device->irq_count = ahci_irq_count(device, dev);
+    status = pci->set_irq_mode(dev, MX_PCIE_IRQ_MODE_MSI, device->irq_count);
+    if (status < 0 && device->irq_count > 1) {
+        device->irq_count = 1;
+        status = pci->set_irq_mode(dev, MX_PCIE_IRQ_MODE_MSI, 1);
+    }
     if (status < 0) {
         xprintf("ahci: error %d setting irq mode\n", status);
         goto fail;
     }
 
-    // get irq handle
-    device->irq_handle = pci->map_interrupt(dev, 0);
-    if (device->irq_handle < 0) {
-        status = device->irq_handle;
-        xprintf("ahci: error %d getting irq handle\n", status);
+    // deliver interrupts to a port
+    device->irq_port = mx_port_create(0);
+    if (device->irq_port < 0) {
+        status = device->irq_port;
+        xprintf("ahci: error %d creating irq port\n", status);
         goto fail;
     }
 
-    // start irq thread
-    int ret = thrd_create_with_name(&device->irq_thread, ahci_irq_thread, device, "ahci-irq");
-    if (ret != thrd_success) {
-        xprintf("ahci: error %d in irq thread create\n", ret);
-        goto fail;
+    int ret;
+    for (uint32_t i = 0; i < device->irq_count; i++) {
+        // get irq handle
+        device->irq_handles[i] = pci->map_interrupt(dev, i);
+        if (device->irq_handles[i] < 0) {
+            status = device->irq_handles[i];
+            xprintf("ahci: error %d getting irq handle %u\n", status, i);
+            goto fail;
+        }
+        status = mx_interrupt_bind(device->irq_handles[i], device->irq_port, i, 1, 0);
+        if (status < 0) {
+            xprintf("ahci: error %d binding irq %u\n", status, i);
+            goto fail;
+        }
+
+        // start irq thread
+        ret = thrd_create_with_name(&device->irq_threads[i], ahci_irq_thread, device, "ahci-irq");
+        if (ret != thrd_success) {
+            xprintf("ahci: error %d in irq thread create\n", ret);
+            goto fail;
+        }
     }
 
     // start watchdog thread
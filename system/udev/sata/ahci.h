@@ -7,10 +7,12 @@
 #include <ddk/device.h>
 #include <ddk/driver.h>
 #include <ddk/protocol/pci.h>
+#include <magenta/device/block.h>
 
 #define AHCI_MAX_PORTS    32
 #define AHCI_MAX_COMMANDS 32
 #define AHCI_MAX_PRDS     128 // just a random choice, hardware max is 64k-1
+#define AHCI_MAX_IRQS     8   // msi vectors, must be a power of 2
 
 #define AHCI_PRD_MAX_SIZE 0x400000 // 4mb
 
@@ -87,6 +89,7 @@ typedef struct {
 #define AHCI_CAP_NCQ (1 << 30)
 #define AHCI_GHC_HR  (1 << 0)
 #define AHCI_GHC_IE  (1 << 1)
+#define AHCI_GHC_MRSM (1 << 2) // msi revert to single message
 #define AHCI_GHC_AE  (1 << 31)
 
 typedef struct {
@@ -159,3 +162,5 @@ static_assert(sizeof(ahci_ct_t) == 0x80, "unexpected command table header size")
 static_assert(sizeof(ahci_prd_t) == 0x10, "unexpected prd entry size");
 
 void ahci_iotxn_queue(mx_device_t* dev, iotxn_t* txn);
+void ahci_port_get_stats(mx_device_t* dev, int port, block_stats_t* stats);
+mx_status_t ahci_port_set_sched(mx_device_t* dev, int port, uint32_t sched);
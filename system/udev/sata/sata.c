@@ -34,6 +34,7 @@
 
 #define SATA_FLAG_DMA   (1 << 0)
 #define SATA_FLAG_LBA48 (1 << 1)
+#define SATA_FLAG_NCQ   (1 << 2)
 
 typedef struct sata_device {
     mx_device_t device;
@@ -125,7 +126,14 @@ static mx_status_t sata_device_identify(sata_device_t* dev, mx_device_t* control
     } else {
         xprintf(" PIO");
     }
-    dev->max_cmd = *(devinfo + SATA_DEVINFO_QUEUE_DEPTH);
+    if (*(devinfo + SATA_DEVINFO_SATA_CAP) & (1 << 8)) {
+        xprintf(" NCQ");
+        flags |= SATA_FLAG_NCQ;
+        dev->max_cmd = *(devinfo + SATA_DEVINFO_QUEUE_DEPTH) & 0x1f;
+    } else {
+        // without ncq only one command may be outstanding
+        dev->max_cmd = 0;
+    }
     xprintf(" %d commands\n", dev->max_cmd + 1);
     if (cap & (1 << 9)) {
         dev->sector_sz = 512; // default
@@ -169,6 +177,17 @@ static ssize_t sata_ioctl(mx_device_t* dev, uint32_t op, const void* cmd, size_t
         *blksize = device->sector_sz;
         return sizeof(*blksize);
     }
+    case IOCTL_BLOCK_GET_STATS: {
+        block_stats_t* stats = reply;
+        if (max < sizeof(*stats)) return ERR_BUFFER_TOO_SMALL;
+        ahci_port_get_stats(dev->parent, device->port, stats);
+        return sizeof(*stats);
+    }
+    case IOCTL_BLOCK_SET_SCHED: {
+        const uint32_t* sched = cmd;
+        if (cmdlen < sizeof(*sched)) return ERR_INVALID_ARGS;
+        return ahci_port_set_sched(dev->parent, device->port, *sched);
+    }
     case IOCTL_BLOCK_RR_PART: {
         // rebind to reread the partition table
         return device_rebind(dev);
@@ -192,7 +211,11 @@ static void sata_iotxn_queue(mx_device_t* dev, iotxn_t* txn) {
     txn->length = MIN(txn->length, device->capacity - txn->offset);
 
     sata_pdata_t* pdata = sata_iotxn_pdata(txn);
-    pdata->cmd = txn->opcode == IOTXN_OP_READ ? SATA_CMD_READ_DMA_EXT : SATA_CMD_WRITE_DMA_EXT;
+    if (device->flags & SATA_FLAG_NCQ) {
+        pdata->cmd = txn->opcode == IOTXN_OP_READ ? SATA_CMD_READ_FPDMA_QUEUED : SATA_CMD_WRITE_FPDMA_QUEUED;
+    } else {
+        pdata->cmd = txn->opcode == IOTXN_OP_READ ? SATA_CMD_READ_DMA_EXT : SATA_CMD_WRITE_DMA_EXT;
+    }
     pdata->device = 0x40;
     pdata->lba = txn->offset / device->sector_sz;
     pdata->count = txn->length / device->sector_sz;
@@ -34,6 +34,7 @@
 
 typedef struct sata_pdata {
     mx_time_t timeout; // for ahci driver watchdog
+    mx_time_t deadline; // for ahci deadline scheduler
     uint64_t lba;   // in blocks
     uint16_t count; // in blocks
     uint8_t cmd;
@@ -235,6 +235,10 @@ mx_status_t usb_ethernet_send(mx_device_t* device, const void* buffer, size_t le
 
     mx_status_t status = NO_ERROR;
 
+    if (length + ETH_HEADER_SIZE > USB_BUF_SIZE) {
+        return ERR_INVALID_ARGS;
+    }
+
     mtx_lock(&eth->mutex);
 
     list_node_t* node = list_remove_head(&eth->free_write_reqs);
@@ -244,11 +248,6 @@ mx_status_t usb_ethernet_send(mx_device_t* device, const void* buffer, size_t le
     }
     iotxn_t* request = containerof(node, iotxn_t, node);
 
-    if (length + ETH_HEADER_SIZE > USB_BUF_SIZE) {
-        status = ERR_INVALID_ARGS;
-        goto out;
-    }
-
     // write 4 byte packet header
     uint8_t header[ETH_HEADER_SIZE];
     uint8_t lo = length & 0xFF;
@@ -297,7 +296,7 @@ mx_status_t usb_ethernet_recv(mx_device_t* device, void* buffer, size_t length)
     }
 
     uint8_t header[ETH_HEADER_SIZE];
-    request->ops->copyfrom(request, header, ETH_HEADER_SIZE, 0);
+    request->ops->copyfrom(request, header, ETH_HEADER_SIZE, offset);
     uint16_t length1 = (header[0] | (uint16_t)header[1] << 8) & 0x7FF;
     uint16_t length2 = (~(header[2] | (uint16_t)header[3] << 8)) & 0x7FF;
 
@@ -313,7 +312,7 @@ mx_status_t usb_ethernet_recv(mx_device_t* device, void* buffer, size_t length)
         status = ERR_BUFFER_TOO_SMALL;
         goto out;
     }
-    request->ops->copyfrom(request, buffer, length1, ETH_HEADER_SIZE);
+    request->ops->copyfrom(request, buffer, length1, offset + ETH_HEADER_SIZE);
     status = length1;
     offset += (length1 + 4);
     if (offset & 1)
@@ -16,14 +16,19 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/param.h>
 #include <threads.h>
 #include <unistd.h>
 
 #include "ums-hw.h"
 
-#define READ_REQ_COUNT 3
-#define WRITE_REQ_COUNT 3
-#define USB_BUF_SIZE 0x8000
+// GET_MAX_LUN returns at most 15
+#define UMS_MAX_LUNS 16
+
+// largest data stage of one command. Block iotxns larger than this are
+// sent as several commands, so that even a data stage scattered over
+// separate pages fits on the host controller's transfer ring.
+#define UMS_MAX_TRANSFER (512 * 1024)
 
 // comment the next line if you don't want debug messages
 #define DEBUG 0
@@ -33,41 +38,77 @@
 # define DEBUG_PRINT(x) do {} while (0)
 #endif
 
+typedef struct ums ums_t;
+
+// a logical unit, published as its own block device
 typedef struct {
     mx_device_t device;
-    mx_device_t* udev;
-    mx_driver_t* driver;
-
-    uint32_t tag_send;      // next tag to send in CBW
-    uint32_t tag_receive;   // next tag we expect to receive in CSW
+    ums_t* msd;
 
     uint8_t lun;
     uint64_t total_blocks;
     uint32_t block_size;
 
     bool use_read_write_16; // use READ16 and WRITE16 if total_blocks > 0xFFFFFFFF
+} ums_lun_t;
+#define get_ums_lun(dev) containerof(dev, ums_lun_t, device)
+
+// a command in flight. Its CBW, data and CSW stages are queued one after
+// the other as each completes, so that a stalled stage leaves nothing
+// queued behind it on a halted pipe.
+typedef struct {
+    ums_t* msd;
+    iotxn_t* cbw;
+    iotxn_t* csw;
+    // data stage, a clone of txn for block io or a buffer for internal commands
+    iotxn_t* data;
+    // block iotxn being serviced, NULL for internal commands
+    iotxn_t* txn;
+    // how much of txn earlier commands have transferred
+    mx_off_t txn_done;
+    // signalled instead of completing txn for internal commands
+    completion_t* completion;
+
+    uint32_t tag;
+    uint32_t length;
+    mx_status_t status;
+    mx_off_t actual;
+} ums_command_t;
+
+struct ums {
+    mx_device_t* udev;
+    mx_driver_t* driver;
+
+    uint32_t tag;           // next tag to send in CBW
+
+    uint8_t max_lun;
+    ums_lun_t luns[UMS_MAX_LUNS];
+    // lun devices added and not yet released
+    uint32_t device_count;
 
     uint8_t bulk_in_addr;
     uint8_t bulk_out_addr;
 
-    // pool of free USB requests
-    list_node_t free_csw_reqs;
-    list_node_t free_read_reqs;
-    list_node_t free_write_reqs;
-
-    // list of queued io transactions
+    // bulk-only transport devices take one command at a time, so the next
+    // CBW is not sent until the CSW for this one is in
+    ums_command_t command;
+    bool busy;
+    // signalled when busy is cleared
+    cnd_t idle;
+    // block iotxns waiting for the command to be free
     list_node_t queued_iotxns;
 
-    // list of received packets not yet read by upper layer
-    list_node_t completed_reads;
-    list_node_t completed_csws;
+    // set after a transport error, no new commands are sent until the
+    // worker has done reset recovery
+    bool reset_needed;
+    bool dead;
 
-    mtx_t mutex;
-} ums_t;
-#define get_ums(dev) containerof(dev, ums_t, device)
+    // sends queued iotxns, so that CBWs always go out in tag order
+    thrd_t worker_thread;
+    completion_t worker_completion;
 
-static void ums_csw_complete(iotxn_t* csw_request, void* cookie);
-static csw_status_t ums_verify_csw(ums_t* msd, iotxn_t* csw_request);
+    mtx_t mutex;
+};
 
 static inline uint16_t read16be(uint8_t* ptr) {
     return betoh16(*((uint16_t*)ptr));
@@ -100,11 +141,13 @@ static mx_status_t ums_reset(ums_t* msd) {
     DEBUG_PRINT(("UMS: performing reset recovery\n"));
     mx_status_t status = usb_control(msd->udev, USB_DIR_OUT | USB_TYPE_CLASS
                                             | USB_RECIP_INTERFACE, USB_REQ_RESET, 0x00, 0x00, NULL, 0);
-    status = usb_control(msd->udev, USB_DIR_OUT | USB_TYPE_CLASS
-                                           | USB_RECIP_INTERFACE, USB_REQ_CLEAR_FEATURE, FS_ENDPOINT_HALT,
+    // the host controller clears its side of a halt when the next transfer
+    // is queued on the endpoint
+    status = usb_control(msd->udev, USB_DIR_OUT | USB_TYPE_STANDARD
+                                           | USB_RECIP_ENDPOINT, USB_REQ_CLEAR_FEATURE, FS_ENDPOINT_HALT,
                                            msd->bulk_in_addr, NULL, 0);
-    status = usb_control(msd->udev, USB_DIR_OUT | USB_TYPE_CLASS
-                                           | USB_RECIP_INTERFACE, USB_REQ_CLEAR_FEATURE, FS_ENDPOINT_HALT,
+    status = usb_control(msd->udev, USB_DIR_OUT | USB_TYPE_STANDARD
+                                           | USB_RECIP_ENDPOINT, USB_REQ_CLEAR_FEATURE, FS_ENDPOINT_HALT,
                                            msd->bulk_out_addr, NULL, 0);
     return status;
 }
@@ -115,124 +158,41 @@ static mx_status_t ums_get_max_lun(ums_t* msd, void* data) {
     return status;
 }
 
-static iotxn_t* get_free_write(ums_t* msd) {
-    list_node_t* node = list_remove_head(&msd->free_write_reqs);
-    if (!node) {
-        return NULL;
-    }
-    return containerof(node, iotxn_t, node);
-}
+// fills in cmd's CBW for a command on lun transferring length bytes
+static void ums_fill_cbw(ums_t* msd, ums_command_t* cmd, uint8_t lun, uint32_t length,
+                         uint8_t flags, uint8_t command_len, void* command) {
+    iotxn_t* txn = cmd->cbw;
+    cmd->tag = msd->tag++;
+    cmd->length = length;
 
-static void ums_queue_request(ums_t* msd, iotxn_t* txn) {
-    iotxn_queue(msd->udev, txn);
-}
-
-static mx_status_t ums_send_cbw(ums_t* msd, uint32_t transfer_length, uint8_t flags,
-                                uint8_t command_len, void* command) {
-    iotxn_t* txn = get_free_write(msd);
-    if (!txn) {
-        return ERR_BUFFER_TOO_SMALL;
-    }
     // CBWs always have 31 bytes
-    txn->length = 31;
+    txn->length = UMS_COMMAND_BLOCK_WRAPPER_SIZE;
 
     // first three blocks are 4 byte
     uint32_t buf_32[3];
     buf_32[0] = htole32(CBW_SIGNATURE);
-    buf_32[1] = htole32(msd->tag_send++);
-    buf_32[2] = htole32(transfer_length);
+    buf_32[1] = htole32(cmd->tag);
+    buf_32[2] = htole32(length);
     txn->ops->copyto(txn, buf_32, sizeof(buf_32), 0);
 
     // get a 3 x 1 byte buffer and start at 12 because of uint32's
     uint8_t buf_8[3];
     buf_8[0] = flags;
-    buf_8[1] = msd->lun;
+    buf_8[1] = lun;
     buf_8[2] = command_len;
     txn->ops->copyto(txn, buf_8, sizeof(buf_8), sizeof(buf_32));
 
     // copy command_len bytes from the command passed in into the command_len
     txn->ops->copyto(txn, command, command_len, sizeof(buf_32) + sizeof(buf_8));
-    ums_queue_request(msd, txn);
-    return NO_ERROR;
-}
-
-static mx_status_t ums_queue_csw(ums_t* msd) {
-    list_node_t* csw_node = list_remove_head(&msd->free_csw_reqs);
-    if (!csw_node) {
-        DEBUG_PRINT(("UMS:error, no CSW reqs left\n"));
-        return ERR_BUFFER_TOO_SMALL;
-    }
-    iotxn_t* csw_request = containerof(csw_node, iotxn_t, node);
-    csw_request->complete_cb = ums_csw_complete;
-    csw_request->cookie = msd;
-    ums_queue_request(msd, csw_request);
-    return NO_ERROR;
-}
-
-static void ums_read_csw_complete(iotxn_t* txn, void* cookie) {
-    completion_signal((completion_t *)cookie);
-}
-
-static mx_status_t ums_read_csw(ums_t* msd) {
-    list_node_t* csw_node = list_remove_head(&msd->free_csw_reqs);
-    if (!csw_node) {
-        DEBUG_PRINT(("UMS:error, no CSW reqs left\n"));
-        return ERR_BUFFER_TOO_SMALL;
-    }
-
-    completion_t completion = COMPLETION_INIT;
-    iotxn_t* csw_request = containerof(csw_node, iotxn_t, node);
-    csw_request->complete_cb = ums_read_csw_complete;
-    csw_request->cookie = &completion;
-    ums_queue_request(msd, csw_request);
-    completion_wait(&completion, MX_TIME_INFINITE);
-
-    csw_status_t csw_error = ums_verify_csw(msd, csw_request);
-    list_add_tail(&msd->free_csw_reqs, &csw_request->node);
-
-    if (csw_error == CSW_SUCCESS) {
-        return NO_ERROR;
-    } else if (csw_error == CSW_FAILED) {
-        return ERR_BAD_STATE;
-    } else {
-        // FIXME - best way to handle this?
-        // print error and then reset device due to it
-        DEBUG_PRINT(("UMS: CSW verify returned error. Check ums-hw.h csw_status_t for enum = %d\n", csw_error));
-        ums_reset(msd);
-        return ERR_INTERNAL;
-    }
 }
 
-static mx_status_t ums_queue_read(ums_t* msd, uint16_t transfer_length) {
-    // read request sense response
-    list_node_t* read_node = list_remove_head(&msd->free_read_reqs);
-    if (!read_node) {
-        DEBUG_PRINT(("UMS:error, no read reqs left\n"));
-        return ERR_BUFFER_TOO_SMALL;
-    }
-    iotxn_t* read_request = containerof(read_node, iotxn_t, node);
-    read_request->length = transfer_length;
-    ums_queue_request(msd, read_request);
-    return NO_ERROR;
-}
-
-static mx_status_t ums_queue_write(ums_t* msd, uint16_t transfer_length, iotxn_t* txn) {
-    list_node_t* write_node = list_remove_head(&msd->free_write_reqs);
-    if (!write_node) {
-        DEBUG_PRINT(("UMS:error, no write reqs left\n"));
-        return ERR_BUFFER_TOO_SMALL;
-    }
-    iotxn_t* write_request = containerof(write_node, iotxn_t, node);
-    write_request->length = transfer_length;
-    void* buffer;
-    write_request->ops->mmap(write_request, &buffer);
-    txn->ops->copyfrom(txn, buffer, (size_t)transfer_length, 0);
-    ums_queue_request(msd, write_request);
-    return NO_ERROR;
-}
-
-static csw_status_t ums_verify_csw(ums_t* msd, iotxn_t* csw_request) {
+static csw_status_t ums_verify_csw(ums_t* msd, ums_command_t* cmd, uint32_t* out_residue) {
     uint8_t buffer[UMS_COMMAND_STATUS_WRAPPER_SIZE];
+    iotxn_t* csw_request = cmd->csw;
+    if (csw_request->actual < sizeof(buffer)) {
+        DEBUG_PRINT(("UMS:short csw, %" PRIu64 " bytes\n", csw_request->actual));
+        return CSW_INVALID;
+    }
     csw_request->ops->copyfrom(csw_request, buffer, sizeof(buffer), 0);
 
     // check signature is "USBS"
@@ -241,11 +201,13 @@ static csw_status_t ums_verify_csw(ums_t* msd, iotxn_t* csw_request) {
         DEBUG_PRINT(("UMS:invalid csw sig, expected:%08x got:%08x \n", CSW_SIGNATURE, letoh32(ptr_32[0])));
         return CSW_INVALID;
     }
-    // check if tag matches the tag of last CBW
-    if (letoh32(ptr_32[1]) != msd->tag_receive++) {
-        DEBUG_PRINT(("UMS:csw tag mismatch, expected:%08x got in csw:%08x \n", msd->tag_receive - 1, letoh32(ptr_32[1])));
+    // check if tag matches the tag of the CBW
+    if (letoh32(ptr_32[1]) != cmd->tag) {
+        DEBUG_PRINT(("UMS:csw tag mismatch, expected:%08x got in csw:%08x \n", cmd->tag, letoh32(ptr_32[1])));
         return CSW_TAG_MISMATCH;
     }
+    // data residue field is the 3rd uint32_t in csw buffer
+    *out_residue = letoh32(ptr_32[2]);
     // check if success is true or not?
     uint8_t* ptr_8 = (uint8_t*)buffer;
     if (ptr_8[12] == CSW_FAILED) {
@@ -256,70 +218,156 @@ static csw_status_t ums_verify_csw(ums_t* msd, iotxn_t* csw_request) {
     return CSW_SUCCESS;
 }
 
-static void ums_read_complete(iotxn_t* txn, void* cookie) {
-    ums_t* msd = (ums_t*)cookie;
-    list_add_tail(&msd->completed_reads, &txn->node);
+static mx_status_t ums_prepare_rw(ums_t* msd, ums_command_t* cmd, iotxn_t* txn);
+static void ums_send_command(ums_t* msd, ums_command_t* cmd);
+
+// called once the command's CSW is in or one of its stages has failed
+static void ums_command_done(ums_command_t* cmd) {
+    ums_t* msd = cmd->msd;
+    mx_status_t status = cmd->status;
+    mx_off_t actual = 0;
+    bool reset = false;
+
+    if (status == NO_ERROR) {
+        uint32_t residue = 0;
+        csw_status_t csw_error = ums_verify_csw(msd, cmd, &residue);
+        if (csw_error == CSW_SUCCESS) {
+            actual = cmd->length - MIN(residue, cmd->length);
+        } else if (csw_error == CSW_FAILED) {
+            status = ERR_BAD_STATE;
+        } else {
+            // print error and then reset device due to it
+            DEBUG_PRINT(("UMS: CSW verify returned error. Check ums-hw.h csw_status_t for enum = %d\n", csw_error));
+            status = ERR_INTERNAL;
+            reset = true;
+        }
+    } else {
+        // a stage failed, most likely a stalled pipe. Nothing else is queued
+        // on the pipes, so the worker can do reset recovery right away
+        reset = true;
+    }
+
+    iotxn_t* txn = cmd->txn;
+    if (txn) {
+        if (cmd->data) {
+            cmd->data->ops->release(cmd->data);
+            cmd->data = NULL;
+        }
+        if (status == NO_ERROR) {
+            cmd->txn_done += actual;
+            // a large txn goes on with its next command, unless the
+            // device came up short or is going away
+            if ((actual == cmd->length) && (cmd->txn_done < txn->length)) {
+                mtx_lock(&msd->mutex);
+                bool dead = msd->dead;
+                mtx_unlock(&msd->mutex);
+                status = dead ? ERR_REMOTE_CLOSED : ums_prepare_rw(msd, cmd, txn);
+                if (status == NO_ERROR) {
+                    ums_send_command(msd, cmd);
+                    return;
+                }
+            }
+        }
+        actual = cmd->txn_done;
+    }
+
+    mtx_lock(&msd->mutex);
+    if (reset) {
+        msd->reset_needed = true;
+    }
+    cmd->status = status;
+    cmd->actual = actual;
+    cmd->txn = NULL;
+    completion_t* completion = cmd->completion;
+    if (txn) {
+        completion_signal(&msd->worker_completion);
+    }
+    // ums_free() may free msd as soon as the lock is dropped
+    msd->busy = false;
+    cnd_broadcast(&msd->idle);
+    mtx_unlock(&msd->mutex);
+
+    if (txn) {
+        txn->ops->complete(txn, status, actual);
+    } else {
+        completion_signal(completion);
+    }
 }
 
-static iotxn_t* pop_completed_read(ums_t* msd) {
-    list_node_t* node = list_remove_head(&msd->completed_reads);
-    if (!node) {
-        printf("msd->completed_reads empty in pop_completed_read\n");
-        return NULL;
+// queues the stage after txn, or finishes the command if txn failed or was its CSW
+static void ums_stage_complete(iotxn_t* txn, void* cookie) {
+    ums_command_t* cmd = (ums_command_t*)cookie;
+    ums_t* msd = cmd->msd;
+
+    if (txn->status != NO_ERROR) {
+        cmd->status = txn->status;
+        ums_command_done(cmd);
+    } else if (txn == cmd->cbw && cmd->data) {
+        iotxn_queue(msd->udev, cmd->data);
+    } else if (txn != cmd->csw) {
+        iotxn_queue(msd->udev, cmd->csw);
+    } else {
+        ums_command_done(cmd);
     }
-    return containerof(node, iotxn_t, node);
 }
 
-static void ums_csw_complete(iotxn_t* csw_request, void* cookie) {
-    ums_t* msd = (ums_t*)cookie;
+// sends a command whose CBW and data have been set up
+static void ums_send_command(ums_t* msd, ums_command_t* cmd) {
+    cmd->status = NO_ERROR;
+    cmd->actual = 0;
 
-    // TODO: handle error case for CSW by setting iotxn to error and returning
-    list_node_t* iotxn_node = list_remove_head(&msd->queued_iotxns);
-    iotxn_t* curr_txn = containerof(iotxn_node, iotxn_t, node);
+    mtx_lock(&msd->mutex);
+    msd->busy = true;
+    mtx_unlock(&msd->mutex);
 
-    csw_status_t csw_error = ums_verify_csw(msd, csw_request);
-    if (csw_error) {
-        // print error and then reset device due to it
-        DEBUG_PRINT(("UMS: CSW verify returned error. Check ums-hw.h csw_status_t for enum = %d\n", csw_error));
-        if (csw_error != CSW_FAILED) {
-            ums_reset(msd);
+    iotxn_queue(msd->udev, cmd->cbw);
+}
+
+// runs an internal command to completion. Only used before the worker
+// thread is started.
+static mx_status_t ums_sync_command(ums_t* msd, uint8_t lun, uint8_t flags, uint8_t command_len,
+                                    void* command, void* out_data, uint32_t length) {
+    ums_command_t* cmd = &msd->command;
+    completion_t completion = COMPLETION_INIT;
+
+    cmd->data = NULL;
+    if (length > 0) {
+        uint8_t ep = (flags & USB_DIR_IN ? msd->bulk_in_addr : msd->bulk_out_addr);
+        cmd->data = usb_alloc_iotxn(ep, length, 0);
+        if (!cmd->data) {
+            return ERR_NO_MEMORY;
         }
-        list_add_tail(&msd->free_csw_reqs, &csw_request->node);
-        curr_txn->ops->complete(curr_txn, ERR_BAD_STATE, 0);
-        return;
+        cmd->data->length = length;
+        cmd->data->complete_cb = ums_stage_complete;
+        cmd->data->cookie = cmd;
     }
-    // if head of iotxn list is a read iotxn and CSW reports success, then set its buffer to that
-    // of the latest read request, with limited length based on data residue field in CSW
-    if (curr_txn->opcode == IOTXN_OP_READ) {
-        iotxn_t* read_request = pop_completed_read(msd);
-        if (!read_request) {
-            list_add_tail(&msd->free_csw_reqs, &csw_request->node);
-            return;
-        }
-        // data residue field is the 3rd uint32_t in csw buffer
-        uint32_t temp;
-        csw_request->ops->copyfrom(csw_request, &temp, sizeof(temp), 2 * sizeof(temp));
-        uint32_t residue = letoh32(temp);
-        uint32_t length = read_request->actual - residue;
-        void* buffer;
-        curr_txn->ops->mmap(curr_txn, &buffer);
-        read_request->ops->copyfrom(read_request, buffer, length, 0);
-        list_add_tail(&msd->free_read_reqs, &read_request->node);
-    }
-
-    list_add_tail(&msd->free_csw_reqs, &csw_request->node);
-    curr_txn->ops->complete(curr_txn, NO_ERROR, curr_txn->length);
-}
+    cmd->txn = NULL;
+    cmd->completion = &completion;
 
-static void ums_write_complete(iotxn_t* txn, void* cookie) {
-    ums_t* msd = (ums_t*)cookie;
-    // FIXME what to do with error here?
-    list_add_tail(&msd->free_write_reqs, &txn->node);
-}
+    ums_fill_cbw(msd, cmd, lun, length, flags, command_len, command);
+    ums_send_command(msd, cmd);
+    completion_wait(&completion, MX_TIME_INFINITE);
 
-static mx_status_t ums_inquiry(ums_t* msd, uint8_t* out_data) {
-    mx_status_t status = NO_ERROR;
+    mx_status_t status = cmd->status;
+    if (status == NO_ERROR && out_data) {
+        cmd->data->ops->copyfrom(cmd->data, out_data, length, 0);
+    }
+    if (cmd->data) {
+        cmd->data->ops->release(cmd->data);
+        cmd->data = NULL;
+    }
+
+    mtx_lock(&msd->mutex);
+    bool reset = msd->reset_needed;
+    msd->reset_needed = false;
+    mtx_unlock(&msd->mutex);
+    if (reset) {
+        ums_reset(msd);
+    }
+    return status;
+}
 
+static mx_status_t ums_inquiry(ums_t* msd, uint8_t lun, uint8_t* out_data) {
     // CBW Configuration
     uint8_t command[UMS_INQUIRY_COMMAND_LENGTH];
     memset(command, 0, UMS_INQUIRY_COMMAND_LENGTH);
@@ -327,49 +375,21 @@ static mx_status_t ums_inquiry(ums_t* msd, uint8_t* out_data) {
     command[0] = UMS_INQUIRY;
     // set allocated length in scsi command
     command[4] = UMS_INQUIRY_TRANSFER_LENGTH;
-    status = ums_send_cbw(msd, UMS_INQUIRY_TRANSFER_LENGTH, USB_DIR_IN,
-                          UMS_INQUIRY_COMMAND_LENGTH, command);
-    if (status == ERR_BUFFER_TOO_SMALL) {
-        return status;
-    }
-
-    // read inquiry response
-    status = ums_queue_read(msd, UMS_INQUIRY_TRANSFER_LENGTH);
-    if (status == ERR_BUFFER_TOO_SMALL) {
-        return status;
-    }
-
-    // wait for CSW
-    status = ums_read_csw(msd);
-    iotxn_t* read_request = pop_completed_read(msd);
-    if (status == NO_ERROR) {
-        read_request->ops->copyfrom(read_request, out_data, UMS_INQUIRY_TRANSFER_LENGTH, 0);
-    }
-    list_add_tail(&msd->free_read_reqs, &read_request->node);
-    return status;
+    return ums_sync_command(msd, lun, USB_DIR_IN, UMS_INQUIRY_COMMAND_LENGTH, command,
+                            out_data, UMS_INQUIRY_TRANSFER_LENGTH);
 }
 
-static mx_status_t ums_test_unit_ready(ums_t* msd) {
-    mx_status_t status = NO_ERROR;
-
+static mx_status_t ums_test_unit_ready(ums_t* msd, uint8_t lun) {
     // CBW Configuration
     uint8_t command[UMS_TEST_UNIT_READY_COMMAND_LENGTH];
     memset(command, 0, UMS_TEST_UNIT_READY_COMMAND_LENGTH);
     // set command type
     command[0] = (char)UMS_TEST_UNIT_READY;
-    status = ums_send_cbw(msd, UMS_NO_TRANSFER_LENGTH, USB_DIR_IN,
-                          UMS_TEST_UNIT_READY_COMMAND_LENGTH, command);
-    if (status == ERR_BUFFER_TOO_SMALL) {
-        return status;
-    }
-
-    // wait for CSW
-    return ums_read_csw(msd);
+    return ums_sync_command(msd, lun, USB_DIR_IN, UMS_TEST_UNIT_READY_COMMAND_LENGTH, command,
+                            NULL, UMS_NO_TRANSFER_LENGTH);
 }
 
-static mx_status_t ums_request_sense(ums_t* msd, uint8_t* out_data) {
-    mx_status_t status = NO_ERROR;
-
+static mx_status_t ums_request_sense(ums_t* msd, uint8_t lun, uint8_t* out_data) {
     // CBW Configuration
     uint8_t command[UMS_REQUEST_SENSE_COMMAND_LENGTH];
     memset(command, 0, UMS_REQUEST_SENSE_COMMAND_LENGTH);
@@ -377,92 +397,21 @@ static mx_status_t ums_request_sense(ums_t* msd, uint8_t* out_data) {
     command[0] = UMS_REQUEST_SENSE;
     // set allocated length in scsi command
     command[4] = UMS_REQUEST_SENSE_TRANSFER_LENGTH;
-    status = ums_send_cbw(msd, UMS_REQUEST_SENSE_TRANSFER_LENGTH, USB_DIR_IN,
-                            UMS_REQUEST_SENSE_COMMAND_LENGTH, command);
-    if (status == ERR_BUFFER_TOO_SMALL) {
-        return status;
-    }
-
-    // read request sense response
-    status = ums_queue_read(msd, UMS_REQUEST_SENSE_TRANSFER_LENGTH);
-    if (status == ERR_BUFFER_TOO_SMALL) {
-        return status;
-    }
-
-    // wait for CSW
-    status = ums_read_csw(msd);
-    iotxn_t* read_request = pop_completed_read(msd);
-    if (status == NO_ERROR) {
-        read_request->ops->copyfrom(read_request, out_data, UMS_REQUEST_SENSE_TRANSFER_LENGTH, 0);
-    }
-    list_add_tail(&msd->free_read_reqs, &read_request->node);
-    return status;
+    return ums_sync_command(msd, lun, USB_DIR_IN, UMS_REQUEST_SENSE_COMMAND_LENGTH, command,
+                            out_data, UMS_REQUEST_SENSE_TRANSFER_LENGTH);
 }
 
-static mx_status_t ums_read_format_capacities(ums_t* msd, uint8_t* out_data) {
-    mx_status_t status = NO_ERROR;
-
-    // CBW Configuration
-    uint8_t command[UMS_READ_FORMAT_CAPACITIES_COMMAND_LENGTH];
-    memset(command, 0, UMS_READ_FORMAT_CAPACITIES_COMMAND_LENGTH);
-    // set command type
-    command[0] = UMS_READ_FORMAT_CAPACITIES;
-    // set allocated length in scsi command
-    command[8] = UMS_READ_FORMAT_CAPACITIES_TRANSFER_LENGTH;
-    status = ums_send_cbw(msd, UMS_READ_FORMAT_CAPACITIES_TRANSFER_LENGTH, USB_DIR_IN,
-                            UMS_READ_FORMAT_CAPACITIES_COMMAND_LENGTH, command);
-    if (status == ERR_BUFFER_TOO_SMALL) {
-        return status;
-    }
-
-    // read request sense response
-    status = ums_queue_read(msd, UMS_READ_FORMAT_CAPACITIES_TRANSFER_LENGTH);
-    if (status == ERR_BUFFER_TOO_SMALL) {
-        return status;
-    }
-
-    // wait for CSW
-    status = ums_read_csw(msd);
-    iotxn_t* read_request = pop_completed_read(msd);
-    if (status == NO_ERROR) {
-        read_request->ops->copyfrom(read_request, out_data, UMS_READ_FORMAT_CAPACITIES_TRANSFER_LENGTH, 0);
-    }
-    list_add_tail(&msd->free_read_reqs, &read_request->node);
-    return status;
-}
-
-static mx_status_t ums_read_capacity10(ums_t* msd, uint8_t* out_data) {
-    mx_status_t status = NO_ERROR;
-
+static mx_status_t ums_read_capacity10(ums_t* msd, uint8_t lun, uint8_t* out_data) {
     // CBW Configuration
     uint8_t command[UMS_READ_CAPACITY10_COMMAND_LENGTH];
     memset(command, 0, UMS_READ_CAPACITY10_COMMAND_LENGTH);
     // set command type
     command[0] = UMS_READ_CAPACITY10;
-    status = ums_send_cbw(msd, UMS_READ_CAPACITY10_TRANSFER_LENGTH, USB_DIR_IN,
-                            UMS_READ_CAPACITY10_COMMAND_LENGTH, command);
-    if (status == ERR_BUFFER_TOO_SMALL) {
-        return status;
-    }
-
-    // read capacity10 response
-    status = ums_queue_read(msd, UMS_READ_CAPACITY10_TRANSFER_LENGTH);
-    if (status == ERR_BUFFER_TOO_SMALL) {
-        return status;
-    }
-
-    status = ums_read_csw(msd);
-    iotxn_t* read_request = pop_completed_read(msd);
-    if (status == NO_ERROR) {
-        read_request->ops->copyfrom(read_request, out_data, UMS_READ_CAPACITY10_TRANSFER_LENGTH, 0);
-    }
-    list_add_tail(&msd->free_read_reqs, &read_request->node);
-    return status;
+    return ums_sync_command(msd, lun, USB_DIR_IN, UMS_READ_CAPACITY10_COMMAND_LENGTH, command,
+                            out_data, UMS_READ_CAPACITY10_TRANSFER_LENGTH);
 }
 
-static mx_status_t ums_read_capacity16(ums_t* msd, uint8_t* out_data) {
-    mx_status_t status = NO_ERROR;
-
+static mx_status_t ums_read_capacity16(ums_t* msd, uint8_t lun, uint8_t* out_data) {
     // CBW Configuration
     uint8_t command[UMS_READ_CAPACITY16_COMMAND_LENGTH];
     memset(command, 0, UMS_READ_CAPACITY16_COMMAND_LENGTH);
@@ -471,251 +420,217 @@ static mx_status_t ums_read_capacity16(ums_t* msd, uint8_t* out_data) {
     // service action = 10, not sure what that means
     command[1] = 0x10;
     command[13] = UMS_READ_CAPACITY16_TRANSFER_LENGTH;  // LSB of allocation length
-    status = ums_send_cbw(msd, UMS_READ_CAPACITY16_TRANSFER_LENGTH, USB_DIR_IN,
-                            UMS_READ_CAPACITY16_COMMAND_LENGTH, command);
-    if (status == ERR_BUFFER_TOO_SMALL) {
-        return status;
-    }
-
-    // read capacity16 response
-    status = ums_queue_read(msd, UMS_READ_CAPACITY16_TRANSFER_LENGTH);
-    if (status == ERR_BUFFER_TOO_SMALL) {
+    return ums_sync_command(msd, lun, USB_DIR_IN, UMS_READ_CAPACITY16_COMMAND_LENGTH, command,
+                            out_data, UMS_READ_CAPACITY16_TRANSFER_LENGTH);
+}
+
+// sets up cmd to service the next part of a block read or write, starting
+// cmd->txn_done bytes in and at most UMS_MAX_TRANSFER long. The data stage
+// is a partial clone of txn so that the transfer goes straight to and from
+// txn's pages and is split into chained TRBs by the host controller rather
+// than into separate bounce buffer sized requests here.
+static mx_status_t ums_prepare_rw(ums_t* msd, ums_command_t* cmd, iotxn_t* txn) {
+    ums_lun_t* lun = (ums_lun_t*)txn->context;
+    bool read = (txn->opcode == IOTXN_OP_READ);
+    uint32_t max_transfer = MAX(UMS_MAX_TRANSFER - (UMS_MAX_TRANSFER % lun->block_size),
+                                lun->block_size);
+    uint32_t transfer_length = MIN(txn->length - cmd->txn_done, max_transfer);
+    uint64_t lba = (txn->offset + cmd->txn_done) / lun->block_size;
+    uint32_t num_blocks = transfer_length / lun->block_size;
+
+    iotxn_t* data;
+    mx_status_t status = txn->ops->clone_partial(txn, cmd->txn_done, transfer_length, &data, 0);
+    if (status != NO_ERROR) {
         return status;
     }
-
-    status = ums_read_csw(msd);
-    iotxn_t* read_request = pop_completed_read(msd);
-    if (status == NO_ERROR) {
-        read_request->ops->copyfrom(read_request, out_data, UMS_READ_CAPACITY16_TRANSFER_LENGTH, 0);
-    }
-    list_add_tail(&msd->free_read_reqs, &read_request->node);
-    return status;
-}
-
-mx_status_t ums_read(mx_device_t* device, iotxn_t* txn) {
-    if (txn->length > UINT32_MAX) return ERR_INVALID_ARGS;
-    ums_t* msd = get_ums(device);
-    mx_status_t status = NO_ERROR;
-
-    uint64_t lba = txn->offset/msd->block_size;
-    uint32_t num_blocks = txn->length/msd->block_size;
-    uint32_t transfer_length = txn->length;
+    data->protocol = MX_PROTOCOL_USB;
+    usb_protocol_data_t* pdata = iotxn_pdata(data, usb_protocol_data_t);
+    memset(pdata, 0, sizeof(*pdata));
+    pdata->ep_address = (read ? msd->bulk_in_addr : msd->bulk_out_addr);
+    data->offset = 0;
+    data->length = transfer_length;
+    data->complete_cb = ums_stage_complete;
+    data->cookie = cmd;
+    cmd->data = data;
+    cmd->txn = txn;
+    cmd->completion = NULL;
 
     // CBW Configuration
-
-    if (msd->use_read_write_16) {
-        uint8_t command[UMS_READ16_COMMAND_LENGTH];
-        memset(command, 0, UMS_READ16_COMMAND_LENGTH);
+    uint8_t command[UMS_READ16_COMMAND_LENGTH];
+    uint8_t command_len;
+    memset(command, 0, sizeof(command));
+    if (lun->use_read_write_16) {
         // set command type
-        command[0] = UMS_READ16;
+        command[0] = (read ? UMS_READ16 : UMS_WRITE16);
         // set lba
         write64be(command + 2, lba);
         // set transfer length in blocks
         write32be(command + 10, num_blocks);
-        status = ums_send_cbw(msd, transfer_length, USB_DIR_IN,
-                                UMS_READ16_COMMAND_LENGTH, command);
-        if (status == ERR_BUFFER_TOO_SMALL) {
-            return status;
-        }
+        command_len = UMS_READ16_COMMAND_LENGTH;
     } else if (num_blocks <= UINT16_MAX) {
-        uint8_t command[UMS_READ10_COMMAND_LENGTH];
-        memset(command, 0, UMS_READ10_COMMAND_LENGTH);
-        // set command type
-        command[0] = UMS_READ10;
-        // set lba
+        command[0] = (read ? UMS_READ10 : UMS_WRITE10);
         write32be(command + 2, lba);
-        // set transfer length in blocks
         write16be(command + 7, num_blocks);
-        status = ums_send_cbw(msd, transfer_length, USB_DIR_IN, UMS_READ10_COMMAND_LENGTH, command);
-        if (status == ERR_BUFFER_TOO_SMALL) {
-            return status;
-        }
+        command_len = UMS_READ10_COMMAND_LENGTH;
     } else {
-        uint8_t command[UMS_READ12_COMMAND_LENGTH];
-        memset(command, 0, UMS_READ12_COMMAND_LENGTH);
-        // set command type
-        command[0] = UMS_READ12;
-        // set lba
+        command[0] = (read ? UMS_READ12 : UMS_WRITE12);
         write32be(command + 2, lba);
-        // set transfer length in blocks
         write32be(command + 6, num_blocks);
-        status = ums_send_cbw(msd, transfer_length, USB_DIR_IN,
-            UMS_READ12_COMMAND_LENGTH, command);
-        if (status == ERR_BUFFER_TOO_SMALL) {
-            return status;
-        }
-    }
-
-    // read request sense response
-    status = ums_queue_read(msd, transfer_length);
-    if (status == ERR_BUFFER_TOO_SMALL) {
-        return status;
+        command_len = UMS_READ12_COMMAND_LENGTH;
     }
-
-    // receive CSW
-    return ums_queue_csw(msd);
+    ums_fill_cbw(msd, cmd, lun->lun, transfer_length, (read ? USB_DIR_IN : USB_DIR_OUT),
+                 command_len, command);
+    return NO_ERROR;
 }
 
-mx_status_t ums_write(mx_device_t* device, iotxn_t* txn) {
-    if (txn->length > UINT32_MAX) return ERR_INVALID_ARGS;
-    ums_t* msd = get_ums(device);
-    mx_status_t status = NO_ERROR;
+static int ums_worker_thread(void* arg) {
+    ums_t* msd = (ums_t*)arg;
 
-    uint64_t lba = txn->offset/msd->block_size;
-    uint32_t num_blocks = txn->length/msd->block_size;
-    uint32_t transfer_length = txn->length;
+    for (;;) {
+        completion_wait(&msd->worker_completion, MX_TIME_INFINITE);
+        completion_reset(&msd->worker_completion);
 
-    if (msd->use_read_write_16) {
-        uint8_t command[UMS_WRITE16_COMMAND_LENGTH];
-        memset(command, 0, UMS_WRITE16_COMMAND_LENGTH);
-        // set command type
-        command[0] = UMS_WRITE16;
-        // set lba
-        uint64_t* lba_ptr = (uint64_t*)&(command[2]);
-        *lba_ptr = htobe64(lba);
-        // set transfer length
-        uint32_t* transfer_len_ptr = (uint32_t*)&(command[10]);
-        *transfer_len_ptr = htobe32(num_blocks);
-        status = ums_send_cbw(msd, transfer_length, USB_DIR_OUT,
-                                UMS_WRITE16_COMMAND_LENGTH, command);
-        if (status == ERR_BUFFER_TOO_SMALL) {
-            return status;
+        mtx_lock(&msd->mutex);
+        if (msd->dead) {
+            mtx_unlock(&msd->mutex);
+            break;
         }
-    } else if (num_blocks <= UINT16_MAX) {
-        uint8_t command[UMS_WRITE10_COMMAND_LENGTH];
-        memset(command, 0, UMS_WRITE10_COMMAND_LENGTH);
-        // set command type
-        command[0] = UMS_WRITE10;
-        // set lba
-        uint32_t* lba_ptr = (uint32_t*)&(command[2]);
-        *lba_ptr = htobe32(lba);
-        // set transfer length in blocks
-        uint16_t* transfer_len_ptr = (uint16_t*)&(command[7]);
-        *transfer_len_ptr = htobe16(num_blocks);
-        status = ums_send_cbw(msd, transfer_length, USB_DIR_OUT,
-                                UMS_WRITE10_COMMAND_LENGTH, command);
-        if (status == ERR_BUFFER_TOO_SMALL) {
-            return status;
+        if (msd->reset_needed && !msd->busy) {
+            mtx_unlock(&msd->mutex);
+            ums_reset(msd);
+            mtx_lock(&msd->mutex);
+            msd->reset_needed = false;
         }
-    } else {
-        uint8_t command[UMS_WRITE12_COMMAND_LENGTH];
-        memset(command, 0, UMS_WRITE12_COMMAND_LENGTH);
-        // set command type
-        command[0] = UMS_WRITE12;
-        // set lba
-        uint32_t* lba_ptr = (uint32_t*)&(command[2]);
-        *lba_ptr = htobe32(lba);
-        // set transfer length
-        uint32_t* transfer_len_ptr = (uint32_t*)&(command[6]);
-        *transfer_len_ptr = htobe32(num_blocks);
-        status = ums_send_cbw(msd, transfer_length, USB_DIR_OUT,
-                                UMS_WRITE12_COMMAND_LENGTH, command);
-        if (status == ERR_BUFFER_TOO_SMALL) {
-            return status;
+
+        // send the next queued iotxn once the command in flight is done
+        while (!msd->busy && !msd->reset_needed) {
+            iotxn_t* txn = list_remove_head_type(&msd->queued_iotxns, iotxn_t, node);
+            if (!txn) break;
+            ums_command_t* cmd = &msd->command;
+            cmd->txn_done = 0;
+            mx_status_t status = ums_prepare_rw(msd, cmd, txn);
+            // ums_send_command() takes the lock itself and the command may
+            // complete before it returns
+            mtx_unlock(&msd->mutex);
+            if (status != NO_ERROR) {
+                txn->ops->complete(txn, status, 0);
+            } else {
+                ums_send_command(msd, cmd);
+            }
+            mtx_lock(&msd->mutex);
         }
+        mtx_unlock(&msd->mutex);
     }
+    return 0;
+}
 
-    //write response
-    status = ums_queue_write(msd, transfer_length, txn);
-    if (status == ERR_BUFFER_TOO_SMALL) {
-        return status;
+static void ums_free(ums_t* msd) {
+    // once the worker has stopped nothing new is sent
+    mtx_lock(&msd->mutex);
+    msd->dead = true;
+    mtx_unlock(&msd->mutex);
+    if (msd->worker_thread) {
+        completion_signal(&msd->worker_completion);
+        thrd_join(msd->worker_thread, NULL);
     }
 
-    // receive CSW
-    return ums_queue_csw(msd);
-}
-
-mx_status_t ums_toggle_removable(mx_device_t* device, bool removable) {
-    ums_t* msd = get_ums(device);
-    mx_status_t status = NO_ERROR;
+    // the command in flight completes to msd, so wait it out
+    list_node_t queued;
+    list_node_t* node;
+    list_initialize(&queued);
+    mtx_lock(&msd->mutex);
+    while (msd->busy) {
+        cnd_wait(&msd->idle, &msd->mutex);
+    }
+    while ((node = list_remove_head(&msd->queued_iotxns)) != NULL) {
+        list_add_tail(&queued, node);
+    }
+    mtx_unlock(&msd->mutex);
 
-    // CBW Configuration
-    uint8_t command[UMS_TOGGLE_REMOVABLE_COMMAND_LENGTH];
-    memset(command, 0, UMS_TOGGLE_REMOVABLE_COMMAND_LENGTH);
-    // set command type
-    command[0] = UMS_TOGGLE_REMOVABLE;
-    status = ums_send_cbw(msd, UMS_NO_TRANSFER_LENGTH, USB_DIR_OUT,
-                            UMS_TOGGLE_REMOVABLE_COMMAND_LENGTH, command);
-    if (status == ERR_BUFFER_TOO_SMALL) {
-        return status;
+    iotxn_t* txn;
+    while ((txn = list_remove_head_type(&queued, iotxn_t, node)) != NULL) {
+        txn->ops->complete(txn, ERR_REMOTE_CLOSED, 0);
     }
 
-    // receive CSW
-    return ums_read_csw(msd);
+    ums_command_t* cmd = &msd->command;
+    if (cmd->cbw) {
+        cmd->cbw->ops->release(cmd->cbw);
+    }
+    if (cmd->csw) {
+        cmd->csw->ops->release(cmd->csw);
+    }
+    free(msd);
 }
 
 static void ums_unbind(mx_device_t* device) {
-    ums_t* msd = get_ums(device);
-    device_remove(&msd->device);
+    ums_lun_t* lun = get_ums_lun(device);
+    device_remove(&lun->device);
 }
 
 static mx_status_t ums_release(mx_device_t* device) {
-    ums_t* msd = get_ums(device);
-    iotxn_t* txn;
-    while ((txn = list_remove_head_type(&msd->free_csw_reqs, iotxn_t, node)) != NULL) {
-        txn->ops->release(txn);
-    }
-    while ((txn = list_remove_head_type(&msd->free_read_reqs, iotxn_t, node)) != NULL) {
-        txn->ops->release(txn);
-    }
-    while ((txn = list_remove_head_type(&msd->free_write_reqs, iotxn_t, node)) != NULL) {
-        txn->ops->release(txn);
-    }
+    ums_lun_t* lun = get_ums_lun(device);
+    ums_t* msd = lun->msd;
 
-    free(msd);
+    mtx_lock(&msd->mutex);
+    bool last = (--msd->device_count == 0);
+    mtx_unlock(&msd->mutex);
+
+    if (last) {
+        ums_free(msd);
+    }
     return NO_ERROR;
 }
 
 static void ums_iotxn_queue(mx_device_t* dev, iotxn_t* txn) {
-    ums_t* msd = get_ums(dev);
-    mtx_lock(&msd->mutex);
+    ums_lun_t* lun = get_ums_lun(dev);
+    ums_t* msd = lun->msd;
 
-    uint32_t block_size = msd->block_size;
+    uint32_t block_size = lun->block_size;
     // offset must be aligned to block size
     if (txn->offset % block_size) {
         DEBUG_PRINT(("UMS:offset on iotxn (%llu) not aligned to block size(%d)\n", txn->offset, block_size));
         txn->ops->complete(txn, ERR_INVALID_ARGS, 0);
-        goto out;
+        return;
     }
 
     if (txn->length % block_size) {
         DEBUG_PRINT(("UMS:length on iotxn (%llu) not aligned to block size(%d)\n", txn->length, block_size));
         txn->ops->complete(txn, ERR_INVALID_ARGS, 0);
-        goto out;
+        return;
     }
 
-    mx_status_t status;
-    if (txn->opcode == IOTXN_OP_READ) {
-        status = ums_read(dev, txn);
-    }else if (txn->opcode == IOTXN_OP_WRITE) {
-        status = ums_write(dev, txn);
-    } else {
-        status = ERR_INVALID_ARGS;
+    if (txn->length > UINT32_MAX ||
+        (txn->opcode != IOTXN_OP_READ && txn->opcode != IOTXN_OP_WRITE)) {
+        txn->ops->complete(txn, ERR_INVALID_ARGS, 0);
+        return;
     }
-    if (status == NO_ERROR) {
-        list_add_tail(&msd->queued_iotxns, &txn->node);
-    } else {
-        txn->ops->complete(txn, status, 0);
+    if (txn->length == 0) {
+        txn->ops->complete(txn, NO_ERROR, 0);
+        return;
     }
 
-out:
+    // the worker thread sends it once the command in flight is done
+    txn->context = lun;
+    mtx_lock(&msd->mutex);
+    list_add_tail(&msd->queued_iotxns, &txn->node);
     mtx_unlock(&msd->mutex);
+    completion_signal(&msd->worker_completion);
 }
 
 static ssize_t ums_ioctl(mx_device_t* dev, uint32_t op, const void* cmd, size_t cmdlen, void* reply, size_t max) {
-    ums_t* msd = get_ums(dev);
+    ums_lun_t* lun = get_ums_lun(dev);
     // TODO implement other block ioctls
     switch (op) {
     case IOCTL_BLOCK_GET_SIZE: {
         uint64_t* size = reply;
         if (max < sizeof(*size)) return ERR_BUFFER_TOO_SMALL;
-        *size = msd->total_blocks;
+        *size = lun->total_blocks;
         return sizeof(*size);
     }
     case IOCTL_BLOCK_GET_BLOCKSIZE: {
          uint64_t* blksize = reply;
          if (max < sizeof(*blksize)) return ERR_BUFFER_TOO_SMALL;
-         *blksize = msd->block_size;
+         *blksize = lun->block_size;
          return sizeof(*blksize);
     }
     default:
@@ -724,8 +639,8 @@ static ssize_t ums_ioctl(mx_device_t* dev, uint32_t op, const void* cmd, size_t
 }
 
 static mx_off_t ums_get_size(mx_device_t* dev) {
-    ums_t* msd = get_ums(dev);
-    return msd->block_size * msd->total_blocks;
+    ums_lun_t* lun = get_ums_lun(dev);
+    return lun->block_size * lun->total_blocks;
 }
 
 static mx_protocol_device_t ums_device_proto = {
@@ -736,32 +651,30 @@ static mx_protocol_device_t ums_device_proto = {
     .get_size = ums_get_size,
 };
 
-static int ums_start_thread(void* arg) {
-    ums_t* msd = (ums_t*)arg;
-    device_init(&msd->device, msd->driver, "usb_mass_storage", &ums_device_proto);
-
+// waits for a logical unit to become ready and reads its capacity
+static mx_status_t ums_lun_init(ums_t* msd, ums_lun_t* lun) {
     uint8_t inquiry_data[UMS_INQUIRY_TRANSFER_LENGTH];
-    mx_status_t status = ums_inquiry(msd, inquiry_data);
+    mx_status_t status = ums_inquiry(msd, lun->lun, inquiry_data);
     if (status < 0) {
-        printf("ums_inquiry failed: %d\n", status);
-        goto fail;
+        printf("ums_inquiry failed for lun %u: %d\n", lun->lun, status);
+        return status;
     }
 
     bool ready = false;
     for (int i = 0; i < 100; i++) {
-        status = ums_test_unit_ready(msd);
+        status = ums_test_unit_ready(msd, lun->lun);
         if (status == NO_ERROR) {
             ready = true;
             break;
         } else if (status != ERR_BAD_STATE) {
             printf("ums_test_unit_ready failed: %d\n", status);
-            goto fail;
+            return status;
         } else {
             uint8_t request_sense_data[UMS_REQUEST_SENSE_TRANSFER_LENGTH];
-            status = ums_request_sense(msd, request_sense_data);
+            status = ums_request_sense(msd, lun->lun, request_sense_data);
             if (status != NO_ERROR) {
                 printf("request_sense_data failed: %d\n", status);
-                goto fail;
+                return status;
             }
             // wait a bit before trying ums_test_unit_ready again
             usleep(100 * 1000);
@@ -769,45 +682,98 @@ static int ums_start_thread(void* arg) {
     }
     if (!ready) {
         printf("gave up waiting for ums_test_unit_ready to succeed\n");
-        goto fail;
+        return ERR_TIMED_OUT;
     }
 
     uint8_t read_capacity10_data[UMS_READ_CAPACITY10_TRANSFER_LENGTH];
-    status = ums_read_capacity10(msd, read_capacity10_data);
+    status = ums_read_capacity10(msd, lun->lun, read_capacity10_data);
     if (status < 0) {
         printf("read_capacity10 failed: %d\n", status);
-        goto fail;
+        return status;
     }
 
     // +1 because this returns the address of the final block, and blocks are zero indexed
-    msd->total_blocks = read32be(read_capacity10_data) + 1;
-    msd->block_size = read32be(read_capacity10_data + 4);
+    lun->total_blocks = read32be(read_capacity10_data) + 1;
+    lun->block_size = read32be(read_capacity10_data + 4);
 
     if (read32be(read_capacity10_data) == 0xFFFFFFFF) {
         uint8_t read_capacity16_data[UMS_READ_CAPACITY16_TRANSFER_LENGTH];
-        status = ums_read_capacity16(msd, read_capacity16_data);
+        status = ums_read_capacity16(msd, lun->lun, read_capacity16_data);
         if (status < 0) {
             printf("read_capacity16 failed: %d\n", status);
-            goto fail;
+            return status;
         }
 
-        msd->total_blocks = read64be((uint8_t*)&read_capacity16_data);
-        msd->block_size = read32be((uint8_t*)&read_capacity16_data + 8);
+        lun->total_blocks = read64be((uint8_t*)&read_capacity16_data);
+        lun->block_size = read32be((uint8_t*)&read_capacity16_data + 8);
+    }
+    if (lun->block_size == 0) {
+        return ERR_NOT_SUPPORTED;
     }
 
     // Need to use READ16/WRITE16 if block addresses are greater than 32 bit
-    msd->use_read_write_16 = msd->total_blocks > UINT32_MAX;
+    lun->use_read_write_16 = lun->total_blocks > UINT32_MAX;
 
-    DEBUG_PRINT(("UMS:block size is: 0x%08x\n", msd->block_size));
-    DEBUG_PRINT(("UMS:total blocks is: %lld\n", msd->total_blocks));
-    DEBUG_PRINT(("UMS:total size is: %lld\n", msd->total_blocks * msd->block_size));
-    msd->device.protocol_id = MX_PROTOCOL_BLOCK;
-    status = device_add(&msd->device, msd->udev);
-    if (status == NO_ERROR) return NO_ERROR;
+    DEBUG_PRINT(("UMS:lun %u block size is: 0x%08x\n", lun->lun, lun->block_size));
+    DEBUG_PRINT(("UMS:lun %u total blocks is: %lld\n", lun->lun, lun->total_blocks));
+    DEBUG_PRINT(("UMS:lun %u total size is: %lld\n", lun->lun, lun->total_blocks * lun->block_size));
+    return NO_ERROR;
+}
+
+static int ums_start_thread(void* arg) {
+    ums_t* msd = (ums_t*)arg;
+    mx_status_t status = NO_ERROR;
+
+    bool ready[UMS_MAX_LUNS] = { false };
+    bool any_ready = false;
+    for (uint8_t i = 0; i <= msd->max_lun; i++) {
+        ums_lun_t* lun = &msd->luns[i];
+        lun->msd = msd;
+        lun->lun = i;
+        status = ums_lun_init(msd, lun);
+        if (status == NO_ERROR) {
+            ready[i] = any_ready = true;
+        }
+    }
+    if (!any_ready) goto fail;
+
+    // from here on all commands go through the worker thread
+    msd->worker_completion = COMPLETION_INIT;
+    int ret = thrd_create_with_name(&msd->worker_thread, ums_worker_thread, msd, "ums_worker");
+    if (ret != thrd_success) {
+        msd->worker_thread = 0;
+        status = ERR_NO_RESOURCES;
+        goto fail;
+    }
+
+    // msd is freed once the last lun device is released, which may happen
+    // in this loop if device_add() fails
+    uint8_t max_lun = msd->max_lun;
+    for (uint8_t i = 0; i <= max_lun; i++) {
+        if (ready[i]) msd->device_count++;
+    }
+    for (uint8_t i = 0; i <= max_lun; i++) {
+        if (!ready[i]) continue;
+        ums_lun_t* lun = &msd->luns[i];
+        char name[MX_DEVICE_NAME_MAX + 1];
+        if (i == 0) {
+            snprintf(name, sizeof(name), "usb_mass_storage");
+        } else {
+            snprintf(name, sizeof(name), "usb_mass_storage-lun%u", i);
+        }
+        device_init(&lun->device, msd->driver, name, &ums_device_proto);
+        lun->device.protocol_id = MX_PROTOCOL_BLOCK;
+        status = device_add(&lun->device, msd->udev);
+        if (status != NO_ERROR) {
+            printf("ums: device_add failed for lun %u: %d\n", i, status);
+            ums_release(&lun->device);
+        }
+    }
+    return NO_ERROR;
 
 fail:
     printf("ums_start_thread failed\n");
-    ums_release(&msd->device);
+    ums_free(msd);
     return status;
 }
 
@@ -859,12 +825,8 @@ static mx_status_t ums_bind(mx_driver_t* driver, mx_device_t* device) {
         return ERR_NO_MEMORY;
     }
 
-    list_initialize(&msd->free_read_reqs);
-    list_initialize(&msd->free_csw_reqs);
-    list_initialize(&msd->free_write_reqs);
     list_initialize(&msd->queued_iotxns);
-    list_initialize(&msd->completed_reads);
-    list_initialize(&msd->completed_csws);
+    cnd_init(&msd->idle);
 
     msd->udev = device;
     msd->driver = driver;
@@ -872,43 +834,28 @@ static mx_status_t ums_bind(mx_driver_t* driver, mx_device_t* device) {
     msd->bulk_out_addr = bulk_out_addr;
 
     mx_status_t status = NO_ERROR;
-    for (int i = 0; i < READ_REQ_COUNT; i++) {
-        iotxn_t* txn = usb_alloc_iotxn(bulk_in_addr, USB_BUF_SIZE, 0);
-        if (!txn) {
-            status = ERR_NO_MEMORY;
-            goto fail;
-        }
-        txn->complete_cb = ums_read_complete;
-        txn->cookie = msd;
-        list_add_head(&msd->free_read_reqs, &txn->node);
-    }
-    for (int i = 0; i < READ_REQ_COUNT; i++) {
-        iotxn_t* txn = usb_alloc_iotxn(bulk_in_addr, UMS_COMMAND_STATUS_WRAPPER_SIZE, 0);
-        if (!txn) {
-            status = ERR_NO_MEMORY;
-            goto fail;
-        }
-        txn->length = UMS_COMMAND_STATUS_WRAPPER_SIZE;
-        // complete_cb and cookie are set later
-        list_add_head(&msd->free_csw_reqs, &txn->node);
-    }
-    for (int i = 0; i < WRITE_REQ_COUNT; i++) {
-        iotxn_t* txn = usb_alloc_iotxn(bulk_out_addr, USB_BUF_SIZE, 0);
-        if (!txn) {
-            status = ERR_NO_MEMORY;
-            goto fail;
-        }
-        txn->complete_cb = ums_write_complete;
-        txn->cookie = msd;
-        list_add_head(&msd->free_write_reqs, &txn->node);
+    ums_command_t* cmd = &msd->command;
+    cmd->msd = msd;
+    cmd->cbw = usb_alloc_iotxn(bulk_out_addr, UMS_COMMAND_BLOCK_WRAPPER_SIZE, 0);
+    cmd->csw = usb_alloc_iotxn(bulk_in_addr, UMS_COMMAND_STATUS_WRAPPER_SIZE, 0);
+    if (!cmd->cbw || !cmd->csw) {
+        status = ERR_NO_MEMORY;
+        goto fail;
     }
+    cmd->cbw->complete_cb = ums_stage_complete;
+    cmd->cbw->cookie = cmd;
+    cmd->csw->length = UMS_COMMAND_STATUS_WRAPPER_SIZE;
+    cmd->csw->complete_cb = ums_stage_complete;
+    cmd->csw->cookie = cmd;
 
+    // devices with a single lun may stall this request
     uint8_t lun = 0;
-    ums_get_max_lun(msd, (void*)&lun);
+    if (ums_get_max_lun(msd, (void*)&lun) < 0 || lun >= UMS_MAX_LUNS) {
+        lun = 0;
+    }
     DEBUG_PRINT(("UMS:Max lun is: %02x\n", (unsigned char)lun));
-    msd->tag_send = msd->tag_receive = 8;
-    // TODO: get this lun from some sort of valid way. not sure how multilun support works
-    msd->lun = 0;
+    msd->max_lun = lun;
+    msd->tag = 8;
     thrd_t thread;
     thrd_create_with_name(&thread, ums_start_thread, msd, "ums_start_thread");
     thrd_detach(thread);
@@ -917,7 +864,7 @@ static mx_status_t ums_bind(mx_driver_t* driver, mx_device_t* device) {
 
 fail:
     printf("ums_bind failed: %d\n", status);
-    ums_release(&msd->device);
+    ums_free(msd);
     return status;
 }
 
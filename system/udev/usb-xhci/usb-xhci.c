@@ -39,10 +39,12 @@ typedef struct usb_xhci {
     io_alloc_t* io_alloc;
     pci_protocol_t* pci_proto;
     bool legacy_irq_mode;
-    mx_handle_t irq_handle;
+    // one irq per interruptor, each delivered to its own io port so
+    // every interruptor thread sleeps on its own
+    mx_handle_t irq_handles[XHCI_MAX_INTERRUPTORS];
+    mx_handle_t irq_ports[XHCI_MAX_INTERRUPTORS];
     mx_handle_t mmio_handle;
     mx_handle_t cfg_handle;
-    thrd_t irq_thread;
 
     // used by the start thread
     mx_device_t* parent;
@@ -108,34 +110,157 @@ mx_vaddr_t xhci_phys_to_virt(xhci_t* xhci, mx_paddr_t addr) {
     return io_phys_to_virt(uxhci->io_alloc, addr);
 }
 
+typedef struct {
+    usb_xhci_t* uxhci;
+    uint32_t interruptor;
+} xhci_irq_thread_arg_t;
+
+static void xhci_irq_loop(usb_xhci_t* uxhci, uint32_t interruptor) {
+    mx_handle_t irq_port = uxhci->irq_ports[interruptor];
+
+    while (1) {
+        // the irq stays masked from when its packet is dequeued until
+        // the next wait, so the event ring is drained first
+        mx_irq_packet_t pkt;
+        mx_status_t wait_res = mx_port_wait(irq_port, &pkt, sizeof(pkt));
+        if (wait_res != NO_ERROR) {
+            if (wait_res != ERR_HANDLE_CLOSED) {
+                printf("unexpected mx_port_wait failure (%d)\n", wait_res);
+            }
+            break;
+        }
+
+        xhci_handle_interrupt(&uxhci->xhci, uxhci->legacy_irq_mode, interruptor);
+    }
+}
+
+// services interruptors other than 0, which only carry transfer events
+static int xhci_secondary_irq_thread(void* arg) {
+    xhci_irq_thread_arg_t* thread_arg = arg;
+    usb_xhci_t* uxhci = thread_arg->uxhci;
+    uint32_t interruptor = thread_arg->interruptor;
+    free(thread_arg);
+
+    xprintf("xhci_irq_thread %u start\n", interruptor);
+    xhci_irq_loop(uxhci, interruptor);
+    xprintf("xhci_irq_thread %u done\n", interruptor);
+    return 0;
+}
+
 static int xhci_irq_thread(void* arg) {
     usb_xhci_t* uxhci = (usb_xhci_t*)arg;
     xprintf("xhci_irq_thread start\n");
 
+    // start the threads for the other interruptors before the controller,
+    // so no slot is ever routed to an interruptor nobody services.
+    // they see no events until the controller is running
+    for (uint32_t i = 1; i < uxhci->xhci.num_interruptors; i++) {
+        xhci_irq_thread_arg_t* thread_arg = malloc(sizeof(xhci_irq_thread_arg_t));
+        thrd_t thread;
+        if (thread_arg) {
+            thread_arg->uxhci = uxhci;
+            thread_arg->interruptor = i;
+            if (thrd_create_with_name(&thread, xhci_secondary_irq_thread, thread_arg,
+                                      "xhci_irq_thread") != thrd_success) {
+                free(thread_arg);
+                thread_arg = NULL;
+            }
+        }
+        if (!thread_arg) {
+            printf("xhci_irq_thread: failed to start interruptor %u thread, using %u\n", i, i);
+            xhci_trim_interruptors(&uxhci->xhci, i);
+            break;
+        }
+        thrd_detach(thread);
+    }
+
     // xhci_start will block, so do this part here instead of in usb_xhci_bind
-    xhci_start(&uxhci->xhci);
+    mx_status_t status = xhci_start(&uxhci->xhci);
+    if (status != NO_ERROR) {
+        // without completers no transfer would ever finish, so the
+        // controller is never published
+        printf("xhci_irq_thread: xhci_start failed %d\n", status);
+        return status;
+    }
 
     device_add(&uxhci->device, uxhci->parent);
     uxhci->parent = NULL;
 
-    while (1) {
-        mx_status_t wait_res;
+    xhci_irq_loop(uxhci, 0);
+    xprintf("xhci_irq_thread done\n");
+    return 0;
+}
 
-        wait_res = mx_handle_wait_one(uxhci->irq_handle,
-                                      MX_SIGNAL_SIGNALED, MX_TIME_INFINITE, NULL);
-        if (wait_res != NO_ERROR) {
-            if (wait_res != ERR_HANDLE_CLOSED) {
-                printf("unexpected pci_wait_interrupt failure (%d)\n", wait_res);
+// Selects our IRQ mode and maps one IRQ per interruptor.  Multiple
+// interruptors need MSI-X, and each vector is steered to its own cpu.
+static mx_status_t xhci_setup_irqs(usb_xhci_t* uxhci, mx_device_t* dev) {
+    pci_protocol_t* pci_proto = uxhci->pci_proto;
+    uint32_t irq_count = uxhci->xhci.num_interruptors;
+    mx_status_t status = ERR_NOT_SUPPORTED;
+
+    if (irq_count > 1) {
+        uint32_t max_irqs;
+        if (pci_proto->query_irq_mode_caps(dev, MX_PCIE_IRQ_MODE_MSI_X, &max_irqs) == NO_ERROR) {
+            if (irq_count > max_irqs) {
+                irq_count = max_irqs;
             }
-            mx_interrupt_complete(uxhci->irq_handle);
-            break;
+            status = pci_proto->set_irq_mode(dev, MX_PCIE_IRQ_MODE_MSI_X, irq_count);
+        }
+    }
+    if (status < 0) {
+        irq_count = 1;
+        status = pci_proto->set_irq_mode(dev, MX_PCIE_IRQ_MODE_MSI, 1);
+    }
+    if (status < 0) {
+        mx_status_t status_legacy = pci_proto->set_irq_mode(dev, MX_PCIE_IRQ_MODE_LEGACY, 1);
+
+        if (status_legacy < 0) {
+            printf("usb_xhci_bind Failed to set IRQ mode to either MSI "
+                   "(err = %d) or Legacy (err = %d)\n",
+                   status, status_legacy);
+            return status;
         }
 
-        mx_interrupt_complete(uxhci->irq_handle);
-        xhci_handle_interrupt(&uxhci->xhci, uxhci->legacy_irq_mode);
+        uxhci->legacy_irq_mode = true;
     }
-    xprintf("xhci_irq_thread done\n");
-    return 0;
+    // interruptors without an IRQ of their own are not used
+    xhci_trim_interruptors(&uxhci->xhci, irq_count);
+
+    // register for interrupts
+    for (uint32_t i = 0; i < irq_count; i++) {
+        status = pci_proto->map_interrupt(dev, i);
+        if (status < 0) {
+            printf("usb_xhci_bind map_interrupt failed %d\n", status);
+            return status;
+        }
+        uxhci->irq_handles[i] = status;
+
+        status = mx_port_create(0);
+        if (status < 0) {
+            printf("usb_xhci_bind port_create failed %d\n", status);
+            return status;
+        }
+        uxhci->irq_ports[i] = status;
+
+        status = mx_interrupt_bind(uxhci->irq_handles[i], uxhci->irq_ports[i], i, 1, 0);
+        if (status < 0) {
+            printf("usb_xhci_bind interrupt_bind failed %d\n", status);
+            return status;
+        }
+    }
+
+    if (irq_count > 1) {
+        uint32_t num_cpus = mx_num_cpus();
+        for (uint32_t i = 0; i < irq_count; i++) {
+            // not fatal, the irq just stays where it is
+            status = pci_proto->set_irq_affinity(dev, i, i % num_cpus);
+            if (status < 0) {
+                xprintf("usb_xhci_bind set_irq_affinity(%u) failed %d\n", i, status);
+            }
+        }
+    }
+
+    return NO_ERROR;
 }
 
 static void xhci_set_bus_device(mx_device_t* device, mx_device_t* busdev) {
@@ -226,8 +351,9 @@ static mx_status_t xhci_do_iotxn_queue(xhci_t* xhci, iotxn_t* txn) {
     if (ep_index >= XHCI_NUM_EPS) {
          return ERR_INVALID_ARGS;
     }
-    mx_paddr_t phys_addr;
-    txn->ops->physmap(txn, &phys_addr);
+    iotxn_sg_t* sg;
+    uint32_t sg_count;
+    txn->ops->physmap_sg(txn, &sg, &sg_count);
 
     xhci_transfer_context_t* context = malloc(sizeof(xhci_transfer_context_t));
     if (!context) {
@@ -244,8 +370,8 @@ static mx_status_t xhci_do_iotxn_queue(xhci_t* xhci, iotxn_t* txn) {
     } else {
         direction = data->ep_address & USB_ENDPOINT_DIR_MASK;
     }
-    return xhci_queue_transfer(xhci, data->device_id, setup, phys_addr, txn->length,
-                                 ep_index, direction, data->frame, context, &txn->node);
+    return xhci_queue_transfer(xhci, data->device_id, setup, sg, sg_count, txn->length,
+                               ep_index, direction, data->frame, context, &txn->node);
 }
 
 void xhci_process_deferred_txns(xhci_t* xhci, xhci_transfer_ring_t* ring, bool closed) {
@@ -311,7 +437,6 @@ static mx_protocol_device_t xhci_device_proto = {
 };
 
 static mx_status_t usb_xhci_bind(mx_driver_t* drv, mx_device_t* dev) {
-    mx_handle_t irq_handle = MX_HANDLE_INVALID;
     mx_handle_t mmio_handle = MX_HANDLE_INVALID;
     mx_handle_t cfg_handle = MX_HANDLE_INVALID;
     io_alloc_t* io_alloc = NULL;
@@ -379,31 +504,7 @@ static mx_status_t usb_xhci_bind(mx_driver_t* drv, mx_device_t* dev) {
         goto error_return;
     }
 
-    // select our IRQ mode
-    status = pci_proto->set_irq_mode(dev, MX_PCIE_IRQ_MODE_MSI, 1);
-    if (status < 0) {
-        mx_status_t status_legacy = pci_proto->set_irq_mode(dev, MX_PCIE_IRQ_MODE_LEGACY, 1);
-
-        if (status_legacy < 0) {
-            printf("usb_xhci_bind Failed to set IRQ mode to either MSI "
-                   "(err = %d) or Legacy (err = %d)\n",
-                   status, status_legacy);
-            goto error_return;
-        }
-
-        uxhci->legacy_irq_mode = true;
-    }
-
-    // register for interrupts
-    status = pci_proto->map_interrupt(dev, 0);
-    if (status < 0) {
-        printf("usb_xhci_bind map_interrupt failed %d\n", status);
-        goto error_return;
-    }
-    irq_handle = status;
-
     uxhci->io_alloc = io_alloc;
-    uxhci->irq_handle = irq_handle;
     uxhci->mmio_handle = mmio_handle;
     uxhci->cfg_handle = cfg_handle;
     uxhci->pci_proto = pci_proto;
@@ -413,7 +514,13 @@ static mx_status_t usb_xhci_bind(mx_driver_t* drv, mx_device_t* dev) {
 
     device_init(&uxhci->device, drv, "usb-xhci", &xhci_device_proto);
 
-    status = xhci_init(&uxhci->xhci, mmio);
+    // ask for an interruptor per cpu, xhci_init trims this to what the
+    // controller supports
+    status = xhci_init(&uxhci->xhci, mmio, mx_num_cpus());
+    if (status < 0)
+        goto error_return;
+
+    status = xhci_setup_irqs(uxhci, dev);
     if (status < 0)
         goto error_return;
 
@@ -427,12 +534,17 @@ static mx_status_t usb_xhci_bind(mx_driver_t* drv, mx_device_t* dev) {
     return NO_ERROR;
 
 error_return:
-    if (uxhci)
+    if (uxhci) {
+        for (uint32_t i = 0; i < XHCI_MAX_INTERRUPTORS; i++) {
+            if (uxhci->irq_handles[i] != MX_HANDLE_INVALID)
+                mx_handle_close(uxhci->irq_handles[i]);
+            if (uxhci->irq_ports[i] != MX_HANDLE_INVALID)
+                mx_handle_close(uxhci->irq_ports[i]);
+        }
         free(uxhci);
+    }
     if (io_alloc)
         io_alloc_free(io_alloc);
-    if (irq_handle != MX_HANDLE_INVALID)
-        mx_handle_close(irq_handle);
     if (mmio_handle != MX_HANDLE_INVALID)
         mx_handle_close(mmio_handle);
     if (cfg_handle != MX_HANDLE_INVALID)
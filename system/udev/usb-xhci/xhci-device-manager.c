@@ -294,7 +294,10 @@ static void xhci_stop_endpoint(xhci_t* xhci, uint32_t slot_id, int ep_index) {
     xhci_slot_t* slot = &xhci->slots[slot_id];
     xhci_transfer_ring_t* transfer_ring = &slot->transfer_rings[ep_index];
 
-   // complete pending requests
+    // run callbacks for transfers that completed before the endpoint stopped
+    xhci_flush_completions(xhci, slot_id, transfer_ring);
+
+    // complete pending requests
     xhci_transfer_context_t* context;
     while ((context = list_remove_head_type(&transfer_ring->pending_requests,
                                             xhci_transfer_context_t, node)) != NULL) {
@@ -505,7 +508,8 @@ mx_status_t xhci_enable_endpoint(xhci_t* xhci, uint32_t slot_id, usb_endpoint_de
         xhci_endpoint_context_t* epc = (xhci_endpoint_context_t*)&xhci->input_context[(index + 2) * xhci->context_size];
         memset((void*)epc, 0, xhci->context_size);
         // allocate a transfer ring for the endpoint
-        mx_status_t status = xhci_transfer_ring_init(xhci, &slot->transfer_rings[index], TRANSFER_RING_SIZE);
+        int ring_size = (ep_type == USB_ENDPOINT_BULK ? BULK_TRANSFER_RING_SIZE : TRANSFER_RING_SIZE);
+        mx_status_t status = xhci_transfer_ring_init(xhci, &slot->transfer_rings[index], ring_size);
         if (status < 0)
             return status;
 
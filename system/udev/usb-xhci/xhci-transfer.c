@@ -4,6 +4,7 @@
 
 #include <magenta/hw/usb.h>
 #include <stdio.h>
+#include <sys/param.h>
 #include <threads.h>
 
 #include "xhci-transfer.h"
@@ -60,11 +61,27 @@ static mx_status_t xhci_reset_endpoint(xhci_t* xhci, uint32_t slot_id, uint32_t
     return (cc == TRB_CC_SUCCESS ? NO_ERROR : ERR_INTERNAL);
 }
 
-mx_status_t xhci_queue_transfer(xhci_t* xhci, int slot_id, usb_setup_t* setup, mx_paddr_t data,
-                        uint16_t length, int endpoint, int direction, uint64_t frame,
-                        xhci_transfer_context_t* context, list_node_t* txn_node) {
-    xprintf("xhci_queue_transfer slot_id: %d setup: %p endpoint: %d length: %d\n",
-            slot_id, setup, endpoint, length);
+// a data TRB's buffer may not cross a 64K boundary (xHCI 4.11.7.1)
+#define XHCI_TRB_BOUNDARY (64 * 1024)
+
+static size_t xhci_sg_trbs(const iotxn_sg_t* sg, uint32_t sg_count, size_t length) {
+    size_t count = 0;
+    for (uint32_t i = 0; (i < sg_count) && (length > 0); i++) {
+        size_t len = MIN(sg[i].length, length);
+        mx_paddr_t start = sg[i].paddr;
+        mx_paddr_t end = start + len;
+        count += (end - 1) / XHCI_TRB_BOUNDARY - start / XHCI_TRB_BOUNDARY + 1;
+        length -= len;
+    }
+    return count;
+}
+
+mx_status_t xhci_queue_transfer(xhci_t* xhci, int slot_id, usb_setup_t* setup,
+                                const iotxn_sg_t* sg, uint32_t sg_count, size_t length,
+                                int endpoint, int direction, uint64_t frame,
+                                xhci_transfer_context_t* context, list_node_t* txn_node) {
+    xprintf("xhci_queue_transfer slot_id: %d setup: %p endpoint: %d length: %zu sg_count: %u\n",
+            slot_id, setup, endpoint, length, sg_count);
 
     if ((setup && endpoint != 0) || (!setup && endpoint == 0)) {
         return ERR_INVALID_ARGS;
@@ -84,9 +101,8 @@ mx_status_t xhci_queue_transfer(xhci_t* xhci, int slot_id, usb_setup_t* setup, m
         xhci_reset_endpoint(xhci, slot_id, endpoint);
     }
 
-    uint32_t interruptor_target = 0;
-    size_t max_transfer_size = 1 << (XFER_TRB_XFER_LENGTH_BITS - 1);
-    size_t data_packets = (length ? (length + max_transfer_size - 1) / max_transfer_size : 0);
+    uint32_t interruptor_target = xhci_slot_interruptor(xhci, slot_id);
+    size_t data_packets = (length ? xhci_sg_trbs(sg, sg_count, length) : 0);
     size_t required_trbs = data_packets + 1;   // add 1 for event data TRB
     if (setup) {
         required_trbs += 2;
@@ -101,12 +117,12 @@ mx_status_t xhci_queue_transfer(xhci_t* xhci, int slot_id, usb_setup_t* setup, m
     if (ep_type >= 4) ep_type -= 4;
     bool isochronous = (ep_type == USB_ENDPOINT_ISOCHRONOUS);
     if (isochronous) {
-        if (!data || !length) return ERR_INVALID_ARGS;
+        if (!sg_count || !length) return ERR_INVALID_ARGS;
         // we currently do not support isoch buffers that span page boundaries
         // Section 3.2.11 in the XHCI spec describes how to handle this, but since
         // iotxn buffers are always close to the beginning of a page, this shouldn't be necessary.
-        mx_paddr_t start_page = data & ~(xhci->page_size - 1);
-        mx_paddr_t end_page = (data + length - 1) & ~(xhci->page_size - 1);
+        mx_paddr_t start_page = sg[0].paddr & ~(xhci->page_size - 1);
+        mx_paddr_t end_page = (sg[0].paddr + length - 1) & ~(xhci->page_size - 1);
         if (start_page != end_page) {
             printf("isoch buffer spans page boundary in xhci_queue_transfer\n");
             return ERR_INVALID_ARGS;
@@ -169,16 +185,28 @@ mx_status_t xhci_queue_transfer(xhci_t* xhci, int slot_id, usb_setup_t* setup, m
     // Data Stage
     if (length > 0) {
         size_t remaining = length;
+        uint32_t sg_index = 0;
+        mx_paddr_t phys = sg[0].paddr;
+        size_t sg_remaining = sg[0].length;
 
         for (size_t i = 0; i < data_packets; i++) {
-            size_t transfer_size = (remaining > max_transfer_size ? max_transfer_size : remaining);
-            remaining -= transfer_size;
+            if (sg_remaining == 0) {
+                sg_index++;
+                phys = sg[sg_index].paddr;
+                sg_remaining = sg[sg_index].length;
+            }
+            // run to the end of this sg entry or the next 64K boundary
+            size_t transfer_size = XHCI_TRB_BOUNDARY - (phys & (XHCI_TRB_BOUNDARY - 1));
+            transfer_size = MIN(transfer_size, MIN(sg_remaining, remaining));
 
             xhci_trb_t* trb = ring->current;
             xhci_clear_trb(trb);
-            XHCI_WRITE64(&trb->ptr, data + (i * max_transfer_size));
+            XHCI_WRITE64(&trb->ptr, phys);
             XHCI_SET_BITS32(&trb->status, XFER_TRB_XFER_LENGTH_START, XFER_TRB_XFER_LENGTH_BITS, transfer_size);
-            uint32_t td_size = data_packets - i - 1;
+            phys += transfer_size;
+            sg_remaining -= transfer_size;
+            remaining -= transfer_size;
+            uint32_t td_size = MIN(data_packets - i - 1, (1u << XFER_TRB_TD_SIZE_BITS) - 1);
             XHCI_SET_BITS32(&trb->status, XFER_TRB_TD_SIZE_START, XFER_TRB_TD_SIZE_BITS, td_size);
             XHCI_SET_BITS32(&trb->status, XFER_TRB_INTR_TARGET_START, XFER_TRB_INTR_TARGET_BITS, interruptor_target);
 
@@ -266,7 +294,11 @@ int xhci_control_request(xhci_t* xhci, int slot_id, uint8_t request_type, uint8_
     xhci_sync_transfer_t xfer;
     xhci_sync_transfer_init(&xfer);
 
-    mx_status_t result = xhci_queue_transfer(xhci, slot_id, &setup, data, length, 0,
+    iotxn_sg_t sg = {
+        .paddr = data,
+        .length = length,
+    };
+    mx_status_t result = xhci_queue_transfer(xhci, slot_id, &setup, &sg, 1, length, 0,
                                              request_type & USB_DIR_MASK, 0, &xfer.context, NULL);
     if (result != NO_ERROR)
         return result;
@@ -283,7 +315,11 @@ mx_status_t xhci_get_descriptor(xhci_t* xhci, int slot_id, uint8_t type, uint16_
                                 USB_REQ_GET_DESCRIPTOR, value, index, phys_addr, length);
 }
 
-void xhci_handle_transfer_event(xhci_t* xhci, xhci_trb_t* trb) {
+void xhci_completion_batch_init(xhci_completion_batch_t* batch) {
+    batch->ring_count = 0;
+}
+
+void xhci_handle_transfer_event(xhci_t* xhci, xhci_trb_t* trb, xhci_completion_batch_t* batch) {
     xprintf("xhci_handle_transfer_event: %08X %08X %08X %08X\n",
             ((uint32_t*)trb)[0], ((uint32_t*)trb)[1], ((uint32_t*)trb)[2], ((uint32_t*)trb)[3]);
 
@@ -359,15 +395,119 @@ void xhci_handle_transfer_event(xhci_t* xhci, xhci_trb_t* trb) {
     // update dequeue_ptr to TRB following this transaction
     ring->dequeue_ptr = context->dequeue_ptr;
 
-    // remove context from pending_requests
+    // move context from pending_requests to the ring's completed list
     list_delete(&context->node);
+    context->result = result;
+    list_add_tail(&ring->completed, &context->node);
+    mtx_unlock(&ring->mutex);
+
+    for (size_t i = 0; i < batch->ring_count; i++) {
+        if (batch->rings[i] == ring) {
+            return;
+        }
+    }
+    batch->rings[batch->ring_count++] = ring;
+}
+
+void xhci_complete_transfers(xhci_t* xhci, uint32_t interruptor, xhci_completion_batch_t* batch) {
+    if (batch->ring_count == 0) {
+        return;
+    }
+
+    xhci_completer_t* completer = &xhci->completers[interruptor];
+    mtx_lock(&completer->lock);
+    for (size_t i = 0; i < batch->ring_count; i++) {
+        xhci_transfer_ring_t* ring = batch->rings[i];
+        if (!list_in_list(&ring->ready_node)) {
+            list_add_tail(&completer->ready_rings, &ring->ready_node);
+        }
+    }
+    cnd_signal(&completer->work);
+    mtx_unlock(&completer->lock);
+    xhci_completion_batch_init(batch);
+}
 
+// runs the callbacks for the transfers on the ring's completed list, in order
+static void xhci_run_completions(xhci_t* xhci, xhci_transfer_ring_t* ring, bool closed) {
+    list_node_t completed;
+    list_initialize(&completed);
+
+    mtx_lock(&ring->mutex);
+    list_node_t* node;
+    while ((node = list_remove_head(&ring->completed)) != NULL) {
+        list_add_tail(&completed, node);
+    }
     bool process_deferred_txns = !list_is_empty(&ring->deferred_txns);
     mtx_unlock(&ring->mutex);
 
-    context->callback(result, context->data);
-
-    if (process_deferred_txns) {
+    xhci_transfer_context_t* context;
+    while ((context = list_remove_head_type(&completed, xhci_transfer_context_t, node)) != NULL) {
+        context->callback(context->result, context->data);
+    }
+    // when closed, the caller completes the deferred txns itself
+    if (process_deferred_txns && !closed) {
         xhci_process_deferred_txns(xhci, ring, false);
     }
 }
+
+static int xhci_completer_thread(void* arg) {
+    xhci_completer_t* completer = (xhci_completer_t*)arg;
+
+    mtx_lock(&completer->lock);
+    while (1) {
+        xhci_transfer_ring_t* ring = list_remove_head_type(&completer->ready_rings,
+                                                           xhci_transfer_ring_t, ready_node);
+        if (!ring) {
+            cnd_wait(&completer->work, &completer->lock);
+            continue;
+        }
+        completer->current = ring;
+        mtx_unlock(&completer->lock);
+
+        xhci_run_completions(completer->xhci, ring, false);
+
+        mtx_lock(&completer->lock);
+        completer->current = NULL;
+        cnd_broadcast(&completer->idle);
+    }
+    return 0;
+}
+
+void xhci_completers_init(xhci_t* xhci) {
+    for (uint32_t i = 0; i < XHCI_MAX_INTERRUPTORS; i++) {
+        xhci_completer_t* completer = &xhci->completers[i];
+        completer->xhci = xhci;
+        mtx_init(&completer->lock, mtx_plain);
+        cnd_init(&completer->work);
+        cnd_init(&completer->idle);
+        list_initialize(&completer->ready_rings);
+        completer->current = NULL;
+    }
+}
+
+mx_status_t xhci_start_completers(xhci_t* xhci) {
+    for (uint32_t i = 0; i < xhci->num_interruptors; i++) {
+        xhci_completer_t* completer = &xhci->completers[i];
+        if (thrd_create_with_name(&completer->thread, xhci_completer_thread, completer,
+                                  "xhci_completer") != thrd_success) {
+            return ERR_NO_RESOURCES;
+        }
+        thrd_detach(completer->thread);
+    }
+    return NO_ERROR;
+}
+
+void xhci_flush_completions(xhci_t* xhci, int slot_id, xhci_transfer_ring_t* ring) {
+    xhci_completer_t* completer = &xhci->completers[xhci_slot_interruptor(xhci, slot_id)];
+
+    mtx_lock(&completer->lock);
+    if (list_in_list(&ring->ready_node)) {
+        list_delete(&ring->ready_node);
+    }
+    while (completer->current == ring) {
+        cnd_wait(&completer->idle, &completer->lock);
+    }
+    mtx_unlock(&completer->lock);
+
+    xhci_run_completions(xhci, ring, true);
+}
@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include <ddk/iotxn.h>
 #include <magenta/types.h>
 
 #include "xhci.h"
@@ -15,21 +16,50 @@ typedef void (*xhci_transfer_complete_cb)(mx_status_t result, void* data);
 typedef struct {
     xhci_transfer_complete_cb callback;
     void* data;
+    // result passed to callback, set when the transfer event is handled
+    mx_status_t result;
 
     // transfer ring we are queued on
     xhci_transfer_ring_t* transfer_ring;
     // TRB following this transaction, for updating transfer ring dequeue_ptr
     xhci_trb_t* dequeue_ptr;
-    // for transfer ring's list of pending requests
+    // for transfer ring's list of pending requests, then its completed list
     list_node_t node;
 } xhci_transfer_context_t;
 
-mx_status_t xhci_queue_transfer(xhci_t* xhci, int slot_id, usb_setup_t* setup, mx_paddr_t data,
-                                uint16_t length, int ep, int direction, uint64_t frame,
+// maximum number of transfer events handled before their rings are
+// handed to the completer
+#define XHCI_COMPLETION_BATCH_SIZE (EVENT_RING_SIZE / 2)
+
+// Transfer rings that gained completed transfers during a pass over an
+// event ring. They are handed to the interruptor's completer after the
+// event ring dequeue pointer is updated, so the controller can keep
+// posting events meanwhile and the completer is woken once per batch.
+typedef struct {
+    xhci_transfer_ring_t* rings[XHCI_COMPLETION_BATCH_SIZE];
+    size_t ring_count;
+} xhci_completion_batch_t;
+
+// data is described by sg_count physical runs in sg, of which the first
+// length bytes are transferred
+mx_status_t xhci_queue_transfer(xhci_t* xhci, int slot_id, usb_setup_t* setup,
+                                const iotxn_sg_t* sg, uint32_t sg_count, size_t length,
+                                int ep, int direction, uint64_t frame,
                                 xhci_transfer_context_t* context, list_node_t* txn_node);
 mx_status_t xhci_control_request(xhci_t* xhci, int slot_id, uint8_t request_type, uint8_t request,
                                  uint16_t value, uint16_t index, mx_paddr_t data, uint16_t length);
 void xhci_cancel_transfers(xhci_t* xhci, xhci_transfer_ring_t* ring);
 mx_status_t xhci_get_descriptor(xhci_t* xhci, int slot_id, uint8_t type, uint16_t value,
                                 uint16_t index, void* data, uint16_t length);
-void xhci_handle_transfer_event(xhci_t* xhci, xhci_trb_t* trb);
+void xhci_completion_batch_init(xhci_completion_batch_t* batch);
+// moves the transfer completed by the event to its ring's completed list
+// and adds the ring to the batch
+void xhci_handle_transfer_event(xhci_t* xhci, xhci_trb_t* trb, xhci_completion_batch_t* batch);
+// hands the rings in the batch to the interruptor's completer and leaves it empty
+void xhci_complete_transfers(xhci_t* xhci, uint32_t interruptor, xhci_completion_batch_t* batch);
+void xhci_completers_init(xhci_t* xhci);
+// starts a completer thread for each interruptor in use
+mx_status_t xhci_start_completers(xhci_t* xhci);
+// waits out any callbacks running for the ring, then runs those still
+// queued on it. Called when the ring's endpoint is stopped.
+void xhci_flush_completions(xhci_t* xhci, int slot_id, xhci_transfer_ring_t* ring);
@@ -15,8 +15,12 @@ inline void trb_set_link(xhci_t* xhci, xhci_trb_t* trb, xhci_trb_t* next, bool t
 mx_status_t xhci_transfer_ring_init(xhci_t* xhci, xhci_transfer_ring_t* ring, int count) {
     list_initialize(&ring->pending_requests);
     list_initialize(&ring->deferred_txns);
+    list_initialize(&ring->completed);
 
-    ring->start = xhci_memalign(xhci, 64, count * sizeof(xhci_trb_t));
+    // rings are a power of two in size, aligning them to their size keeps
+    // them from crossing a 64K boundary (xHCI 6.1)
+    size_t size = count * sizeof(xhci_trb_t);
+    ring->start = xhci_memalign(xhci, (size > 64 ? size : 64), size);
     if (!ring->start)
         return ERR_NO_MEMORY;
     ring->current = ring->start;
@@ -71,6 +75,7 @@ mx_status_t xhci_event_ring_init(xhci_t* xhci, int interruptor, int count) {
 void xhci_event_ring_free(xhci_t* xhci, int interruptor) {
     xhci_event_ring_t* ring = &xhci->event_rings[interruptor];
     xhci_free(xhci, (void *)ring->start);
+    xhci_free(xhci, (void *)ring->erst_array);
 }
 
 void xhci_clear_trb(xhci_trb_t* trb) {
@@ -20,6 +20,8 @@ typedef struct xhci_transfer_ring {
     mtx_t mutex;
     list_node_t pending_requests;   // pending transfers that should be completed when ring is dead
     list_node_t deferred_txns;      // used by upper layer to defer iotxns when ring is full
+    list_node_t completed;          // completed transfers whose callbacks have not run yet
+    list_node_t ready_node;         // for the completer's list of rings with completed transfers
 } xhci_transfer_ring_t;
 
 typedef struct xhci_event_ring {
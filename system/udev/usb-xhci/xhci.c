@@ -105,10 +105,12 @@ static void xhci_read_extended_caps(xhci_t* xhci, void* mmio, volatile uint32_t*
     }
 }
 
-mx_status_t xhci_init(xhci_t* xhci, void* mmio) {
+mx_status_t xhci_init(xhci_t* xhci, void* mmio, uint32_t num_interruptors) {
     mx_status_t result = NO_ERROR;
+    uint32_t event_rings = 0;
 
     list_initialize(&xhci->command_queue);
+    xhci_completers_init(xhci);
 
     xhci->cap_regs = (xhci_cap_regs_t*)mmio;
     xhci->op_regs = (xhci_op_regs_t*)((uint8_t*)xhci->cap_regs + xhci->cap_regs->length);
@@ -128,6 +130,16 @@ mx_status_t xhci_init(xhci_t* xhci, void* mmio) {
     xhci->context_size = (XHCI_READ32(hccparams1) & HCCPARAMS1_CSZ ? 64 : 32);
     xhci->large_esit = !!(XHCI_READ32(hccparams2) & HCCPARAMS2_LEC);
 
+    if (num_interruptors > xhci->max_interruptors) {
+        num_interruptors = xhci->max_interruptors;
+    }
+    if (num_interruptors > XHCI_MAX_INTERRUPTORS) {
+        num_interruptors = XHCI_MAX_INTERRUPTORS;
+    }
+    if (num_interruptors == 0) {
+        num_interruptors = 1;
+    }
+
     uint32_t scratch_pad_bufs = XHCI_GET_BITS32(hcsparams2, HCSPARAMS2_MAX_SBBUF_HI_START,
                                                 HCSPARAMS2_MAX_SBBUF_HI_BITS);
 
@@ -175,11 +187,14 @@ mx_status_t xhci_init(xhci_t* xhci, void* mmio) {
         printf("xhci_command_ring_init failed\n");
         goto fail;
     }
-    result = xhci_event_ring_init(xhci, 0, EVENT_RING_SIZE);
-    if (result != NO_ERROR) {
-        printf("xhci_event_ring_init failed\n");
-        goto fail;
+    for (; event_rings < num_interruptors; event_rings++) {
+        result = xhci_event_ring_init(xhci, event_rings, EVENT_RING_SIZE);
+        if (result != NO_ERROR) {
+            printf("xhci_event_ring_init failed\n");
+            goto fail;
+        }
     }
+    xhci->num_interruptors = num_interruptors;
 
     xhci->rh_map = (uint8_t *)calloc(xhci->rh_num_ports, sizeof(uint8_t));
     if (!xhci->rh_map) {
@@ -207,7 +222,9 @@ fail:
     }
     free(xhci->rh_map);
     free(xhci->rh_port_map);
-    xhci_event_ring_free(xhci, 0);
+    for (uint32_t i = 0; i < event_rings; i++) {
+        xhci_event_ring_free(xhci, i);
+    }
     xhci_transfer_ring_free(xhci, &xhci->command_ring);
     if (xhci->scratch_pad) {
         for (size_t i = 0; i < scratch_pad_bufs; i++) {
@@ -222,6 +239,12 @@ fail:
     return result;
 }
 
+void xhci_trim_interruptors(xhci_t* xhci, uint32_t count) {
+    while (xhci->num_interruptors > count) {
+        xhci_event_ring_free(xhci, --xhci->num_interruptors);
+    }
+}
+
 static void xhci_update_erdp(xhci_t* xhci, int interruptor) {
     xhci_event_ring_t* er = &xhci->event_rings[interruptor];
     xhci_intr_regs_t* intr_regs = &xhci->runtime_regs->intr_regs[interruptor];
@@ -250,7 +273,7 @@ static void xhci_wait_bits(volatile uint32_t* ptr, uint32_t bits, uint32_t expec
     }
 }
 
-void xhci_start(xhci_t* xhci) {
+mx_status_t xhci_start(xhci_t* xhci) {
     volatile uint32_t* usbcmd = &xhci->op_regs->usbcmd;
     volatile uint32_t* usbsts = &xhci->op_regs->usbsts;
 
@@ -276,8 +299,16 @@ void xhci_start(xhci_t* xhci) {
     XHCI_SET_BITS32(&op_regs->config, CONFIG_MAX_SLOTS_ENABLED_START,
                     CONFIG_MAX_SLOTS_ENABLED_BITS, xhci->max_slots);
 
-    // initialize interruptor (only using one for now)
-    xhci_interruptor_init(xhci, 0);
+    // initialize interruptors
+    for (uint32_t i = 0; i < xhci->num_interruptors; i++) {
+        xhci_interruptor_init(xhci, i);
+    }
+
+    mx_status_t status = xhci_start_completers(xhci);
+    if (status != NO_ERROR) {
+        printf("xhci_start: failed to start completer threads\n");
+        return status;
+    }
 
     // start the controller with interrupts and mfindex wrap events enabled
     uint32_t start_flags = USBCMD_RS | USBCMD_INTE | USBCMD_EWE;
@@ -285,6 +316,7 @@ void xhci_start(xhci_t* xhci) {
     xhci_wait_bits(usbsts, USBSTS_HCH, 0);
 
     xhci_start_device_thread(xhci);
+    return NO_ERROR;
 }
 
 void xhci_post_command(xhci_t* xhci, uint32_t command, uint64_t ptr, uint32_t control_bits,
@@ -351,6 +383,10 @@ uint64_t xhci_get_current_frame(xhci_t* xhci) {
 
 static void xhci_handle_events(xhci_t* xhci, int interruptor) {
     xhci_event_ring_t* er = &xhci->event_rings[interruptor];
+    xhci_completion_batch_t batch;
+    xhci_completion_batch_init(&batch);
+    // events consumed since ERDP was last written
+    uint32_t consumed = 0;
 
     // process all TRBs with cycle bit matching our CCS
     while ((XHCI_READ32(&er->current->control) & TRB_C) == er->ccs) {
@@ -363,7 +399,7 @@ static void xhci_handle_events(xhci_t* xhci, int interruptor) {
             // ignore, these are dealt with in xhci_handle_interrupt() below
             break;
         case TRB_EVENT_TRANSFER:
-            xhci_handle_transfer_event(xhci, er->current);
+            xhci_handle_transfer_event(xhci, er->current, &batch);
             break;
         case TRB_EVENT_MFINDEX_WRAP:
             xhci_handle_mfindex_wrap(xhci);
@@ -378,13 +414,31 @@ static void xhci_handle_events(xhci_t* xhci, int interruptor) {
             er->current = er->start;
             er->ccs ^= TRB_C;
         }
+
+        // hand the consumed TRBs back to the controller and the completed
+        // transfers to the completer every half ring, rather than after every event
+        if (++consumed == XHCI_COMPLETION_BATCH_SIZE) {
+            xhci_update_erdp(xhci, interruptor);
+            consumed = 0;
+            xhci_complete_transfers(xhci, interruptor, &batch);
+        }
+    }
+
+    if (consumed) {
         xhci_update_erdp(xhci, interruptor);
     }
+    xhci_complete_transfers(xhci, interruptor, &batch);
 }
 
-void xhci_handle_interrupt(xhci_t* xhci, bool legacy) {
+void xhci_handle_interrupt(xhci_t* xhci, bool legacy, uint32_t interruptor) {
     volatile uint32_t* usbsts = &xhci->op_regs->usbsts;
-    const int interruptor = 0;
+
+    // Only interruptor 0 looks at USBSTS, the others just have transfer
+    // events to process. Legacy mode only ever uses interruptor 0.
+    if (interruptor != 0) {
+        xhci_handle_events(xhci, interruptor);
+        return;
+    }
 
     uint32_t status = XHCI_READ32(usbsts);
     uint32_t clear = status & USBSTS_CLEAR_BITS;
@@ -19,8 +19,14 @@
 #define COMMAND_RING_SIZE 8
 #define EVENT_RING_SIZE 64
 #define TRANSFER_RING_SIZE 64
+// bulk endpoints get a larger ring so a single transfer can span a few
+// megabytes of contiguous memory or about a megabyte of scattered pages
+#define BULK_TRANSFER_RING_SIZE 256
 #define ERST_ARRAY_SIZE 1
 
+// maximum number of interruptors we use, each with its own event ring and irq
+#define XHCI_MAX_INTERRUPTORS 8
+
 #define XHCI_RH_USB_2 0 // index of USB 2.0 virtual root hub device
 #define XHCI_RH_USB_3 1 // index of USB 2.0 virtual root hub device
 #define XHCI_RH_COUNT 2 // number of virtual root hub devices
@@ -47,6 +53,19 @@ typedef struct {
     void* data;
 } xhci_command_context_t;
 
+// Runs transfer callbacks off the irq thread, one per interruptor.
+// A transfer ring with completed transfers is on ready_rings at most once
+// and only one thread runs its callbacks, so they run in completion order.
+typedef struct {
+    xhci_t* xhci;
+    thrd_t thread;
+    mtx_t lock;
+    cnd_t work;                 // signalled when a ring is added to ready_rings
+    cnd_t idle;                 // signalled when current is cleared
+    list_node_t ready_rings;    // xhci_transfer_ring_t, by ready_node
+    xhci_transfer_ring_t* current;  // ring whose callbacks are running
+} xhci_completer_t;
+
 struct xhci {
     // MMIO data structures
     xhci_cap_regs_t* cap_regs;
@@ -61,12 +80,18 @@ struct xhci {
     xhci_transfer_ring_t command_ring;
     xhci_command_context_t* command_contexts[COMMAND_RING_SIZE];
 
-    // One event ring for now, but we will have multiple if we use multiple interruptors
-    xhci_event_ring_t event_rings[1];
+    // one event ring per interruptor in use
+    xhci_event_ring_t event_rings[XHCI_MAX_INTERRUPTORS];
+    // and a completer to run the callbacks for its transfer events
+    xhci_completer_t completers[XHCI_MAX_INTERRUPTORS];
 
     size_t page_size;
     size_t max_slots;
     size_t max_interruptors;
+    // number of interruptors in use. Command completion and port status
+    // events always go to interruptor 0, transfer events are spread
+    // across all of them by slot.
+    uint32_t num_interruptors;
     size_t context_size;
     // true if controller supports large ESIT payloads
     bool large_esit;
@@ -105,9 +130,19 @@ struct xhci {
     mx_time_t last_mfindex_wrap;
 };
 
-mx_status_t xhci_init(xhci_t* xhci, void* mmio);
-void xhci_start(xhci_t* xhci);
-void xhci_handle_interrupt(xhci_t* xhci, bool legacy);
+// num_interruptors is the number of interruptors we would like to use.
+// xhci->num_interruptors is set to the number actually available.
+mx_status_t xhci_init(xhci_t* xhci, void* mmio, uint32_t num_interruptors);
+// drops interruptors beyond count, before xhci_start
+void xhci_trim_interruptors(xhci_t* xhci, uint32_t count);
+// the controller is left stopped if this fails
+mx_status_t xhci_start(xhci_t* xhci);
+void xhci_handle_interrupt(xhci_t* xhci, bool legacy, uint32_t interruptor);
+
+// returns the interruptor that transfer events for a slot are delivered to
+static inline uint32_t xhci_slot_interruptor(xhci_t* xhci, int slot_id) {
+    return slot_id % xhci->num_interruptors;
+}
 void xhci_post_command(xhci_t* xhci, uint32_t command, uint64_t ptr, uint32_t control_bits,
                        xhci_command_context_t* context);
 
@@ -0,0 +1,200 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <threads.h>
+
+#include <block-client/client.h>
+#include <magenta/syscalls.h>
+#include <mxio/io.h>
+
+// Each block_client_transact() call owns one group for its duration.
+// The group index is the txnid of all of its requests.
+#define MAX_GROUPS 64
+
+typedef struct group {
+    bool busy;
+    uint32_t outstanding;
+    mx_status_t status;
+} group_t;
+
+// There is no thread dedicated to reading responses.  Whichever
+// waiter finds nobody reading the pipe takes that role, and hands
+// the completions it reads to their groups.
+struct block_client {
+    mx_handle_t h;
+    mtx_t lock;
+    cnd_t cond;
+    bool reading;
+    group_t groups[MAX_GROUPS];
+};
+
+static mx_status_t read_responses(mx_handle_t h, block_fifo_response_t* rsp, uint32_t* count) {
+    mx_signals_state_t pending;
+    mx_status_t r;
+    if ((r = mx_handle_wait_one(h, MX_SIGNAL_READABLE | MX_SIGNAL_PEER_CLOSED,
+                                MX_TIME_INFINITE, &pending)) < 0) {
+        return r;
+    }
+    if (!(pending.satisfied & MX_SIGNAL_READABLE)) {
+        return ERR_REMOTE_CLOSED;
+    }
+    uint32_t sz = sizeof(block_fifo_response_t) * BLOCK_FIFO_MAX_BATCH;
+    if ((r = mx_msgpipe_read(h, rsp, &sz, NULL, NULL, 0)) < 0) {
+        return r;
+    }
+    *count = sz / sizeof(block_fifo_response_t);
+    return NO_ERROR;
+}
+
+mx_status_t block_client_create(int fd, mx_handle_t vmo, block_client_t** out) {
+    block_client_t* client;
+    if ((client = calloc(1, sizeof(block_client_t))) == NULL) {
+        return ERR_NO_MEMORY;
+    }
+    mtx_init(&client->lock, mtx_plain);
+    cnd_init(&client->cond);
+
+    mx_status_t r;
+    r = mxio_ioctl(fd, IOCTL_BLOCK_GET_FIFO, NULL, 0, &client->h, sizeof(client->h));
+    if (r < 0) {
+        goto fail;
+    }
+
+    mx_handle_t dup;
+    if ((dup = mx_handle_duplicate(vmo, MX_RIGHT_SAME_RIGHTS)) < 0) {
+        r = dup;
+        goto fail;
+    }
+    block_fifo_request_t req = {
+        .opcode = BLOCK_FIFO_OP_ATTACH_VMO,
+    };
+    if ((r = mx_msgpipe_write(client->h, &req, sizeof(req), &dup, 1, 0)) < 0) {
+        mx_handle_close(dup);
+        goto fail;
+    }
+
+    block_fifo_response_t rsp[BLOCK_FIFO_MAX_BATCH];
+    uint32_t count;
+    if ((r = read_responses(client->h, rsp, &count)) < 0) {
+        goto fail;
+    }
+    if (count != 1) {
+        r = ERR_IO;
+        goto fail;
+    }
+    if ((r = rsp[0].status) < 0) {
+        goto fail;
+    }
+
+    *out = client;
+    return NO_ERROR;
+
+fail:
+    if (client->h > 0) {
+        mx_handle_close(client->h);
+    }
+    free(client);
+    return r;
+}
+
+mx_status_t block_client_transact(block_client_t* client,
+                                  block_fifo_request_t* reqs, size_t count) {
+    if (count == 0) {
+        return NO_ERROR;
+    }
+
+    mtx_lock(&client->lock);
+    uint32_t txnid;
+    for (;;) {
+        for (txnid = 0; txnid < MAX_GROUPS; txnid++) {
+            if (!client->groups[txnid].busy) {
+                break;
+            }
+        }
+        if (txnid < MAX_GROUPS) {
+            break;
+        }
+        cnd_wait(&client->cond, &client->lock);
+    }
+    group_t* g = client->groups + txnid;
+    g->busy = true;
+    g->outstanding = count;
+    g->status = NO_ERROR;
+    mtx_unlock(&client->lock);
+
+    for (size_t n = 0; n < count; n++) {
+        reqs[n].txnid = txnid;
+    }
+
+    size_t sent = 0;
+    while (sent < count) {
+        size_t batch = count - sent;
+        if (batch > BLOCK_FIFO_MAX_BATCH) {
+            batch = BLOCK_FIFO_MAX_BATCH;
+        }
+        mx_status_t r = mx_msgpipe_write(client->h, reqs + sent,
+                                         batch * sizeof(block_fifo_request_t), NULL, 0, 0);
+        if (r < 0) {
+            // nothing will ever come back for what wasn't sent
+            mtx_lock(&client->lock);
+            g->outstanding -= (count - sent);
+            g->status = r;
+            mtx_unlock(&client->lock);
+            break;
+        }
+        sent += batch;
+    }
+
+    block_fifo_response_t rsp[BLOCK_FIFO_MAX_BATCH];
+    mtx_lock(&client->lock);
+    while (g->outstanding > 0) {
+        if (client->reading) {
+            cnd_wait(&client->cond, &client->lock);
+            continue;
+        }
+        client->reading = true;
+        mtx_unlock(&client->lock);
+
+        uint32_t n = 0;
+        mx_status_t r = read_responses(client->h, rsp, &n);
+
+        mtx_lock(&client->lock);
+        client->reading = false;
+        if (r < 0) {
+            // the fifo is gone: fail everyone still waiting on it
+            for (uint32_t i = 0; i < MAX_GROUPS; i++) {
+                if (client->groups[i].busy && client->groups[i].outstanding) {
+                    client->groups[i].outstanding = 0;
+                    client->groups[i].status = r;
+                }
+            }
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            if (rsp[i].txnid >= MAX_GROUPS) {
+                continue;
+            }
+            group_t* rg = client->groups + rsp[i].txnid;
+            if (!rg->busy || (rg->outstanding == 0)) {
+                continue;
+            }
+            if ((rsp[i].status < 0) && (rg->status == NO_ERROR)) {
+                rg->status = rsp[i].status;
+            }
+            rg->outstanding--;
+        }
+        cnd_broadcast(&client->cond);
+    }
+    mx_status_t status = g->status;
+    g->busy = false;
+    cnd_broadcast(&client->cond);
+    mtx_unlock(&client->lock);
+    return status;
+}
+
+void block_client_destroy(block_client_t* client) {
+    mx_handle_close(client->h);
+    free(client);
+}
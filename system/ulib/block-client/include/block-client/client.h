@@ -0,0 +1,32 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stddef.h>
+
+#include <magenta/compiler.h>
+#include <magenta/device/block.h>
+#include <magenta/types.h>
+
+__BEGIN_CDECLS
+
+// Client side of the block fifo protocol (see magenta/device/block.h)
+
+typedef struct block_client block_client_t;
+
+// Obtain the block fifo of the block device open on fd and attach
+// vmo to it.  The caller keeps its own vmo handle.
+mx_status_t block_client_create(int fd, mx_handle_t vmo, block_client_t** out);
+
+// Submit count requests and wait for all of them to complete.
+// The txnid of each request is assigned here.  Multiple threads may
+// call this at once, and all of their requests are in flight together.
+// Returns NO_ERROR or the status of a failed request.
+mx_status_t block_client_transact(block_client_t* client,
+                                  block_fifo_request_t* reqs, size_t count);
+
+void block_client_destroy(block_client_t* client);
+
+__END_CDECLS
@@ -94,11 +94,25 @@ struct iotxn {
 #define iotxn_to(txn, type) ((type*) (txn)->extra)
 #define iotxn_pdata(txn, type) ((type*) (txn)->protocol_data)
 
+// A physically contiguous run of an iotxn's data.
+typedef struct iotxn_sg {
+    mx_paddr_t paddr;
+    uint64_t length;
+} iotxn_sg_t;
+
 
 // create a new iotxn with payload space of data_size
 // and extra storage space of extra_size
 mx_status_t iotxn_alloc(iotxn_t** out, uint32_t flags, size_t data_size, size_t extra_size);
 
+// create a new iotxn whose payload is the range [vmo_offset, vmo_offset + length)
+// of vmo, with extra storage space of extra_size
+// The pages are committed and pinned for the life of the iotxn and data is
+// never copied: devices reach it through physmap_sg().  The iotxn holds its
+// own reference to the vmo.
+mx_status_t iotxn_alloc_vmo(iotxn_t** out, uint32_t flags, mx_handle_t vmo,
+                            uint64_t vmo_offset, uint64_t length, size_t extra_size);
+
 // queue an iotxn against a device
 void iotxn_queue(mx_device_t* dev, iotxn_t* txn);
 
@@ -129,7 +143,16 @@ struct iotxn_ops {
     // the iotxn's buffer data (on WRITE ops) or a buffer that will be
     // copied back to the iotxn's buffer data (on READ ops).  This may
     // be the buffer itself, or a temporary, depending on conditions.
-    void (*physmap)(iotxn_t* txn, mx_paddr_t* addr);
+    // Fails with ERR_NOT_SUPPORTED unless the iotxn is physically
+    // contiguous (one physmap_sg() entry), as every iotxn from
+    // iotxn_alloc() is.
+    mx_status_t (*physmap)(iotxn_t* txn, mx_paddr_t* addr);
+
+    // physmap_sg() returns the list of physically contiguous runs that
+    // make up the iotxn's data, in order.  The list belongs to the iotxn
+    // and is valid until it is released.  It may cover more than length
+    // bytes if a processor has shortened the iotxn.
+    void (*physmap_sg)(iotxn_t* txn, iotxn_sg_t** sg, uint32_t* count);
 
     // mmap() returns a void* pointing at the data in the iotxn's buffer.
     // This may have to do an expensive memory map operation or copy data
@@ -143,6 +166,12 @@ struct iotxn_ops {
     // request of a driver it is stacked on top of.
     mx_status_t (*clone)(iotxn_t* txn, iotxn_t** out, size_t extra_size);
 
+    // clone_partial() is clone() for the range [offset, offset + length)
+    // of this iotxn's data, so a driver can split a request its device
+    // cannot take in one piece.  The clone's length is set to length.
+    mx_status_t (*clone_partial)(iotxn_t* txn, uint64_t offset, uint64_t length,
+                                 iotxn_t** out, size_t extra_size);
+
 
     // free the iotxn -- should be called only by the entity that allocated it
     void (*release)(iotxn_t* txn);
@@ -29,6 +29,22 @@ typedef struct mx_display_protocol {
 
     void (*flush)(mx_device_t* dev);
     // flushes the framebuffer
+
+    // The remaining ops are optional and may be NULL.
+
+    void (*flush_region)(mx_device_t* dev, uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+    // flushes a rectangle of the framebuffer, in pixels
+
+    mx_status_t (*get_buffers)(mx_device_t* dev, void** buffers, uint32_t* count);
+    // gets pointers to the framebuffers flip() can switch between.  On
+    // entry *count is the size of buffers, on return it is the number
+    // of framebuffers.  Buffer 0 is the one get_framebuffer() returns.
+
+    mx_status_t (*flip)(mx_device_t* dev, uint32_t buffer, mx_handle_t event);
+    // scans out buffer from the next vblank on, and signals event (if it
+    // is not MX_HANDLE_INVALID) once it is being scanned out.  Only one
+    // flip may be pending at a time, ERR_SHOULD_WAIT is returned for
+    // another.  The event must stay open until it is signaled.
 } mx_display_protocol_t;
 
 __END_CDECLS;
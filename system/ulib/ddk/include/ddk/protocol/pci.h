@@ -34,6 +34,9 @@ typedef struct pci_protocol {
     mx_status_t (*set_irq_mode)(mx_device_t* dev,
                                 mx_pci_irq_mode_t mode,
                                 uint32_t requested_irq_count);
+    mx_status_t (*set_irq_affinity)(mx_device_t* dev,
+                                    uint32_t which_irq,
+                                    uint32_t cpu_num);
 } pci_protocol_t;
 
 __END_CDECLS;
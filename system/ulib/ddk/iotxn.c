@@ -6,6 +6,7 @@
 #include <ddk/device.h>
 #include <magenta/syscalls.h>
 #include <sys/param.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -22,6 +23,12 @@
 #endif
 
 #define IOTXN_FLAG_CLONE (1 << 0)
+#define IOTXN_FLAG_VMO (1 << 1)    // data is a range of a pinned vmo
+#define IOTXN_FLAG_MAPPED (1 << 2) // this iotxn mapped the vmo range at data
+#define IOTXN_FLAG_SG_OWNED (1 << 3) // a partial clone's own copy of the sg list
+
+#define PAGE_ROUNDDOWN(x) ((x) & ~((uint64_t)PAGE_SIZE - 1))
+#define PAGE_ROUNDUP(x) PAGE_ROUNDDOWN((x) + PAGE_SIZE - 1)
 
 typedef struct iotxn_priv iotxn_priv_t;
 
@@ -33,8 +40,15 @@ struct iotxn_priv {
     mx_size_t vmo_offset;
     mx_handle_t vmo;
 
+    // physical runs making up the data payload
+    iotxn_sg_t* sg;
+    uint32_t sg_count;
+
     uint32_t flags;
 
+    // free list the buffer goes back to on release
+    uint32_t size_class;
+
     // extra data, at the end of this ioxtn_t structure
     mx_size_t extra_size;
 
@@ -44,18 +58,52 @@ struct iotxn_priv {
     mx_size_t buffer_size;
     mx_paddr_t buffer_phys;
 
-    // 64-bytes at this point on 64-bit systems
+    // sg list of a buffer allocated by iotxn_alloc()
+    iotxn_sg_t sg_inline;
 
     iotxn_t txn; // must be at the end for extra data, only valid if not a clone
 };
 
 #define get_priv(iotxn) containerof(iotxn, iotxn_priv_t, txn)
 
-static list_node_t free_list = LIST_INITIAL_VALUE(free_list);
+// Buffers from iotxn_alloc() are rounded up to a power of two size
+// class, from one page to IOTXN_NUM_CLASSES pages doubling, and go back
+// on their class's free list when released, so allocation is a pop from
+// one short-held per-class lock rather than a search of every buffer.
+// Anything larger is sized exactly and found first-fit.
+#define IOTXN_MIN_CLASS_SHIFT 12
+#define IOTXN_NUM_CLASSES 6
+#define IOTXN_CLASS_LARGE IOTXN_NUM_CLASSES
+
+typedef struct iotxn_pool {
+    mtx_t lock;
+    list_node_t free_list;
+} iotxn_pool_t;
+
+#define IOTXN_POOL_INIT(n) { MTX_INIT, LIST_INITIAL_VALUE(pools[n].free_list) }
+
+static iotxn_pool_t pools[IOTXN_NUM_CLASSES + 1] = {
+    IOTXN_POOL_INIT(0),
+    IOTXN_POOL_INIT(1),
+    IOTXN_POOL_INIT(2),
+    IOTXN_POOL_INIT(3),
+    IOTXN_POOL_INIT(4),
+    IOTXN_POOL_INIT(5),
+    IOTXN_POOL_INIT(IOTXN_CLASS_LARGE),
+};
+
 static list_node_t clone_list = LIST_INITIAL_VALUE(clone_list); // free list for clones
-static mtx_t free_list_mutex = MTX_INIT;
 static mtx_t clone_list_mutex = MTX_INIT;
 
+static uint32_t size_class(size_t sz) {
+    for (uint32_t n = 0; n < IOTXN_NUM_CLASSES; n++) {
+        if (sz <= (1u << (IOTXN_MIN_CLASS_SHIFT + n))) {
+            return n;
+        }
+    }
+    return IOTXN_CLASS_LARGE;
+}
+
 static void iotxn_complete(iotxn_t* txn, mx_status_t status, mx_off_t actual) {
     txn->actual = actual;
     txn->status = status;
@@ -66,23 +114,61 @@ static void iotxn_complete(iotxn_t* txn, mx_status_t status, mx_off_t actual) {
 
 static void iotxn_copyfrom(iotxn_t* txn, void* data, size_t length, size_t offset) {
     iotxn_priv_t* priv = get_priv(txn);
+    if (offset >= priv->data_size) {
+        return;
+    }
     size_t count = MIN(length, priv->data_size - offset);
-    memcpy(data, priv->data + offset, count);
+    if (priv->flags & IOTXN_FLAG_VMO) {
+        mx_vmo_read(priv->vmo, data, priv->vmo_offset + offset, count);
+    } else {
+        memcpy(data, priv->data + offset, count);
+    }
 }
 
 static void iotxn_copyto(iotxn_t* txn, const void* data, size_t length, size_t offset) {
     iotxn_priv_t* priv = get_priv(txn);
+    if (offset >= priv->data_size) {
+        return;
+    }
     size_t count = MIN(length, priv->data_size - offset);
-    memcpy(priv->data + offset, data, count);
+    if (priv->flags & IOTXN_FLAG_VMO) {
+        mx_vmo_write(priv->vmo, data, priv->vmo_offset + offset, count);
+    } else {
+        memcpy(priv->data + offset, data, count);
+    }
 }
 
-static void iotxn_physmap(iotxn_t* txn, mx_paddr_t* addr) {
+static mx_status_t iotxn_physmap(iotxn_t* txn, mx_paddr_t* addr) {
     iotxn_priv_t* priv = get_priv(txn);
+    if (priv->sg_count > 1) {
+        xprintf("iotxn_physmap: txn=%p is not contiguous (%u runs)\n", txn, priv->sg_count);
+        return ERR_NOT_SUPPORTED;
+    }
     *addr = priv->data_phys;
+    return NO_ERROR;
+}
+
+static void iotxn_physmap_sg(iotxn_t* txn, iotxn_sg_t** sg, uint32_t* count) {
+    iotxn_priv_t* priv = get_priv(txn);
+    *sg = priv->sg;
+    *count = priv->sg_count;
 }
 
 static void iotxn_mmap(iotxn_t* txn, void** data) {
     iotxn_priv_t* priv = get_priv(txn);
+    if ((priv->flags & IOTXN_FLAG_VMO) && (priv->data == NULL)) {
+        uint64_t start = PAGE_ROUNDDOWN(priv->vmo_offset);
+        uint64_t end = PAGE_ROUNDUP(priv->vmo_offset + priv->data_size);
+        uintptr_t base = 0;
+        mx_status_t status = mx_process_map_vm(mx_process_self(), priv->vmo, start, end - start,
+                                               &base, MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE);
+        if (status < 0) {
+            xprintf("iotxn_mmap: txn=%p cannot map vmo (%d)\n", txn, status);
+        } else {
+            priv->data = (void*)base + (priv->vmo_offset - start);
+            priv->flags |= IOTXN_FLAG_MAPPED;
+        }
+    }
     *data = priv->data;
 }
 
@@ -104,7 +190,7 @@ static mx_status_t iotxn_clone(iotxn_t* txn, iotxn_t** out, size_t extra_size) {
     // found one that fits, skip allocation
     if (found) {
         list_delete(&clone->node);
-        if (cpriv->buffer_size) memset(cpriv + sizeof(iotxn_priv_t), 0, cpriv->buffer_size);
+        if (cpriv->buffer_size) memset(cpriv->txn.extra, 0, cpriv->buffer_size);
         mtx_unlock(&clone_list_mutex);
         goto out;
     }
@@ -122,30 +208,94 @@ static mx_status_t iotxn_clone(iotxn_t* txn, iotxn_t** out, size_t extra_size) {
     // copy properties to the new iotxn
     cpriv->buffer_size = extra_size;
 out:
-    cpriv->flags |= IOTXN_FLAG_CLONE;
+    // a clone never owns the vmo or its mapping
+    cpriv->flags = IOTXN_FLAG_CLONE | (priv->flags & IOTXN_FLAG_VMO);
     // copy data payload metadata to the clone so the api can just work
     cpriv->data_size = priv->data_size;
     cpriv->data = priv->data;
     cpriv->data_phys = priv->data_phys;
     cpriv->vmo_offset = priv->vmo_offset;
     cpriv->vmo = priv->vmo;
+    cpriv->sg = priv->sg;
+    cpriv->sg_count = priv->sg_count;
     memcpy(&cpriv->txn, txn, sizeof(iotxn_t));
     cpriv->txn.complete_cb = NULL; // clear the complete cb
     *out = &cpriv->txn;
     return NO_ERROR;
 }
 
+static mx_status_t iotxn_clone_partial(iotxn_t* txn, uint64_t offset, uint64_t length,
+                                       iotxn_t** out, size_t extra_size) {
+    iotxn_priv_t* priv = get_priv(txn);
+    if ((offset > priv->data_size) || (length > priv->data_size - offset) || (length == 0)) {
+        return ERR_INVALID_ARGS;
+    }
+
+    // skip the runs before offset, then take the ones covering length
+    uint32_t first = 0;
+    uint64_t skip = offset;
+    while (skip >= priv->sg[first].length) {
+        skip -= priv->sg[first].length;
+        first++;
+    }
+    uint32_t count = 0;
+    uint64_t covered = 0;
+    while (covered < skip + length) {
+        covered += priv->sg[first + count].length;
+        count++;
+    }
+    iotxn_sg_t* sg = malloc(count * sizeof(iotxn_sg_t));
+    if (sg == NULL) {
+        return ERR_NO_MEMORY;
+    }
+    memcpy(sg, priv->sg + first, count * sizeof(iotxn_sg_t));
+    sg[0].paddr += skip;
+    sg[0].length -= skip;
+
+    mx_status_t status = iotxn_clone(txn, out, extra_size);
+    if (status != NO_ERROR) {
+        free(sg);
+        return status;
+    }
+    iotxn_priv_t* cpriv = get_priv(*out);
+    cpriv->flags |= IOTXN_FLAG_SG_OWNED;
+    cpriv->data_size = length;
+    if (cpriv->data) {
+        cpriv->data += offset;
+    }
+    cpriv->data_phys = sg[0].paddr;
+    cpriv->vmo_offset += offset;
+    cpriv->sg = sg;
+    cpriv->sg_count = count;
+    cpriv->txn.length = length;
+    return NO_ERROR;
+}
+
 static void iotxn_release(iotxn_t* txn) {
     xprintf("iotxn_release: txn=%p\n", txn);
     iotxn_priv_t* priv = get_priv(txn);
+    if (priv->flags & IOTXN_FLAG_MAPPED) {
+        mx_process_unmap_vm(mx_process_self(), PAGE_ROUNDDOWN((uintptr_t)priv->data), 0);
+        priv->data = NULL;
+        priv->flags &= ~IOTXN_FLAG_MAPPED;
+    }
+    if (priv->flags & IOTXN_FLAG_SG_OWNED) {
+        free(priv->sg);
+        priv->sg = NULL;
+    }
     if (priv->flags & IOTXN_FLAG_CLONE) {
         mtx_lock(&clone_list_mutex);
         list_add_tail(&clone_list, &txn->node);
         mtx_unlock(&clone_list_mutex);
+    } else if (priv->flags & IOTXN_FLAG_VMO) {
+        mx_vmo_op_range(priv->vmo, MX_VMO_OP_UNLOCK, priv->vmo_offset, priv->data_size, NULL, 0);
+        mx_handle_close(priv->vmo);
+        free(priv);
     } else {
-        mtx_lock(&free_list_mutex);
-        list_add_tail(&free_list, &txn->node);
-        mtx_unlock(&free_list_mutex);
+        iotxn_pool_t* pool = pools + priv->size_class;
+        mtx_lock(&pool->lock);
+        list_add_head(&pool->free_list, &txn->node);
+        mtx_unlock(&pool->lock);
     }
 }
 
@@ -154,8 +304,10 @@ static iotxn_ops_t ops = {
     .copyfrom = iotxn_copyfrom,
     .copyto = iotxn_copyto,
     .physmap = iotxn_physmap,
+    .physmap_sg = iotxn_physmap_sg,
     .mmap = iotxn_mmap,
     .clone = iotxn_clone,
+    .clone_partial = iotxn_clone_partial,
     .release = iotxn_release,
 };
 
@@ -163,28 +315,38 @@ mx_status_t iotxn_alloc(iotxn_t** out, uint32_t flags, size_t data_size, size_t
     xprintf("iotxn_alloc: flags=0x%x data_size=0x%zx extra_size=0x%zx\n", flags, data_size, extra_size);
     iotxn_t* txn = NULL;
     iotxn_priv_t* priv = NULL;
-    // look in free list first for something that fits
-    bool found = false;
+    size_t sz = sizeof(iotxn_priv_t) + data_size + extra_size;
+    uint32_t cls = size_class(sz);
+    iotxn_pool_t* pool = pools + cls;
 
-    mtx_lock(&free_list_mutex);
-    list_for_every_entry (&free_list, txn, iotxn_t, node) {
-        priv = get_priv(txn);
-        if (priv->buffer_size >= data_size + extra_size) {
-            found = true;
-            break;
+    mtx_lock(&pool->lock);
+    if (cls != IOTXN_CLASS_LARGE) {
+        // every buffer in a class fits
+        txn = list_remove_head_type(&pool->free_list, iotxn_t, node);
+    } else {
+        list_for_every_entry (&pool->free_list, txn, iotxn_t, node) {
+            if (get_priv(txn)->buffer_size >= data_size + extra_size) {
+                list_delete(&txn->node);
+                break;
+            }
+        }
+        if (&txn->node == &pool->free_list) {
+            txn = NULL;
         }
     }
-    // found one that fits, skip allocation
-    if (found) {
-        list_delete(&txn->node);
-        memset(&txn, 0, sizeof(iotxn_t) + priv->buffer_size);
-        mtx_unlock(&free_list_mutex);
+    mtx_unlock(&pool->lock);
+
+    if (txn != NULL) {
+        // found one that fits, skip allocation
+        priv = get_priv(txn);
+        memset(txn, 0, sizeof(iotxn_t) + extra_size);
         goto out;
     }
-    mtx_unlock(&free_list_mutex);
 
     // didn't find one that fits, allocate a new one
-    size_t sz = sizeof(iotxn_priv_t) + data_size + extra_size;
+    if (cls != IOTXN_CLASS_LARGE) {
+        sz = 1u << (IOTXN_MIN_CLASS_SHIFT + cls);
+    }
     mx_paddr_t phys;
     mx_status_t status = mx_alloc_device_memory(get_root_resource(), sz, &phys, (void**)&priv);
     if (status < 0) {
@@ -194,17 +356,107 @@ mx_status_t iotxn_alloc(iotxn_t** out, uint32_t flags, size_t data_size, size_t
     memset(priv, 0, sz);
 
     // layout is iotxn_priv_t | extra_size | data
-    priv->buffer_size = data_size + extra_size;
+    priv->buffer_size = sz - sizeof(iotxn_priv_t);
     priv->buffer_phys = phys;
+    priv->size_class = cls;
 out:
+    priv->flags = 0;
     priv->data_size = data_size;
     priv->extra_size = extra_size;
     priv->data = (void*)priv + sizeof(iotxn_priv_t) + extra_size;
     priv->data_phys = priv->buffer_phys + sizeof(iotxn_priv_t) + extra_size;
+    priv->sg_inline.paddr = priv->data_phys;
+    priv->sg_inline.length = data_size;
+    priv->sg = &priv->sg_inline;
+    priv->sg_count = 1;
+    priv->txn.ops = &ops;
+    *out = &priv->txn;
+    xprintf("iotxn_alloc: found=%d txn=%p buffer_size=0x%zx\n", txn != NULL, &priv->txn, priv->buffer_size);
+    return NO_ERROR;
+}
+
+mx_status_t iotxn_alloc_vmo(iotxn_t** out, uint32_t flags, mx_handle_t vmo,
+                            uint64_t vmo_offset, uint64_t length, size_t extra_size) {
+    xprintf("iotxn_alloc_vmo: flags=0x%x vmo=%d vmo_offset=0x%llx length=0x%llx extra_size=0x%zx\n",
+            flags, vmo, vmo_offset, length, extra_size);
+    if (length == 0) {
+        return ERR_INVALID_ARGS;
+    }
+
+    uint64_t start = PAGE_ROUNDDOWN(vmo_offset);
+    size_t pages = (PAGE_ROUNDUP(vmo_offset + length) - start) / PAGE_SIZE;
+    mx_paddr_t* paddrs = malloc(pages * sizeof(mx_paddr_t));
+    if (paddrs == NULL) {
+        return ERR_NO_MEMORY;
+    }
+
+    mx_status_t status;
+    mx_handle_t h;
+    if ((h = mx_handle_duplicate(vmo, MX_RIGHT_SAME_RIGHTS)) < 0) {
+        status = h;
+        goto fail_dup;
+    }
+    if ((status = mx_vmo_op_range(h, MX_VMO_OP_LOCK, vmo_offset, length, NULL, 0)) < 0) {
+        goto fail_lock;
+    }
+    if ((status = mx_vmo_op_range(h, MX_VMO_OP_LOOKUP, vmo_offset, length,
+                                  paddrs, pages * sizeof(mx_paddr_t))) < 0) {
+        goto fail_lookup;
+    }
+
+    // merge physically adjacent pages into runs
+    uint32_t count = 1;
+    for (size_t n = 1; n < pages; n++) {
+        if (paddrs[n] != paddrs[n - 1] + PAGE_SIZE) {
+            count++;
+        }
+    }
+
+    // layout is iotxn_priv_t | extra_size | sg list
+    size_t extra = (extra_size + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+    iotxn_priv_t* priv = calloc(1, sizeof(iotxn_priv_t) + extra + count * sizeof(iotxn_sg_t));
+    if (priv == NULL) {
+        status = ERR_NO_MEMORY;
+        goto fail_lookup;
+    }
+    iotxn_sg_t* sg = (void*)priv + sizeof(iotxn_priv_t) + extra;
+    uint64_t off = vmo_offset - start;
+    uint64_t remaining = length;
+    uint32_t i = 0;
+    for (size_t n = 0; n < pages; n++) {
+        uint64_t len = MIN(PAGE_SIZE - off, remaining);
+        if ((n > 0) && (paddrs[n] == paddrs[n - 1] + PAGE_SIZE)) {
+            sg[i - 1].length += len;
+        } else {
+            sg[i].paddr = paddrs[n] + off;
+            sg[i].length = len;
+            i++;
+        }
+        remaining -= len;
+        off = 0;
+    }
+    free(paddrs);
+
+    priv->flags = IOTXN_FLAG_VMO;
+    priv->vmo = h;
+    priv->vmo_offset = vmo_offset;
+    priv->data_size = length;
+    priv->data_phys = sg[0].paddr;
+    priv->extra_size = extra_size;
+    priv->sg = sg;
+    priv->sg_count = count;
     priv->txn.ops = &ops;
     *out = &priv->txn;
-    xprintf("iotxn_alloc: found=%d txn=%p buffer_size=0x%zx\n", found, &priv->txn, priv->buffer_size);
+    xprintf("iotxn_alloc_vmo: txn=%p sg_count=%u\n", &priv->txn, count);
     return NO_ERROR;
+
+fail_lookup:
+    mx_vmo_op_range(h, MX_VMO_OP_UNLOCK, vmo_offset, length, NULL, 0);
+fail_lock:
+    mx_handle_close(h);
+fail_dup:
+    free(paddrs);
+    return status;
 }
 
 void iotxn_queue(mx_device_t* dev, iotxn_t* txn) {
@@ -20,6 +20,8 @@ MODULE_SRCS := \
     $(LOCAL_DIR)/devhost.c \
     $(LOCAL_DIR)/devhost-api.c \
     $(LOCAL_DIR)/devhost-binding.c \
+    $(LOCAL_DIR)/devhost-block-fifo.c \
+    $(LOCAL_DIR)/devhost-eth-fifo.c \
     $(LOCAL_DIR)/devhost-core.c \
     $(LOCAL_DIR)/devhost-rpc-server.c \
     system/udev/kpci/kpci.c \
@@ -13,6 +13,7 @@
  * @brief  Graphics drawing library
  */
 #include <gfx/gfx.h>
+#include <gfx/pixel.h>
 
 #include <assert.h>
 #include <err.h>
@@ -214,154 +215,72 @@ void gfx_putchar(gfx_surface* surface, const gfx_font* font, unsigned ch, unsign
     surface->putchar(surface, font, ch, x, y, fg, bg);
 }
 
-static void copyrect8(gfx_surface* surface, unsigned x, unsigned y, unsigned width, unsigned height, unsigned x2, unsigned y2) {
-    // copy
-    const uint8_t* src = &((const uint8_t*)surface->ptr)[x + y * surface->stride];
-    uint8_t* dest = &((uint8_t*)surface->ptr)[x2 + y2 * surface->stride];
-    unsigned stride_diff = surface->stride - width;
+// copies a rectangle a row at a time, in an order that is safe when the
+// source and destination overlap
+static void copyrect_rows(gfx_surface* surface, unsigned pixelsize, unsigned x, unsigned y, unsigned width, unsigned height, unsigned x2, unsigned y2) {
+    size_t stride = surface->stride * pixelsize;
+    size_t len = width * pixelsize;
+    const uint8_t* src = (const uint8_t*)surface->ptr + x * pixelsize + y * stride;
+    uint8_t* dest = (uint8_t*)surface->ptr + x2 * pixelsize + y2 * stride;
 
     if (dest < src) {
-        unsigned i, j;
-        for (i = 0; i < height; i++) {
-            for (j = 0; j < width; j++) {
-                *dest = *src;
-                dest++;
-                src++;
-            }
-            dest += stride_diff;
-            src += stride_diff;
+        for (unsigned i = 0; i < height; i++) {
+            memmove(dest, src, len);
+            dest += stride;
+            src += stride;
         }
     } else {
         // copy backwards
-        src += (height-1) * surface->stride + (width-1);
-        dest += (height-1) * surface->stride + (width-1);
-
-        unsigned i, j;
-        for (i = 0; i < height; i++) {
-            for (j = 0; j < width; j++) {
-                *dest = *src;
-                dest--;
-                src--;
-            }
-            dest -= stride_diff;
-            src -= stride_diff;
+        src += (height - 1) * stride;
+        dest += (height - 1) * stride;
+        for (unsigned i = 0; i < height; i++) {
+            memmove(dest, src, len);
+            dest -= stride;
+            src -= stride;
         }
     }
 }
 
+static void copyrect8(gfx_surface* surface, unsigned x, unsigned y, unsigned width, unsigned height, unsigned x2, unsigned y2) {
+    copyrect_rows(surface, 1, x, y, width, height, x2, y2);
+}
+
 static void fillrect8(gfx_surface* surface, unsigned x, unsigned y, unsigned width, unsigned height, unsigned color) {
     uint8_t* dest = &((uint8_t*)surface->ptr)[x + y * surface->stride];
-    unsigned stride_diff = surface->stride - width;
 
     uint8_t color8 = (uint8_t)(surface->translate_color(color));
 
-    unsigned i, j;
-    for (i = 0; i < height; i++) {
-        for (j = 0; j < width; j++) {
-            *dest = color8;
-            dest++;
-        }
-        dest += stride_diff;
+    for (unsigned i = 0; i < height; i++) {
+        gfx_pixel_fill8(dest, color8, width);
+        dest += surface->stride;
     }
 }
 
 static void copyrect16(gfx_surface* surface, unsigned x, unsigned y, unsigned width, unsigned height, unsigned x2, unsigned y2) {
-    // copy
-    const uint16_t* src = &((const uint16_t*)surface->ptr)[x + y * surface->stride];
-    uint16_t* dest = &((uint16_t*)surface->ptr)[x2 + y2 * surface->stride];
-    unsigned stride_diff = surface->stride - width;
-
-    if (dest < src) {
-        unsigned i, j;
-        for (i = 0; i < height; i++) {
-            for (j = 0; j < width; j++) {
-                *dest = *src;
-                dest++;
-                src++;
-            }
-            dest += stride_diff;
-            src += stride_diff;
-        }
-    } else {
-        // copy backwards
-        src += (height-1) * surface->stride + (width-1);
-        dest += (height-1) * surface->stride + (width-1);
-
-        unsigned i, j;
-        for (i = 0; i < height; i++) {
-            for (j = 0; j < width; j++) {
-                *dest = *src;
-                dest--;
-                src--;
-            }
-            dest -= stride_diff;
-            src -= stride_diff;
-        }
-    }
+    copyrect_rows(surface, 2, x, y, width, height, x2, y2);
 }
 
 static void fillrect16(gfx_surface* surface, unsigned x, unsigned y, unsigned width, unsigned height, unsigned color) {
     uint16_t* dest = &((uint16_t*)surface->ptr)[x + y * surface->stride];
-    unsigned stride_diff = surface->stride - width;
 
     uint16_t color16 = (uint16_t)(surface->translate_color(color));
 
-    unsigned i, j;
-    for (i = 0; i < height; i++) {
-        for (j = 0; j < width; j++) {
-            *dest = color16;
-            dest++;
-        }
-        dest += stride_diff;
+    for (unsigned i = 0; i < height; i++) {
+        gfx_pixel_fill16(dest, color16, width);
+        dest += surface->stride;
     }
 }
 
 static void copyrect32(gfx_surface* surface, unsigned x, unsigned y, unsigned width, unsigned height, unsigned x2, unsigned y2) {
-    // copy
-    const uint32_t* src = &((const uint32_t*)surface->ptr)[x + y * surface->stride];
-    uint32_t* dest = &((uint32_t*)surface->ptr)[x2 + y2 * surface->stride];
-    unsigned stride_diff = surface->stride - width;
-
-    if (dest < src) {
-        unsigned i, j;
-        for (i = 0; i < height; i++) {
-            for (j = 0; j < width; j++) {
-                *dest = *src;
-                dest++;
-                src++;
-            }
-            dest += stride_diff;
-            src += stride_diff;
-        }
-    } else {
-        // copy backwards
-        src += (height-1) * surface->stride + (width-1);
-        dest += (height-1) * surface->stride + (width-1);
-
-        unsigned i, j;
-        for (i = 0; i < height; i++) {
-            for (j = 0; j < width; j++) {
-                *dest = *src;
-                dest--;
-                src--;
-            }
-            dest -= stride_diff;
-            src -= stride_diff;
-        }
-    }
+    copyrect_rows(surface, 4, x, y, width, height, x2, y2);
 }
 
 static void fillrect32(gfx_surface* surface, unsigned x, unsigned y, unsigned width, unsigned height, unsigned color) {
     uint32_t* dest = &((uint32_t*)surface->ptr)[x + y * surface->stride];
-    unsigned stride_diff = surface->stride - width;
 
-    unsigned i, j;
-    for (i = 0; i < height; i++) {
-        for (j = 0; j < width; j++) {
-            *dest = color;
-            dest++;
-        }
-        dest += stride_diff;
+    for (unsigned i = 0; i < height; i++) {
+        gfx_pixel_fill32(dest, color, width);
+        dest += surface->stride;
     }
 }
 
@@ -417,39 +336,8 @@ void gfx_line(gfx_surface* surface, unsigned x1, unsigned y1, unsigned x2, unsig
 }
 
 uint32_t alpha32_add_ignore_destalpha(uint32_t dest, uint32_t src) {
-    uint32_t cdest[3];
-    uint32_t csrc[3];
-
-    uint32_t srca;
-    uint32_t srcainv;
-
-    srca = (src >> 24) & 0xff;
-    if (srca == 0) {
-        return dest;
-    } else if (srca == 255) {
-        return src;
-    }
-    srca++;
-    srcainv = (255 - srca);
-
-    cdest[0] = (dest >> 16) & 0xff;
-    cdest[1] = (dest >> 8) & 0xff;
-    cdest[2] = (dest >> 0) & 0xff;
-
-    csrc[0] = (src >> 16) & 0xff;
-    csrc[1] = (src >> 8) & 0xff;
-    csrc[2] = (src >> 0) & 0xff;
-
-    //    if (srca > 0)
-    //        printf("s %d %d %d d %d %d %d a %d ai %d\n", csrc[0], csrc[1], csrc[2], cdest[0], cdest[1], cdest[2], srca, srcainv);
-
-    uint32_t cres[3];
-
-    cres[0] = ((csrc[0] * srca) / 256) + ((cdest[0] * srcainv) / 256);
-    cres[1] = ((csrc[1] * srca) / 256) + ((cdest[1] * srcainv) / 256);
-    cres[2] = ((csrc[2] * srca) / 256) + ((cdest[2] * srcainv) / 256);
-
-    return (srca << 24) | (cres[0] << 16) | (cres[1] << 8) | (cres[2]);
+    gfx_pixel_blend32(&dest, &src, 1);
+    return dest;
 }
 
 /**
@@ -465,8 +353,6 @@ void gfx_surface_blend(struct gfx_surface* target, struct gfx_surface* source, u
  * @brief  Copy pixels from source to dest.
  */
 void gfx_blend(gfx_surface* target, gfx_surface* source, unsigned srcx, unsigned srcy, unsigned width, unsigned height, unsigned destx, unsigned desty) {
-    assert(target->format == source->format);
-
     xprintf("target %p, source %p, srcx %u, srcy %u, width %u, height %u, destx %u, desty %u\n", target, source, srcx, srcy, width, height, destx, desty);
 
     if (destx >= target->width)
@@ -490,82 +376,44 @@ void gfx_blend(gfx_surface* target, gfx_surface* source, unsigned srcx, unsigned
         height = source->height - srcy;
 
     // XXX total hack to deal with various blends
-    if (source->format == MX_PIXEL_FORMAT_RGB_565 && target->format == MX_PIXEL_FORMAT_RGB_565) {
-        // 16 bit to 16 bit
-        const uint16_t* src = &((const uint16_t*)source->ptr)[srcx + srcy * source->stride];
-        uint16_t* dest = &((uint16_t*)target->ptr)[destx + desty * target->stride];
-        unsigned dest_stride_diff = target->stride - width;
-        unsigned source_stride_diff = source->stride - width;
-
-        xprintf("w %u h %u dstride %u sstride %u\n", width, height, dest_stride_diff, source_stride_diff);
-
-        unsigned i, j;
-        for (i = 0; i < height; i++) {
-            for (j = 0; j < width; j++) {
-                *dest = *src;
-                dest++;
-                src++;
-            }
-            dest += dest_stride_diff;
-            src += source_stride_diff;
+    if (source->format == target->format &&
+        (source->format == MX_PIXEL_FORMAT_RGB_565 ||
+         source->format == MX_PIXEL_FORMAT_RGB_x888 ||
+         source->format == MX_PIXEL_FORMAT_MONO_1)) {
+        // same format, no alpha
+        const uint8_t* src = (const uint8_t*)source->ptr + (srcx + srcy * source->stride) * source->pixelsize;
+        uint8_t* dest = (uint8_t*)target->ptr + (destx + desty * target->stride) * target->pixelsize;
+
+        xprintf("w %u h %u dstride %u sstride %u\n", width, height, target->stride, source->stride);
+
+        for (unsigned i = 0; i < height; i++) {
+            memmove(dest, src, width * source->pixelsize);
+            dest += target->stride * target->pixelsize;
+            src += source->stride * source->pixelsize;
         }
     } else if (source->format == MX_PIXEL_FORMAT_ARGB_8888 && target->format == MX_PIXEL_FORMAT_ARGB_8888) {
         // both are 32 bit modes, both alpha
         const uint32_t* src = &((const uint32_t*)source->ptr)[srcx + srcy * source->stride];
         uint32_t* dest = &((uint32_t*)target->ptr)[destx + desty * target->stride];
-        unsigned dest_stride_diff = target->stride - width;
-        unsigned source_stride_diff = source->stride - width;
-
-        xprintf("w %u h %u dstride %u sstride %u\n", width, height, dest_stride_diff, source_stride_diff);
-
-        unsigned i, j;
-        for (i = 0; i < height; i++) {
-            for (j = 0; j < width; j++) {
-                // XXX ignores destination alpha
-                *dest = alpha32_add_ignore_destalpha(*dest, *src);
-                dest++;
-                src++;
-            }
-            dest += dest_stride_diff;
-            src += source_stride_diff;
-        }
-    } else if (source->format == MX_PIXEL_FORMAT_RGB_x888 && target->format == MX_PIXEL_FORMAT_RGB_x888) {
-        // both are 32 bit modes, no alpha
-        const uint32_t* src = &((const uint32_t*)source->ptr)[srcx + srcy * source->stride];
-        uint32_t* dest = &((uint32_t*)target->ptr)[destx + desty * target->stride];
-        unsigned dest_stride_diff = target->stride - width;
-        unsigned source_stride_diff = source->stride - width;
 
-        xprintf("w %u h %u dstride %u sstride %u\n", width, height, dest_stride_diff, source_stride_diff);
+        xprintf("w %u h %u dstride %u sstride %u\n", width, height, target->stride, source->stride);
 
-        unsigned i, j;
-        for (i = 0; i < height; i++) {
-            for (j = 0; j < width; j++) {
-                *dest = *src;
-                dest++;
-                src++;
-            }
-            dest += dest_stride_diff;
-            src += source_stride_diff;
+        for (unsigned i = 0; i < height; i++) {
+            // XXX ignores destination alpha
+            gfx_pixel_blend32(dest, src, width);
+            dest += target->stride;
+            src += source->stride;
         }
-    } else if (source->format == MX_PIXEL_FORMAT_MONO_1 && target->format == MX_PIXEL_FORMAT_MONO_1) {
-        // both are 8 bit modes, no alpha
-        const uint8_t* src = &((const uint8_t*)source->ptr)[srcx + srcy * source->stride];
-        uint8_t* dest = &((uint8_t*)target->ptr)[destx + desty * target->stride];
-        unsigned dest_stride_diff = target->stride - width;
-        unsigned source_stride_diff = source->stride - width;
-
-        xprintf("w %u h %u dstride %u sstride %u\n", width, height, dest_stride_diff, source_stride_diff);
-
-        unsigned i, j;
-        for (i = 0; i < height; i++) {
-            for (j = 0; j < width; j++) {
-                *dest = *src;
-                dest++;
-                src++;
-            }
-            dest += dest_stride_diff;
-            src += source_stride_diff;
+    } else if ((source->format == MX_PIXEL_FORMAT_ARGB_8888 || source->format == MX_PIXEL_FORMAT_RGB_x888) &&
+               target->format == MX_PIXEL_FORMAT_RGB_565) {
+        // 32 bit to 16 bit, no alpha
+        const uint32_t* src = &((const uint32_t*)source->ptr)[srcx + srcy * source->stride];
+        uint16_t* dest = &((uint16_t*)target->ptr)[destx + desty * target->stride];
+
+        for (unsigned i = 0; i < height; i++) {
+            gfx_pixel_argb8888_to_rgb565(dest, src, width);
+            dest += target->stride;
+            src += source->stride;
         }
     } else {
         xprintf("gfx_surface_blend: unimplemented colorspace combination (source %d target %d)\n", source->format, target->format);
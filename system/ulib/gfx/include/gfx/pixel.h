@@ -0,0 +1,43 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <magenta/compiler.h>
+
+__BEGIN_CDECLS
+
+// Row kernels shared by the user and kernel gfx libraries.  Each one
+// handles a single row of count pixels.  Vector versions are chosen at
+// runtime from what the cpu supports.  The kernel always gets the plain C
+// versions, since it does not save vector state.
+
+#define GFX_PIXEL_IMPL_GENERIC 0
+#define GFX_PIXEL_IMPL_SSE2    1
+#define GFX_PIXEL_IMPL_AVX2    2
+#define GFX_PIXEL_IMPL_NEON    3
+#define GFX_PIXEL_IMPL_COUNT   4
+
+void gfx_pixel_fill32(uint32_t* dst, uint32_t color, size_t count);
+void gfx_pixel_fill16(uint16_t* dst, uint16_t color, size_t count);
+void gfx_pixel_fill8(uint8_t* dst, uint8_t color, size_t count);
+
+// blends ARGB8888 src over dst, ignoring dst alpha.  The result's alpha
+// is the source alpha.
+void gfx_pixel_blend32(uint32_t* dst, const uint32_t* src, size_t count);
+
+void gfx_pixel_argb8888_to_rgb565(uint16_t* dst, const uint32_t* src, size_t count);
+
+// selects an implementation, the best supported one is used by default.
+// Returns false if impl is not supported on this cpu.
+bool gfx_pixel_select(unsigned impl);
+
+// returns the name of the implementation in use
+const char* gfx_pixel_impl_name(void);
+
+__END_CDECLS
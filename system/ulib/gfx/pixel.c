@@ -0,0 +1,386 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// This file is also built into the kernel's gfx library, see
+// kernel/lib/gfx/rules.mk.
+
+#include <gfx/pixel.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if !WITH_NO_FP && defined(__x86_64__)
+#define PIXEL_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#elif !WITH_NO_FP && defined(__aarch64__)
+#define PIXEL_NEON 1
+#include <arm_neon.h>
+#endif
+
+typedef struct pixel_impl {
+    const char* name;
+    void (*fill32)(uint32_t* dst, uint32_t color, size_t count);
+    void (*blend32)(uint32_t* dst, const uint32_t* src, size_t count);
+    void (*to_rgb565)(uint16_t* dst, const uint32_t* src, size_t count);
+} pixel_impl_t;
+
+// generic versions, also used for the tails the vector versions leave
+
+static void fill32_generic(uint32_t* dst, uint32_t color, size_t count) {
+    while (count--) {
+        *dst++ = color;
+    }
+}
+
+static inline uint32_t blend_pixel(uint32_t dest, uint32_t src) {
+    uint32_t srca = src >> 24;
+    if (srca == 0) {
+        return dest;
+    } else if (srca == 255) {
+        return src;
+    }
+    srca++;
+    uint32_t srcainv = 255 - srca;
+
+    uint32_t r = ((((src >> 16) & 0xff) * srca) >> 8) + ((((dest >> 16) & 0xff) * srcainv) >> 8);
+    uint32_t g = ((((src >> 8) & 0xff) * srca) >> 8) + ((((dest >> 8) & 0xff) * srcainv) >> 8);
+    uint32_t b = (((src & 0xff) * srca) >> 8) + (((dest & 0xff) * srcainv) >> 8);
+    return (srca << 24) | (r << 16) | (g << 8) | b;
+}
+
+static void blend32_generic(uint32_t* dst, const uint32_t* src, size_t count) {
+    while (count--) {
+        *dst = blend_pixel(*dst, *src++);
+        dst++;
+    }
+}
+
+static inline uint16_t rgb565_pixel(uint32_t in) {
+    return ((in >> 3) & 0x1f) | (((in >> 10) & 0x3f) << 5) | (((in >> 19) & 0x1f) << 11);
+}
+
+static void to_rgb565_generic(uint16_t* dst, const uint32_t* src, size_t count) {
+    while (count--) {
+        *dst++ = rgb565_pixel(*src++);
+    }
+}
+
+static const pixel_impl_t impl_generic = {
+    .name = "generic",
+    .fill32 = fill32_generic,
+    .blend32 = blend32_generic,
+    .to_rgb565 = to_rgb565_generic,
+};
+
+#if PIXEL_X86
+// SSE2 is part of x86-64, so these need no cpu check
+
+static void fill32_sse2(uint32_t* dst, uint32_t color, size_t count) {
+    __m128i c = _mm_set1_epi32(color);
+    for (; count >= 8; count -= 8, dst += 8) {
+        _mm_storeu_si128((__m128i*)dst, c);
+        _mm_storeu_si128((__m128i*)(dst + 4), c);
+    }
+    fill32_generic(dst, color, count);
+}
+
+// blends 4 pixels, see blend_pixel()
+static inline __m128i blend4_sse2(__m128i d, __m128i s) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i alpha = _mm_srli_epi32(s, 24);
+    __m128i a = _mm_add_epi32(alpha, _mm_set1_epi32(1));
+    __m128i ainv = _mm_sub_epi32(_mm_set1_epi32(255), a);
+
+    // spread each pixel's factors across its four 16 bit channels
+    __m128i a16 = _mm_packs_epi32(a, a);
+    a16 = _mm_unpacklo_epi16(a16, a16);
+    __m128i a_lo = _mm_unpacklo_epi32(a16, a16);
+    __m128i a_hi = _mm_unpackhi_epi32(a16, a16);
+    __m128i ainv16 = _mm_packs_epi32(ainv, ainv);
+    ainv16 = _mm_unpacklo_epi16(ainv16, ainv16);
+    __m128i ainv_lo = _mm_unpacklo_epi32(ainv16, ainv16);
+    __m128i ainv_hi = _mm_unpackhi_epi32(ainv16, ainv16);
+
+    __m128i lo = _mm_add_epi16(
+        _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(s, zero), a_lo), 8),
+        _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), ainv_lo), 8));
+    __m128i hi = _mm_add_epi16(
+        _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(s, zero), a_hi), 8),
+        _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), ainv_hi), 8));
+    __m128i res = _mm_packus_epi16(lo, hi);
+    res = _mm_or_si128(_mm_and_si128(res, _mm_set1_epi32(0x00ffffff)), _mm_slli_epi32(a, 24));
+
+    // transparent pixels keep dst, opaque ones take src
+    __m128i transparent = _mm_cmpeq_epi32(alpha, zero);
+    __m128i opaque = _mm_cmpeq_epi32(alpha, _mm_set1_epi32(255));
+    res = _mm_andnot_si128(_mm_or_si128(transparent, opaque), res);
+    res = _mm_or_si128(res, _mm_and_si128(transparent, d));
+    return _mm_or_si128(res, _mm_and_si128(opaque, s));
+}
+
+static void blend32_sse2(uint32_t* dst, const uint32_t* src, size_t count) {
+    for (; count >= 4; count -= 4, dst += 4, src += 4) {
+        __m128i d = _mm_loadu_si128((const __m128i*)dst);
+        __m128i s = _mm_loadu_si128((const __m128i*)src);
+        _mm_storeu_si128((__m128i*)dst, blend4_sse2(d, s));
+    }
+    blend32_generic(dst, src, count);
+}
+
+static inline __m128i rgb565_4_sse2(__m128i p) {
+    __m128i b = _mm_and_si128(_mm_srli_epi32(p, 3), _mm_set1_epi32(0x001f));
+    __m128i g = _mm_and_si128(_mm_srli_epi32(p, 5), _mm_set1_epi32(0x07e0));
+    __m128i r = _mm_and_si128(_mm_srli_epi32(p, 8), _mm_set1_epi32(0xf800));
+    __m128i v = _mm_or_si128(_mm_or_si128(b, g), r);
+    // sign extend so the signed saturating pack keeps all 16 bits
+    return _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+}
+
+static void to_rgb565_sse2(uint16_t* dst, const uint32_t* src, size_t count) {
+    for (; count >= 8; count -= 8, dst += 8, src += 8) {
+        __m128i lo = rgb565_4_sse2(_mm_loadu_si128((const __m128i*)src));
+        __m128i hi = rgb565_4_sse2(_mm_loadu_si128((const __m128i*)(src + 4)));
+        _mm_storeu_si128((__m128i*)dst, _mm_packs_epi32(lo, hi));
+    }
+    to_rgb565_generic(dst, src, count);
+}
+
+static const pixel_impl_t impl_sse2 = {
+    .name = "sse2",
+    .fill32 = fill32_sse2,
+    .blend32 = blend32_sse2,
+    .to_rgb565 = to_rgb565_sse2,
+};
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static void fill32_avx2(uint32_t* dst, uint32_t color, size_t count) {
+    __m256i c = _mm256_set1_epi32(color);
+    for (; count >= 16; count -= 16, dst += 16) {
+        _mm256_storeu_si256((__m256i*)dst, c);
+        _mm256_storeu_si256((__m256i*)(dst + 8), c);
+    }
+    fill32_generic(dst, color, count);
+}
+
+// blends 8 pixels, the same steps as blend4_sse2() within each 128 bit lane
+AVX2 static inline __m256i blend8_avx2(__m256i d, __m256i s) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i alpha = _mm256_srli_epi32(s, 24);
+    __m256i a = _mm256_add_epi32(alpha, _mm256_set1_epi32(1));
+    __m256i ainv = _mm256_sub_epi32(_mm256_set1_epi32(255), a);
+
+    __m256i a16 = _mm256_packs_epi32(a, a);
+    a16 = _mm256_unpacklo_epi16(a16, a16);
+    __m256i a_lo = _mm256_unpacklo_epi32(a16, a16);
+    __m256i a_hi = _mm256_unpackhi_epi32(a16, a16);
+    __m256i ainv16 = _mm256_packs_epi32(ainv, ainv);
+    ainv16 = _mm256_unpacklo_epi16(ainv16, ainv16);
+    __m256i ainv_lo = _mm256_unpacklo_epi32(ainv16, ainv16);
+    __m256i ainv_hi = _mm256_unpackhi_epi32(ainv16, ainv16);
+
+    __m256i lo = _mm256_add_epi16(
+        _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(s, zero), a_lo), 8),
+        _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), ainv_lo), 8));
+    __m256i hi = _mm256_add_epi16(
+        _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(s, zero), a_hi), 8),
+        _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), ainv_hi), 8));
+    __m256i res = _mm256_packus_epi16(lo, hi);
+    res = _mm256_or_si256(_mm256_and_si256(res, _mm256_set1_epi32(0x00ffffff)),
+                          _mm256_slli_epi32(a, 24));
+
+    __m256i transparent = _mm256_cmpeq_epi32(alpha, zero);
+    __m256i opaque = _mm256_cmpeq_epi32(alpha, _mm256_set1_epi32(255));
+    res = _mm256_andnot_si256(_mm256_or_si256(transparent, opaque), res);
+    res = _mm256_or_si256(res, _mm256_and_si256(transparent, d));
+    return _mm256_or_si256(res, _mm256_and_si256(opaque, s));
+}
+
+AVX2 static void blend32_avx2(uint32_t* dst, const uint32_t* src, size_t count) {
+    for (; count >= 8; count -= 8, dst += 8, src += 8) {
+        __m256i d = _mm256_loadu_si256((const __m256i*)dst);
+        __m256i s = _mm256_loadu_si256((const __m256i*)src);
+        _mm256_storeu_si256((__m256i*)dst, blend8_avx2(d, s));
+    }
+    blend32_sse2(dst, src, count);
+}
+
+AVX2 static inline __m256i rgb565_8_avx2(__m256i p) {
+    __m256i b = _mm256_and_si256(_mm256_srli_epi32(p, 3), _mm256_set1_epi32(0x001f));
+    __m256i g = _mm256_and_si256(_mm256_srli_epi32(p, 5), _mm256_set1_epi32(0x07e0));
+    __m256i r = _mm256_and_si256(_mm256_srli_epi32(p, 8), _mm256_set1_epi32(0xf800));
+    __m256i v = _mm256_or_si256(_mm256_or_si256(b, g), r);
+    return _mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16);
+}
+
+AVX2 static void to_rgb565_avx2(uint16_t* dst, const uint32_t* src, size_t count) {
+    for (; count >= 16; count -= 16, dst += 16, src += 16) {
+        __m256i lo = rgb565_8_avx2(_mm256_loadu_si256((const __m256i*)src));
+        __m256i hi = rgb565_8_avx2(_mm256_loadu_si256((const __m256i*)(src + 8)));
+        // the pack works within lanes, put the quadwords back in order
+        __m256i v = _mm256_packs_epi32(lo, hi);
+        _mm256_storeu_si256((__m256i*)dst, _mm256_permute4x64_epi64(v, 0xd8));
+    }
+    to_rgb565_sse2(dst, src, count);
+}
+
+static const pixel_impl_t impl_avx2 = {
+    .name = "avx2",
+    .fill32 = fill32_avx2,
+    .blend32 = blend32_avx2,
+    .to_rgb565 = to_rgb565_avx2,
+};
+
+static bool cpu_has_avx2(void) {
+    unsigned a, b, c, d;
+    if (!__get_cpuid(1, &a, &b, &c, &d)) {
+        return false;
+    }
+    // the os must have enabled saving of the ymm registers
+    if (!(c & bit_OSXSAVE) || !(c & bit_AVX)) {
+        return false;
+    }
+    uint32_t xcr0_lo, xcr0_hi;
+    __asm__ volatile("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    if ((xcr0_lo & 0x6) != 0x6) {
+        return false;
+    }
+    if (__get_cpuid_max(0, NULL) < 7) {
+        return false;
+    }
+    __cpuid_count(7, 0, a, b, c, d);
+    return (b & bit_AVX2) != 0;
+}
+#endif // PIXEL_X86
+
+#if PIXEL_NEON
+// NEON is part of arm64, so these need no cpu check
+
+static void fill32_neon(uint32_t* dst, uint32_t color, size_t count) {
+    uint32x4_t c = vdupq_n_u32(color);
+    for (; count >= 8; count -= 8, dst += 8) {
+        vst1q_u32(dst, c);
+        vst1q_u32(dst + 4, c);
+    }
+    fill32_generic(dst, color, count);
+}
+
+// blends 8 pixels a channel at a time, see blend_pixel()
+static void blend32_neon(uint32_t* dst, const uint32_t* src, size_t count) {
+    for (; count >= 8; count -= 8, dst += 8, src += 8) {
+        uint8x8x4_t s = vld4_u8((const uint8_t*)src);
+        uint8x8x4_t d = vld4_u8((const uint8_t*)dst);
+        uint8x8_t alpha = s.val[3];
+        uint16x8_t a = vaddw_u8(vdupq_n_u16(1), alpha);
+        uint16x8_t ainv = vsubq_u16(vdupq_n_u16(255), a);
+        uint8x8_t transparent = vceq_u8(alpha, vdup_n_u8(0));
+        uint8x8_t opaque = vceq_u8(alpha, vdup_n_u8(255));
+
+        uint8x8x4_t res;
+        for (int i = 0; i < 3; i++) {
+            uint8x8_t c = vadd_u8(vshrn_n_u16(vmulq_u16(vmovl_u8(s.val[i]), a), 8),
+                                  vshrn_n_u16(vmulq_u16(vmovl_u8(d.val[i]), ainv), 8));
+            res.val[i] = vbsl_u8(transparent, d.val[i], vbsl_u8(opaque, s.val[i], c));
+        }
+        res.val[3] = vbsl_u8(transparent, d.val[3], vbsl_u8(opaque, alpha, vmovn_u16(a)));
+        vst4_u8((uint8_t*)dst, res);
+    }
+    blend32_generic(dst, src, count);
+}
+
+static void to_rgb565_neon(uint16_t* dst, const uint32_t* src, size_t count) {
+    for (; count >= 8; count -= 8, dst += 8, src += 8) {
+        uint8x8x4_t p = vld4_u8((const uint8_t*)src);
+        uint16x8_t r = vshll_n_u8(vshr_n_u8(p.val[2], 3), 11);
+        uint16x8_t g = vshll_n_u8(vshr_n_u8(p.val[1], 2), 5);
+        uint16x8_t b = vmovl_u8(vshr_n_u8(p.val[0], 3));
+        vst1q_u16(dst, vorrq_u16(vorrq_u16(r, g), b));
+    }
+    to_rgb565_generic(dst, src, count);
+}
+
+static const pixel_impl_t impl_neon = {
+    .name = "neon",
+    .fill32 = fill32_neon,
+    .blend32 = blend32_neon,
+    .to_rgb565 = to_rgb565_neon,
+};
+#endif // PIXEL_NEON
+
+static const pixel_impl_t* get_impl(unsigned which) {
+    switch (which) {
+    case GFX_PIXEL_IMPL_GENERIC:
+        return &impl_generic;
+#if PIXEL_X86
+    case GFX_PIXEL_IMPL_SSE2:
+        return &impl_sse2;
+    case GFX_PIXEL_IMPL_AVX2:
+        return cpu_has_avx2() ? &impl_avx2 : NULL;
+#endif
+#if PIXEL_NEON
+    case GFX_PIXEL_IMPL_NEON:
+        return &impl_neon;
+#endif
+    default:
+        return NULL;
+    }
+}
+
+// chosen on first use, racing first users all pick the same one
+static const pixel_impl_t* impl;
+
+static const pixel_impl_t* current_impl(void) {
+    const pixel_impl_t* i = impl;
+    if (i == NULL) {
+        for (unsigned which = GFX_PIXEL_IMPL_COUNT; which-- > 0; ) {
+            if ((i = get_impl(which)) != NULL) {
+                break;
+            }
+        }
+        impl = i;
+    }
+    return i;
+}
+
+bool gfx_pixel_select(unsigned which) {
+    const pixel_impl_t* i = get_impl(which);
+    if (i == NULL) {
+        return false;
+    }
+    impl = i;
+    return true;
+}
+
+const char* gfx_pixel_impl_name(void) {
+    return current_impl()->name;
+}
+
+void gfx_pixel_fill32(uint32_t* dst, uint32_t color, size_t count) {
+    current_impl()->fill32(dst, color, count);
+}
+
+void gfx_pixel_fill16(uint16_t* dst, uint16_t color, size_t count) {
+    if (count && ((uintptr_t)dst & 2)) {
+        *dst++ = color;
+        count--;
+    }
+    current_impl()->fill32((uint32_t*)dst, ((uint32_t)color << 16) | color, count / 2);
+    if (count & 1) {
+        dst[count - 1] = color;
+    }
+}
+
+void gfx_pixel_fill8(uint8_t* dst, uint8_t color, size_t count) {
+    memset(dst, color, count);
+}
+
+void gfx_pixel_blend32(uint32_t* dst, const uint32_t* src, size_t count) {
+    current_impl()->blend32(dst, src, count);
+}
+
+void gfx_pixel_argb8888_to_rgb565(uint16_t* dst, const uint32_t* src, size_t count) {
+    current_impl()->to_rgb565(dst, src, count);
+}
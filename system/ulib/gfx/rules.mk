@@ -16,5 +16,6 @@ MODULE_LIBS := \
 
 MODULE_SRCS += \
     $(LOCAL_DIR)/gfx.c \
+    $(LOCAL_DIR)/pixel.c \
 
 include make/module.mk
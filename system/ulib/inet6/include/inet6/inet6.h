@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -128,6 +129,14 @@ static inline uint32_t _swap32(uint32_t n) {
 char* ip6toa(char* _out, void* ip6addr);
 #define IP6TOAMAX 40
 
+// Internet checksum: adds len bytes of data to the 16-bit one's
+// complement sum and returns the new sum (not inverted)
+uint16_t inet_checksum(const void* data, size_t len, uint16_t sum);
+
+// Returns a finished (inverted) checksum updated for len bytes of the
+// data it covers changing from old to new, without resumming the rest
+uint16_t inet_checksum_adjust(uint16_t csum, const void* old, const void* new, size_t len);
+
 // provided by inet6.c
 void ip6_init(void* macaddr);
 void eth_recv(void* data, size_t len);
@@ -138,11 +147,28 @@ void eth_put_buffer(void* ptr);
 int eth_send(void* data, size_t len);
 int eth_add_mcast_filter(const mac_addr_t* addr);
 
+// Called from within eth_recv() (so from udp6_recv()) with a pointer
+// anywhere into the frame being received, to keep that frame's buffer
+// after the callback returns.  Release it with eth_put_buffer().
+// Returns nonzero if the driver can't lend the buffer out, in which
+// case the data must be copied before returning.
+int eth_hold_buffer(void* data);
+
 // call to transmit a UDP packet
 int udp6_send(const void* data, size_t len,
               const ip6_addr_t* daddr, uint16_t dport,
               uint16_t sport);
 
+// Zero-copy transmit: udp6_get_buffer() returns room for len bytes of
+// UDP payload inside a transmit buffer, which is then passed (along
+// with the payload length) to udp6_send_buffer() or given back with
+// udp6_put_buffer().  udp6_send_buffer() always consumes the buffer.
+void* udp6_get_buffer(size_t len);
+void udp6_put_buffer(void* data);
+int udp6_send_buffer(void* data, size_t len,
+                     const ip6_addr_t* daddr, uint16_t dport,
+                     uint16_t sport);
+
 // implement to recive UDP packets
 void udp6_recv(void* data, size_t len,
                const ip6_addr_t* daddr, uint16_t dport,
@@ -173,5 +199,9 @@ void udp6_recv(void* data, size_t len,
 // and free functionality.  It will allocate a single transmit buffer
 // from udp6_send() or icmp6_send() to fill out and either pass to the
 // network stack via eth_send() or, in the event of an error, release
-// via eth_put_buffer().
+// via eth_put_buffer().  udp6_get_buffer() exposes that buffer so
+// callers can build their payload in place.
+//
+// Received frames are handed up in place; a UDP receiver that wants
+// to keep one (rather than copy it) asks the driver via eth_hold_buffer().
 //
@@ -7,13 +7,19 @@
 // setup networking
 int netifc_open(void);
 
+// Set up an in-process loopback interface instead of a device, for
+// testing the stack: eth_send() copies each frame into a receive buffer
+// and hands it to eth_recv() before returning.
+int netifc_open_loopback(void);
+
 // process inbound packet(s)
 int netifc_poll(void);
 
 // return nonzero if interface exists
 int netifc_active(void);
 
-// shut down networking
+// Shut down networking.  Frames the stack is holding (see
+// eth_hold_buffer()) stay valid until given back with eth_put_buffer().
 void netifc_close(void);
 
 // set a timer to expire after ms milliseconds
@@ -2,6 +2,7 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
@@ -128,20 +129,75 @@ static int resolve_ip6(mac_addr_t* _mac, const ip6_addr_t* _ip) {
     return -1;
 }
 
-static uint16_t checksum(const void* _data, size_t len, uint16_t _sum) {
-    uint32_t sum = _sum;
-    const uint16_t* data = _data;
-    while (len > 1) {
-        sum += *data++;
-        len -= 2;
+static inline uint64_t load64(const uint8_t* p) {
+    uint64_t n;
+    memcpy(&n, p, sizeof(n));
+    return n;
+}
+
+// One's complement addition with end-around carry.
+static inline uint64_t add64(uint64_t sum, uint64_t n) {
+    sum += n;
+    return sum + (sum < n);
+}
+
+// The one's complement sum is independent of byte order as long as
+// each 16-bit word keeps its two bytes together, so whole 64-bit words
+// can be added and folded down at the end (RFC 1071).
+uint16_t inet_checksum(const void* _data, size_t len, uint16_t _sum) {
+    const uint8_t* data = _data;
+    uint64_t sum = _sum;
+    uint64_t sum2 = 0;
+
+    // two independent accumulators keep the carries from serializing
+    while (len >= 32) {
+        sum = add64(sum, load64(data));
+        sum2 = add64(sum2, load64(data + 8));
+        sum = add64(sum, load64(data + 16));
+        sum2 = add64(sum2, load64(data + 24));
+        data += 32;
+        len -= 32;
+    }
+    sum = add64(sum, sum2);
+    while (len >= 8) {
+        sum = add64(sum, load64(data));
+        data += 8;
+        len -= 8;
     }
     if (len) {
-        sum += (*data & 0xFF);
+        // the trailing bytes form a final word padded with zeros
+        uint64_t n = 0;
+        memcpy(&n, data, len);
+        sum = add64(sum, n);
+    }
+
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    return sum;
+}
+
+// Adjusts a finished checksum for len bytes (an even number) of the
+// checksummed data changing from old to new, per RFC 1624 eqn 3:
+// HC' = ~(~HC + ~m + m')
+uint16_t inet_checksum_adjust(uint16_t csum, const void* old, const void* new, size_t len) {
+    const uint8_t* o = old;
+    const uint8_t* n = new;
+    uint32_t sum = (uint16_t)~csum;
+    for (; len > 1; len -= 2) {
+        uint16_t ow, nw;
+        memcpy(&ow, o, 2);
+        memcpy(&nw, n, 2);
+        sum += (uint16_t)~ow;
+        sum += nw;
+        o += 2;
+        n += 2;
     }
     while (sum > 0xFFFF) {
         sum = (sum & 0xFFFF) + (sum >> 16);
     }
-    return sum;
+    return ~sum;
 }
 
 typedef struct {
@@ -161,9 +217,9 @@ static unsigned ip6_checksum(ip6_hdr_t* ip, unsigned type, size_t length) {
     uint16_t sum;
 
     // length and protocol field for pseudo-header
-    sum = checksum(&ip->length, 2, htons(type));
+    sum = inet_checksum(&ip->length, 2, htons(type));
     // src/dst for pseudo-header + payload
-    sum = checksum(&ip->src, 32 + length, sum);
+    sum = inet_checksum(&ip->src, 32 + length, sum);
 
     // 0 is illegal, so 0xffff remains 0xffff
     if (sum != 0xffff) {
@@ -198,12 +254,23 @@ static int ip6_setup(ip6_pkt_t* p, const ip6_addr_t* daddr, size_t length, uint8
 
 #define UDP6_MAX_PAYLOAD (ETH_MTU - ETH_HDR_LEN - IP6_HDR_LEN - UDP_HDR_LEN)
 
-int udp6_send(const void* data, size_t dlen, const ip6_addr_t* daddr, uint16_t dport, uint16_t sport) {
-    size_t length = dlen + UDP_HDR_LEN;
+void* udp6_get_buffer(size_t len) {
+    if (len > UDP6_MAX_PAYLOAD)
+        return NULL;
     udp_pkt_t* p = eth_get_buffer(ETH_MTU + 2);
-
     if (p == 0)
-        return -1;
+        return NULL;
+    return p->data;
+}
+
+void udp6_put_buffer(void* data) {
+    eth_put_buffer(data);
+}
+
+int udp6_send_buffer(void* data, size_t dlen, const ip6_addr_t* daddr, uint16_t dport, uint16_t sport) {
+    udp_pkt_t* p = (void*)((uint8_t*)data - offsetof(udp_pkt_t, data));
+    size_t length = dlen + UDP_HDR_LEN;
+
     if (dlen > UDP6_MAX_PAYLOAD)
         goto fail;
     if (ip6_setup((void*)p, daddr, length, HDR_UDP))
@@ -215,7 +282,6 @@ int udp6_send(const void* data, size_t dlen, const ip6_addr_t* daddr, uint16_t d
     p->udp.length = htons(length);
     p->udp.checksum = 0;
 
-    memcpy(p->data, data, dlen);
     p->udp.checksum = ip6_checksum(&p->ip6, HDR_UDP, length);
     return eth_send(p->eth + 2, ETH_HDR_LEN + IP6_HDR_LEN + length);
 
@@ -224,9 +290,19 @@ fail:
     return -1;
 }
 
+int udp6_send(const void* data, size_t dlen, const ip6_addr_t* daddr, uint16_t dport, uint16_t sport) {
+    void* buf = udp6_get_buffer(dlen);
+
+    if (buf == NULL)
+        return -1;
+    memcpy(buf, data, dlen);
+    return udp6_send_buffer(buf, dlen, daddr, dport, sport);
+}
+
 #define ICMP6_MAX_PAYLOAD (ETH_MTU - ETH_HDR_LEN - IP6_HDR_LEN)
 
-static int icmp6_send(const void* data, size_t length, const ip6_addr_t* daddr) {
+// If csum is true the message's checksum field is already correct.
+static int icmp6_send(const void* data, size_t length, const ip6_addr_t* daddr, bool csum) {
     ip6_pkt_t* p;
     icmp6_hdr_t* icmp;
 
@@ -240,7 +316,8 @@ static int icmp6_send(const void* data, size_t length, const ip6_addr_t* daddr)
 
     icmp = (void*)p->data;
     memcpy(icmp, data, length);
-    icmp->checksum = ip6_checksum(&p->ip6, HDR_ICMP6, length);
+    if (!csum)
+        icmp->checksum = ip6_checksum(&p->ip6, HDR_ICMP6, length);
     return eth_send(p->eth + 2, ETH_HDR_LEN + IP6_HDR_LEN + length);
 
 fail:
@@ -259,8 +336,8 @@ void _udp6_recv(ip6_hdr_t* ip, void* _data, size_t len) {
     if (udp->checksum == 0xFFFF)
         udp->checksum = 0;
 
-    sum = checksum(&ip->length, 2, htons(HDR_UDP));
-    sum = checksum(&ip->src, 32 + len, sum);
+    sum = inet_checksum(&ip->length, 2, htons(HDR_UDP));
+    sum = inet_checksum(&ip->src, 32 + len, sum);
     if (sum != 0xFFFF)
         BAD("Checksum Incorrect");
 
@@ -285,8 +362,8 @@ void icmp6_recv(ip6_hdr_t* ip, void* _data, size_t len) {
     if (icmp->checksum == 0xFFFF)
         icmp->checksum = 0;
 
-    sum = checksum(&ip->length, 2, htons(HDR_ICMP6));
-    sum = checksum(&ip->src, 32 + len, sum);
+    sum = inet_checksum(&ip->length, 2, htons(HDR_ICMP6));
+    sum = inet_checksum(&ip->src, 32 + len, sum);
     if (sum != 0xFFFF)
         BAD("Checksum Incorrect");
 
@@ -313,14 +390,20 @@ void icmp6_recv(ip6_hdr_t* ip, void* _data, size_t len) {
         msg.opt[1] = 1;
         memcpy(msg.opt + 2, &ll_mac_addr, ETH_ADDR_LEN);
 
-        icmp6_send(&msg, sizeof(msg), (void*)&ip->src);
+        icmp6_send(&msg, sizeof(msg), (void*)&ip->src, false);
         return;
     }
 
     if (icmp->type == ICMP6_ECHO_REQUEST) {
-        icmp->checksum = 0;
+        // The request's checksum already covers the payload, so adjust
+        // it for the new type and for the reply coming from our address
+        // (the pseudo-header's addresses swap, leaving only dst -> src).
+        uint8_t type[2] = { icmp->type, icmp->code };
         icmp->type = ICMP6_ECHO_REPLY;
-        icmp6_send(_data, len, (void*)&ip->src);
+        icmp->checksum = inet_checksum_adjust(icmp->checksum, type, icmp, 2);
+        icmp->checksum = inet_checksum_adjust(icmp->checksum, &ip->dst, &ll_ip6_addr,
+                                              sizeof(ip6_addr_t));
+        icmp6_send(_data, len, (void*)&ip->src, true);
         return;
     }
 
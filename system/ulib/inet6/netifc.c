@@ -5,8 +5,10 @@
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
 
@@ -16,6 +18,8 @@
 #include <inet6/inet6.h>
 #include <inet6/netifc.h>
 
+#include <magenta/device/ethernet.h>
+
 #include <mxio/io.h>
 #include <mxio/watcher.h>
 
@@ -51,9 +55,17 @@ static uint8_t netmac[6];
 
 #define MAX_FILTER 8
 
-#define NUM_BUFFER_PAGES 8
 #define ETH_BUFFER_SIZE 1536
 #define ETH_BUFFER_MAGIC 0x424201020304A7A7UL
+#define ETH_RX_BUFFER_MAGIC 0x424201020304A7A8UL
+
+// Every buffer (tx or rx) starts on a NET_SLOT_SIZE boundary, so any
+// pointer into a frame leads back to its eth_buffer_t.
+#define NET_SLOT_SIZE   2048
+
+// Received frames start this far into a buffer's data, so that the
+// ip6 header following the 14 byte ethernet header is 4-byte aligned.
+#define NET_RX_HEADROOM 2
 
 typedef struct eth_buffer eth_buffer_t;
 struct eth_buffer {
@@ -62,13 +74,134 @@ struct eth_buffer {
     uint8_t data[0];
 };
 
-static eth_buffer_t* eth_buffers = NULL;
+static eth_buffer_t* eth_buffers = NULL; // free tx buffers
+static eth_buffer_t* rx_buffers = NULL;  // free rx buffers
+
+// the buffer of the frame eth_recv() is looking at, and whether
+// eth_hold_buffer() has claimed it
+static eth_buffer_t* rx_buffer;
+static bool rx_held;
+
+static inline eth_buffer_t* eth_buffer_of(void* data) {
+    return (void*)(((uintptr_t)data) & ~(uintptr_t)(NET_SLOT_SIZE - 1));
+}
+
+static bool netifc_recv(eth_buffer_t* buf, void* data, size_t len);
+
+// set by netifc_open_loopback(): eth_send() hands frames straight back
+static bool netloop;
+
+// When the device supports it, frames move through shared rings in a
+// vmo (see magenta/device/ethernet.h) instead of a read() or write()
+// per frame.  The vmo holds the rings, then the rx buffers (enough to
+// fill the rx ring plus spares to cover frames the stack is holding
+// on to), then the tx buffers handed out by eth_get_buffer().
+#define NET_SLOTS_OFF   4096
+#define NET_RX_SLOTS    (ETH_FIFO_RING_SIZE + NET_RX_SPARE)
+#define NET_RX_SPARE    32
+#define NET_TX_SLOTS    ETH_FIFO_RING_SIZE
+#define NET_VMO_SIZE    (NET_SLOTS_OFF + (NET_RX_SLOTS + NET_TX_SLOTS) * NET_SLOT_SIZE)
+
+// Without rings, frames are read() into buffers from a smaller pool.
+#define NET_LEGACY_RX   16
+#define NET_LEGACY_TX   8
+
+static mx_handle_t netpipe;
+static mx_handle_t netevent;
+static mx_handle_t netvmo;
+static uintptr_t netbase;
+static eth_fifo_rings_t* netrings;
+static uint32_t rx_consumed; // rx entries we've taken back from the device
+static uint32_t rx_avail;    // rx entries we've handed to the device
+static uint32_t tx_avail;    // tx entries we've handed to the device
+static uint32_t tx_reclaimed; // tx entries whose buffers we've taken back
+static uint32_t rx_lent;      // rx buffers in the vmo the stack is holding
+
+// Closing the rings while the stack holds frames leaves their vmo
+// mapped until the last of them comes back through eth_put_buffer(),
+// so the held pointers stay valid and a new mapping can't reuse the
+// addresses.
+#define NET_RETIRED_MAX 4
+
+static struct {
+    uintptr_t base;
+    uint32_t lent;
+} retired[NET_RETIRED_MAX];
+
+static inline bool netifc_in_vmo(uintptr_t base, void* data) {
+    return ((uintptr_t)data - base) < NET_VMO_SIZE;
+}
+
+static void netifc_retire(uintptr_t base, uint32_t lent) {
+    for (unsigned n = 0; n < NET_RETIRED_MAX; n++) {
+        if (retired[n].base == 0) {
+            retired[n].base = base;
+            retired[n].lent = lent;
+            return;
+        }
+    }
+    // better to leak the mapping than to pull it out from under the stack
+    printf("netifc: leaking buffers at %p, %u frames still held\n", (void*)base, lent);
+}
+
+// returns true if data was a held frame from a retired mapping
+static bool netifc_put_retired(void* data) {
+    for (unsigned n = 0; n < NET_RETIRED_MAX; n++) {
+        if (retired[n].base && netifc_in_vmo(retired[n].base, data)) {
+            if (--retired[n].lent == 0) {
+                mx_process_unmap_vm(mx_process_self(), retired[n].base, 0);
+                retired[n].base = 0;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+static void netifc_kick(void) {
+    mx_object_signal(netevent, 0, ETH_FIFO_SIGNAL_KICK);
+}
+
+// return buffers of frames the device has finished sending
+static void netifc_reclaim_tx(void) {
+    uint32_t used = __atomic_load_n(&netrings->tx.used, __ATOMIC_ACQUIRE);
+    while (tx_reclaimed != used) {
+        eth_fifo_entry_t* e = netrings->tx.entries + (tx_reclaimed & (ETH_FIFO_RING_SIZE - 1));
+        eth_buffer_t* buf = (eth_buffer_t*)(uintptr_t)e->cookie;
+        buf->next = eth_buffers;
+        eth_buffers = buf;
+        tx_reclaimed++;
+    }
+}
+
+// post free rx buffers to the device, up to a full ring
+static void netifc_refill_rx(void) {
+    uint32_t avail = rx_avail;
+    while (((avail - rx_consumed) < ETH_FIFO_RING_SIZE) && (rx_buffers != NULL)) {
+        eth_buffer_t* buf = rx_buffers;
+        rx_buffers = buf->next;
+        eth_fifo_entry_t* e = netrings->rx.entries + (avail & (ETH_FIFO_RING_SIZE - 1));
+        e->offset = (uintptr_t)(buf->data + NET_RX_HEADROOM) - netbase;
+        e->length = NET_SLOT_SIZE - sizeof(eth_buffer_t) - NET_RX_HEADROOM;
+        e->flags = 0;
+        e->cookie = (uintptr_t)buf;
+        avail++;
+    }
+    if (avail != rx_avail) {
+        rx_avail = avail;
+        __atomic_store_n(&netrings->rx.avail, avail, __ATOMIC_RELEASE);
+        netifc_kick();
+    }
+}
 
 void* eth_get_buffer(size_t sz) {
     eth_buffer_t* buf;
     if (sz > ETH_BUFFER_SIZE) {
         return NULL;
     }
+    if ((eth_buffers == NULL) && netrings) {
+        netifc_reclaim_tx();
+    }
     if (eth_buffers == NULL) {
         printf("out of buffers\n");
         return NULL;
@@ -80,7 +213,24 @@ void* eth_get_buffer(size_t sz) {
 }
 
 void eth_put_buffer(void* data) {
-    eth_buffer_t* buf = (void*)(((uintptr_t)data) & (~31));
+    if (netifc_put_retired(data)) {
+        return;
+    }
+    eth_buffer_t* buf = eth_buffer_of(data);
+    if (netrings && !netifc_in_vmo(netbase, data)) {
+        // held since before the rings came up, from the read() pool
+        free(buf);
+        return;
+    }
+    if (buf->magic == ETH_RX_BUFFER_MAGIC) {
+        // a frame the stack held on to; netifc_refill_rx() reposts it
+        if (netrings) {
+            rx_lent--;
+        }
+        buf->next = rx_buffers;
+        rx_buffers = buf;
+        return;
+    }
     if (buf->magic != ETH_BUFFER_MAGIC) {
         printf("fatal: eth buffer %p (from %p) bad magic %llx\n", buf, data, buf->magic);
         for (;;)
@@ -90,6 +240,17 @@ void eth_put_buffer(void* data) {
     eth_buffers = buf;
 }
 
+int eth_hold_buffer(void* data) {
+    if ((rx_buffer == NULL) || (eth_buffer_of(data) != rx_buffer)) {
+        return -1;
+    }
+    if (netrings && !rx_held) {
+        rx_lent++;
+    }
+    rx_held = true;
+    return 0;
+}
+
 int eth_send(void* data, size_t len) {
 #if DROP_PACKETS
     txc++;
@@ -99,6 +260,37 @@ int eth_send(void* data, size_t len) {
         return len;
     }
 #endif
+    if (netloop) {
+        // copy the frame into an rx buffer, as a device would, and
+        // hand it up as if it had just arrived
+        eth_buffer_t* buf = rx_buffers;
+        if (buf != NULL) {
+            rx_buffers = buf->next;
+            void* rx = buf->data + NET_RX_HEADROOM;
+            memcpy(rx, data, len);
+            eth_put_buffer(data);
+            if (!netifc_recv(buf, rx, len)) {
+                buf->next = rx_buffers;
+                rx_buffers = buf;
+            }
+        } else {
+            eth_put_buffer(data);
+        }
+        return len;
+    }
+    if (netrings) {
+        // every tx buffer is either free or on the ring, so the ring
+        // can't overflow; the buffer comes back via netifc_reclaim_tx()
+        eth_buffer_t* buf = eth_buffer_of(data);
+        eth_fifo_entry_t* e = netrings->tx.entries + (tx_avail & (ETH_FIFO_RING_SIZE - 1));
+        e->offset = (uintptr_t)data - netbase;
+        e->length = len;
+        e->flags = 0;
+        e->cookie = (uintptr_t)buf;
+        __atomic_store_n(&netrings->tx.avail, ++tx_avail, __ATOMIC_RELEASE);
+        netifc_kick();
+        return len;
+    }
     int r = write(netfd, data, len);
     eth_put_buffer(data);
     return r;
@@ -124,6 +316,128 @@ int netifc_timer_expired(void) {
     return 0;
 }
 
+static void netifc_close_fifo(void) {
+    if (netpipe > 0) {
+        mx_handle_close(netpipe);
+    }
+    if (netevent > 0) {
+        mx_handle_close(netevent);
+    }
+    if (netbase) {
+        if (rx_lent) {
+            netifc_retire(netbase, rx_lent);
+        } else {
+            mx_process_unmap_vm(mx_process_self(), netbase, 0);
+        }
+    }
+    if (netvmo > 0) {
+        mx_handle_close(netvmo);
+    }
+    netpipe = 0;
+    netevent = 0;
+    netvmo = 0;
+    netbase = 0;
+    rx_lent = 0;
+    if (netrings) {
+        // the buffers lived in the vmo
+        netrings = NULL;
+        eth_buffers = NULL;
+        rx_buffers = NULL;
+    }
+}
+
+static mx_status_t netifc_open_fifo(void) {
+    mx_status_t r;
+    if ((r = mxio_ioctl(netfd, IOCTL_ETHERNET_GET_FIFO, NULL, 0, &netpipe, sizeof(netpipe))) < 0) {
+        netpipe = 0;
+        return r;
+    }
+    if ((netvmo = mx_vmo_create(NET_VMO_SIZE)) < 0) {
+        r = netvmo;
+        netvmo = 0;
+        goto fail;
+    }
+    if ((r = mx_process_map_vm(mx_process_self(), netvmo, 0, NET_VMO_SIZE, &netbase,
+                               MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE)) < 0) {
+        netbase = 0;
+        goto fail;
+    }
+    if ((netevent = mx_event_create(0)) < 0) {
+        r = netevent;
+        netevent = 0;
+        goto fail;
+    }
+
+    eth_fifo_rings_t* rings = (eth_fifo_rings_t*)netbase;
+    rx_consumed = 0;
+    rx_avail = 0;
+    tx_avail = 0;
+    tx_reclaimed = 0;
+
+    mx_handle_t h[2];
+    if ((h[0] = mx_handle_duplicate(netvmo, MX_RIGHT_SAME_RIGHTS)) < 0) {
+        r = h[0];
+        goto fail;
+    }
+    if ((h[1] = mx_handle_duplicate(netevent, MX_RIGHT_SAME_RIGHTS)) < 0) {
+        mx_handle_close(h[0]);
+        r = h[1];
+        goto fail;
+    }
+    eth_fifo_attach_t msg = { 0 };
+    if ((r = mx_msgpipe_write(netpipe, &msg, sizeof(msg), h, 2, 0)) < 0) {
+        mx_handle_close(h[0]);
+        mx_handle_close(h[1]);
+        goto fail;
+    }
+    mx_signals_state_t pending;
+    if ((r = mx_handle_wait_one(netpipe, MX_SIGNAL_READABLE | MX_SIGNAL_PEER_CLOSED,
+                                MX_TIME_INFINITE, &pending)) < 0) {
+        goto fail;
+    }
+    uint32_t sz = sizeof(msg);
+    if ((r = mx_msgpipe_read(netpipe, &msg, &sz, NULL, NULL, 0)) < 0) {
+        goto fail;
+    }
+    if ((r = msg.status) < 0) {
+        goto fail;
+    }
+
+    netrings = rings;
+    eth_buffers = NULL;
+    rx_buffers = NULL;
+    rx_lent = 0;
+    for (uint32_t n = 0; n < NET_RX_SLOTS; n++) {
+        eth_buffer_t* eb = (void*)(netbase + NET_SLOTS_OFF + n * NET_SLOT_SIZE);
+        eb->magic = ETH_RX_BUFFER_MAGIC;
+        eb->next = rx_buffers;
+        rx_buffers = eb;
+    }
+    for (uint32_t n = 0; n < NET_TX_SLOTS; n++) {
+        eth_buffer_t* eb = (void*)(netbase + NET_SLOTS_OFF + (NET_RX_SLOTS + n) * NET_SLOT_SIZE);
+        eb->magic = ETH_BUFFER_MAGIC;
+        eb->next = eth_buffers;
+        eth_buffers = eb;
+    }
+    netifc_refill_rx();
+    return NO_ERROR;
+
+fail:
+    netifc_close_fifo();
+    return r;
+}
+
+static void netifc_alloc_legacy(void) {
+    for (int i = 0; i < (NET_LEGACY_RX + NET_LEGACY_TX); i++) {
+        void* buffer;
+        if (posix_memalign(&buffer, NET_SLOT_SIZE, NET_SLOT_SIZE) == 0) {
+            eth_buffer_t* eb = buffer;
+            eb->magic = (i < NET_LEGACY_RX) ? ETH_RX_BUFFER_MAGIC : ETH_BUFFER_MAGIC;
+            eth_put_buffer(eb->data);
+        }
+    }
+}
+
 static mx_status_t netifc_open_cb(int dirfd, const char* fn, void* cookie) {
     printf("netifc: ? /dev/class/ethernet/%s\n", fn);
 
@@ -138,15 +452,11 @@ static mx_status_t netifc_open_cb(int dirfd, const char* fn, void* cookie) {
     }
 
     ip6_init(netmac);
-    for (int i = 0; i < 8; i++) {
-        char* buffer = malloc(sizeof(eth_buffer_t) + ETH_BUFFER_SIZE + 32);
-        buffer = (char*)((((uintptr_t)buffer) + 31) & (~31));
-        if (buffer) {
-            eth_buffer_t* eb = (eth_buffer_t*)buffer;
-            eb->magic = ETH_BUFFER_MAGIC;
-            eth_put_buffer(buffer + sizeof(eth_buffer_t));
-        }
+    if (netifc_open_fifo() == NO_ERROR) {
+        // stop polling
+        return 1;
     }
+    netifc_alloc_legacy();
 
     // stop polling
     return 1;
@@ -163,7 +473,18 @@ int netifc_open(void) {
     return (status < 0) ? -1 : 0;
 }
 
+int netifc_open_loopback(void) {
+    static const uint8_t mac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+    memcpy(netmac, mac, sizeof(netmac));
+    ip6_init(netmac);
+    netifc_alloc_legacy();
+    netloop = true;
+    return 0;
+}
+
 void netifc_close(void) {
+    netloop = false;
+    netifc_close_fifo();
     close(netfd);
     netfd = -1;
 }
@@ -172,20 +493,96 @@ int netifc_active(void) {
     return (netfd >= 0);
 }
 
+// Hands a frame to the stack, returning true if the stack kept its buffer.
+static bool netifc_recv(eth_buffer_t* buf, void* data, size_t len) {
+#if DROP_PACKETS
+    rxc++;
+    if ((random() % DROP_PACKETS) == 0) {
+        printf("rx drop %d\n", rxc);
+        return false;
+    }
+#endif
+    rx_buffer = buf;
+    rx_held = false;
+    eth_recv(data, len);
+    rx_buffer = NULL;
+    return rx_held;
+}
+
+static int netifc_poll_fifo(void) {
+    for (;;) {
+        mx_object_signal(netevent, ETH_FIFO_SIGNAL_DONE, 0);
+
+        // hand each received frame up, then give all of the buffers
+        // the stack didn't keep (or replacements for those it did)
+        // back to the device at once
+        uint32_t used = __atomic_load_n(&netrings->rx.used, __ATOMIC_ACQUIRE);
+        while (rx_consumed != used) {
+            eth_fifo_entry_t* e = netrings->rx.entries + (rx_consumed & (ETH_FIFO_RING_SIZE - 1));
+            eth_buffer_t* buf = (eth_buffer_t*)(uintptr_t)e->cookie;
+            if ((e->flags & ETH_FIFO_FLAG_ERROR) ||
+                !netifc_recv(buf, (void*)(netbase + e->offset), e->length)) {
+                buf->next = rx_buffers;
+                rx_buffers = buf;
+            }
+            rx_consumed++;
+        }
+        netifc_refill_rx();
+        netifc_reclaim_tx();
+
+        mx_time_t timeout = MX_TIME_INFINITE;
+        if (net_timer) {
+            mx_time_t now = mx_current_time();
+            if (now > net_timer) {
+                break;
+            }
+            timeout = net_timer - now + MX_MSEC(1);
+        }
+        mx_handle_t handles[2] = { netevent, netpipe };
+        mx_signals_t signals[2] = { ETH_FIFO_SIGNAL_DONE, MX_SIGNAL_PEER_CLOSED };
+        mx_signals_state_t states[2] = {};
+        mx_status_t r = mx_handle_wait_many(2, handles, signals, timeout, NULL, states);
+        if ((r < 0) && (r != ERR_TIMED_OUT)) {
+            return -1;
+        }
+        if (states[1].satisfied & MX_SIGNAL_PEER_CLOSED) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
 int netifc_poll(void) {
     uint8_t buffer[2048];
     mx_status_t r;
 
+    if (netrings) {
+        return netifc_poll_fifo();
+    }
+
     for (;;) {
-        while ((r = read(netfd, buffer, sizeof(buffer))) > 0) {
-#if DROP_PACKETS
-            rxc++;
-            if ((random() % DROP_PACKETS) == 0) {
-                printf("rx drop %d\n", rxc);
-                continue;
+        for (;;) {
+            // read straight into a pool buffer so the stack can keep
+            // the frame; only fall back to copying through the stack
+            // buffer if it's holding on to all of them
+            eth_buffer_t* buf = rx_buffers;
+            uint8_t* data = buffer;
+            size_t len = sizeof(buffer);
+            if (buf != NULL) {
+                rx_buffers = buf->next;
+                data = buf->data + NET_RX_HEADROOM;
+                len = ETH_BUFFER_SIZE;
+            }
+            r = read(netfd, data, len);
+            if ((r <= 0) || !netifc_recv(buf, data, r)) {
+                if (buf != NULL) {
+                    buf->next = rx_buffers;
+                    rx_buffers = buf;
+                }
+            }
+            if (r <= 0) {
+                break;
             }
-#endif
-            eth_recv(buffer, r);
         }
         if (errno == ENOTCONN) {
             return -1;
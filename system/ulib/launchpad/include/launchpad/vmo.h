@@ -15,6 +15,8 @@ mx_handle_t launchpad_vmo_from_mem(const void* data, size_t len);
 // These functions return ERR_IO to indicate an error in the POSIXish
 // underlying calls, meaning errno has been set with a POSIX-style error.
 // Other errors are verbatim from the mx_vm_object_* calls.
+// If the file lives in a filesystem page cache the vmo returned is
+// shared with it: it is not writable and may be larger than the file.
 mx_handle_t launchpad_vmo_from_fd(int fd);
 mx_handle_t launchpad_vmo_from_file(const char* filename);
 
@@ -8,6 +8,7 @@
 #include <fcntl.h>
 #include <limits.h>
 #include <magenta/syscalls.h>
+#include <mxio/io.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -46,7 +47,19 @@ mx_handle_t launchpad_vmo_from_fd(int fd) {
     uint64_t size = st.st_size;
     uint64_t offset = 0;
 
-    mx_handle_t vmo = mx_vmo_create(size);
+    // If the filesystem keeps the whole file in a page cache vmo,
+    // starting at the beginning of it, share that instead of reading
+    // the file into a new one.
+    mx_handle_t vmo;
+    size_t vmo_off, vmo_len;
+    if (mxio_get_vmo(fd, MXIO_MMAP_FLAG_READ | MXIO_MMAP_FLAG_EXEC,
+                     &vmo, &vmo_off, &vmo_len) == NO_ERROR) {
+        if ((vmo_off == 0) && (vmo_len >= size))
+            return vmo;
+        mx_handle_close(vmo);
+    }
+
+    vmo = mx_vmo_create(size);
     if (vmo < 0)
         return vmo;
 
@@ -18,18 +18,31 @@ typedef struct {
     list_node_t node;
     mx_handle_t h;
     uint32_t flags;
+    uint32_t pending;
+    uint64_t key;
     void* cb;
     void* cookie;
 } handler_t;
 
-#define FLAG_DISCONNECTED 1
+// a worker thread is currently running callbacks for this handler
+#define FLAG_BUSY 1
+// peer closed was observed, close once pending messages are drained
+#define FLAG_CLOSED 2
+
+// Handlers are looked up by a never-reused key rather than
+// by pointer, so a stale port packet that races with the
+// handler being disconnected on another worker thread finds
+// nothing instead of freed memory.
+#define HANDLER_HASH_BITS 6
+#define HANDLER_BUCKETS (1 << HANDLER_HASH_BITS)
 
 struct mxio_dispatcher {
     mtx_t lock;
-    list_node_t list;
+    list_node_t hash[HANDLER_BUCKETS];
+    uint64_t next_key;
     mx_handle_t ioport;
     mxio_dispatcher_cb_t cb;
-    thrd_t t;
+    bool started;
 };
 
 static void mxio_dispatcher_destroy(mxio_dispatcher_t* md) {
@@ -37,48 +50,37 @@ static void mxio_dispatcher_destroy(mxio_dispatcher_t* md) {
     free(md);
 }
 
-static void destroy_handler(mxio_dispatcher_t* md, handler_t* handler) {
+static handler_t* find_handler(mxio_dispatcher_t* md, uint64_t key) {
+    handler_t* handler;
+    list_for_every_entry (md->hash + (key & (HANDLER_BUCKETS - 1)), handler, handler_t, node) {
+        if (handler->key == key) {
+            return handler;
+        }
+    }
+    return NULL;
+}
+
+static void disconnect_handler(mxio_dispatcher_t* md, handler_t* handler) {
+    // once out of the hash, any events still queued for this
+    // handler on the port will be dropped by the workers
     mtx_lock(&md->lock);
     list_delete(&handler->node);
     mtx_unlock(&md->lock);
-    free(handler);
-}
 
-static void disconnect_handler(mxio_dispatcher_t* md, handler_t* handler) {
-    // close handle, so we get no further messages
+    xprintf("handler(%x) done\n", handler->h);
     mx_handle_close(handler->h);
-
-    // send a synthetic message so we know when it's safe to destroy
-    mx_io_packet_t packet;
-    packet.hdr.key = (uint64_t)(uintptr_t)handler;
-    packet.signals = MX_SIGNAL_SIGNALED;
-    mx_port_queue(md->ioport, &packet, sizeof(packet));
-
-    // flag so we know to ignore further events
-    handler->flags |= FLAG_DISCONNECTED;
+    free(handler);
 }
 
-static int mxio_dispatcher_thread(void* _md) {
-    mxio_dispatcher_t* md = _md;
+// Run callbacks for a handler until all the work that was
+// posted for it is consumed.  Called with the lock held and
+// FLAG_BUSY set, returns with the lock released.
+static void handler_service(mxio_dispatcher_t* md, handler_t* handler) {
     mx_status_t r;
-
-again:
     for (;;) {
-        mx_io_packet_t packet;
-        if ((r = mx_port_wait(md->ioport, &packet, sizeof(packet))) < 0) {
-            printf("dispatcher: ioport wait failed %d\n", r);
-            break;
-        }
-        handler_t* handler = (void*)(uintptr_t)packet.hdr.key;
-        if (handler->flags & FLAG_DISCONNECTED) {
-            // handler is awaiting gc
-            // ignore events for it until we get the synthetic "destroy" event
-            if (packet.signals & MX_SIGNAL_SIGNALED) {
-                destroy_handler(md, handler);
-            }
-            continue;
-        }
-        if (packet.signals & MX_SIGNAL_READABLE) {
+        if (handler->pending) {
+            handler->pending--;
+            mtx_unlock(&md->lock);
             if ((r = md->cb(handler->h, handler->cb, handler->cookie)) != 0) {
                 if (r == ERR_DISPATCHER_NO_WORK) {
                     printf("mxio: dispatcher found no work to do!\n");
@@ -88,19 +90,59 @@ again:
                         md->cb(0, handler->cb, handler->cookie);
                     }
                     disconnect_handler(md, handler);
-                    continue;
+                    return;
                 }
             }
-        }
-        if (packet.signals & MX_SIGNAL_PEER_CLOSED) {
+            mtx_lock(&md->lock);
+        } else if (handler->flags & FLAG_CLOSED) {
+            mtx_unlock(&md->lock);
             // synthesize a close
             md->cb(0, handler->cb, handler->cookie);
             disconnect_handler(md, handler);
+            return;
+        } else {
+            handler->flags &= ~FLAG_BUSY;
+            mtx_unlock(&md->lock);
+            return;
         }
     }
+}
+
+static int mxio_dispatcher_thread(void* _md) {
+    mxio_dispatcher_t* md = _md;
+    mx_status_t r;
+
+    for (;;) {
+        mx_io_packet_t packet;
+        if ((r = mx_port_wait(md->ioport, &packet, sizeof(packet))) < 0) {
+            printf("dispatcher: ioport wait failed %d\n", r);
+            break;
+        }
+        mtx_lock(&md->lock);
+        handler_t* handler = find_handler(md, packet.hdr.key);
+        if (handler == NULL) {
+            // handler was disconnected, ignore leftover events for it
+            mtx_unlock(&md->lock);
+            continue;
+        }
+        if (packet.signals & MX_SIGNAL_READABLE) {
+            handler->pending++;
+        }
+        if (packet.signals & MX_SIGNAL_PEER_CLOSED) {
+            handler->flags |= FLAG_CLOSED;
+        }
+        if (handler->flags & FLAG_BUSY) {
+            // another worker owns this handler and will
+            // pick up the work we just posted for it, which
+            // keeps messages on one pipe strictly in order
+            mtx_unlock(&md->lock);
+            continue;
+        }
+        handler->flags |= FLAG_BUSY;
+        handler_service(md, handler);
+    }
 
     printf("dispatcher: FATAL ERROR, EXITING\n");
-    mxio_dispatcher_destroy(md);
     return NO_ERROR;
 }
 
@@ -110,36 +152,56 @@ mx_status_t mxio_dispatcher_create(mxio_dispatcher_t** out, mxio_dispatcher_cb_t
         return ERR_NO_MEMORY;
     }
     xprintf("mxio_dispatcher_create: %p\n", md);
-    list_initialize(&md->list);
+    for (unsigned n = 0; n < HANDLER_BUCKETS; n++) {
+        list_initialize(md->hash + n);
+    }
     mtx_init(&md->lock, mtx_plain);
     if ((md->ioport = mx_port_create(0u)) < 0) {
+        mx_status_t r = md->ioport;
         free(md);
-        return md->ioport;
+        return r;
     }
+    md->next_key = 1;
     md->cb = cb;
     *out = md;
     return NO_ERROR;
 }
 
-mx_status_t mxio_dispatcher_start(mxio_dispatcher_t* md, const char* name) {
-    mx_status_t r;
+mx_status_t mxio_dispatcher_start_pool(mxio_dispatcher_t* md, const char* name, uint32_t count) {
+    mx_status_t r = NO_ERROR;
+    if (count == 0) {
+        return ERR_INVALID_ARGS;
+    }
     mtx_lock(&md->lock);
-    if (md->t == NULL) {
-        if (thrd_create_with_name(&md->t, mxio_dispatcher_thread, md, name) != thrd_success) {
-            mxio_dispatcher_destroy(md);
+    if (md->started) {
+        mtx_unlock(&md->lock);
+        return ERR_BAD_STATE;
+    }
+    for (uint32_t n = 0; n < count; n++) {
+        thrd_t t;
+        if (thrd_create_with_name(&t, mxio_dispatcher_thread, md, name) != thrd_success) {
             r = ERR_NO_RESOURCES;
-        } else {
-            thrd_detach(md->t);
-            r = NO_ERROR;
+            break;
         }
-    } else {
-        r = ERR_BAD_STATE;
+        thrd_detach(t);
+        md->started = true;
     }
     mtx_unlock(&md->lock);
     return r;
 }
 
+mx_status_t mxio_dispatcher_start(mxio_dispatcher_t* md, const char* name) {
+    mx_status_t r = mxio_dispatcher_start_pool(md, name, 1);
+    if (r == ERR_NO_RESOURCES) {
+        mxio_dispatcher_destroy(md);
+    }
+    return r;
+}
+
 void mxio_dispatcher_run(mxio_dispatcher_t* md) {
+    mtx_lock(&md->lock);
+    md->started = true;
+    mtx_unlock(&md->lock);
     mxio_dispatcher_thread(md);
 }
 
@@ -152,12 +214,14 @@ mx_status_t mxio_dispatcher_add(mxio_dispatcher_t* md, mx_handle_t h, void* cb,
     }
     handler->h = h;
     handler->flags = 0;
+    handler->pending = 0;
     handler->cb = cb;
     handler->cookie = cookie;
 
     mtx_lock(&md->lock);
-    list_add_tail(&md->list, &handler->node);
-    if ((r = mx_port_bind(md->ioport, (uint64_t)(uintptr_t)handler, h,
+    handler->key = md->next_key++;
+    list_add_tail(md->hash + (handler->key & (HANDLER_BUCKETS - 1)), &handler->node);
+    if ((r = mx_port_bind(md->ioport, handler->key, h,
                              MX_SIGNAL_READABLE | MX_SIGNAL_PEER_CLOSED)) < 0) {
         list_delete(&handler->node);
     }
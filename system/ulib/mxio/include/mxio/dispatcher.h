@@ -29,7 +29,22 @@ mx_status_t mxio_dispatcher_create(mxio_dispatcher_t** out, mxio_dispatcher_cb_t
 // create a thread for a dispatcher and start it running
 mx_status_t mxio_dispatcher_start(mxio_dispatcher_t* md, const char* name);
 
+// create count threads for a dispatcher and start them all running
+// on the same set of handles.
+//
+// Messages from any one handle are delivered one at a time and in
+// order, but callbacks for different handles may run concurrently,
+// so the handler must protect any state shared between handles.
+//
+// If a thread cannot be created, ERR_NO_RESOURCES is returned and the
+// threads already started keep running.  The dispatcher is not destroyed,
+// so the caller may still serve it with mxio_dispatcher_run().
+mx_status_t mxio_dispatcher_start_pool(mxio_dispatcher_t* md, const char* name,
+                                       uint32_t count);
+
 // run the dispatcher loop on the current thread, never to return
+// (may be combined with mxio_dispatcher_start_pool() to add the
+// current thread to the pool)
 void mxio_dispatcher_run(mxio_dispatcher_t* md);
 
 // add a pipe and handler to a dispatcher
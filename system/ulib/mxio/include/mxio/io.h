@@ -43,6 +43,11 @@
 #define MXIO_EVT_ERROR MX_SIGNAL_SIGNAL2
 #define MXIO_EVT_ALL (MXIO_EVT_READABLE | MXIO_EVT_WRITABLE | MXIO_EVT_ERROR)
 
+// access requested from mxio_get_vmo()
+#define MXIO_MMAP_FLAG_READ  (1u << 0)
+#define MXIO_MMAP_FLAG_WRITE (1u << 1)
+#define MXIO_MMAP_FLAG_EXEC  (1u << 2)
+
 __BEGIN_CDECLS
 
 // wait until one or more events are pending
@@ -51,6 +56,12 @@ mx_status_t mxio_wait_fd(int fd, uint32_t events, uint32_t* pending, mx_time_t t
 // invoke a raw mxio ioctl
 ssize_t mxio_ioctl(int fd, int op, const void* in_buf, size_t in_len, void* out_buf, size_t out_len);
 
+// obtain a vmo backing the file open on fd, if the underlying
+// filesystem provides one.  The file's contents start at *off within
+// the vmo and the vmo covers *len bytes of it.  The vmo is shared with
+// the filesystem, so later writes to the file are visible through it.
+mx_status_t mxio_get_vmo(int fd, uint32_t flags, mx_handle_t* vmo, size_t* off, size_t* len);
+
 // create a pipe, installing one half in a fd, returning the other
 // for transport to another process
 mx_status_t mxio_pipe_half(mx_handle_t* handle, uint32_t* type);
@@ -32,7 +32,8 @@ __BEGIN_CDECLS
 #define MXRIO_READ_AT      0x0000000c
 #define MXRIO_WRITE_AT     0x0000000d
 #define MXRIO_RENAME       0x0000000f
-#define MXRIO_NUM_OPS      15
+#define MXRIO_MMAP         0x00000010
+#define MXRIO_NUM_OPS      17
 
 #define MXRIO_OP(n)        ((n) & 0xFFFF)
 #define MXRIO_REPLY_PIPE   0x01000000
@@ -41,7 +42,8 @@ __BEGIN_CDECLS
     "status", "close", "clone", "open", \
     "misc", "read", "write", "seek", \
     "stat", "readdir", "ioctl", "unlink", \
-    "read_at", "write_at", "rename", }
+    "read_at", "write_at", "unused", "rename", \
+    "mmap", }
 
 typedef struct mxrio_msg mxrio_msg_t;
 
@@ -103,6 +105,7 @@ struct mxrio_msg {
 // IOCTL     out_len    opcode   <in_bytes>        0           <out_bytes>     -
 // UNLINK    0          0        <name>            0           -               -
 // RENAME    0          0        <name1>0<name2>0  0           -               -
+// MMAP      flags      0        -                 length      -               vmohandle
 //
 // proposed:
 //
@@ -110,12 +113,15 @@ struct mxrio_msg {
 // MKDIR     0          0        <name>            0           -               -
 // SYMLINK   namelen    0        <name><path>      0           -               -
 // READLINK  maxreply   0        -                 0           <path>          -
-// MMAP      flags      offset   <uint64:len>      offset      -               vmohandle
 // FLUSH     0          0        -                 0           -               -
 // SYNC      0          0        -                 0           -               -
 // LINK*     0          0        <name>            0           -               -
 //
 // on response arg32 is always mx_status, and may be positive for read/write calls
 // * handle[0] used to pass reference to target object
+//
+// MMAP flags are MXIO_MMAP_FLAG_*.  The vmo is the file's page cache:
+// bytes [0, length) of it are the file's contents and stay coherent with
+// reads and writes through the remoteio protocol.
 
 __END_CDECLS
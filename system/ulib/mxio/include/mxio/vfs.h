@@ -97,6 +97,12 @@ struct vnode_ops {
     mx_status_t (*rename)(vnode_t* olddir, vnode_t* newdir, const char* oldname, size_t oldlen, const char* newname, size_t newlen);
     // Renames the path at oldname in olddir to the path at newname in newdir.
     // Unlinks any prior newname if it already exists.
+
+    mx_status_t (*mmap)(vnode_t* vn, uint32_t flags, mx_handle_t* out, size_t* len);
+    // Returns a new handle to the vmo caching the contents of vn, with rights
+    // limited by flags (MXIO_MMAP_FLAG_*).  Bytes [0, *len) of the vmo hold
+    // the file.  The file must not shrink while the vmo is handed out.
+    // Optional; may be NULL if the filesystem has no page cache.
 };
 
 struct vnattr {
@@ -25,6 +25,14 @@ ssize_t mxio_default_write(mxio_t* io, const void* _data, size_t len) {
     return len;
 }
 
+ssize_t mxio_default_read_at(mxio_t* io, void* _data, size_t len, off_t offset) {
+    return ERR_NOT_SUPPORTED;
+}
+
+ssize_t mxio_default_write_at(mxio_t* io, const void* _data, size_t len, off_t offset) {
+    return ERR_NOT_SUPPORTED;
+}
+
 off_t mxio_default_seek(mxio_t* io, off_t offset, int whence) {
     return ERR_NOT_SUPPORTED;
 }
@@ -54,9 +62,15 @@ ssize_t mxio_default_ioctl(mxio_t* io, uint32_t op, const void* in_buf,
     return ERR_NOT_SUPPORTED;
 }
 
+mx_status_t mxio_default_get_vmo(mxio_t* io, uint32_t flags, mx_handle_t* out, size_t* off, size_t* len) {
+    return ERR_NOT_SUPPORTED;
+}
+
 static mxio_ops_t mx_null_ops = {
     .read = mxio_default_read,
+    .read_at = mxio_default_read_at,
     .write = mxio_default_write,
+    .write_at = mxio_default_write_at,
     .seek = mxio_default_seek,
     .misc = mxio_default_misc,
     .close = mxio_default_close,
@@ -64,6 +78,7 @@ static mxio_ops_t mx_null_ops = {
     .clone = mxio_default_clone,
     .wait = mxio_default_wait,
     .ioctl = mxio_default_ioctl,
+    .get_vmo = mxio_default_get_vmo,
 };
 
 mxio_t* mxio_null_create(void) {
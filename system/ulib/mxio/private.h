@@ -35,6 +35,7 @@ typedef struct mxio_ops {
     mx_status_t (*clone)(mxio_t* io, mx_handle_t* out_handles, uint32_t* out_types);
     mx_status_t (*wait)(mxio_t* io, uint32_t events, uint32_t* pending, mx_time_t timeout);
     ssize_t (*ioctl)(mxio_t* io, uint32_t op, const void* in_buf, size_t in_len, void* out_buf, size_t out_len);
+    mx_status_t (*get_vmo)(mxio_t* io, uint32_t flags, mx_handle_t* out, size_t* off, size_t* len);
 } mxio_ops_t;
 
 // mxio_t flags
@@ -138,6 +139,7 @@ mx_status_t mxio_default_open(mxio_t* io, const char* path, int32_t flags, uint3
 mx_handle_t mxio_default_clone(mxio_t* io, mx_handle_t* handles, uint32_t* types);
 mx_status_t mxio_default_wait(mxio_t* io, uint32_t events, uint32_t* pending, mx_time_t timeout);
 ssize_t mxio_default_ioctl(mxio_t* io, uint32_t op, const void* in_buf, size_t in_len, void* out_buf, size_t out_len);
+mx_status_t mxio_default_get_vmo(mxio_t* io, uint32_t flags, mx_handle_t* out, size_t* off, size_t* len);
 
 void __mxio_startup_handles_init(uint32_t num, mx_handle_t handles[],
                                  uint32_t handle_info[])
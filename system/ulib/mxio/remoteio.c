@@ -37,6 +37,12 @@ struct mxrio {
     // TODO: replace with reply-pipes to allow
     // true multithreaded io
     mtx_t lock;
+
+    // page cache vmo of the remote file, once the file has been mapped
+    // bytes [0, vmo_len) of the file are known to be backed by it
+    mx_handle_t vmo;
+    size_t vmo_len;
+    uint64_t vmo_size;
 };
 
 static const char* _opnames[] = MXRIO_OPNAMES;
@@ -397,8 +403,76 @@ static ssize_t mxrio_read(mxio_t* io, void* _data, size_t len) {
     return read_common(MXRIO_READ, io, _data, len, 0);
 }
 
+static mx_status_t mxrio_get_vmo(mxio_t* io, uint32_t flags, mx_handle_t* out, size_t* off, size_t* len) {
+    mxrio_t* rio = (mxrio_t*)io;
+    mxrio_msg_t msg;
+    mx_status_t r;
+
+    memset(&msg, 0, MXRIO_HDR_SZ);
+    msg.op = MXRIO_MMAP;
+    msg.arg = flags;
+
+    if ((r = mxrio_txn(rio, &msg)) < 0) {
+        return r;
+    }
+    if (msg.hcount != 1) {
+        discard_handles(msg.handle, msg.hcount);
+        return ERR_IO;
+    }
+    *out = msg.handle[0];
+    *off = 0;
+    *len = msg.arg2.off;
+
+    // keep a readable copy for mxrio_read_at()
+    if (flags & MXIO_MMAP_FLAG_READ) {
+        mtx_lock(&rio->lock);
+        if (rio->vmo <= 0) {
+            mx_handle_t vmo = mx_handle_duplicate(msg.handle[0], MX_RIGHT_SAME_RIGHTS);
+            if (vmo > 0) {
+                if (mx_vmo_get_size(vmo, &rio->vmo_size) < 0) {
+                    mx_handle_close(vmo);
+                } else {
+                    rio->vmo = vmo;
+                    rio->vmo_len = msg.arg2.off;
+                }
+            }
+        }
+        mtx_unlock(&rio->lock);
+    }
+    return NO_ERROR;
+}
+
+// Once a file has been mapped, positioned reads are served straight
+// out of its page cache vmo, saving the rpc and a copy.  Asking for
+// the vmo makes the server fill it, so it is never requested just for
+// reads.  Files behind such a vmo never shrink, so any range that is
+// known to exist stays valid.  Reads past the known range go through
+// READ_AT and their replies extend it.
 static ssize_t mxrio_read_at(mxio_t* io, void* _data, size_t len, off_t offset) {
-    return read_common(MXRIO_READ_AT, io, _data, len, offset);
+    mxrio_t* rio = (mxrio_t*)io;
+
+    mtx_lock(&rio->lock);
+    mx_handle_t vmo = rio->vmo;
+    size_t known = rio->vmo_len;
+    mtx_unlock(&rio->lock);
+
+    if ((vmo > 0) && (offset >= 0) && (len <= known) && ((size_t)offset <= (known - len))) {
+        return mx_vmo_read(vmo, _data, offset, len);
+    }
+
+    ssize_t r = read_common(MXRIO_READ_AT, io, _data, len, offset);
+    if ((vmo > 0) && (r > 0)) {
+        uint64_t end = offset + r;
+        mtx_lock(&rio->lock);
+        if (end > rio->vmo_size) {
+            end = rio->vmo_size;
+        }
+        if (end > rio->vmo_len) {
+            rio->vmo_len = end;
+        }
+        mtx_unlock(&rio->lock);
+    }
+    return r;
 }
 
 static off_t mxrio_seek(mxio_t* io, off_t offset, int whence) {
@@ -434,6 +508,11 @@ static mx_status_t mxrio_close(mxio_t* io) {
     mx_handle_t h = rio->h;
     rio->h = 0;
     mx_handle_close(h);
+    if (rio->vmo > 0) {
+        h = rio->vmo;
+        rio->vmo = 0;
+        mx_handle_close(h);
+    }
     if (rio->e > 0) {
         h = rio->e;
         rio->e = 0;
@@ -616,6 +695,7 @@ static mxio_ops_t mx_remote_ops = {
     .clone = mxrio_clone,
     .wait = mxrio_wait,
     .ioctl = mxrio_ioctl,
+    .get_vmo = mxrio_get_vmo,
 };
 
 mxio_t* mxio_remote_create(mx_handle_t h, mx_handle_t e) {
@@ -342,6 +342,16 @@ ssize_t mxio_ioctl(int fd, int op, const void* in_buf, size_t in_len, void* out_
     return r;
 }
 
+mx_status_t mxio_get_vmo(int fd, uint32_t flags, mx_handle_t* vmo, size_t* off, size_t* len) {
+    mxio_t* io;
+    if ((io = fd_to_io(fd)) == NULL) {
+        return ERR_BAD_HANDLE;
+    }
+    mx_status_t r = io->ops->get_vmo(io, flags, vmo, off, len);
+    mxio_release(io);
+    return r;
+}
+
 mx_status_t mxio_wait_fd(int fd, uint32_t events, uint32_t* pending, mx_time_t timeout) {
     mxio_t* io;
     if ((io = fd_to_io(fd)) == NULL) {
@@ -490,6 +500,34 @@ ssize_t write(int fd, const void* buf, size_t count) {
     return r;
 }
 
+ssize_t pread(int fd, void* buf, size_t count, off_t ofs) {
+    if (buf == NULL) {
+        return ERRNO(EINVAL);
+    }
+
+    mxio_t* io = fd_to_io(fd);
+    if (io == NULL) {
+        return ERRNO(EBADF);
+    }
+    ssize_t r = STATUS(io->ops->read_at(io, buf, count, ofs));
+    mxio_release(io);
+    return r;
+}
+
+ssize_t pwrite(int fd, const void* buf, size_t count, off_t ofs) {
+    if (buf == NULL) {
+        return ERRNO(EINVAL);
+    }
+
+    mxio_t* io = fd_to_io(fd);
+    if (io == NULL) {
+        return ERRNO(EBADF);
+    }
+    ssize_t r = STATUS(io->ops->write_at(io, buf, count, ofs));
+    mxio_release(io);
+    return r;
+}
+
 int close(int fd) {
     mtx_lock(&mxio_lock);
     if ((fd < 0) || (fd >= MAX_MXIO_FD) || (mxio_fdtab[fd] == NULL)) {
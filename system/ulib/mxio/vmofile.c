@@ -41,6 +41,25 @@ static ssize_t vmofile_read(mxio_t* io, void* data, size_t len) {
     return mx_vmo_read(vf->vmo, data, at, len);
 }
 
+static ssize_t vmofile_read_at(mxio_t* io, void* data, size_t len, off_t at) {
+    vmofile_t* vf = (vmofile_t*)io;
+
+    // make sure we're within the file's bounds
+    if ((at < 0) || ((mx_off_t)at > (vf->end - vf->off))) {
+        return ERR_INVALID_ARGS;
+    }
+
+    // adjust to vmo offset
+    at += vf->off;
+
+    // clip length to file bounds
+    if (len > (vf->end - at)) {
+        len = vf->end - at;
+    }
+
+    return mx_vmo_read(vf->vmo, data, at, len);
+}
+
 static off_t vmofile_seek(mxio_t* io, off_t offset, int whence) {
     vmofile_t* vf = (vmofile_t*)io;
     mtx_lock(&vf->lock);
@@ -101,9 +120,30 @@ static mx_status_t vmofile_misc(mxio_t* io, uint32_t op, uint32_t maxreply, void
     }
 }
 
+static mx_status_t vmofile_get_vmo(mxio_t* io, uint32_t flags, mx_handle_t* out, size_t* off, size_t* len) {
+    vmofile_t* vf = (vmofile_t*)io;
+    if (flags & MXIO_MMAP_FLAG_WRITE) {
+        return ERR_ACCESS_DENIED;
+    }
+    mx_rights_t rights = MX_RIGHT_DUPLICATE | MX_RIGHT_TRANSFER | MX_RIGHT_READ | MX_RIGHT_MAP;
+    if (flags & MXIO_MMAP_FLAG_EXEC) {
+        rights |= MX_RIGHT_EXECUTE;
+    }
+    mx_handle_t h = mx_handle_duplicate(vf->vmo, rights);
+    if (h < 0) {
+        return h;
+    }
+    *out = h;
+    *off = vf->off;
+    *len = vf->end - vf->off;
+    return NO_ERROR;
+}
+
 static mxio_ops_t vmofile_ops = {
     .read = vmofile_read,
+    .read_at = vmofile_read_at,
     .write = mxio_default_write,
+    .write_at = mxio_default_write_at,
     .seek = vmofile_seek,
     .misc = vmofile_misc,
     .close = vmofile_close,
@@ -111,6 +151,7 @@ static mxio_ops_t vmofile_ops = {
     .clone = mxio_default_clone,
     .wait = mxio_default_wait,
     .ioctl = mxio_default_ioctl,
+    .get_vmo = vmofile_get_vmo,
 };
 
 mxio_t* mxio_vmofile_create(mx_handle_t h, mx_off_t off, mx_off_t len) {
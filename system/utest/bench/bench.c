@@ -0,0 +1,660 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <unistd.h>
+
+#include <launchpad/launchpad.h>
+#include <magenta/processargs.h>
+#include <magenta/syscalls.h>
+#include <mxio/util.h>
+
+// Syscall and IPC microbenchmarks.
+//
+// Each benchmark is a function that performs an operation n times.
+// The harness first doubles n until one call takes at least
+// BATCH_TIME, so the cost of reading the clock disappears into the
+// batch, then times that batch SAMPLES times after a warm up run.
+// Every sample gives one per-operation time, and the report is the
+// distribution of those: min, median, 90th and 99th percentile, max,
+// mean and standard deviation, all in nanoseconds.
+//
+// With -j the results are printed as one JSON object per line, for
+// tools that track them from build to build.
+//
+// The process benchmarks run this binary again: "bench --echo" echoes
+// messages on the pipe it is given, "bench --exit" exits at once.
+
+#define DEFAULT_SAMPLES 100
+#define BATCH_TIME MX_MSEC(2)
+#define MAX_BATCH (1u << 24)
+
+#define MSG_SIZE 64
+#define VMO_PAGES 16
+#define RIO_FILE "/tmp/bench-rio"
+#define RIO_SIZE 4096
+
+#ifndef PAGE_SIZE
+#define PAGE_SIZE 4096
+#endif
+
+static const char* self_path;
+
+// ---- syscalls and handles
+
+static int run_syscall_null(uint32_t n) {
+    for (uint32_t i = 0; i < n; i++) {
+        mx_syscall_test_0();
+    }
+    return 0;
+}
+
+static int run_handle_create_close(uint32_t n) {
+    for (uint32_t i = 0; i < n; i++) {
+        mx_handle_t h = mx_event_create(0);
+        if (h < 0) {
+            return h;
+        }
+        mx_handle_close(h);
+    }
+    return 0;
+}
+
+static int run_handle_duplicate_close(uint32_t n) {
+    mx_handle_t h = mx_event_create(0);
+    if (h < 0) {
+        return h;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        mx_handle_t dup = mx_handle_duplicate(h, MX_RIGHT_SAME_RIGHTS);
+        if (dup < 0) {
+            mx_handle_close(h);
+            return dup;
+        }
+        mx_handle_close(dup);
+    }
+    mx_handle_close(h);
+    return 0;
+}
+
+// ---- message pipes
+
+static mx_handle_t pipes[2];
+static thrd_t echo_thread;
+static mx_handle_t echo_process;
+
+// read from h and write it back until the other end goes away
+static int echo_loop(mx_handle_t h) {
+    char buf[MSG_SIZE];
+    for (;;) {
+        mx_status_t r = mx_handle_wait_one(h, MX_SIGNAL_READABLE | MX_SIGNAL_PEER_CLOSED,
+                                           MX_TIME_INFINITE, NULL);
+        if (r < 0) {
+            return r;
+        }
+        uint32_t sz = sizeof(buf);
+        r = mx_msgpipe_read(h, buf, &sz, NULL, NULL, 0);
+        if (r < 0) {
+            // peer closed, or something worse
+            break;
+        }
+        if ((r = mx_msgpipe_write(h, buf, sz, NULL, 0, 0)) < 0) {
+            return r;
+        }
+    }
+    mx_handle_close(h);
+    return 0;
+}
+
+static int echo_thread_entry(void* arg) {
+    return echo_loop(pipes[1]);
+}
+
+static int run_msgpipe_roundtrip(uint32_t n) {
+    char buf[MSG_SIZE];
+    memset(buf, 0x5a, sizeof(buf));
+    for (uint32_t i = 0; i < n; i++) {
+        mx_status_t r = mx_msgpipe_write(pipes[0], buf, sizeof(buf), NULL, 0, 0);
+        if (r < 0) {
+            return r;
+        }
+        r = mx_handle_wait_one(pipes[0], MX_SIGNAL_READABLE, MX_TIME_INFINITE, NULL);
+        if (r < 0) {
+            return r;
+        }
+        uint32_t sz = sizeof(buf);
+        if ((r = mx_msgpipe_read(pipes[0], buf, &sz, NULL, NULL, 0)) < 0) {
+            return r;
+        }
+    }
+    return 0;
+}
+
+static int run_msgpipe_write_read(uint32_t n) {
+    char buf[MSG_SIZE];
+    memset(buf, 0x5a, sizeof(buf));
+    for (uint32_t i = 0; i < n; i++) {
+        mx_status_t r = mx_msgpipe_write(pipes[0], buf, sizeof(buf), NULL, 0, 0);
+        if (r < 0) {
+            return r;
+        }
+        uint32_t sz = sizeof(buf);
+        if ((r = mx_msgpipe_read(pipes[1], buf, &sz, NULL, NULL, 0)) < 0) {
+            return r;
+        }
+    }
+    return 0;
+}
+
+static int setup_pipe(void) {
+    return mx_msgpipe_create(pipes, 0);
+}
+
+static void teardown_pipe(void) {
+    mx_handle_close(pipes[0]);
+    mx_handle_close(pipes[1]);
+}
+
+static int setup_pingpong_thread(void) {
+    mx_status_t r = mx_msgpipe_create(pipes, 0);
+    if (r < 0) {
+        return r;
+    }
+    if (thrd_create_with_name(&echo_thread, echo_thread_entry, NULL, "bench-echo") != thrd_success) {
+        teardown_pipe();
+        return ERR_NO_RESOURCES;
+    }
+    return 0;
+}
+
+static void teardown_pingpong_thread(void) {
+    // the echo thread closes its end when it sees ours go
+    mx_handle_close(pipes[0]);
+    thrd_join(echo_thread, NULL);
+}
+
+static int setup_pingpong_process(void) {
+    mx_status_t r = mx_msgpipe_create(pipes, 0);
+    if (r < 0) {
+        return r;
+    }
+    const char* argv[] = { self_path, "--echo" };
+    uint32_t id = MX_HND_INFO(MX_HND_TYPE_USER0, 0);
+    echo_process = launchpad_launch_mxio_etc(argv[0], 2, argv, NULL, 1, &pipes[1], &id);
+    if (echo_process < 0) {
+        mx_handle_close(pipes[0]);
+        return echo_process;
+    }
+    return 0;
+}
+
+static void teardown_pingpong_process(void) {
+    mx_handle_close(pipes[0]);
+    mx_handle_wait_one(echo_process, MX_SIGNAL_SIGNALED, MX_TIME_INFINITE, NULL);
+    mx_handle_close(echo_process);
+}
+
+// ---- futexes
+
+// 0: the waker's turn, 1: the wakee's turn, 2: stop
+static int futex_word;
+static thrd_t futex_thread;
+
+static int futex_thread_entry(void* arg) {
+    for (;;) {
+        int v = __atomic_load_n(&futex_word, __ATOMIC_ACQUIRE);
+        if (v == 2) {
+            return 0;
+        }
+        if (v == 0) {
+            mx_futex_wait(&futex_word, 0, MX_TIME_INFINITE);
+            continue;
+        }
+        __atomic_store_n(&futex_word, 0, __ATOMIC_RELEASE);
+        mx_futex_wake(&futex_word, 1);
+    }
+}
+
+// one operation is a wake of the other thread and a wake back
+static int run_futex_wake(uint32_t n) {
+    for (uint32_t i = 0; i < n; i++) {
+        __atomic_store_n(&futex_word, 1, __ATOMIC_RELEASE);
+        mx_futex_wake(&futex_word, 1);
+        while (__atomic_load_n(&futex_word, __ATOMIC_ACQUIRE) == 1) {
+            mx_futex_wait(&futex_word, 1, MX_TIME_INFINITE);
+        }
+    }
+    return 0;
+}
+
+static int setup_futex(void) {
+    futex_word = 0;
+    if (thrd_create_with_name(&futex_thread, futex_thread_entry, NULL, "bench-futex") != thrd_success) {
+        return ERR_NO_RESOURCES;
+    }
+    return 0;
+}
+
+static void teardown_futex(void) {
+    __atomic_store_n(&futex_word, 2, __ATOMIC_RELEASE);
+    mx_futex_wake(&futex_word, 1);
+    thrd_join(futex_thread, NULL);
+}
+
+// ---- ports
+
+typedef struct {
+    mx_packet_header_t hdr;
+    uint64_t payload[4];
+} bench_packet_t;
+
+#define PORT_BURST 32
+
+static mx_handle_t port;
+static thrd_t port_thread;
+static uint32_t port_remaining;
+
+static int setup_port(void) {
+    port = mx_port_create(0u);
+    return (port < 0) ? port : 0;
+}
+
+static void teardown_port(void) {
+    mx_handle_close(port);
+}
+
+// bursts of packets queued and drained on one thread
+static int run_port_queue_wait(uint32_t n) {
+    bench_packet_t pkt = {};
+    while (n > 0) {
+        uint32_t burst = (n < PORT_BURST) ? n : PORT_BURST;
+        for (uint32_t i = 0; i < burst; i++) {
+            pkt.hdr.key = i;
+            mx_status_t r = mx_port_queue(port, &pkt, sizeof(pkt));
+            if (r < 0) {
+                return r;
+            }
+        }
+        for (uint32_t i = 0; i < burst; i++) {
+            mx_status_t r = mx_port_wait(port, &pkt, sizeof(pkt));
+            if (r < 0) {
+                return r;
+            }
+        }
+        n -= burst;
+    }
+    return 0;
+}
+
+static int port_producer(void* arg) {
+    bench_packet_t pkt = {};
+    uint32_t n = port_remaining;
+    for (uint32_t i = 0; i < n; i++) {
+        pkt.hdr.key = i;
+        mx_status_t r = mx_port_queue(port, &pkt, sizeof(pkt));
+        if (r < 0) {
+            return r;
+        }
+    }
+    return 0;
+}
+
+// one thread queueing, this one waiting
+static int run_port_cross_thread(uint32_t n) {
+    port_remaining = n;
+    if (thrd_create_with_name(&port_thread, port_producer, NULL, "bench-port") != thrd_success) {
+        return ERR_NO_RESOURCES;
+    }
+    bench_packet_t pkt;
+    mx_status_t r = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if ((r = mx_port_wait(port, &pkt, sizeof(pkt))) < 0) {
+            break;
+        }
+    }
+    int ret;
+    thrd_join(port_thread, &ret);
+    return (r < 0) ? r : ret;
+}
+
+// ---- vmos
+
+static mx_handle_t vmo;
+
+static int setup_vmo(void) {
+    vmo = mx_vmo_create(VMO_PAGES * PAGE_SIZE);
+    return (vmo < 0) ? vmo : 0;
+}
+
+static void teardown_vmo(void) {
+    mx_handle_close(vmo);
+}
+
+static int map_touch_unmap(mx_handle_t h, bool touch) {
+    uintptr_t ptr;
+    mx_status_t r = mx_process_map_vm(mx_process_self(), h, 0, VMO_PAGES * PAGE_SIZE, &ptr,
+                                      MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE);
+    if (r < 0) {
+        return r;
+    }
+    if (touch) {
+        for (size_t off = 0; off < VMO_PAGES * PAGE_SIZE; off += PAGE_SIZE) {
+            *(volatile uint8_t*)(ptr + off) = 1;
+        }
+    }
+    return mx_process_unmap_vm(mx_process_self(), ptr, 0);
+}
+
+static int run_vmo_map_unmap(uint32_t n) {
+    for (uint32_t i = 0; i < n; i++) {
+        mx_status_t r = map_touch_unmap(vmo, false);
+        if (r < 0) {
+            return r;
+        }
+    }
+    return 0;
+}
+
+// the pages stay committed, so this is the cost of mapping them in
+static int run_vmo_map_fault_unmap(uint32_t n) {
+    for (uint32_t i = 0; i < n; i++) {
+        mx_status_t r = map_touch_unmap(vmo, true);
+        if (r < 0) {
+            return r;
+        }
+    }
+    return 0;
+}
+
+// and this includes allocating and zeroing them
+static int run_vmo_create_fault(uint32_t n) {
+    for (uint32_t i = 0; i < n; i++) {
+        mx_handle_t h = mx_vmo_create(VMO_PAGES * PAGE_SIZE);
+        if (h < 0) {
+            return h;
+        }
+        mx_status_t r = map_touch_unmap(h, true);
+        mx_handle_close(h);
+        if (r < 0) {
+            return r;
+        }
+    }
+    return 0;
+}
+
+// ---- processes
+
+static int run_process_spawn(uint32_t n) {
+    const char* argv[] = { self_path, "--exit" };
+    for (uint32_t i = 0; i < n; i++) {
+        mx_handle_t p = launchpad_launch_mxio(argv[0], 2, argv);
+        if (p < 0) {
+            return p;
+        }
+        mx_status_t r = mx_handle_wait_one(p, MX_SIGNAL_SIGNALED, MX_TIME_INFINITE, NULL);
+        mx_handle_close(p);
+        if (r < 0) {
+            return r;
+        }
+    }
+    return 0;
+}
+
+// ---- remote io, against memfs
+
+static int setup_rio(void) {
+    int fd = open(RIO_FILE, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return ERR_IO;
+    }
+    char buf[RIO_SIZE];
+    memset(buf, 0xa5, sizeof(buf));
+    ssize_t r = write(fd, buf, sizeof(buf));
+    close(fd);
+    return (r == (ssize_t)sizeof(buf)) ? 0 : ERR_IO;
+}
+
+static void teardown_rio(void) {
+    unlink(RIO_FILE);
+}
+
+static int run_rio_open_close(uint32_t n) {
+    for (uint32_t i = 0; i < n; i++) {
+        int fd = open(RIO_FILE, O_RDONLY);
+        if (fd < 0) {
+            return ERR_IO;
+        }
+        close(fd);
+    }
+    return 0;
+}
+
+static int run_rio_open_read_close(uint32_t n) {
+    char buf[RIO_SIZE];
+    for (uint32_t i = 0; i < n; i++) {
+        int fd = open(RIO_FILE, O_RDONLY);
+        if (fd < 0) {
+            return ERR_IO;
+        }
+        ssize_t r = read(fd, buf, sizeof(buf));
+        close(fd);
+        if (r != (ssize_t)sizeof(buf)) {
+            return ERR_IO;
+        }
+    }
+    return 0;
+}
+
+// ---- harness
+
+typedef struct bench {
+    const char* name;
+    int (*run)(uint32_t n);
+    int (*setup)(void);
+    void (*teardown)(void);
+} bench_t;
+
+static const bench_t benches[] = {
+    { "syscall_null", run_syscall_null, NULL, NULL },
+    { "handle_create_close", run_handle_create_close, NULL, NULL },
+    { "handle_duplicate_close", run_handle_duplicate_close, NULL, NULL },
+    { "msgpipe_write_read", run_msgpipe_write_read, setup_pipe, teardown_pipe },
+    { "msgpipe_pingpong_thread", run_msgpipe_roundtrip, setup_pingpong_thread, teardown_pingpong_thread },
+    { "msgpipe_pingpong_process", run_msgpipe_roundtrip, setup_pingpong_process, teardown_pingpong_process },
+    { "futex_wake_roundtrip", run_futex_wake, setup_futex, teardown_futex },
+    { "port_queue_wait", run_port_queue_wait, setup_port, teardown_port },
+    { "port_cross_thread", run_port_cross_thread, setup_port, teardown_port },
+    { "vmo_map_unmap", run_vmo_map_unmap, setup_vmo, teardown_vmo },
+    { "vmo_map_fault_unmap", run_vmo_map_fault_unmap, setup_vmo, teardown_vmo },
+    { "vmo_create_fault", run_vmo_create_fault, NULL, NULL },
+    { "process_spawn", run_process_spawn, NULL, NULL },
+    { "rio_open_close", run_rio_open_close, setup_rio, teardown_rio },
+    { "rio_open_read_close", run_rio_open_read_close, setup_rio, teardown_rio },
+};
+
+typedef struct result {
+    uint32_t batch;
+    uint32_t samples;
+    double min, p50, p90, p99, max, mean, stddev;
+} result_t;
+
+static int cmp_double(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x < y) ? -1 : (x > y);
+}
+
+// nearest rank
+static double percentile(const double* sorted, uint32_t count, uint32_t pct) {
+    uint32_t rank = (pct * count + 99) / 100;
+    return sorted[(rank > 0) ? (rank - 1) : 0];
+}
+
+static int time_batch(const bench_t* b, uint32_t n, mx_time_t* elapsed) {
+    mx_time_t t0 = mx_current_time();
+    int r = b->run(n);
+    *elapsed = mx_current_time() - t0;
+    return r;
+}
+
+static int measure(const bench_t* b, uint32_t samples, result_t* res) {
+    mx_time_t elapsed;
+    int r;
+
+    // warm up and find a batch long enough to time
+    uint32_t n = 1;
+    for (;;) {
+        if ((r = time_batch(b, n, &elapsed)) < 0) {
+            return r;
+        }
+        if ((elapsed >= BATCH_TIME) || (n >= MAX_BATCH)) {
+            break;
+        }
+        n *= 2;
+    }
+
+    double* t = malloc(samples * sizeof(double));
+    if (t == NULL) {
+        return ERR_NO_MEMORY;
+    }
+    double sum = 0;
+    for (uint32_t i = 0; i < samples; i++) {
+        if ((r = time_batch(b, n, &elapsed)) < 0) {
+            free(t);
+            return r;
+        }
+        t[i] = (double)elapsed / n;
+        sum += t[i];
+    }
+
+    res->batch = n;
+    res->samples = samples;
+    res->mean = sum / samples;
+    double var = 0;
+    for (uint32_t i = 0; i < samples; i++) {
+        var += (t[i] - res->mean) * (t[i] - res->mean);
+    }
+    res->stddev = (samples > 1) ? sqrt(var / (samples - 1)) : 0;
+
+    qsort(t, samples, sizeof(double), cmp_double);
+    res->min = t[0];
+    res->p50 = percentile(t, samples, 50);
+    res->p90 = percentile(t, samples, 90);
+    res->p99 = percentile(t, samples, 99);
+    res->max = t[samples - 1];
+    free(t);
+    return 0;
+}
+
+static void report(const char* name, const result_t* res, bool json) {
+    if (json) {
+        printf("{\"name\":\"%s\",\"unit\":\"ns\",\"batch\":%u,\"samples\":%u,"
+               "\"min\":%.1f,\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"max\":%.1f,"
+               "\"mean\":%.1f,\"stddev\":%.1f}\n",
+               name, res->batch, res->samples, res->min, res->p50, res->p90, res->p99,
+               res->max, res->mean, res->stddev);
+    } else {
+        printf("%-26s %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f %8u\n", name,
+               res->min, res->p50, res->p90, res->p99, res->max, res->stddev, res->batch);
+    }
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "usage: bench [-j] [-s samples] [name...]\n"
+            "  -j          one JSON object per result\n"
+            "  -s samples  timed batches per benchmark (default %u)\n"
+            "  name        only run benchmarks whose names start with this\n"
+            "benchmarks:\n", DEFAULT_SAMPLES);
+    for (size_t i = 0; i < countof(benches); i++) {
+        fprintf(stderr, "  %s\n", benches[i].name);
+    }
+}
+
+static bool selected(const char* name, int argc, char** argv, int first) {
+    if (first >= argc) {
+        return true;
+    }
+    for (int i = first; i < argc; i++) {
+        if (!strncmp(name, argv[i], strlen(argv[i]))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char** argv) {
+    self_path = argv[0];
+
+    // the other ends of the process benchmarks
+    if ((argc == 2) && !strcmp(argv[1], "--exit")) {
+        return 0;
+    }
+    if ((argc == 2) && !strcmp(argv[1], "--echo")) {
+        mx_handle_t h = mxio_get_startup_handle(MX_HND_INFO(MX_HND_TYPE_USER0, 0));
+        if (h < 0) {
+            fprintf(stderr, "bench: no pipe to echo on\n");
+            return -1;
+        }
+        return echo_loop(h);
+    }
+
+    bool json = false;
+    uint32_t samples = DEFAULT_SAMPLES;
+    int first = 1;
+    while (first < argc && argv[first][0] == '-') {
+        if (!strcmp(argv[first], "-j")) {
+            json = true;
+            first++;
+        } else if (!strcmp(argv[first], "-s") && (first + 1 < argc)) {
+            samples = strtoul(argv[first + 1], NULL, 0);
+            first += 2;
+        } else {
+            usage();
+            return -1;
+        }
+    }
+    if (samples == 0) {
+        usage();
+        return -1;
+    }
+
+    if (!json) {
+        printf("%-26s %10s %10s %10s %10s %10s %10s %8s\n", "ns per op", "min", "p50",
+               "p90", "p99", "max", "stddev", "batch");
+    }
+
+    int failed = 0;
+    for (size_t i = 0; i < countof(benches); i++) {
+        const bench_t* b = &benches[i];
+        if (!selected(b->name, argc, argv, first)) {
+            continue;
+        }
+        int r = b->setup ? b->setup() : 0;
+        if (r < 0) {
+            fprintf(stderr, "bench: %s: setup failed: %d\n", b->name, r);
+            failed++;
+            continue;
+        }
+        result_t res;
+        r = measure(b, samples, &res);
+        if (b->teardown) {
+            b->teardown();
+        }
+        if (r < 0) {
+            fprintf(stderr, "bench: %s: failed: %d\n", b->name, r);
+            failed++;
+            continue;
+        }
+        report(b->name, &res, json);
+    }
+    return failed ? -1 : 0;
+}
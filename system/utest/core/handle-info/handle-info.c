@@ -2,6 +2,7 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -73,9 +74,55 @@ bool handle_rights_test(void) {
     END_TEST;
 }
 
+bool process_stats_test(void) {
+    BEGIN_TEST;
+
+    mx_info_process_stats_t before = {};
+    ASSERT_EQ(mx_object_get_info(mx_process_self(), MX_INFO_PROCESS_STATS, sizeof(before.rec),
+                                 &before, sizeof(before)), (mx_ssize_t)sizeof(before), "");
+    EXPECT_GE(before.rec.threads, 1u, "");
+    EXPECT_GE(before.rec.mapped_bytes, before.rec.committed_bytes, "");
+
+    // map 16 pages and commit 4 of them
+    const mx_size_t len = 16 * PAGE_SIZE;
+    mx_handle_t vmo = mx_vmo_create(len);
+    ASSERT_GT(vmo, 0, "");
+    uintptr_t ptr = 0;
+    ASSERT_EQ(mx_process_map_vm(mx_process_self(), vmo, 0, len, &ptr,
+                                MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE), NO_ERROR, "");
+    for (int n = 0; n < 4; n++) {
+        ((volatile char*)ptr)[n * PAGE_SIZE] = 1;
+    }
+
+    mx_info_process_stats_t after = {};
+    ASSERT_EQ(mx_object_get_info(mx_process_self(), MX_INFO_PROCESS_STATS, sizeof(after.rec),
+                                 &after, sizeof(after)), (mx_ssize_t)sizeof(after), "");
+    EXPECT_EQ(after.rec.regions, before.rec.regions + 1, "");
+    EXPECT_GE(after.rec.mapped_bytes, before.rec.mapped_bytes + len, "");
+    EXPECT_GE(after.rec.committed_bytes, before.rec.committed_bytes + 4 * PAGE_SIZE, "");
+
+    ASSERT_EQ(mx_process_unmap_vm(mx_process_self(), ptr, 0), NO_ERROR, "");
+    mx_handle_close(vmo);
+
+    END_TEST;
+}
+
+bool cpu_stats_test(void) {
+    BEGIN_TEST;
+
+    // only the root resource will do
+    mx_info_cpu_stats_t info = {};
+    EXPECT_LT(mx_object_get_info(mx_process_self(), MX_INFO_CPU_STATS, sizeof(info.rec[0]),
+                                 &info, sizeof(info)), 0, "cpu stats without the root resource");
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(handle_info_tests)
 RUN_TEST(handle_info_test)
 RUN_TEST(handle_rights_test)
+RUN_TEST(process_stats_test)
+RUN_TEST(cpu_stats_test)
 END_TEST_CASE(handle_info_tests)
 
 #ifndef BUILD_COMBINED_TESTS
@@ -44,8 +44,42 @@ bool threads_test(void) {
     END_TEST;
 }
 
+bool thread_stats_test(void) {
+    BEGIN_TEST;
+
+    const mx_size_t stack_size = 256u << 10;
+    mx_handle_t thread_stack_vmo = mx_vmo_create(stack_size);
+    ASSERT_GT(thread_stack_vmo, 0, "");
+
+    uintptr_t stack = 0u;
+    ASSERT_EQ(mx_process_map_vm(mx_process_self(), thread_stack_vmo, 0, stack_size, &stack,
+                                MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE), NO_ERROR, "");
+    ASSERT_EQ(mx_handle_close(thread_stack_vmo), NO_ERROR, "");
+
+    mxr_thread_t* thread = NULL;
+    ASSERT_EQ(mxr_thread_create("test_thread", &thread), NO_ERROR, "");
+    ASSERT_EQ(mxr_thread_start(thread, stack, stack_size, test_thread_fn, NULL), NO_ERROR, "");
+
+    mx_handle_t handle = mxr_thread_get_handle(thread);
+    ASSERT_EQ(mx_handle_wait_one(handle, MX_SIGNAL_SIGNALED, MX_TIME_INFINITE, NULL), NO_ERROR, "");
+
+    // the thread spent its life asleep
+    mx_info_thread_stats_t info = {};
+    ASSERT_EQ(mx_object_get_info(handle, MX_INFO_THREAD_STATS, sizeof(info.rec), &info,
+                                 sizeof(info)), (mx_ssize_t)sizeof(info), "");
+    EXPECT_GE(info.rec.wait_time, MX_MSEC(90), "sleep not counted as waiting");
+    EXPECT_LT(info.rec.runtime, info.rec.wait_time, "");
+    EXPECT_GE(info.rec.context_switches, 1ULL, "");
+    EXPECT_LE(info.rec.preemptions, info.rec.context_switches, "");
+
+    mxr_thread_destroy(thread);
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(threads_tests)
 RUN_TEST(threads_test)
+RUN_TEST(thread_stats_test)
 END_TEST_CASE(threads_tests)
 
 #ifndef BUILD_COMBINED_TESTS
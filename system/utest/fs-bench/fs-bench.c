@@ -0,0 +1,166 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <unistd.h>
+
+#include <magenta/syscalls.h>
+
+// Multi-client filesystem throughput benchmark.
+//
+// Each client thread opens its own file (and so its own rpc
+// connection) in the target directory and reads or writes it
+// in IO_SIZE chunks for a fixed period.  Runs are repeated with
+// a doubling number of clients, so a filesystem that serves
+// requests concurrently shows throughput that scales.
+
+#define IO_SIZE (8 * 1024)
+#define FILE_SIZE (512 * 1024)
+#define MAX_CLIENTS 16
+
+typedef struct client {
+    thrd_t t;
+    int fd;
+    bool write;
+    mx_time_t deadline;
+    uint64_t ops;
+    int err;
+} client_t;
+
+static int client_thread(void* arg) {
+    client_t* c = arg;
+    char buf[IO_SIZE];
+    memset(buf, 0x5a, sizeof(buf));
+
+    off_t off = 0;
+    while (mx_current_time() < c->deadline) {
+        if (off == 0) {
+            if (lseek(c->fd, 0, SEEK_SET) != 0) {
+                c->err = -1;
+                return -1;
+            }
+        }
+        ssize_t r = c->write ? write(c->fd, buf, IO_SIZE) : read(c->fd, buf, IO_SIZE);
+        if (r != IO_SIZE) {
+            c->err = -1;
+            return -1;
+        }
+        c->ops++;
+        off = (off + IO_SIZE) % FILE_SIZE;
+    }
+    return 0;
+}
+
+static int make_file(const char* dir, unsigned n, char* path, size_t pathlen) {
+    snprintf(path, pathlen, "%s/fs-bench-%u", dir, n);
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "fs-bench: cannot create '%s'\n", path);
+        return -1;
+    }
+    char buf[IO_SIZE];
+    memset(buf, 0xa5, sizeof(buf));
+    for (unsigned off = 0; off < FILE_SIZE; off += IO_SIZE) {
+        if (write(fd, buf, IO_SIZE) != IO_SIZE) {
+            fprintf(stderr, "fs-bench: cannot fill '%s'\n", path);
+            close(fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+
+static int run(const char* dir, unsigned count, bool write, mx_time_t duration) {
+    client_t clients[MAX_CLIENTS];
+    char path[256];
+    int r = 0;
+
+    memset(clients, 0, sizeof(clients));
+    for (unsigned n = 0; n < count; n++) {
+        if ((clients[n].fd = make_file(dir, n, path, sizeof(path))) < 0) {
+            count = n;
+            r = -1;
+            goto done;
+        }
+        clients[n].write = write;
+    }
+
+    mx_time_t start = mx_current_time();
+    for (unsigned n = 0; n < count; n++) {
+        clients[n].deadline = start + duration;
+        if (thrd_create_with_name(&clients[n].t, client_thread, &clients[n],
+                                  "fs-bench-client") != thrd_success) {
+            fprintf(stderr, "fs-bench: cannot create thread\n");
+            // let the clients that did start finish up
+            count = n;
+            r = -1;
+            break;
+        }
+    }
+    uint64_t ops = 0;
+    for (unsigned n = 0; n < count; n++) {
+        thrd_join(clients[n].t, NULL);
+        if (clients[n].err) {
+            fprintf(stderr, "fs-bench: client %u io error\n", n);
+            r = -1;
+        }
+        ops += clients[n].ops;
+    }
+    mx_time_t elapsed = mx_current_time() - start;
+
+    uint64_t us = elapsed / 1000;
+    if (us == 0) {
+        us = 1;
+    }
+    printf("%-5s clients=%2u ops=%8llu %8llu ops/s %6llu KB/s\n",
+           write ? "write" : "read", count, ops,
+           ops * 1000000ULL / us, (ops * IO_SIZE / 1024) * 1000000ULL / us);
+
+done:
+    for (unsigned n = 0; n < count; n++) {
+        close(clients[n].fd);
+        snprintf(path, sizeof(path), "%s/fs-bench-%u", dir, n);
+        unlink(path);
+    }
+    return r;
+}
+
+int main(int argc, char** argv) {
+    const char* dir = "/data";
+    unsigned max = 8;
+    unsigned seconds = 2;
+
+    if (argc > 1) {
+        dir = argv[1];
+    }
+    if (argc > 2) {
+        max = strtoul(argv[2], NULL, 10);
+    }
+    if (argc > 3) {
+        seconds = strtoul(argv[3], NULL, 10);
+    }
+    if ((max == 0) || (max > MAX_CLIENTS) || (seconds == 0)) {
+        fprintf(stderr, "usage: fs-bench [ <dir> [ <max-clients> [ <seconds> ] ] ]\n"
+                "       max-clients may be at most %u\n", MAX_CLIENTS);
+        return -1;
+    }
+
+    printf("fs-bench: dir=%s io=%u file=%u duration=%us\n", dir, IO_SIZE, FILE_SIZE, seconds);
+    mx_time_t duration = seconds * 1000000000ULL;
+    for (unsigned count = 1; count <= max; count *= 2) {
+        if (run(dir, count, false, duration) < 0) {
+            return -1;
+        }
+    }
+    for (unsigned count = 1; count <= max; count *= 2) {
+        if (run(dir, count, true, duration) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
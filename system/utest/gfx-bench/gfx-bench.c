@@ -0,0 +1,154 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gfx/gfx.h>
+#include <gfx/pixel.h>
+#include <magenta/syscalls.h>
+
+// Pixel throughput benchmark for the gfx row kernels.
+//
+// Each operation is run over a 4K sized surface with every
+// implementation the cpu supports, and its output is checked
+// against the generic implementation's before the timings are
+// reported in megapixels per second.
+
+#define WIDTH 3840
+#define HEIGHT 2160
+#define PIXELS (WIDTH * HEIGHT)
+#define ITERS 8
+
+static const char* impl_names[GFX_PIXEL_IMPL_COUNT] = {
+    [GFX_PIXEL_IMPL_GENERIC] = "generic",
+    [GFX_PIXEL_IMPL_SSE2] = "sse2",
+    [GFX_PIXEL_IMPL_AVX2] = "avx2",
+    [GFX_PIXEL_IMPL_NEON] = "neon",
+};
+
+static uint32_t* src32;
+static uint32_t* dst32;
+static uint16_t* dst16;
+
+// reference output from the generic implementation
+static uint32_t* ref32;
+static uint16_t* ref16;
+
+static void fill_random(uint32_t* buf, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        uint32_t v = (uint32_t)rand() ^ ((uint32_t)rand() << 16);
+        // make sure the fully transparent and opaque cases show up
+        if (i % 7 == 0) {
+            v &= 0x00ffffff;
+        } else if (i % 11 == 0) {
+            v |= 0xff000000;
+        }
+        buf[i] = v;
+    }
+}
+
+static void op_fill(void) {
+    for (unsigned y = 0; y < HEIGHT; y++) {
+        gfx_pixel_fill32(dst32 + y * WIDTH, 0xff336699, WIDTH);
+    }
+}
+
+static void op_blend(void) {
+    for (unsigned y = 0; y < HEIGHT; y++) {
+        gfx_pixel_blend32(dst32 + y * WIDTH, src32 + y * WIDTH, WIDTH);
+    }
+}
+
+static void op_565(void) {
+    for (unsigned y = 0; y < HEIGHT; y++) {
+        gfx_pixel_argb8888_to_rgb565(dst16 + y * WIDTH, src32 + y * WIDTH, WIDTH);
+    }
+}
+
+static gfx_surface* surface;
+
+static void op_scroll(void) {
+    // scroll up by a text line's worth of rows
+    gfx_copyrect(surface, 0, 16, WIDTH, HEIGHT - 16, 0, 0);
+}
+
+typedef struct op {
+    const char* name;
+    void (*fn)(void);
+    bool check16;
+} op_t;
+
+static const op_t ops[] = {
+    { "fill", op_fill, false },
+    { "blend", op_blend, false },
+    { "565", op_565, true },
+    { "scroll", op_scroll, false },
+};
+
+static int run(const op_t* op, unsigned impl) {
+    // start every implementation from the same destination contents
+    memcpy(dst32, ref32, PIXELS * sizeof(uint32_t));
+    op->fn();
+    if (impl == GFX_PIXEL_IMPL_GENERIC) {
+        if (op->check16) {
+            memcpy(ref16, dst16, PIXELS * sizeof(uint16_t));
+        }
+    } else if (op->check16 ? memcmp(dst16, ref16, PIXELS * sizeof(uint16_t))
+                           : memcmp(dst32, ref32 + PIXELS, PIXELS * sizeof(uint32_t))) {
+        printf("%-8s %-8s MISMATCH\n", impl_names[impl], op->name);
+        return -1;
+    }
+    if (impl == GFX_PIXEL_IMPL_GENERIC && !op->check16) {
+        memcpy(ref32 + PIXELS, dst32, PIXELS * sizeof(uint32_t));
+    }
+
+    mx_time_t t0 = mx_current_time();
+    for (unsigned n = 0; n < ITERS; n++) {
+        op->fn();
+    }
+    mx_time_t t1 = mx_current_time();
+
+    uint64_t mpps = ((uint64_t)PIXELS * ITERS) / ((t1 - t0) / 1000 + 1);
+    printf("%-8s %-8s %6llu Mpix/s\n", impl_names[impl], op->name, mpps);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    src32 = malloc(PIXELS * sizeof(uint32_t));
+    dst32 = malloc(PIXELS * sizeof(uint32_t));
+    dst16 = malloc(PIXELS * sizeof(uint16_t));
+    ref32 = malloc(2 * PIXELS * sizeof(uint32_t));
+    ref16 = malloc(PIXELS * sizeof(uint16_t));
+    if (!src32 || !dst32 || !dst16 || !ref32 || !ref16) {
+        fprintf(stderr, "gfx-bench: out of memory\n");
+        return -1;
+    }
+    fill_random(src32, PIXELS);
+    fill_random(ref32, PIXELS);
+
+    surface = gfx_create_surface(dst32, WIDTH, HEIGHT, WIDTH, MX_PIXEL_FORMAT_ARGB_8888, 0);
+    if (surface == NULL) {
+        fprintf(stderr, "gfx-bench: cannot create surface\n");
+        return -1;
+    }
+
+    printf("gfx-bench: %ux%u, default implementation %s\n", WIDTH, HEIGHT, gfx_pixel_impl_name());
+
+    int r = 0;
+    for (size_t i = 0; i < countof(ops); i++) {
+        for (unsigned impl = 0; impl < GFX_PIXEL_IMPL_COUNT; impl++) {
+            if (!gfx_pixel_select(impl)) {
+                continue;
+            }
+            if (run(&ops[i], impl) < 0) {
+                r = -1;
+            }
+        }
+    }
+
+    gfx_surface_destroy(surface);
+    return r;
+}
@@ -0,0 +1,21 @@
+# Copyright 2016 The Fuchsia Authors. All rights reserved.
+# Use of this source code is governed by a BSD-style license that can be
+# found in the LICENSE file.
+
+LOCAL_DIR := $(GET_LOCAL_DIR)
+
+MODULE := $(LOCAL_DIR)
+
+MODULE_TYPE := userapp
+
+MODULE_SRCS += \
+    $(LOCAL_DIR)/inet6-bench.c
+
+MODULE_NAME := inet6-bench
+
+# inet6-bench runs over netifc.c's in-process loopback interface
+MODULE_STATIC_LIBS := ulib/inet6
+
+MODULE_LIBS := ulib/mxio ulib/magenta ulib/musl
+
+include make/module.mk
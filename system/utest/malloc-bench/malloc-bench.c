@@ -0,0 +1,269 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+#include <magenta/syscalls.h>
+
+// Multi-threaded malloc throughput and stress benchmark.
+//
+// Each worker thread runs one workload for a fixed period and counts
+// the malloc/free pairs it completes.  Runs are repeated with a
+// doubling number of workers, so an allocator whose threads contend
+// for locks shows throughput that fails to scale.
+//
+// Except in the small workload, every block is filled when allocated
+// and checked before it is freed, so the benchmark doubles as a
+// stress test: a block handed out twice, or overwritten by the
+// allocator, fails the run.
+//
+//   small:  allocate, touch and free one block of 16 to 256 bytes
+//   mixed:  replace random slots of a working set of SLOTS blocks,
+//           mostly small, some up to 4K and a few mapped on their own
+//   remote: blocks are allocated by one thread of a pair and freed
+//           by the other, passed through a ring
+
+#define SLOTS 1024
+#define RING 256
+#define MAX_WORKERS 16
+#define BIG_SIZE (256 * 1024)
+
+typedef struct worker worker_t;
+
+struct worker {
+    thrd_t t;
+    unsigned n;
+    mx_time_t deadline;
+    uint64_t ops;
+    int err;
+    uint32_t seed;
+    // remote: the ring this worker fills, read by its peer
+    worker_t* peer;
+    void* ring[RING];
+    uint32_t head;
+    uint32_t tail;
+    bool done;
+};
+
+static uint32_t rnd(worker_t* w) {
+    w->seed = w->seed * 1103515245 + 12345;
+    return w->seed >> 8;
+}
+
+// blocks carry their size in front of the fill
+static void* alloc_sized(size_t size, uint8_t tag) {
+    size_t* p = malloc(sizeof(size_t) + size);
+    if (p != NULL) {
+        *p = size;
+        memset(p + 1, tag, size);
+    }
+    return p;
+}
+
+static bool check_free_sized(void* block, uint8_t tag) {
+    size_t* p = block;
+    const uint8_t* b = (const uint8_t*)(p + 1);
+    for (size_t i = 0; i < *p; i++) {
+        if (b[i] != tag) {
+            return false;
+        }
+    }
+    free(p);
+    return true;
+}
+
+static int small_thread(void* arg) {
+    worker_t* w = arg;
+    while (mx_current_time() < w->deadline) {
+        for (unsigned i = 0; i < 256; i++) {
+            size_t size = 16 + (rnd(w) % 241);
+            volatile uint8_t* p = malloc(size);
+            if (p == NULL) {
+                w->err = -1;
+                return -1;
+            }
+            p[0] = (uint8_t)i;
+            p[size - 1] = (uint8_t)i;
+            free((void*)p);
+        }
+        w->ops += 256;
+    }
+    return 0;
+}
+
+static size_t mixed_size(worker_t* w) {
+    uint32_t r = rnd(w);
+    if ((r % 1024) == 0) {
+        return BIG_SIZE;
+    }
+    if ((r % 8) == 0) {
+        return 1 + (r % 4096);
+    }
+    return 1 + (r % 256);
+}
+
+static int mixed_thread(void* arg) {
+    worker_t* w = arg;
+    void** slots = calloc(SLOTS, sizeof(void*));
+    if (slots == NULL) {
+        w->err = -1;
+        return -1;
+    }
+    while ((mx_current_time() < w->deadline) && !w->err) {
+        for (unsigned i = 0; i < 256; i++) {
+            unsigned k = rnd(w) % SLOTS;
+            if ((slots[k] != NULL) && !check_free_sized(slots[k], (uint8_t)k)) {
+                slots[k] = NULL;
+                w->err = -1;
+                break;
+            }
+            if ((slots[k] = alloc_sized(mixed_size(w), (uint8_t)k)) == NULL) {
+                w->err = -1;
+                break;
+            }
+        }
+        w->ops += 256;
+    }
+    for (unsigned k = 0; k < SLOTS; k++) {
+        if ((slots[k] != NULL) && !check_free_sized(slots[k], (uint8_t)k)) {
+            w->err = -1;
+        }
+    }
+    free(slots);
+    return w->err;
+}
+
+// even workers allocate into their ring, odd ones drain their peer's
+static int remote_thread(void* arg) {
+    worker_t* w = arg;
+    if (w->n & 1) {
+        worker_t* src = w->peer;
+        for (;;) {
+            uint32_t tail = src->tail;
+            if (tail == __atomic_load_n(&src->head, __ATOMIC_ACQUIRE)) {
+                if (__atomic_load_n(&src->done, __ATOMIC_ACQUIRE) &&
+                    (tail == __atomic_load_n(&src->head, __ATOMIC_ACQUIRE))) {
+                    break;
+                }
+                thrd_yield();
+                continue;
+            }
+            void* p = src->ring[tail % RING];
+            if (!check_free_sized(p, (uint8_t)tail)) {
+                w->err = -1;
+            }
+            __atomic_store_n(&src->tail, tail + 1, __ATOMIC_RELEASE);
+            w->ops++;
+        }
+        return w->err;
+    }
+    while (mx_current_time() < w->deadline) {
+        uint32_t head = w->head;
+        if (head - __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE) == RING) {
+            thrd_yield();
+            continue;
+        }
+        void* p = alloc_sized(16 + (rnd(w) % 497), (uint8_t)head);
+        if (p == NULL) {
+            w->err = -1;
+            break;
+        }
+        w->ring[head % RING] = p;
+        __atomic_store_n(&w->head, head + 1, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&w->done, true, __ATOMIC_RELEASE);
+    return w->err;
+}
+
+typedef struct workload {
+    const char* name;
+    thrd_start_t fn;
+    unsigned min_workers;
+} workload_t;
+
+static const workload_t workloads[] = {
+    { "small", small_thread, 1 },
+    { "mixed", mixed_thread, 1 },
+    { "remote", remote_thread, 2 },
+};
+
+static int run(const workload_t* wl, unsigned count, mx_time_t duration) {
+    worker_t* workers = calloc(count, sizeof(worker_t));
+    if (workers == NULL) {
+        return -1;
+    }
+
+    int r = 0;
+    mx_time_t start = mx_current_time();
+    for (unsigned n = 0; n < count; n++) {
+        workers[n].n = n;
+        workers[n].seed = n + 1;
+        workers[n].deadline = start + duration;
+        workers[n].peer = &workers[n ^ 1];
+    }
+    unsigned started;
+    for (started = 0; started < count; started++) {
+        if (thrd_create_with_name(&workers[started].t, wl->fn, &workers[started],
+                                  "malloc-bench") != thrd_success) {
+            fprintf(stderr, "malloc-bench: cannot create thread\n");
+            r = -1;
+            break;
+        }
+    }
+    uint64_t ops = 0;
+    for (unsigned n = 0; n < started; n++) {
+        thrd_join(workers[n].t, NULL);
+        if (workers[n].err) {
+            fprintf(stderr, "malloc-bench: %s worker %u found a bad block\n", wl->name, n);
+            r = -1;
+        }
+        ops += workers[n].ops;
+    }
+    mx_time_t elapsed = mx_current_time() - start;
+    free(workers);
+
+    uint64_t us = elapsed / 1000;
+    if (us == 0) {
+        us = 1;
+    }
+    if (r == 0) {
+        printf("%-6s threads=%2u ops=%10llu %10llu ops/s %6llu ns/op/thread\n",
+               wl->name, count, ops, ops * 1000000ULL / us,
+               ops ? (elapsed * count) / ops : 0);
+    }
+    return r;
+}
+
+int main(int argc, char** argv) {
+    unsigned max = 8;
+    unsigned seconds = 2;
+
+    if (argc > 1) {
+        max = strtoul(argv[1], NULL, 10);
+    }
+    if (argc > 2) {
+        seconds = strtoul(argv[2], NULL, 10);
+    }
+    if ((max == 0) || (max > MAX_WORKERS) || (seconds == 0)) {
+        fprintf(stderr, "usage: malloc-bench [ <max-threads> [ <seconds> ] ]\n"
+                "       max-threads may be at most %u\n", MAX_WORKERS);
+        return -1;
+    }
+
+    printf("malloc-bench: duration=%us\n", seconds);
+    mx_time_t duration = seconds * 1000000000ULL;
+    for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++) {
+        for (unsigned count = workloads[i].min_workers; count <= max; count *= 2) {
+            if (run(&workloads[i], count, duration) < 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
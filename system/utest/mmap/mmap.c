@@ -0,0 +1,154 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <magenta/syscalls.h>
+#include <mxio/io.h>
+#include <unittest/unittest.h>
+
+// memfs keeps file data in a vmo, so /tmp exercises the whole path
+#define TEST_FILE "/tmp/mmap-test"
+
+static int create_file(const char* data, size_t len) {
+    unlink(TEST_FILE);
+    int fd = open(TEST_FILE, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        return fd;
+    if (write(fd, data, len) != (ssize_t)len) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool mmap_shared_read_test(void) {
+    BEGIN_TEST;
+
+    const char gold[] = "hello page cache";
+    int fd = create_file(gold, sizeof(gold));
+    ASSERT_GE(fd, 0, "could not create file");
+
+    char* ptr = mmap(NULL, PAGE_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    ASSERT_NEQ(ptr, MAP_FAILED, "mmap failed");
+    EXPECT_EQ(memcmp(ptr, gold, sizeof(gold)), 0, "mapping does not match file");
+
+    // writes through the fd are visible through the mapping
+    const char more[] = "more";
+    EXPECT_EQ(pwrite(fd, more, sizeof(more), 0), (ssize_t)sizeof(more), "pwrite failed");
+    EXPECT_EQ(memcmp(ptr, more, sizeof(more)), 0, "mapping is not coherent");
+
+    EXPECT_EQ(munmap(ptr, PAGE_SIZE), 0, "munmap failed");
+    close(fd);
+    unlink(TEST_FILE);
+    END_TEST;
+}
+
+static bool mmap_shared_write_test(void) {
+    BEGIN_TEST;
+
+    const char gold[] = "0123456789";
+    int fd = create_file(gold, sizeof(gold));
+    ASSERT_GE(fd, 0, "could not create file");
+
+    char* ptr = mmap(NULL, PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ASSERT_NEQ(ptr, MAP_FAILED, "mmap failed");
+    ptr[0] = 'X';
+
+    char buf[sizeof(gold)];
+    EXPECT_EQ(pread(fd, buf, sizeof(buf), 0), (ssize_t)sizeof(buf), "pread failed");
+    EXPECT_EQ(buf[0], 'X', "store through shared mapping was lost");
+
+    EXPECT_EQ(munmap(ptr, PAGE_SIZE), 0, "munmap failed");
+    close(fd);
+    unlink(TEST_FILE);
+    END_TEST;
+}
+
+static bool mmap_private_write_test(void) {
+    BEGIN_TEST;
+
+    const char gold[] = "0123456789";
+    int fd = create_file(gold, sizeof(gold));
+    ASSERT_GE(fd, 0, "could not create file");
+
+    char* ptr = mmap(NULL, PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    ASSERT_NEQ(ptr, MAP_FAILED, "mmap failed");
+    EXPECT_EQ(memcmp(ptr, gold, sizeof(gold)), 0, "mapping does not match file");
+    ptr[0] = 'X';
+
+    char buf[sizeof(gold)];
+    EXPECT_EQ(pread(fd, buf, sizeof(buf), 0), (ssize_t)sizeof(buf), "pread failed");
+    EXPECT_EQ(memcmp(buf, gold, sizeof(gold)), 0, "private store reached the file");
+
+    EXPECT_EQ(munmap(ptr, PAGE_SIZE), 0, "munmap failed");
+    close(fd);
+    unlink(TEST_FILE);
+    END_TEST;
+}
+
+static bool pread_cached_test(void) {
+    BEGIN_TEST;
+
+    const char gold[] = "abcdefgh";
+    int fd = create_file(gold, sizeof(gold));
+    ASSERT_GE(fd, 0, "could not create file");
+
+    char buf[2 * sizeof(gold)];
+    EXPECT_EQ(pread(fd, buf, sizeof(gold), 0), (ssize_t)sizeof(gold), "pread failed");
+    EXPECT_EQ(memcmp(buf, gold, sizeof(gold)), 0, "pread returned wrong data");
+
+    // data appended after the page cache was handed out
+    EXPECT_EQ(pwrite(fd, gold, sizeof(gold), sizeof(gold)), (ssize_t)sizeof(gold), "pwrite failed");
+    EXPECT_EQ(pread(fd, buf, sizeof(buf), 0), (ssize_t)sizeof(buf), "pread failed");
+    EXPECT_EQ(memcmp(buf + sizeof(gold), gold, sizeof(gold)), 0, "pread missed appended data");
+
+    // reads past EOF stay short
+    EXPECT_EQ(pread(fd, buf, sizeof(buf), sizeof(gold)), (ssize_t)sizeof(gold), "pread past EOF");
+
+    close(fd);
+    unlink(TEST_FILE);
+    END_TEST;
+}
+
+static bool get_vmo_test(void) {
+    BEGIN_TEST;
+
+    const char gold[] = "vmo";
+    int fd = create_file(gold, sizeof(gold));
+    ASSERT_GE(fd, 0, "could not create file");
+
+    mx_handle_t vmo;
+    size_t off, len;
+    ASSERT_EQ(mxio_get_vmo(fd, MXIO_MMAP_FLAG_READ, &vmo, &off, &len), NO_ERROR, "mxio_get_vmo failed");
+    EXPECT_EQ(len, sizeof(gold), "wrong length");
+
+    char buf[sizeof(gold)];
+    EXPECT_EQ(mx_vmo_read(vmo, buf, off, sizeof(buf)), (mx_ssize_t)sizeof(buf), "vmo read failed");
+    EXPECT_EQ(memcmp(buf, gold, sizeof(gold)), 0, "vmo does not match file");
+
+    // a read-only handle cannot be written
+    EXPECT_LT(mx_vmo_write(vmo, buf, off, sizeof(buf)), 0, "read-only vmo was writable");
+
+    mx_handle_close(vmo);
+    close(fd);
+    unlink(TEST_FILE);
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(mmap_tests)
+RUN_TEST(mmap_shared_read_test)
+RUN_TEST(mmap_shared_write_test)
+RUN_TEST(mmap_private_write_test)
+RUN_TEST(pread_cached_test)
+RUN_TEST(get_vmo_test)
+END_TEST_CASE(mmap_tests)
+
+int main(int argc, char** argv) {
+    return unittest_run_all_tests(argc, argv) ? 0 : -1;
+}
@@ -0,0 +1,120 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/param.h>
+
+#include <block-client/client.h>
+#include <magenta/syscalls.h>
+#include <magenta/types.h>
+#include <magenta/device/block.h>
+
+#include <mxio/io.h>
+
+#include "msd.h"
+
+// Sequential throughput benchmark.
+//
+// Moves BENCH_SIZE bytes from the start of the device through the block
+// fifo as BLOCK_FIFO_MAX_XFER sized requests, submitting them in batches
+// of a doubling depth.  With a depth of one the device idles between
+// requests; a driver that pipelines commands shows throughput rising
+// with depth until the bus or the media is the limit.
+//
+// Writing destroys the data at the start of the device, so it is only
+// done when asked for.
+
+#define BENCH_SIZE (16 * 1024 * 1024)
+#define MAX_DEPTH 64
+
+static mx_status_t bench_pass(block_client_t* client, uint32_t opcode, uint64_t size,
+                              uint32_t depth) {
+    block_fifo_request_t reqs[MAX_DEPTH];
+    for (uint64_t off = 0; off < size; ) {
+        uint32_t n = 0;
+        for (; (n < depth) && (off < size); n++) {
+            reqs[n].opcode = opcode;
+            reqs[n].length = MIN(size - off, BLOCK_FIFO_MAX_XFER);
+            reqs[n].vmo_offset = off;
+            reqs[n].dev_offset = off;
+            off += reqs[n].length;
+        }
+        mx_status_t status = block_client_transact(client, reqs, n);
+        if (status != NO_ERROR) {
+            return status;
+        }
+    }
+    return NO_ERROR;
+}
+
+static int bench_run(block_client_t* client, uint32_t opcode, uint64_t size) {
+    const char* what = (opcode == BLOCK_FIFO_OP_WRITE) ? "write" : "read";
+    for (uint32_t depth = 1; depth <= MAX_DEPTH; depth *= 2) {
+        mx_time_t start = mx_current_time();
+        mx_status_t status = bench_pass(client, opcode, size, depth);
+        mx_time_t elapsed = mx_current_time() - start;
+        if (status != NO_ERROR) {
+            printf("msd-bench: %s at depth %u failed: %d\n", what, depth, status);
+            return -1;
+        }
+        if (elapsed == 0) {
+            elapsed = 1;
+        }
+        printf("%-5s depth %2u: %8llu KB/s (%llu bytes in %llu us)\n", what, depth,
+               (size * 1000000000ull / elapsed) / 1024, size, elapsed / 1000);
+    }
+    return 0;
+}
+
+int msd_bench(const char* dev, bool write) {
+    int fd = open(dev, O_RDWR);
+    if (fd < 0) {
+        printf("msd-bench: cannot open '%s'\n", dev);
+        return -1;
+    }
+
+    mx_handle_t vmo = 0;
+    block_client_t* client = NULL;
+    int rc;
+
+    uint64_t blocks, blksize;
+    if (mxio_ioctl(fd, IOCTL_BLOCK_GET_SIZE, NULL, 0, &blocks, sizeof(blocks)) != sizeof(blocks) ||
+        mxio_ioctl(fd, IOCTL_BLOCK_GET_BLOCKSIZE, NULL, 0, &blksize, sizeof(blksize)) != sizeof(blksize)) {
+        printf("msd-bench: cannot get size of '%s'\n", dev);
+        rc = -1;
+        goto done;
+    }
+    uint64_t size = MIN(blocks * blksize, BENCH_SIZE);
+    size -= size % blksize;
+
+    if ((vmo = mx_vmo_create(size)) < 0) {
+        printf("msd-bench: out of memory\n");
+        rc = vmo;
+        goto done;
+    }
+    if ((rc = block_client_create(fd, vmo, &client)) < 0) {
+        printf("msd-bench: error %d setting up block fifo\n", rc);
+        goto done;
+    }
+
+    printf("msd-bench: %s, %llu bytes per pass\n", dev, size);
+    rc = bench_run(client, BLOCK_FIFO_OP_READ, size);
+    if ((rc == 0) && write) {
+        rc = bench_run(client, BLOCK_FIFO_OP_WRITE, size);
+    }
+
+done:
+    if (client) {
+        block_client_destroy(client);
+    }
+    if (vmo > 0) {
+        mx_handle_close(vmo);
+    }
+    close(fd);
+    return rc;
+}
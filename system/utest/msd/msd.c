@@ -11,6 +11,8 @@
 
 #include <mxio/io.h>
 
+#include "msd.h"
+
 // change this number to change how many bytes are being written/read
 #define TEST_LEN 1024
 
@@ -57,12 +59,21 @@ int write_read_pattern_test(int fd, const char* pattern, uint32_t length, uint32
     return memcmp(in, out, length);
 }
 
+#define MSD_DEVICE "/dev/class/pci/004/00:14:00/xhci_usb/usb_bus/usb-dev-002/usb_mass_storage"
+
 // writes first block two blocks full of lowercase letters in order, then reads to verify.
 // then writes them full of letters in reverse order and verifies.
+// "msd-test bench [-w] [device]" runs the throughput benchmark instead.
 int main(int argc, char** argv) {
+    if (argc > 1 && !strcmp(argv[1], "bench")) {
+        bool write = (argc > 2 && !strcmp(argv[2], "-w"));
+        int next = (write ? 3 : 2);
+        return msd_bench(argc > next ? argv[next] : MSD_DEVICE, write);
+    }
+
     printf("starting\n");
     int fd = 0;
-    fd = open("/dev/class/pci/004/00:14:00/xhci_usb/usb_bus/usb-dev-002/usb_mass_storage", O_RDWR);
+    fd = open(MSD_DEVICE, O_RDWR);
     if (fd < 0) {
         printf("msd_test: cannot open '%d'\n", fd);
         return -1;
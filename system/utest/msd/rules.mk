@@ -9,10 +9,13 @@ MODULE := $(LOCAL_DIR)
 MODULE_TYPE := userapp
 
 MODULE_SRCS += \
-    $(LOCAL_DIR)/msd.c
+    $(LOCAL_DIR)/msd.c \
+    $(LOCAL_DIR)/msd-bench.c
 
 MODULE_NAME := msd-test
 
+MODULE_STATIC_LIBS := ulib/block-client
+
 MODULE_LIBS := ulib/mxio ulib/magenta ulib/musl
 
 include make/module.mk
@@ -329,6 +329,253 @@ bool vmo_lookup_test() {
     END_TEST;
 }
 
+// residency of the first 8 pages, in the low bits of *bits
+static mx_status_t residency(mx_handle_t vmo, size_t size, uint8_t* bits) {
+    *bits = 0;
+    return mx_vmo_op_range(vmo, MX_VMO_OP_RESIDENCY, 0, size, bits, sizeof(*bits));
+}
+
+bool vmo_decommit_test() {
+    BEGIN_TEST;
+
+    mx_status_t status;
+    const size_t size = PAGE_SIZE * 4;
+
+    mx_handle_t vmo = mx_vmo_create(size);
+    EXPECT_LT(0, vmo, "vm_object_create");
+    uint8_t bits;
+    EXPECT_EQ(NO_ERROR, residency(vmo, size, &bits), "residency");
+    EXPECT_EQ(0u, bits, "nothing committed yet");
+
+    uintptr_t ptr;
+    status = mx_process_map_vm(mx_process_self(), vmo, 0, size, &ptr,
+                               MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE);
+    EXPECT_EQ(NO_ERROR, status, "vm_map");
+
+    // touch the first three pages through the mapping
+    volatile uint8_t* p = (volatile uint8_t*)ptr;
+    p[0] = 1;
+    p[PAGE_SIZE] = 2;
+    p[PAGE_SIZE * 2] = 3;
+    EXPECT_EQ(NO_ERROR, residency(vmo, size, &bits), "residency");
+    EXPECT_EQ(0x7u, bits, "touched pages committed");
+
+    // give back the middle one, and see zeroes where it was
+    status = mx_vmo_op_range(vmo, MX_VMO_OP_DECOMMIT, PAGE_SIZE, PAGE_SIZE, NULL, 0);
+    EXPECT_EQ(NO_ERROR, status, "decommit");
+    EXPECT_EQ(NO_ERROR, residency(vmo, size, &bits), "residency");
+    EXPECT_EQ(0x5u, bits, "decommitted page gone");
+    EXPECT_EQ(1u, p[0], "page before kept");
+    EXPECT_EQ(0u, p[PAGE_SIZE], "decommitted page reads zero");
+    EXPECT_EQ(3u, p[PAGE_SIZE * 2], "page after kept");
+
+    // decommit through the mapping
+    status = mx_process_op_vm(mx_process_self(), MX_VMO_OP_DECOMMIT, ptr, size);
+    EXPECT_EQ(NO_ERROR, status, "decommit mapping");
+    EXPECT_EQ(NO_ERROR, residency(vmo, size, &bits), "residency");
+    EXPECT_EQ(0u, bits, "all decommitted");
+    EXPECT_EQ(0u, p[PAGE_SIZE * 2], "decommitted mapping reads zero");
+
+    // only whole pages
+    status = mx_vmo_op_range(vmo, MX_VMO_OP_DECOMMIT, 1, PAGE_SIZE, NULL, 0);
+    EXPECT_EQ(ERR_INVALID_ARGS, status, "unaligned decommit");
+
+    // not while locked
+    status = mx_vmo_op_range(vmo, MX_VMO_OP_LOCK, 0, size, NULL, 0);
+    EXPECT_EQ(NO_ERROR, status, "lock");
+    status = mx_vmo_op_range(vmo, MX_VMO_OP_DECOMMIT, 0, size, NULL, 0);
+    EXPECT_EQ(ERR_BAD_STATE, status, "decommit locked vmo");
+    status = mx_vmo_op_range(vmo, MX_VMO_OP_UNLOCK, PAGE_SIZE, PAGE_SIZE, NULL, 0);
+    EXPECT_EQ(ERR_NOT_FOUND, status, "unlock of a range never locked");
+    status = mx_vmo_op_range(vmo, MX_VMO_OP_UNLOCK, 0, size, NULL, 0);
+    EXPECT_EQ(NO_ERROR, status, "unlock");
+    status = mx_vmo_op_range(vmo, MX_VMO_OP_UNLOCK, 0, size, NULL, 0);
+    EXPECT_EQ(ERR_NOT_FOUND, status, "second unlock");
+
+    // a lock only keeps its own range from being decommitted
+    status = mx_vmo_op_range(vmo, MX_VMO_OP_LOCK, 0, PAGE_SIZE, NULL, 0);
+    EXPECT_EQ(NO_ERROR, status, "lock first page");
+    status = mx_vmo_op_range(vmo, MX_VMO_OP_DECOMMIT, PAGE_SIZE, PAGE_SIZE, NULL, 0);
+    EXPECT_EQ(NO_ERROR, status, "decommit beside locked page");
+    status = mx_vmo_op_range(vmo, MX_VMO_OP_UNLOCK, 0, PAGE_SIZE, NULL, 0);
+    EXPECT_EQ(NO_ERROR, status, "unlock first page");
+
+    // not without write rights
+    mx_handle_t ro = mx_handle_duplicate(vmo, MX_RIGHT_READ | MX_RIGHT_TRANSFER);
+    EXPECT_LT(0, ro, "duplicate");
+    status = mx_vmo_op_range(ro, MX_VMO_OP_DECOMMIT, 0, size, NULL, 0);
+    EXPECT_EQ(ERR_ACCESS_DENIED, status, "decommit without write right");
+    mx_handle_close(ro);
+
+    status = mx_process_unmap_vm(mx_process_self(), ptr, 0);
+    EXPECT_EQ(NO_ERROR, status, "vm_unmap");
+    status = mx_handle_close(vmo);
+    EXPECT_EQ(NO_ERROR, status, "handle_close");
+
+    END_TEST;
+}
+
+bool vmo_residency_test() {
+    BEGIN_TEST;
+
+    mx_status_t status;
+    const size_t size = PAGE_SIZE * 20;
+    uint8_t bits[3];
+
+    mx_handle_t vmo = mx_vmo_create(size);
+    EXPECT_LT(0, vmo, "vm_object_create");
+
+    status = mx_vmo_op_range(vmo, MX_VMO_OP_COMMIT, PAGE_SIZE * 9, PAGE_SIZE * 2, NULL, 0);
+    EXPECT_EQ(NO_ERROR, status, "commit");
+
+    memset(bits, 0xff, sizeof(bits));
+    status = mx_vmo_op_range(vmo, MX_VMO_OP_RESIDENCY, 0, size, bits, sizeof(bits));
+    EXPECT_EQ(NO_ERROR, status, "residency");
+    EXPECT_EQ(0x00u, bits[0], "pages 0-7");
+    EXPECT_EQ(0x06u, bits[1], "pages 8-15");
+    EXPECT_EQ(0x00u, bits[2], "pages 16-19");
+
+    // the bitmap starts at the page holding the offset
+    status = mx_vmo_op_range(vmo, MX_VMO_OP_RESIDENCY, PAGE_SIZE * 9 + 1, 1, bits, 1);
+    EXPECT_EQ(NO_ERROR, status, "residency at an offset");
+    EXPECT_EQ(0x01u, bits[0], "one page");
+
+    status = mx_vmo_op_range(vmo, MX_VMO_OP_RESIDENCY, 0, size, bits, 2);
+    EXPECT_EQ(ERR_BUFFER_TOO_SMALL, status, "short bitmap");
+    status = mx_vmo_op_range(vmo, MX_VMO_OP_RESIDENCY, 0, size + 1, bits, sizeof(bits));
+    EXPECT_EQ(ERR_OUT_OF_RANGE, status, "out of range");
+
+    status = mx_handle_close(vmo);
+    EXPECT_EQ(NO_ERROR, status, "handle_close");
+
+    END_TEST;
+}
+
+bool vmo_prefetch_test() {
+    BEGIN_TEST;
+
+    mx_status_t status;
+    const size_t size = PAGE_SIZE * 8;
+
+    mx_handle_t vmo = mx_vmo_create(size);
+    EXPECT_LT(0, vmo, "vm_object_create");
+
+    // a range that is partly committed already
+    uint8_t c = 0x5a;
+    EXPECT_EQ(1, mx_vmo_write(vmo, &c, PAGE_SIZE * 2, 1), "touch page 2");
+    EXPECT_EQ(1, mx_vmo_write(vmo, &c, PAGE_SIZE * 5, 1), "touch page 5");
+
+    status = mx_vmo_op_range(vmo, MX_VMO_OP_PREFETCH, 0, size, NULL, 0);
+    EXPECT_EQ(NO_ERROR, status, "prefetch");
+
+    // it happens in the background, so give it a while
+    uint8_t bits = 0;
+    for (int i = 0; i < 100; i++) {
+        status = residency(vmo, size, &bits);
+        if (status != NO_ERROR || bits == 0xff)
+            break;
+        mx_nanosleep(MX_MSEC(10));
+    }
+    EXPECT_EQ(NO_ERROR, status, "residency");
+    EXPECT_EQ(0xffu, bits, "prefetched pages committed");
+
+    // the touched pages are the ones that were there before
+    c = 0;
+    EXPECT_EQ(1, mx_vmo_read(vmo, &c, PAGE_SIZE * 2, 1), "read page 2");
+    EXPECT_EQ(0x5au, c, "page 2 kept");
+    c = 0;
+    EXPECT_EQ(1, mx_vmo_read(vmo, &c, PAGE_SIZE * 5, 1), "read page 5");
+    EXPECT_EQ(0x5au, c, "page 5 kept");
+
+    status = mx_handle_close(vmo);
+    EXPECT_EQ(NO_ERROR, status, "handle_close");
+
+    END_TEST;
+}
+
+bool vmo_large_page_test() {
+    BEGIN_TEST;
+
+    mx_status_t status;
+    const size_t large = 2 * 1024 * 1024;
+    const size_t size = large * 2;
+
+    mx_handle_t vmo = mx_vmo_create_etc(size, ~MX_VMO_FLAG_MASK);
+    EXPECT_EQ(ERR_INVALID_ARGS, vmo, "undefined flags");
+
+    vmo = mx_vmo_create_etc(size, MX_VMO_FLAG_LARGE_PAGES);
+    EXPECT_LT(0, vmo, "vm_object_create");
+
+    uintptr_t ptr;
+    status = mx_process_map_vm(mx_process_self(), vmo, 0, size, &ptr,
+                               MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE);
+    EXPECT_EQ(NO_ERROR, status, "vm_map");
+    EXPECT_EQ(0u, ptr % large, "mapping lined up with large pages");
+
+    // one touch brings in the whole chunk, unless it had to fall back to
+    // separate pages
+    volatile uint8_t* p = (volatile uint8_t*)ptr;
+    p[PAGE_SIZE * 3] = 1;
+    uint8_t bits[large / PAGE_SIZE / 8];
+    status = mx_vmo_op_range(vmo, MX_VMO_OP_RESIDENCY, 0, large, bits, sizeof(bits));
+    EXPECT_EQ(NO_ERROR, status, "residency");
+    bool whole = bits[0] == 0xff;
+    for (size_t i = 0; i < sizeof(bits); i++) {
+        if (whole)
+            EXPECT_EQ(0xffu, bits[i], "whole chunk committed");
+        else
+            EXPECT_EQ(i == 0 ? 0x08u : 0u, bits[i], "one page committed");
+    }
+
+    mx_info_process_stats_t stats = {};
+    mx_ssize_t ret = mx_object_get_info(mx_process_self(), MX_INFO_PROCESS_STATS,
+                                        sizeof(stats.rec), &stats, sizeof(stats));
+    EXPECT_EQ((mx_ssize_t)sizeof(stats), ret, "process stats");
+    EXPECT_LE(stats.rec.large_page_bytes, stats.rec.committed_bytes, "large pages are committed");
+    if (whole)
+        EXPECT_GE(stats.rec.large_page_bytes, large, "large page counted");
+
+    // the rest of the chunk reads back as zeroes, and takes writes
+    for (size_t i = 0; i < large; i += PAGE_SIZE) {
+        EXPECT_EQ(i == PAGE_SIZE * 3 ? 1u : 0u, p[i], "reading large page");
+        p[i] = (uint8_t)(i / PAGE_SIZE);
+    }
+
+    // a chunk is decommitted whole or not at all
+    status = mx_vmo_op_range(vmo, MX_VMO_OP_DECOMMIT, PAGE_SIZE * 5, PAGE_SIZE, NULL, 0);
+    EXPECT_EQ(ERR_INVALID_ARGS, status, "decommit part of a chunk");
+    status = mx_vmo_op_range(vmo, MX_VMO_OP_DECOMMIT, 0, large + PAGE_SIZE, NULL, 0);
+    EXPECT_EQ(ERR_INVALID_ARGS, status, "decommit past a chunk");
+    for (size_t i = 0; i < large; i += PAGE_SIZE)
+        EXPECT_EQ((uint8_t)(i / PAGE_SIZE), p[i], "chunk kept");
+
+    status = mx_vmo_op_range(vmo, MX_VMO_OP_DECOMMIT, 0, large, NULL, 0);
+    EXPECT_EQ(NO_ERROR, status, "decommit chunk");
+    for (size_t i = 0; i < large; i += PAGE_SIZE)
+        EXPECT_EQ(0u, p[i], "decommitted chunk reads zero");
+
+    // the tail of an object that isn't a whole chunk is fine too
+    mx_handle_t odd = mx_vmo_create_etc(large + PAGE_SIZE * 3, MX_VMO_FLAG_LARGE_PAGES);
+    EXPECT_LT(0, odd, "vm_object_create");
+    status = mx_vmo_op_range(odd, MX_VMO_OP_COMMIT, 0, large + PAGE_SIZE * 3, NULL, 0);
+    EXPECT_EQ(NO_ERROR, status, "commit");
+    uint8_t c = 0x5a;
+    EXPECT_EQ(1, mx_vmo_write(odd, &c, large + PAGE_SIZE * 2, 1), "write tail");
+    c = 0;
+    EXPECT_EQ(1, mx_vmo_read(odd, &c, large + PAGE_SIZE * 2, 1), "read tail");
+    EXPECT_EQ(0x5au, c, "tail data");
+    status = mx_vmo_op_range(odd, MX_VMO_OP_DECOMMIT, large + PAGE_SIZE, PAGE_SIZE, NULL, 0);
+    EXPECT_EQ(NO_ERROR, status, "decommit part of the tail");
+    mx_handle_close(odd);
+
+    status = mx_process_unmap_vm(mx_process_self(), ptr, 0);
+    EXPECT_EQ(NO_ERROR, status, "vm_unmap");
+    status = mx_handle_close(vmo);
+    EXPECT_EQ(NO_ERROR, status, "handle_close");
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(vmo_tests)
 RUN_TEST(vmo_create_test);
 RUN_TEST(vmo_read_write_test);
@@ -336,6 +583,10 @@ RUN_TEST(vmo_read_only_map_test);
 RUN_TEST(vmo_resize_test);
 RUN_TEST(vmo_rights_test);
 RUN_TEST(vmo_lookup_test);
+RUN_TEST(vmo_decommit_test);
+RUN_TEST(vmo_residency_test);
+RUN_TEST(vmo_prefetch_test);
+RUN_TEST(vmo_large_page_test);
 END_TEST_CASE(vmo_tests)
 
 int main(int argc, char** argv) {
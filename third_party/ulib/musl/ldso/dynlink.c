@@ -1395,6 +1395,8 @@ static void* dls3(mx_handle_t exec_vmo, int argc, char** argv) {
                     libc.tls_size);
             _exit(127);
         }
+        /* The thread cache hangs off the old thread structure. */
+        __malloc_thread_cleanup();
         __init_tp(__copy_tls(initial_tls));
     } else {
         size_t tmp_tls_size = libc.tls_size;
@@ -22,6 +22,7 @@ static void dummy_0(void) {}
 weak_alias(dummy_0, __acquire_ptc);
 weak_alias(dummy_0, __dl_thread_cleanup);
 weak_alias(dummy_0, __do_orphaned_stdio_locks);
+weak_alias(dummy_0, __malloc_thread_cleanup);
 weak_alias(dummy_0, __pthread_tsd_run_dtors);
 weak_alias(dummy_0, __release_ptc);
 
@@ -272,6 +273,7 @@ _Noreturn void pthread_exit(void* result) {
 
     __do_orphaned_stdio_locks();
     __dl_thread_cleanup();
+    __malloc_thread_cleanup();
 
     mxr_thread_exit(mxr_thread);
 }
@@ -47,6 +47,7 @@ struct pthread {
     uintptr_t canary_at_end;
     void** dtv_copy;
     mxr_thread_t* mxr_thread;
+    void* malloc_cache;
 };
 
 struct __timer {
@@ -136,6 +137,8 @@ void __acquire_ptc(void);
 void __release_ptc(void);
 void __inhibit_ptc(void);
 
+void __malloc_thread_cleanup(void);
+
 void __block_all_sigs(void*);
 void __block_app_sigs(void*);
 void __restore_sigs(void*);
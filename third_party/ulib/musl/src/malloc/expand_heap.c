@@ -12,10 +12,27 @@ void* __mmap(void*, size_t, int, int, int, off_t);
  * an input and an output, since the caller needs to know the size
  * allocated, which will be larger than requested due to page alignment
  * and mmap minimum size rules. The caller is responsible for locking
- * to prevent concurrent calls. */
+ * to prevent concurrent calls.
+ *
+ * Each mmap is a new vmo and mapping, so rather than map just what
+ * was asked for, map a span of SPAN_MIN doubling up to SPAN_MAX and
+ * hand out the rest of it on later calls.  Pages of a span are only
+ * committed when touched, and the allocator decommits the middle of
+ * large free chunks again, so a big span costs little more than the
+ * address space.  Spans are placed end to end, so the heap stays
+ * contiguous and free chunks can merge across them. */
+
+#if _LP64
+#define SPAN_MIN (1u << 20)
+#define SPAN_MAX (16u << 20)
+#else
+#define SPAN_MIN (256u << 10)
+#define SPAN_MAX (4u << 20)
+#endif
 
 void* __expand_heap(size_t* pn) {
-    static unsigned mmap_step;
+    static size_t span_size = SPAN_MIN;
+    static char *span_next, *span_end;
     size_t n = *pn;
     // TODO(teisenbe): Remove this and the use of MAP_FIXED below when it's
     // time to do ASLR.  This is present for now to move the heap away from
@@ -34,15 +51,25 @@ void* __expand_heap(size_t* pn) {
     }
     n += -n & PAGE_SIZE - 1;
 
-    size_t min = (size_t)PAGE_SIZE << mmap_step / 2;
-    if (n < min)
-        n = min;
-    void* area = __mmap(next_base, n, PROT_READ | PROT_WRITE, MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    if (area == MAP_FAILED)
-        return 0;
+    if (n > (size_t)(span_end - span_next)) {
+        size_t len = span_size;
+        if (len < n)
+            len = n;
+        void* area = __mmap(next_base, len, PROT_READ | PROT_WRITE, MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (area == MAP_FAILED)
+            return 0;
+        // The rest of the old span is kept if the new one follows it.
+        if (area != span_end)
+            span_next = area;
+        span_end = (char*)area + len;
+        next_base = span_end;
+        if (span_size < SPAN_MAX)
+            span_size *= 2;
+    }
+
+    void* area = span_next;
+    span_next += n;
     *pn = n;
-    next_base = area + n;
-    mmap_step++;
 
     return area;
 }
@@ -2,6 +2,7 @@
 #include "atomic.h"
 #include "libc.h"
 #include "malloc_impl.h"
+#include "pthread_impl.h"
 #include <errno.h>
 #include <limits.h>
 #include <stdint.h>
@@ -128,6 +129,8 @@ void __dump_heap(int x)
 
 void* __expand_heap(size_t*);
 
+static void bin_free(struct chunk*);
+
 static struct chunk* expand_heap(size_t n) {
     static mtx_t heap_lock;
     static void* end;
@@ -281,16 +284,15 @@ static void trim(struct chunk* self, size_t n) {
     next->psize = n1 - n | C_INUSE;
     self->csize = n | C_INUSE;
 
-    free(CHUNK_TO_MEM(split));
+    bin_free(split);
 }
 
-void* malloc(size_t n) {
+/* alloc_chunk - the allocator proper, below the thread caches.
+ * Takes a size already passed through adjust_size. */
+static struct chunk* alloc_chunk(size_t n) {
     struct chunk* c;
     int i, j;
 
-    if (adjust_size(&n) < 0)
-        return 0;
-
     if (n > MMAP_THRESHOLD) {
         size_t len = n + OVERHEAD + PAGE_SIZE - 1 & -PAGE_SIZE;
         char* base = __mmap(0, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
@@ -299,7 +301,7 @@ void* malloc(size_t n) {
         c = (void*)(base + SIZE_ALIGN - OVERHEAD);
         c->csize = len - (SIZE_ALIGN - OVERHEAD);
         c->psize = SIZE_ALIGN - OVERHEAD;
-        return CHUNK_TO_MEM(c);
+        return c;
     }
 
     i = bin_index_up(n);
@@ -332,7 +334,152 @@ void* malloc(size_t n) {
     /* Now patch up in case we over-allocated */
     trim(c, n);
 
-    return CHUNK_TO_MEM(c);
+    return c;
+}
+
+/* Thread caches
+ *
+ * Each thread keeps a few free chunks of every small size in front
+ * of the bins, so most malloc and free calls take no lock at all.
+ * Cached chunks keep their in-use bits: to the rest of the heap they
+ * are allocated, so nothing merges with them and memalign, realloc
+ * and malloc_usable_size only ever see ordinary chunks.  An empty
+ * class is refilled from one bin allocation carved into several
+ * chunks, and a full one hands half of its chunks back to the bins,
+ * where they merge and are reclaimed as usual. */
+
+#define TCACHE_CLASSES 32
+#define TCACHE_MAX (TCACHE_CLASSES * SIZE_ALIGN)
+#define TCACHE_BYTES 4096
+#define TCACHE_DEAD ((void*)-1)
+
+struct tcache {
+    struct chunk* head[TCACHE_CLASSES];
+    unsigned short count[TCACHE_CLASSES];
+};
+
+static inline int tcache_class(size_t n) {
+    return n / SIZE_ALIGN - 1;
+}
+
+/* How many chunks of a class may be cached: TCACHE_BYTES worth,
+ * which is at least 4 for the largest class. */
+static inline unsigned tcache_limit(int i) {
+    return TCACHE_BYTES / ((i + 1) * SIZE_ALIGN);
+}
+
+static struct tcache* get_tcache(void) {
+    /* Nothing to hang a cache on before the thread pointer is set. */
+    if (!mxr_tp_get())
+        return 0;
+    pthread_t self = __pthread_self();
+    struct tcache* tc = self->malloc_cache;
+    if (tc == TCACHE_DEAD)
+        return 0;
+    if (!tc) {
+        size_t n = sizeof *tc;
+        struct chunk* c;
+        adjust_size(&n);
+        if (!(c = alloc_chunk(n)))
+            return 0;
+        tc = CHUNK_TO_MEM(c);
+        memset(tc, 0, sizeof *tc);
+        self->malloc_cache = tc;
+    }
+    return tc;
+}
+
+static inline void tcache_push(struct tcache* tc, int i, struct chunk* c) {
+    c->next = tc->head[i];
+    tc->head[i] = c;
+    tc->count[i]++;
+}
+
+static void tcache_flush(struct tcache* tc, int i, unsigned n) {
+    while (n--) {
+        struct chunk* c = tc->head[i];
+        tc->head[i] = c->next;
+        tc->count[i]--;
+        bin_free(c);
+    }
+}
+
+/* Carve one chunk of half a class's worth into chunks of size n,
+ * caching all but the last, which goes to the caller.  That one may
+ * be a little larger, when the bins had no exact fit to give. */
+static struct chunk* tcache_fill(struct tcache* tc, int i, size_t n) {
+    struct chunk *c, *next;
+    size_t left;
+
+    if (!(c = alloc_chunk(tcache_limit(i) / 2 * n)))
+        return 0;
+    left = CHUNK_SIZE(c);
+    while (left >= 2 * n) {
+        next = (void*)((char*)c + n);
+        next->psize = n | C_INUSE;
+        c->csize = n | C_INUSE;
+        tcache_push(tc, i, c);
+        left -= n;
+        c = next;
+    }
+    c->csize = left | C_INUSE;
+    NEXT_CHUNK(c)->psize = left | C_INUSE;
+    return c;
+}
+
+static struct chunk* tcache_get(size_t n) {
+    struct tcache* tc = get_tcache();
+    struct chunk* c;
+    int i = tcache_class(n);
+
+    if (!tc)
+        return 0;
+    if (!(c = tc->head[i]))
+        return tcache_fill(tc, i, n);
+    tc->head[i] = c->next;
+    tc->count[i]--;
+    return c;
+}
+
+static int tcache_put(struct chunk* c) {
+    struct tcache* tc = get_tcache();
+    int i = tcache_class(CHUNK_SIZE(c));
+
+    if (!tc)
+        return 0;
+#if LK_DEBUGLEVEL > 1
+    memset(CHUNK_TO_MEM(c), FREE_FILL, CHUNK_SIZE(c) - OVERHEAD);
+#endif
+    if (tc->count[i] >= tcache_limit(i))
+        tcache_flush(tc, i, tc->count[i] / 2);
+    tcache_push(tc, i, c);
+    return 1;
+}
+
+/* Called as a thread exits, and by the dynamic linker as it moves
+ * the initial thread to its final thread structure.  Anything the
+ * thread frees after this goes straight to the bins. */
+void __malloc_thread_cleanup(void) {
+    pthread_t self = __pthread_self();
+    struct tcache* tc = self->malloc_cache;
+
+    if (!tc || tc == TCACHE_DEAD)
+        return;
+    self->malloc_cache = TCACHE_DEAD;
+    for (int i = 0; i < TCACHE_CLASSES; i++)
+        tcache_flush(tc, i, tc->count[i]);
+    bin_free(MEM_TO_CHUNK(tc));
+}
+
+void* malloc(size_t n) {
+    struct chunk* c;
+
+    if (adjust_size(&n) < 0)
+        return 0;
+
+    if (n > TCACHE_MAX || !(c = tcache_get(n)))
+        c = alloc_chunk(n);
+    return c ? CHUNK_TO_MEM(c) : 0;
 }
 
 void* __malloc0(size_t n) {
@@ -422,18 +569,14 @@ void* realloc(void* p, size_t n) {
     return new;
 }
 
-// This is static so __donate_heap (below) can call it without PLT
-// indirection.  The public name free is an alias for this.
-static void internal_free(void* p) {
-    struct chunk* self = MEM_TO_CHUNK(p);
+/* bin_free - returns a chunk to the bins, merging it with its free
+ * neighbours, or unmaps it if it was mapped on its own. */
+static void bin_free(struct chunk* self) {
     struct chunk* next;
     size_t final_size, new_size, size;
     int reclaim = 0;
     int i;
 
-    if (!p)
-        return;
-
     if (IS_MMAPPED(self)) {
         size_t extra = self->psize;
         char* base = (char*)self - extra;
@@ -446,7 +589,7 @@ static void internal_free(void* p) {
     }
 
 #if LK_DEBUGLEVEL > 1
-    memset(p, FREE_FILL, CHUNK_SIZE(self) - OVERHEAD);
+    memset(CHUNK_TO_MEM(self), FREE_FILL, CHUNK_SIZE(self) - OVERHEAD);
 #endif
     final_size = new_size = CHUNK_SIZE(self);
     next = NEXT_CHUNK(self);
@@ -497,21 +640,38 @@ static void internal_free(void* p) {
     self->next->prev = self;
     self->prev->next = self;
 
-    /* Replace middle of large chunks with fresh zero pages */
+    /* Replace middle of large chunks with fresh zero pages: madvise
+     * decommits them, handing the memory back to the system until the
+     * span is used again */
     if (reclaim) {
         uintptr_t a = (uintptr_t)self + SIZE_ALIGN + PAGE_SIZE - 1 & -PAGE_SIZE;
         uintptr_t b = (uintptr_t)next - SIZE_ALIGN & -PAGE_SIZE;
-#if 1
-        __madvise((void*)a, b - a, MADV_DONTNEED);
-#else
-        __mmap((void*)a, b - a, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1,
-               0);
-#endif
+        if (b > a)
+            __madvise((void*)a, b - a, MADV_DONTNEED);
     }
 
     unlock_bin(i);
 }
 
+// This is static so __donate_heap (below) can call it without PLT
+// indirection.  The public name free is an alias for this.
+static void internal_free(void* p) {
+    struct chunk* self = MEM_TO_CHUNK(p);
+
+    if (!p)
+        return;
+
+    if (!IS_MMAPPED(self) && CHUNK_SIZE(self) <= TCACHE_MAX) {
+        /* Crash on corrupted footer (likely from buffer overflow) */
+        if (NEXT_CHUNK(self)->psize != self->csize)
+            a_crash();
+        if (tcache_put(self))
+            return;
+    }
+
+    bin_free(self);
+}
+
 void free(void*) __attribute__((alias("internal_free")));
 
 // "Donate" a memory block to the heap by setting up a minimal malloc
@@ -1,10 +1,45 @@
 #include "libc.h"
-#include "syscall.h"
+#include <errno.h>
+#include <magenta/syscalls.h>
+#include <magenta/types.h>
 #include <sys/mman.h>
 
 int __madvise(void* addr, size_t len, int advice) {
-    // TODO(kulakowski) Implement more mmap
-    return 0;
+    uint32_t op;
+    switch (advice) {
+    case MADV_DONTNEED:
+    case MADV_FREE:
+        /* NOTE: the pages go back to the system and read back as zeroes,
+         * even in shared mappings, which is what malloc wants.
+         */
+        op = MX_VMO_OP_DECOMMIT;
+        break;
+    case MADV_WILLNEED:
+        op = MX_VMO_OP_PREFETCH;
+        break;
+    default:
+        /* everything else is only a hint */
+        return 0;
+    }
+
+    mx_status_t status = _mx_process_op_vm(libc.proc, op, (uintptr_t)addr, len);
+    if (!status) return 0;
+
+    switch (status) {
+    case ERR_ACCESS_DENIED:
+        errno = EACCES;
+        break;
+    case ERR_NOT_FOUND:
+        errno = ENOMEM;
+        break;
+    case ERR_NO_RESOURCES:
+        errno = EAGAIN;
+        break;
+    default:
+        errno = EINVAL;
+        break;
+    }
+    return -1;
 }
 
 weak_alias(__madvise, madvise);
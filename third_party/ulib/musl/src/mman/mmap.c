@@ -2,6 +2,7 @@
 #include <errno.h>
 #include <limits.h>
 #include <magenta/syscalls.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <sys/mman.h>
 #include <unistd.h>
@@ -14,6 +15,102 @@ weak_alias(dummy, __vm_wait);
 #define UNIT SYSCALL_MMAP2_UNIT
 #define OFF_MASK ((-0x2000ULL << (8 * sizeof(long) - 1)) | (UNIT - 1))
 
+// Provided by mxio, when it is linked in.  The flags must match
+// MXIO_MMAP_FLAG_* in <mxio/io.h>.
+mx_status_t mxio_get_vmo(int fd, uint32_t flags, mx_handle_t* vmo,
+                         size_t* off, size_t* len) __attribute__((weak));
+#define MXIO_MMAP_FLAG_READ (1u << 0)
+#define MXIO_MMAP_FLAG_WRITE (1u << 1)
+#define MXIO_MMAP_FLAG_EXEC (1u << 2)
+
+// File mappings map the filesystem's page cache vmo directly, so they
+// share pages with every other mapping and with read() and write().
+// There is no copy-on-write yet, so a private writable mapping (or one
+// whose file data is not page aligned within the vmo) gets a snapshot
+// of the file in a fresh vmo instead.
+static void* mmap_file(void* start, size_t len, int prot, int flags,
+                       int fd, off_t off, uint32_t mx_flags) {
+    if (&mxio_get_vmo == NULL) {
+        errno = ENODEV;
+        return MAP_FAILED;
+    }
+
+    bool copy = (flags & MAP_PRIVATE) && (prot & PROT_WRITE);
+    uint32_t vmo_flags = MXIO_MMAP_FLAG_READ;
+    if ((flags & MAP_SHARED) && (prot & PROT_WRITE))
+        vmo_flags |= MXIO_MMAP_FLAG_WRITE;
+    if (prot & PROT_EXEC)
+        vmo_flags |= MXIO_MMAP_FLAG_EXEC;
+
+    mx_handle_t vmo;
+    size_t vmo_off, vmo_len;
+    mx_status_t status = mxio_get_vmo(fd, vmo_flags, &vmo, &vmo_off, &vmo_len);
+    if (status < 0) {
+        switch (status) {
+        case ERR_BAD_HANDLE:
+            errno = EBADF;
+            break;
+        case ERR_ACCESS_DENIED:
+            errno = EACCES;
+            break;
+        default:
+            errno = ENODEV;
+            break;
+        }
+        return MAP_FAILED;
+    }
+    if ((vmo_off + off) & (PAGE_SIZE - 1))
+        copy = true;
+
+    uintptr_t ptr = (uintptr_t)start;
+    if (!copy) {
+        status = _mx_process_map_vm(libc.proc, vmo, vmo_off + off, len,
+                                    &ptr, mx_flags);
+        _mx_handle_close(vmo);
+        if (status < 0) {
+            errno = (status == ERR_ACCESS_DENIED) ? EACCES : ENXIO;
+            return MAP_FAILED;
+        }
+        return (void*)ptr;
+    }
+
+    mx_handle_t copy_vmo = _mx_vmo_create(len);
+    if (copy_vmo < 0) {
+        _mx_handle_close(vmo);
+        errno = ENOMEM;
+        return MAP_FAILED;
+    }
+    status = _mx_process_map_vm(libc.proc, copy_vmo, 0, len, &ptr,
+                                mx_flags | MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE);
+    _mx_handle_close(copy_vmo);
+    if (status < 0) {
+        _mx_handle_close(vmo);
+        errno = ENOMEM;
+        return MAP_FAILED;
+    }
+    if ((size_t)off < vmo_len) {
+        size_t xfer = vmo_len - off;
+        if (xfer > len)
+            xfer = len;
+        mx_ssize_t n = _mx_vmo_read(vmo, (void*)ptr, vmo_off + off, xfer);
+        if (n != (mx_ssize_t)xfer) {
+            _mx_handle_close(vmo);
+            _mx_process_unmap_vm(libc.proc, ptr, 0);
+            errno = EIO;
+            return MAP_FAILED;
+        }
+    }
+    _mx_handle_close(vmo);
+    if (!(prot & PROT_WRITE)) {
+        if (_mx_process_protect_vm(libc.proc, ptr, 0, mx_flags & ~MX_VM_FLAG_FIXED) < 0) {
+            _mx_process_unmap_vm(libc.proc, ptr, 0);
+            errno = EACCES;
+            return MAP_FAILED;
+        }
+    }
+    return (void*)ptr;
+}
+
 void* __mmap(void* start, size_t len, int prot, int flags, int fd, off_t off) {
     if (off & OFF_MASK) {
         errno = EINVAL;
@@ -43,22 +140,22 @@ void* __mmap(void* start, size_t len, int prot, int flags, int fd, off_t off) {
 
     //printf("__mmap start %p, len %zu prot %u flags %u fd %d off %llx\n", start, len, prot, flags, fd, off);
 
+    // build magenta flags for this
+    uint32_t mx_flags = 0;
+    mx_flags |= (prot & PROT_READ) ? MX_VM_FLAG_PERM_READ : 0;
+    mx_flags |= (prot & PROT_WRITE) ? MX_VM_FLAG_PERM_WRITE : 0;
+    mx_flags |= (prot & PROT_EXEC) ? MX_VM_FLAG_PERM_EXECUTE : 0;
+    mx_flags |= (flags & MAP_FIXED) ? MX_VM_FLAG_FIXED : 0;
+
+    // round up to page size
+    len = (len + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
     // look for a specific case that we can handle, from pthread_create
     if ((flags & MAP_ANON) && (fd < 0)) {
-        // round up to page size
-        len = (len + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
-
         mx_handle_t vmo = _mx_vmo_create(len);
         if (vmo < 0)
             return MAP_FAILED;
 
-        // build magenta flags for this
-        uint32_t mx_flags = 0;
-        mx_flags |= (prot & PROT_READ) ? MX_VM_FLAG_PERM_READ : 0;
-        mx_flags |= (prot & PROT_WRITE) ? MX_VM_FLAG_PERM_WRITE : 0;
-        mx_flags |= (prot & PROT_EXEC) ? MX_VM_FLAG_PERM_EXECUTE : 0;
-        mx_flags |= (flags & MAP_FIXED) ? MX_VM_FLAG_FIXED : 0;
-
         uintptr_t ptr = (uintptr_t)start;
         mx_status_t status = _mx_process_map_vm(libc.proc, vmo, 0, len,
                                                 &ptr, mx_flags);
@@ -69,8 +166,9 @@ void* __mmap(void* start, size_t len, int prot, int flags, int fd, off_t off) {
         }
 
         return (void*)ptr;
+    } else if (!(flags & MAP_ANON)) {
+        return mmap_file(start, len, prot, flags, fd, off, mx_flags);
     } else {
-        // TODO(kulakowski) mxio file mapping
         return MAP_FAILED;
     }
 }